@@ -0,0 +1,341 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpuid.h"
+#include "cpuinfo.h"
+#include "hwctrl.h"
+#include "memctrl.h"
+#include "simd.h"
+#include "tsc.h"
+
+#include "string.h"
+
+#include "config.h"
+#include "display.h"
+#include "test.h"
+
+#include "test_kernels.h"
+
+#include "autotune.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define RECORD_NAME         "Memtest86+KernelTune"
+
+#define RECORD_SIGNATURE    0x544b544d  // "MTKT"
+
+#define MIN_SCRATCH_SIZE    (16 << 20)  // bytes
+#define MAX_SCRATCH_SIZE    (64 << 20)  // bytes
+
+#define NUM_RUNS            2           // the fastest is taken
+
+#define NUM_LEVELS          (SIMD_AVX512 + 1)
+
+#if TESTWORD_WIDTH > 32
+#define PATTERN             UINT64_C(0x5555aaaa3333cccc)
+#else
+#define PATTERN             0x3333cccc
+#endif
+
+#define SEED                0x12345678
+
+#define SMT_UNKNOWN         0
+#define SMT_ALL             1
+#define SMT_PAIR            2
+
+//------------------------------------------------------------------------------
+// Types
+//------------------------------------------------------------------------------
+
+// The operations that are tuned. The walking ones, streaming fill, and own
+// address operations are only used by a few tests, so they are left as chosen
+// by test_kernels_init().
+
+typedef enum {
+    OP_CHECK_WRITE,
+    OP_PATTERN_CHECK,
+    OP_PAIR_CHECK,
+    OP_RANDOM_FILL,
+    OP_RANDOM_CHECK_WRITE,
+    OP_BLOCK_FILL,
+    OP_COPY,
+    NUM_OPS
+} op_t;
+
+// The layout is the same in the 32-bit and 64-bit builds. The choices are
+// recorded as SIMD levels. The SMT placement is measured later, by the tests
+// themselves, and is recorded as SMT_UNKNOWN until then.
+
+typedef struct {
+    uint32_t    signature;
+    uint32_t    checksum;
+    uint32_t    cpuid_version;
+    uint32_t    simd_level;
+    uint32_t    dram_freq;
+    uint8_t     choice[NUM_OPS];
+    uint8_t     smt_placement;
+} record_t;
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+static const char *op_name[NUM_OPS] = {
+    "check_write",
+    "pattern_check",
+    "pair_check",
+    "random_fill",
+    "random_check_write",
+    "block_fill",
+    "copy_words"
+};
+
+static const test_kernel_t *level_kernel[NUM_LEVELS];
+
+static test_kernel_t    tuned_kernel;
+
+static record_t         record;
+
+static bool             record_valid = false;   // record should be saved when changed
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+// Returns the two's complement of the sum of the 32-bit words in the record,
+// with the checksum field taken as zero.
+static uint32_t checksum(const record_t *rec)
+{
+    const uint32_t *word = (const uint32_t *)rec;
+
+    uint32_t sum = 0;
+    for (uintptr_t i = 0; i < sizeof(record_t) / sizeof(uint32_t); i++) {
+        sum += word[i];
+    }
+    return -(sum - rec->checksum);
+}
+
+// Fills the record header with the properties of this machine that the best
+// choices depend on.
+static void init_record(void)
+{
+    memset(&record, 0, sizeof(record));
+    record.signature     = RECORD_SIGNATURE;
+    record.cpuid_version = cpuid_info.version.raw[0];
+    record.simd_level    = simd_level;
+    record.dram_freq     = imc.freq;
+}
+
+static bool load_record(void)
+{
+    init_record();
+    record_t saved;
+    if (!read_nv_variable(RECORD_NAME, &saved, sizeof(saved))) {
+        return false;
+    }
+    if (saved.checksum != checksum(&saved)) {
+        return false;
+    }
+    record.checksum = saved.checksum;
+    memcpy(record.choice, saved.choice, sizeof(record.choice));
+    record.smt_placement = saved.smt_placement;
+    if (memcmp(&record, &saved, sizeof(record)) != 0) {
+        return false;
+    }
+    for (int op = 0; op < NUM_OPS; op++) {
+        if (record.choice[op] > simd_level) {
+            return false;
+        }
+    }
+    return record.smt_placement <= SMT_PAIR;
+}
+
+// Sets up the memory contents expected by the operation.
+static void prepare(op_t op, testword_t *start, testword_t *end)
+{
+    switch (op) {
+      case OP_CHECK_WRITE:
+      case OP_PATTERN_CHECK:
+      case OP_PAIR_CHECK:
+        fill_words(start, end, PATTERN);
+        break;
+      case OP_RANDOM_CHECK_WRITE:
+        scalar_kernel.random_fill(start, end, SEED, false);
+        break;
+      default:
+        break;
+    }
+}
+
+// Returns the fastest time taken by the kernel to perform the operation on
+// the range, in TSC cycles.
+static uint64_t time_op(const test_kernel_t *kernel, op_t op, testword_t *start, testword_t *end)
+{
+    uintptr_t  half_words = (end - start + 1) / 2;
+    testword_t *half      = start + half_words;
+
+    uint64_t best_time = UINT64_MAX;
+    for (int run = 0; run < NUM_RUNS; run++) {
+        prepare(op, start, end);
+        uint64_t start_time = get_tsc();
+        switch (op) {
+          case OP_CHECK_WRITE:
+            kernel->check_write_up(start, end, PATTERN, ~PATTERN);
+            kernel->check_write_down(start, end, ~PATTERN, PATTERN);
+            break;
+          case OP_PATTERN_CHECK:
+            kernel->pattern_check(start, end, PATTERN);
+            break;
+          case OP_PAIR_CHECK:
+            kernel->pair_check(start, end);
+            break;
+          case OP_RANDOM_FILL:
+            kernel->random_fill(start, end, SEED, false);
+            break;
+          case OP_RANDOM_CHECK_WRITE:
+            kernel->random_check_write(start, end, SEED, 0);
+            break;
+          case OP_BLOCK_FILL:
+            kernel->block_fill(start, end);
+            break;
+          case OP_COPY:
+            kernel->copy_words(half, start, half_words);
+            break;
+          default:
+            break;
+        }
+        uint64_t time = get_tsc() - start_time;
+        if (time < best_time) {
+            best_time = time;
+        }
+    }
+    return best_time;
+}
+
+static bool tune(void)
+{
+    size_t size = (size_t)l3_cache * 4 * 1024;
+    if (size < MIN_SCRATCH_SIZE) size = MIN_SCRATCH_SIZE;
+    if (size > MAX_SCRATCH_SIZE) size = MAX_SCRATCH_SIZE;
+
+    uintptr_t scratch = find_scratch_region(size);
+    if (scratch == 0) {
+        return false;
+    }
+    testword_t *start = (testword_t *)scratch;
+    testword_t *end   = (testword_t *)(scratch + size) - 1;
+
+    // Let the core clock ramp up before the first measurement.
+    fill_words(start, end, 0);
+
+    init_record();
+    for (int op = 0; op < NUM_OPS; op++) {
+        uint64_t best_time = UINT64_MAX;
+        for (int level = SIMD_NONE; level <= (int)simd_level; level++) {
+            uint64_t time = time_op(level_kernel[level], (op_t)op, start, end);
+            if (time < best_time) {
+                best_time = time;
+                record.choice[op] = level;
+            }
+        }
+    }
+    return true;
+}
+
+static void install_choices(void)
+{
+    tuned_kernel = *test_kernel;
+    tuned_kernel.name = "tuned";
+
+    const test_kernel_t *kernel;
+
+    kernel = level_kernel[record.choice[OP_CHECK_WRITE]];
+    tuned_kernel.check_write_up     = kernel->check_write_up;
+    tuned_kernel.check_write_down   = kernel->check_write_down;
+
+    kernel = level_kernel[record.choice[OP_PATTERN_CHECK]];
+    tuned_kernel.pattern_check      = kernel->pattern_check;
+
+    kernel = level_kernel[record.choice[OP_PAIR_CHECK]];
+    tuned_kernel.pair_check         = kernel->pair_check;
+
+    kernel = level_kernel[record.choice[OP_RANDOM_FILL]];
+    tuned_kernel.random_fill        = kernel->random_fill;
+
+    kernel = level_kernel[record.choice[OP_RANDOM_CHECK_WRITE]];
+    tuned_kernel.random_check_write = kernel->random_check_write;
+
+    kernel = level_kernel[record.choice[OP_BLOCK_FILL]];
+    tuned_kernel.block_fill         = kernel->block_fill;
+
+    kernel = level_kernel[record.choice[OP_COPY]];
+    tuned_kernel.copy_words         = kernel->copy_words;
+
+    test_kernel = &tuned_kernel;
+
+    for (int op = 0; op < NUM_OPS; op++) {
+        trace(0, "using %s kernel for %s", level_kernel[record.choice[op]]->name, op_name[op]);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+void autotune_kernels(void)
+{
+    if (forced_kernel >= 0 || simd_level == SIMD_NONE || clks_per_msec == 0) {
+        return;
+    }
+
+    level_kernel[SIMD_NONE]   = &scalar_kernel;
+    level_kernel[SIMD_SSE2]   = &sse2_kernel;
+    level_kernel[SIMD_AVX2]   = &avx2_kernel;
+    level_kernel[SIMD_AVX512] = &avx512_kernel;
+
+    if (load_record()) {
+        trace(0, "using the saved kernel choices");
+        install_choices();
+        record_valid = true;
+        return;
+    }
+
+    // The nobench option asks for a quick start.
+    if (!enable_bench) {
+        return;
+    }
+
+    uint64_t start_time = get_tsc();
+    if (!tune()) {
+        return;
+    }
+    trace(0, "kernels tuned in %i ms", (int)((get_tsc() - start_time) / clks_per_msec));
+    install_choices();
+
+    record.checksum = checksum(&record);
+    write_nv_variable(RECORD_NAME, &record, sizeof(record));
+    record_valid = true;
+}
+
+int autotune_smt_pairing(void)
+{
+    if (!record_valid || record.smt_placement == SMT_UNKNOWN) {
+        return -1;
+    }
+    return record.smt_placement == SMT_PAIR;
+}
+
+void autotune_save_smt_pairing(bool pair)
+{
+    if (!record_valid) {
+        return;
+    }
+    record.smt_placement = pair ? SMT_PAIR : SMT_ALL;
+    record.checksum = checksum(&record);
+    write_nv_variable(RECORD_NAME, &record, sizeof(record));
+}
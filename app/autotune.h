@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+/**
+ * \file
+ *
+ * Provides the start-up kernel autotuner. This times each of the test kernel
+ * variants supported by the CPU on a scratch region of memory, and selects
+ * the fastest one for each operation. The choices are saved in a UEFI
+ * variable, and reused on later boots with the same CPU model and memory
+ * configuration, together with the SMT placement measured by the tests.
+ *
+ *//*
+ * Copyright (C) 2024 Memtest86+ contributors.
+ */
+
+#include <stdbool.h>
+
+/**
+ * Replaces the test kernels selected by test_kernels_init() with the fastest
+ * variant of each operation. Does nothing if the kernel boot option is given
+ * or the CPU only supports the scalar kernels. Must be called after
+ * test_kernels_init() and error_init().
+ */
+void autotune_kernels(void);
+
+/**
+ * Returns 1 if the saved record shows the tests run faster with the two
+ * hardware threads of each core sharing its work (smt=pair), 0 if they run
+ * faster with each thread taking its own share (smt=all), or -1 if this has
+ * not been measured on this machine.
+ */
+int autotune_smt_pairing(void);
+
+/**
+ * Records the SMT placement found to be faster, for use on later boots. Does
+ * nothing if the kernel choices were not saved.
+ */
+void autotune_save_smt_pairing(bool pair);
+
+#endif // AUTOTUNE_H
@@ -25,6 +25,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "config.h"
 #include "display.h"
 
 #include "badram.h"
@@ -34,8 +35,11 @@
 // Constants
 //------------------------------------------------------------------------------
 
-#define MAX_PATTERNS 10
-#define PATTERNS_SIZE (MAX_PATTERNS + 1)
+#define PATTERNS_SIZE (BADRAM_MAX_PATTERNS + 1)
+
+// A pattern that covers more pages than this is excluded from the memory map
+// as a single range spanning all the pages it covers.
+#define MEMMAP_MAX_PAGES 8
 
 // DEFAULT_MASK covers a uintptr_t, since that is the testing granularity.
 #ifdef __x86_64__
@@ -51,6 +55,7 @@
 typedef struct {
     uint64_t   addr;
     uint64_t   mask;
+    uint64_t   next_cost;   // the combi_cost with the next pattern in the array
 } pattern_t;
 
 //------------------------------------------------------------------------------
@@ -113,14 +118,38 @@ static uint64_t combi_cost(uint64_t addr1, uint64_t mask1, uint64_t addr2, uint6
  */
 static bool is_covered(pattern_t pattern)
 {
+    // The pattern is covered if every bit fixed by the existing mask is also
+    // fixed, and has the same value, in the pattern. This is equivalent to a
+    // combi_cost of 0, but doesn't need to count the addresses covered.
     for (int i = 0; i < num_patterns; i++) {
-        if (combi_cost(patterns[i].addr, patterns[i].mask, pattern.addr, pattern.mask) == 0) {
+        uint64_t mask = patterns[i].mask;
+        if ((mask & ~pattern.mask) == 0 && ((patterns[i].addr ^ pattern.addr) & mask) == 0) {
             return true;
         }
     }
     return false;
 }
 
+/*
+ * Update the cached cost of merging the entry at idx with the next entry.
+ */
+static void update_next_cost(int idx)
+{
+    if (idx < 0 || idx >= num_patterns) {
+        return;
+    }
+    if (idx == num_patterns - 1) {
+        patterns[idx].next_cost = UINT64_MAX;
+        return;
+    }
+    patterns[idx].next_cost = combi_cost(
+        patterns[idx].addr,
+        patterns[idx].mask,
+        patterns[idx+1].addr,
+        patterns[idx+1].mask
+    );
+}
+
 /*
  * Find the pair of entries that would be the cheapest to merge.
  * Assumes patterns is sorted by .addr asc and that for each index i, the cheapest entry to merge with is at i-1 or i+1.
@@ -131,16 +160,13 @@ static int cheapest_pair()
     // This is guaranteed to be overwritten with >= 0 as long as num_patterns > 1
     int merge_idx = -1;
 
+    // The pair costs are cached, so this is just a scan of the array, and
+    // only the entries next to an inserted or merged pattern need to have
+    // their costs recalculated.
     uint64_t min_cost = UINT64_MAX;
     for (int i = 0; i < num_patterns - 1; i++) {
-        uint64_t tmp_cost = combi_cost(
-            patterns[i].addr,
-            patterns[i].mask,
-            patterns[i+1].addr,
-            patterns[i+1].mask
-        );
-        if (tmp_cost <= min_cost) {
-            min_cost = tmp_cost;
+        if (patterns[i].next_cost <= min_cost) {
+            min_cost = patterns[i].next_cost;
             merge_idx = i;
         }
     }
@@ -160,6 +186,8 @@ static void remove_pair(int idx)
     patterns[num_patterns - 2].addr = 0u;
     patterns[num_patterns - 2].mask = 0u;
     num_patterns -= 2;
+
+    update_next_cost(idx - 1);
 }
 
 /*
@@ -191,6 +219,9 @@ static void insert_at(pattern_t pattern, int idx)
 
     patterns[idx] = pattern;
     num_patterns++;
+
+    update_next_cost(idx - 1);
+    update_next_cost(idx);
 }
 
 /*
@@ -214,6 +245,66 @@ static void insert_sorted(pattern_t pattern)
     insert_at(pattern, new_idx);
 }
 
+/*
+ * Display one memory map exclusion, returning the next column.
+ */
+static int display_memmap_range(int col, bool first, uint64_t addr, uint64_t size)
+{
+    int text_width = 10 + 1 + 1 + 2 + 16;
+    if (!first) {
+        display_scrolled_message(col, ",");
+        col++;
+    }
+    if (col > (SCREEN_WIDTH - text_width)) {
+        scroll();
+        col = 7;
+    }
+    return display_scrolled_message(col, "%uK$0x%08x%08x",
+                                    (uintptr_t)(size >> 10),
+                                    (uintptr_t)(addr >> 32), (uintptr_t)(addr & 0xFFFFFFFFU));
+}
+
+/*
+ * Display the page ranges covered by the patterns as Linux memmap= exclusions.
+ */
+static void display_memmap(void)
+{
+    scroll();
+    display_scrolled_message(0, "memmap=");
+    int  col   = 7;
+    bool first = true;
+    for (int i = 0; i < num_patterns; i++) {
+        // The bits that vary across the pages covered by the pattern.
+        uint64_t page_mask  = ~(uint64_t)(PAGE_SIZE - 1);
+        uint64_t free_bits  = ~patterns[i].mask & page_mask;
+        uint64_t first_page = patterns[i].addr & ~free_bits & page_mask;
+
+        uint64_t num_pages = 1;
+        for (uint64_t bits = free_bits; bits != 0 && num_pages <= MEMMAP_MAX_PAGES; bits &= bits - 1) {
+            num_pages <<= 1;
+        }
+        bool contiguous = ((free_bits + PAGE_SIZE) & free_bits) == 0;
+        if (contiguous || num_pages > MEMMAP_MAX_PAGES) {
+            // Exclude all the pages between the first and last covered pages.
+            // This is exact if the varying bits are the lowest page bits.
+            uint64_t size = (free_bits | (PAGE_SIZE - 1)) + 1;
+            if (!contiguous) {
+                size = (first_page | free_bits) + PAGE_SIZE - first_page;
+            }
+            col = display_memmap_range(col, first, first_page, size);
+            first = false;
+            continue;
+        }
+        // Exclude each covered page, enumerating the subsets of the free bits.
+        uint64_t sub = 0;
+        do {
+            col = display_memmap_range(col, first, first_page | sub, PAGE_SIZE);
+            first = false;
+            sub = (sub - free_bits) & free_bits;
+        } while (sub != 0);
+    }
+}
+
 //------------------------------------------------------------------------------
 // Public Functions
 //------------------------------------------------------------------------------
@@ -223,8 +314,9 @@ void badram_init(void)
     num_patterns = 0;
 
     for (int idx = 0; idx < PATTERNS_SIZE; idx++) {
-        patterns[idx].addr = 0u;
-        patterns[idx].mask = 0u;
+        patterns[idx].addr      = 0u;
+        patterns[idx].mask      = 0u;
+        patterns[idx].next_cost = UINT64_MAX;
     }
 }
 
@@ -244,9 +336,9 @@ bool badram_insert(testword_t page, testword_t offset)
     insert_sorted(pattern);
 
     // If we have more patterns than the max we need to force a merge
-    if (num_patterns > MAX_PATTERNS) {
+    if (num_patterns > badram_max_patterns) {
         // Find the pair that is the cheapest to merge
-        // merge_idx will be -1 if num_patterns < 2, but that means MAX_PATTERNS = 0 which is not a valid state anyway
+        // merge_idx will be -1 if num_patterns < 2, but that means badram_max_patterns = 0 which is not a valid state anyway
         int merge_idx = cheapest_pair();
 
         pattern_t combined = combined_pattern(merge_idx, merge_idx + 1);
@@ -288,4 +380,6 @@ void badram_display(void)
                                  (uintptr_t)(patterns[i].mask >> 32), (uintptr_t)(patterns[i].mask & 0xFFFFFFFFU));
         col += text_width;
     }
+
+    display_memmap();
 }
@@ -15,6 +15,12 @@
 
 #include "test.h"
 
+/**
+ * The maximum number of patterns that can be selected by the badrampatterns
+ * boot option.
+ */
+#define BADRAM_MAX_PATTERNS     64
+
 /**
  * Initialises the pattern array.
  */
@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpuid.h"
+#include "cpuinfo.h"
+#include "hwctrl.h"
+#include "memsize.h"
+#include "pmem.h"
+#include "screen.h"
+#include "smbus.h"
+
+#include "print.h"
+#include "string.h"
+
+#include "config.h"
+#include "display.h"
+#include "error.h"
+#include "telemetry.h"
+#include "test.h"
+
+#include "tests.h"
+
+#include "baseline.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define RECORD_NAME         "Memtest86+Baseline"
+
+#define RECORD_SIGNATURE    0x4c42544d  // "MTBL"
+
+//------------------------------------------------------------------------------
+// Types
+//------------------------------------------------------------------------------
+
+// The properties of the machine and the configuration that the throughput
+// depends on.
+
+typedef struct {
+    uint32_t    cpuid_version;
+    uint32_t    spd_population;
+    uint32_t    memory_mb;
+    uint32_t    num_cpus;
+    uint32_t    cpu_mode;
+    uint32_t    testword_width;
+} machine_key_t;
+
+// The layout is the same in the 32-bit and 64-bit builds. A record saved
+// by a version with a different number of tests has a different size, so
+// is rejected when it is read. A throughput of 0 means it wasn't measured.
+
+typedef struct {
+    uint32_t    signature;
+    uint32_t    checksum;
+    machine_key_t       key;
+    uint32_t    bandwidth_mbps;
+    uint32_t    test_mbps[NUM_TEST_PATTERNS];
+} record_t;
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+static record_t     saved;
+
+static bool         saved_valid = false;
+
+// The baseline given on the command line.
+static uint32_t     given_bandwidth_mbps = 0;
+static uint32_t     given_test_mbps[NUM_TEST_PATTERNS];
+static bool         given = false;
+
+// The tests already reported as slow in this run, with bit 0 used for the
+// startup bandwidth.
+static uint32_t     reported = 0;
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+// Returns the two's complement of the sum of the 32-bit words in the record,
+// with the checksum field taken as zero.
+static uint32_t checksum(const record_t *rec)
+{
+    const uint32_t *word = (const uint32_t *)rec;
+
+    uint32_t sum = 0;
+    for (uintptr_t i = 0; i < sizeof(record_t) / sizeof(uint32_t); i++) {
+        sum += word[i];
+    }
+    return -(sum - rec->checksum);
+}
+
+static void make_key(machine_key_t *key)
+{
+    extern int num_enabled_cpus;
+
+    memset(key, 0, sizeof(*key));
+    key->cpuid_version  = cpuid_info.version.raw[0];
+    key->spd_population = spd_population;
+    key->memory_mb      = num_pm_pages >> (20 - PAGE_SHIFT);
+    key->num_cpus       = num_enabled_cpus;
+    key->cpu_mode       = cpu_mode;
+    key->testword_width = TESTWORD_WIDTH;
+}
+
+// Returns true if the saved baseline was measured on this machine with the
+// current configuration.
+static bool saved_matches(void)
+{
+    if (!saved_valid || baseline_mode != BASELINE_AUTO) {
+        return false;
+    }
+    machine_key_t key;
+    make_key(&key);
+    return memcmp(&key, &saved.key, sizeof(key)) == 0;
+}
+
+// Returns the baseline throughput in MB/s of the specified test, or 0 if
+// there is none for the current machine and configuration.
+static uint32_t baseline_mbps(int test)
+{
+    if (given) {
+        return test == BASELINE_BANDWIDTH ? given_bandwidth_mbps : given_test_mbps[test];
+    }
+    if (!saved_matches()) {
+        return 0;
+    }
+    return test == BASELINE_BANDWIDTH ? saved.bandwidth_mbps : saved.test_mbps[test];
+}
+
+static void check(int test, uint32_t mbps)
+{
+    uint32_t bit = 1u << (test + 1);
+    if (slowdown_threshold <= 0 || mbps == 0 || (reported & bit)) {
+        return;
+    }
+    uint32_t expected = baseline_mbps(test);
+    if (expected == 0) {
+        return;
+    }
+    int pct = (int)(((uint64_t)mbps * 100) / expected);
+    if (pct >= 100 - slowdown_threshold) {
+        return;
+    }
+    reported |= bit;
+
+    if (test == BASELINE_BANDWIDTH) {
+        trace(0, "startup bandwidth %uMB/s, %i%% of baseline", (uintptr_t)mbps, pct);
+    } else {
+        trace(0, "test %i throughput %uMB/s, %i%% of baseline", test, (uintptr_t)mbps, pct);
+    }
+    telemetry_below_baseline(test, mbps, expected);
+    if (!enable_headless) {
+        set_foreground_colour(BLUE);
+        if (test == BASELINE_BANDWIDTH) {
+            printf(ROW_FOOTER, 56, "Baseline: bandwidth -%2i%%", 100 - pct);
+        } else {
+            printf(ROW_FOOTER, 56, "Baseline: test %2i -%2i%% ", test, 100 - pct);
+        }
+        set_foreground_colour(WHITE);
+    }
+}
+
+static void save_baseline(void)
+{
+    record_t record;
+
+    memset(&record, 0, sizeof(record));
+    record.signature      = RECORD_SIGNATURE;
+    make_key(&record.key);
+    record.bandwidth_mbps = ram_speed / 1024;
+    for (int test = 0; test < NUM_TEST_PATTERNS; test++) {
+        record.test_mbps[test] = test_mbps(test);
+    }
+    record.checksum = checksum(&record);
+
+    if (write_nv_variable(RECORD_NAME, &record, sizeof(record))) {
+        saved = record;
+        saved_valid = true;
+        trace(0, "saved the performance baseline");
+    }
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+void baseline_set(int test, uint32_t mbps)
+{
+    if (test == BASELINE_BANDWIDTH) {
+        given_bandwidth_mbps = mbps;
+    } else if (test >= 0 && test < NUM_TEST_PATTERNS) {
+        given_test_mbps[test] = mbps;
+    }
+    given = true;
+}
+
+void baseline_init(void)
+{
+    if (baseline_mode == BASELINE_OFF) {
+        return;
+    }
+    if (!read_nv_variable(RECORD_NAME, &saved, sizeof(saved))) {
+        return;
+    }
+    saved_valid = (saved.signature == RECORD_SIGNATURE && saved.checksum == checksum(&saved));
+}
+
+void baseline_start_run(void)
+{
+    reported = 0;
+}
+
+void baseline_check_test(int test, uint32_t mbps)
+{
+    if (baseline_mode == BASELINE_OFF) {
+        return;
+    }
+    check(test, mbps);
+}
+
+void baseline_end_pass(int pass)
+{
+    if (baseline_mode == BASELINE_OFF) {
+        return;
+    }
+    check(BASELINE_BANDWIDTH, ram_speed / 1024);
+
+    if (pass != 0 || error_count != 0 || given) {
+        return;
+    }
+    // Replace a baseline measured on other hardware or with another
+    // configuration.
+    if (baseline_mode == BASELINE_SAVE || !saved_matches()) {
+        save_baseline();
+    }
+}
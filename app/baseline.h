@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef BASELINE_H
+#define BASELINE_H
+/**
+ * \file
+ *
+ * Provides a performance baseline for the machine: the startup bandwidth
+ * and the throughput of each test, measured in the first pass of an earlier
+ * run on the same CPU model, memory modules and CPU configuration, or given
+ * on the command line. The measurements of each run are compared with the
+ * baseline as they are made, so a machine that is much slower than others
+ * of its type is flagged during the first pass rather than after a full run.
+ *
+ * The baseline is saved in a non-volatile UEFI variable, so is only kept
+ * across boots when the machine was booted through UEFI.
+ *
+ *//*
+ * Copyright (C) 2024 Memtest86+ contributors.
+ */
+
+#include <stdint.h>
+
+/**
+ * The test number used to identify the startup bandwidth.
+ */
+#define BASELINE_BANDWIDTH  -1
+
+/**
+ * Sets the expected throughput in MB/s of the specified test (or of the
+ * startup benchmark, if test is BASELINE_BANDWIDTH), overriding the saved
+ * baseline. Called when parsing the command line.
+ */
+void baseline_set(int test, uint32_t mbps);
+
+/**
+ * Loads the saved baseline. Must be called after the memory modules have
+ * been identified.
+ */
+void baseline_init(void);
+
+/**
+ * Clears the record of the warnings raised. Must be called at the start of
+ * each run.
+ */
+void baseline_start_run(void);
+
+/**
+ * Compares the throughput measured for a run of the specified test with the
+ * baseline, and raises a warning the first time in each run that it is more
+ * than the slowdown threshold below the baseline.
+ */
+void baseline_check_test(int test, uint32_t mbps);
+
+/**
+ * Compares the startup bandwidth with the baseline, and saves the results of
+ * the first pass as the new baseline if there is no baseline for this
+ * machine or the baseline=save boot option was given. Must be called at the
+ * end of each pass, after the startup benchmark has been run.
+ */
+void baseline_end_pass(int pass);
+
+#endif // BASELINE_H
@@ -0,0 +1,1162 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "boot.h"
+
+#include "cpuinfo.h"
+#include "keyboard.h"
+#include "memctrl.h"
+#include "memsize.h"
+#include "pmem.h"
+#include "screen.h"
+#include "serial.h"
+#include "smp.h"
+#include "tsc.h"
+#include "vmem.h"
+
+#include "barrier.h"
+#include "print.h"
+#include "string.h"
+#include "unistd.h"
+
+#include "config.h"
+
+#include "benchmark.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define MIN_START_PAGE      PAGE_C(16,MB)   // keep clear of the BIOS and low memory
+
+#define MIN_BUFFER_PAGES    PAGE_C(16,MB)
+#define MAX_BUFFER_PAGES    PAGE_C(512,MB)
+
+#define TIMED_PASSES        4       // passes over the buffer in each bandwidth measurement
+
+#define LINE_SIZE           64      // the size of a pointer chasing node, in bytes
+
+#define LATENCY_STEPS       (1 << 20)
+
+#define NUM_LATENCY_SIZES   5
+
+#define MAX_NODE_ROWS       6       // the number of proximity domains shown on screen
+
+#define MATRIX_LATENCY_SIZE SIZE_C(64,MB)
+
+#define MAX_MATRIX_SHOWN    4       // the number of proximity domains shown in the matrix
+
+#define LOADED_CHAIN_SIZE   SIZE_C(128,MB)
+
+#define LOAD_CHUNK_WORDS    (4096 / sizeof(uintptr_t))  // read or copied by a loading core between delays
+
+#define NUM_LOAD_LEVELS     7
+
+#define NO_LOAD             UINT32_MAX
+
+#define MAX_SCALE_STEPS     9       // 1, 2, 4 ... 128 cores, and all the cores (MAX_CPUS is 256)
+
+#define SATURATION_PERCENT  90      // of the highest bandwidth in a scaling sweep
+
+#define DISPLAY_TIMEOUT     30000   // milliseconds
+
+#define POP_BENCH_R         3
+#define POP_BENCH_C         8
+#define POP_BENCH_W         64
+#define POP_BENCH_H         (MAX_NODE_ROWS + 12)
+
+#define POP_BENCH_LAST_R    (POP_BENCH_R + POP_BENCH_H - 1)
+#define POP_BENCH_LAST_C    (POP_BENCH_C + POP_BENCH_W - 1)
+
+#define POP_BENCH_REGION    POP_BENCH_R, POP_BENCH_C, POP_BENCH_LAST_R, POP_BENCH_LAST_C
+
+#define ROW_BW_HEADER       (POP_BENCH_R + 3)
+#define ROW_BW_FIRST        (ROW_BW_HEADER + 1)
+#define ROW_LAT_HEADER      (ROW_BW_FIRST + MAX_NODE_ROWS + 3)
+#define ROW_LAT_VALUES      (ROW_LAT_HEADER + 1)
+#define ROW_BENCH_PROMPT    (POP_BENCH_LAST_R - 1)
+
+#define POP_MATRIX_R        5
+#define POP_MATRIX_C        1
+#define POP_MATRIX_W        78
+#define POP_MATRIX_H        (MAX_MATRIX_SHOWN + 8)
+
+#define POP_MATRIX_LAST_R   (POP_MATRIX_R + POP_MATRIX_H - 1)
+#define POP_MATRIX_LAST_C   (POP_MATRIX_C + POP_MATRIX_W - 1)
+
+#define POP_MATRIX_REGION   POP_MATRIX_R, POP_MATRIX_C, POP_MATRIX_LAST_R, POP_MATRIX_LAST_C
+
+#define ROW_MATRIX_HEADER   (POP_MATRIX_R + 3)
+#define ROW_MATRIX_FIRST    (ROW_MATRIX_HEADER + 2)
+#define ROW_MATRIX_PROMPT   (POP_MATRIX_LAST_R - 1)
+
+#define COL_MATRIX_BW       (POP_MATRIX_C + 9)
+#define COL_MATRIX_LAT      (POP_MATRIX_C + 35)
+#define COL_MATRIX_DIST     (POP_MATRIX_C + 61)
+
+#define POP_LOAD_R          4
+#define POP_LOAD_C          6
+#define POP_LOAD_W          68
+#define POP_LOAD_H          (NUM_LOAD_LEVELS + 9)
+
+#define POP_LOAD_LAST_R     (POP_LOAD_R + POP_LOAD_H - 1)
+#define POP_LOAD_LAST_C     (POP_LOAD_C + POP_LOAD_W - 1)
+
+#define POP_LOAD_REGION     POP_LOAD_R, POP_LOAD_C, POP_LOAD_LAST_R, POP_LOAD_LAST_C
+
+#define ROW_LOAD_HEADER     (POP_LOAD_R + 3)
+#define ROW_LOAD_FIRST      (ROW_LOAD_HEADER + 1)
+#define ROW_LOAD_LEGEND     (POP_LOAD_LAST_R - 3)
+#define ROW_LOAD_PROMPT     (POP_LOAD_LAST_R - 1)
+
+#define COL_LOAD_READ_BW    (POP_LOAD_C + 18)
+#define COL_LOAD_READ_LAT   (POP_LOAD_C + 31)
+#define COL_LOAD_COPY_BW    (POP_LOAD_C + 46)
+#define COL_LOAD_COPY_LAT   (POP_LOAD_C + 59)
+
+#define POP_SCALE_R         5
+#define POP_SCALE_C         1
+#define POP_SCALE_W         78
+#define POP_SCALE_H         (MAX_NODE_ROWS + 8)
+
+#define POP_SCALE_LAST_R    (POP_SCALE_R + POP_SCALE_H - 1)
+#define POP_SCALE_LAST_C    (POP_SCALE_C + POP_SCALE_W - 1)
+
+#define POP_SCALE_REGION    POP_SCALE_R, POP_SCALE_C, POP_SCALE_LAST_R, POP_SCALE_LAST_C
+
+#define ROW_SCALE_HEADER    (POP_SCALE_R + 3)
+#define ROW_SCALE_FIRST     (ROW_SCALE_HEADER + 1)
+#define ROW_SCALE_LEGEND    (POP_SCALE_LAST_R - 3)
+#define ROW_SCALE_PROMPT    (POP_SCALE_LAST_R - 1)
+
+#define COL_SCALE_STEPS     (POP_SCALE_C + 10)
+#define COL_SCALE_KNEE      (COL_SCALE_STEPS + 6 * MAX_SCALE_STEPS + 2)
+
+static const uintptr_t latency_size[NUM_LATENCY_SIZES] = {
+    SIZE_C(16,KB), SIZE_C(256,KB), SIZE_C(4,MB), SIZE_C(32,MB), SIZE_C(256,MB)
+};
+
+static const char *latency_label[NUM_LATENCY_SIZES] = {
+    "16KB", "256KB", "4MB", "32MB", "256MB"
+};
+
+// The TSC cycles each loading core waits after each chunk it reads or copies,
+// from the lowest load to the highest.
+static const uint32_t load_delay_level[NUM_LOAD_LEVELS] = {
+    NO_LOAD, 32768, 8192, 4096, 2048, 1024, 0
+};
+
+//------------------------------------------------------------------------------
+// Types
+//------------------------------------------------------------------------------
+
+typedef enum {
+    KERNEL_NONE,
+    KERNEL_READ,
+    KERNEL_WRITE,
+    KERNEL_COPY,
+    KERNEL_TRIAD,
+    KERNEL_LATENCY,
+    KERNEL_LOADED_READ,                     // pointer chase alongside read traffic
+    KERNEL_LOADED_COPY,                     // pointer chase alongside copy traffic
+    NUM_KERNELS
+} kernel_t;
+
+typedef struct {
+    uint32_t    mbps[NUM_KERNELS];          // indexed by the bandwidth kernels
+} bandwidth_t;
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+// The following variables are written by CPU core 0 before each phase of the
+// benchmark, and are read by all the CPU cores taking part in it.
+
+static barrier_t        *bench_barrier = NULL;
+
+static kernel_t         phase_kernel = KERNEL_NONE;
+static uintptr_t        phase_window = 0;           // page number
+static uintptr_t        phase_words  = 0;           // per array
+static bool             cpu_selected[MAX_CPUS];
+static uintptr_t        *cpu_buffer[MAX_CPUS];
+
+static uint64_t         phase_time   = 0;           // TSC cycles
+
+// In the loaded latency phases, one CPU core chases pointers through its own
+// buffer while the others generate memory traffic until it has finished.
+
+static int              chase_cpu    = 0;
+static uintptr_t        chase_words  = 0;
+static bool             chain_built  = false;
+static uint32_t         load_delay   = NO_LOAD;     // TSC cycles
+static volatile bool    chase_done   = false;
+static uint64_t         load_bytes[MAX_CPUS];
+
+static volatile uintptr_t sink;                     // defeats dead code elimination
+
+static uint16_t         popup_save_buffer[POP_BENCH_W * POP_BENCH_H];   // large enough for any panel
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static uintptr_t read_words(const uintptr_t *p, uintptr_t n)
+{
+    uintptr_t sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+    for (uintptr_t i = 0; i < n; i += 4) {
+        sum0 += p[i + 0];
+        sum1 += p[i + 1];
+        sum2 += p[i + 2];
+        sum3 += p[i + 3];
+    }
+    return sum0 + sum1 + sum2 + sum3;
+}
+
+static void write_words(uintptr_t *p, uintptr_t n, uintptr_t value)
+{
+    __asm__ __volatile__ (
+        "cld\n\t"
+        "rep\n\t"
+#ifdef __x86_64__
+        "stosq\n\t"
+#else
+        "stosl\n\t"
+#endif
+        : "+D" (p), "+c" (n)
+        : "a" (value)
+        : "memory"
+    );
+}
+
+static void copy_words(uintptr_t *dst, const uintptr_t *src, uintptr_t n)
+{
+    __asm__ __volatile__ (
+        "cld\n\t"
+        "rep\n\t"
+#ifdef __x86_64__
+        "movsq\n\t"
+#else
+        "movsl\n\t"
+#endif
+        : "+D" (dst), "+S" (src), "+c" (n)
+        :
+        : "memory"
+    );
+}
+
+static void triad_words(uintptr_t *a, const uintptr_t *b, const uintptr_t *c, uintptr_t n, uintptr_t k)
+{
+    for (uintptr_t i = 0; i < n; i++) {
+        a[i] = b[i] + k * c[i];
+    }
+}
+
+static uint32_t next_random(uint32_t *state)
+{
+    // xorshift32
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static void build_chain(uintptr_t *buffer, uint32_t num_nodes)
+{
+    const uintptr_t node_words = LINE_SIZE / sizeof(uintptr_t);
+
+    // Build a random cyclic permutation of the nodes (Sattolo's algorithm),
+    // using the second word of each node to hold the permutation.
+    for (uint32_t i = 0; i < num_nodes; i++) {
+        buffer[i * node_words + 1] = i;
+    }
+    uint32_t state = 0x2545f491;
+    for (uint32_t i = num_nodes - 1; i > 0; i--) {
+        uint32_t j = next_random(&state) % i;
+        uintptr_t temp = buffer[i * node_words + 1];
+        buffer[i * node_words + 1] = buffer[j * node_words + 1];
+        buffer[j * node_words + 1] = temp;
+    }
+    // Link the nodes in permutation order.
+    for (uint32_t i = 0; i < num_nodes; i++) {
+        uintptr_t this_node = buffer[i * node_words + 1];
+        uintptr_t next_node = buffer[((i + 1) % num_nodes) * node_words + 1];
+        buffer[this_node * node_words] = (uintptr_t)&buffer[next_node * node_words];
+    }
+}
+
+static uintptr_t chase_chain(uintptr_t *node, uint32_t num_steps)
+{
+    for (uint32_t i = 0; i < num_steps; i += 4) {
+        node = (uintptr_t *)*node;
+        node = (uintptr_t *)*node;
+        node = (uintptr_t *)*node;
+        node = (uintptr_t *)*node;
+    }
+    return (uintptr_t)node;
+}
+
+static void generate_load(int my_cpu, uintptr_t *a, uintptr_t *b, uintptr_t n)
+{
+    uint64_t bytes = 0;
+    uintptr_t i = 0;
+    while (load_delay != NO_LOAD && !chase_done) {
+        if (phase_kernel == KERNEL_LOADED_COPY) {
+            copy_words(b + i, a + i, LOAD_CHUNK_WORDS);
+            bytes += 2 * LOAD_CHUNK_WORDS * sizeof(uintptr_t);
+        } else {
+            sink = read_words(a + i, LOAD_CHUNK_WORDS);
+            bytes += LOAD_CHUNK_WORDS * sizeof(uintptr_t);
+        }
+        i += LOAD_CHUNK_WORDS;
+        if (i >= n) {
+            i = 0;
+        }
+        if (load_delay > 0) {
+            uint64_t resume_time = get_tsc() + load_delay;
+            while (get_tsc() < resume_time && !chase_done) { }
+        }
+    }
+    load_bytes[my_cpu] = bytes;
+}
+
+static void run_loaded_kernel(int my_cpu, bool timed)
+{
+    uintptr_t *a = cpu_buffer[my_cpu];
+
+    if (my_cpu == chase_cpu) {
+        uint32_t num_nodes = (chase_words * sizeof(uintptr_t)) / LINE_SIZE;
+        if (timed) {
+            sink = chase_chain(a, LATENCY_STEPS);
+            chase_done = true;
+        } else {
+            if (!chain_built) {
+                build_chain(a, num_nodes);
+                chain_built = true;
+            }
+            sink = chase_chain(a, num_nodes < LATENCY_STEPS ? num_nodes : LATENCY_STEPS);
+        }
+        return;
+    }
+    if (timed) {
+        generate_load(my_cpu, a, a + phase_words, phase_words);
+    } else {
+        sink = read_words(a, 2 * phase_words);
+    }
+}
+
+static void run_kernel(int my_cpu, bool timed)
+{
+    uintptr_t *a = cpu_buffer[my_cpu];
+    uintptr_t *b = a + phase_words;
+    uintptr_t *c = b + phase_words;
+    uintptr_t  n = phase_words;
+
+    if (phase_kernel == KERNEL_LOADED_READ || phase_kernel == KERNEL_LOADED_COPY) {
+        run_loaded_kernel(my_cpu, timed);
+        return;
+    }
+
+    if (phase_kernel == KERNEL_LATENCY) {
+        uint32_t num_nodes = (n * sizeof(uintptr_t)) / LINE_SIZE;
+        if (timed) {
+            sink = chase_chain(a, LATENCY_STEPS);
+        } else {
+            build_chain(a, num_nodes);
+            sink = chase_chain(a, num_nodes < LATENCY_STEPS ? num_nodes : LATENCY_STEPS);
+        }
+        return;
+    }
+
+    int passes = timed ? TIMED_PASSES : 1;
+    for (int i = 0; i < passes; i++) {
+        switch (phase_kernel) {
+          case KERNEL_READ:
+            sink = read_words(a, n);
+            break;
+          case KERNEL_WRITE:
+            write_words(a, n, i);
+            break;
+          case KERNEL_COPY:
+            copy_words(b, a, n);
+            break;
+          case KERNEL_TRIAD:
+            triad_words(c, a, b, n, 3);
+            break;
+          default:
+            break;
+        }
+    }
+}
+
+static void wait_for_setup(void)
+{
+    // CPU core 0 may wait for user input between phases.
+    if (power_save > POWER_SAVE_OFF) {
+        barrier_halt_wait(bench_barrier);
+    } else {
+        barrier_spin_wait(bench_barrier);
+    }
+}
+
+static bool run_phase(int my_cpu)
+{
+    wait_for_setup();
+    if (phase_kernel == KERNEL_NONE) {
+        return false;
+    }
+    // Map the buffers and warm them up, so the TLB and cache state is the
+    // same whichever CPU core last touched them.
+    if (cpu_selected[my_cpu]) {
+        map_window(phase_window);
+        run_kernel(my_cpu, false);
+    }
+    barrier_spin_wait(bench_barrier);
+    uint64_t start_time = get_tsc();
+    if (cpu_selected[my_cpu]) {
+        run_kernel(my_cpu, true);
+    }
+    barrier_spin_wait(bench_barrier);
+    if (my_cpu == 0) {
+        phase_time = get_tsc() - start_time;
+    }
+    return true;
+}
+
+static bool place_buffer(uintptr_t start, uintptr_t end, uintptr_t num_pages, uintptr_t *buffer_page)
+{
+    uintptr_t program_start = (uintptr_t)_start >> PAGE_SHIFT;
+    uintptr_t program_end   = ((uintptr_t)_end + PAGE_SIZE - 1) >> PAGE_SHIFT;
+
+    uintptr_t page = start;
+    while (page + num_pages <= end) {
+        // Avoid the memory region where the program is currently located.
+        if (page < program_end && (page + num_pages) > program_start) {
+            page = program_end;
+            continue;
+        }
+        // The buffer must lie entirely within the permanently mapped region
+        // or entirely within one window.
+        if (page < VM_PINNED_SIZE) {
+            if ((page + num_pages) > VM_PINNED_SIZE) {
+                page = VM_PINNED_SIZE;
+                continue;
+            }
+        } else {
+            uintptr_t next_window = (page & ~(VM_WINDOW_SIZE - 1)) + VM_WINDOW_SIZE;
+            if ((page + num_pages) > next_window) {
+                page = next_window;
+                continue;
+            }
+        }
+        *buffer_page = page;
+        return true;
+    }
+    return false;
+}
+
+static bool find_buffer(int domain, uintptr_t num_pages, uintptr_t *buffer_page)
+{
+    uintptr_t lower_limit = pm_limit_lower > MIN_START_PAGE ? pm_limit_lower : MIN_START_PAGE;
+    uintptr_t upper_limit = pm_limit_upper;
+
+    for (int i = 0; i < pm_map_size; i++) {
+        uintptr_t seg_start = pm_map[i].start > lower_limit ? pm_map[i].start : lower_limit;
+        uintptr_t seg_end   = pm_map[i].end   < upper_limit ? pm_map[i].end   : upper_limit;
+        if (seg_start >= seg_end) {
+            continue;
+        }
+        if (domain < 0) {
+            if (place_buffer(seg_start, seg_end, num_pages, buffer_page)) {
+                return true;
+            }
+            continue;
+        }
+        // Split the segment into the parts belonging to each proximity domain.
+        uint64_t span_start = (uint64_t)seg_start << PAGE_SHIFT;
+        uint64_t span_end   = (uint64_t)seg_end   << PAGE_SHIFT;
+        while (span_start < span_end) {
+            uint32_t proximity_domain_idx;
+            uint64_t new_start;
+            uint64_t new_end;
+            if (!smp_narrow_to_proximity_domain(span_start, span_end, &proximity_domain_idx, &new_start, &new_end)) {
+                break;
+            }
+            if ((int)proximity_domain_idx == domain
+            &&  place_buffer(new_start >> PAGE_SHIFT, new_end >> PAGE_SHIFT, num_pages, buffer_page)) {
+                return true;
+            }
+            span_start = new_end;
+        }
+    }
+    return false;
+}
+
+static int num_selected_cpus(void)
+{
+    int num_cpus = 0;
+    for (int cpu_num = 0; cpu_num < num_available_cpus; cpu_num++) {
+        if (cpu_selected[cpu_num]) {
+            num_cpus++;
+        }
+    }
+    return num_cpus;
+}
+
+// Finds and maps a buffer of up to the requested number of pages in the
+// domain, halving the size until one is found. Returns the first word of the
+// buffer, or NULL if it couldn't be placed.
+static uintptr_t *map_buffer(int domain, uintptr_t *total_pages)
+{
+    uintptr_t buffer_page = 0;
+    while (!find_buffer(domain, *total_pages, &buffer_page)) {
+        *total_pages /= 2;
+        if (*total_pages < MIN_BUFFER_PAGES) {
+            return NULL;
+        }
+    }
+    phase_window = buffer_page & ~(VM_WINDOW_SIZE - 1);
+    if (!map_window(phase_window)) {
+        return NULL;
+    }
+    return first_word_mapping(buffer_page);
+}
+
+static bool setup_buffers(int domain, uintptr_t total_pages)
+{
+    int num_cpus = num_selected_cpus();
+    if (num_cpus == 0) {
+        return false;
+    }
+
+    uintptr_t *buffer = map_buffer(domain, &total_pages);
+    if (buffer == NULL) {
+        return false;
+    }
+
+    // Give each CPU core three arrays, each a whole number of cache lines.
+    uintptr_t cpu_words = ((total_pages << PAGE_SHIFT) / sizeof(uintptr_t)) / num_cpus;
+    phase_words = (cpu_words / 3) & ~(uintptr_t)(LINE_SIZE / sizeof(uintptr_t) - 1);
+    if (phase_words == 0) {
+        return false;
+    }
+    for (int cpu_num = 0; cpu_num < num_available_cpus; cpu_num++) {
+        if (cpu_selected[cpu_num]) {
+            cpu_buffer[cpu_num] = buffer;
+            buffer += 3 * phase_words;
+        }
+    }
+    return true;
+}
+
+// Gives the first half of the buffer to the CPU core that chases pointers,
+// and splits the other half between the other selected CPU cores, with two
+// arrays each.
+static bool setup_loaded_buffers(int domain)
+{
+    int num_loaders = num_selected_cpus() - 1;
+
+    uintptr_t total_pages = 2 * (LOADED_CHAIN_SIZE >> PAGE_SHIFT);
+    uintptr_t *buffer = map_buffer(domain, &total_pages);
+    if (buffer == NULL) {
+        return false;
+    }
+
+    uintptr_t half_words = ((total_pages << PAGE_SHIFT) / sizeof(uintptr_t)) / 2;
+    chase_words = half_words;
+    phase_words = 0;
+    if (num_loaders > 0) {
+        phase_words = (half_words / num_loaders / 2) & ~(uintptr_t)(LOAD_CHUNK_WORDS - 1);
+        if (phase_words == 0) {
+            return false;
+        }
+    }
+    cpu_buffer[chase_cpu] = buffer;
+    buffer += half_words;
+    for (int cpu_num = 0; cpu_num < num_available_cpus; cpu_num++) {
+        if (cpu_selected[cpu_num] && cpu_num != chase_cpu) {
+            cpu_buffer[cpu_num] = buffer;
+            buffer += 2 * phase_words;
+        }
+    }
+    chain_built = false;
+    return true;
+}
+
+static uint32_t mb_per_sec(uint64_t num_bytes, uint64_t clks)
+{
+    if (clks == 0) {
+        return 0;
+    }
+    return ((num_bytes >> 10) * clks_per_msec * 1000) / (clks * 1024);
+}
+
+static bool measure_bandwidth(int domain, kernel_t last_kernel, bandwidth_t *result)
+{
+    uintptr_t total_pages = MIN_BUFFER_PAGES;
+    uintptr_t l3_pages = SIZE_C(l3_cache, KB) >> PAGE_SHIFT;
+    if (8 * l3_pages > total_pages) {
+        total_pages = 8 * l3_pages;
+    }
+    if (total_pages > MAX_BUFFER_PAGES) {
+        total_pages = MAX_BUFFER_PAGES;
+    }
+    if (!setup_buffers(domain, total_pages)) {
+        return false;
+    }
+
+    uint64_t array_bytes = (uint64_t)phase_words * sizeof(uintptr_t) * num_selected_cpus() * TIMED_PASSES;
+
+    for (kernel_t kernel = KERNEL_READ; kernel <= last_kernel; kernel++) {
+        phase_kernel = kernel;
+        run_phase(0);
+        int num_arrays = (kernel == KERNEL_COPY) ? 2 : (kernel == KERNEL_TRIAD) ? 3 : 1;
+        result->mbps[kernel] = mb_per_sec(num_arrays * array_bytes, phase_time);
+    }
+    return true;
+}
+
+static uint32_t measure_latency(int domain, uintptr_t size)
+{
+    // The chain occupies the first of the three arrays. A single CPU core
+    // must be selected.
+    if (!setup_buffers(domain, (3 * size) >> PAGE_SHIFT)) {
+        return 0;
+    }
+    phase_kernel = KERNEL_LATENCY;
+    run_phase(0);
+    // Convert to tenths of a nanosecond.
+    return (phase_time * 10000000) / ((uint64_t)clks_per_msec * LATENCY_STEPS);
+}
+
+static void select_cpus(int domain, int max_cpus)
+{
+    int num_cpus = 0;
+    for (int cpu_num = 0; cpu_num < num_available_cpus; cpu_num++) {
+        bool selected = (cpu_state[cpu_num] != CPU_STATE_DISABLED) && num_cpus < max_cpus;
+        if (domain >= 0 && smp_get_proximity_domain_idx(cpu_num) != (uint32_t)domain) {
+            selected = false;
+        }
+        if (selected) {
+            num_cpus++;
+        }
+        cpu_selected[cpu_num] = selected;
+    }
+}
+
+static void serial_print_value(const char *label, uint32_t value)
+{
+    char buffer[16];
+
+    serial_echo_print(label);
+    serial_echo_print(itoa(value, buffer));
+}
+
+static void report_bandwidth(int row, const char *label, int domain, int num_cpus, const bandwidth_t *result)
+{
+    if (row < ROW_BW_FIRST + MAX_NODE_ROWS + 2) {
+        if (domain >= 0) {
+            printf(row, POP_BENCH_C+2, "%s %i (%i cores)", label, domain, num_cpus);
+        } else {
+            printf(row, POP_BENCH_C+2, "%s (%i cores)", label, num_cpus);
+        }
+        for (kernel_t kernel = KERNEL_READ; kernel <= KERNEL_TRIAD; kernel++) {
+            printf(row, POP_BENCH_C+23 + 9 * (kernel - KERNEL_READ), "%8u", (uintptr_t)result->mbps[kernel]);
+        }
+        if (enable_tty) {
+            tty_send_region(row, POP_BENCH_C, row, POP_BENCH_LAST_C);
+        }
+    }
+
+    if (enable_tty) {
+        serial_echo_print(label);
+        if (domain >= 0) {
+            serial_print_value(" ", domain);
+        }
+        serial_print_value(", cores ", num_cpus);
+        serial_print_value(": read ", result->mbps[KERNEL_READ]);
+        serial_print_value(" write ", result->mbps[KERNEL_WRITE]);
+        serial_print_value(" copy ", result->mbps[KERNEL_COPY]);
+        serial_print_value(" triad ", result->mbps[KERNEL_TRIAD]);
+        serial_echo_print(" MB/s\r\n");
+    }
+}
+
+static void report_latency(const uint32_t result[])
+{
+    for (int i = 0; i < NUM_LATENCY_SIZES; i++) {
+        int col = POP_BENCH_C+16 + 9 * i;
+        if (result[i] == 0) {
+            prints(ROW_LAT_VALUES, col + 7, "-");
+            continue;
+        }
+        printf(ROW_LAT_VALUES, col, "%6i.%i", (int)(result[i] / 10), (int)(result[i] % 10));
+        if (enable_tty) {
+            serial_echo_print("Latency ");
+            serial_echo_print(latency_label[i]);
+            serial_print_value(": ", result[i] / 10);
+            serial_print_value(".", result[i] % 10);
+            serial_echo_print(" ns\r\n");
+        }
+    }
+    if (enable_tty) {
+        tty_send_region(ROW_LAT_VALUES, POP_BENCH_C, ROW_LAT_VALUES, POP_BENCH_LAST_C);
+    }
+}
+
+static void print_tenths(int row, int col, uint32_t value)
+{
+    if (value == 0) {
+        prints(row, col + 5, "-");
+    } else {
+        printf(row, col, "%4i.%i", (int)(value / 10), (int)(value % 10));
+    }
+}
+
+static void measure_matrix(void)
+{
+    int num_domains = num_proximity_domains;
+
+    save_screen_region(POP_MATRIX_REGION, popup_save_buffer);
+    set_background_colour(BLACK);
+    set_foreground_colour(WHITE);
+    clear_screen_region(POP_MATRIX_REGION);
+
+    prints(POP_MATRIX_R+1, POP_MATRIX_C+2, "NUMA matrix (rows: CPU node, columns: memory node)");
+    prints(ROW_MATRIX_HEADER, COL_MATRIX_BW,   "Read GB/s");
+    prints(ROW_MATRIX_HEADER, COL_MATRIX_LAT,  "Latency ns");
+    prints(ROW_MATRIX_HEADER, COL_MATRIX_DIST, "SLIT distance");
+    for (int to = 0; to < num_domains && to < MAX_MATRIX_SHOWN; to++) {
+        printi(ROW_MATRIX_HEADER+1, COL_MATRIX_BW   + 6 * to + 4, to, 2, false, false);
+        printi(ROW_MATRIX_HEADER+1, COL_MATRIX_LAT  + 6 * to + 4, to, 2, false, false);
+        printi(ROW_MATRIX_HEADER+1, COL_MATRIX_DIST + 4 * to + 1, to, 3, false, false);
+    }
+    prints(ROW_MATRIX_PROMPT, POP_MATRIX_C+2, "Running...");
+    if (enable_tty) {
+        tty_send_region(POP_MATRIX_REGION);
+        serial_echo_print("\r\nNUMA matrix\r\n");
+    }
+
+    for (int from = 0; from < num_domains; from++) {
+        int row = ROW_MATRIX_FIRST + from;
+        bool shown = (from < MAX_MATRIX_SHOWN);
+        if (shown) {
+            printf(row, POP_MATRIX_C+2, "Node %i", from);
+        }
+        for (int to = 0; to < num_domains; to++) {
+            bandwidth_t result;
+            uint32_t gbps_x10 = 0;
+            uint32_t latency  = 0;
+
+            // Use the first CPU core in the source domain.
+            select_cpus(from, 1);
+            if (num_selected_cpus() > 0) {
+                if (measure_bandwidth(to, KERNEL_READ, &result)) {
+                    gbps_x10 = (result.mbps[KERNEL_READ] * 10) / 1024;
+                }
+                latency = measure_latency(to, MATRIX_LATENCY_SIZE);
+            }
+            int distance = smp_get_proximity_distance(from, to);
+
+            if (shown && to < MAX_MATRIX_SHOWN) {
+                print_tenths(row, COL_MATRIX_BW  + 6 * to, gbps_x10);
+                print_tenths(row, COL_MATRIX_LAT + 6 * to, latency);
+                if (distance > 0) {
+                    printi(row, COL_MATRIX_DIST + 4 * to + 1, distance, 3, false, false);
+                } else {
+                    prints(row, COL_MATRIX_DIST + 4 * to + 3, "-");
+                }
+                if (enable_tty) {
+                    tty_send_region(row, POP_MATRIX_C, row, POP_MATRIX_LAST_C);
+                }
+            }
+            if (enable_tty) {
+                serial_print_value("From node ", from);
+                serial_print_value(" to node ", to);
+                serial_print_value(": read ", gbps_x10 / 10);
+                serial_print_value(".", gbps_x10 % 10);
+                serial_print_value(" GB/s latency ", latency / 10);
+                serial_print_value(".", latency % 10);
+                serial_print_value(" ns distance ", distance);
+                serial_echo_print("\r\n");
+            }
+        }
+    }
+
+    clear_screen_region(ROW_MATRIX_PROMPT, POP_MATRIX_C+2, ROW_MATRIX_PROMPT, POP_MATRIX_LAST_C);
+    prints(ROW_MATRIX_PROMPT, POP_MATRIX_C+2, "Press any key to continue");
+    if (enable_tty) {
+        tty_send_region(POP_MATRIX_REGION);
+    }
+
+    for (int i = 0; i < DISPLAY_TIMEOUT && get_key() == 0; i++) {
+        usleep(1000);
+    }
+
+    restore_screen_region(POP_MATRIX_REGION, popup_save_buffer);
+    set_background_colour(BLUE);
+    set_foreground_colour(WHITE);
+
+    if (enable_tty) {
+        tty_full_redraw();
+    }
+}
+
+// Measures the latency seen by CPU core 0 chasing pointers while the other
+// CPU cores in its domain generate increasing read or copy traffic, and
+// shows the latency against the bandwidth they achieved.
+static void measure_loaded_latency(int domain)
+{
+    save_screen_region(POP_LOAD_REGION, popup_save_buffer);
+    set_background_colour(BLACK);
+    set_foreground_colour(WHITE);
+    clear_screen_region(POP_LOAD_REGION);
+
+    chase_cpu = 0;
+    select_cpus(domain, MAX_CPUS);
+    int num_loaders = num_selected_cpus() - 1;
+
+    printf(POP_LOAD_R+1, POP_LOAD_C+2, "Loaded latency (1 core chasing pointers, %i cores loading)", num_loaders);
+    prints(ROW_LOAD_HEADER, POP_LOAD_C+2, "Delay (clks)");
+    prints(ROW_LOAD_HEADER, COL_LOAD_READ_BW  - 3, "Read GB/s");
+    prints(ROW_LOAD_HEADER, COL_LOAD_READ_LAT - 4, "Latency ns");
+    prints(ROW_LOAD_HEADER, COL_LOAD_COPY_BW  - 3, "Copy GB/s");
+    prints(ROW_LOAD_HEADER, COL_LOAD_COPY_LAT - 4, "Latency ns");
+    prints(ROW_LOAD_LEGEND, POP_LOAD_C+2, "Delay: TSC cycles each loading core waits after each 4KB");
+    prints(ROW_LOAD_PROMPT, POP_LOAD_C+2, "Running...");
+    if (enable_tty) {
+        tty_send_region(POP_LOAD_REGION);
+        serial_echo_print("\r\nLoaded latency\r\n");
+    }
+
+    bool ok = setup_loaded_buffers(domain);
+    for (int level = 0; ok && level < NUM_LOAD_LEVELS; level++) {
+        int row = ROW_LOAD_FIRST + level;
+        load_delay = load_delay_level[level];
+        if (load_delay == NO_LOAD) {
+            prints(row, POP_LOAD_C+10, "none");
+        } else {
+            printi(row, POP_LOAD_C+8, load_delay, 6, false, false);
+        }
+        for (kernel_t kernel = KERNEL_LOADED_READ; kernel <= KERNEL_LOADED_COPY; kernel++) {
+            for (int cpu_num = 0; cpu_num < num_available_cpus; cpu_num++) {
+                load_bytes[cpu_num] = 0;
+            }
+            chase_done   = false;
+            phase_kernel = kernel;
+            run_phase(0);
+
+            uint64_t total_bytes = 0;
+            for (int cpu_num = 0; cpu_num < num_available_cpus; cpu_num++) {
+                total_bytes += load_bytes[cpu_num];
+            }
+            uint32_t gbps_x10 = (mb_per_sec(total_bytes, phase_time) * 10) / 1024;
+            // Convert to tenths of a nanosecond.
+            uint32_t latency  = (phase_time * 10000000) / ((uint64_t)clks_per_msec * LATENCY_STEPS);
+
+            bool copy = (kernel == KERNEL_LOADED_COPY);
+            print_tenths(row, copy ? COL_LOAD_COPY_BW  : COL_LOAD_READ_BW,  gbps_x10);
+            print_tenths(row, copy ? COL_LOAD_COPY_LAT : COL_LOAD_READ_LAT, latency);
+            if (enable_tty) {
+                tty_send_region(row, POP_LOAD_C, row, POP_LOAD_LAST_C);
+                serial_echo_print(copy ? "Copy load" : "Read load");
+                if (load_delay != NO_LOAD) {
+                    serial_print_value(", delay ", load_delay);
+                } else {
+                    serial_echo_print(", none");
+                }
+                serial_print_value(": ", gbps_x10 / 10);
+                serial_print_value(".", gbps_x10 % 10);
+                serial_print_value(" GB/s latency ", latency / 10);
+                serial_print_value(".", latency % 10);
+                serial_echo_print(" ns\r\n");
+            }
+        }
+    }
+    load_delay = NO_LOAD;
+
+    clear_screen_region(ROW_LOAD_PROMPT, POP_LOAD_C+2, ROW_LOAD_PROMPT, POP_LOAD_LAST_C);
+    prints(ROW_LOAD_PROMPT, POP_LOAD_C+2, ok ? "Press any key to continue" : "No room for the buffers. Press any key to continue");
+    if (enable_tty) {
+        tty_send_region(POP_LOAD_REGION);
+    }
+
+    for (int i = 0; i < DISPLAY_TIMEOUT && get_key() == 0; i++) {
+        usleep(1000);
+    }
+
+    restore_screen_region(POP_LOAD_REGION, popup_save_buffer);
+    set_background_colour(BLUE);
+    set_foreground_colour(WHITE);
+
+    if (enable_tty) {
+        tty_full_redraw();
+    }
+}
+
+// Measures the read bandwidth of 1, 2, 4 ... cores and then all the cores in
+// the domain (or in the system, if domain is -1) working on memory in the
+// same domain, and shows the results in the given row, along with the knee:
+// the fewest cores that reach SATURATION_PERCENT of the highest bandwidth.
+static void measure_scaling_sweep(int domain, int row, bool shown)
+{
+    select_cpus(domain, MAX_CPUS);
+    int max_cpus = num_selected_cpus();
+    if (max_cpus == 0) {
+        return;
+    }
+    if (shown) {
+        if (domain >= 0) {
+            printf(row, POP_SCALE_C+2, "Node %i", domain);
+        } else {
+            prints(row, POP_SCALE_C+2, "System");
+        }
+    }
+
+    int      step_cpus[MAX_SCALE_STEPS];
+    uint32_t step_mbps[MAX_SCALE_STEPS];
+    int      num_steps = 0;
+    uint32_t best_mbps = 0;
+    for (int num_cpus = 1; num_steps < MAX_SCALE_STEPS; num_cpus *= 2) {
+        if (num_cpus >= max_cpus || num_steps == MAX_SCALE_STEPS - 1) {
+            num_cpus = max_cpus;
+        }
+        // The last column is used for all the cores.
+        int col = (num_cpus == max_cpus) ? MAX_SCALE_STEPS - 1 : num_steps;
+
+        bandwidth_t result;
+        select_cpus(domain, num_cpus);
+        uint32_t mbps = 0;
+        if (measure_bandwidth(domain, KERNEL_READ, &result)) {
+            mbps = result.mbps[KERNEL_READ];
+        }
+        step_cpus[num_steps] = num_cpus;
+        step_mbps[num_steps] = mbps;
+        num_steps++;
+        if (mbps > best_mbps) {
+            best_mbps = mbps;
+        }
+
+        uint32_t gbps_x10 = (mbps * 10) / 1024;
+        if (shown) {
+            print_tenths(row, COL_SCALE_STEPS + 6 * col, gbps_x10);
+            if (enable_tty) {
+                tty_send_region(row, POP_SCALE_C, row, POP_SCALE_LAST_C);
+            }
+        }
+        if (enable_tty) {
+            if (domain >= 0) {
+                serial_print_value("Node ", domain);
+                serial_echo_print(", ");
+            }
+            serial_print_value("cores ", num_cpus);
+            serial_print_value(": read ", gbps_x10 / 10);
+            serial_print_value(".", gbps_x10 % 10);
+            serial_echo_print(" GB/s\r\n");
+        }
+        if (num_cpus == max_cpus) {
+            break;
+        }
+    }
+    if (best_mbps == 0) {
+        return;
+    }
+
+    int knee = 0;
+    while (step_mbps[knee] < (uint64_t)best_mbps * SATURATION_PERCENT / 100) {
+        knee++;
+    }
+    if (shown) {
+        printi(row, COL_SCALE_KNEE, step_cpus[knee], 4, false, false);
+        if (enable_tty) {
+            tty_send_region(row, POP_SCALE_C, row, POP_SCALE_LAST_C);
+        }
+    }
+    if (enable_tty) {
+        if (domain >= 0) {
+            serial_print_value("Node ", domain);
+            serial_echo_print(", ");
+        }
+        serial_print_value("saturated at ", step_cpus[knee]);
+        serial_echo_print(" cores\r\n");
+    }
+}
+
+static void measure_scaling(void)
+{
+    save_screen_region(POP_SCALE_REGION, popup_save_buffer);
+    set_background_colour(BLACK);
+    set_foreground_colour(WHITE);
+    clear_screen_region(POP_SCALE_REGION);
+
+    prints(POP_SCALE_R+1, POP_SCALE_C+2, "Bandwidth scaling (read GB/s by number of cores)");
+    prints(ROW_SCALE_HEADER, POP_SCALE_C+2, "Cores");
+    for (int i = 0; i < MAX_SCALE_STEPS - 1; i++) {
+        printi(ROW_SCALE_HEADER, COL_SCALE_STEPS + 6 * i + 2, 1 << i, 4, false, false);
+    }
+    prints(ROW_SCALE_HEADER, COL_SCALE_STEPS + 6 * (MAX_SCALE_STEPS - 1) + 3, "All");
+    prints(ROW_SCALE_HEADER, COL_SCALE_KNEE, "Knee");
+    prints(ROW_SCALE_PROMPT, POP_SCALE_C+2, "Running...");
+    if (enable_tty) {
+        tty_send_region(POP_SCALE_REGION);
+        serial_echo_print("\r\nBandwidth scaling\r\n");
+    }
+
+    if (num_proximity_domains > 1) {
+        for (int domain = 0; domain < num_proximity_domains; domain++) {
+            measure_scaling_sweep(domain, ROW_SCALE_FIRST + domain, domain < MAX_NODE_ROWS);
+        }
+    } else {
+        measure_scaling_sweep(-1, ROW_SCALE_FIRST, true);
+    }
+
+    printf(ROW_SCALE_LEGEND, POP_SCALE_C+2, "Knee: the fewest cores that reach %i%% of the highest bandwidth", SATURATION_PERCENT);
+    clear_screen_region(ROW_SCALE_PROMPT, POP_SCALE_C+2, ROW_SCALE_PROMPT, POP_SCALE_LAST_C);
+    prints(ROW_SCALE_PROMPT, POP_SCALE_C+2, "Press any key to continue");
+    if (enable_tty) {
+        tty_send_region(POP_SCALE_REGION);
+    }
+
+    for (int i = 0; i < DISPLAY_TIMEOUT && get_key() == 0; i++) {
+        usleep(1000);
+    }
+
+    restore_screen_region(POP_SCALE_REGION, popup_save_buffer);
+    set_background_colour(BLUE);
+    set_foreground_colour(WHITE);
+
+    if (enable_tty) {
+        tty_full_redraw();
+    }
+}
+
+static void open_panel(void)
+{
+    save_screen_region(POP_BENCH_REGION, popup_save_buffer);
+    set_background_colour(BLACK);
+    set_foreground_colour(WHITE);
+    clear_screen_region(POP_BENCH_REGION);
+
+    prints(POP_BENCH_R+1,  POP_BENCH_C+2,  "Memory benchmark");
+    if (memctrl_peak_bandwidth() > 0) {
+        printf(POP_BENCH_R+1, POP_BENCH_C+34, "Theoretical peak %u MB/s", (uintptr_t)memctrl_peak_bandwidth());
+    }
+    prints(ROW_BW_HEADER,  POP_BENCH_C+2,  "Bandwidth (MB/s)         Read    Write     Copy    Triad");
+    prints(ROW_LAT_HEADER, POP_BENCH_C+2,  "Latency (ns)");
+    for (int i = 0; i < NUM_LATENCY_SIZES; i++) {
+        int col = POP_BENCH_C+16 + 9 * i;
+        prints(ROW_LAT_HEADER, col + 8 - strlen(latency_label[i]), latency_label[i]);
+    }
+    prints(ROW_BENCH_PROMPT, POP_BENCH_C+2, "Running...");
+
+    if (enable_tty) {
+        tty_send_region(POP_BENCH_REGION);
+        serial_echo_print("\r\n\nMemory benchmark\r\n");
+        if (memctrl_peak_bandwidth() > 0) {
+            serial_print_value("Theoretical peak ", memctrl_peak_bandwidth());
+            serial_echo_print(" MB/s\r\n");
+        }
+    }
+}
+
+static void close_panel(void)
+{
+    clear_screen_region(ROW_BENCH_PROMPT, POP_BENCH_C+2, ROW_BENCH_PROMPT, POP_BENCH_LAST_C);
+    prints(ROW_BENCH_PROMPT, POP_BENCH_C+2, "Press any key to continue");
+    if (enable_tty) {
+        tty_send_region(POP_BENCH_REGION);
+    }
+
+    for (int i = 0; i < DISPLAY_TIMEOUT && get_key() == 0; i++) {
+        usleep(1000);
+    }
+
+    restore_screen_region(POP_BENCH_REGION, popup_save_buffer);
+    set_background_colour(BLUE);
+    set_foreground_colour(WHITE);
+
+    if (enable_tty) {
+        tty_full_redraw();
+    }
+}
+
+static void control_benchmark(void)
+{
+    bandwidth_t result;
+    uint32_t    latency[NUM_LATENCY_SIZES];
+
+    open_panel();
+
+    // On a NUMA system, measure the single core figures with local memory.
+    int home_domain = (num_proximity_domains > 1) ? (int)smp_get_proximity_domain_idx(0) : -1;
+
+    int row = ROW_BW_FIRST;
+    select_cpus(home_domain, 1);
+    if (measure_bandwidth(home_domain, KERNEL_TRIAD, &result)) {
+        report_bandwidth(row++, "Single core", -1, 1, &result);
+    }
+    select_cpus(-1, MAX_CPUS);
+    if (num_selected_cpus() > 1 && measure_bandwidth(-1, KERNEL_TRIAD, &result)) {
+        report_bandwidth(row++, "All cores", -1, num_selected_cpus(), &result);
+    }
+    if (num_proximity_domains > 1) {
+        for (int domain = 0; domain < num_proximity_domains; domain++) {
+            select_cpus(domain, MAX_CPUS);
+            if (num_selected_cpus() > 0 && measure_bandwidth(domain, KERNEL_TRIAD, &result)) {
+                report_bandwidth(row++, "Node", domain, num_selected_cpus(), &result);
+            }
+        }
+    }
+
+    select_cpus(home_domain, 1);
+    for (int i = 0; i < NUM_LATENCY_SIZES; i++) {
+        latency[i] = measure_latency(home_domain, latency_size[i]);
+    }
+    report_latency(latency);
+
+    close_panel();
+
+    select_cpus(-1, MAX_CPUS);
+    if (num_selected_cpus() > 1) {
+        measure_scaling();
+    }
+
+    select_cpus(home_domain, MAX_CPUS);
+    if (num_selected_cpus() > 1) {
+        measure_loaded_latency(home_domain);
+    }
+
+    if (num_proximity_domains > 1) {
+        measure_matrix();
+    }
+
+    phase_kernel = KERNEL_NONE;
+    run_phase(0);
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+void run_benchmark(int my_cpu, barrier_t *barrier)
+{
+    if (my_cpu == 0) {
+        bench_barrier = barrier;
+        for (int cpu_num = 0; cpu_num < MAX_CPUS; cpu_num++) {
+            cpu_selected[cpu_num] = false;
+        }
+    }
+    barrier_spin_wait(barrier);
+
+    if (my_cpu == 0) {
+        control_benchmark();
+    } else {
+        while (run_phase(my_cpu)) { }
+    }
+}
@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+/**
+ * \file
+ *
+ * Provides the extended memory benchmark. This measures the read, write,
+ * copy, and triad bandwidth using a single CPU core, all the enabled CPU
+ * cores, and the CPU cores in each NUMA proximity domain working on memory
+ * in the same domain. It also measures the latency of dependent loads at
+ * a range of working set sizes. It then measures how the read bandwidth of
+ * each proximity domain scales as 1, 2, 4 ... CPU cores are used, and finds
+ * the number of cores at which it saturates, and the loaded latency: the
+ * latency of dependent loads by one CPU core while the other CPU cores in its
+ * proximity domain read or copy memory at increasing intensity. On a NUMA
+ * system, it finally measures the read bandwidth and latency from one CPU
+ * core in each proximity domain to memory in each proximity domain, and
+ * shows the resulting matrices alongside the distances reported by the ACPI
+ * SLIT. The results are displayed in pop-up panels and, if the serial
+ * console is enabled, are sent to the serial port.
+ *
+ * As in the STREAM benchmark, the copy bandwidth counts the bytes read and
+ * written, and the triad bandwidth counts the bytes read from both source
+ * arrays and written to the destination array.
+ *
+ *//*
+ * Copyright (C) 2024 Memtest86+ contributors.
+ */
+
+#include "barrier.h"
+
+/**
+ * Runs the benchmark. Must be called by all the enabled CPU cores, with a
+ * barrier that blocks all of them. CPU core 0 controls the benchmark and
+ * displays the results.
+ */
+void run_benchmark(int my_cpu, barrier_t *barrier);
+
+#endif // BENCHMARK_H
@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpuinfo.h"
+#include "keyboard.h"
+#include "screen.h"
+#include "tsc.h"
+
+#include "print.h"
+
+#include "telemetry.h"
+
+#include "boottime.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define MAX_PHASES          24
+
+#define ROWS_PER_COLUMN     12
+
+#define POP_BOOT_R          4
+#define POP_BOOT_C          6
+#define POP_BOOT_W          68
+#define POP_BOOT_H          (ROWS_PER_COLUMN + 7)
+
+#define POP_BOOT_LAST_R     (POP_BOOT_R + POP_BOOT_H - 1)
+#define POP_BOOT_LAST_C     (POP_BOOT_C + POP_BOOT_W - 1)
+
+#define POP_BOOT_REGION     POP_BOOT_R, POP_BOOT_C, POP_BOOT_LAST_R, POP_BOOT_LAST_C
+
+//------------------------------------------------------------------------------
+// Types
+//------------------------------------------------------------------------------
+
+typedef struct {
+    const char  *name;
+    uint64_t    end_tsc;
+} boot_phase_t;
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+// The first entry is the time stamp taken when the program was entered. It
+// is also the time since the CPU was reset, which covers the firmware and
+// boot loader, if the TSC was cleared by the reset.
+static boot_phase_t phase[MAX_PHASES + 1];
+static int          num_phases = 0;
+
+static bool         ended = false;
+
+static uint16_t     popup_save_buffer[POP_BOOT_W * POP_BOOT_H];
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static uint32_t cycles_to_usec(uint64_t cycles)
+{
+    return clks_per_msec > 0 ? (cycles * 1000) / clks_per_msec : 0;
+}
+
+static uint32_t phase_usec(int i)
+{
+    return cycles_to_usec(phase[i].end_tsc - phase[i - 1].end_tsc);
+}
+
+// Prints the time as milliseconds with one decimal place.
+static void print_msec(int row, int col, uint32_t usec)
+{
+    printf(row, col, "%7u.%i", (uintptr_t)(usec / 1000), (int)(usec % 1000) / 100);
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+void boottime_mark(const char *name)
+{
+    if (ended) {
+        return;
+    }
+    if (num_phases == 0) {
+        phase[0].name    = "Firmware, loader";
+        phase[0].end_tsc = get_tsc();
+    }
+    // Merge any excess phases into the last one, so the total is still right.
+    if (num_phases < MAX_PHASES) {
+        num_phases++;
+    }
+    phase[num_phases].name    = name;
+    phase[num_phases].end_tsc = get_tsc();
+}
+
+void boottime_end(void)
+{
+    if (ended) {
+        return;
+    }
+    boottime_mark("Run setup");
+    ended = true;
+
+    for (int i = 1; i <= num_phases; i++) {
+        telemetry_startup_phase(phase[i].name, cycles_to_usec(phase[i - 1].end_tsc - phase[0].end_tsc), phase_usec(i));
+    }
+    telemetry_startup_end(cycles_to_usec(phase[0].end_tsc),
+                          cycles_to_usec(phase[num_phases].end_tsc - phase[0].end_tsc));
+}
+
+void boottime_display(void)
+{
+    save_screen_region(POP_BOOT_REGION, popup_save_buffer);
+    set_background_colour(BLACK);
+    set_foreground_colour(WHITE);
+    clear_screen_region(POP_BOOT_REGION);
+
+    prints(POP_BOOT_R+1, POP_BOOT_C+2, "Startup time of each phase, in ms");
+    if (num_phases == 0 || clks_per_msec == 0) {
+        prints(POP_BOOT_R+3, POP_BOOT_C+2, "No startup times were recorded");
+    } else {
+        for (int i = 1; i <= num_phases; i++) {
+            int row = POP_BOOT_R + 3 + (i - 1) % ROWS_PER_COLUMN;
+            int col = POP_BOOT_C + 2 + ((i - 1) / ROWS_PER_COLUMN) * 33;
+            prints(row, col, phase[i].name);
+            print_msec(row, col + 20, phase_usec(i));
+        }
+        uint32_t total_usec = cycles_to_usec(phase[num_phases].end_tsc - phase[0].end_tsc);
+        prints(POP_BOOT_LAST_R-3, POP_BOOT_C+2, "Total");
+        print_msec(POP_BOOT_LAST_R-3, POP_BOOT_C+22, total_usec);
+        if (!ended) {
+            prints(POP_BOOT_LAST_R-3, POP_BOOT_C+35, "(the first run hasn't started)");
+        }
+        // The TSC may not have been cleared by the reset (e.g. in a virtual
+        // machine), in which case this is meaningless.
+        prints(POP_BOOT_LAST_R-2, POP_BOOT_C+2, phase[0].name);
+        print_msec(POP_BOOT_LAST_R-2, POP_BOOT_C+22, cycles_to_usec(phase[0].end_tsc));
+        prints(POP_BOOT_LAST_R-2, POP_BOOT_C+35, "(if the TSC started at reset)");
+    }
+    prints(POP_BOOT_LAST_R-1, POP_BOOT_C+2, "Press any key to continue");
+
+    while (get_key() == 0) { }
+
+    restore_screen_region(POP_BOOT_REGION, popup_save_buffer);
+    set_background_colour(BLUE);
+    set_foreground_colour(WHITE);
+}
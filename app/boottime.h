@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef BOOTTIME_H
+#define BOOTTIME_H
+/**
+ * \file
+ *
+ * Provides a record of how long each phase of the startup took, from the
+ * entry to the program to the start of the first test. Each phase is time
+ * stamped with the TSC as it ends, and the time stamps are converted to
+ * times once the TSC has been calibrated, so phases that run before the
+ * timers are initialised can be measured too.
+ *
+ *//*
+ * Copyright (C) 2024 Memtest86+ contributors.
+ */
+
+/**
+ * Ends the current startup phase and starts the next one. The time since the
+ * last call (or since the program was entered, for the first call) is
+ * recorded against the specified name, which must be a string constant. Does
+ * nothing once boottime_end() has been called.
+ */
+void boottime_mark(const char *phase);
+
+/**
+ * Ends the last startup phase, and sends the times of all the phases in the
+ * telemetry stream. Does nothing after the first call, so the startup of a
+ * later run isn't recorded.
+ */
+void boottime_end(void);
+
+/**
+ * Displays the startup times in a pop-up panel until a key is pressed.
+ */
+void boottime_display(void);
+
+#endif // BOOTTIME_H
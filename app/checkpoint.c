@@ -0,0 +1,157 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hwctrl.h"
+
+#include "string.h"
+
+#include "error.h"
+
+#include "tests.h"
+
+#include "checkpoint.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define CHECKPOINT_NAME         "Memtest86+Checkpoint"
+
+#define CHECKPOINT_SIGNATURE    0x5043544d  // "MTCP"
+
+#define RESULT_NAME             "Memtest86+Result"
+
+//------------------------------------------------------------------------------
+// Types
+//------------------------------------------------------------------------------
+
+// The layout is the same in the 32-bit and 64-bit builds. A record saved
+// by a version with a different number of tests has a different size, so
+// is rejected when it is read.
+
+typedef struct {
+    uint32_t    signature;
+    uint32_t    checksum;
+    int32_t     pass_num;
+    int32_t     test_num;
+    int32_t     window_range;
+    int32_t     second_half;
+    uint64_t    error_count;
+    uint64_t    error_count_cecc;
+    int32_t     test_errors[NUM_TEST_PATTERNS];
+} record_t;
+
+// The layout is documented with the passes boot option.
+
+typedef struct {
+    uint64_t    passes;
+    uint64_t    error_count;
+    uint64_t    error_count_cecc;
+} result_t;
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+static record_t     record;
+
+static record_t     last_record;
+
+static bool         last_record_valid = false;
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+// Returns the two's complement of the sum of the 32-bit words in the record,
+// with the checksum field taken as zero.
+static uint32_t checksum(const record_t *rec)
+{
+    const uint32_t *word = (const uint32_t *)rec;
+
+    uint32_t sum = 0;
+    for (uintptr_t i = 0; i < sizeof(record_t) / sizeof(uint32_t); i++) {
+        sum += word[i];
+    }
+    return -(sum - rec->checksum);
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+void save_checkpoint(const checkpoint_t *position)
+{
+    memset(&record, 0, sizeof(record));
+    record.signature        = CHECKPOINT_SIGNATURE;
+    record.pass_num         = position->pass_num;
+    record.test_num         = position->test_num;
+    record.window_range     = position->window_range;
+    record.second_half      = position->second_half;
+    record.error_count      = error_count;
+    record.error_count_cecc = error_count_cecc;
+    for (int i = 0; i < NUM_TEST_PATTERNS; i++) {
+        record.test_errors[i] = test_list[i].errors;
+    }
+    record.checksum = checksum(&record);
+
+    // Avoid needless writes to the firmware's flash memory.
+    if (last_record_valid && memcmp(&record, &last_record, sizeof(record)) == 0) {
+        return;
+    }
+    if (write_nv_variable(CHECKPOINT_NAME, &record, sizeof(record))) {
+        last_record = record;
+        last_record_valid = true;
+    }
+}
+
+bool load_checkpoint(checkpoint_t *position)
+{
+    if (!read_nv_variable(CHECKPOINT_NAME, &record, sizeof(record))) {
+        return false;
+    }
+    if (record.signature != CHECKPOINT_SIGNATURE || record.checksum != checksum(&record)) {
+        return false;
+    }
+    if (record.pass_num < 0 || record.test_num < 0 || record.test_num >= NUM_TEST_PATTERNS) {
+        return false;
+    }
+
+    position->pass_num     = record.pass_num;
+    position->test_num     = record.test_num;
+    position->window_range = record.window_range;
+    position->second_half  = record.second_half;
+
+    last_record = record;
+    last_record_valid = true;
+    return true;
+}
+
+void restore_checkpoint_errors(void)
+{
+    if (!last_record_valid) {
+        return;
+    }
+    error_count      = last_record.error_count;
+    error_count_cecc = last_record.error_count_cecc;
+    for (int i = 0; i < NUM_TEST_PATTERNS; i++) {
+        test_list[i].errors = last_record.test_errors[i] >= 0 ? last_record.test_errors[i] : 0;
+    }
+}
+
+void clear_checkpoint(void)
+{
+    // Writing no data deletes the variable.
+    write_nv_variable(CHECKPOINT_NAME, NULL, 0);
+    last_record_valid = false;
+}
+
+void save_run_result(int passes)
+{
+    result_t result = { passes, error_count, error_count_cecc };
+
+    write_nv_variable(RESULT_NAME, &result, sizeof(result));
+}
@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+/**
+ * \file
+ *
+ * Provides a checkpoint of the test progress that is kept across a reset,
+ * so that a run can be resumed from the test it had reached, and a record
+ * of the result of a finished run. These are saved in non-volatile UEFI
+ * variables, so are only available when the machine was booted through UEFI.
+ *
+ *//*
+ * Copyright (C) 2024 Memtest86+ contributors.
+ */
+
+#include <stdbool.h>
+
+/**
+ * The position in the run recorded by a checkpoint. The recorded test is
+ * the next one to be run, so it is started again from its first window.
+ */
+typedef struct {
+    int         pass_num;
+    int         test_num;
+    int         window_range;
+    bool        second_half;
+} checkpoint_t;
+
+/**
+ * Saves a checkpoint of the specified position and the current error counts,
+ * including the count for each test. Does nothing if the checkpoint hasn't
+ * changed since it was last saved or loaded.
+ */
+void save_checkpoint(const checkpoint_t *position);
+
+/**
+ * Loads the last saved checkpoint. If it is valid, copies the position to
+ * the specified structure and returns true. Otherwise returns false.
+ */
+bool load_checkpoint(checkpoint_t *position);
+
+/**
+ * Restores the error counts recorded by the last checkpoint that was loaded
+ * or saved. Does nothing if there is no such checkpoint.
+ */
+void restore_checkpoint_errors(void);
+
+/**
+ * Deletes the saved checkpoint, so the next run starts from the first pass.
+ */
+void clear_checkpoint(void);
+
+/**
+ * Saves the result of a run that finished after the specified number of
+ * passes, i.e. the pass count and the current error counts.
+ */
+void save_run_result(int passes);
+
+#endif // CHECKPOINT_H
@@ -24,6 +24,7 @@
 #include "pmem.h"
 #include "serial.h"
 #include "screen.h"
+#include "simd.h"
 #include "smp.h"
 #include "usbhcd.h"
 #include "vmem.h"
@@ -33,11 +34,14 @@
 #include "string.h"
 #include "unistd.h"
 
+#include "badram.h"
 #include "display.h"
+#include "error.h"
 #include "test.h"
 
 #include "tests.h"
 
+#include "baseline.h"
 #include "config.h"
 
 //------------------------------------------------------------------------------
@@ -82,23 +86,66 @@ uintptr_t       num_pages_to_test = 0;
 
 cpu_mode_t      cpu_mode = PAR;
 
+cpu_sample_t    cpu_sample      = CPU_SAMPLE_ALL;
+int             cpu_sample_size = 0;                // for CPU_SAMPLE_RANDOM
+
+smt_mode_t      smt_mode = SMT_AUTO;
+
 error_mode_t    error_mode = ERROR_MODE_NONE;
 
 cpu_state_t     cpu_state[MAX_CPUS];
 
 core_type_t     hybrid_core_type[MAX_CPUS];
-bool            exclude_ecores     = true;
+bool            exclude_ecores     = false;
 
 bool            smp_enabled        = true;
 
+int             ui_cpu             = -1;
+
 bool            enable_big_status  = true;
 bool            enable_temperature = true;
 bool            enable_trace       = false;
 
 bool            enable_sm          = true;
 bool            enable_bench       = true;
+bool            run_full_bench     = false;
 bool            enable_mch_read    = true;
 bool            enable_numa        = false;
+bool            enable_nt_fill     = false;
+bool            enable_perf_max    = false;
+bool            enable_fade_overlap = false;
+bool            enable_bad_page_exclusion = false;
+bool            enable_direct_map  = false;
+bool            enable_telemetry   = false;
+bool            enable_headless    = false;
+bool            enable_stress      = false;
+bool            enable_stress_avx  = false;
+bool            enable_stripes     = false;
+bool            enable_mixed_tests = false;
+bool            enable_resume      = false;
+bool            enable_pmu         = false;
+bool            enable_heartbeat   = true;
+bool            enable_dma         = false;
+bool            enable_errlog      = true;
+
+int             forced_kernel      = -1;                // the SIMD level given by the kernel option, -1 to autotune
+int             wide_word_bits     = 0;                 // 0 unless test 6 walks a bit through wider patterns
+
+int             eta_passes         = 4;
+int             max_passes         = 0;                 // 0 if the run doesn't finish
+finish_action_t finish_action      = FINISH_WAIT;
+int             pass_budget        = 0;                 // in minutes, 0 if none
+int             badram_max_patterns = 10;
+int             triage_threshold   = 0;                 // 0 if triage mode is only started from the menu
+int             storm_threshold    = 100;               // in errors per second, 0 if errors are never coalesced
+int             slowdown_threshold = 10;                // in percent, 0 if slowdowns aren't reported
+baseline_mode_t baseline_mode      = BASELINE_AUTO;
+int             failfast_threshold = 0;                 // 0 if the run doesn't stop early
+bool            failfast_ecc       = false;             // failfast_threshold includes corrected ECC errors
+int             quick_stride       = 0;                 // 0 if not in quick screen mode
+int             soak_hours         = 0;                 // 0 to run the retention scrub for its iteration count
+int             soak_rate          = 64;                // the retention scrub bandwidth, in MB/s
+uint32_t        fixed_seed         = 0;                 // 0 if each pass chooses its own seed
 
 bool            enable_ecc_polling = false;
 
@@ -113,6 +160,11 @@ int             tty_update_period  = 2;                 // Update TTY every 2 se
 
 uint32_t        tty_mmio_ref_clk   = UART_REF_CLK_MMIO; // Reference clock for MMIO (in Hz)
 int             tty_mmio_stride    = 4;                 // Stride for MMIO (register width in bytes)
+bool            tty_dbc            = false;             // Use the XHCI Debug Capability instead of a UART
+
+uint32_t        netlog_ip          = 0;                 // 0 if events are not sent over the network
+uint32_t        netlog_source_ip   = 0;                 // 0 to use a link-local address
+int             netlog_port        = 5140;
 
 bool            err_banner_redraw  = false;             // Redraw banner on new errors
 
@@ -129,6 +181,13 @@ static void parse_serial_params(const char *params)
         return;
     }
 
+    // The XHCI Debug Capability is fast enough to keep up with every update.
+    if (strncmp(params, "dbc", 4) == 0) {
+        tty_dbc = true;
+        tty_update_period = 1;
+        return;
+    }
+
     // Check if console is MMIO and grab address and stride
     uintptr_t mmio_adr = 0;
     if (strncmp(params, "mmio,0x", 7) == 0) {
@@ -200,11 +259,233 @@ static void parse_serial_params(const char *params)
 
 }
 
+// Parses an IPv4 address in dotted decimal notation, advancing the string
+// pointer past it. Returns 0 if the string doesn't start with an address.
+static uint32_t parse_ip_address(const char **str)
+{
+    const char *p = *str;
+    uint32_t addr = 0;
+    for (int i = 0; i < 4; i++) {
+        if (i > 0 && *p++ != '.') {
+            return 0;
+        }
+        if (*p < '0' || *p > '9') {
+            return 0;
+        }
+        int value = 0;
+        while (*p >= '0' && *p <= '9') {
+            value = 10 * value + (*p++ - '0');
+            if (value > 255) {
+                return 0;
+            }
+        }
+        addr = addr << 8 | value;
+    }
+    *str = p;
+    return addr;
+}
+
+// Parses a decimal number, advancing the string pointer past it. Returns -1
+// if the string doesn't start with a digit.
+static int parse_number(const char **str)
+{
+    const char *p = *str;
+    if (*p < '0' || *p > '9') {
+        return -1;
+    }
+    int value = 0;
+    while (*p >= '0' && *p <= '9') {
+        value = 10 * value + (*p++ - '0');
+        if (value > 999999) {
+            return -1;
+        }
+    }
+    *str = p;
+    return value;
+}
+
+// Parses a comma-separated list of test numbers and ranges of test numbers
+// (e.g. "0,3-6,9") and selects just those tests. Leaves the selection
+// unchanged if the list is malformed.
+static void parse_test_list(const char *params)
+{
+    bool selected[NUM_TEST_PATTERNS];
+    for (int i = 0; i < NUM_TEST_PATTERNS; i++) {
+        selected[i] = false;
+    }
+    const char *p = params;
+    while (true) {
+        int first = parse_number(&p);
+        int last  = first;
+        if (*p == '-') {
+            p++;
+            last = parse_number(&p);
+        }
+        if (first < 0 || last < first || last >= NUM_TEST_PATTERNS) {
+            return;
+        }
+        for (int i = first; i <= last; i++) {
+            selected[i] = true;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        if (*p++ != ',') {
+            return;
+        }
+    }
+    for (int i = 0; i < NUM_TEST_PATTERNS; i++) {
+        test_list[i].enabled = selected[i];
+    }
+}
+
+// Parses a comma-separated list of test:iterations pairs (e.g. "5:10,8:16")
+// and sets the iteration counts of those tests. Leaves the counts unchanged
+// if the list is malformed.
+static void parse_iteration_list(const char *params)
+{
+    int iterations[NUM_TEST_PATTERNS];
+    for (int i = 0; i < NUM_TEST_PATTERNS; i++) {
+        iterations[i] = test_list[i].iterations;
+    }
+    const char *p = params;
+    while (true) {
+        int test = parse_number(&p);
+        if (test < 0 || test >= NUM_TEST_PATTERNS || *p++ != ':') {
+            return;
+        }
+        int count = parse_number(&p);
+        if (count < 1) {
+            return;
+        }
+        iterations[test] = count;
+        if (*p == '\0') {
+            break;
+        }
+        if (*p++ != ',') {
+            return;
+        }
+    }
+    for (int i = 0; i < NUM_TEST_PATTERNS; i++) {
+        test_list[i].iterations = iterations[i];
+    }
+}
+
+// Parses a comma-separated list of test:MB/s pairs, where the test may be
+// "bw" for the startup bandwidth (e.g. "bw:12000,5:9800"), and sets the
+// baseline throughputs. Ignores the list if it is malformed.
+static void parse_baseline_list(const char *params)
+{
+    int      tests[NUM_TEST_PATTERNS + 1];
+    uint32_t mbps[NUM_TEST_PATTERNS + 1];
+    int      num_values = 0;
+    const char *p = params;
+    while (num_values <= NUM_TEST_PATTERNS) {
+        int test = BASELINE_BANDWIDTH;
+        if (strncmp(p, "bw:", 3) == 0) {
+            p += 2;
+        } else {
+            test = parse_number(&p);
+            if (test < 0 || test >= NUM_TEST_PATTERNS) {
+                return;
+            }
+        }
+        if (*p++ != ':') {
+            return;
+        }
+        int value = parse_number(&p);
+        if (value < 1) {
+            return;
+        }
+        tests[num_values] = test;
+        mbps[num_values]  = value;
+        num_values++;
+        if (*p == '\0') {
+            break;
+        }
+        if (*p++ != ',') {
+            return;
+        }
+    }
+    for (int i = 0; i < num_values; i++) {
+        baseline_set(tests[i], mbps[i]);
+    }
+}
+
+// Selects just the listed tests, and scales their iteration counts by
+// multiplier / divisor. The first pass runs a third of the iterations, so
+// the counts aren't reduced below 3.
+static void select_tests(const int tests[], int num_tests, int multiplier, int divisor)
+{
+    for (int i = 0; i < NUM_TEST_PATTERNS; i++) {
+        test_list[i].enabled = false;
+    }
+    for (int i = 0; i < num_tests; i++) {
+        test_pattern_t *test = &test_list[tests[i]];
+        test->enabled    = true;
+        int iterations   = (test->iterations * multiplier) / divisor;
+        if (iterations < 3 && iterations < test->iterations) {
+            iterations = test->iterations < 3 ? test->iterations : 3;
+        }
+        test->iterations = iterations;
+    }
+}
+
+// Selects one of the predefined sets of tests and iteration counts.
+static void set_test_profile(const char *name)
+{
+    // The tests that find the most faults in the least time.
+    static const int quick_tests[]  = { 0, 2, 3, 5, 7, 8 };
+
+    // All the tests, other than the stress test and the retention scrub,
+    // which have their own modes.
+    static const int full_tests[]   = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 14 };
+
+    // The tests that load the memory the hardest.
+    static const int burnin_tests[] = { 5, 7, 8, 11, 12 };
+
+    if (strncmp(name, "quick", 6) == 0) {
+        select_tests(quick_tests, sizeof(quick_tests) / sizeof(quick_tests[0]), 1, 3);
+    } else if (strncmp(name, "full", 5) == 0) {
+        select_tests(full_tests, sizeof(full_tests) / sizeof(full_tests[0]), 1, 1);
+    } else if (strncmp(name, "burnin", 7) == 0) {
+        select_tests(burnin_tests, sizeof(burnin_tests) / sizeof(burnin_tests[0]), 2, 1);
+    }
+}
+
 static void parse_option(const char *option, const char *params)
 {
     if (option[0] == '\0') return;
 
-    if (strncmp(option, "console", 8) == 0) {
+    if (strncmp(option, "badrampatterns", 15) == 0 && params != NULL) {
+        int num_patterns = decstr2int(params);
+        if (num_patterns > 0 && num_patterns <= BADRAM_MAX_PATTERNS) {
+            badram_max_patterns = num_patterns;
+        }
+    } else if (strncmp(option, "baseline", 9) == 0 && params != NULL) {
+        if (strncmp(params, "save", 5) == 0) {
+            baseline_mode = BASELINE_SAVE;
+        } else if (strncmp(params, "off", 4) == 0) {
+            baseline_mode = BASELINE_OFF;
+        } else {
+            parse_baseline_list(params);
+        }
+    } else if (strncmp(option, "bench", 6) == 0 && params != NULL) {
+        if (strncmp(params, "full", 5) == 0) {
+            run_full_bench = true;
+        }
+    } else if (strncmp(option, "eccpoll", 8) == 0) {
+        enable_ecc_polling = true;
+    } else if (strncmp(option, "dma", 4) == 0) {
+        enable_dma = true;
+    } else if (strncmp(option, "directmap", 10) == 0) {
+        enable_direct_map = true;
+    } else if (strncmp(option, "budget", 7) == 0 && params != NULL) {
+        int minutes = decstr2int(params);
+        if (minutes > 0) {
+            pass_budget = minutes;
+        }
+    } else if (strncmp(option, "console", 8) == 0) {
         parse_serial_params(params);
     } else if (strncmp(option, "cpuseqmode", 11) == 0) {
         if (strncmp(params, "par", 4) == 0) {
@@ -214,6 +495,18 @@ static void parse_option(const char *option, const char *params)
         } else if (strncmp(params, "rr", 3) == 0 || strncmp(params, "one", 4) == 0) {
             cpu_mode = ONE;
         }
+    } else if (strncmp(option, "cpusample", 10) == 0 && params != NULL) {
+        if (strncmp(params, "core", 5) == 0) {
+            cpu_sample = CPU_SAMPLE_CORE;
+        } else if (strncmp(params, "package", 8) == 0) {
+            cpu_sample = CPU_SAMPLE_PACKAGE;
+        } else {
+            int size = decstr2int(params);
+            if (size > 0) {
+                cpu_sample = CPU_SAMPLE_RANDOM;
+                cpu_sample_size = size;
+            }
+        }
     } else if (strncmp(option, "reportmode", 11) == 0) {
         if (strncmp(params, "none", 5) == 0) {
             error_mode = ERROR_MODE_NONE;
@@ -224,6 +517,40 @@ static void parse_option(const char *option, const char *params)
         } else if (strncmp(params, "badram", 7) == 0) {
             error_mode = ERROR_MODE_BADRAM;
         }
+    } else if (strncmp(option, "excludebad", 11) == 0) {
+        enable_bad_page_exclusion = true;
+    } else if (strncmp(option, "etapasses", 10) == 0 && params != NULL) {
+        int num_passes = decstr2int(params);
+        if (num_passes > 0) {
+            eta_passes = num_passes;
+        }
+    } else if (strncmp(option, "fadeoverlap", 12) == 0) {
+        enable_fade_overlap = true;
+    } else if (strncmp(option, "failfast", 9) == 0) {
+        failfast_threshold = 1;
+        if (params != NULL) {
+            int num_errors = 0;
+            while (*params >= '0' && *params <= '9') {
+                num_errors = 10 * num_errors + (*params++ - '0');
+            }
+            if (num_errors > 0) {
+                failfast_threshold = num_errors;
+            }
+            if (*params == ',') {
+                params++;
+            }
+            failfast_ecc = (strncmp(params, "ecc", 4) == 0);
+        }
+    } else if (strncmp(option, "finish", 7) == 0 && params != NULL) {
+        if (strncmp(params, "reboot", 7) == 0) {
+            finish_action = FINISH_REBOOT;
+        } else if (strncmp(params, "poweroff", 9) == 0) {
+            finish_action = FINISH_POWER_OFF;
+        }
+    } else if (strncmp(option, "iters", 6) == 0 && params != NULL) {
+        parse_iteration_list(params);
+    } else if (strncmp(option, "headless", 9) == 0) {
+        enable_headless = true;
     } else if (strncmp(option, "keyboard", 9) == 0 && params != NULL) {
         if (strncmp(params, "legacy", 7) == 0) {
             keyboard_types = KT_LEGACY;
@@ -232,10 +559,30 @@ static void parse_option(const char *option, const char *params)
         } else if (strncmp(params, "both", 5) == 0) {
             keyboard_types = KT_USB|KT_LEGACY;
         }
+    } else if (strncmp(option, "mixtests", 9) == 0) {
+        enable_mixed_tests = true;
+    } else if (strncmp(option, "kernel", 7) == 0 && params != NULL) {
+        if (strncmp(params, "scalar", 7) == 0) {
+            forced_kernel = SIMD_NONE;
+        } else if (strncmp(params, "sse2", 5) == 0) {
+            forced_kernel = SIMD_SSE2;
+        } else if (strncmp(params, "avx2", 5) == 0) {
+            forced_kernel = SIMD_AVX2;
+        } else if (strncmp(params, "avx512", 7) == 0) {
+            forced_kernel = SIMD_AVX512;
+        }
+    } else if (strncmp(option, "wordwidth", 10) == 0 && params != NULL) {
+        int bits = decstr2int(params);
+        // The pattern must span a whole number of words and fit in a cache line.
+        if (bits > TESTWORD_WIDTH && bits <= 512 && (bits & (bits - 1)) == 0) {
+            wide_word_bits = bits;
+        }
     } else if (strncmp(option, "nobench", 8) == 0) {
         enable_bench = false;
     } else if (strncmp(option, "nobigstatus", 12) == 0) {
         enable_big_status = false;
+    } else if (strncmp(option, "noheartbeat", 12) == 0) {
+        enable_heartbeat = false;
     } else if (strncmp(option, "noehci", 7) == 0) {
         usb_init_options |= USB_IGNORE_EHCI;
     } else if (strncmp(option, "nomch", 6) == 0) {
@@ -246,10 +593,40 @@ static void parse_option(const char *option, const char *params)
         enable_sm = false;
     } else if (strncmp(option, "nosmp", 6) == 0) {
         smp_enabled = false;
+    } else if (strncmp(option, "ntfill", 7) == 0) {
+        enable_nt_fill = true;
     } else if (strncmp(option, "numa", 5) == 0) {
         enable_numa = true;
     } else if (strncmp(option, "nonuma", 7) == 0) {
         enable_numa = false;
+    } else if (strncmp(option, "passes", 7) == 0 && params != NULL) {
+        int num_passes = decstr2int(params);
+        if (num_passes > 0) {
+            max_passes = num_passes;
+        }
+    } else if (strncmp(option, "perf", 5) == 0 && params != NULL) {
+        if (strncmp(params, "max", 4) == 0) {
+            enable_perf_max = true;
+        }
+    } else if (strncmp(option, "netlog", 7) == 0 && params != NULL) {
+        netlog_ip = parse_ip_address(&params);
+        if (netlog_ip != 0) {
+            if (*params == ':') {
+                params++;
+                int port = 0;
+                while (*params >= '0' && *params <= '9' && port <= 0xffff) {
+                    port = 10 * port + (*params++ - '0');
+                }
+                if (port > 0 && port <= 0xffff) {
+                    netlog_port = port;
+                }
+            }
+            if (*params == ',') {
+                params++;
+                netlog_source_ip = parse_ip_address(&params);
+            }
+            enable_telemetry = true;
+        }
     } else if (strncmp(option, "powersave", 10) == 0) {
         if (strncmp(params, "off", 4) == 0) {
             power_save = POWER_SAVE_OFF;
@@ -257,9 +634,103 @@ static void parse_option(const char *option, const char *params)
             power_save = POWER_SAVE_LOW;
         } else if (strncmp(params, "high", 5) == 0) {
             power_save = POWER_SAVE_HIGH;
+        } else if (strncmp(params, "mwait", 6) == 0) {
+            power_save = POWER_SAVE_MWAIT;
+        }
+    } else if (strncmp(option, "telemetry", 10) == 0 && params != NULL) {
+        if (strncmp(params, "jsonl", 6) == 0) {
+            // The event stream uses the serial console, with the default
+            // settings unless the console option is also given.
+            enable_telemetry = true;
+            enable_tty       = true;
+        }
+    } else if (strncmp(option, "profile", 8) == 0 && params != NULL) {
+        set_test_profile(params);
+    } else if (strncmp(option, "quick", 6) == 0 && params != NULL) {
+        int stride = decstr2int(params);
+        if (stride > 1) {
+            // Only a power of 2 divides the work units evenly.
+            quick_stride = 1;
+            while (quick_stride <= stride / 2) {
+                quick_stride *= 2;
+            }
+        }
+    } else if (strncmp(option, "seed", 5) == 0 && params != NULL) {
+        if (strncmp(params, "0x", 2) == 0) {
+            fixed_seed = hexstr2int(params+2);
+        } else {
+            fixed_seed = decstr2int(params);
+        }
+    } else if (strncmp(option, "noerrlog", 9) == 0) {
+        enable_errlog = false;
+    } else if (strncmp(option, "resume", 7) == 0) {
+        enable_resume = true;
+    } else if (strncmp(option, "slowdown", 9) == 0 && params != NULL) {
+        int percent = decstr2int(params);
+        if (percent >= 0 && percent < 100) {
+            slowdown_threshold = percent;
+        }
+    } else if (strncmp(option, "soak", 5) == 0) {
+        // Only run the retention scrub.
+        for (int i = 0; i < NUM_TEST_PATTERNS; i++) {
+            test_list[i].enabled = (i == 15);
+        }
+        soak_hours = 8;
+        if (params != NULL) {
+            int hours = 0;
+            while (*params >= '0' && *params <= '9') {
+                hours = 10 * hours + (*params++ - '0');
+            }
+            if (hours > 0) {
+                soak_hours = hours;
+            }
+            if (*params == ',') {
+                int rate = decstr2int(params + 1);
+                if (rate > 0) {
+                    soak_rate = rate;
+                }
+            }
         }
+    } else if (strncmp(option, "smt", 4) == 0 && params != NULL) {
+        if (strncmp(params, "off", 4) == 0) {
+            smt_mode = SMT_OFF;
+        } else if (strncmp(params, "pair", 5) == 0) {
+            smt_mode = SMT_PAIR;
+        } else if (strncmp(params, "all", 4) == 0) {
+            smt_mode = SMT_ALL;
+        } else if (strncmp(params, "auto", 5) == 0) {
+            smt_mode = SMT_AUTO;
+        }
+    } else if (strncmp(option, "stress", 7) == 0) {
+        // Only run the stress test.
+        for (int i = 0; i < NUM_TEST_PATTERNS; i++) {
+            test_list[i].enabled = (i == 12);
+        }
+        enable_stress = true;
+        if (params != NULL && strncmp(params, "avx", 4) == 0) {
+            enable_stress_avx = true;
+        }
+    } else if (strncmp(option, "pmu", 4) == 0) {
+        enable_pmu = true;
+    } else if (strncmp(option, "stripe", 7) == 0) {
+        enable_stripes = true;
     } else if (strncmp(option, "trace", 6) == 0) {
         enable_trace = true;
+    } else if (strncmp(option, "uicore", 7) == 0 && params != NULL) {
+        int cpu_num = decstr2int(params);
+        ui_cpu = (cpu_num > 0 && cpu_num < MAX_CPUS) ? cpu_num : -1;
+    } else if (strncmp(option, "stormrate", 10) == 0 && params != NULL) {
+        int num_errors = decstr2int(params);
+        if (num_errors >= 0) {
+            storm_threshold = num_errors;
+        }
+    } else if (strncmp(option, "tests", 6) == 0 && params != NULL) {
+        parse_test_list(params);
+    } else if (strncmp(option, "triage", 7) == 0 && params != NULL) {
+        int num_errors = decstr2int(params);
+        if (num_errors > 0) {
+            triage_threshold = num_errors;
+        }
     } else if (strncmp(option, "usbdebug", 9) == 0) {
         usb_init_options |= USB_DEBUG;
     } else if (strncmp(option, "usbinit", 8) == 0) {
@@ -886,10 +1357,15 @@ void config_menu(bool initial)
             printf(POP_R+8,  POP_LI, "<F6>  Temperature %s", enable_temperature ? "disable" : "enable ");
             //if (no_temperature) set_foreground_colour(WHITE);
             printf(POP_R+9,  POP_LI, "<F7>  Boot trace %s",  enable_trace  ? "disable" : "enable ");
-            prints(POP_R+10, POP_LI, "<F10> Exit menu");
+            printf(POP_R+10, POP_LI, "<F8>  Full benchmark %s", run_full_bench ? "disable" : "enable ");
+            prints(POP_R+11, POP_LI, "<F10> Exit menu");
         } else {
             prints(POP_R+7,  POP_LI, "<F5>  Skip current test");
-            prints(POP_R+8 , POP_LI, "<F10> Exit menu");
+            prints(POP_R+8,  POP_LI, "<F6>  Run full benchmark");
+            if (num_faulty_pages == 0) set_foreground_colour(BOLD+BLACK);
+            prints(POP_R+9,  POP_LI, "<F7>  Triage faulty pages");
+            if (num_faulty_pages == 0) set_foreground_colour(WHITE);
+            prints(POP_R+10, POP_LI, "<F10> Exit menu");
         }
 
         if (tty_update) {
@@ -924,11 +1400,24 @@ void config_menu(bool initial)
           case '6':
             if (initial) {
                 enable_temperature = !enable_temperature;
+            } else {
+                exit_menu = true;
+                run_full_bench = true;
+                bail = true;
             }
             break;
           case '7':
             if (initial) {
                 enable_trace = !enable_trace;
+            } else if (num_faulty_pages > 0) {
+                exit_menu = true;
+                start_triage = true;
+                bail = true;
+            }
+            break;
+          case '8':
+            if (initial) {
+                run_full_bench = !run_full_bench;
             }
             break;
           case '0':
@@ -22,6 +22,20 @@ typedef enum {
     ONE
 } cpu_mode_t;
 
+typedef enum {
+    CPU_SAMPLE_ALL,         // the sequential modes run the tests on every CPU
+    CPU_SAMPLE_CORE,        // ... on one CPU in each core
+    CPU_SAMPLE_PACKAGE,     // ... on one CPU in each package
+    CPU_SAMPLE_RANDOM       // ... on a random subset of the CPUs
+} cpu_sample_t;
+
+typedef enum {
+    SMT_AUTO,               // choose between SMT_ALL and SMT_PAIR by measurement
+    SMT_OFF,                // only one thread in each core is used
+    SMT_PAIR,               // the threads in each core share one work share
+    SMT_ALL                 // each thread has its own work share
+} smt_mode_t;
+
 typedef enum {
     ERROR_MODE_NONE,
     ERROR_MODE_SUMMARY,
@@ -30,11 +44,24 @@ typedef enum {
 } error_mode_t;
 
 typedef enum {
+    POWER_SAVE_MWAIT,       // spin waits use MONITOR/MWAIT
     POWER_SAVE_OFF,
     POWER_SAVE_LOW,
     POWER_SAVE_HIGH
 } power_save_t;
 
+typedef enum {
+    BASELINE_AUTO,          // compare with the saved baseline, saving one if there is none
+    BASELINE_SAVE,          // save the results of the first pass as the baseline
+    BASELINE_OFF
+} baseline_mode_t;
+
+typedef enum {
+    FINISH_WAIT,            // wait for a key press, then reboot
+    FINISH_REBOOT,
+    FINISH_POWER_OFF
+} finish_action_t;
+
 extern uintptr_t    pm_limit_lower;
 extern uintptr_t    pm_limit_upper;
 
@@ -42,6 +69,11 @@ extern uintptr_t    num_pages_to_test;
 
 extern cpu_mode_t   cpu_mode;
 
+extern cpu_sample_t cpu_sample;
+extern int          cpu_sample_size;
+
+extern smt_mode_t   smt_mode;
+
 extern error_mode_t error_mode;
 
 extern cpu_state_t  cpu_state[MAX_CPUS];
@@ -51,6 +83,8 @@ extern bool         exclude_ecores;
 
 extern bool         smp_enabled;
 
+extern int          ui_cpu;
+
 extern bool         enable_big_status;
 extern bool         enable_temperature;
 extern bool         enable_trace;
@@ -58,9 +92,45 @@ extern bool         enable_trace;
 extern bool         enable_sm;
 extern bool         enable_tty;
 extern bool         enable_bench;
+extern bool         run_full_bench;
 extern bool         enable_mch_read;
 extern bool         enable_ecc_polling;
 extern bool         enable_numa;
+extern bool         enable_nt_fill;
+extern bool         enable_perf_max;
+extern bool         enable_fade_overlap;
+extern bool         enable_bad_page_exclusion;
+extern bool         enable_direct_map;
+extern bool         enable_telemetry;
+extern bool         enable_headless;
+extern bool         enable_stress;
+extern bool         enable_stress_avx;
+extern bool         enable_stripes;
+extern bool         enable_mixed_tests;
+extern bool         enable_resume;
+extern bool         enable_pmu;
+extern bool         enable_heartbeat;
+extern bool         enable_dma;
+extern bool         enable_errlog;
+
+extern int          forced_kernel;
+extern int          wide_word_bits;
+
+extern int          eta_passes;
+extern int          max_passes;
+extern finish_action_t finish_action;
+extern int          pass_budget;
+extern int          badram_max_patterns;
+extern int          triage_threshold;
+extern int          storm_threshold;
+extern int          slowdown_threshold;
+extern baseline_mode_t baseline_mode;
+extern int          failfast_threshold;
+extern bool         failfast_ecc;
+extern int          quick_stride;
+extern int          soak_hours;
+extern int          soak_rate;
+extern uint32_t     fixed_seed;
 
 extern bool         pause_at_start;
 
@@ -72,6 +142,11 @@ extern int          tty_update_period;
 
 extern uint32_t     tty_mmio_ref_clk;
 extern int          tty_mmio_stride;
+extern bool         tty_dbc;
+
+extern uint32_t     netlog_ip;
+extern uint32_t     netlog_source_ip;
+extern int          netlog_port;
 
 extern bool err_banner_redraw;
 
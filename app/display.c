@@ -19,12 +19,20 @@
 #include "tsc.h"
 
 #include "barrier.h"
+#include "smp.h"
 #include "spinlock.h"
 
+#include "baseline.h"
+#include "boottime.h"
 #include "config.h"
 #include "error.h"
+#include "profile.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "trend.h"
 #include "build_version.h"
 
+#include "test.h"
 #include "tests.h"
 
 #include "display.h"
@@ -44,18 +52,66 @@
 
 #define POP_STATUS_REGION  POP_STAT_R, POP_STAT_C, POP_STAT_LAST_R, POP_STAT_LAST_C
 
+#define POP_RATE_R       0
+#define POP_RATE_C       9
+#define POP_RATE_W       69
+#define POP_RATE_H       (NUM_TEST_PATTERNS + 8)
+
+#define POP_RATE_LAST_R  (POP_RATE_R + POP_RATE_H - 1)
+#define POP_RATE_LAST_C  (POP_RATE_C + POP_RATE_W - 1)
+
+#define POP_RATE_REGION  POP_RATE_R, POP_RATE_C, POP_RATE_LAST_R, POP_RATE_LAST_C
+
+#define GRID_CPUS_PER_ROW   64
+
+#define POP_GRID_W       72
+#define POP_GRID_H       (4 + (MAX_CPUS + GRID_CPUS_PER_ROW - 1) / GRID_CPUS_PER_ROW)
+#define POP_GRID_R       (ROW_MESSAGE_B - POP_GRID_H + 1)
+#define POP_GRID_C       4
+
+#define POP_GRID_LAST_R  (POP_GRID_R + POP_GRID_H - 1)
+#define POP_GRID_LAST_C  (POP_GRID_C + POP_GRID_W - 1)
+
+#define POP_GRID_REGION  POP_GRID_R, POP_GRID_C, POP_GRID_LAST_R, POP_GRID_LAST_C
+
 #define SPINNER_PERIOD  100     // milliseconds
 
+#define INPUT_PERIOD    50      // milliseconds
+
+#define STRESS_SAMPLE_PERIOD    10  // seconds
+
 #define NUM_SPIN_STATES 4
 
 static const char spin_state[NUM_SPIN_STATES] = { '|', '/', '-', '\\' };
 
 static const char cpu_mode_str[3][4] = { "PAR", "SEQ", "RR " };
 
+//------------------------------------------------------------------------------
+// Types
+//------------------------------------------------------------------------------
+
+// Each CPU only writes its own progress counters, so keep them in separate
+// cache lines.
+typedef struct __attribute__((aligned(64))) {
+    volatile int        ticks;
+    volatile uint32_t   kbytes;         // test data processed, modulo 4TB
+    uint32_t            spare_bytes;    // less than 1KB, not yet counted
+} cpu_progress_t;
+
+typedef struct {
+    uint32_t    mbps;                   // all CPUs
+    uint32_t    slowest_mbps;
+    uint32_t    fastest_mbps;
+    int         slowest_cpu;
+    int         fastest_cpu;
+} throughput_t;
+
 //------------------------------------------------------------------------------
 // Private Variables
 //------------------------------------------------------------------------------
 
+static cpu_progress_t cpu_progress[MAX_CPUS];
+
 static bool scroll_lock = false;
 static bool scroll_wait = false;
 
@@ -64,11 +120,62 @@ static int spin_idx = 0;        // current spinner position
 static int pass_ticks = 0;      // current value (ticks_per_pass is final value)
 static int test_ticks = 0;      // current value (ticks_per_test is final value)
 
+static int pass_ticks_base = 0; // value of pass_ticks at start of test
+static int test_ticks_base = 0; // sum of CPU tick counters at start of test
+
 static int pass_bar_length = 0; // currently displayed length
 static int test_bar_length = 0; // currently displayed length
 
 static uint64_t run_start_time = 0; // TSC time stamp
 static uint64_t next_spin_time = 0; // TSC time stamp
+static uint64_t next_input_time = 0; // TSC time stamp
+
+static volatile bool heartbeat_enabled = false;
+static volatile bool in_housekeeping   = false;
+static uint64_t last_housekeeping_time = 0; // TSC time stamp
+
+static bool     rate_test_started    = false;
+static int      rate_test_num        = 0;
+static int      rate_test_pass       = 0;
+static uint64_t rate_test_start_time = 0;       // TSC time stamp
+static uint32_t rate_test_start_kbytes[MAX_CPUS];
+
+static uint64_t rate_sample_time     = 0;       // TSC time stamp
+static uint32_t rate_sample_kbytes   = 0;
+
+static uint64_t stress_sample_time   = 0;       // TSC time stamp
+static uint32_t stress_sample_kbytes = 0;
+
+static int      clock_sample_cpu     = -1;      // the core the counters were read on
+static uint64_t clock_sample_aperf   = 0;
+static uint64_t clock_sample_mperf   = 0;
+
+static throughput_t test_throughput[NUM_TEST_PATTERNS];   // last completed run of each test
+
+static uint64_t pass_start_time      = 0;       // TSC time stamp
+
+static int      timed_test_num       = -1;      // test being timed, or -1 if none
+static int      timed_test_pass      = 0;
+static uint64_t timed_test_start     = 0;       // TSC time stamp
+
+// The time spent in each test in the last pass that ran it, excluding any
+// delays, and the number of ticks performed in that time.
+static int      timed_pass[NUM_TEST_PATTERNS];
+static uint64_t timed_clks[NUM_TEST_PATTERNS];
+static int      timed_ticks[NUM_TEST_PATTERNS];
+
+static uint16_t popup_rate_save_buffer[POP_RATE_W * POP_RATE_H];
+
+// The CPU activity grid stays on the screen while the tests run. It is taken
+// off while anything else may draw in the message area, so the save buffer
+// always holds what lies beneath it.
+static bool     cpu_grid_enabled = false;
+static bool     cpu_grid_shown   = false;
+static bool     cpu_grid_drawn   = false;           // the grid buffer holds the grid
+static uint16_t popup_grid_save_buffer[POP_GRID_W * POP_GRID_H];
+static uint16_t popup_grid_buffer[POP_GRID_W * POP_GRID_H];
+static uint32_t grid_sample_kbytes[MAX_CPUS];       // at the last once-per-second sample
+static uint32_t grid_delta_kbytes[MAX_CPUS];        // over the last second
 
 static int prev_sec = -1;               // previous second
 static bool timed_update_done = false;  // update cycle status
@@ -86,10 +193,441 @@ int max_cpu_temp = 0;
 
 display_mode_t display_mode = DISPLAY_MODE_NA;
 
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+// Draws the run time as display_run_time() does, but without going through the
+// shared screen state, for display_heartbeat(). The status line is always white
+// on blue while a test runs.
+static void draw_run_time_now(int hours, int mins, int secs)
+{
+    char str[16];
+
+    itoa(hours, str);
+    int len = strlen(str);
+    str[len++] = ':';
+    str[len++] = '0' + mins / 10;
+    str[len++] = '0' + mins % 10;
+    str[len++] = ':';
+    str[len++] = '0' + secs / 10;
+    str[len++] = '0' + secs % 10;
+    for (int i = 0; i < len; i++) {
+        draw_char_now(7, 51 + i, str[i], WHITE, BLUE);
+    }
+}
+
+static int sum_cpu_ticks(void)
+{
+    int sum = 0;
+    for (int cpu_num = 0; cpu_num < num_available_cpus; cpu_num++) {
+        sum += cpu_progress[cpu_num].ticks;
+    }
+    return sum;
+}
+
+static uint32_t sum_cpu_kbytes(void)
+{
+    uint32_t sum = 0;
+    for (int cpu_num = 0; cpu_num < num_available_cpus; cpu_num++) {
+        sum += cpu_progress[cpu_num].kbytes;
+    }
+    return sum;
+}
+
+static uint32_t mb_per_sec(uint32_t kbytes, uint64_t clks)
+{
+    uint64_t msecs = clks_per_msec > 0 ? clks / clks_per_msec : 0;
+    if (msecs == 0) {
+        return 0;
+    }
+    return ((uint64_t)kbytes * 1000) / (msecs * 1024);
+}
+
+// Returns the throughput in MB/s (2^20 bytes per second) as a percentage of
+// the peak bandwidth in MB/s (10^6 bytes per second).
+static int peak_percent(uint32_t mbps, uint32_t peak_mbps)
+{
+    return (int)(((uint64_t)mbps * 1048576 * 100) / ((uint64_t)peak_mbps * 1000000));
+}
+
+// Records the throughput of the test that has just completed.
+static void record_test_throughput(uint64_t current_time)
+{
+    throughput_t *result = &test_throughput[rate_test_num];
+    uint64_t test_time = current_time - rate_test_start_time;
+    uint32_t total_kbytes = 0;
+    *result = (throughput_t){ 0, UINT32_MAX, 0, -1, -1 };
+    for (int cpu_num = 0; cpu_num < num_available_cpus; cpu_num++) {
+        uint32_t kbytes = cpu_progress[cpu_num].kbytes - rate_test_start_kbytes[cpu_num];
+        if (kbytes == 0) {
+            continue;
+        }
+        total_kbytes += kbytes;
+        uint32_t mbps = mb_per_sec(kbytes, test_time);
+        if (mbps < result->slowest_mbps) {
+            result->slowest_mbps = mbps;
+            result->slowest_cpu  = cpu_num;
+        }
+        if (mbps >= result->fastest_mbps) {
+            result->fastest_mbps = mbps;
+            result->fastest_cpu  = cpu_num;
+        }
+    }
+    result->mbps = mb_per_sec(total_kbytes, test_time);
+    trend_record_test(rate_test_pass, rate_test_num, result->mbps);
+    baseline_check_test(rate_test_num, result->mbps);
+    rate_test_started = false;
+}
+
+static void start_test_throughput(void)
+{
+    uint64_t current_time = get_tsc();
+
+    if (rate_test_started) {
+        record_test_throughput(current_time);
+    }
+
+    for (int cpu_num = 0; cpu_num < num_available_cpus; cpu_num++) {
+        rate_test_start_kbytes[cpu_num] = cpu_progress[cpu_num].kbytes;
+    }
+    rate_test_started    = true;
+    rate_test_num        = test_num;
+    rate_test_pass       = pass_num;
+    rate_test_start_time = current_time;
+    rate_sample_time     = current_time;
+    rate_sample_kbytes   = sum_cpu_kbytes();
+}
+
+static void update_live_throughput(uint64_t current_time)
+{
+    uint32_t kbytes = sum_cpu_kbytes();
+    display_test_throughput(mb_per_sec(kbytes - rate_sample_kbytes, current_time - rate_sample_time));
+    rate_sample_time   = current_time;
+    rate_sample_kbytes = kbytes;
+}
+
+// Sends the throughput measured since the last call to the telemetry stream,
+// along with the temperature and error counts.
+static void update_stress_sample(uint64_t current_time)
+{
+    uint32_t kbytes = sum_cpu_kbytes();
+    if (stress_sample_time != 0) {
+        uint32_t run_secs = (current_time - run_start_time) / (1000 * (uint64_t)clks_per_msec);
+        telemetry_stress_sample(run_secs, mb_per_sec(kbytes - stress_sample_kbytes, current_time - stress_sample_time));
+    }
+    stress_sample_time   = current_time;
+    stress_sample_kbytes = kbytes;
+}
+
+// Shows the average clock frequency this core achieved while not halted
+// since the last call, if it was also this core that made the last call.
+static void update_live_clock(void)
+{
+    uint64_t aperf, mperf;
+
+    if (!read_core_clock_counters(&aperf, &mperf)) {
+        return;
+    }
+    int my_cpu = smp_my_cpu_num();
+    if (my_cpu == clock_sample_cpu && mperf > clock_sample_mperf) {
+        uint64_t mhz = ((aperf - clock_sample_aperf) * (clks_per_msec / 1000)) / (mperf - clock_sample_mperf);
+        clear_screen_region(1, 10, 1, 16);
+        display_cpu_clk((int)mhz);
+    }
+    clock_sample_cpu   = my_cpu;
+    clock_sample_aperf = aperf;
+    clock_sample_mperf = mperf;
+}
+
+static void start_test_timing(void)
+{
+    uint64_t current_time = get_tsc();
+
+    if (timed_test_num >= 0) {
+        // Record the time taken by the test that has just completed. If the
+        // pass is split, the test is run twice, so add up both parts.
+        int test = timed_test_num;
+        if (timed_pass[test] != timed_test_pass) {
+            timed_pass[test]  = timed_test_pass;
+            timed_clks[test]  = 0;
+            timed_ticks[test] = 0;
+        }
+        pass_type_t pass_type = (timed_test_pass == 0) ? FAST_PASS : FULL_PASS;
+        int ticks = (sum_cpu_ticks() - test_ticks_base) / num_active_cpus;
+        int delay_ticks = delay_ticks_per_test[pass_type][test];
+        uint64_t clks = current_time - timed_test_start;
+        uint64_t delay_clks = (uint64_t)delay_ticks * 1000 * clks_per_msec;
+        if (ticks > delay_ticks && clks > delay_clks) {
+            timed_clks[test]  += clks - delay_clks;
+            timed_ticks[test] += ticks - delay_ticks;
+        }
+    }
+
+    timed_test_num   = test_num;
+    timed_test_pass  = pass_num;
+    timed_test_start = current_time;
+}
+
+// Returns the predicted time for a pass of the specified type through the
+// specified test, or 0 if there are no timings to base it on.
+static uint64_t predicted_test_clks(int test, pass_type_t pass_type)
+{
+    uint64_t clks_per_tick = test_clks_per_tick(test);
+    if (clks_per_tick == 0) {
+        return 0;
+    }
+    int delay_ticks = delay_ticks_per_test[pass_type][test];
+    int ticks = ticks_per_test[pass_type][test] - delay_ticks;
+
+    return (uint64_t)delay_ticks * 1000 * clks_per_msec + ticks * clks_per_tick;
+}
+
+static uint64_t predicted_pass_clks(pass_type_t pass_type)
+{
+    uint64_t clks = 0;
+    for (int test = 0; test < NUM_TEST_PATTERNS; test++) {
+        clks += predicted_test_clks(test, pass_type);
+    }
+    return clks;
+}
+
+static void display_eta(int row, int col, const char *label, uint64_t clks)
+{
+    uint32_t secs  = clks / (1000 * (uint64_t)clks_per_msec);
+    uint32_t mins  = secs / 60; secs %= 60;
+    uint32_t hours = mins / 60; mins %= 60;
+    printf(row, col, "%s %i:%02i:%02i", label, (int)hours, (int)mins, (int)secs);
+}
+
+static void display_pass_and_run_eta(int row, int col)
+{
+    if (clks_per_msec == 0 || predicted_pass_clks(FULL_PASS) == 0) {
+        prints(row, col, "Pass ETA: not yet known");
+        return;
+    }
+    pass_type_t pass_type = (pass_num == 0) ? FAST_PASS : FULL_PASS;
+    uint64_t elapsed   = get_tsc() - pass_start_time;
+    uint64_t predicted = predicted_pass_clks(pass_type);
+    uint64_t pass_eta  = predicted > elapsed ? predicted - elapsed : 0;
+    display_eta(row, col, "Pass ETA:", pass_eta);
+
+    uint64_t run_eta = pass_eta;
+    for (int pass = pass_num + 1; pass < eta_passes; pass++) {
+        run_eta += predicted_pass_clks(FULL_PASS);
+    }
+    if (pass_num < eta_passes) {
+        printf(row, col + 22, "Run ETA (%i passes):", eta_passes);
+        display_eta(row, col + 44, "", run_eta);
+    }
+}
+
+static void display_headless_status(int pass_pct, int test_pct, int hours, int mins, int secs)
+{
+    // The fields have fixed widths, so only the changed characters are drawn.
+    printf(ROW_FOOTER, 0, " Pass %4i %3i%%  Test %2i %3i%%  Time %3i:%02i:%02i  Errors %6u  %s",
+           pass_num, pass_pct, test_num, test_pct, hours, mins, secs,
+           (uintptr_t)(error_count < 999999 ? error_count : 999999),
+           error_count == 0 ? "Testing" : "Failed!");
+}
+
+static void display_throughput_table(void)
+{
+    save_screen_region(POP_RATE_REGION, popup_rate_save_buffer);
+    set_background_colour(BLACK);
+    set_foreground_colour(WHITE);
+    clear_screen_region(POP_RATE_REGION);
+
+    uint32_t peak_mbps = memctrl_peak_bandwidth();
+
+    prints(POP_RATE_R+1, POP_RATE_C+2, "Throughput of the last run of each test");
+    if (peak_mbps > 0) {
+        // ram_speed is in kB/s.
+        printf(POP_RATE_R+2, POP_RATE_C+2, "Theoretical peak %u MB/s", (uintptr_t)peak_mbps);
+        if (ram_speed > 0) {
+            printf(POP_RATE_R+2, POP_RATE_C+31, "startup benchmark %i%% of peak",
+                   (int)(ram_speed / (peak_mbps * 10)));
+        }
+    }
+    prints(POP_RATE_R+3, POP_RATE_C+2, "Test    GB/s  Peak   Slowest CPU MB/s  Fastest CPU MB/s  Pass time");
+    for (int i = 0; i < NUM_TEST_PATTERNS; i++) {
+        int row = POP_RATE_R + 4 + i;
+        const throughput_t *result = &test_throughput[i];
+        printi(row, POP_RATE_C+3, i, 2, false, false);
+        if (test_list[i].enabled && clks_per_msec > 0) {
+            uint64_t clks = predicted_test_clks(i, FULL_PASS);
+            if (clks > 0) {
+                display_eta(row, POP_RATE_C+58, "", clks);
+            }
+        }
+        if (result->mbps == 0) {
+            prints(row, POP_RATE_C+11, "-");
+            continue;
+        }
+        uint32_t gbps_x10 = (result->mbps * 10) / 1024;
+        printf(row, POP_RATE_C+8, "%4i.%i", (int)(gbps_x10 / 10), (int)(gbps_x10 % 10));
+        if (peak_mbps > 0) {
+            printf(row, POP_RATE_C+16, "%3i%%", peak_percent(result->mbps, peak_mbps));
+        }
+        printf(row, POP_RATE_C+23, "#%i", result->slowest_cpu);
+        printf(row, POP_RATE_C+29, "%7u", (uintptr_t)result->slowest_mbps);
+        printf(row, POP_RATE_C+41, "#%i", result->fastest_cpu);
+        printf(row, POP_RATE_C+47, "%7u", (uintptr_t)result->fastest_mbps);
+    }
+    display_pass_and_run_eta(POP_RATE_LAST_R-3, POP_RATE_C+2);
+    prints(POP_RATE_LAST_R-1, POP_RATE_C+2, "Press any key to continue");
+
+    while (get_key() == 0) { }
+
+    restore_screen_region(POP_RATE_REGION, popup_rate_save_buffer);
+    set_background_colour(BLUE);
+    set_foreground_colour(WHITE);
+}
+
+// Records the test data processed by each CPU core over the last second.
+static void sample_cpu_activity(void)
+{
+    for (int cpu_num = 0; cpu_num < num_available_cpus; cpu_num++) {
+        uint32_t kbytes = cpu_progress[cpu_num].kbytes;
+        grid_delta_kbytes[cpu_num]  = kbytes - grid_sample_kbytes[cpu_num];
+        grid_sample_kbytes[cpu_num] = kbytes;
+    }
+}
+
+// Draws one character for each CPU core, showing its state or, while it is
+// testing, its rate over the last second in tenths of the fastest core's rate.
+static void draw_cpu_grid(void)
+{
+    set_background_colour(BLACK);
+    set_foreground_colour(WHITE);
+    clear_screen_region(POP_GRID_REGION);
+
+    prints(POP_GRID_R+1, POP_GRID_C+2, "CPU activity over the last second (press C to close)");
+    prints(POP_GRID_R+2, POP_GRID_C+2, "0-9 speed  - waiting  E errors  T throttled  U UI core  . unused");
+
+    uint32_t max_kbytes = 0;
+    for (int cpu_num = 0; cpu_num < num_available_cpus; cpu_num++) {
+        if (max_kbytes < grid_delta_kbytes[cpu_num]) {
+            max_kbytes = grid_delta_kbytes[cpu_num];
+        }
+    }
+    for (int cpu_num = 0; cpu_num < num_available_cpus; cpu_num++) {
+        int row = POP_GRID_R + 3 + cpu_num / GRID_CPUS_PER_ROW;
+        int col = POP_GRID_C + 6 + cpu_num % GRID_CPUS_PER_ROW;
+        if (cpu_num % GRID_CPUS_PER_ROW == 0) {
+            set_foreground_colour(WHITE);
+            printi(row, POP_GRID_C+2, cpu_num, 3, false, false);
+        }
+        char state;
+        if (cpu_state[cpu_num] == CPU_STATE_DISABLED) {
+            set_foreground_colour(WHITE);
+            state = '.';
+        } else if (cpu_num == ui_cpu) {
+            set_foreground_colour(CYAN);
+            state = 'U';
+        } else if (cpu_error_count(cpu_num) > 0) {
+            set_foreground_colour(BOLD+RED);
+            state = 'E';
+        } else if (cpu_is_throttled(cpu_num)) {
+            set_foreground_colour(BOLD+MAUVE);
+            state = 'T';
+        } else if (grid_delta_kbytes[cpu_num] == 0) {
+            set_foreground_colour(WHITE);
+            state = '-';
+        } else {
+            int tenths = (uint64_t)grid_delta_kbytes[cpu_num] * 10 / max_kbytes;
+            if (tenths > 9) {
+                tenths = 9;
+            }
+            set_foreground_colour(tenths >= 5 ? BOLD+GREEN : BOLD+YELLOW);
+            state = '0' + tenths;
+        }
+        printc(row, col, state);
+    }
+
+    set_background_colour(BLUE);
+    set_foreground_colour(WHITE);
+
+    save_screen_region(POP_GRID_REGION, popup_grid_buffer);
+    cpu_grid_drawn = true;
+}
+
+static void hide_cpu_grid(void)
+{
+    if (cpu_grid_shown) {
+        restore_screen_region(POP_GRID_REGION, popup_grid_save_buffer);
+        cpu_grid_shown = false;
+    }
+}
+
+static void show_cpu_grid(void)
+{
+    if (!cpu_grid_enabled || cpu_grid_shown || enable_headless) {
+        return;
+    }
+    save_screen_region(POP_GRID_REGION, popup_grid_save_buffer);
+    if (cpu_grid_drawn) {
+        restore_screen_region(POP_GRID_REGION, popup_grid_buffer);
+    } else {
+        draw_cpu_grid();
+    }
+    cpu_grid_shown = true;
+}
+
+static void toggle_cpu_grid(void)
+{
+    cpu_grid_enabled = !cpu_grid_enabled;
+    if (cpu_grid_enabled) {
+        // Show the state at the next housekeeping.
+        cpu_grid_drawn = false;
+    } else {
+        hide_cpu_grid();
+    }
+}
+
 //------------------------------------------------------------------------------
 // Public Functions
 //------------------------------------------------------------------------------
 
+uint64_t test_clks_per_tick(int test)
+{
+    if (timed_ticks[test] > 0) {
+        return timed_clks[test] / timed_ticks[test];
+    }
+    uint64_t total_clks  = 0;
+    uint64_t total_ticks = 0;
+    for (int i = 0; i < NUM_TEST_PATTERNS; i++) {
+        total_clks  += timed_clks[i];
+        total_ticks += timed_ticks[i];
+    }
+    return total_ticks > 0 ? total_clks / total_ticks : 0;
+}
+
+uint32_t test_mbps(int test)
+{
+    return test_throughput[test].mbps;
+}
+
+uint64_t block_clks_per_tick(void)
+{
+    uint64_t total_clks = 0;
+    int      num_tests  = 0;
+    for (int i = 1; i < NUM_TEST_PATTERNS; i++) {
+        if (timed_ticks[i] > 0) {
+            total_clks += timed_clks[i] / timed_ticks[i];
+            num_tests++;
+        }
+    }
+    return num_tests > 0 ? total_clks / num_tests : 0;
+}
+
+void scale_tick_timing(int shift)
+{
+    for (int i = 0; i < NUM_TEST_PATTERNS; i++) {
+        timed_clks[i] = (shift >= 0) ? timed_clks[i] << shift : timed_clks[i] >> -shift;
+    }
+}
+
 void display_init(void)
 {
     cursor_off();
@@ -173,6 +711,17 @@ void display_init(void)
     if (l3_cache) {
         display_l3_cache_size(l3_cache);
     }
+    display_memory_speeds();
+    if (num_pm_pages) {
+        // Round to nearest MB.
+        display_memory_size(1024 * ((num_pm_pages + 128) / 256));
+    }
+
+    scroll_message_row = ROW_SCROLL_T;
+}
+
+void display_memory_speeds(void)
+{
     if (l1_cache_speed) {
         display_l1_cache_speed(l1_cache_speed);
     }
@@ -185,12 +734,6 @@ void display_init(void)
     if (ram_speed) {
         display_ram_speed(ram_speed);
     }
-    if (num_pm_pages) {
-        // Round to nearest MB.
-        display_memory_size(1024 * ((num_pm_pages + 128) / 256));
-    }
-
-    scroll_message_row = ROW_SCROLL_T;
 }
 
 void display_cpu_topology(void)
@@ -293,6 +836,9 @@ void post_display_init(void)
 
 void display_start_run(void)
 {
+    // The grid is put back by the next housekeeping.
+    hide_cpu_grid();
+
     if (!enable_trace && !enable_sm) {
         clear_message_area();
     }
@@ -308,6 +854,15 @@ void display_start_run(void)
         clear_screen_region(8, 68, 8, SCREEN_WIDTH - 1);    // error count
     }
 
+    for (int i = 0; i < NUM_TEST_PATTERNS; i++) {
+        timed_pass[i]  = -1;
+        timed_clks[i]  = 0;
+        timed_ticks[i] = 0;
+    }
+    timed_test_num = -1;
+    rate_test_started = false;
+    trend_start_run();
+
     display_pass_count(0);
     error_count = 0;
     display_error_count();
@@ -330,6 +885,18 @@ void display_start_pass(void)
     display_pass_percentage(0);
     pass_bar_length = 0;
     pass_ticks = 0;
+    pass_ticks_base = 0;
+    if (clks_per_msec > 0) {
+        pass_start_time = get_tsc();
+    }
+}
+
+void display_end_pass(void)
+{
+    if (rate_test_started && clks_per_msec > 0) {
+        record_test_throughput(get_tsc());
+    }
+    trend_end_pass(pass_num);
 }
 
 void display_start_test(void)
@@ -341,8 +908,16 @@ void display_start_test(void)
     display_test_percentage(0);
     display_test_number(test_num);
     display_test_description(test_list[test_num].description);
+    if (clks_per_msec > 0) {
+        start_test_timing();
+    }
     test_bar_length = 0;
     test_ticks = 0;
+    test_ticks_base = sum_cpu_ticks();
+    pass_ticks_base = pass_ticks;
+    if (clks_per_msec > 0) {
+        start_test_throughput();
+    }
 
 #if 0
     uint64_t current_time = get_tsc();
@@ -368,7 +943,11 @@ void display_temperature(void)
         return;
     }
 
-    int actual_cpu_temp = get_cpu_temperature();
+    // Show the hottest core if we have per-core readings.
+    int actual_cpu_temp, average_temp, num_throttled = 0;
+    if (!get_thermal_summary(&actual_cpu_temp, &average_temp, &num_throttled)) {
+        actual_cpu_temp = get_cpu_temperature();
+    }
 
     if (actual_cpu_temp == 0) {
         if (max_cpu_temp == 0) {
@@ -380,16 +959,21 @@ void display_temperature(void)
     if (max_cpu_temp < actual_cpu_temp ) {
         max_cpu_temp = actual_cpu_temp;
     }
+    trend_sample_temperature(actual_cpu_temp);
 
     int offset = actual_cpu_temp / 100 + max_cpu_temp / 100;
 
     clear_screen_region(1, 18, 1, 22);
     printf(1, 20-offset, "%2i/%2i%cC", actual_cpu_temp, max_cpu_temp, 0xF8);
+    if (offset == 0) {
+        // Flag that some cores are being throttled.
+        printc(1, 27, num_throttled > 0 ? 'T' : ' ');
+    }
 }
 
 void display_big_status(bool pass)
 {
-    if (!enable_big_status || big_status_displayed) {
+    if (!enable_big_status || enable_headless || big_status_displayed) {
         return;
     }
 
@@ -454,6 +1038,9 @@ void check_input(void)
         break;
       case '1':
         config_menu(false);
+        if (bail) {
+            abort_test();
+        }
         break;
       case ' ':
         set_scroll_lock(!scroll_lock);
@@ -461,11 +1048,39 @@ void check_input(void)
       case '\n':
         scroll_wait = false;
         break;
+      case 't':
+        display_throughput_table();
+        break;
+      case 'h':
+        trend_display();
+        break;
+      case 'c':
+        toggle_cpu_grid();
+        break;
+      case 's':
+        boottime_display();
+        break;
+#if PROFILE_PHASES
+      case 'p':
+        profile_display();
+        break;
+#endif
       default:
         break;
     }
 }
 
+void abort_test(void)
+{
+    bail = true;
+
+    // The other CPUs may bail out before reaching the next barrier.
+    barrier_abort(run_barrier, power_save >= POWER_SAVE_HIGH);
+    for (int i = 0; domain_barrier != NULL && i < num_proximity_domains; i++) {
+        barrier_abort(&domain_barrier[i], power_save >= POWER_SAVE_HIGH);
+    }
+}
+
 void set_scroll_lock(bool enabled)
 {
     scroll_lock = enabled;
@@ -500,62 +1115,96 @@ void scroll(void)
 
 void do_tick(int my_cpu)
 {
-    int act_sec = 0;
-    bool use_spin_wait = (power_save < POWER_SAVE_HIGH);
-    if (use_spin_wait) {
-        barrier_spin_wait(run_barrier);
-    } else {
-        barrier_halt_wait(run_barrier);
-    }
+    cpu_progress[my_cpu].ticks++;
 
-    if (master_cpu == my_cpu) {
-        check_input();
-        error_update();
-    }
-    if (use_spin_wait) {
-        barrier_spin_wait(run_barrier);
-    } else {
-        barrier_halt_wait(run_barrier);
+    // Only the master CPU does the update, unless there is a dedicated UI
+    // core. The other CPUs carry on testing.
+    if (master_cpu != my_cpu || ui_cpu >= 0) {
+        return;
     }
 
-    // Only the master CPU does the update.
-    if (master_cpu != my_cpu) {
-        return;
+    do_housekeeping();
+}
+
+void count_test_data(int my_cpu, uintptr_t num_bytes)
+{
+    cpu_progress_t *progress = &cpu_progress[my_cpu];
+    uintptr_t bytes = progress->spare_bytes + num_bytes;
+    progress->kbytes     += bytes >> 10;
+    progress->spare_bytes = bytes & 0x3ff;
+}
+
+void display_start_headless(void)
+{
+    clear_screen_region(ROW_FOOTER, 0, ROW_FOOTER, SCREEN_WIDTH - 1);
+    set_screen_headless(ROW_FOOTER);
+}
+
+void do_housekeeping(void)
+{
+    int act_sec = 0;
+    int hours = 0, mins = 0, secs = 0;
+
+    in_housekeeping = true;
+
+    // Polling the keyboards means reading the USB controllers, the legacy
+    // keyboard controller and the serial port, so while the tests run only
+    // do it every INPUT_PERIOD ms, which is still fast enough for typing.
+    bool poll_input = true;
+    if (clks_per_msec > 0) {
+        uint64_t current_time = get_tsc();
+        if (current_time >= next_input_time) {
+            next_input_time = current_time + INPUT_PERIOD * clks_per_msec;
+        } else {
+            poll_input = false;
+        }
+    }
+    // The error reports, trace messages and menus are drawn beneath the
+    // CPU activity grid.
+    hide_cpu_grid();
+    if (poll_input) {
+        check_input();
     }
+    error_update();
+    trace_flush();
+    show_cpu_grid();
 
-    test_ticks++;
-    pass_ticks++;
+    test_ticks = (sum_cpu_ticks() - test_ticks_base) / num_active_cpus;
+    pass_ticks = pass_ticks_base + test_ticks;
 
     pass_type_t pass_type = (pass_num == 0) ? FAST_PASS : FULL_PASS;
 
-    int pct = 0;
+    int test_pct = 0;
     if (ticks_per_test[pass_type][test_num] > 0) {
-        pct = 100 * test_ticks / ticks_per_test[pass_type][test_num];
-        if (pct > 100) {
-            pct = 100;
+        test_pct = 100 * test_ticks / ticks_per_test[pass_type][test_num];
+        if (test_pct > 100) {
+            test_pct = 100;
         }
     }
-    display_test_percentage(pct);
-    display_test_bar((BAR_LENGTH * pct) / 100);
-
-    pct = 0;
+    int pass_pct = 0;
     if (ticks_per_pass[pass_type] > 0) {
-        pct = 100 * pass_ticks / ticks_per_pass[pass_type];
-        if (pct > 100) {
-            pct = 100;
+        pass_pct = 100 * pass_ticks / ticks_per_pass[pass_type];
+        if (pass_pct > 100) {
+            pass_pct = 100;
         }
     }
-    display_pass_percentage(pct);
-    display_pass_bar((BAR_LENGTH * pct) / 100);
+    if (!enable_headless) {
+        display_test_percentage(test_pct);
+        display_test_bar((BAR_LENGTH * test_pct) / 100);
+        display_pass_percentage(pass_pct);
+        display_pass_bar((BAR_LENGTH * pass_pct) / 100);
+    }
 
-    bool update_spinner = true;
+    bool update_spinner = !enable_headless;
     if (clks_per_msec > 0) {
         uint64_t current_time = get_tsc();
 
-        int secs  = (current_time - run_start_time) / (1000 * (uint64_t)clks_per_msec);
-        int mins  = secs / 60; secs %= 60; act_sec = secs;
-        int hours = mins / 60; mins %= 60;
-        display_run_time(hours, mins, secs);
+        secs  = (current_time - run_start_time) / (1000 * (uint64_t)clks_per_msec);
+        mins  = secs / 60; secs %= 60; act_sec = secs;
+        hours = mins / 60; mins %= 60;
+        if (!enable_headless) {
+            display_run_time(hours, mins, secs);
+        }
 
         if (current_time >= next_spin_time) {
             next_spin_time = current_time + SPINNER_PERIOD * clks_per_msec;
@@ -577,16 +1226,43 @@ void do_tick(int my_cpu)
     // This only tick one time per second
     if (!timed_update_done) {
 
-        // Display FAIL banner if (new) errors detected
-        if (err_banner_redraw && !big_status_displayed && error_count > 1) {
-            display_big_status(false);
-        }
-
         // Check ECC Errors
         memctrl_poll_ecc();
 
-        // Update temperature
-        display_temperature();
+        // Keep the DRAM traffic counts from wrapping
+        memctrl_poll_traffic();
+
+        if (enable_headless) {
+            // Only the status line is shown.
+            display_headless_status(pass_pct, test_pct, hours, mins, secs);
+        } else {
+            // Display FAIL banner if (new) errors detected
+            if (err_banner_redraw && !big_status_displayed && error_count > 1) {
+                display_big_status(false);
+            }
+
+            // Update temperature
+            display_temperature();
+
+            // Update the CPU activity grid
+            sample_cpu_activity();
+            if (cpu_grid_shown) {
+                draw_cpu_grid();
+            }
+
+            // Update the throughput measured over the last second
+            if (clks_per_msec > 0) {
+                update_live_throughput(get_tsc());
+                if (enable_perf_max) {
+                    update_live_clock();
+                }
+            }
+        }
+
+        // In stress mode, record the sustained throughput over time.
+        if (enable_stress && clks_per_msec > 0 && act_sec % STRESS_SAMPLE_PERIOD == 0) {
+            update_stress_sample(get_tsc());
+        }
 
         // Update TTY one time every TTY_UPDATE_PERIOD second(s)
         if (enable_tty) {
@@ -603,17 +1279,45 @@ void do_tick(int my_cpu)
         prev_sec = act_sec;
         timed_update_done = false;
     }
+
+    update_screen();
+
+    if (enable_tty) {
+        tty_xmit_poll();
+    }
+
+    if (clks_per_msec > 0) {
+        last_housekeeping_time = get_tsc();
+    }
+    in_housekeeping = false;
 }
 
-void do_trace(int my_cpu, const char *fmt, ...)
+void display_enable_heartbeat(bool enable)
 {
-    va_list args;
+    heartbeat_enabled = enable;
+}
 
-    va_start(args, fmt);
-    spin_lock(error_mutex);
-    scroll();
-    printi(scroll_message_row, 0, my_cpu, 2, false, false);
-    vprintf(scroll_message_row, 4, fmt, args);
-    spin_unlock(error_mutex);
-    va_end(args);
+void display_heartbeat(void)
+{
+    // This may interrupt any code on the master CPU, including the screen
+    // functions, so it only updates the run time and the spinner, draws them
+    // straight to the physical screen, and doesn't take any locks.
+    if (!heartbeat_enabled || in_housekeeping || enable_headless || clks_per_msec == 0) {
+        return;
+    }
+    uint64_t current_time = get_tsc();
+    if (current_time < last_housekeeping_time + HEARTBEAT_PERIOD * clks_per_msec) {
+        return;
+    }
+
+    int secs  = (current_time - run_start_time) / (1000 * (uint64_t)clks_per_msec);
+    int mins  = secs / 60; secs %= 60;
+    int hours = mins / 60; mins %= 60;
+    draw_run_time_now(hours, mins, secs);
+
+    if (current_time >= next_spin_time) {
+        next_spin_time = current_time + SPINNER_PERIOD * clks_per_msec;
+        spin_idx = (spin_idx + 1) % NUM_SPIN_STATES;
+        draw_char_now(7, 77, spin_state[spin_idx], WHITE, BLUE);
+    }
 }
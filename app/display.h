@@ -166,22 +166,37 @@ typedef enum {
 
 #define display_test_pattern_name(str) \
     { \
-        clear_screen_region(5, 39, 5, SCREEN_WIDTH - 1); \
+        clear_screen_region(5, 39, 5, SCREEN_WIDTH - 13); \
         prints(5, 39, str); \
     }
 
 #define display_test_pattern_value(pattern) \
     { \
-        clear_screen_region(5, 39, 5, SCREEN_WIDTH - 1); \
+        clear_screen_region(5, 39, 5, SCREEN_WIDTH - 13); \
         printf(5, 39, "0x%0*x", TESTWORD_DIGITS, pattern); \
     }
 
+#define display_test_wide_pattern(width, bit, zeros) \
+    { \
+        clear_screen_region(5, 39, 5, SCREEN_WIDTH - 13); \
+        printf(5, 39, "%i-bit walking %s, bit %i", width, zeros ? "zero" : "one", bit); \
+    }
+
 #define display_test_pattern_values(pattern, offset) \
     { \
-        clear_screen_region(5, 39, 5, SCREEN_WIDTH - 1); \
+        clear_screen_region(5, 39, 5, SCREEN_WIDTH - 13); \
         printf(5, 39, "0x%0*x - %i", TESTWORD_DIGITS, pattern, offset); \
     }
 
+#define display_test_transfer_rate(kps) \
+    { \
+        clear_screen_region(5, 39, 5, SCREEN_WIDTH - 13); \
+        printf(5, 39, "%u k transfers/s", (uintptr_t)(kps)); \
+    }
+
+#define display_test_throughput(mbps) \
+    printf(5, 69, "%6u MB/s", (uintptr_t)(mbps))
+
 #define display_run_time(hours, mins, secs) \
     printf(7, 51, "%i:%02i:%02i", hours, mins, secs)
 
@@ -239,8 +254,39 @@ extern int scroll_message_row;
 
 extern display_mode_t display_mode;
 
+/**
+ * Returns the average time taken by each tick of the specified test in the
+ * last pass that ran it, excluding any delays. If the test hasn't been run,
+ * returns the average over the tests that have, or 0 if none have.
+ */
+uint64_t test_clks_per_tick(int test);
+
+/**
+ * Returns the throughput of the last completed run of the specified test, in
+ * MB/s, or 0 if the test hasn't been run.
+ */
+uint32_t test_mbps(int test);
+
+/**
+ * Returns the average time taken by each tick of the tests that tick once
+ * per block (all but test 0) that have been timed in this run, excluding
+ * any delays, or 0 if none have been timed.
+ */
+uint64_t block_clks_per_tick(void);
+
+/**
+ * Multiplies the recorded times per tick by 2 to the power of shift (which
+ * may be negative), after the block size has been changed.
+ */
+void scale_tick_timing(int shift);
+
 void display_init(void);
 
+/**
+ * Displays the cache and RAM bandwidths that have been measured.
+ */
+void display_memory_speeds(void);
+
 void display_cpu_topology(void);
 
 void post_display_init(void);
@@ -249,6 +295,8 @@ void display_start_run(void);
 
 void display_start_pass(void);
 
+void display_end_pass(void);
+
 void display_start_test(void);
 
 void display_error_count(void);
@@ -261,14 +309,64 @@ void restore_big_status(void);
 
 void check_input(void);
 
+/**
+ * Makes all the CPUs stop running the current test, by setting bail and
+ * releasing any CPUs that are waiting at a barrier.
+ */
+void abort_test(void);
+
 void set_scroll_lock(bool enabled);
 
 void toggle_scroll_lock(void);
 
 void scroll(void);
 
+/**
+ * Stops drawing the display on the physical screen, apart from a single
+ * status line showing the progress and the error count, which is updated
+ * once per second.
+ */
+void display_start_headless(void);
+
 void do_tick(int my_cpu);
 
+/**
+ * Adds num_bytes to the amount of test data processed by the specified CPU.
+ * Used to measure the throughput of each test.
+ */
+void count_test_data(int my_cpu, uintptr_t num_bytes);
+
+/**
+ * Polls the keyboard, reports any new errors, and updates the progress
+ * display and the other periodic status information. Called by do_tick()
+ * on the master CPU, or repeatedly by the dedicated UI core if there is one.
+ */
+void do_housekeeping(void);
+
+/**
+ * The period of the heartbeat interrupt, in milliseconds.
+ */
+#define HEARTBEAT_PERIOD    100
+
+/**
+ * Selects whether display_heartbeat() updates the display. It is only enabled
+ * while the master CPU runs a test, as at other times a popup may cover the
+ * status area.
+ */
+void display_enable_heartbeat(bool enable);
+
+/**
+ * Keeps the run time and the spinner moving when the master CPU hasn't done
+ * the housekeeping for a heartbeat period, e.g. while a test kernel works
+ * through a large chunk between ticks. Called from the heartbeat interrupt
+ * handler.
+ */
+void display_heartbeat(void);
+
+/**
+ * Records a trace message from the specified CPU. This is normally used
+ * through the trace() macro. See trace.h.
+ */
 void do_trace(int my_cpu, const char *fmt, ...);
 
 #endif // DISPLAY_H
@@ -0,0 +1,351 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cache.h"
+#include "cpuid.h"
+#include "heap.h"
+#include "memsize.h"
+#include "tsc.h"
+
+#include "config.h"
+#include "display.h"
+#include "test.h"
+
+#include "errlog.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define LOG_SIGNATURE   0x4c45544d  // "MTEL"
+
+#define LOG_VERSION     2
+
+#define LOG_SIZE        (32 * 1024)
+
+#define LOG_ENTRIES     (LOG_SIZE / sizeof(entry_t) - 2)
+
+// Limits the address and data errors logged in each pass, so an error storm
+// can't push the rest of the log out of the ring. The first error of each
+// boot is also kept in its own slot, which is never overwritten.
+#define MAX_PASS_ERRORS 64
+
+#define NO_CPU          0xffff
+
+#define NO_TEST         0xff
+
+//------------------------------------------------------------------------------
+// Types
+//------------------------------------------------------------------------------
+
+// The layout is the same in the 32-bit and 64-bit builds, and is documented
+// in the README. The header and each entry fill one cache line. The CRC only
+// covers the fixed part of the header, as the head changes with each event.
+// The first error of each boot is copied into first_error, ahead of the ring.
+
+typedef struct {
+    uint32_t    signature;
+    uint32_t    version;
+    uint32_t    entry_size;
+    uint32_t    num_entries;
+    uint32_t    boot_count;
+    uint32_t    reserved1;
+    uint64_t    base_addr;
+    uint32_t    crc;
+    uint32_t    head;
+    uint32_t    reserved2[6];
+} header_t;
+
+typedef struct {
+    uint32_t    seq;
+    uint32_t    check;
+    uint16_t    boot;
+    uint8_t     type;
+    uint8_t     test;
+    uint16_t    cpu;
+    uint16_t    pass;
+    uint64_t    addr;
+    uint64_t    good;
+    uint64_t    bad;
+    uint64_t    tsc;
+    uint32_t    reserved[4];
+} entry_t;
+
+typedef struct {
+    header_t    header;
+    entry_t     first_error;
+    entry_t     entry[];
+} log_t;
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+static log_t        *errlog         = NULL;
+
+static bool         flush_lines     = false;
+
+static bool         first_error_logged = false;
+static int          pass_errors     = 0;    // address and data errors logged in this pass
+
+// A summary of the log left by the previous boot.
+
+static bool         prev_valid      = false;
+static uint32_t     prev_last_seq   = 0;
+static uint32_t     prev_errors     = 0;
+static uint32_t     prev_ecc_errors = 0;
+static int          prev_pass       = 0;
+static uint64_t     prev_first_addr = 0;
+
+static bool         reported        = false;
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+// Returns the CRC-32 (as used by Ethernet and UEFI) of the specified bytes.
+static uint32_t crc32(const void *data, size_t length)
+{
+    const uint8_t *byte = (const uint8_t *)data;
+
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= byte[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t header_crc(const header_t *header)
+{
+    return crc32(header, offsetof(header_t, crc));
+}
+
+// Returns the sum of the 32-bit words of the entry, up to the reserved words.
+// The check word makes this zero for a completely written entry.
+static uint32_t entry_sum(const entry_t *entry)
+{
+    const uint32_t *word = (const uint32_t *)entry;
+
+    uint32_t sum = 0;
+    for (uintptr_t i = 0; i < offsetof(entry_t, reserved) / sizeof(uint32_t); i++) {
+        sum += word[i];
+    }
+    return sum;
+}
+
+static bool entry_valid(const entry_t *entry)
+{
+    return entry->seq != 0 && entry_sum(entry) == 0;
+}
+
+// Writes the line back to memory, so it survives a reset that discards the
+// contents of the caches.
+static void flush_line(const void *addr)
+{
+    if (flush_lines) {
+        cache_flush_line(addr);
+    }
+}
+
+static void summarise_prev_log(void)
+{
+    const header_t *header = &errlog->header;
+    if (header->signature   != LOG_SIGNATURE
+    ||  header->version     != LOG_VERSION
+    ||  header->entry_size  != sizeof(entry_t)
+    ||  header->num_entries != LOG_ENTRIES
+    ||  header->base_addr   != (uintptr_t)errlog
+    ||  header->crc         != header_crc(header)) {
+        return;
+    }
+    prev_valid = true;
+
+    // The head may not have reached memory before a reset, so the entries
+    // themselves show where to continue. As the ring may have lost the first
+    // error, and the errors over the per-pass limit aren't logged, the first
+    // error slot and the pass events are used if they are valid.
+    uint32_t first_error_seq = 0;
+    uint32_t last_pass_seq   = 0;
+    uint32_t last_pass_errors = 0;
+    for (uintptr_t i = 0; i < LOG_ENTRIES; i++) {
+        const entry_t *entry = &errlog->entry[i];
+        if (!entry_valid(entry)) {
+            continue;
+        }
+        if (entry->seq > prev_last_seq) {
+            prev_last_seq = entry->seq;
+        }
+        if (entry->boot != (uint16_t)header->boot_count) {
+            continue;
+        }
+        switch (entry->type) {
+          case ERRLOG_PASS:
+            if (entry->pass > prev_pass) {
+                prev_pass = entry->pass;
+            }
+            if (entry->seq > last_pass_seq) {
+                last_pass_seq    = entry->seq;
+                last_pass_errors = (uint32_t)entry->addr;
+            }
+            break;
+          case ERRLOG_ADDR:
+          case ERRLOG_DATA:
+          case ERRLOG_PARITY:
+            prev_errors++;
+            if (first_error_seq == 0 || entry->seq < first_error_seq) {
+                first_error_seq = entry->seq;
+                prev_first_addr = entry->addr;
+            }
+            break;
+          case ERRLOG_ECC:
+            prev_ecc_errors++;
+            break;
+          default:
+            break;
+        }
+    }
+    if (last_pass_errors > prev_errors) {
+        prev_errors = last_pass_errors;
+    }
+    const entry_t *first_error = &errlog->first_error;
+    if (entry_valid(first_error) && first_error->boot == (uint16_t)header->boot_count) {
+        prev_first_addr = first_error->addr;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+void errlog_reserve(void)
+{
+    if (!enable_errlog) {
+        return;
+    }
+    errlog = (log_t *)heap_alloc(HEAP_TYPE_HM_1, LOG_SIZE, PAGE_SIZE);
+    if (errlog != NULL) {
+        summarise_prev_log();
+    }
+}
+
+void errlog_init(void)
+{
+    if (errlog == NULL) {
+        return;
+    }
+    flush_lines = cpuid_info.flags.cflush;
+
+    header_t *header = &errlog->header;
+    if (prev_valid) {
+        header->boot_count++;
+    } else {
+        errlog->first_error.seq = 0;
+        flush_line(&errlog->first_error);
+        for (uintptr_t i = 0; i < LOG_ENTRIES; i++) {
+            errlog->entry[i].seq = 0;
+            flush_line(&errlog->entry[i]);
+        }
+        header->signature   = LOG_SIGNATURE;
+        header->version     = LOG_VERSION;
+        header->entry_size  = sizeof(entry_t);
+        header->num_entries = LOG_ENTRIES;
+        header->boot_count  = 1;
+        header->reserved1   = 0;
+        header->base_addr   = (uintptr_t)errlog;
+        for (uintptr_t i = 0; i < sizeof(header->reserved2) / sizeof(uint32_t); i++) {
+            header->reserved2[i] = 0;
+        }
+    }
+    header->crc  = header_crc(header);
+    header->head = prev_last_seq;
+    flush_line(header);
+
+    errlog_append(ERRLOG_BOOT, -1, 0, 0, 0);
+}
+
+void errlog_report(void)
+{
+    if (reported || !prev_valid || (prev_errors == 0 && prev_ecc_errors == 0)) {
+        return;
+    }
+    reported = true;
+
+    uint64_t log_addr = (uintptr_t)errlog;
+    if (enable_trace) {
+        trace(0, "previous boot logged %u errors, %u ECC errors, %u passes",
+              (uintptr_t)prev_errors, (uintptr_t)prev_ecc_errors, (uintptr_t)prev_pass);
+        return;
+    }
+    scroll();
+    display_scrolled_message(0, "Previous boot: %u errors, %u corrected ECC errors, %u passes completed",
+                             (uintptr_t)prev_errors, (uintptr_t)prev_ecc_errors, (uintptr_t)prev_pass);
+    scroll();
+    if (prev_errors > 0) {
+        display_scrolled_message(0, "First error at 0x%08x%08x. Error log at memmap=%uK$0x%08x%08x",
+                                 (uintptr_t)(prev_first_addr >> 32), (uintptr_t)(prev_first_addr & 0xFFFFFFFFU),
+                                 (uintptr_t)(LOG_SIZE >> 10),
+                                 (uintptr_t)(log_addr >> 32), (uintptr_t)(log_addr & 0xFFFFFFFFU));
+    } else {
+        display_scrolled_message(0, "Error log at memmap=%uK$0x%08x%08x",
+                                 (uintptr_t)(LOG_SIZE >> 10),
+                                 (uintptr_t)(log_addr >> 32), (uintptr_t)(log_addr & 0xFFFFFFFFU));
+    }
+}
+
+void errlog_append(errlog_event_t type, int cpu, uint64_t addr, testword_t good, testword_t bad)
+{
+    if (errlog == NULL) {
+        return;
+    }
+
+    bool is_error = false;
+    switch (type) {
+      case ERRLOG_PASS:
+        pass_errors = 0;
+        break;
+      case ERRLOG_ADDR:
+      case ERRLOG_DATA:
+        // These are only logged by error_update(), on one CPU at a time.
+        if (pass_errors >= MAX_PASS_ERRORS) {
+            return;
+        }
+        pass_errors++;
+        is_error = true;
+        break;
+      case ERRLOG_PARITY:
+        is_error = true;
+        break;
+      default:
+        break;
+    }
+
+    // Claiming a slot is the only shared write, so any CPU can append.
+    uint32_t seq = __sync_add_and_fetch(&errlog->header.head, 1);
+
+    entry_t *entry = &errlog->entry[(seq - 1) % LOG_ENTRIES];
+    entry->seq   = seq;
+    entry->boot  = errlog->header.boot_count;
+    entry->type  = type;
+    entry->test  = (cpu >= 0) ? cpu_context[cpu].running_test : NO_TEST;
+    entry->cpu   = (cpu >= 0) ? cpu : NO_CPU;
+    entry->pass  = pass_num;
+    entry->addr  = addr;
+    entry->good  = good;
+    entry->bad   = bad;
+    entry->tsc   = get_tsc();
+    entry->check = 0;
+    entry->check = -entry_sum(entry);
+    flush_line(entry);
+
+    if (is_error && !first_error_logged && __sync_bool_compare_and_swap(&first_error_logged, false, true)) {
+        errlog->first_error = *entry;
+        flush_line(&errlog->first_error);
+    }
+}
@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef ERRLOG_H
+#define ERRLOG_H
+/**
+ * \file
+ *
+ * Provides a compact binary log of the errors and other events of a run,
+ * kept in a reserved range of physical memory that is excluded from the
+ * tests. The log survives a warm reboot, so if the machine hangs or resets
+ * after finding errors, the next boot reports what the previous one found,
+ * and an operating system started with a matching memmap= reservation can
+ * read it from memory. The layout is documented in the README.
+ *
+ * Each event costs a few stores and a cache line flush, but the slots are
+ * claimed through a shared counter, so the address and data errors are
+ * logged when error_update() drains them, rather than from the test loops.
+ * Only the first few of these are logged in each pass, and the first one of
+ * each boot is kept where the later entries can't overwrite it.
+ *
+ *//*
+ * Copyright (C) 2024 Memtest86+ contributors.
+ */
+
+#include <stdint.h>
+
+#include "test.h"
+
+/**
+ * The event types recorded in the log.
+ */
+typedef enum {
+    ERRLOG_BOOT     = 1,
+    ERRLOG_PASS     = 2,
+    ERRLOG_ADDR     = 3,
+    ERRLOG_DATA     = 4,
+    ERRLOG_ECC      = 5,
+    ERRLOG_PARITY   = 6
+} errlog_event_t;
+
+/**
+ * Reserves the memory for the log and reads any log left there by the
+ * previous boot, without changing it. Does nothing if the log has been
+ * disabled by the noerrlog boot option. Must be called after the boot
+ * options have been read, but before any heap allocation that depends on
+ * them, so the log is found at the same address on every boot.
+ */
+void errlog_reserve(void);
+
+/**
+ * Starts logging the events of this boot after those of the previous one,
+ * or starts a new log if none was found. Must not be called until the data
+ * structures passed by the BIOS and boot loader are no longer needed, as
+ * they may occupy the same memory.
+ */
+void errlog_init(void);
+
+/**
+ * Displays a summary of the errors logged by the previous boot, if there
+ * were any, and the memmap= reservation that keeps the log from being used
+ * by an operating system. Only displays anything the first time it is
+ * called.
+ */
+void errlog_report(void);
+
+/**
+ * Appends an event to the log. For errors, addr is the physical address,
+ * and good and bad are the expected and actual values. For the pass event,
+ * addr is the number of errors found so far. cpu is -1 if the event wasn't
+ * detected by a CPU core running a test. Safe to call concurrently from any
+ * CPU core, except that address and data errors must only be appended by
+ * one CPU core at a time.
+ */
+void errlog_append(errlog_event_t type, int cpu, uint64_t addr, testword_t good, testword_t bad);
+
+#endif // ERRLOG_H
@@ -13,7 +13,12 @@
 
 #include <limits.h>
 
+#include "cpuid.h"
+#include "cpuinfo.h"
+#include "heap.h"
+#include "smbios.h"
 #include "smp.h"
+#include "tsc.h"
 #include "vmem.h"
 
 #include "badram.h"
@@ -24,6 +29,8 @@
 #include "tests.h"
 #include "serial.h"
 #include "memctrl.h"
+#include "telemetry.h"
+#include "errlog.h"
 #include "error.h"
 
 //------------------------------------------------------------------------------
@@ -34,6 +41,20 @@
 #define USB_WORKAROUND 1
 #endif
 
+#define ERROR_STAGE_SIZE    8   // must be a power of 2
+
+#define NUM_DRAM_LOCATIONS  8   // 2 memory controllers x 2 channels x 2 DIMMs
+
+#define NUM_SMBIOS_DIMMS    32  // as indexed by smbios_find_dimm()
+
+#define MAX_DIMM_NAME_LENGTH 16
+
+#define FAULTY_SET_BITS     14
+#define FAULTY_SET_SIZE     (1 << FAULTY_SET_BITS)
+#define FAULTY_SET_LIMIT    (FAULTY_SET_SIZE - FAULTY_SET_SIZE / 4)
+
+#define STORM_PERIOD        1000    // milliseconds
+
 //------------------------------------------------------------------------------
 // Types
 //------------------------------------------------------------------------------
@@ -62,8 +83,52 @@ typedef struct {
     uintptr_t           max_run;
     uintptr_t           last_addr;
     testword_t          last_xor;
+    uint32_t            bit_errors[TESTWORD_WIDTH];
+    uint32_t            dimm_errors[NUM_DRAM_LOCATIONS];
+    uint32_t            smbios_dimm_errors[NUM_SMBIOS_DIMMS];
 } error_info_t;
 
+// While the errors arrive faster than storm_threshold per STORM_PERIOD, the
+// address mode display coalesces them into one line per period.
+
+typedef struct {
+    uint64_t            period_start;   // TSC time stamp
+    int                 period_errors;
+    bool                active;
+    int                 cpu;            // of the last error coalesced
+    int                 test;           // of the last error coalesced
+    uintptr_t           count;
+    testword_t          xor_mask;
+    page_offs_t         min_addr;
+    page_offs_t         max_addr;
+} error_storm_t;
+
+typedef struct {
+    error_type_t        type;
+    uintptr_t           addr;
+    testword_t          good;
+    testword_t          bad;
+    bool                use_for_badram;
+} staged_error_t;
+
+// Each CPU records the address and data errors it detects in its own staging ring, which
+// is drained by error_update(). The head index and the overflow summary are
+// only written by the CPU that owns the ring. The tail index and the drained
+// overflow counts are only written by the CPU that drains it.
+
+typedef struct __attribute__((aligned(64))) {
+    volatile uintptr_t  head;
+    volatile uintptr_t  tail;
+    staged_error_t      entry[ERROR_STAGE_SIZE];
+    volatile uintptr_t  overflow_count;
+    volatile uintptr_t  overflow_total_bits;
+    volatile testword_t overflow_bad_bits;
+    volatile uintptr_t  overflow_min_addr;
+    volatile uintptr_t  overflow_max_addr;
+    uintptr_t           drained_count;
+    uintptr_t           drained_total_bits;
+} error_stage_t;
+
 //------------------------------------------------------------------------------
 // Private Variables
 //------------------------------------------------------------------------------
@@ -72,6 +137,27 @@ static error_mode_t     last_error_mode = ERROR_MODE_NONE;
 
 static error_info_t     error_info;
 
+static error_storm_t    storm;
+
+static error_stage_t    error_stage[MAX_CPUS];
+
+static bool             use_popcnt = false;
+
+// The set of the faulty addresses seen in the current run, as an open
+// addressing hash table allocated from the pinned heap. A key is the
+// physical address of a word with its lowest bit set, so 0 marks an empty
+// slot.
+
+static uint64_t         *faulty_set = NULL;
+
+static int              faulty_set_count = 0;
+
+static bool             fail_fast_stopped = false;
+
+// The pass whose seed was last recorded in the address list, or -1 if none.
+
+static int              seed_logged_pass = -1;
+
 //------------------------------------------------------------------------------
 // Public Variables
 //------------------------------------------------------------------------------
@@ -79,43 +165,104 @@ static error_info_t     error_info;
 uint64_t                error_count      = 0;
 uint64_t                error_count_cecc = 0;
 
+int                     num_faulty_pages = 0;
+uintptr_t               faulty_pages[MAX_FAULTY_PAGES];
+
 //------------------------------------------------------------------------------
 // Private Functions
 //------------------------------------------------------------------------------
 
-static bool update_error_info(testword_t page, testword_t offset, uintptr_t addr, testword_t xor)
+static int count_bits(testword_t value)
 {
-    bool update_stats = false;
+    if (use_popcnt) {
+        testword_t count;
+        __asm__ ("popcnt %1, %0" : "=r" (count) : "rm" (value));
+        return (int)count;
+    }
+    // Count the set bits in parallel, avoiding a call to a library function.
+    testword_t ones = ~(testword_t)0;
+    value = value - ((value >> 1) & (ones / 3));
+    value = (value & (ones / 5)) + ((value >> 2) & (ones / 5));
+    value = (value + (value >> 4)) & (ones / 17);
+    return (int)((value * (ones / 255)) >> (TESTWORD_WIDTH - 8));
+}
 
-    // Update address range.
+// Adds the address to the set of faulty addresses. Returns false if it was
+// already in the set (or the set is full).
+static bool add_faulty_addr(testword_t page, testword_t offset)
+{
+    if (faulty_set == NULL || faulty_set_count >= FAULTY_SET_LIMIT) {
+        return true;
+    }
+    uint64_t key = ((uint64_t)page << PAGE_SHIFT | offset) | 1;
 
-    if (error_info.min_addr.page > page) {
-        error_info.min_addr.page   = page;
-        error_info.min_addr.offset = offset;
-        update_stats = true;
-    } else if (error_info.min_addr.page == page && error_info.min_addr.offset > offset) {
-        error_info.min_addr.offset = offset;
-        update_stats = true;
+    // Fibonacci hashing, then linear probing.
+    uint32_t idx = (key * 0x9e3779b97f4a7c15ULL) >> (64 - FAULTY_SET_BITS);
+    while (faulty_set[idx] != 0) {
+        if (faulty_set[idx] == key) {
+            return false;
+        }
+        idx = (idx + 1) & (FAULTY_SET_SIZE - 1);
     }
-    if (error_info.max_addr.page < page) {
-        error_info.max_addr.page   = page;
-        error_info.max_addr.offset = offset;
-        update_stats = true;
-    } else if (error_info.max_addr.page == page && error_info.max_addr.offset < offset) {
-        error_info.max_addr.offset = offset;
-        update_stats = true;
+    faulty_set[idx] = key;
+    faulty_set_count++;
+    return true;
+}
+
+// Adds the page to the list of faulty pages.
+static void add_faulty_page(testword_t page)
+{
+    int i = num_faulty_pages;
+    while (i > 0 && faulty_pages[i - 1] >= page) {
+        if (faulty_pages[i - 1] == page) {
+            return;
+        }
+        i--;
+    }
+    if (num_faulty_pages == MAX_FAULTY_PAGES) {
+        return;
     }
+    for (int j = num_faulty_pages; j > i; j--) {
+        faulty_pages[j] = faulty_pages[j - 1];
+    }
+    faulty_pages[i] = page;
+    num_faulty_pages++;
+}
 
-    // Update bits in error.
+static bool update_error_info(testword_t page, testword_t offset, uintptr_t addr, testword_t xor, bool new_addr)
+{
+    bool update_stats = false;
 
-    int bits = 0;
-    for (int i = 0; i < TESTWORD_WIDTH; i++) {
-        if ((xor >> i) & 1) {
-            bits++;
+    // Update address range. This can't change if the address has already
+    // been seen.
+
+    if (new_addr) {
+        if (error_info.min_addr.page > page) {
+            error_info.min_addr.page   = page;
+            error_info.min_addr.offset = offset;
+            update_stats = true;
+        } else if (error_info.min_addr.page == page && error_info.min_addr.offset > offset) {
+            error_info.min_addr.offset = offset;
+            update_stats = true;
+        }
+        if (error_info.max_addr.page < page) {
+            error_info.max_addr.page   = page;
+            error_info.max_addr.offset = offset;
+            update_stats = true;
+        } else if (error_info.max_addr.page == page && error_info.max_addr.offset < offset) {
+            error_info.max_addr.offset = offset;
+            update_stats = true;
         }
     }
+
+    // Update bits in error, and the count of errors in each bit position.
+
+    int bits = count_bits(xor);
     if (bits > 0 && error_count < ERROR_LIMIT) {
         error_info.total_bits += bits;
+        for (testword_t mask = xor; mask != 0; mask &= mask - 1) {
+            error_info.bit_errors[__builtin_ctzl(mask)]++;
+        }
     }
     if (bits > error_info.max_bits) {
         error_info.max_bits = bits;
@@ -150,7 +297,129 @@ static bool update_error_info(testword_t page, testword_t offset, uintptr_t addr
     return update_stats;
 }
 
-static void common_err(error_type_t type, uintptr_t addr, testword_t good, testword_t bad, bool use_for_badram)
+static int worst_bit(void)
+{
+    int worst = 0;
+    for (int i = 1; i < TESTWORD_WIDTH; i++) {
+        if (error_info.bit_errors[i] > error_info.bit_errors[worst]) {
+            worst = i;
+        }
+    }
+    return worst;
+}
+
+static int location_index(const dram_location_t *loc)
+{
+    if (loc->mc < 0 || loc->mc > 1 || loc->channel < 0 || loc->channel > 1 || loc->dimm < 0 || loc->dimm > 1) {
+        return -1;
+    }
+    return loc->mc * 4 + loc->channel * 2 + loc->dimm;
+}
+
+static int worst_dimm(void)
+{
+    int worst = 0;
+    for (int i = 1; i < NUM_DRAM_LOCATIONS; i++) {
+        if (error_info.dimm_errors[i] > error_info.dimm_errors[worst]) {
+            worst = i;
+        }
+    }
+    return worst;
+}
+
+static int worst_smbios_dimm(void)
+{
+    int worst = 0;
+    for (int i = 1; i < NUM_SMBIOS_DIMMS; i++) {
+        if (error_info.smbios_dimm_errors[i] > error_info.smbios_dimm_errors[worst]) {
+            worst = i;
+        }
+    }
+    return worst;
+}
+
+static void reset_storm(void)
+{
+    storm.period_start    = 0;
+    storm.period_errors   = 0;
+    storm.active          = false;
+    storm.count           = 0;
+    storm.xor_mask        = 0;
+    storm.min_addr.page   = UINTPTR_MAX;
+    storm.min_addr.offset = PAGE_SIZE - 1;
+    storm.max_addr.page   = 0;
+    storm.max_addr.offset = 0;
+}
+
+// Displays one line for the errors coalesced in the last storm period.
+static void report_storm(void)
+{
+    scroll();
+
+    set_foreground_colour(YELLOW);
+
+    display_scrolled_message(0, " %2i   %4i   %2i   %09x%03x-%09x%03x",
+                             storm.cpu, pass_num, storm.test,
+                             storm.min_addr.page, storm.min_addr.offset,
+                             storm.max_addr.page, storm.max_addr.offset);
+    display_scrolled_message(44, "%0*x  %u errors", TESTWORD_DIGITS, storm.xor_mask, storm.count);
+
+    set_foreground_colour(WHITE);
+
+    storm.count           = 0;
+    storm.xor_mask        = 0;
+    storm.min_addr.page   = UINTPTR_MAX;
+    storm.min_addr.offset = PAGE_SIZE - 1;
+    storm.max_addr.page   = 0;
+    storm.max_addr.offset = 0;
+}
+
+// Ends the current storm period if it is over, reporting the errors that were
+// coalesced in it. The storm continues while each period has too many errors.
+static void end_storm_period(uint64_t now)
+{
+    if (now - storm.period_start < STORM_PERIOD * (uint64_t)clks_per_msec) {
+        return;
+    }
+    if (storm.count > 0) {
+        report_storm();
+    }
+    storm.active        = storm.period_errors > storm_threshold;
+    storm.period_start  = now;
+    storm.period_errors = 0;
+}
+
+// Counts an error found by a test, and returns true if it should be coalesced
+// into the storm line rather than displayed on its own.
+static bool in_error_storm(void)
+{
+    if (storm_threshold <= 0 || clks_per_msec == 0) {
+        return false;
+    }
+    end_storm_period(get_tsc());
+    if (++storm.period_errors > storm_threshold) {
+        storm.active = true;
+    }
+    return storm.active;
+}
+
+static void coalesce_error(int cpu, int test, testword_t page, testword_t offset, testword_t xor)
+{
+    if (storm.min_addr.page > page || (storm.min_addr.page == page && storm.min_addr.offset > offset)) {
+        storm.min_addr.page   = page;
+        storm.min_addr.offset = offset;
+    }
+    if (storm.max_addr.page < page || (storm.max_addr.page == page && storm.max_addr.offset < offset)) {
+        storm.max_addr.page   = page;
+        storm.max_addr.offset = offset;
+    }
+    storm.xor_mask |= xor;
+    storm.cpu       = cpu;
+    storm.test      = test;
+    storm.count++;
+}
+
+static void common_err(error_type_t type, int cpu, uintptr_t addr, testword_t good, testword_t bad, bool use_for_badram)
 {
     spin_lock(error_mutex);
 
@@ -161,20 +430,59 @@ static void common_err(error_type_t type, uintptr_t addr, testword_t good, testw
         clear_message_area();
         badram_init();
     }
+    if (new_header) {
+        seed_logged_pass = -1;
+        reset_storm();
+    }
     last_error_mode = error_mode;
 
     testword_t xor = good ^ bad;
 
+    // The ECC errors aren't found by a test, so can't be attributed to one.
+    int test = (type == CECC_ERROR || type == NEW_MODE) ? test_num : cpu_context[cpu].running_test;
+
     bool new_stats = false;
     testword_t page   = page_of((void *)addr);
     testword_t offset = addr & (PAGE_SIZE - 1);
 
+    // The memory controller reports ECC errors by physical address, which
+    // may be unknown (zero).
+    bool ecc_addr_known = (type == CECC_ERROR && ecc_status.addr != 0);
+    if (type == CECC_ERROR) {
+        page   = ecc_status.addr >> PAGE_SHIFT;
+        offset = ecc_status.addr & (PAGE_SIZE - 1);
+    }
+
+    // A stuck bit is reported again on every sweep, so only analyse the
+    // address the first time it is seen.
+    bool new_faulty_addr = false;
+    if (type == ADDR_ERROR || type == DATA_ERROR || ecc_addr_known) {
+        new_faulty_addr = add_faulty_addr(page, offset);
+    }
+
+    // Find which DIMM holds the address, if the memory controller allows.
+    uint64_t phys_addr = (uint64_t)page << PAGE_SHIFT | offset;
+    dram_location_t location;
+    bool located = false;
+    if (type == ADDR_ERROR || type == DATA_ERROR || ecc_addr_known) {
+        located = memctrl_decode_addr(phys_addr, &location);
+        int idx = located ? location_index(&location) : -1;
+        if (idx >= 0 && error_info.dimm_errors[idx] < UINT32_MAX) {
+            error_info.dimm_errors[idx]++;
+        }
+        // Otherwise fall back to the coarser SMBIOS mapping.
+        idx = located ? -1 : smbios_find_dimm(phys_addr);
+        if (idx >= 0 && idx < NUM_SMBIOS_DIMMS && error_info.smbios_dimm_errors[idx] < UINT32_MAX) {
+            error_info.smbios_dimm_errors[idx]++;
+        }
+    }
+
     switch (type) {
       case ADDR_ERROR:
-        new_stats = update_error_info(page, offset, addr, 0);
+        new_stats = update_error_info(page, offset, addr, 0, new_faulty_addr);
         break;
       case DATA_ERROR:
-        new_stats = update_error_info(page, offset, addr, xor);
+        new_stats = update_error_info(page, offset, addr, xor, new_faulty_addr);
         break;
       case NEW_MODE:
         new_stats = (error_count > 0);
@@ -188,6 +496,9 @@ static void common_err(error_type_t type, uintptr_t addr, testword_t good, testw
     if (error_mode == ERROR_MODE_BADRAM && use_for_badram) {
         new_badram = badram_insert(page, offset);
     }
+    if ((use_for_badram || ecc_addr_known) && new_faulty_addr) {
+        add_faulty_page(page);
+    }
 
     if (new_address) {
         if (type == CECC_ERROR) {
@@ -198,10 +509,26 @@ static void common_err(error_type_t type, uintptr_t addr, testword_t good, testw
             if (error_count < ERROR_LIMIT) {
                 error_count++;
             }
-            if (test_list[test_num].errors < INT_MAX) {
-                test_list[test_num].errors++;
+            if (test_list[test].errors < INT_MAX) {
+                test_list[test].errors++;
             }
         }
+
+        switch (type) {
+          case ADDR_ERROR:
+          case DATA_ERROR:
+            telemetry_error(cpu, phys_addr, good, bad, type == ADDR_ERROR, located ? &location : NULL);
+            break;
+          case PARITY_ERROR:
+            telemetry_parity_error(cpu, phys_addr);
+            break;
+          case CECC_ERROR:
+            telemetry_ecc_error(ecc_status.core, ecc_status.addr, ecc_status.channel, ecc_status.count,
+                                ecc_status.syndrome, ecc_status.tsc, located ? &location : NULL);
+            break;
+          default:
+            break;
+        }
     }
 
     switch (error_mode) {
@@ -215,6 +542,8 @@ static void common_err(error_type_t type, uintptr_t addr, testword_t good, testw
             display_pinned_message(2, 1,  "    Bits in Error Mask:");
             display_pinned_message(3, 1,  " Bits in Error - Total:");
             display_pinned_message(4, 1,  " Max Contiguous Errors:");
+            display_pinned_message(5, 1,  " Most Frequent Bad Bit:");
+            display_pinned_message(6, 1,  "Most Frequent Bad DIMM:");
 
             display_pinned_message(0, 64, "Test  Errors");
             for (int i = 0; i < NUM_TEST_PATTERNS; i++) {
@@ -223,12 +552,7 @@ static void common_err(error_type_t type, uintptr_t addr, testword_t good, testw
 
         }
         if (new_stats) {
-            int bits = 0;
-            for (int i = 0; i < TESTWORD_WIDTH; i++) {
-                if (error_info.bad_bits >> i & 1) {
-                    bits++;
-                }
-            }
+            int bits = count_bits(error_info.bad_bits);
             display_pinned_message(0, 25, "%09x%03x (%kB)",
                                           error_info.min_addr.page,
                                           error_info.min_addr.offset,
@@ -246,6 +570,32 @@ static void common_err(error_type_t type, uintptr_t addr, testword_t good, testw
                                           (int)(error_info.total_bits / error_count));
             display_pinned_message(4, 25, "%u",
                                           error_info.max_run);
+            if (error_info.total_bits > 0) {
+                int bit = worst_bit();
+                display_pinned_message(5, 25, "%2i (%u errors)   ",
+                                              bit, error_info.bit_errors[bit]);
+            }
+            int dimm = worst_dimm();
+            int smbios_dimm = worst_smbios_dimm();
+            if (error_info.dimm_errors[dimm] > 0) {
+                display_pinned_message(6, 25, "MC%i CH%i DIMM%i (%u errors)   ",
+                                              dimm >> 2, (dimm >> 1) & 1, dimm & 1,
+                                              error_info.dimm_errors[dimm]);
+            } else if (error_info.smbios_dimm_errors[smbios_dimm] > 0) {
+                // Leave room for the count before the test error counts.
+                char name[MAX_DIMM_NAME_LENGTH + 1];
+                const char *slot = smbios_dimm_name(smbios_dimm);
+                int length = 0;
+                while (slot[length] != '\0' && length < MAX_DIMM_NAME_LENGTH) {
+                    name[length] = slot[length];
+                    length++;
+                }
+                name[length] = '\0';
+                display_pinned_message(6, 25, "%s (%u errors)   ", name,
+                                              error_info.smbios_dimm_errors[smbios_dimm]);
+            } else {
+                display_pinned_message(6, 25, "unknown");
+            }
 
             for (int i = 0; i < NUM_TEST_PATTERNS; i++) {
                 display_pinned_message(1 + i, 69, "%c%i",
@@ -275,15 +625,28 @@ static void common_err(error_type_t type, uintptr_t addr, testword_t good, testw
             //                  fields:    NN   NNNN   NN   PPPPPPPPPOOO (N.NN?B)  XXXXXXXX  XXXXXXXX  XXXXXXXX
 #endif
         }
+        if (new_address && (type == ADDR_ERROR || type == DATA_ERROR) && in_error_storm()) {
+            // The full detail still goes to the telemetry stream.
+            coalesce_error(cpu, test, page, offset, xor);
+            display_error_count();
+            break;
+        }
         if (new_address) {
             check_input();
+            // Record the seed of each pass that finds errors, so the random
+            // patterns it used can be repeated with the seed boot option.
+            if (pass_num != seed_logged_pass) {
+                seed_logged_pass = pass_num;
+                scroll();
+                display_scrolled_message(6, "%4i   pass seed %u", pass_num, pass_seed);
+            }
             scroll();
 
             set_foreground_colour(YELLOW);
 
             display_scrolled_message(0, " %2i   %4i   %2i   %09x%03x (%kB)",
-                                     type != CECC_ERROR ? smp_my_cpu_num() : ecc_status.core,
-                                     pass_num, test_num, page, offset, page << 2);
+                                     type != CECC_ERROR ? cpu : ecc_status.core,
+                                     pass_num, test, page, offset, page << 2);
 
             if (type == PARITY_ERROR) {
                 display_scrolled_message(41, "%s", "Parity error detected near this address");
@@ -321,6 +684,120 @@ static void common_err(error_type_t type, uintptr_t addr, testword_t good, testw
     spin_unlock(error_mutex);
 }
 
+static void merge_overflow(int cpu, error_stage_t *stage)
+{
+    uintptr_t count      = stage->overflow_count;
+    uintptr_t total_bits = stage->overflow_total_bits;
+
+    uintptr_t new_count = count - stage->drained_count;
+    if (new_count == 0) {
+        return;
+    }
+
+    spin_lock(error_mutex);
+
+    uintptr_t min_addr = stage->overflow_min_addr;
+    uintptr_t max_addr = stage->overflow_max_addr;
+    testword_t min_page = page_of((void *)min_addr);
+    testword_t max_page = page_of((void *)max_addr);
+    testword_t min_offs = min_addr & (PAGE_SIZE - 1);
+    testword_t max_offs = max_addr & (PAGE_SIZE - 1);
+
+    if (error_info.min_addr.page > min_page
+    || (error_info.min_addr.page == min_page && error_info.min_addr.offset > min_offs)) {
+        error_info.min_addr.page   = min_page;
+        error_info.min_addr.offset = min_offs;
+    }
+    if (error_info.max_addr.page < max_page
+    || (error_info.max_addr.page == max_page && error_info.max_addr.offset < max_offs)) {
+        error_info.max_addr.page   = max_page;
+        error_info.max_addr.offset = max_offs;
+    }
+    error_info.bad_bits |= stage->overflow_bad_bits;
+
+    if (error_count < ERROR_LIMIT) {
+        error_info.total_bits += total_bits - stage->drained_total_bits;
+        error_count += new_count;
+        if (error_count > ERROR_LIMIT) {
+            error_count = ERROR_LIMIT;
+        }
+    }
+    int test = cpu_context[cpu].running_test;
+    if (new_count < (uintptr_t)(INT_MAX - test_list[test].errors)) {
+        test_list[test].errors += new_count;
+    } else {
+        test_list[test].errors = INT_MAX;
+    }
+
+    stage->drained_count      = count;
+    stage->drained_total_bits = total_bits;
+
+    spin_unlock(error_mutex);
+
+    telemetry_errors_dropped(new_count);
+
+    // Redisplay the summary, without adding another error.
+    common_err(NEW_MODE, 0, 0, 0, 0, false);
+}
+
+static uint64_t phys_addr_of(uintptr_t addr)
+{
+    return (uint64_t)page_of((void *)addr) << PAGE_SHIFT | (addr & (PAGE_SIZE - 1));
+}
+
+static void stage_error(error_type_t type, uintptr_t addr, testword_t good, testword_t bad, bool use_for_badram)
+{
+    // Record the error in this CPU's staging ring, leaving the display update
+    // and the error log to error_update(), so the testing CPUs never contend
+    // for error_mutex or the log head.
+    // If the ring is full, just keep a summary.
+    int my_cpu = smp_my_cpu_num();
+    error_stage_t *stage = &error_stage[my_cpu];
+
+    uintptr_t head = stage->head;
+    if (head - __atomic_load_n(&stage->tail, __ATOMIC_ACQUIRE) < ERROR_STAGE_SIZE) {
+        staged_error_t *entry = &stage->entry[head % ERROR_STAGE_SIZE];
+        entry->type           = type;
+        entry->addr           = addr;
+        entry->good           = good;
+        entry->bad            = bad;
+        entry->use_for_badram = use_for_badram;
+        __atomic_store_n(&stage->head, head + 1, __ATOMIC_RELEASE);
+    } else {
+        // Address errors don't contribute to the bits in error.
+        testword_t xor = (type == DATA_ERROR) ? good ^ bad : 0;
+        if (addr < stage->overflow_min_addr) {
+            stage->overflow_min_addr = addr;
+        }
+        if (addr > stage->overflow_max_addr) {
+            stage->overflow_max_addr = addr;
+        }
+        stage->overflow_bad_bits   |= xor;
+        stage->overflow_total_bits += count_bits(xor);
+        __atomic_store_n(&stage->overflow_count, stage->overflow_count + 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void drain_error_stages(void)
+{
+    for (int cpu = 0; cpu < num_available_cpus; cpu++) {
+        error_stage_t *stage = &error_stage[cpu];
+
+        uintptr_t head = __atomic_load_n(&stage->head, __ATOMIC_ACQUIRE);
+        uintptr_t tail = stage->tail;
+        while (tail != head) {
+            staged_error_t *entry = &stage->entry[tail % ERROR_STAGE_SIZE];
+            errlog_append(entry->type == ADDR_ERROR ? ERRLOG_ADDR : ERRLOG_DATA, cpu,
+                          phys_addr_of(entry->addr), entry->good, entry->bad);
+            common_err(entry->type, cpu, entry->addr, entry->good, entry->bad, entry->use_for_badram);
+            tail++;
+        }
+        __atomic_store_n(&stage->tail, tail, __ATOMIC_RELEASE);
+
+        merge_overflow(cpu, stage);
+    }
+}
+
 //------------------------------------------------------------------------------
 // Public Functions
 //------------------------------------------------------------------------------
@@ -339,13 +816,55 @@ void error_init(void)
     error_info.max_run          = 0;
     error_info.last_addr        = 0;
     error_info.last_xor         = 0;
+    for (int i = 0; i < TESTWORD_WIDTH; i++) {
+        error_info.bit_errors[i] = 0;
+    }
+    for (int i = 0; i < NUM_DRAM_LOCATIONS; i++) {
+        error_info.dimm_errors[i] = 0;
+    }
+    for (int i = 0; i < NUM_SMBIOS_DIMMS; i++) {
+        error_info.smbios_dimm_errors[i] = 0;
+    }
+
+    use_popcnt = cpuid_info.flags.popcnt;
+
+    if (faulty_set == NULL) {
+        faulty_set = (uint64_t *)heap_alloc(HEAP_TYPE_HM_1, FAULTY_SET_SIZE * sizeof(uint64_t), PAGE_SIZE);
+    }
+    if (faulty_set != NULL) {
+        for (int i = 0; i < FAULTY_SET_SIZE; i++) {
+            faulty_set[i] = 0;
+        }
+    }
+    faulty_set_count = 0;
+
+    num_faulty_pages = 0;
+
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        error_stage_t *stage = &error_stage[cpu];
+        stage->head                = 0;
+        stage->tail                = 0;
+        stage->overflow_count      = 0;
+        stage->overflow_total_bits = 0;
+        stage->overflow_bad_bits   = 0;
+        stage->overflow_min_addr   = UINTPTR_MAX;
+        stage->overflow_max_addr   = 0;
+        stage->drained_count       = 0;
+        stage->drained_total_bits  = 0;
+    }
 
     error_count = 0;
+
+    fail_fast_stopped = false;
+
+    seed_logged_pass = -1;
+
+    reset_storm();
 }
 
 void addr_error(testword_t *addr1, testword_t *addr2, testword_t good, testword_t bad)
 {
-    common_err(ADDR_ERROR, (uintptr_t)addr1, good, bad, false); (void)addr2;
+    stage_error(ADDR_ERROR, (uintptr_t)addr1, good, bad, false); (void)addr2;
 }
 
 void data_error(testword_t *addr, testword_t good, testword_t bad, bool use_for_badram)
@@ -360,12 +879,14 @@ void data_error(testword_t *addr, testword_t good, testword_t bad, bool use_for_
         return;
     }
 #endif
-    common_err(DATA_ERROR, (uintptr_t)addr, good, bad, use_for_badram);
+
+    stage_error(DATA_ERROR, (uintptr_t)addr, good, bad, use_for_badram);
 }
 
 void ecc_error()
 {
-    common_err(CECC_ERROR, ecc_status.addr, 0, 0, false);
+    errlog_append(ERRLOG_ECC, -1, ecc_status.addr, 0, 0);
+    common_err(CECC_ERROR, 0, ecc_status.addr, 0, 0, false);
     error_update();
 }
 
@@ -374,20 +895,41 @@ void parity_error(void)
 {
     // We don't know the real address that caused the parity error,
     // so use the last recorded test address.
-    common_err(PARITY_ERROR, test_addr[my_cpu_num()], 0, 0, false);
+    errlog_append(ERRLOG_PARITY, smp_my_cpu_num(), phys_addr_of(cpu_context[my_cpu_num()].test_addr), 0, 0);
+    common_err(PARITY_ERROR, smp_my_cpu_num(), cpu_context[my_cpu_num()].test_addr, 0, 0, false);
 }
 #endif
 
 void error_update(void)
 {
+    drain_error_stages();
+
+    if (error_mode == ERROR_MODE_ADDRESS && storm.period_start != 0 && clks_per_msec > 0) {
+        // Report the last of a storm, even if no more errors arrive.
+        spin_lock(error_mutex);
+        end_storm_period(get_tsc());
+        spin_unlock(error_mutex);
+    }
+
+    if (!fail_fast_stopped && fail_fast_reached()) {
+        // The outcome is decided, so move straight on to triage.
+        fail_fast_stopped = true;
+        abort_test();
+    }
+
     if (error_count > 0 || error_count_cecc > 0) {
         if (error_mode != last_error_mode) {
-            common_err(NEW_MODE, 0, 0, 0, false);
+            common_err(NEW_MODE, 0, 0, 0, 0, false);
         }
-        if (error_mode == ERROR_MODE_SUMMARY && test_list[test_num].errors > 0) {
-            display_pinned_message(1 + test_num, 69, "%c%i",
-                                   test_list[test_num].errors == INT_MAX ? '>' : ' ',
-                                   test_list[test_num].errors);
+        if (error_mode == ERROR_MODE_SUMMARY) {
+            // When the tests are mixed, errors may be found by any test.
+            for (int test = 0; test < NUM_TEST_PATTERNS; test++) {
+                if (test_list[test].errors > 0 && (test == test_num || mixed_tests)) {
+                    display_pinned_message(1 + test, 69, "%c%i",
+                                           test_list[test].errors == INT_MAX ? '>' : ' ',
+                                           test_list[test].errors);
+                }
+            }
         }
         display_error_count();
 
@@ -406,3 +948,18 @@ void error_update(void)
         }
     }
 }
+
+uintptr_t cpu_error_count(int cpu)
+{
+    const error_stage_t *stage = &error_stage[cpu];
+    return __atomic_load_n(&stage->head, __ATOMIC_ACQUIRE) + __atomic_load_n(&stage->overflow_count, __ATOMIC_ACQUIRE);
+}
+
+bool fail_fast_reached(void)
+{
+    if (failfast_threshold <= 0) {
+        return false;
+    }
+    uint64_t count = error_count + (failfast_ecc ? error_count_cecc : 0);
+    return count >= (uint64_t)failfast_threshold;
+}
@@ -25,6 +25,24 @@ extern uint64_t error_count;
  */
 extern uint64_t error_count_cecc;
 
+/**
+ * The maximum number of faulty pages that are recorded.
+ */
+#define MAX_FAULTY_PAGES    64
+
+/**
+ * The number of pages found to contain a data error at an exactly known
+ * address during the current run.
+ */
+extern int num_faulty_pages;
+
+/**
+ * The faulty pages, in ascending order of page number. These are excluded
+ * from testing if the excludebad boot option was given, and are the only
+ * pages tested in triage mode.
+ */
+extern uintptr_t faulty_pages[MAX_FAULTY_PAGES];
+
 /**
  * Initialises the error records.
  */
@@ -36,7 +54,9 @@ void error_init(void);
 void addr_error(testword_t *addr1, testword_t *addr2, testword_t good, testword_t bad);
 
 /**
- * Adds a data error to the error reports.
+ * Adds a data error to the error reports. The error is recorded in a per-CPU
+ * staging buffer and is only reported when error_update() is next called, so
+ * this is cheap enough to call from inside the test loops.
  */
 void data_error(testword_t *addr, testword_t good, testword_t bad, bool use_for_badram);
 
@@ -54,8 +74,24 @@ void parity_error(void);
 #endif
 
 /**
- * Refreshes the error display after the error mode is changed.
+ * Reports any data errors recorded since the last call and refreshes the
+ * error display after the error mode is changed. Must only be called by one
+ * CPU at a time. Stops the current test when the failfast error threshold
+ * is first reached.
  */
 void error_update(void);
 
+/**
+ * Returns the number of address and data errors detected by the specified
+ * CPU core during the current run, including any not yet reported. Doesn't
+ * take any locks.
+ */
+uintptr_t cpu_error_count(int cpu);
+
+/**
+ * Returns true if the failfast boot option was given and the number of errors
+ * found has reached its threshold.
+ */
+bool fail_fast_reached(void);
+
 #endif // ERROR_H
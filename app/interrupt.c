@@ -8,16 +8,23 @@
 // Released under version 2 of the Gnu Public License.
 // By Chris Brady
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "cpuid.h"
 #include "hwctrl.h"
 #include "keyboard.h"
+#include "memctrl.h"
+#include "pmu.h"
 #include "screen.h"
 #include "smp.h"
 
+#include "barrier.h"
+
+#include "config.h"
 #include "error.h"
 #include "display.h"
+#include "test.h"
 
 #include "interrupt.h"
 
@@ -139,6 +146,25 @@ void interrupt(struct trap_regs *trap_regs)
 
     if (trap_regs->vect == INT_NMI) {
         uint8_t *pc = (uint8_t *)trap_regs->ip;
+        int my_cpu = smp_my_cpu_num();
+        bool heartbeat = pmu_heartbeat_expired(my_cpu);
+        if (heartbeat && my_cpu == master_cpu && ui_cpu < 0) {
+            display_heartbeat();
+        }
+        if (memctrl_capture_ecc_interrupt() || heartbeat) {
+            // This was an ECC error or heartbeat interrupt. If it woke us from
+            // a barrier halt and no wakeup signal arrived with it, halt again.
+            if (pc[-1] == OPCODE_HLT && barrier_is_waiting(my_cpu)) {
+                uintptr_t *return_addr;
+                if (cpuid_info.flags.lm == 1) {
+                    return_addr = (uintptr_t *)(trap_regs->sp - 40);
+                } else {
+                    return_addr = (uintptr_t *)(trap_regs->sp - 12);
+                }
+                *return_addr -= 1;
+            }
+            return;
+        }
         if (pc[-1] == OPCODE_HLT) {
             // Assume this is a barrier wakeup signal sent via IPI.
             return;
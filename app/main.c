@@ -22,17 +22,21 @@
 #include "cache.h"
 #include "cpuid.h"
 #include "cpuinfo.h"
+#include "cpulocal.h"
 #include "heap.h"
 #include "hwctrl.h"
 #include "hwquirks.h"
 #include "io.h"
+#include "ioat.h"
 #include "keyboard.h"
 #include "pmem.h"
 #include "memctrl.h"
 #include "memsize.h"
 #include "pci.h"
+#include "pmu.h"
 #include "screen.h"
 #include "serial.h"
+#include "simd.h"
 #include "smbios.h"
 #include "smp.h"
 #include "temperature.h"
@@ -41,13 +45,25 @@
 
 #include "unistd.h"
 
+#include "autotune.h"
 #include "badram.h"
+#include "baseline.h"
+#include "errlog.h"
+#include "benchmark.h"
+#include "boottime.h"
+#include "checkpoint.h"
 #include "config.h"
 #include "display.h"
 #include "error.h"
+#include "netlog.h"
+#include "profile.h"
+#include "telemetry.h"
 #include "test.h"
+#include "trace.h"
 
 #include "tests.h"
+#include "test_helper.h"
+#include "test_kernels.h"
 
 #include "tsc.h"
 
@@ -67,6 +83,36 @@
 
 #define HIGH_LOAD_LIMIT     (VM_PINNED_SIZE << PAGE_SHIFT)
 
+#define UI_POLL_PERIOD      1000    // microseconds
+
+#define TRIAGE_NEIGHBOUR_PAGES  1   // pages either side of a faulty page tested in triage mode
+
+#define DEFAULT_STRIPE_SIZE 256     // bytes, used when the channel interleave is not known
+
+//------------------------------------------------------------------------------
+// Types
+//------------------------------------------------------------------------------
+
+// To avoid relocating the program twice for every test, a pass may be split
+// into two halves. In one half, every test only tests the memory above the
+// low load limit, and in the other half, every test only tests the memory
+// below it. The half that suits the current program location is run first,
+// so the program is only relocated once per pass.
+
+typedef enum {
+    ALL_WINDOWS,
+    UPPER_WINDOWS,
+    LOWER_WINDOW
+} window_range_t;
+
+typedef struct {
+    uintptr_t   pm_limit_lower;
+    uintptr_t   pm_limit_upper;
+    uintptr_t   spin_size;
+    int         quick_stride;
+    int         num_faulty_pages;       // -1 unless in triage mode
+} sweep_key_t;
+
 //------------------------------------------------------------------------------
 // Private Variables
 //------------------------------------------------------------------------------
@@ -86,22 +132,77 @@ static bool             start_pass = false;
 static bool             start_test = false;
 static bool             rerun_test = false;
 
-static bool             dummy_run  = false;
-
 static uintptr_t        window_start = 0;
 static uintptr_t        window_end   = 0;
 
+static window_range_t   window_range = ALL_WINDOWS;
+static bool             second_half  = false;
+
+// The position loaded from the checkpoint when the run is resumed. The
+// checkpoint is only loaded by the first run after booting.
+static checkpoint_t     checkpoint;
+static bool             checkpoint_checked = false;
+static bool             resume_run  = false;
+static bool             resume_pass = false;
+
+static bool             bandwidth_measured = false;   // the startup benchmark has been run after the first pass
+
 static size_t           num_mapped_pages = 0;
 
+// The virtual memory map is double buffered, so the master can build the map
+// for the next window while the current window is being tested. The map is
+// built in spare_vm_map and then swapped with vm_map.
+static vm_map_t         *spare_vm_map = NULL;
+static int              spare_vm_map_size = 0;
+static size_t           spare_mapped_pages = 0;
+static int              prepared_window = -1;       // the window spare_vm_map was built for in advance, or -1
+
+static bool             domain_windows = false;     // each proximity domain has its own window
+
+static uintptr_t        domain_window[MAX_WINDOW_SLOTS];
+static uintptr_t        domain_next_page[MAX_WINDOW_SLOTS];
+
+static bool             mix_test = false;           // the domains run different tests in their own windows
+static int              domain_test[MAX_WINDOW_SLOTS];
+
 static int              test_stage = 0;
 
+static int              num_test_cpus = 1;  // the enabled CPUs, less any UI core
+
+static int              cpu_sibling[MAX_CPUS];      // the other thread in each CPU's core, or -1
+
+static bool             smt_trial = false;          // the first two passes compare smt=all and smt=pair
+static uint32_t         smt_trial_mbps[NUM_TEST_PATTERNS];  // with smt=all
+
+static bool             in_cpu_sample[MAX_CPUS];    // takes a turn when the CPUs run a test in turn
+static int              num_sampled_cpus = 1;
+
+static int              all_sweep_ticks   = 0;  // for one sweep through all the windows
+static int              all_windows       = 0;
+static int              upper_sweep_ticks = 0;  // ditto, leaving out the lower window
+static int              upper_windows     = 0;
+static int              addr_test_windows = 0;  // ditto, as split by the address test
+static int              sampled_sweep_ticks = 0;    // for one sampled sweep in quick screen mode
+
+static sweep_key_t      sweep_key;              // the inputs to the sweep tick counts above
+static bool             sweep_key_valid = false;
+
+static bool             tests_scheduled = false;    // the full passes use scheduled_iterations
+static int              scheduled_iterations[NUM_TEST_PATTERNS];    // 0 if the test is dropped
+
+static bool             triage_active = false;  // only the faulty pages are tested
+
+static volatile int     window_cpus_done = 0;
+
+static uint64_t         relocate_start_time = 0;    // copied to the new location
+
 //------------------------------------------------------------------------------
 // Public Variables
 //------------------------------------------------------------------------------
 
 // These are exposed in test.h.
 
-uint8_t     chunk_index[MAX_CPUS];
+cpu_context_t cpu_context[MAX_CPUS];
 
 int         num_active_cpus = 0;
 int         num_enabled_cpus = 1;
@@ -110,21 +211,26 @@ int         master_cpu = 0;
 
 barrier_t   *run_barrier = NULL;
 
+barrier_t   *domain_barrier = NULL;
+
 spinlock_t  *error_mutex = NULL;
 
-vm_map_t    vm_map[MAX_MEM_SEGMENTS];
+vm_map_t    *vm_map = NULL;
+int         vm_map_capacity = 0;
 int         vm_map_size = 0;
 uint32_t    proximity_domains[MAX_CPUS];
 
 int         pass_num = 0;
+uint32_t    pass_seed = 0;
 int         test_num = 0;
+bool        mixed_tests = false;
 
 int         window_num = 0;
 
 bool        restart = false;
 bool        bail    = false;
 
-uintptr_t   test_addr[MAX_CPUS];
+bool        start_triage = false;
 
 //------------------------------------------------------------------------------
 // Private Functions
@@ -155,14 +261,10 @@ static void run_at(uintptr_t addr, int my_cpu)
     uintptr_t *new_start_addr = (uintptr_t *)(addr + startup - _start);
 
     if (my_cpu == 0) {
-        // Copy the program code and all data except the stacks.
+        relocate_start_time = profile_start();
+        // Copy the program code and all data except the stacks. This includes
+        // the thread-local flags, unless they were moved by cpu_local_init().
         memmove((void *)addr, (void *)_start, _stacks - _start);
-        // Copy the thread-local storage.
-        size_t locals_offset = _stacks - _start + BSP_STACK_SIZE - LOCALS_SIZE;
-        for (int cpu_num = 0; cpu_num < num_available_cpus; cpu_num++) {
-            memcpy((void *)(addr + locals_offset), (void *)(_start + locals_offset), LOCALS_SIZE);
-            locals_offset += AP_STACK_SIZE;
-        }
     }
     LONG_BARRIER;
 
@@ -201,12 +303,61 @@ static bool set_load_addr(uintptr_t *load_addr, size_t program_size, uintptr_t l
     return false;
 }
 
+// Returns the number of low-order APIC ID bits needed to identify a thread
+// within a group of the specified size.
+static int apic_id_shift(int group_size)
+{
+    int shift = 0;
+    while ((1 << shift) < group_size) {
+        shift++;
+    }
+    return shift;
+}
+
+// Returns the number of hardware threads in each CPU core, from the topology
+// shown by display_cpu_topology().
+static int threads_per_core(void)
+{
+    if (cpuid_info.topology.core_count > 0 && cpuid_info.topology.thread_count > cpuid_info.topology.core_count) {
+        return cpuid_info.topology.thread_count / cpuid_info.topology.core_count;
+    }
+    return 1;
+}
+
+// Returns the other enabled hardware thread in the same core as the specified
+// CPU, or -1 if there is none. Only cores with two threads are paired.
+static int smt_sibling(int cpu)
+{
+    if (threads_per_core() != 2) {
+        return -1;
+    }
+    int shift = apic_id_shift(2);
+    for (int other = 0; other < num_available_cpus; other++) {
+        if (other != cpu && cpu_state[other] != CPU_STATE_DISABLED
+        &&  (smp_get_apic_id(other) >> shift) == (smp_get_apic_id(cpu) >> shift)) {
+            return other;
+        }
+    }
+    return -1;
+}
+
+// Starts the heartbeat interrupt on the calling CPU core. It is started on
+// all the cores, as the master CPU changes when the cores test in turn.
+static void start_heartbeat(int my_cpu)
+{
+    if (enable_heartbeat && ui_cpu < 0 && clks_per_msec > 0) {
+        pmu_start_heartbeat(my_cpu, (uint64_t)HEARTBEAT_PERIOD * clks_per_msec);
+    }
+}
+
 static void global_init(void)
 {
     floppy_off();
 
     cpuid_init();
 
+    simd_init();
+
     // Nothing before this should access the boot parameters, in case they are located above 4GB.
     // This is the first region we map, so it is guaranteed not to fail.
     boot_params_addr = map_region(boot_params_addr, sizeof(boot_params_t), true);
@@ -217,37 +368,102 @@ static void global_init(void)
 
     cpuinfo_init();
 
+    boottime_mark("CPU and screen");
+
     pmem_init();
 
+    boottime_mark("Memory map");
+
     heap_init();
 
+    boottime_mark("Heap");
+
+    // The ACPI tables tell pci_init() where to find the PCIe ECAM.
+    acpi_init();
+
+    boottime_mark("ACPI tables");
+
     pci_init();
 
+    boottime_mark("PCI scan");
+
     quirks_init();
 
-    acpi_init();
+    boottime_mark("Chipset quirks");
 
     timers_init();
 
+    boottime_mark("Timer calibration");
+
     membw_init();
 
+    boottime_mark("Memory bandwidth");
+
     smbios_init();
 
     badram_init();
 
     config_init();
 
+    // Reserve this before any of the allocations that depend on the boot
+    // options, so it is found at the same address on the next boot.
+    errlog_reserve();
+
+    boottime_mark("SMBIOS and options");
+
     memctrl_init();
 
+    if (enable_stripes) {
+        uintptr_t stripe_size = memctrl_interleave_size();
+        set_work_striping(stripe_size > 0 ? stripe_size : DEFAULT_STRIPE_SIZE);
+    }
+
+    boottime_mark("Memory controller");
+
     tty_init();
 
     smp_init(smp_enabled);
 
+    boottime_mark("SMP discovery");
+
+    trace_init();
+
+    memctrl_enable_ecc_interrupts();
+
+    if (enable_perf_max) {
+        set_max_performance(0);
+    }
+
+    if (enable_pmu) {
+        pmu_start(0);
+    }
+
     // Force disable the NUMA code paths when no proximity domain was found.
     if (num_proximity_domains == 0) {
         enable_numa = false;
     }
 
+    cpu_local_init();
+
+    // The barrier waits halt instead if MONITOR/MWAIT is not available.
+    if (power_save == POWER_SAVE_MWAIT && !cpuid_info.flags.mon) {
+        power_save = POWER_SAVE_HIGH;
+    }
+    barrier_enable_mwait(power_save == POWER_SAVE_MWAIT);
+
+    // This must be done before any other use of the memory map, as the page
+    // tables are allocated from the high memory heap.
+    if (enable_direct_map) {
+        enable_direct_map = map_all_memory(pm_map[pm_map_size - 1].end);
+    }
+    // Otherwise, if we can, give each proximity domain its own window, so the
+    // CPUs in every domain can test their local memory at the same time.
+    if (enable_numa && !enable_direct_map && num_proximity_domains > 1) {
+        domain_windows = init_window_slots(num_proximity_domains);
+    }
+
+    boottime_mark("Page tables");
+
     // At this point we have started reserving physical pages in the memory
     // map for data structures that need to be permanently pinned in place.
     // This may overwrite any data structures passed to us by the BIOS and/or
@@ -256,34 +472,108 @@ static void global_init(void)
 
     keyboard_init();
 
+    boottime_mark("Keyboard and USB");
+
+    tty_dbc_init();
+
+    netlog_init();
+
+    if (enable_dma) {
+        int num_channels = ioat_init();
+        trace(0, "found %i DMA channels", num_channels);
+    }
+
+    boottime_mark("Network and DMA");
+
     display_init();
 
+    errlog_init();
+
     error_init();
 
+    boottime_mark("Display");
+
+    test_kernels_init();
+
+    autotune_kernels();
+
+    boottime_mark("Kernel autotune");
+
+    profile_init();
+
     temperature_init();
 
+    boottime_mark("Temperature");
+
     initial_config();
 
+    boottime_mark("Config menu wait");
+
     clear_message_area();
 
     if (!smp_enabled) {
         num_available_cpus = 1;
     }
 
+    if (ui_cpu >= num_available_cpus || (ui_cpu > 0 && cpu_state[ui_cpu] != CPU_STATE_ENABLED)) {
+        ui_cpu = -1;
+    }
+
+    start_heartbeat(0);
+
+    uint8_t test_cpus[MAX_CPUS];
     num_enabled_cpus = 0;
+    num_test_cpus    = 0;
     for (int i = 0; i < num_available_cpus; i++) {
+        if (cpu_state[i] == CPU_STATE_ENABLED && smt_mode == SMT_OFF && i > 0) {
+            // Leave the second thread in each core stopped.
+            int sibling = smt_sibling(i);
+            if (sibling >= 0 && sibling < i) {
+                cpu_state[i] = CPU_STATE_DISABLED;
+            }
+        }
         if (cpu_state[i] == CPU_STATE_ENABLED) {
+            num_enabled_cpus++;
+            if (i == ui_cpu) {
+                // The UI core is started, but doesn't take part in the tests.
+                continue;
+            }
+            test_cpus[num_test_cpus] = i;
             if (enable_numa) {
                 uint32_t proximity_domain_idx = smp_get_proximity_domain_idx(i);
-                chunk_index[i] = smp_alloc_cpu_in_proximity_domain(proximity_domain_idx);
+                cpu_context[i].chunk_index = smp_alloc_cpu_in_proximity_domain(proximity_domain_idx);
             } else {
-                chunk_index[i] = num_enabled_cpus;
+                cpu_context[i].chunk_index = num_test_cpus;
             }
-            num_enabled_cpus++;
+            num_test_cpus++;
         }
     }
+    barrier_init_tree(test_cpus, num_test_cpus);
+    init_work_shares(test_cpus, num_test_cpus);
+    bool any_siblings = false;
+    for (int i = 0; i < num_available_cpus; i++) {
+        cpu_sibling[i] = smt_sibling(i);
+        if (cpu_sibling[i] >= 0) {
+            any_siblings = true;
+        }
+    }
+    init_work_pairs(cpu_sibling);
+    if (smt_mode == SMT_AUTO && any_siblings && cpu_mode == PAR) {
+        int saved = autotune_smt_pairing();
+        smt_trial = (saved < 0);
+        set_work_pairing(saved > 0);
+    } else {
+        set_work_pairing(smt_mode == SMT_PAIR);
+    }
+    if (cpuid_info.topology.is_hybrid) {
+        // The APs do this in ap_enumerate().
+        hybrid_core_type[0] = get_ap_hybrid_type();
+        measure_cpu_speed(0);
+    }
     display_cpu_topology();
 
+    boottime_mark("CPU topology");
+
     master_cpu = 0;
 
     display_temperature();
@@ -296,6 +586,8 @@ static void global_init(void)
         post_display_init();
     }
 
+    baseline_init();
+
     size_t program_size = (_stacks - _start) + BSP_STACK_SIZE + (num_enabled_cpus - 1) * AP_STACK_SIZE;
 
     bool load_addr_ok = set_load_addr(& low_load_addr, program_size,         0x1000,  LOW_LOAD_LIMIT)
@@ -311,7 +603,7 @@ static void global_init(void)
         trace(0, "ACPI RSDP (v%u.%u) found in %s at %0*x", acpi_config.ver_maj, acpi_config.ver_min, rsdp_source, 2*sizeof(uintptr_t), acpi_config.rsdp_addr);
         trace(0, "ACPI FADT found at %0*x", 2*sizeof(uintptr_t), acpi_config.fadt_addr);
         trace(0, "ACPI SRAT found at %0*x", 2*sizeof(uintptr_t), acpi_config.srat_addr);
-        //trace(0, "ACPI SLIT found at %0*x", 2*sizeof(uintptr_t), acpi_config.slit_addr);
+        trace(0, "ACPI SLIT found at %0*x", 2*sizeof(uintptr_t), acpi_config.slit_addr);
     }
 
     if (!load_addr_ok) {
@@ -323,10 +615,41 @@ static void global_init(void)
     start_barrier = smp_alloc_barrier(1);
     run_barrier   = smp_alloc_barrier(1);
 
+    // The virtual memory map must hold every segment of a window, which may
+    // be split at the proximity domain boundaries and around the faulty pages.
+    vm_map_capacity = pm_map_size + 2 * num_memory_affinity_ranges + num_proximity_domains + MAX_FAULTY_PAGES;
+    vm_map = (vm_map_t *)heap_alloc(HEAP_TYPE_HM_1, 2 * vm_map_capacity * sizeof(vm_map_t), 64);
+    if (vm_map == NULL) {
+        vm_map = (vm_map_t *)heap_alloc(HEAP_TYPE_LM_1, 2 * vm_map_capacity * sizeof(vm_map_t), 64);
+    }
+    if (vm_map == NULL) {
+        vm_map_capacity = 0;
+        trace(0, "No room for the memory map. No memory will be tested.");
+    } else {
+        spare_vm_map = vm_map + vm_map_capacity;
+    }
+
+    // There is no room for more barriers in the SMP heap page.
+    if (num_proximity_domains > 1) {
+        domain_barrier = (barrier_t *)heap_alloc(HEAP_TYPE_HM_1, num_proximity_domains * sizeof(barrier_t), 64);
+        if (domain_barrier != NULL) {
+            barrier_init_domains(domain_barrier, num_proximity_domains);
+        }
+    }
+
     error_mutex   = smp_alloc_mutex();
 
+    // From now on, changes to a framebuffer display are drawn by the periodic
+    // housekeeping, or when waiting for a key press.
+    set_screen_update_deferred(true);
+
+    if (enable_headless) {
+        display_start_headless();
+    }
+
+    boottime_mark("SPD and baseline");
+
     start_run = true;
-    dummy_run = true;
     restart = false;
 }
 
@@ -349,17 +672,103 @@ static void ap_enumerate(int my_cpu)
         //TODO : hlt AP?
     }
 
+    measure_cpu_speed(my_cpu);
+
     if (my_cpu == num_enabled_cpus - 1) {
         display_cpu_topology();
     }
 }
 
-static void setup_vm_map(uintptr_t win_start, uintptr_t win_end)
+// Adds a single segment of physical pages to the virtual memory map.
+static void add_vm_segment(uintptr_t seg_start, uintptr_t seg_end, uint32_t proximity_domain_idx)
+{
+    if (seg_start >= seg_end) {
+        return;
+    }
+    if (spare_vm_map_size > 0) {
+        // Merge with the previous segment if it ends where this one starts,
+        // both physically and in the window mapping.
+        vm_map_t *prev = &spare_vm_map[spare_vm_map_size - 1];
+        uintptr_t prev_end = prev->pm_base_addr + (((uintptr_t)prev->end - (uintptr_t)prev->start) >> PAGE_SHIFT) + 1;
+        if (prev_end == seg_start && prev->proximity_domain_idx == proximity_domain_idx
+        &&  prev->end + 1 == first_word_mapping(seg_start)) {
+            spare_mapped_pages += seg_end - seg_start;
+            prev->end = last_word_mapping(seg_end - 1, sizeof(testword_t));
+            return;
+        }
+    }
+    if (spare_vm_map_size >= vm_map_capacity) {
+        return;
+    }
+    spare_mapped_pages += seg_end - seg_start;
+    spare_vm_map[spare_vm_map_size].pm_base_addr = seg_start;
+    spare_vm_map[spare_vm_map_size].start        = first_word_mapping(seg_start);
+    spare_vm_map[spare_vm_map_size].end          = last_word_mapping(seg_end - 1, sizeof(testword_t));
+    spare_vm_map[spare_vm_map_size].proximity_domain_idx = proximity_domain_idx;
+    spare_vm_map_size++;
+}
+
+// Returns the number of pages from seg_start to seg_end that are tested in
+// triage mode, i.e. the faulty pages and their neighbours. If add is true,
+// also adds those pages to the virtual memory map.
+static uintptr_t add_triage_segments(uintptr_t seg_start, uintptr_t seg_end, bool add, uint32_t proximity_domain_idx)
 {
-    vm_map_size = 0;
+    uintptr_t num_pages = 0;
+    uintptr_t last_end  = seg_start;
+    for (int i = 0; i < num_faulty_pages; i++) {
+        uintptr_t start = faulty_pages[i] > TRIAGE_NEIGHBOUR_PAGES ? faulty_pages[i] - TRIAGE_NEIGHBOUR_PAGES : 0;
+        uintptr_t end   = faulty_pages[i] + TRIAGE_NEIGHBOUR_PAGES + 1;
+        if (start < last_end) {
+            start = last_end;
+        }
+        if (end > seg_end) {
+            end = seg_end;
+        }
+        if (start < end) {
+            if (add) {
+                add_vm_segment(start, end, proximity_domain_idx);
+            }
+            num_pages += end - start;
+            last_end = end;
+        }
+    }
+    return num_pages;
+}
 
-    num_mapped_pages = 0;
+// Adds the physical pages from seg_start to seg_end to the virtual memory map.
+// In triage mode, only adds the faulty pages and their neighbours. Otherwise,
+// if enabled, leaves out the faulty pages. This splits the segment, so a
+// faulty page is only left out while there is room in the map for the extra
+// segment.
+static void add_vm_segments(uintptr_t seg_start, uintptr_t seg_end, uint32_t proximity_domain_idx)
+{
+    if (triage_active) {
+        add_triage_segments(seg_start, seg_end, true, proximity_domain_idx);
+        return;
+    }
+    if (!enable_bad_page_exclusion) {
+        add_vm_segment(seg_start, seg_end, proximity_domain_idx);
+        return;
+    }
+    int i = 0;
+    while (seg_start < seg_end && spare_vm_map_size < vm_map_capacity) {
+        while (i < num_faulty_pages && faulty_pages[i] < seg_start) {
+            i++;
+        }
+        uintptr_t part_end = seg_end;
+        if (i < num_faulty_pages && faulty_pages[i] < seg_end && spare_vm_map_size < vm_map_capacity - 1) {
+            part_end = faulty_pages[i];
+        }
+        add_vm_segment(seg_start, part_end, proximity_domain_idx);
+        seg_start = (part_end < seg_end) ? part_end + 1 : seg_end;
+    }
+}
 
+// Adds the intersection of the window and the physical memory segments to the
+// virtual memory map. If domain is not negative, only adds the parts of that
+// intersection that are in the specified proximity domain.
+static void add_to_vm_map(uintptr_t win_start, uintptr_t win_end, int domain)
+{
     // Reduce the window to fit in the user-specified limits.
     if (win_start < pm_limit_lower) {
         win_start = pm_limit_lower;
@@ -393,15 +802,12 @@ static void setup_vm_map(uintptr_t win_start, uintptr_t win_end)
                 uint64_t new_start;
                 uint64_t new_end;
 
-                while (1) {
+                while (spare_vm_map_size < vm_map_capacity) {
                     if (smp_narrow_to_proximity_domain(orig_start, orig_end, &proximity_domain_idx, &new_start, &new_end)) {
-                        // Create a new entry in the virtual memory map.
-                        num_mapped_pages += (new_end - new_start) >> PAGE_SHIFT;
-                        vm_map[vm_map_size].pm_base_addr = new_start >> PAGE_SHIFT;
-                        vm_map[vm_map_size].start        = first_word_mapping(new_start >> PAGE_SHIFT);
-                        vm_map[vm_map_size].end          = last_word_mapping((new_end >> PAGE_SHIFT) - 1, sizeof(testword_t));
-                        vm_map[vm_map_size].proximity_domain_idx = proximity_domain_idx;
-                        vm_map_size++;
+                        if (domain < 0 || proximity_domain_idx == (uint32_t)domain) {
+                            // Create new entries in the virtual memory map.
+                            add_vm_segments(new_start >> PAGE_SHIFT, new_end >> PAGE_SHIFT, proximity_domain_idx);
+                        }
                         if (new_start != orig_start || new_end != orig_end) {
                             // Proceed to the next part of the range.
                             orig_start = new_end; // No shift here, we already have a physical address.
@@ -412,60 +818,252 @@ static void setup_vm_map(uintptr_t win_start, uintptr_t win_end)
                         }
                     } else {
                         // Could not match with proximity domain, fall back to default behaviour. This shouldn't happen !
-                        vm_map[vm_map_size].proximity_domain_idx = 0;
+                        if (domain > 0) {
+                            break;
+                        }
                         goto non_numa_vm_map_entry;
                     }
                 }
             } else {
 non_numa_vm_map_entry:
-                num_mapped_pages += seg_end - seg_start;
-                vm_map[vm_map_size].pm_base_addr = seg_start;
-                vm_map[vm_map_size].start        = first_word_mapping(seg_start);
-                vm_map[vm_map_size].end          = last_word_mapping(seg_end - 1, sizeof(testword_t));
-                vm_map_size++;
+                add_vm_segments(seg_start, seg_end, 0);
             }
         }
     }
 #if 0
-    for (int i = 0; i < vm_map_size; i++) {
-        do_trace(0, "vm %0*x - %0*x", 2*sizeof(uintptr_t), vm_map[i].start, 2*sizeof(uintptr_t), vm_map[i].end);
+    for (int i = 0; i < spare_vm_map_size; i++) {
+        do_trace(0, "vm %0*x - %0*x", 2*sizeof(uintptr_t), spare_vm_map[i].start, 2*sizeof(uintptr_t), spare_vm_map[i].end);
     }
 #endif
 }
 
+// Makes the map that has been built in spare_vm_map the current map. Must
+// only be called while no CPU is testing.
+static void switch_vm_map(void)
+{
+    vm_map_t *old_vm_map = vm_map;
+
+    vm_map           = spare_vm_map;
+    vm_map_size      = spare_vm_map_size;
+    num_mapped_pages = spare_mapped_pages;
+
+    spare_vm_map = old_vm_map;
+}
+
+static void build_vm_map(uintptr_t win_start, uintptr_t win_end)
+{
+    spare_vm_map_size = 0;
+
+    spare_mapped_pages = 0;
+
+    add_to_vm_map(win_start, win_end, -1);
+}
+
+static void setup_vm_map(uintptr_t win_start, uintptr_t win_end)
+{
+    build_vm_map(win_start, win_end);
+    switch_vm_map();
+}
+
+// Returns the start page of the first window at or above from_page that
+// contains memory to be tested in the specified proximity domain, or
+// NO_WINDOW if there is none.
+static uintptr_t find_domain_window(uint32_t domain, uintptr_t from_page)
+{
+    for (int i = 0; i < pm_map_size; i++) {
+        uintptr_t seg_start = pm_map[i].start;
+        uintptr_t seg_end   = pm_map[i].end;
+        if (seg_start < from_page) {
+            seg_start = from_page;
+        }
+        if (seg_start < pm_limit_lower) {
+            seg_start = pm_limit_lower;
+        }
+        if (seg_end > pm_limit_upper) {
+            seg_end = pm_limit_upper;
+        }
+        while (seg_start < seg_end) {
+            uint32_t proximity_domain_idx;
+            uint64_t new_start;
+            uint64_t new_end;
+            if (!smp_narrow_to_proximity_domain((uint64_t)seg_start << PAGE_SHIFT, (uint64_t)seg_end << PAGE_SHIFT,
+                                                &proximity_domain_idx, &new_start, &new_end)) {
+                break;
+            }
+            if (proximity_domain_idx == domain) {
+                return seg_start - seg_start % VM_WINDOW_SIZE;
+            }
+            seg_start = new_end >> PAGE_SHIFT;
+        }
+    }
+    return NO_WINDOW;
+}
+
+// Selects the next window for each proximity domain and sets up the virtual
+// memory map to cover the memory in those windows that belongs to the domain
+// that selected it. Returns false if there is no more memory to test.
+static bool setup_domain_vm_map(void)
+{
+    bool found = false;
+    for (int domain = 0; domain < num_proximity_domains; domain++) {
+        if (window_num == 1) {
+            domain_next_page[domain] = LOW_LOAD_LIMIT >> PAGE_SHIFT;
+        }
+        domain_window[domain] = NO_WINDOW;
+        if (domain_next_page[domain] != NO_WINDOW) {
+            domain_window[domain] = find_domain_window(domain, domain_next_page[domain]);
+        }
+        if (domain_window[domain] != NO_WINDOW) {
+            domain_next_page[domain] = domain_window[domain] + VM_WINDOW_SIZE;
+            found = true;
+        } else {
+            domain_next_page[domain] = NO_WINDOW;
+        }
+    }
+
+    // The virtual addresses depend on the slot assignment, so map the windows
+    // before we build the map. The other CPUs will map them again once we are
+    // done.
+    map_windows(domain_window, num_proximity_domains);
+
+    spare_vm_map_size = 0;
+
+    spare_mapped_pages = 0;
+
+    // Add the windows in ascending address order, so the map stays sorted.
+    uintptr_t win_start = 0;
+    while (true) {
+        int next_domain = -1;
+        for (int domain = 0; domain < num_proximity_domains; domain++) {
+            if (domain_window[domain] >= win_start && domain_window[domain] != NO_WINDOW
+            && (next_domain < 0 || domain_window[domain] < domain_window[next_domain])) {
+                next_domain = domain;
+            }
+        }
+        if (next_domain < 0) {
+            break;
+        }
+        win_start = domain_window[next_domain];
+        uintptr_t win_end = win_start + VM_WINDOW_SIZE;
+        for (int domain = 0; domain < num_proximity_domains; domain++) {
+            if (domain_window[domain] == win_start) {
+                add_to_vm_map(win_start > (LOW_LOAD_LIMIT >> PAGE_SHIFT) ? win_start : (LOW_LOAD_LIMIT >> PAGE_SHIFT), win_end, domain);
+            }
+        }
+        win_start = win_end;
+    }
+    switch_vm_map();
+    return found;
+}
+
+static void run_housekeeping(void)
+{
+    // Keep the display and the other housekeeping tasks up to date until
+    // all the active CPUs have finished testing the current window.
+    while (window_cpus_done < num_active_cpus) {
+        do_housekeeping();
+        usleep(UI_POLL_PERIOD);
+    }
+}
+
+static int test_iterations(int test, pass_type_t pass_type)
+{
+    if (pass_type == FAST_PASS) {
+        // Reduce iterations for a faster first pass.
+        return test_list[test].iterations / 3;
+    }
+    if (tests_scheduled) {
+        return scheduled_iterations[test];
+    }
+    return test_list[test].iterations;
+}
+
+// Returns the page at which the windows in the current range end.
+static uintptr_t window_range_end(void)
+{
+    return window_range == LOWER_WINDOW ? (LOW_LOAD_LIMIT >> PAGE_SHIFT) : pm_map[pm_map_size - 1].end;
+}
+
+// Returns the page at which the window that starts at LOW_LOAD_LIMIT ends.
+// If all memory is mapped, we can test it in a single window. Otherwise the
+// whole of the permanently mapped region can still be tested at once, saving
+// a window switch in each sweep. The address test is the exception, as
+// map_window_uncached() can only alias one VM_WINDOW_SIZE region, so it keeps
+// each window within one.
+static uintptr_t first_upper_window_end(bool split_pinned)
+{
+    if (enable_direct_map) {
+        return pm_map[pm_map_size - 1].end;
+    }
+    return split_pinned ? VM_WINDOW_SIZE : VM_PINNED_SIZE;
+}
+
+// Moves the window bounds on from the previous window to the specified one.
+static void next_window_bounds(int num, uintptr_t *start, uintptr_t *end)
+{
+    switch (num) {
+      case 0:
+        *start = 0;
+        *end   = (LOW_LOAD_LIMIT >> PAGE_SHIFT);
+        break;
+      case 1:
+        *start = (LOW_LOAD_LIMIT >> PAGE_SHIFT);
+        *end   = first_upper_window_end(test_num == 0);
+        break;
+      default:
+        *start = *end;
+        *end  += VM_WINDOW_SIZE;
+    }
+}
+
+// Builds the map for the window after the current one in spare_vm_map, so
+// that moving on to it is just a switch of the maps. The map is built the
+// same way when the window starts, so this is only done when the window
+// mapping of the virtual addresses doesn't depend on the window slots.
+static void prepare_next_window(void)
+{
+    if (domain_windows || window_end >= window_range_end()) {
+        return;
+    }
+    uintptr_t start = window_start;
+    uintptr_t end   = window_end;
+    next_window_bounds(window_num + 1, &start, &end);
+    build_vm_map(start, end);
+    prepared_window = window_num + 1;
+}
+
 static void test_all_windows(int my_cpu)
 {
     bool parallel_test = false;
     bool i_am_master = (my_cpu == master_cpu);
     bool i_am_active = i_am_master;
-    if (!dummy_run) {
-        if (cpu_mode == PAR && test_list[test_num].cpu_mode == PAR) {
-            parallel_test = true;
-            i_am_active = true;
-        }
+    bool i_am_ui_cpu = (my_cpu == ui_cpu);
+    if (cpu_mode == PAR && test_list[test_num].cpu_mode == PAR) {
+        parallel_test = true;
+        i_am_active = !i_am_ui_cpu;
     }
     if (i_am_master) {
         num_active_cpus = 1;
-        if (!dummy_run) {
-            if (parallel_test) {
-                num_active_cpus = num_enabled_cpus;
-                if(display_mode == DISPLAY_MODE_NA) {
-                    display_all_active();
-                }
-            } else {
-                if (display_mode == 0) {
-                    display_active_cpu(my_cpu);
-                }
+        if (parallel_test) {
+            num_active_cpus = num_test_cpus;
+            if(display_mode == DISPLAY_MODE_NA) {
+                display_all_active();
+            }
+        } else {
+            if (display_mode == 0) {
+                display_active_cpu(my_cpu);
             }
         }
+        prepared_window = -1;
         barrier_reset(run_barrier, num_active_cpus);
+        if (domain_barrier != NULL) {
+            for (int i = 0; i < num_proximity_domains; i++) {
+                barrier_reset(&domain_barrier[i], used_cpus_in_proximity_domain[i]);
+            }
+        }
     }
 
-    int iterations = test_list[test_num].iterations;
-    if (pass_num == 0) {
-        // Reduce iterations for a faster first pass.
-        iterations /= 3;
-    }
+    pass_type_t pass_type = pass_num == 0 ? FAST_PASS : FULL_PASS;
 
     // Loop through all possible windows.
     do {
@@ -474,7 +1072,15 @@ static void test_all_windows(int my_cpu)
             break;
         }
 
+        if (i_am_active) {
+            sample_cpu_thermal_status(my_cpu);
+        }
+
         if (i_am_master) {
+            if (window_num == 0 && window_range == UPPER_WINDOWS) {
+                // The lower window is tested in the other half of the pass.
+                window_num = 1;
+            }
             if (window_num == 0 && test_list[test_num].stages > 1) {
                 // A multi-stage test runs through all the windows at each stage.
                 // Relocation may disrupt the test.
@@ -489,35 +1095,40 @@ static void test_all_windows(int my_cpu)
 
         // Relocate if necessary.
         if (window_num > 0) {
-            if (!dummy_run && (uintptr_t)&_start != low_load_addr) {
+            if ((uintptr_t)&_start != low_load_addr) {
                 run_at(low_load_addr, my_cpu);
             }
         } else {
-            if (!dummy_run && (uintptr_t)&_start != high_load_addr) {
+            if ((uintptr_t)&_start != high_load_addr) {
                 run_at(high_load_addr, my_cpu);
             }
         }
 
-        if (i_am_master) {
+        if (i_am_master && domain_windows && window_num > 0) {
+            if (!setup_domain_vm_map()) {
+                // Signal that we have tested all the windows.
+                window_end = pm_map[pm_map_size - 1].end;
+            }
+            window_cpus_done = 0;
+            mixed_tests = mix_test;
+        } else if (i_am_master) {
+            mixed_tests = false;
             //trace(my_cpu, "start window %i", window_num);
-            switch (window_num) {
-              case 0:
-                window_start = 0;
-                window_end   = (LOW_LOAD_LIMIT >> PAGE_SHIFT);
-                break;
-              case 1:
-                window_start = (LOW_LOAD_LIMIT >> PAGE_SHIFT);
-                window_end   = VM_WINDOW_SIZE;
-                break;
-              default:
-                window_start = window_end;
-                window_end  += VM_WINDOW_SIZE;
+            next_window_bounds(window_num, &window_start, &window_end);
+            if (prepared_window == window_num) {
+                switch_vm_map();
+            } else {
+                setup_vm_map(window_start, window_end);
             }
-            setup_vm_map(window_start, window_end);
+            prepared_window = -1;
+            window_cpus_done = 0;
+        }
+        if (i_am_master) {
+            update_work_shares();
         }
         SHORT_BARRIER;
 
-        if (!i_am_active) {
+        if (!i_am_active && !i_am_ui_cpu) {
             continue;
         }
 
@@ -529,29 +1140,532 @@ static void test_all_windows(int my_cpu)
             continue;
         }
 
-        if (dummy_run) {
+        uint64_t map_start_time = profile_start();
+        if (domain_windows && window_num > 0) {
+            map_windows(domain_window, num_proximity_domains);
+        } else if (!map_window(vm_map[0].pm_base_addr)) {
+            // Either there is no PAE or we are at the PAE limit.
+            break;
+        }
+        profile_record(my_cpu, PHASE_MAP_WINDOW, map_start_time);
+        if (i_am_master) {
+            telemetry_add_tested_pages(num_mapped_pages);
+        }
+        if (i_am_ui_cpu) {
+            run_housekeeping();
+        } else {
+            int test = mixed_tests ? domain_test[smp_get_proximity_domain_idx(my_cpu)] : test_num;
+            cpu_context[my_cpu].running_test = test;
+            uint64_t core_counts[2][NUM_PMU_EVENTS];
+            if (enable_pmu) {
+                pmu_read(my_cpu, core_counts[0]);
+            }
             if (i_am_master) {
-                ticks_per_test[pass_num][test_num] += run_test(-1, test_num, test_stage, iterations);
+                display_enable_heartbeat(true);
             }
-        } else {
-            if (!map_window(vm_map[0].pm_base_addr)) {
-                // Either there is no PAE or we are at the PAE limit.
-                break;
+            run_test(my_cpu, test, test_stage, test_iterations(test, pass_type));
+            if (i_am_master) {
+                display_enable_heartbeat(false);
+            }
+            if (enable_pmu) {
+                pmu_read(my_cpu, core_counts[1]);
+                telemetry_add_core_counts(core_counts[0], core_counts[1]);
+            }
+            __sync_fetch_and_add(&window_cpus_done, 1);
+            if (i_am_master && !bail) {
+                // Overlap this with the other CPUs finishing the window.
+                prepare_next_window();
             }
-            run_test(my_cpu, test_num, test_stage, iterations);
         }
 
         if (i_am_master) {
             window_num++;
         }
-    } while (window_end < pm_map[pm_map_size - 1].end);
+    } while (window_end < window_range_end());
+}
+
+static bool test_is_selected(int test)
+{
+    if (!test_list[test].enabled) {
+        return false;
+    }
+    if (pass_num > 0 && tests_scheduled && scheduled_iterations[test] == 0) {
+        // Dropped to fit the time budget.
+        return false;
+    }
+    // A multi-stage test never tests the lower window.
+    return window_range != LOWER_WINDOW || test_list[test].stages == 1;
+}
+
+static bool test_selected(void)
+{
+    return test_is_selected(test_num);
+}
+
+// Returns the test that will be run over the same memory straight after the
+// current test, or -1 if there is none or if it isn't known.
+static int next_selected_test(void)
+{
+    pass_type_t pass_type = (pass_num == 0) ? FAST_PASS : FULL_PASS;
+    if (cpu_mode == SEQ || test_iterations(test_num, pass_type) == 0) {
+        // Each CPU runs each test in turn, or the current test does nothing.
+        return -1;
+    }
+    for (int test = test_num + 1; test < NUM_TEST_PATTERNS; test++) {
+        if (test_is_selected(test)) {
+            return test_iterations(test, pass_type) > 0 ? test : -1;
+        }
+    }
+    return -1;
+}
+
+// Returns true if the specified test can be run in one proximity domain while
+// the other domains run different tests. The CPUs in all the domains must run
+// a multi-stage test, a sequential test, or the coherence test together.
+static bool is_mixable(int test, pass_type_t pass_type)
+{
+    return test_is_selected(test) && test_iterations(test, pass_type) > 0
+        && test_list[test].cpu_mode == PAR && test_list[test].stages == 1 && test != 14;
+}
+
+// If enabled, chooses the test each proximity domain runs in its own windows
+// while the domain containing the master CPU runs the current test. The other
+// domains run the mixable tests that follow the current test, in turn, so each
+// domain has run every mixable test by the end of the pass.
+static void setup_mixed_tests(void)
+{
+    pass_type_t pass_type = (pass_num == 0) ? FAST_PASS : FULL_PASS;
+
+    mix_test = false;
+    if (!enable_mixed_tests || !domain_windows || domain_barrier == NULL || cpu_mode != PAR
+    ||  !is_mixable(test_num, pass_type)) {
+        return;
+    }
+    int mixable[NUM_TEST_PATTERNS];
+    int num_mixable = 0;
+    for (int i = 0; i < NUM_TEST_PATTERNS; i++) {
+        int test = (test_num + i) % NUM_TEST_PATTERNS;
+        if (is_mixable(test, pass_type)) {
+            mixable[num_mixable++] = test;
+        }
+    }
+    if (num_mixable < 2) {
+        return;
+    }
+    int master_domain = smp_get_proximity_domain_idx(master_cpu);
+    for (int domain = 0; domain < num_proximity_domains; domain++) {
+        int offset = (domain - master_domain + num_proximity_domains) % num_proximity_domains;
+        domain_test[domain] = mixable[offset % num_mixable];
+    }
+    mix_test = true;
+}
+
+static window_range_t first_window_range(void)
+{
+    if (pm_limit_lower >= LOW_LOAD_LIMIT) {
+        // We never need to relocate.
+        return ALL_WINDOWS;
+    }
+    return (uintptr_t)&_start == high_load_addr ? LOWER_WINDOW : UPPER_WINDOWS;
+}
+
+// Returns the sampling stride used for the specified test. In quick screen
+// mode, the address tests still cover all the memory, so that every address
+// line is exercised, and the bit fade test, which is dominated by its delays,
+// is left unchanged. Triage mode always tests all the faulty pages.
+static int sample_stride(int test)
+{
+    if (quick_stride > 1 && !triage_active && test >= 3 && test <= 9) {
+        return quick_stride;
+    }
+    return 1;
+}
+
+// Counts the ticks taken by one sweep through the memory under test, and the
+// number of windows that contain memory under test, from the sizes of the
+// physical memory segments in each window. If include_lower is false, the
+// lower window is left out, as it is by the multi-stage tests. If split_pinned
+// is true, the permanently mapped region is split as it is by the address test.
+// Only one page in every stride is counted, as set by set_work_sampling().
+static void count_sweep_ticks(bool include_lower, bool split_pinned, int stride, int *sweep_ticks, int *num_windows)
+{
+    const uintptr_t spin_pages = spin_size / (PAGE_SIZE / sizeof(testword_t));
+
+    uintptr_t win_start = 0;
+    uintptr_t win_end   = 0;
+
+    *sweep_ticks = 0;
+    *num_windows = 0;
+
+    int window = (include_lower && pm_limit_lower < LOW_LOAD_LIMIT) ? 0 : 1;
+    do {
+        // This follows the windows used by test_all_windows().
+        switch (window++) {
+          case 0:
+            win_start = 0;
+            win_end   = (LOW_LOAD_LIMIT >> PAGE_SHIFT);
+            break;
+          case 1:
+            win_start = (LOW_LOAD_LIMIT >> PAGE_SHIFT);
+            win_end   = first_upper_window_end(split_pinned);
+            break;
+          default:
+            win_start = win_end;
+            win_end  += VM_WINDOW_SIZE;
+        }
+        uintptr_t start = win_start > pm_limit_lower ? win_start : pm_limit_lower;
+        uintptr_t end   = win_end   < pm_limit_upper ? win_end   : pm_limit_upper;
+
+        bool window_used = false;
+        for (int i = 0; i < pm_map_size; i++) {
+            uintptr_t seg_start = pm_map[i].start > start ? pm_map[i].start : start;
+            uintptr_t seg_end   = pm_map[i].end   < end   ? pm_map[i].end   : end;
+            if (seg_start < seg_end && triage_active) {
+                uintptr_t num_pages = add_triage_segments(seg_start, seg_end, false, 0) / stride;
+                if (num_pages > 0) {
+                    *sweep_ticks += (num_pages + spin_pages - 1) / spin_pages;
+                    window_used = true;
+                }
+            } else if (seg_start < seg_end) {
+                *sweep_ticks += ((seg_end - seg_start) / stride + spin_pages - 1) / spin_pages;
+                window_used = true;
+            }
+        }
+        if (window_used) {
+            *num_windows += 1;
+        }
+    } while (win_end < pm_map[pm_map_size - 1].end);
+}
+
+// Returns the number of ticks the specified test performs in a pass with the
+// specified number of iterations, and sets *delay_ticks to the number of those
+// that are one second delays. count_sweep_ticks() must have been called first.
+static int count_test_ticks(int test, int iterations, int *delay_ticks)
+{
+    int stages = test_list[test].stages;
+    int ticks  = 0;
+
+    *delay_ticks = 0;
+    for (int stage = 0; stage < stages; stage++) {
+        *delay_ticks += estimate_delay_ticks(test, stage, iterations);
+        if (stages > 1) {
+            ticks += estimate_test_ticks(test, stage, iterations, upper_sweep_ticks, upper_windows);
+        } else if (test == 0) {
+            ticks += estimate_test_ticks(test, stage, iterations, all_sweep_ticks, addr_test_windows);
+        } else if (sample_stride(test) > 1) {
+            ticks += estimate_test_ticks(test, stage, iterations, sampled_sweep_ticks, all_windows);
+        } else {
+            ticks += estimate_test_ticks(test, stage, iterations, all_sweep_ticks, all_windows);
+        }
+    }
+    // A sequential test is run by each CPU in turn.
+    if (cpu_mode == SEQ || (cpu_mode == PAR && test_list[test].cpu_mode == SEQ)) {
+        ticks        *= num_sampled_cpus;
+        *delay_ticks *= num_sampled_cpus;
+    }
+    return ticks;
+}
+
+// Returns the expected time taken by a tick of the parallel tests with the
+// current block size, assuming the CPUs share the memory bandwidth measured
+// at startup, or 0 if it wasn't measured.
+static uint64_t estimated_clks_per_tick(void)
+{
+    if (ram_speed < 1000) {
+        return 0;
+    }
+    uintptr_t kb_per_tick = (spin_size * sizeof(testword_t) / 1024) * num_test_cpus;
+    return (uint64_t)(kb_per_tick / (ram_speed / 1000)) * clks_per_msec;
+}
+
+// Returns true if the sweep tick counts were calculated for the current
+// memory range and block size. Otherwise records the current values, and
+// returns false. A change to the test selection or the CPU sequencing mode
+// doesn't change the sweeps, so their counts can be reused.
+static bool sweep_ticks_valid(void)
+{
+    int num_pages = triage_active ? num_faulty_pages : -1;
+    if (sweep_key_valid
+    &&  sweep_key.pm_limit_lower   == pm_limit_lower
+    &&  sweep_key.pm_limit_upper   == pm_limit_upper
+    &&  sweep_key.spin_size        == spin_size
+    &&  sweep_key.quick_stride     == quick_stride
+    &&  sweep_key.num_faulty_pages == num_pages) {
+        return true;
+    }
+    sweep_key.pm_limit_lower   = pm_limit_lower;
+    sweep_key.pm_limit_upper   = pm_limit_upper;
+    sweep_key.spin_size        = spin_size;
+    sweep_key.quick_stride     = quick_stride;
+    sweep_key.num_faulty_pages = num_pages;
+    sweep_key_valid = true;
+    return false;
+}
+
+// Calculates the number of ticks in each test and pass, without running
+// through the tests.
+static void calculate_tick_budget(void)
+{
+    if (!sweep_ticks_valid()) {
+        int split_sweep_ticks;
+        count_sweep_ticks(true,  false, 1, &all_sweep_ticks,   &all_windows);
+        count_sweep_ticks(false, false, 1, &upper_sweep_ticks, &upper_windows);
+        count_sweep_ticks(true,  true,  1, &split_sweep_ticks, &addr_test_windows);
+        if (quick_stride > 1) {
+            count_sweep_ticks(true, false, quick_stride, &sampled_sweep_ticks, &all_windows);
+        }
+    }
+
+    for (int pass_type = 0; pass_type < NUM_PASS_TYPES; pass_type++) {
+        ticks_per_pass[pass_type] = 0;
+        for (int test = 0; test < NUM_TEST_PATTERNS; test++) {
+            ticks_per_test[pass_type][test] = 0;
+            delay_ticks_per_test[pass_type][test] = 0;
+            int iterations = test_iterations(test, pass_type);
+            if (!test_list[test].enabled || iterations == 0) {
+                continue;
+            }
+            int delay_ticks;
+            int ticks = count_test_ticks(test, iterations, &delay_ticks);
+            ticks_per_test[pass_type][test] = ticks;
+            delay_ticks_per_test[pass_type][test] = delay_ticks;
+            ticks_per_pass[pass_type] += ticks;
+        }
+    }
+}
+
+// Returns the predicted time to run the specified test with the specified
+// number of iterations.
+static uint64_t predicted_test_clks(int test, int iterations)
+{
+    int delay_ticks;
+    int ticks = count_test_ticks(test, iterations, &delay_ticks);
+    return (uint64_t)delay_ticks * 1000 * clks_per_msec + (ticks - delay_ticks) * test_clks_per_tick(test);
+}
+
+static int scaled_iterations(int test, int fraction)
+{
+    int iterations = (test_list[test].iterations * fraction) / 1024;
+    return iterations > 0 ? iterations : 1;
+}
+
+// Chooses the tests and the iteration counts for the full passes, so that a
+// full pass is expected to fit in the time budget, based on the times taken
+// in the previous passes. The tests are chosen in order of their yield per
+// second when run for a single iteration. The iteration counts of all the
+// chosen tests are then reduced by the same fraction.
+static void schedule_tests(void)
+{
+    tests_scheduled = false;
+    if (pass_budget == 0 || clks_per_msec == 0 || test_clks_per_tick(0) == 0) {
+        return;
+    }
+    uint64_t budget_clks = (uint64_t)pass_budget * 60 * 1000 * clks_per_msec;
+
+    uint64_t min_clks[NUM_TEST_PATTERNS];
+    bool     considered[NUM_TEST_PATTERNS];
+    bool     chosen[NUM_TEST_PATTERNS];
+    for (int test = 0; test < NUM_TEST_PATTERNS; test++) {
+        considered[test] = !test_list[test].enabled;
+        chosen[test]     = false;
+        min_clks[test]   = test_list[test].enabled ? predicted_test_clks(test, 1) : 0;
+    }
+
+    uint64_t total_clks = 0;
+    bool     any_chosen = false;
+    while (true) {
+        int best = -1;
+        for (int test = 0; test < NUM_TEST_PATTERNS; test++) {
+            if (considered[test]) {
+                continue;
+            }
+            // Compare yield / time without dividing.
+            if (best < 0 || test_yield[test] * min_clks[best] > test_yield[best] * min_clks[test]) {
+                best = test;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        considered[best] = true;
+        // Always run at least one test.
+        if (total_clks + min_clks[best] <= budget_clks || !any_chosen) {
+            chosen[best] = true;
+            any_chosen   = true;
+            total_clks  += min_clks[best];
+        }
+    }
+
+    // Find the largest fraction of the normal iterations (in 1/1024ths) that
+    // fits in the budget.
+    int lower = 0;
+    int upper = 1024;
+    while (lower < upper) {
+        int fraction = (lower + upper + 1) / 2;
+        uint64_t clks = 0;
+        for (int test = 0; test < NUM_TEST_PATTERNS; test++) {
+            if (chosen[test]) {
+                clks += predicted_test_clks(test, scaled_iterations(test, fraction));
+            }
+        }
+        if (clks <= budget_clks) {
+            lower = fraction;
+        } else {
+            upper = fraction - 1;
+        }
+    }
+
+    for (int test = 0; test < NUM_TEST_PATTERNS; test++) {
+        scheduled_iterations[test] = chosen[test] ? scaled_iterations(test, lower) : 0;
+    }
+    tests_scheduled = true;
+}
+
+static bool is_test_cpu(int cpu)
+{
+    return cpu_state[cpu] != CPU_STATE_DISABLED && cpu != ui_cpu;
+}
+
+// Chooses the seed for the random patterns of the current pass. This is the
+// seed given by the boot options, if any, so the patterns of a recorded pass
+// can be repeated.
+static void choose_pass_seed(void)
+{
+    if (fixed_seed != 0) {
+        pass_seed = fixed_seed;
+    } else if (cpuid_info.flags.rdtsc) {
+        pass_seed = get_tsc();
+        if (pass_seed == 0) {
+            pass_seed = 1;
+        }
+    } else {
+        pass_seed = 1 + pass_num;
+    }
+}
+
+// Chooses the CPUs that take turns to run each test when the tests are run
+// on one CPU at a time. CPU 0 always takes a turn, as the turns start and end
+// with it. When sampling by core or by package, each other core or package
+// is represented by one of its CPUs, chosen afresh on each pass, so the
+// passes work their way through all the CPUs.
+static void select_cpu_sample(void)
+{
+    for (int cpu = 0; cpu < num_available_cpus; cpu++) {
+        in_cpu_sample[cpu] = (cpu_sample == CPU_SAMPLE_ALL || cpu == 0) && is_test_cpu(cpu);
+    }
+
+    if (cpu_sample == CPU_SAMPLE_RANDOM) {
+        testword_t state = pass_prsg_seed(NUM_TEST_PATTERNS, 0);  // distinct from the seeds used by the tests
+        int needed    = cpu_sample_size - 1;
+        int remaining = num_test_cpus - 1;
+        for (int cpu = 1; cpu < num_available_cpus && needed > 0 && remaining > 0; cpu++) {
+            if (!is_test_cpu(cpu)) {
+                continue;
+            }
+            // Select each CPU with the probability that gives the chosen
+            // number of CPUs in total.
+            state = prsg(state);
+            if ((int)(state % remaining) < needed) {
+                in_cpu_sample[cpu] = true;
+                needed--;
+            }
+            remaining--;
+        }
+    } else if (cpu_sample != CPU_SAMPLE_ALL) {
+        int shift = apic_id_shift(cpu_sample == CPU_SAMPLE_CORE ? threads_per_core() : cpuid_info.topology.thread_count);
+        int cpu0_group = smp_get_apic_id(0) >> shift;
+        for (int cpu = 1; cpu < num_available_cpus; cpu++) {
+            int group = smp_get_apic_id(cpu) >> shift;
+            if (!is_test_cpu(cpu) || group == cpu0_group) {
+                continue;
+            }
+            int index = 0;
+            int size  = 0;
+            for (int other = 1; other < num_available_cpus; other++) {
+                if (is_test_cpu(other) && (smp_get_apic_id(other) >> shift) == group) {
+                    if (other < cpu) {
+                        index++;
+                    }
+                    size++;
+                }
+            }
+            in_cpu_sample[cpu] = (index == pass_num % size);
+        }
+    }
+
+    num_sampled_cpus = 0;
+    for (int cpu = 0; cpu < num_available_cpus; cpu++) {
+        if (in_cpu_sample[cpu]) {
+            num_sampled_cpus++;
+        }
+    }
 }
 
 static void select_next_master(void)
 {
     do {
         master_cpu = (master_cpu + 1) % num_available_cpus;
-    } while (cpu_state[master_cpu] == CPU_STATE_DISABLED);
+    } while (!in_cpu_sample[master_cpu]);
+}
+
+// Reports the result of a run that has finished after the number of passes
+// given by the passes option, and then takes the finish action. If the
+// machine can't be powered off, waits for a key press and then reboots.
+// Ends a pass of the smt=auto trial. The first pass is run with each thread
+// taking its own share of the work and the second with the two threads in
+// each core sharing one. The placement that gives the higher total throughput
+// over the tests run in both passes is then used, and saved for later boots.
+static void end_smt_trial_pass(void)
+{
+    if (pass_num == 1) {
+        for (int test = 0; test < NUM_TEST_PATTERNS; test++) {
+            smt_trial_mbps[test] = test_mbps(test);
+        }
+        set_work_pairing(true);
+        return;
+    }
+    uint64_t all_mbps  = 0;
+    uint64_t pair_mbps = 0;
+    for (int test = 0; test < NUM_TEST_PATTERNS; test++) {
+        if (smt_trial_mbps[test] > 0 && test_mbps(test) > 0) {
+            all_mbps  += smt_trial_mbps[test];
+            pair_mbps += test_mbps(test);
+        }
+    }
+    bool pair = pair_mbps > all_mbps;
+    trace(0, "SMT placement %s (total %u MB/s paired, %u MB/s unpaired)", pair ? "pair" : "all",
+          (uintptr_t)pair_mbps, (uintptr_t)all_mbps);
+    set_work_pairing(pair);
+    autotune_save_smt_pairing(pair);
+    smt_trial = false;
+}
+
+static void finish_run(void)
+{
+    telemetry_end_run(pass_num);
+    save_run_result(pass_num);
+    if (enable_resume) {
+        // Don't resume a finished run.
+        clear_checkpoint();
+    }
+    clear_footer_message();
+    display_footer_message("Finished - press a key");
+    if (enable_tty) {
+        tty_full_redraw();
+    }
+
+    switch (finish_action) {
+      case FINISH_REBOOT:
+        reboot();
+        break;
+      case FINISH_POWER_OFF:
+        power_off();
+        break;
+      default:
+        break;
+    }
+    while (get_key() == 0) { }
+    reboot();
 }
 
 //------------------------------------------------------------------------------
@@ -586,13 +1700,23 @@ void main(void)
                 while (get_key() == 0) { }
                 reboot();
             }
+            boottime_mark("Start APs");
             if (enable_trace && num_enabled_cpus > 1) {
                 trace(0, "all other CPUs started");
                 set_scroll_lock(true);
             }
             init_state = 2;
         } else {
+            init_write_combining();
             trace(my_cpu, "AP started");
+            simd_enable();
+            if (enable_perf_max) {
+                set_max_performance(my_cpu);
+            }
+            if (enable_pmu) {
+                pmu_start(my_cpu);
+            }
+            start_heartbeat(my_cpu);
             cpu_state[my_cpu] = CPU_STATE_RUNNING;
             ap_enumerate(my_cpu);
             while (init_state < 2) {
@@ -601,6 +1725,12 @@ void main(void)
         }
     }
 
+    if (my_cpu == 0 && relocate_start_time != 0) {
+        // We have just finished relocating ourselves.
+        profile_record(my_cpu, PHASE_RELOCATE, relocate_start_time);
+        relocate_start_time = 0;
+    }
+
 #if TEST_INTERRUPT
     if (my_cpu == 0) {
         __asm__ __volatile__ ("int $1");
@@ -612,35 +1742,121 @@ void main(void)
     // have a single loop and use global state variables to allow us to restart
     // where we left off after each relocation.
 
+    if (my_cpu == 0) {
+        // From now on, the trace messages are formatted between the tests
+        // and by the periodic housekeeping.
+        trace_defer();
+    }
+
     while (1) {
         SHORT_BARRIER;
+        if (run_full_bench) {
+            run_benchmark(my_cpu, start_barrier);
+            if (my_cpu == 0) {
+                run_full_bench = false;
+            }
+        }
         if (my_cpu == 0) {
+            trace_flush();
             if (start_run) {
                 pass_num = 0;
+                resume_run = false;
+                if (enable_resume && !checkpoint_checked) {
+                    checkpoint_checked = true;
+                    resume_run = load_checkpoint(&checkpoint);
+                }
+                if (resume_run) {
+                    pass_num = checkpoint.pass_num;
+                    resume_pass = true;
+                    trace(my_cpu, "resuming at pass %i test %i", pass_num, checkpoint.test_num);
+                }
                 start_pass = true;
-                if (!dummy_run) {
-                    display_start_run();
-                    badram_init();
-                    error_init();
+                tests_scheduled = false;
+                if (triage_active) {
+                    triage_active = false;
+                    clear_footer_message();
+                }
+                // Choose the block size per tick from the memory bandwidth,
+                // and then from the measured tick times on each pass. When
+                // the run is restarted after a change of configuration, the
+                // tick times measured in the previous run still apply. If
+                // there is nothing to go on, start with short ticks, so a
+                // key press that abandons a test takes effect quickly.
+                uint64_t measured_clks = block_clks_per_tick();
+                if (measured_clks > 0) {
+                    calibrate_spin_size(measured_clks);
+                } else {
+                    uint64_t estimated_clks = estimated_clks_per_tick();
+                    spin_size = (estimated_clks > 0) ? MAX_SPIN_SIZE : MIN_SPIN_SIZE;
+                    calibrate_spin_size(estimated_clks);
                 }
+                choose_pass_seed();
+                select_cpu_sample();
+                calculate_tick_budget();
+                display_start_run();
+                errlog_report();
+                badram_init();
+                error_init();
+                if (resume_run) {
+                    restore_checkpoint_errors();
+                    display_pass_count(pass_num);
+                    error_update();
+                }
+                telemetry_start_run(num_enabled_cpus);
+                boottime_end();
+                baseline_start_run();
             }
             if (start_pass) {
                 test_num = 0;
+                window_range = first_window_range();
+                second_half  = false;
+                if (resume_pass) {
+                    // The halves of the pass only apply if the low memory
+                    // still needs a separate window.
+                    if ((checkpoint.window_range == ALL_WINDOWS) == (window_range == ALL_WINDOWS)
+                    &&  checkpoint.window_range >= ALL_WINDOWS && checkpoint.window_range <= LOWER_WINDOW) {
+                        test_num     = checkpoint.test_num;
+                        window_range = (window_range_t)checkpoint.window_range;
+                        second_half  = checkpoint.second_half;
+                    }
+                    resume_pass = false;
+                }
                 start_test = true;
-                if (dummy_run) {
-                    ticks_per_pass[pass_num] = 0;
-                } else {
-                    display_start_pass();
+                if (pass_num > 0) {
+                    choose_pass_seed();
+                    select_cpu_sample();
+                    int shift = calibrate_spin_size(block_clks_per_tick());
+                    if (shift != 0) {
+                        scale_tick_timing(shift);
+                        calculate_tick_budget();
+                    }
+                }
+                if (pass_num > 0 && pass_budget > 0) {
+                    schedule_tests();
+                    calculate_tick_budget();
                 }
+                trace(my_cpu, "start pass %i seed %u", pass_num, pass_seed);
+                display_start_pass();
+                telemetry_start_pass(pass_num);
             }
             if (start_test) {
                 trace(my_cpu, "start test %i", test_num);
                 test_stage = 0;
                 rerun_test = true;
-                if (dummy_run) {
-                    ticks_per_test[pass_num][test_num] = 0;
-                } else if (test_list[test_num].enabled) {
+                // Move the sampled slices on each pass, so repeated quick
+                // screen passes work their way through all the memory.
+                set_work_sampling(sample_stride(test_num), pass_num);
+                if (test_selected()) {
+                    if (enable_resume && !triage_active) {
+                        checkpoint_t position = { pass_num, test_num, window_range, second_half };
+                        save_checkpoint(&position);
+                    }
                     display_start_test();
+                    telemetry_start_test(pass_num, test_num);
+                    setup_mixed_tests();
+                    // The other domains may be running different tests, so
+                    // memory can't be left ready for the next test.
+                    chain_test_start(test_num, mix_test ? -1 : next_selected_test());
                 }
                 bail = false;
             }
@@ -655,7 +1871,7 @@ void main(void)
             rerun_test = false;
         }
         SHORT_BARRIER;
-        if (test_list[test_num].enabled) {
+        if (test_selected()) {
             test_all_windows(my_cpu);
         }
         SHORT_BARRIER;
@@ -668,17 +1884,39 @@ void main(void)
             // The configuration has been changed.
             master_cpu = 0;
             start_run = true;
-            dummy_run = true;
             restart = false;
             continue;
         }
         error_update();
 
-        if (test_list[test_num].enabled) {
+        bool fail_fast = fail_fast_reached();
+        if (start_triage || fail_fast || (triage_threshold > 0 && error_count >= (uint64_t)triage_threshold)) {
+            start_triage = false;
+            if (!triage_active && num_faulty_pages > 0) {
+                // Rerun all the tests on just the faulty pages.
+                triage_active = true;
+                master_cpu = 0;
+                start_pass = true;
+                calculate_tick_budget();
+                display_footer_message("Triage: faulty pages");
+                continue;
+            }
+            if (fail_fast && !triage_active) {
+                // There are no faulty pages to triage.
+                finish_run();
+            }
+        }
+
+        if (test_selected()) {
             if (++test_stage < test_list[test_num].stages) {
                 rerun_test = true;
                 continue;
             }
+            if (!bail && repeat_test_stage(test_num, test_stage - 1, test_iterations(test_num, pass_num == 0 ? FAST_PASS : FULL_PASS))) {
+                test_stage--;
+                rerun_test = true;
+                continue;
+            }
             test_stage = 0;
 
             switch (cpu_mode) {
@@ -706,8 +1944,9 @@ void main(void)
             }
         }
 
-        if (dummy_run) {
-            ticks_per_pass[pass_num] += ticks_per_test[pass_num][test_num];
+        if (test_selected()) {
+            telemetry_end_test(pass_num, test_num);
+            chain_test_end(!bail);
         }
 
         start_test = true;
@@ -715,23 +1954,43 @@ void main(void)
         if (test_num < NUM_TEST_PATTERNS) {
             continue;
         }
+        if (window_range != ALL_WINDOWS && !second_half) {
+            // Run the other half of the pass.
+            window_range = (window_range == UPPER_WINDOWS) ? LOWER_WINDOW : UPPER_WINDOWS;
+            second_half  = true;
+            test_num = 0;
+            continue;
+        }
 
+        display_end_pass();
+        telemetry_end_pass(pass_num);
         pass_num++;
-        if (dummy_run && pass_num == NUM_PASS_TYPES) {
-            start_run = true;
-            dummy_run = false;
-            continue;
+
+        if (smt_trial) {
+            end_smt_trial_pass();
         }
 
+        // The bandwidth benchmark is run once the first pass has given the
+        // first results, while the other CPUs wait for the next pass.
+        if (enable_bench && ram_speed == 0 && !bandwidth_measured) {
+            bandwidth_measured = true;
+            measure_memory_bandwidth();
+            trace(my_cpu, "memory bandwidth %ukB/s, peak %uMB/s", ram_speed, memctrl_peak_bandwidth());
+            display_memory_speeds();
+        }
+        baseline_end_pass(pass_num - 1);
+        errlog_append(ERRLOG_PASS, -1, error_count, 0, 0);
+
         start_pass = true;
-        if (!dummy_run) {
-            display_pass_count(pass_num);
-            if (error_count == 0) {
-                display_status("Pass   ");
-                display_big_status(true);
-            } else {
-                display_big_status(false);
-            }
+        display_pass_count(pass_num);
+        if (error_count == 0) {
+            display_status("Pass   ");
+            display_big_status(true);
+        } else {
+            display_big_status(false);
+        }
+        if ((max_passes > 0 && pass_num >= max_passes) || (fail_fast && triage_active)) {
+            finish_run();
         }
     }
 }
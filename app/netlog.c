@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "e1000.h"
+
+#include "spinlock.h"
+#include "string.h"
+
+#include "config.h"
+
+#include "netlog.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define ETH_HEADER_SIZE     14
+#define IP_HEADER_SIZE      20
+#define UDP_HEADER_SIZE     8
+
+#define HEADER_SIZE         (ETH_HEADER_SIZE + IP_HEADER_SIZE + UDP_HEADER_SIZE)
+
+#define MAX_PAYLOAD_SIZE    512
+
+#define SOURCE_PORT         5140
+
+#define MAX_LINK_TIME       5000    // milliseconds
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+static bool         active = false;
+
+static uint8_t      station_mac[6];
+
+static uint32_t     source_ip = 0;
+
+static spinlock_t   send_lock = false;
+
+static uint8_t      frame[HEADER_SIZE + MAX_PAYLOAD_SIZE];
+
+static uint16_t     ident = 0;
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static void put16(uint8_t *p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value;
+}
+
+static void put32(uint8_t *p, uint32_t value)
+{
+    put16(p + 0, value >> 16);
+    put16(p + 2, value);
+}
+
+// Returns the Internet checksum of the data, which must be an even number of
+// bytes.
+static uint16_t ip_checksum(const uint8_t *data, int length)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < length; i += 2) {
+        sum += (uint32_t)data[i] << 8 | data[i + 1];
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return ~sum;
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+void netlog_init(void)
+{
+    if (netlog_ip == 0 || active) {
+        return;
+    }
+    if (!e1000_init(station_mac, MAX_LINK_TIME)) {
+        return;
+    }
+
+    // Without DHCP, use a link-local address derived from the station address,
+    // so the collector can tell the machines apart.
+    source_ip = netlog_source_ip;
+    if (source_ip == 0) {
+        source_ip = 169 << 24 | 254 << 16 | (1 + station_mac[4] % 254) << 8 | station_mac[5];
+    }
+
+    // Ethernet header.
+    memset(&frame[0], 0xff, 6);
+    memcpy(&frame[6], station_mac, 6);
+    put16(&frame[12], 0x0800);
+
+    active = true;
+}
+
+const uint8_t *netlog_mac(void)
+{
+    return active ? station_mac : NULL;
+}
+
+void netlog_send(const char *data, int length)
+{
+    if (!active) {
+        return;
+    }
+    if (length > MAX_PAYLOAD_SIZE) {
+        length = MAX_PAYLOAD_SIZE;
+    }
+
+    spin_lock(&send_lock);
+
+    // IPv4 header. Each datagram has its own identification, so the collector
+    // can detect dropped frames.
+    uint8_t *ip = &frame[ETH_HEADER_SIZE];
+    ip[0] = 0x45;
+    ip[1] = 0;
+    put16(&ip[2], IP_HEADER_SIZE + UDP_HEADER_SIZE + length);
+    put16(&ip[4], ident++);
+    put16(&ip[6], 0x4000);      // don't fragment
+    ip[8] = 64;                 // time to live
+    ip[9] = 17;                 // UDP
+    put16(&ip[10], 0);
+    put32(&ip[12], source_ip);
+    put32(&ip[16], netlog_ip);
+    put16(&ip[10], ip_checksum(ip, IP_HEADER_SIZE));
+
+    // UDP header. The checksum is optional for IPv4.
+    uint8_t *udp = &ip[IP_HEADER_SIZE];
+    put16(&udp[0], SOURCE_PORT);
+    put16(&udp[2], netlog_port);
+    put16(&udp[4], UDP_HEADER_SIZE + length);
+    put16(&udp[6], 0);
+
+    memcpy(&udp[UDP_HEADER_SIZE], data, length);
+
+    (void)e1000_send(frame, HEADER_SIZE + length);
+
+    spin_unlock(&send_lock);
+}
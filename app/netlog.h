@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef NETLOG_H
+#define NETLOG_H
+/**
+ * \file
+ *
+ * Provides a network channel for the telemetry event stream. Each event is
+ * sent as a UDP datagram to the collector given by the netlog option. There
+ * is no ARP, so the datagrams are sent to the Ethernet broadcast address and
+ * the collector must be on the same network segment.
+ *
+ *//*
+ * Copyright (C) 2024 Memtest86+ contributors.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Initialises the network controller if the netlog option was given. Must be
+ * called after memory has started being reserved for pinned data structures.
+ */
+void netlog_init(void);
+
+/**
+ * Returns the station address of the network controller, or NULL if the
+ * network channel is not in use.
+ */
+const uint8_t *netlog_mac(void);
+
+/**
+ * Sends the data as a single UDP datagram, without waiting. The datagram is
+ * dropped if the network controller is busy. Does nothing if the network
+ * channel is not in use.
+ */
+void netlog_send(const char *data, int length);
+
+#endif // NETLOG_H
@@ -0,0 +1,238 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpuinfo.h"
+#include "keyboard.h"
+#include "screen.h"
+#include "serial.h"
+#include "smp.h"
+#include "tsc.h"
+
+#include "print.h"
+#include "string.h"
+
+#include "config.h"
+
+#include "profile.h"
+
+#if PROFILE_PHASES
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define NUM_BUCKETS         48      // bucket n counts times of 2^n to 2^(n+1)-1 cycles
+
+#define CALIBRATION_LOOPS   256
+
+#define POP_PROF_R          6
+#define POP_PROF_C          10
+#define POP_PROF_W          60
+#define POP_PROF_H          13
+
+#define POP_PROF_LAST_R     (POP_PROF_R + POP_PROF_H - 1)
+#define POP_PROF_LAST_C     (POP_PROF_C + POP_PROF_W - 1)
+
+#define POP_PROF_REGION     POP_PROF_R, POP_PROF_C, POP_PROF_LAST_R, POP_PROF_LAST_C
+
+static const char *phase_name[NUM_PHASES] = {
+    "Fill",
+    "Verify",
+    "Cache flush",
+    "Barrier wait",
+    "Map window",
+    "Relocate"
+};
+
+//------------------------------------------------------------------------------
+// Types
+//------------------------------------------------------------------------------
+
+typedef struct __attribute__((aligned(64))) {
+    uint64_t    total[NUM_PHASES];
+    uint32_t    count[NUM_PHASES];
+    uint32_t    hist[NUM_PHASES][NUM_BUCKETS];
+} profile_data_t;
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+static profile_data_t   profile_data[MAX_CPUS];
+
+static profile_data_t   calibration_data;
+
+static uint32_t         overhead = 0;   // estimated cycles per measurement
+
+static uint16_t         popup_save_buffer[POP_PROF_W * POP_PROF_H];
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static int log2_cycles(uint64_t cycles)
+{
+    // Avoid __builtin_clzll, which needs libgcc in 32-bit builds.
+    uint32_t hi = cycles >> 32;
+    uint32_t lo = cycles;
+    if (hi != 0) {
+        return 63 - __builtin_clz(hi);
+    }
+    return lo != 0 ? 31 - __builtin_clz(lo) : 0;
+}
+
+static void record(profile_data_t *data, phase_t phase, uint64_t cycles)
+{
+    int bucket = log2_cycles(cycles);
+    if (bucket >= NUM_BUCKETS) {
+        bucket = NUM_BUCKETS - 1;
+    }
+    data->total[phase] += cycles;
+    data->count[phase]++;
+    data->hist[phase][bucket]++;
+}
+
+static void serial_print_value(const char *label, uint32_t value)
+{
+    char buffer[16];
+
+    serial_echo_print(label);
+    serial_echo_print(itoa(value, buffer));
+}
+
+static uint32_t cycles_to_msec(uint64_t cycles)
+{
+    return clks_per_msec > 0 ? cycles / clks_per_msec : 0;
+}
+
+static void dump_to_serial(void)
+{
+    serial_echo_print("\r\n\nPhase profile\r\n");
+    serial_print_value("overhead (cycles per sample): ", overhead);
+    serial_echo_print("\r\n");
+    for (int cpu_num = 0; cpu_num < num_available_cpus; cpu_num++) {
+        const profile_data_t *data = &profile_data[cpu_num];
+        for (int phase = 0; phase < NUM_PHASES; phase++) {
+            if (data->count[phase] == 0) {
+                continue;
+            }
+            serial_print_value("CPU ", cpu_num);
+            serial_echo_print(" ");
+            serial_echo_print(phase_name[phase]);
+            serial_print_value(": samples ", data->count[phase]);
+            serial_print_value(" total ms ", cycles_to_msec(data->total[phase]));
+            serial_echo_print("\r\n");
+            for (int bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+                if (data->hist[phase][bucket] != 0) {
+                    serial_print_value("  2^", bucket);
+                    serial_print_value(" cycles: ", data->hist[phase][bucket]);
+                    serial_echo_print("\r\n");
+                }
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+void profile_record(int my_cpu, phase_t phase, uint64_t start_time)
+{
+    if (my_cpu < 0) {
+        return;
+    }
+    record(&profile_data[my_cpu], phase, get_tsc() - start_time);
+}
+
+void profile_init(void)
+{
+    // The histograms accumulate from the start of the program, so there is
+    // nothing to clear.
+    //
+    // Time a series of empty measurements. Each one costs two TSC reads and
+    // a histogram update, which is the overhead added to each phase.
+    uint64_t start_time = get_tsc();
+    for (int i = 0; i < CALIBRATION_LOOPS; i++) {
+        record(&calibration_data, PHASE_FILL, get_tsc() - profile_start());
+    }
+    overhead = (get_tsc() - start_time) / CALIBRATION_LOOPS;
+}
+
+void profile_display(void)
+{
+    uint64_t total[NUM_PHASES];
+    uint32_t count[NUM_PHASES];
+    uint32_t hist[NUM_PHASES][NUM_BUCKETS];
+
+    uint64_t all_cycles  = 0;
+    uint64_t all_samples = 0;
+    for (int phase = 0; phase < NUM_PHASES; phase++) {
+        total[phase] = 0;
+        count[phase] = 0;
+        for (int bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+            hist[phase][bucket] = 0;
+        }
+        for (int cpu_num = 0; cpu_num < num_available_cpus; cpu_num++) {
+            const profile_data_t *data = &profile_data[cpu_num];
+            total[phase] += data->total[phase];
+            count[phase] += data->count[phase];
+            for (int bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+                hist[phase][bucket] += data->hist[phase][bucket];
+            }
+        }
+        all_cycles  += total[phase];
+        all_samples += count[phase];
+    }
+
+    save_screen_region(POP_PROF_REGION, popup_save_buffer);
+    set_background_colour(BLACK);
+    set_foreground_colour(WHITE);
+    clear_screen_region(POP_PROF_REGION);
+
+    prints(POP_PROF_R+1, POP_PROF_C+2, "Phase profile (all CPUs)");
+    prints(POP_PROF_R+3, POP_PROF_C+2, "Phase          Samples   Total ms   Mean us    Mode");
+    for (int phase = 0; phase < NUM_PHASES; phase++) {
+        int row = POP_PROF_R + 4 + phase;
+        prints(row, POP_PROF_C+2, phase_name[phase]);
+        printf(row, POP_PROF_C+15, "%8u", (uintptr_t)count[phase]);
+        printf(row, POP_PROF_C+25, "%9u", (uintptr_t)cycles_to_msec(total[phase]));
+        if (count[phase] > 0 && clks_per_msec > 0) {
+            uint64_t mean_usec = (total[phase] * 1000) / ((uint64_t)count[phase] * clks_per_msec);
+            printf(row, POP_PROF_C+36, "%9u", (uintptr_t)mean_usec);
+            int mode = 0;
+            for (int bucket = 1; bucket < NUM_BUCKETS; bucket++) {
+                if (hist[phase][bucket] > hist[phase][mode]) {
+                    mode = bucket;
+                }
+            }
+            printf(row, POP_PROF_C+48, "2^%i", mode);
+        }
+    }
+    uint32_t permille = 0;
+    if (all_cycles > 0) {
+        permille = (all_samples * overhead * 1000) / all_cycles;
+    }
+    printf(POP_PROF_R+10, POP_PROF_C+2, "Overhead: ~%i cycles/sample (%i.%i%% of measured time)",
+           (int)overhead, (int)(permille / 10), (int)(permille % 10));
+    prints(POP_PROF_R+11, POP_PROF_C+2, "Press any key to continue");
+
+    if (enable_tty) {
+        dump_to_serial();
+    }
+
+    while (get_key() == 0) { }
+
+    restore_screen_region(POP_PROF_REGION, popup_save_buffer);
+    set_background_colour(BLUE);
+    set_foreground_colour(WHITE);
+
+    if (enable_tty) {
+        tty_full_redraw();
+    }
+}
+
+#endif // PROFILE_PHASES
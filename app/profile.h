@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef PROFILE_H
+#define PROFILE_H
+/**
+ * \file
+ *
+ * Provides optional instrumentation that measures how long each CPU spends
+ * in the main phases of a test pass, and records the measurements in log2
+ * histograms of TSC cycles. This is only compiled in when PROFILE_PHASES is
+ * defined to be non-zero (e.g. by adding -DPROFILE_PHASES=1 to CFLAGS).
+ * Otherwise the functions used in the hot paths compile to nothing.
+ *
+ *//*
+ * Copyright (C) 2024 Memtest86+ contributors.
+ */
+
+#include <stdint.h>
+
+#include "tsc.h"
+
+#ifndef PROFILE_PHASES
+#define PROFILE_PHASES  0
+#endif
+
+/**
+ * The phases that are measured.
+ */
+typedef enum {
+    PHASE_FILL,
+    PHASE_VERIFY,
+    PHASE_CACHE_FLUSH,
+    PHASE_BARRIER_WAIT,
+    PHASE_MAP_WINDOW,
+    PHASE_RELOCATE,
+    NUM_PHASES
+} phase_t;
+
+#if PROFILE_PHASES
+
+/**
+ * Returns the start time of a phase.
+ */
+static inline uint64_t profile_start(void)
+{
+    return get_tsc();
+}
+
+/**
+ * Records the time since start_time in the histogram for the specified phase
+ * and CPU. Does nothing if my_cpu is negative.
+ */
+void profile_record(int my_cpu, phase_t phase, uint64_t start_time);
+
+/**
+ * Estimates the overhead of taking a measurement. Must be called after the
+ * TSC has been calibrated.
+ */
+void profile_init(void);
+
+/**
+ * Displays a summary of the histograms in a pop-up panel until a key is
+ * pressed. If the serial console is enabled, also dumps the histograms for
+ * each CPU to the serial port.
+ */
+void profile_display(void);
+
+#else
+
+static inline uint64_t profile_start(void)
+{
+    return 0;
+}
+
+static inline void profile_record(int my_cpu, phase_t phase, uint64_t start_time)
+{
+    (void)my_cpu;
+    (void)phase;
+    (void)start_time;
+}
+
+static inline void profile_init(void)
+{
+}
+
+#endif // PROFILE_PHASES
+
+#endif // PROFILE_H
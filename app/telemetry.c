@@ -0,0 +1,550 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpuinfo.h"
+#include "heap.h"
+#include "memctrl.h"
+#include "memsize.h"
+#include "pmem.h"
+#include "serial.h"
+#include "smbios.h"
+#include "smp.h"
+#include "temperature.h"
+#include "tsc.h"
+
+#include "spinlock.h"
+
+#include "config.h"
+#include "error.h"
+#include "netlog.h"
+#include "version.h"
+
+#include "test.h"
+
+#include "telemetry.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define LINE_BUFFER_SIZE    512
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+static spinlock_t   line_lock = false;
+
+static char         line[LINE_BUFFER_SIZE];
+
+static int          line_length = 0;
+
+static uint64_t     test_start_time = 0;
+
+static uint64_t     tested_pages = 0;
+
+static dram_traffic_t test_start_traffic;
+
+static spinlock_t   core_counts_lock = false;
+
+static uint64_t     core_counts[NUM_PMU_EVENTS];
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static void add_chars(const char *str)
+{
+    // Leave room for the line terminator.
+    while (*str && line_length < (LINE_BUFFER_SIZE - 4)) {
+        line[line_length++] = *str++;
+    }
+}
+
+static void add_key(const char *key)
+{
+    add_chars(",\"");
+    add_chars(key);
+    add_chars("\":");
+}
+
+// Adds a key made from the prefix, the single digit index, and the suffix.
+static void add_indexed_key(const char *prefix, int index, const char *suffix)
+{
+    char digit[2] = { '0' + index, '\0' };
+
+    add_chars(",\"");
+    add_chars(prefix);
+    add_chars(digit);
+    add_chars(suffix);
+    add_chars("\":");
+}
+
+// Divides the value by 10 and returns the remainder. This uses 32-bit
+// arithmetic, because the 64-bit division used in the 32-bit build is only
+// approximate.
+static int divide_by_10(uint64_t *value)
+{
+    uint32_t hi = *value >> 32;
+    uint32_t lo = *value;
+
+    uint32_t q_hi  = hi / 10;
+    uint32_t mid   = (hi % 10) << 16 | lo >> 16;
+    uint32_t q_mid = mid / 10;
+    uint32_t low   = (mid % 10) << 16 | (lo & 0xffff);
+    uint32_t q_low = low / 10;
+
+    *value = (uint64_t)q_hi << 32 | q_mid << 16 | q_low;
+    return low % 10;
+}
+
+// Formats the value in decimal at the end of the supplied buffer, and
+// returns a pointer to the first digit.
+static const char *format_uint(char buffer[21], uint64_t value)
+{
+    int i = 20;
+
+    buffer[i] = '\0';
+    do {
+        buffer[--i] = '0' + divide_by_10(&value);
+    } while (value != 0);
+
+    return &buffer[i];
+}
+
+static void add_uint(const char *key, uint64_t value)
+{
+    char buffer[21];
+
+    add_key(key);
+    add_chars(format_uint(buffer, value));
+}
+
+static void add_int(const char *key, int value)
+{
+    char buffer[21];
+
+    add_key(key);
+    if (value < 0) {
+        add_chars("-");
+        add_chars(format_uint(buffer, -(int64_t)value));
+    } else {
+        add_chars(format_uint(buffer, value));
+    }
+}
+
+static void add_hex(const char *key, uint64_t value)
+{
+    char buffer[19];
+    int  i = sizeof(buffer) - 1;
+
+    buffer[i] = '\0';
+    do {
+        buffer[--i] = "0123456789abcdef"[value & 0xf];
+        value >>= 4;
+    } while (value != 0);
+    buffer[--i] = 'x';
+    buffer[--i] = '0';
+
+    add_key(key);
+    add_chars("\"");
+    add_chars(&buffer[i]);
+    add_chars("\"");
+}
+
+static void add_string(const char *key, const char *value)
+{
+    add_key(key);
+    add_chars("\"");
+    // Leave room for the closing quote and the line terminator.
+    while (*value && line_length < (LINE_BUFFER_SIZE - 6)) {
+        if (*value == '"' || *value == '\\') {
+            line[line_length++] = '\\';
+        }
+        line[line_length++] = *value++;
+    }
+    add_chars("\"");
+}
+
+static void add_temperature(void)
+{
+    if (enable_temperature) {
+        add_int("temp_c", get_cpu_temperature());
+        int hottest, average, num_throttled;
+        if (get_thermal_summary(&hottest, &average, &num_throttled)) {
+            add_int("temp_max_c", hottest);
+            add_int("temp_avg_c", average);
+            add_uint("throttled_cpus", num_throttled);
+        }
+    }
+}
+
+// Adds the rates of the DRAM traffic counted for each channel or memory
+// controller since the start of the test.
+static void add_dram_traffic(uint64_t duration_us)
+{
+    char buffer[21];
+
+    memctrl_poll_traffic();
+    const char *prefix = dram_traffic.per_channel ? "ch" : "mc";
+    for (int i = 0; i < dram_traffic.num_counters; i++) {
+        // Bytes/us is MB/s.
+        uint64_t rate = (dram_traffic.read_bytes[i] - test_start_traffic.read_bytes[i]) / duration_us;
+        if (dram_traffic.combined) {
+            add_indexed_key(prefix, i, "_mb_per_s");
+            add_chars(format_uint(buffer, rate));
+            continue;
+        }
+        add_indexed_key(prefix, i, "_read_mb_per_s");
+        add_chars(format_uint(buffer, rate));
+        rate = (dram_traffic.write_bytes[i] - test_start_traffic.write_bytes[i]) / duration_us;
+        add_indexed_key(prefix, i, "_write_mb_per_s");
+        add_chars(format_uint(buffer, rate));
+    }
+}
+
+// Adds the ratio of the two values, to two decimal places.
+static void add_ratio(const char *key, uint64_t numerator, uint64_t denominator)
+{
+    char buffer[21];
+
+    uint64_t hundredths = (numerator * 100) / denominator;
+    add_key(key);
+    add_chars(format_uint(buffer, hundredths / 100));
+    add_chars(".");
+    int fraction = hundredths % 100;
+    add_chars(fraction < 10 ? "0" : "");
+    add_chars(format_uint(buffer, fraction));
+}
+
+// Adds the core performance counts summed over the CPU cores for the current
+// test, per word of memory covered.
+static void add_core_counts(void)
+{
+    uint64_t num_words = tested_pages * (PAGE_SIZE / sizeof(testword_t));
+    if (num_words == 0) {
+        return;
+    }
+    unsigned events = pmu_common_events();
+    if (events & (1 << PMU_CYCLES)) {
+        add_ratio("cycles_per_word", core_counts[PMU_CYCLES], num_words);
+    }
+    if (events & (1 << PMU_INSTRUCTIONS)) {
+        add_ratio("instructions_per_word", core_counts[PMU_INSTRUCTIONS], num_words);
+    }
+    if (events & (1 << PMU_LLC_MISSES)) {
+        add_ratio("llc_misses_per_word", core_counts[PMU_LLC_MISSES], num_words);
+    }
+    if (events & (1 << PMU_MEM_STALLS)) {
+        add_ratio("mem_stall_cycles_per_word", core_counts[PMU_MEM_STALLS], num_words);
+    }
+}
+
+static bool start_event(const char *name)
+{
+    if (!enable_telemetry) {
+        return false;
+    }
+    spin_lock(&line_lock);
+    line_length = 0;
+    add_chars("{\"event\":\"");
+    add_chars(name);
+    add_chars("\"");
+    return true;
+}
+
+static void end_event(void)
+{
+    line[line_length++] = '}';
+    line[line_length++] = '\r';
+    line[line_length++] = '\n';
+    line[line_length]   = '\0';
+    serial_echo_print(line);
+    netlog_send(line, line_length);
+    spin_unlock(&line_lock);
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+void telemetry_start_run(int num_cpus)
+{
+    if (!start_event("run_start")) {
+        return;
+    }
+    add_string("version", MT_VERSION);
+    add_uint("cpus", num_cpus);
+    add_uint("memory_kb", (uint64_t)num_pm_pages << 2);
+    add_uint("reserved_kb", (uint64_t)heap_reserved_pages() << 2);
+    if (memctrl_peak_bandwidth() > 0) {
+        add_uint("peak_mb_per_s", memctrl_peak_bandwidth());
+    }
+    const uint8_t *mac = netlog_mac();
+    if (mac != NULL) {
+        char mac_str[18];
+        for (int i = 0; i < 6; i++) {
+            mac_str[3 * i + 0] = "0123456789abcdef"[mac[i] >> 4];
+            mac_str[3 * i + 1] = "0123456789abcdef"[mac[i] & 0xf];
+            mac_str[3 * i + 2] = (i < 5) ? ':' : '\0';
+        }
+        add_string("mac", mac_str);
+    }
+    end_event();
+}
+
+void telemetry_start_pass(int pass)
+{
+    if (!start_event("pass_start")) {
+        return;
+    }
+    add_uint("pass", pass);
+    add_uint("seed", pass_seed);
+    end_event();
+}
+
+void telemetry_end_pass(int pass)
+{
+    if (!start_event("pass_end")) {
+        return;
+    }
+    add_uint("pass", pass);
+    add_string("status", error_count == 0 ? "pass" : "fail");
+    add_uint("errors", error_count);
+    add_uint("ecc_errors", error_count_cecc);
+    add_temperature();
+    end_event();
+}
+
+void telemetry_end_run(int passes)
+{
+    if (!start_event("run_end")) {
+        return;
+    }
+    add_uint("passes", passes);
+    add_string("status", error_count == 0 ? "pass" : "fail");
+    add_uint("errors", error_count);
+    add_uint("ecc_errors", error_count_cecc);
+    end_event();
+}
+
+void telemetry_start_test(int pass, int test)
+{
+    if (!start_event("test_start")) {
+        return;
+    }
+    add_uint("pass", pass);
+    add_uint("test", test);
+    end_event();
+
+    memctrl_poll_traffic();
+    test_start_traffic = dram_traffic;
+
+    for (int i = 0; i < NUM_PMU_EVENTS; i++) {
+        core_counts[i] = 0;
+    }
+
+    tested_pages    = 0;
+    test_start_time = get_tsc();
+}
+
+void telemetry_add_tested_pages(uintptr_t num_pages)
+{
+    tested_pages += num_pages;
+}
+
+void telemetry_add_core_counts(const uint64_t start[NUM_PMU_EVENTS], const uint64_t end[NUM_PMU_EVENTS])
+{
+    if (!enable_telemetry) {
+        return;
+    }
+    spin_lock(&core_counts_lock);
+    for (int i = 0; i < NUM_PMU_EVENTS; i++) {
+        core_counts[i] += (end[i] - start[i]) & PMU_COUNTER_MASK;
+    }
+    spin_unlock(&core_counts_lock);
+}
+
+void telemetry_end_test(int pass, int test)
+{
+    if (!enable_telemetry) {
+        return;
+    }
+    uint64_t duration_us = 0;
+    if (clks_per_msec > 0) {
+        duration_us = ((get_tsc() - test_start_time) * 1000) / clks_per_msec;
+    }
+    uint64_t tested_kb = tested_pages << 2;
+
+    start_event("test_end");
+    add_uint("pass", pass);
+    add_uint("test", test);
+    add_uint("duration_us", duration_us);
+    add_uint("tested_kb", tested_kb);
+    if (duration_us > 0) {
+        // KB/us is approximately GB/s, so scale to get MB/s.
+        uint64_t mb_per_s = (tested_kb * 1000000) / (duration_us * 1024);
+        add_uint("mb_per_s", mb_per_s);
+        if (memctrl_peak_bandwidth() > 0) {
+            add_uint("peak_pct", (mb_per_s * 100) / memctrl_peak_bandwidth());
+        }
+        add_dram_traffic(duration_us);
+    }
+    if (enable_pmu) {
+        add_core_counts();
+    }
+    add_temperature();
+    end_event();
+}
+
+void telemetry_error(int cpu, uint64_t addr, testword_t good, testword_t bad, bool addr_error,
+                     const dram_location_t *location)
+{
+    if (!start_event("error")) {
+        return;
+    }
+    add_string("type", addr_error ? "address" : "data");
+    add_uint("pass", pass_num);
+    add_uint("test", test_num);
+    add_uint("cpu", cpu);
+    add_hex("addr", addr);
+    add_hex("expected", good);
+    add_hex("actual", bad);
+    add_hex("xor", good ^ bad);
+    if (location != NULL) {
+        add_int("mc", location->mc);
+        add_int("channel", location->channel);
+        add_int("dimm", location->dimm);
+    } else {
+        const char *slot = smbios_dimm_name(smbios_find_dimm(addr));
+        if (slot != NULL) {
+            add_string("slot", slot);
+        }
+    }
+    end_event();
+}
+
+void telemetry_parity_error(int cpu, uint64_t addr)
+{
+    if (!start_event("error")) {
+        return;
+    }
+    add_string("type", "parity");
+    add_uint("pass", pass_num);
+    add_uint("test", test_num);
+    add_uint("cpu", cpu);
+    add_hex("addr", addr);
+    end_event();
+}
+
+void telemetry_ecc_error(int core, uint64_t addr, int channel, int count, uint32_t syndrome,
+                         uint64_t tsc, const dram_location_t *location)
+{
+    if (!start_event("error")) {
+        return;
+    }
+    add_string("type", "ecc");
+    add_uint("pass", pass_num);
+    add_uint("test", test_num);
+    add_uint("cpu", core);
+    add_hex("addr", addr);
+    add_uint("channel", channel);
+    add_uint("count", count);
+    add_hex("syndrome", syndrome);
+    if (tsc != 0 && clks_per_msec > 0) {
+        add_uint("capture_delay_us", ((get_tsc() - tsc) * 1000) / clks_per_msec);
+    }
+    if (location != NULL) {
+        add_int("mc", location->mc);
+        add_int("dimm", location->dimm);
+    }
+    add_uint("ecc_errors", error_count_cecc);
+    end_event();
+}
+
+void telemetry_stress_sample(uint32_t run_secs, uint32_t mb_per_s)
+{
+    if (!start_event("stress_sample")) {
+        return;
+    }
+    add_uint("run_s", run_secs);
+    add_uint("mb_per_s", mb_per_s);
+    add_uint("errors", error_count);
+    add_uint("ecc_errors", error_count_cecc);
+    add_temperature();
+    end_event();
+}
+
+void telemetry_slowdown(int pass, int test, uint32_t mb_per_s, uint32_t first_mb_per_s)
+{
+    if (!start_event("slowdown")) {
+        return;
+    }
+    add_uint("pass", pass);
+    add_uint("test", test);
+    add_uint("mb_per_s", mb_per_s);
+    add_uint("first_mb_per_s", first_mb_per_s);
+    add_temperature();
+    end_event();
+}
+
+void telemetry_below_baseline(int test, uint32_t mb_per_s, uint32_t baseline_mb_per_s)
+{
+    if (!start_event("below_baseline")) {
+        return;
+    }
+    add_uint("pass", pass_num);
+    if (test >= 0) {
+        add_uint("test", test);
+    }
+    add_uint("mb_per_s", mb_per_s);
+    add_uint("baseline_mb_per_s", baseline_mb_per_s);
+    add_temperature();
+    end_event();
+}
+
+void telemetry_errors_dropped(uintptr_t count)
+{
+    if (!start_event("errors_dropped")) {
+        return;
+    }
+    add_uint("pass", pass_num);
+    add_uint("test", test_num);
+    add_uint("count", count);
+    add_uint("errors", error_count);
+    end_event();
+}
+
+void telemetry_trace(int cpu, const char *message)
+{
+    if (!start_event("trace")) {
+        return;
+    }
+    add_uint("cpu", cpu);
+    add_string("message", message);
+    end_event();
+}
+
+void telemetry_startup_phase(const char *phase, uint32_t start_us, uint32_t duration_us)
+{
+    if (!start_event("startup_phase")) {
+        return;
+    }
+    add_string("phase", phase);
+    add_uint("start_us", start_us);
+    add_uint("us", duration_us);
+    end_event();
+}
+
+void telemetry_startup_end(uint32_t firmware_us, uint32_t total_us)
+{
+    if (!start_event("startup_end")) {
+        return;
+    }
+    add_uint("firmware_us", firmware_us);
+    add_uint("total_us", total_us);
+    end_event();
+}
@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+/**
+ * \file
+ *
+ * Provides a machine-readable event stream on the serial console. When
+ * enabled, each event is sent as a single line containing a JSON object,
+ * and the VT100 copy of the screen is not sent. All the functions do
+ * nothing if the event stream is not enabled.
+ *
+ *//*
+ * Copyright (C) 2024 Memtest86+ contributors.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memctrl.h"
+#include "pmu.h"
+
+#include "test.h"
+
+/**
+ * Sends the run start event, which includes the number of CPU cores in use
+ * and the amount of memory to be tested.
+ */
+void telemetry_start_run(int num_cpus);
+
+/**
+ * Sends the pass start event.
+ */
+void telemetry_start_pass(int pass);
+
+/**
+ * Sends the pass end event, which includes the error counts so far.
+ */
+void telemetry_end_pass(int pass);
+
+/**
+ * Sends the run end event when the run finishes after the number of passes
+ * given by the passes option, which includes the final result and error
+ * counts.
+ */
+void telemetry_end_run(int passes);
+
+/**
+ * Sends the test start event and starts timing the test.
+ */
+void telemetry_start_test(int pass, int test);
+
+/**
+ * Adds the specified number of pages to the amount of memory covered by the
+ * current test.
+ */
+void telemetry_add_tested_pages(uintptr_t num_pages);
+
+/**
+ * Adds the increments of the core performance counters of one CPU core, from
+ * the readings taken before and after it ran part of the current test.
+ */
+void telemetry_add_core_counts(const uint64_t start[NUM_PMU_EVENTS], const uint64_t end[NUM_PMU_EVENTS]);
+
+/**
+ * Sends the test end event, which includes the test duration and the rate at
+ * which memory was covered.
+ */
+void telemetry_end_test(int pass, int test);
+
+/**
+ * Sends an error event for an address or data error detected at the
+ * specified physical address. If location is not NULL, the event also
+ * includes the memory controller, channel, and DIMM slot that hold it.
+ * Otherwise, if the SMBIOS tables map the address to one memory device, the
+ * event includes its slot name.
+ */
+void telemetry_error(int cpu, uint64_t addr, testword_t good, testword_t bad, bool addr_error,
+                     const dram_location_t *location);
+
+/**
+ * Sends an error event for a parity error detected near the specified
+ * physical address.
+ */
+void telemetry_parity_error(int cpu, uint64_t addr);
+
+/**
+ * Sends an error event for a correctable ECC error reported by the memory
+ * controller, including the syndrome or model-specific error code it
+ * reported. If tsc is not 0, it is the time the error was captured by an
+ * interrupt, and the event includes how long ago that was. If location is
+ * not NULL, the event also includes the memory controller and DIMM slot
+ * that hold the failing address.
+ */
+void telemetry_ecc_error(int core, uint64_t addr, int channel, int count, uint32_t syndrome,
+                         uint64_t tsc, const dram_location_t *location);
+
+/**
+ * Sends a stress sample event, which includes the run time in seconds, the
+ * throughput over the last sample period, the temperature, and the error
+ * counts so far.
+ */
+void telemetry_stress_sample(uint32_t run_secs, uint32_t mb_per_s);
+
+/**
+ * Sends a slowdown event, recording that the throughput of the specified
+ * test in the specified pass has fallen too far below its throughput in the
+ * first pass that ran it.
+ */
+void telemetry_slowdown(int pass, int test, uint32_t mb_per_s, uint32_t first_mb_per_s);
+
+/**
+ * Sends a below_baseline event, recording that the throughput of the
+ * specified test (or of the startup benchmark, if test is negative) is too
+ * far below the performance baseline.
+ */
+void telemetry_below_baseline(int test, uint32_t mb_per_s, uint32_t baseline_mb_per_s);
+
+/**
+ * Sends an event recording that the specified number of data errors were
+ * only counted, because they were detected faster than they could be
+ * reported.
+ */
+void telemetry_errors_dropped(uintptr_t count);
+
+/**
+ * Sends a trace event holding a message recorded by the trace option.
+ */
+void telemetry_trace(int cpu, const char *message);
+
+/**
+ * Sends a startup phase event, holding the time in microseconds from the
+ * entry to the program to the start of the phase, and the duration of the
+ * phase.
+ */
+void telemetry_startup_phase(const char *phase, uint32_t start_us, uint32_t duration_us);
+
+/**
+ * Sends the startup end event, holding the time in microseconds from the CPU
+ * reset to the entry to the program, and the total startup time.
+ */
+void telemetry_startup_end(uint32_t firmware_us, uint32_t total_us);
+
+#endif // TELEMETRY_H
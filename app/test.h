@@ -20,12 +20,34 @@
 #include "spinlock.h"
 
 /**
- * A mapping from a CPU core number to the index number of the memory chunk
- * it operates on when performing a memory test in parallel across all the
- * enabled cores (in the current proximity domain, when NUMA awareness is
- * enabled).
- */
-extern uint8_t chunk_index[MAX_CPUS];
+ * The state of a CPU core that the tests read or update as they run. Each
+ * core updates its own entry many times a second, so the entries are kept
+ * in separate cache lines, to avoid moving lines between the cores (and
+ * across the links between CPU packages) on every update.
+ */
+typedef struct __attribute__((aligned(64))) {
+    /**
+     * The base address of the block of memory currently being tested.
+     */
+    uintptr_t   test_addr;
+    /**
+     * The test the core is currently running. This only differs from
+     * test_num when the proximity domains are running different tests.
+     */
+    int         running_test;
+    /**
+     * The index number of the memory chunk the core operates on when
+     * performing a memory test in parallel across all the enabled cores (in
+     * the current proximity domain, when NUMA awareness is enabled).
+     */
+    uint8_t     chunk_index;
+} cpu_context_t;
+
+/**
+ * The state of each CPU core, indexed by CPU core number.
+ */
+extern cpu_context_t cpu_context[MAX_CPUS];
+
 /**
  * An array where the count of used CPUs in the current proximity domain.
  */
@@ -47,6 +69,13 @@ extern int master_cpu;
  */
 extern barrier_t *run_barrier;
 
+/**
+ * An array of barriers, one for each proximity domain, used to synchronise
+ * the CPU cores within each domain during parallel tests when the NUMA code
+ * paths are enabled, or NULL if there is only one proximity domain.
+ */
+extern barrier_t *domain_barrier;
+
 /**
  * A mutex used when reporting errors or printing trace information.
  */
@@ -96,9 +125,15 @@ typedef struct {
 } vm_map_t;
 
 /**
- * The list of memory segments currently mapped into virtual memory.
+ * The list of memory segments currently mapped into virtual memory. This is
+ * allocated from the heap at startup. Adjacent segments are merged when they
+ * are physically contiguous and in the same proximity domain.
  */
-extern vm_map_t vm_map[MAX_MEM_SEGMENTS];
+extern vm_map_t *vm_map;
+/**
+ * The number of entries allocated for vm_map.
+ */
+extern int vm_map_capacity;
 /**
  * The number of memory segments currently mapped into virtual memory.
  */
@@ -108,10 +143,19 @@ extern int vm_map_size;
  * The number of completed test passes.
  */
 extern int pass_num;
+/**
+ * The seed from which the random patterns of the current pass are derived.
+ */
+extern uint32_t pass_seed;
 /**
  * The current test number.
  */
 extern int test_num;
+/**
+ * True while the proximity domains are running different tests, in which
+ * case the phases of each test only synchronise the CPUs within a domain.
+ */
+extern bool mixed_tests;
 /**
  * The current window number.
  */
@@ -128,8 +172,9 @@ extern bool restart;
 extern bool bail;
 
 /**
- * The base address of the block of memory currently being tested.
+ * A flag indicating that testing should switch to triage mode, which only
+ * tests the faulty pages found so far.
  */
-extern uintptr_t test_addr[MAX_CPUS];
+extern bool start_triage;
 
 #endif // TEST_H
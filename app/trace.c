@@ -0,0 +1,280 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "boot.h"
+
+#include "cpuid.h"
+#include "heap.h"
+#include "screen.h"
+#include "smp.h"
+#include "tsc.h"
+
+#include "print.h"
+#include "spinlock.h"
+
+#include "config.h"
+#include "display.h"
+#include "telemetry.h"
+
+#include "test.h"
+
+#include "trace.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define TRACE_RING_SIZE 64      // entries per CPU, must be a power of 2
+
+#define TRACE_MAX_ARGS  6       // any further arguments are not recorded
+
+//------------------------------------------------------------------------------
+// Types
+//------------------------------------------------------------------------------
+
+// The format string and any string arguments are normally in the program
+// image, which may be relocated before the entry is formatted, so the entry
+// records where the image was.
+
+typedef struct {
+    uint64_t            time;
+    uintptr_t           image_base;
+    const char          *fmt;
+    uintptr_t           arg[TRACE_MAX_ARGS];
+    bool                arg_is_str[TRACE_MAX_ARGS];
+} trace_entry_t;
+
+// Each ring has a single producer, the CPU that owns it, which only writes
+// the head index and the drop count, and a single consumer, the CPU running
+// trace_flush(), which only writes the tail index and the reported drop
+// count.
+
+typedef struct __attribute__((aligned(64))) {
+    volatile uintptr_t  head;
+    volatile uintptr_t  tail;
+    volatile uintptr_t  dropped;
+    uintptr_t           reported;
+    trace_entry_t       entry[TRACE_RING_SIZE];
+} trace_ring_t;
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+static trace_ring_t     *trace_ring = NULL;
+
+static int              num_trace_rings = 0;
+
+static bool             deferred = false;
+
+static spinlock_t       flush_lock = false;
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+// Records the arguments used by the conversions in the format string, as
+// interpreted by printf().
+static void record_args(trace_entry_t *entry, const char *fmt, va_list args)
+{
+    int n = 0;
+    while (*fmt != '\0' && n < TRACE_MAX_ARGS) {
+        if (*fmt++ != '%') {
+            continue;
+        }
+        while (*fmt == '-' || *fmt == 'S' || *fmt == '0') {
+            fmt++;
+        }
+        if (*fmt == '*') {
+            entry->arg_is_str[n] = false;
+            entry->arg[n++] = (uintptr_t)va_arg(args, int);
+            fmt++;
+            if (n == TRACE_MAX_ARGS) {
+                break;
+            }
+        }
+        while (*fmt >= '0' && *fmt <= '9') {
+            fmt++;
+        }
+        entry->arg_is_str[n] = false;
+        switch (*fmt) {
+          case 'c':
+          case 'i':
+            entry->arg[n++] = (uintptr_t)va_arg(args, int);
+            break;
+          case 'u':
+          case 'x':
+          case 'k':
+            entry->arg[n++] = va_arg(args, uintptr_t);
+            break;
+          case 's':
+            entry->arg_is_str[n] = true;
+            entry->arg[n++] = (uintptr_t)va_arg(args, const char *);
+            break;
+          default:
+            break;
+        }
+        if (*fmt != '\0') {
+            fmt++;
+        }
+    }
+    while (n < TRACE_MAX_ARGS) {
+        entry->arg_is_str[n] = false;
+        entry->arg[n++] = 0;
+    }
+}
+
+// Returns the current address of a pointer recorded while the program image
+// was at image_base.
+static uintptr_t rebase(uintptr_t ptr, uintptr_t image_base)
+{
+    if (ptr >= image_base && ptr < image_base + (_end - _start)) {
+        return ptr - image_base + (uintptr_t)_start;
+    }
+    return ptr;
+}
+
+// Sends the message just printed on the scroll message row as a trace event.
+static void send_trace_event(int cpu)
+{
+    char message[SCREEN_WIDTH];
+
+    int length = 0;
+    for (int col = 4; col < SCREEN_WIDTH; col++) {
+        char c = shadow_buffer[scroll_message_row][col].ch;
+        message[length++] = (c >= ' ' && c <= '~') ? c : '?';
+    }
+    while (length > 0 && message[length - 1] == ' ') {
+        length--;
+    }
+    message[length] = '\0';
+
+    telemetry_trace(cpu, message);
+}
+
+static void print_entry(int cpu, const trace_entry_t *entry)
+{
+    uintptr_t arg[TRACE_MAX_ARGS];
+    for (int i = 0; i < TRACE_MAX_ARGS; i++) {
+        arg[i] = entry->arg_is_str[i] ? rebase(entry->arg[i], entry->image_base) : entry->arg[i];
+    }
+    const char *fmt = (const char *)rebase((uintptr_t)entry->fmt, entry->image_base);
+
+    spin_lock(error_mutex);
+    scroll();
+    printi(scroll_message_row, 0, cpu, 2, false, false);
+    printf(scroll_message_row, 4, fmt, arg[0], arg[1], arg[2], arg[3], arg[4], arg[5]);
+    if (enable_telemetry) {
+        send_trace_event(cpu);
+    }
+    spin_unlock(error_mutex);
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+void trace_init(void)
+{
+    if (!enable_trace || trace_ring != NULL) {
+        return;
+    }
+    trace_ring = (trace_ring_t *)heap_alloc(HEAP_TYPE_HM_1, num_available_cpus * sizeof(trace_ring_t), 64);
+    if (trace_ring == NULL) {
+        return;
+    }
+    for (int cpu = 0; cpu < num_available_cpus; cpu++) {
+        trace_ring[cpu].head     = 0;
+        trace_ring[cpu].tail     = 0;
+        trace_ring[cpu].dropped  = 0;
+        trace_ring[cpu].reported = 0;
+    }
+    num_trace_rings = num_available_cpus;
+}
+
+void trace_defer(void)
+{
+    deferred = true;
+}
+
+void trace_flush(void)
+{
+    if (trace_ring == NULL || !__sync_bool_compare_and_swap(&flush_lock, false, true)) {
+        return;
+    }
+
+    while (true) {
+        int first_cpu = -1;
+        uint64_t first_time = 0;
+        for (int cpu = 0; cpu < num_trace_rings; cpu++) {
+            trace_ring_t *ring = &trace_ring[cpu];
+            uintptr_t tail = ring->tail;
+            if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+                continue;
+            }
+            uint64_t time = ring->entry[tail % TRACE_RING_SIZE].time;
+            if (first_cpu < 0 || time < first_time) {
+                first_cpu  = cpu;
+                first_time = time;
+            }
+        }
+        if (first_cpu < 0) {
+            break;
+        }
+        trace_ring_t *ring = &trace_ring[first_cpu];
+        print_entry(first_cpu, &ring->entry[ring->tail % TRACE_RING_SIZE]);
+        __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+    }
+
+    for (int cpu = 0; cpu < num_trace_rings; cpu++) {
+        trace_ring_t *ring = &trace_ring[cpu];
+        uintptr_t dropped = ring->dropped;
+        if (dropped != ring->reported) {
+            spin_lock(error_mutex);
+            scroll();
+            printf(scroll_message_row, 0, "%2i  %u trace messages lost", cpu, dropped - ring->reported);
+            spin_unlock(error_mutex);
+            ring->reported = dropped;
+        }
+    }
+
+    spin_unlock(&flush_lock);
+}
+
+void do_trace(int my_cpu, const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    if (trace_ring == NULL || my_cpu < 0 || my_cpu >= num_trace_rings) {
+        spin_lock(error_mutex);
+        scroll();
+        printi(scroll_message_row, 0, my_cpu, 2, false, false);
+        vprintf(scroll_message_row, 4, fmt, args);
+        spin_unlock(error_mutex);
+        va_end(args);
+        return;
+    }
+
+    trace_ring_t *ring = &trace_ring[my_cpu];
+    uintptr_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) < TRACE_RING_SIZE) {
+        trace_entry_t *entry = &ring->entry[head % TRACE_RING_SIZE];
+        entry->time       = cpuid_info.flags.rdtsc ? get_tsc() : 0;
+        entry->image_base = (uintptr_t)_start;
+        entry->fmt        = fmt;
+        record_args(entry, fmt, args);
+        __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    } else {
+        ring->dropped++;
+    }
+    va_end(args);
+
+    if (my_cpu == 0 && !deferred) {
+        trace_flush();
+    }
+}
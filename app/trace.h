@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef TRACE_H
+#define TRACE_H
+/**
+ * \file
+ *
+ * Provides the trace log. Once testing starts, do_trace() only records each
+ * trace message, with its TSC timestamp, in a ring owned by the calling CPU,
+ * so tracing doesn't hold up the CPU or change the timing between the CPUs.
+ * The recorded messages are formatted on the screen (and so on the serial
+ * console) later, in timestamp order, by trace_flush().
+ *
+ *//*
+ * Copyright (C) 2024 Memtest86+ contributors.
+ */
+
+#include <stdbool.h>
+
+/**
+ * Allocates the trace rings if tracing is enabled. Must be called after the
+ * CPUs have been enumerated. If tracing is enabled later, or the allocation
+ * fails, trace messages are formatted immediately instead.
+ */
+void trace_init(void);
+
+/**
+ * Makes do_trace() leave the recorded messages for trace_flush() to format.
+ * Until this is called, CPU 0 formats the messages as soon as it records
+ * them.
+ */
+void trace_defer(void);
+
+/**
+ * Formats the messages recorded by all the CPUs since the last call, in
+ * timestamp order, followed by a count of any messages that were lost
+ * because a ring was full. Does nothing if another CPU is already doing
+ * this.
+ */
+void trace_flush(void);
+
+#endif // TRACE_H
@@ -0,0 +1,219 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "keyboard.h"
+#include "memctrl.h"
+#include "screen.h"
+#include "serial.h"
+
+#include "print.h"
+#include "string.h"
+
+#include "config.h"
+#include "display.h"
+#include "error.h"
+#include "telemetry.h"
+
+#include "tests.h"
+
+#include "trend.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define NUM_PASSES          8       // the number of passes kept in the history
+
+#define POP_TREND_R         5
+#define POP_TREND_C         10
+#define POP_TREND_W         60
+#define POP_TREND_H         (NUM_PASSES + 8)
+
+#define POP_TREND_LAST_R    (POP_TREND_R + POP_TREND_H - 1)
+#define POP_TREND_LAST_C    (POP_TREND_C + POP_TREND_W - 1)
+
+#define POP_TREND_REGION    POP_TREND_R, POP_TREND_C, POP_TREND_LAST_R, POP_TREND_LAST_C
+
+//------------------------------------------------------------------------------
+// Types
+//------------------------------------------------------------------------------
+
+typedef struct {
+    int         pass;
+    uint32_t    mbps[NUM_TEST_PATTERNS];    // 0 if the test wasn't run
+    int         max_temp;                   // degrees C, or 0 if not known
+    uint32_t    cecc_count;                 // correctable ECC errors in the pass
+} pass_trend_t;
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+static pass_trend_t history[NUM_PASSES];    // a ring, oldest overwritten first
+static int          num_recorded = 0;       // passes recorded since the start of the run
+
+static pass_trend_t current;
+static uint64_t     cecc_base = 0;          // error_count_cecc at the start of the current pass
+
+// The throughput of each test in the first pass that ran it.
+static uint32_t     first_mbps[NUM_TEST_PATTERNS];
+static int          first_pass[NUM_TEST_PATTERNS];
+
+static uint16_t     popup_save_buffer[POP_TREND_W * POP_TREND_H];
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static void start_pass_record(void)
+{
+    memset(&current, 0, sizeof(current));
+    cecc_base = error_count_cecc;
+}
+
+// Returns the mean throughput of the tests run in the pass as a percentage of
+// their throughput in the first pass that ran them, or -1 if there are none,
+// and the test with the lowest percentage.
+static int pass_percent(const pass_trend_t *record, int *slowest_test, int *slowest_pct)
+{
+    int sum = 0;
+    int num = 0;
+    *slowest_test = -1;
+    *slowest_pct  = 0;
+    for (int test = 0; test < NUM_TEST_PATTERNS; test++) {
+        if (record->mbps[test] == 0 || first_mbps[test] == 0) {
+            continue;
+        }
+        int pct = (int)(((uint64_t)record->mbps[test] * 100) / first_mbps[test]);
+        if (*slowest_test < 0 || pct < *slowest_pct) {
+            *slowest_test = test;
+            *slowest_pct  = pct;
+        }
+        sum += pct;
+        num++;
+    }
+    return num > 0 ? sum / num : -1;
+}
+
+static bool is_slowdown(int pct)
+{
+    return slowdown_threshold > 0 && pct < 100 - slowdown_threshold;
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+void trend_start_run(void)
+{
+    num_recorded = 0;
+    for (int test = 0; test < NUM_TEST_PATTERNS; test++) {
+        first_mbps[test] = 0;
+        first_pass[test] = 0;
+    }
+    start_pass_record();
+}
+
+void trend_record_test(int pass, int test, uint32_t mbps)
+{
+    if (mbps == 0) {
+        return;
+    }
+    current.mbps[test] = mbps;
+    if (first_mbps[test] == 0) {
+        first_mbps[test] = mbps;
+        first_pass[test] = pass;
+    }
+}
+
+void trend_sample_temperature(int temp)
+{
+    if (temp > current.max_temp) {
+        current.max_temp = temp;
+    }
+}
+
+void trend_end_pass(int pass)
+{
+    current.pass       = pass;
+    current.cecc_count = error_count_cecc - cecc_base;
+    history[num_recorded % NUM_PASSES] = current;
+    num_recorded++;
+
+    int test, pct;
+    pass_percent(&current, &test, &pct);
+    if (test >= 0 && is_slowdown(pct)) {
+        trace(0, "pass %i: test %i throughput %uMB/s, %i%% of pass %i",
+              pass, test, (uintptr_t)current.mbps[test], pct, first_pass[test]);
+        telemetry_slowdown(pass, test, current.mbps[test], first_mbps[test]);
+        if (!enable_headless) {
+            set_foreground_colour(BLUE);
+            printf(ROW_FOOTER, 56, "Slowdown: test %2i -%2i%%", test, 100 - pct);
+            set_foreground_colour(WHITE);
+        }
+    }
+
+    start_pass_record();
+}
+
+void trend_display(void)
+{
+    save_screen_region(POP_TREND_REGION, popup_save_buffer);
+    set_background_colour(BLACK);
+    set_foreground_colour(WHITE);
+    clear_screen_region(POP_TREND_REGION);
+
+    prints(POP_TREND_R+1, POP_TREND_C+2, "Throughput trend of the last passes, as a percentage");
+    prints(POP_TREND_R+2, POP_TREND_C+2, "of the first pass that ran each test");
+    prints(POP_TREND_R+3, POP_TREND_C+2, "Pass    Mean   Slowest test   Max temp   ECC errors");
+
+    int oldest = num_recorded > NUM_PASSES ? num_recorded - NUM_PASSES : 0;
+    if (num_recorded == 0) {
+        prints(POP_TREND_R+4, POP_TREND_C+2, "No pass has been completed yet");
+    }
+    for (int i = oldest; i < num_recorded; i++) {
+        const pass_trend_t *record = &history[i % NUM_PASSES];
+        int row = POP_TREND_R + 4 + (i - oldest);
+        printf(row, POP_TREND_C+2, "%4i", record->pass);
+        int test, pct;
+        int mean = pass_percent(record, &test, &pct);
+        if (mean < 0) {
+            prints(row, POP_TREND_C+11, "-");
+        } else {
+            printf(row, POP_TREND_C+8, "%4i%%", mean);
+            printf(row, POP_TREND_C+17, "#%2i %3i%%", test, pct);
+            if (is_slowdown(pct)) {
+                prints(row, POP_TREND_C+26, "!");
+            }
+        }
+        if (record->max_temp > 0) {
+            printf(row, POP_TREND_C+33, "%3i%cC", record->max_temp, 0xF8);
+        } else {
+            prints(row, POP_TREND_C+35, "-");
+        }
+        if (ecc_status.ecc_enabled) {
+            printf(row, POP_TREND_C+44, "%8u", (uintptr_t)record->cecc_count);
+        } else {
+            prints(row, POP_TREND_C+51, "-");
+        }
+    }
+
+    if (slowdown_threshold > 0) {
+        printf(POP_TREND_LAST_R-2, POP_TREND_C+2, "! marks a test more than %i%% slower than at first",
+               slowdown_threshold);
+    }
+    prints(POP_TREND_LAST_R-1, POP_TREND_C+2, "Press any key to continue");
+
+    while (get_key() == 0) { }
+
+    restore_screen_region(POP_TREND_REGION, popup_save_buffer);
+    set_background_colour(BLUE);
+    set_foreground_colour(WHITE);
+
+    if (enable_tty) {
+        tty_full_redraw();
+    }
+}
@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef TREND_H
+#define TREND_H
+/**
+ * \file
+ *
+ * Provides a history of the throughput of each test, the maximum CPU
+ * temperature, and the number of correctable ECC errors over the last few
+ * passes, so that a machine that slows down as a run goes on (e.g. through
+ * thermal throttling) can be spotted, and a warning when the throughput of
+ * a test falls too far below that measured in the first pass that ran it.
+ *
+ *//*
+ * Copyright (C) 2024 Memtest86+ contributors.
+ */
+
+#include <stdint.h>
+
+/**
+ * Clears the history. Must be called at the start of each run.
+ */
+void trend_start_run(void);
+
+/**
+ * Records the throughput in MB/s measured for a run of the specified test in
+ * the specified pass.
+ */
+void trend_record_test(int pass, int test, uint32_t mbps);
+
+/**
+ * Records a sample of the CPU temperature in degrees Celsius.
+ */
+void trend_sample_temperature(int temp);
+
+/**
+ * Completes the record of the specified pass, and raises a warning if the
+ * throughput of a test has dropped by more than the slowdown threshold.
+ */
+void trend_end_pass(int pass);
+
+/**
+ * Displays the history in a pop-up panel until a key is pressed.
+ */
+void trend_display(void);
+
+#endif // TREND_H
@@ -51,6 +51,11 @@
 #define EFI_CONVENTIONAL_MEMORY 7
 #define EFI_ACPI_RECLAIM_MEMORY 9
 
+/**
+ * EFI memory descriptor attribute bits.
+ */
+#define EFI_MEMORY_RUNTIME      UINT64_C(0x8000000000000000)
+
 /**
  * EFI_RESET_TYPE values.
  */
@@ -58,6 +63,14 @@
 #define EFI_RESET_WARM          1
 #define EFI_RESET_SHUTDOWN      2
 
+/**
+ * EFI variable attributes.
+ */
+#define EFI_VARIABLE_NON_VOLATILE       0x00000001
+#define EFI_VARIABLE_BOOTSERVICE_ACCESS 0x00000002
+#define EFI_VARIABLE_RUNTIME_ACCESS     0x00000004
+#define EFI_RESET_SHUTDOWN      2
+
 /**
  * EFI_GRAPHICS_PIXEL_FORMAT values.
  */
@@ -212,9 +225,9 @@ typedef struct {
     unsigned long       set_wakeup_time;
     unsigned long       set_virtual_address_map;
     unsigned long       convert_pointer;
-    unsigned long       get_variable;
+    efi_status_t        (efiapi *get_variable)(efi_char16_t *, efi_guid_t *, uint32_t *, uintn_t *, void *);
     unsigned long       get_next_variable;
-    unsigned long       set_variable;
+    efi_status_t        (efiapi *set_variable)(efi_char16_t *, efi_guid_t *, uint32_t, uintn_t, void *);
     unsigned long       get_next_high_mono_count;
     efi_status_t        (efiapi *reset_system)(int, int, int);
     unsigned long       update_capsule;
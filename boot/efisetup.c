@@ -40,6 +40,8 @@ static uint32_t pref_v_resolution;
 
 static bool rotate;
 
+static bool fast_mode;
+
 static bool debug;
 
 //------------------------------------------------------------------------------
@@ -220,6 +222,13 @@ static void parse_option(const char *option, int option_length)
         if ((option_length == 4) && (strncmp(option, "bios", 4) == 0)) {
             pref_h_resolution = 0;
             pref_v_resolution = 0;
+            fast_mode = false;
+            return;
+        }
+        if ((option_length == 4) && (strncmp(option, "fast", 4) == 0)) {
+            pref_h_resolution = UINT32_MAX;
+            pref_v_resolution = UINT32_MAX;
+            fast_mode = true;
             return;
         }
         int h_value = 0;
@@ -240,6 +249,7 @@ static void parse_option(const char *option, int option_length)
         if (option_length != 0) return;
         pref_h_resolution = h_value;
         pref_v_resolution = v_value;
+        fast_mode = false;
         return;
     }
 }
@@ -249,6 +259,7 @@ static void parse_cmd_line(uintptr_t cmd_line_addr, int cmd_line_size)
     pref_h_resolution = UINT32_MAX;
     pref_v_resolution = UINT32_MAX;
     rotate = false;
+    fast_mode = false;
 
     if (cmd_line_addr != 0) {
         const char *cmd_line = (const char *)cmd_line_addr;
@@ -359,6 +370,27 @@ static void get_bit_range(uint32_t mask, uint8_t *pos, uint8_t *size)
     *size = length;
 }
 
+// Returns the number of bits per pixel for the specified mode, or 0 if the
+// mode has no linear frame buffer.
+static int pixel_depth(const efi_gop_mode_info_t *info)
+{
+    uint8_t pos, red_size, green_size, blue_size, rsvd_size;
+
+    switch (info->pixel_format) {
+      case PIXEL_RGB_RESERVED_8BIT_PER_COLOR:
+      case PIXEL_BGR_RESERVED_8BIT_PER_COLOR:
+        return 32;
+      case PIXEL_BIT_MASK:
+        get_bit_range(info->pixel_info.red_mask,   &pos, &red_size);
+        get_bit_range(info->pixel_info.green_mask, &pos, &green_size);
+        get_bit_range(info->pixel_info.blue_mask,  &pos, &blue_size);
+        get_bit_range(info->pixel_info.rsvd_mask,  &pos, &rsvd_size);
+        return red_size + green_size + blue_size + rsvd_size;
+      default:
+        return 0;
+    }
+}
+
 static efi_graphics_output_t *find_gop(efi_handle_t *handles, size_t handles_size)
 {
     efi_status_t status;
@@ -425,7 +457,9 @@ static efi_status_t set_screen_info_from_gop(screen_info_t *si, efi_handle_t *ha
 
     if (debug) {
         print_string("Requested size : ");
-        if ((pref_h_resolution == UINT32_MAX) && (pref_v_resolution == UINT32_MAX)) {
+        if (fast_mode) {
+            print_string("fast");
+        } else if ((pref_h_resolution == UINT32_MAX) && (pref_v_resolution == UINT32_MAX)) {
             print_string("auto");
         } else {
             print_dec(pref_h_resolution);
@@ -442,6 +476,10 @@ static efi_status_t set_screen_info_from_gop(screen_info_t *si, efi_handle_t *ha
     best_info.h_resolution = UINT32_MAX;
     best_info.v_resolution = UINT32_MAX;
 
+    // In fast mode, the cost of a mode is the size of its frame buffer, which
+    // is what each full screen redraw has to write.
+    uint64_t best_cost = UINT64_MAX;
+
     uint32_t best_mode = UINT32_MAX;
     if (use_current_mode) {
         best_mode = mode->mode;
@@ -459,17 +497,22 @@ static efi_status_t set_screen_info_from_gop(screen_info_t *si, efi_handle_t *ha
                 best_info = *info;
                 break;
             }
-            if (rotate) {
-                if (info->v_resolution >= MIN_H_RESOLUTION
-                 && info->h_resolution >= MIN_V_RESOLUTION
-                 && info->v_resolution < best_info.v_resolution) {
+            bool fits = rotate ? (info->v_resolution >= MIN_H_RESOLUTION && info->h_resolution >= MIN_V_RESOLUTION)
+                               : (info->h_resolution >= MIN_H_RESOLUTION && info->v_resolution >= MIN_V_RESOLUTION);
+            if (fast_mode) {
+                uint64_t cost = (uint64_t)info->pixels_per_scan_line * info->v_resolution * pixel_depth(info);
+                if (fits && cost > 0 && cost < best_cost) {
+                    best_mode = mode_num;
+                    best_info = *info;
+                    best_cost = cost;
+                }
+            } else if (rotate) {
+                if (fits && info->v_resolution < best_info.v_resolution) {
                     best_mode = mode_num;
                     best_info = *info;
                 }
             } else {
-                if (info->h_resolution >= MIN_H_RESOLUTION
-                 && info->v_resolution >= MIN_V_RESOLUTION
-                 && info->h_resolution < best_info.h_resolution) {
+                if (fits && info->h_resolution < best_info.h_resolution) {
                     best_mode = mode_num;
                     best_info = *info;
                 }
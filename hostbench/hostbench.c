@@ -0,0 +1,346 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+//
+// Runs the Memtest86+ memory tests as user-space threads on the build host
+// and reports the rate at which each test covers memory with each of the
+// test kernels the CPU supports. This lets changes to the tests and the test
+// kernels be measured without booting the result on real hardware.
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include "hostbench.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define HUGE_PAGE_SIZE      (2 << 20)
+
+#define DEFAULT_SIZE_MB     1024
+#define DEFAULT_REPEATS     3
+
+#define MAX_THREADS         256     // must not exceed MAX_CPUS
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+static const char *kernel_option[NUM_KERNELS] = { "scalar", "sse2", "avx2", "avx512" };
+
+static pthread_barrier_t run_barrier;      // the threads running a test
+
+static pthread_barrier_t start_barrier;    // the threads and the controller
+
+static pthread_barrier_t end_barrier;      // the threads and the controller
+
+static int          num_threads = 1;
+
+static volatile int current_test = -1;     // -1 tells the threads to exit
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-t threads] [-m size_mb] [-r repeats] [-k kernel] [-n] [test ...]\n", program);
+    fprintf(stderr, "  -t  number of threads (default 1)\n");
+    fprintf(stderr, "  -m  size of the test buffer in MB (default %d)\n", DEFAULT_SIZE_MB);
+    fprintf(stderr, "  -r  number of runs of each test, the best is reported (default %d)\n", DEFAULT_REPEATS);
+    fprintf(stderr, "  -k  kernel to use: scalar, sse2, avx2, or avx512 (default all supported)\n");
+    fprintf(stderr, "  -n  fill memory using non-temporal stores, as with the nt_fill boot option\n");
+    fprintf(stderr, "Tests:");
+    for (int test = 0; test < mock_num_tests(); test++) {
+        fprintf(stderr, " %s", mock_test_name(test));
+    }
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+static bool kernel_supported(kernel_level_t level)
+{
+    __builtin_cpu_init();
+    switch (level) {
+      case KERNEL_SCALAR:
+        return true;
+      case KERNEL_SSE2:
+        return __builtin_cpu_supports("sse2");
+      case KERNEL_AVX2:
+        return __builtin_cpu_supports("avx2");
+      case KERNEL_AVX512:
+        return __builtin_cpu_supports("avx512f");
+      default:
+        return false;
+    }
+}
+
+static double elapsed_seconds(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+static uint32_t measure_tsc_per_msec(void)
+{
+    struct timespec start_time, end_time;
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    uint64_t start_tsc = __rdtsc();
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &end_time);
+    } while (elapsed_seconds(&start_time, &end_time) < 0.1);
+    uint64_t end_tsc = __rdtsc();
+
+    return (end_tsc - start_tsc) / (elapsed_seconds(&start_time, &end_time) * 1000);
+}
+
+static int cache_size_kb(int name)
+{
+    long size = sysconf(name);
+    return (size > 0) ? size / 1024 : 0;
+}
+
+// Allocates the test buffer, preferring explicit huge pages, then transparent
+// huge pages, so that the tests don't measure TLB misses.
+static void *alloc_buffer(size_t size, const char **page_type)
+{
+    void *buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (buffer != MAP_FAILED) {
+        *page_type = "2MB huge pages";
+        return buffer;
+    }
+    buffer = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) {
+        return NULL;
+    }
+    buffer = (void *)(((uintptr_t)buffer + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+    if (madvise(buffer, size, MADV_HUGEPAGE) == 0) {
+        *page_type = "transparent huge pages";
+    } else {
+        *page_type = "4KB pages";
+    }
+    return buffer;
+}
+
+static void *test_thread(void *arg)
+{
+    int my_cpu = (int)(intptr_t)arg;
+
+    while (true) {
+        pthread_barrier_wait(&start_barrier);
+        if (current_test < 0) {
+            break;
+        }
+        mock_run_test(current_test, my_cpu);
+        pthread_barrier_wait(&end_barrier);
+    }
+    return NULL;
+}
+
+static void start_threads(pthread_t thread[])
+{
+    int num_host_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int cpu = 0; cpu < num_threads; cpu++) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (num_host_cpus > 0) {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            CPU_SET(cpu % num_host_cpus, &cpu_set);
+            pthread_attr_setaffinity_np(&attr, sizeof(cpu_set), &cpu_set);
+        }
+        int result = pthread_create(&thread[cpu], &attr, test_thread, (void *)(intptr_t)cpu);
+        pthread_attr_destroy(&attr);
+        if (result != 0) {
+            fprintf(stderr, "Failed to create thread %d: %s\n", cpu, strerror(result));
+            exit(1);
+        }
+    }
+}
+
+static void stop_threads(pthread_t thread[])
+{
+    current_test = -1;
+    pthread_barrier_wait(&start_barrier);
+    for (int cpu = 0; cpu < num_threads; cpu++) {
+        pthread_join(thread[cpu], NULL);
+    }
+}
+
+// Runs the test on all the threads and returns the run time in seconds and
+// in TSC cycles.
+static double run_test(int test, uint64_t *tsc_cycles)
+{
+    struct timespec start_time, end_time;
+
+    current_test = test;
+
+    pthread_barrier_wait(&start_barrier);
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    uint64_t start_tsc = __rdtsc();
+
+    pthread_barrier_wait(&end_barrier);
+    uint64_t end_tsc = __rdtsc();
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+
+    *tsc_cycles = end_tsc - start_tsc;
+    return elapsed_seconds(&start_time, &end_time);
+}
+
+static bool run_benchmark(kernel_level_t level, int test, int num_repeats)
+{
+    const char *kernel_name = mock_select_kernel(level);
+
+    double   best_gbps  = 0.0;
+    double   best_cpw   = 0.0;
+    uint64_t num_errors = 0;
+    for (int run = 0; run < num_repeats; run++) {
+        uint64_t tsc_cycles;
+        double seconds = run_test(test, &tsc_cycles);
+
+        uint64_t num_bytes = mock_take_tested_bytes();
+        num_errors += mock_take_error_count();
+        if (num_bytes == 0 || seconds <= 0.0) {
+            continue;
+        }
+        double gbps = num_bytes / seconds / 1e9;
+        if (gbps > best_gbps) {
+            best_gbps = gbps;
+            // Each thread covers its share of the words, so (to first order)
+            // the cost per word handled by one thread is:
+            best_cpw  = (double)tsc_cycles * num_threads / (num_bytes / sizeof(uintptr_t));
+        }
+    }
+    printf("%-16s %-8s %10.2f %12.3f %8llu\n", mock_test_name(test), kernel_name, best_gbps, best_cpw,
+           (unsigned long long)num_errors);
+
+    return num_errors == 0;
+}
+
+//------------------------------------------------------------------------------
+// Main Program
+//------------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    size_t size_mb     = DEFAULT_SIZE_MB;
+    int    num_repeats = DEFAULT_REPEATS;
+    int    kernel      = -1;
+    bool   nt_fill     = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:m:r:k:n")) != -1) {
+        switch (opt) {
+          case 't':
+            num_threads = atoi(optarg);
+            break;
+          case 'm':
+            size_mb = strtoul(optarg, NULL, 0);
+            break;
+          case 'r':
+            num_repeats = atoi(optarg);
+            break;
+          case 'k':
+            for (int level = 0; level < NUM_KERNELS; level++) {
+                if (strcmp(optarg, kernel_option[level]) == 0) {
+                    kernel = level;
+                }
+            }
+            if (kernel < 0) {
+                usage(argv[0]);
+            }
+            break;
+          case 'n':
+            nt_fill = true;
+            break;
+          default:
+            usage(argv[0]);
+        }
+    }
+    if (num_threads < 1 || num_threads > MAX_THREADS || size_mb < 2 || num_repeats < 1) {
+        usage(argv[0]);
+    }
+
+    bool run_test_num[mock_num_tests()];
+    bool run_all_tests = (optind == argc);
+    for (int test = 0; test < mock_num_tests(); test++) {
+        run_test_num[test] = run_all_tests;
+    }
+    for (int i = optind; i < argc; i++) {
+        int test = 0;
+        while (test < mock_num_tests() && strcmp(argv[i], mock_test_name(test)) != 0) {
+            test++;
+        }
+        if (test == mock_num_tests()) {
+            usage(argv[0]);
+        }
+        run_test_num[test] = true;
+    }
+    if (kernel >= 0 && !kernel_supported(kernel)) {
+        fprintf(stderr, "The %s kernel is not supported by this CPU\n", kernel_option[kernel]);
+        return 1;
+    }
+
+    size_t size = (size_mb << 20) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+    const char *page_type = NULL;
+    void *buffer = alloc_buffer(size, &page_type);
+    if (buffer == NULL) {
+        fprintf(stderr, "Failed to allocate %zuMB: %s\n", size >> 20, strerror(errno));
+        return 1;
+    }
+
+    uint32_t tsc_per_msec = measure_tsc_per_msec();
+    mock_init(num_threads, cache_size_kb(_SC_LEVEL2_CACHE_SIZE), cache_size_kb(_SC_LEVEL3_CACHE_SIZE),
+              tsc_per_msec, nt_fill);
+    mock_set_buffer(buffer, size);
+
+    pthread_barrier_init(&run_barrier,   NULL, num_threads);
+    pthread_barrier_init(&start_barrier, NULL, num_threads + 1);
+    pthread_barrier_init(&end_barrier,   NULL, num_threads + 1);
+
+    pthread_t thread[MAX_THREADS];
+    start_threads(thread);
+
+    printf("%zuMB using %s, %d thread%s, TSC %u.%03uGHz%s\n", size >> 20, page_type, num_threads,
+           num_threads > 1 ? "s" : "", tsc_per_msec / 1000000, (tsc_per_msec / 1000) % 1000,
+           nt_fill ? ", streaming fill" : "");
+    printf("%-16s %-8s %10s %12s %8s\n", "test", "kernel", "GB/s", "clks/word", "errors");
+
+    bool passed = true;
+    for (int test = 0; test < mock_num_tests(); test++) {
+        if (!run_test_num[test]) {
+            continue;
+        }
+        for (int level = 0; level < NUM_KERNELS; level++) {
+            if ((kernel < 0 && kernel_supported(level)) || kernel == level) {
+                passed &= run_benchmark(level, test, num_repeats);
+            }
+        }
+    }
+
+    stop_threads(thread);
+
+    return passed ? 0 : 2;
+}
+
+//------------------------------------------------------------------------------
+// Host Functions
+//------------------------------------------------------------------------------
+
+void host_barrier_wait(void)
+{
+    pthread_barrier_wait(&run_barrier);
+}
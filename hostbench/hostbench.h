@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef HOSTBENCH_H
+#define HOSTBENCH_H
+/**
+ * \file
+ *
+ * Provides the interface between the host side of the benchmark, which is
+ * built against the host C library, and the mock Memtest86+ environment that
+ * the memory tests are built against. Only plain C types are used, so this
+ * can be included on both sides.
+ *
+ *//*
+ * Copyright (C) 2024 Memtest86+ contributors.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The test kernel levels, matching the SIMD levels in simd.h.
+ */
+typedef enum {
+    KERNEL_SCALAR,
+    KERNEL_SSE2,
+    KERNEL_AVX2,
+    KERNEL_AVX512,
+    NUM_KERNELS
+} kernel_level_t;
+
+/**
+ * Initialises the mock environment for the specified number of threads,
+ * cache sizes (in KB), and TSC frequency. If nt_fill is true, the tests fill
+ * memory using non-temporal stores where the kernel supports them.
+ */
+void mock_init(int num_threads, int l2_kb, int l3_kb, uint32_t tsc_per_msec, bool nt_fill);
+
+/**
+ * Makes the specified buffer the only memory segment under test.
+ */
+void mock_set_buffer(void *start, size_t size);
+
+/**
+ * Selects the test kernel used by the tests and returns its name. The caller
+ * must check that the CPU and OS support the selected level.
+ */
+const char *mock_select_kernel(kernel_level_t level);
+
+/**
+ * Returns the number of tests that can be run.
+ */
+int mock_num_tests(void);
+
+/**
+ * Returns the name of the specified test.
+ */
+const char *mock_test_name(int test);
+
+/**
+ * Runs the specified test. Must be called by all the threads, each with a
+ * different value of my_cpu in the range [0, num_threads).
+ */
+void mock_run_test(int test, int my_cpu);
+
+/**
+ * Returns the number of bytes covered by the threads since the last call.
+ */
+uint64_t mock_take_tested_bytes(void);
+
+/**
+ * Returns the number of data or address errors reported since the last call.
+ */
+uint64_t mock_take_error_count(void);
+
+/**
+ * Waits until all the threads running a test reach this point. Provided by
+ * the host side and used to implement the run barrier.
+ */
+void host_barrier_wait(void);
+
+#endif // HOSTBENCH_H
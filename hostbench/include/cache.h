@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef CACHE_H
+#define CACHE_H
+/**
+ * \file
+ *
+ * Replaces system/cache.h in the host benchmark. WBINVD is a privileged
+ * instruction, so a full cache flush is not possible from user space and
+ * is omitted. Flushing a range uses CLFLUSH, which all x86-64 CPUs support.
+ *
+ *//*
+ * Copyright (C) 2024 Memtest86+ contributors.
+ */
+
+#include <stdint.h>
+
+/**
+ * Does nothing in the host benchmark. This still contains an asm statement
+ * so that its callers have the same control flow as in the real build, and
+ * can share the profile recorded by the benchmark.
+ */
+static inline void cache_flush(void)
+{
+    __asm__ __volatile__ ("" ::: "memory");
+}
+
+/**
+ * Flush the cache lines containing the specified range of addresses from all
+ * CPU caches in the coherence domain. The last address is inclusive.
+ * line_size must be a power of 2.
+ */
+static inline void cache_flush_range(const void *first, const void *last, uintptr_t line_size)
+{
+    for (uintptr_t addr = (uintptr_t)first & ~(line_size - 1); addr <= (uintptr_t)last; addr += line_size) {
+        __asm__ __volatile__ ("\t"
+            "clflush %0\n"
+            : /* no outputs */
+            : "m" (*(const volatile char *)addr)
+            : "memory"
+        );
+    }
+    __asm__ __volatile__ ("\t"
+        "mfence\n"
+        : /* no outputs */
+        : /* no inputs */
+        : "memory"
+    );
+}
+
+#endif // CACHE_H
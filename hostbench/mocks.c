@@ -0,0 +1,405 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+//
+// Provides the parts of the Memtest86+ environment used by the memory tests,
+// so the tests and test kernels can be built unmodified and run as ordinary
+// threads on the build host. There is no screen, no error log, and memory is
+// tested through its virtual address.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpuid.h"
+#include "cpuinfo.h"
+#include "ioat.h"
+#include "memsize.h"
+#include "screen.h"
+#include "simd.h"
+#include "smp.h"
+#include "temperature.h"
+
+#include "barrier.h"
+#include "print.h"
+
+#include "config.h"
+#include "display.h"
+#include "error.h"
+#include "test.h"
+
+#include "test_funcs.h"
+#include "test_helper.h"
+#include "test_kernels.h"
+
+#include "hostbench.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define MODULO_N    20
+
+//------------------------------------------------------------------------------
+// Types
+//------------------------------------------------------------------------------
+
+typedef struct {
+    const char  *name;
+    void        (*run)(int my_cpu);
+} test_entry_t;
+
+//------------------------------------------------------------------------------
+// Public Variables
+//------------------------------------------------------------------------------
+
+// test.h
+
+cpu_context_t   cpu_context[MAX_CPUS];
+uint8_t         used_cpus_in_proximity_domain[MAX_PROXIMITY_DOMAINS];
+
+int             num_active_cpus = 1;
+int             master_cpu      = 0;
+
+barrier_t       *run_barrier    = NULL;
+barrier_t       *domain_barrier = NULL;
+
+vm_map_t        *vm_map         = NULL;
+int             vm_map_capacity = 0;
+int             vm_map_size     = 0;
+
+int             pass_num        = 0;
+uint32_t        pass_seed       = 0;
+
+bool            bail            = false;
+
+// smp.h
+
+int             num_available_cpus    = 1;
+int             num_proximity_domains = 1;
+
+// cpuinfo.h
+
+int             l2_cache      = 0;
+int             l3_cache      = 0;
+
+uint32_t        clks_per_msec = 0;
+
+// simd.h
+
+simd_level_t    simd_level    = SIMD_NONE;
+
+// error.h
+
+uint64_t        error_count   = 0;
+
+// config.h
+
+core_type_t     hybrid_core_type[MAX_CPUS];
+
+int             ui_cpu         = 0;
+
+bool            enable_trace   = false;
+bool            enable_numa    = false;
+bool            enable_nt_fill = false;
+bool            enable_dma     = false;
+int             forced_kernel  = -1;
+
+power_save_t    power_save     = POWER_SAVE_OFF;
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+static barrier_t    dummy_barrier;
+
+static vm_map_t     buffer_map;
+
+static uint64_t     tested_bytes[MAX_CPUS];
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static void run_own_addr(int my_cpu)
+{
+    test_own_addr1(my_cpu);
+}
+
+static void run_mov_inv_fixed(int my_cpu)
+{
+    test_mov_inv_fixed(my_cpu, 1, 0, ~(testword_t)0, false, ~(testword_t)0);
+}
+
+static void run_mov_inv_walk1(int my_cpu)
+{
+    test_mov_inv_walk1(my_cpu, 1, 0, false);
+}
+
+static void run_block_move(int my_cpu)
+{
+    test_block_move(my_cpu, 1);
+}
+
+static void run_mov_inv_random(int my_cpu)
+{
+    test_mov_inv_random(my_cpu, pass_prsg_seed(8, 0));
+}
+
+static void run_modulo_n(int my_cpu)
+{
+    testword_t pattern = prsg(0x87654321);
+
+    test_modulo_n(my_cpu, 2, pattern, ~pattern, MODULO_N, 0);
+}
+
+static void run_modulo_n_fused(int my_cpu)
+{
+    testword_t pattern[4];
+    for (int j = 0; j < 4; j++) {
+        pattern[j] = prsg(0x87654321 + j);
+    }
+
+    test_modulo_n_fused(my_cpu, 2, pattern, MODULO_N, 0, 4);
+}
+
+static const test_entry_t test_list[] = {
+    { "own_addr",       run_own_addr        },
+    { "mov_inv_fixed",  run_mov_inv_fixed   },
+    { "mov_inv_walk1",  run_mov_inv_walk1   },
+    { "block_move",     run_block_move      },
+    { "mov_inv_random", run_mov_inv_random  },
+    { "modulo_n",       run_modulo_n        },
+    { "modulo_n_fused", run_modulo_n_fused  }
+};
+
+#define NUM_TESTS   (int)(sizeof(test_list) / sizeof(test_list[0]))
+
+//------------------------------------------------------------------------------
+// Mock Functions
+//------------------------------------------------------------------------------
+
+uint32_t smp_get_proximity_domain_idx(int cpu_num)
+{
+    (void)cpu_num;
+
+    return 0;
+}
+
+bool cpu_is_throttled(int cpu)
+{
+    (void)cpu;
+
+    return false;
+}
+
+void barrier_spin_wait(barrier_t *barrier)
+{
+    (void)barrier;
+
+    host_barrier_wait();
+}
+
+void barrier_halt_wait(barrier_t *barrier)
+{
+    (void)barrier;
+
+    host_barrier_wait();
+}
+
+// There are no DMA channels, so the tests never queue any operations.
+
+int ioat_num_channels(void)
+{
+    return 0;
+}
+
+bool ioat_can_fill(int chan)
+{
+    (void)chan;
+
+    return false;
+}
+
+bool ioat_queue_copy(int chan, void *dst, const void *src, size_t size, bool fence)
+{
+    (void)chan;
+    (void)dst;
+    (void)src;
+    (void)size;
+    (void)fence;
+
+    return false;
+}
+
+bool ioat_queue_fill(int chan, void *dst, uint64_t pattern, size_t size, bool fence)
+{
+    (void)chan;
+    (void)dst;
+    (void)pattern;
+    (void)size;
+    (void)fence;
+
+    return false;
+}
+
+void ioat_cancel(int chan)
+{
+    (void)chan;
+}
+
+void ioat_start(int chan)
+{
+    (void)chan;
+}
+
+bool ioat_wait(int chan)
+{
+    (void)chan;
+
+    return false;
+}
+
+void do_tick(int my_cpu)
+{
+    (void)my_cpu;
+}
+
+void do_housekeeping(void)
+{
+}
+
+void count_test_data(int my_cpu, uintptr_t num_bytes)
+{
+    tested_bytes[my_cpu] += num_bytes;
+}
+
+void do_trace(int my_cpu, const char *fmt, ...)
+{
+    (void)my_cpu;
+    (void)fmt;
+}
+
+void clear_screen_region(int start_row, int start_col, int end_row, int end_col)
+{
+    (void)start_row;
+    (void)start_col;
+    (void)end_row;
+    (void)end_col;
+}
+
+int prints(int row, int col, const char *str)
+{
+    (void)row;
+    (void)str;
+
+    return col;
+}
+
+int printf(int row, int col, const char *fmt, ...)
+{
+    (void)row;
+    (void)fmt;
+
+    return col;
+}
+
+void addr_error(testword_t *addr1, testword_t *addr2, testword_t good, testword_t bad)
+{
+    (void)addr1;
+    (void)addr2;
+    (void)good;
+    (void)bad;
+
+    __atomic_add_fetch(&error_count, 1, __ATOMIC_RELAXED);
+}
+
+void data_error(testword_t *addr, testword_t good, testword_t bad, bool use_for_badram)
+{
+    (void)addr;
+    (void)good;
+    (void)bad;
+    (void)use_for_badram;
+
+    __atomic_add_fetch(&error_count, 1, __ATOMIC_RELAXED);
+}
+
+void error_update(void)
+{
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+void mock_init(int num_threads, int l2_kb, int l3_kb, uint32_t tsc_per_msec, bool nt_fill)
+{
+    cpuid_init();
+
+    num_available_cpus = num_threads;
+    num_active_cpus    = num_threads;
+    used_cpus_in_proximity_domain[0] = num_threads;
+    for (int cpu = 0; cpu < num_threads; cpu++) {
+        cpu_context[cpu].chunk_index = cpu;
+        hybrid_core_type[cpu] = CORE_PCORE;
+    }
+
+    l2_cache       = l2_kb;
+    l3_cache       = l3_kb;
+    clks_per_msec  = tsc_per_msec;
+    enable_nt_fill = nt_fill;
+
+    run_barrier = &dummy_barrier;
+
+    vm_map          = &buffer_map;
+    vm_map_capacity = 1;
+}
+
+void mock_set_buffer(void *start, size_t size)
+{
+    vm_map[0].pm_base_addr = (uintptr_t)start >> PAGE_SHIFT;
+    vm_map[0].start        = (testword_t *)start;
+    vm_map[0].end          = (testword_t *)((uintptr_t)start + size) - 1;
+    vm_map[0].proximity_domain_idx = 0;
+    vm_map_size = 1;
+}
+
+const char *mock_select_kernel(kernel_level_t level)
+{
+    bool nt_fill = enable_nt_fill;
+
+    simd_level = (simd_level_t)level;
+    test_kernels_init();
+
+    // The scalar kernel clears enable_nt_fill, so restore it for the next one.
+    enable_nt_fill = nt_fill;
+
+    return test_kernel->name;
+}
+
+int mock_num_tests(void)
+{
+    return NUM_TESTS;
+}
+
+const char *mock_test_name(int test)
+{
+    return test_list[test].name;
+}
+
+void mock_run_test(int test, int my_cpu)
+{
+    test_list[test].run(my_cpu);
+}
+
+uint64_t mock_take_tested_bytes(void)
+{
+    uint64_t total = 0;
+    for (int cpu = 0; cpu < num_available_cpus; cpu++) {
+        total += tested_bytes[cpu];
+        tested_bytes[cpu] = 0;
+    }
+    return total;
+}
+
+uint64_t mock_take_error_count(void)
+{
+    return __atomic_exchange_n(&error_count, 0, __ATOMIC_RELAXED);
+}
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "cpulocal.h"
 #include "smp.h"
@@ -11,26 +12,321 @@
 
 #include "barrier.h"
 
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define TREE_MIN_THREADS    16  // below this, a flat barrier is fast enough
+
+#define APIC_ID_BITS        12  // enough for MAX_APIC_IDS
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+// The group assignments are only written before the APs are started, so
+// unlike the barrier objects themselves they do not need to be pinned.
+
+static int      tree_num_cpus   = 0;
+static int      tree_num_groups = 0;
+
+static int8_t   tree_group[MAX_CPUS];
+static uint8_t  tree_members[MAX_CPUS];
+static uint16_t tree_first_member[BARRIER_MAX_GROUPS + 1];
+
+static bool     use_mwait = false;
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static int assign_groups(const uint8_t cpu_list[], int num_cpus, int shift, int8_t key_group[])
+{
+    for (int key = 0; key < (1 << APIC_ID_BITS); key++) {
+        key_group[key] = -1;
+    }
+    int num_groups = 0;
+    for (int i = 0; i < num_cpus; i++) {
+        int key = smp_get_apic_id(cpu_list[i]) >> shift;
+        if (key_group[key] < 0) {
+            if (num_groups == BARRIER_MAX_GROUPS) {
+                return num_groups + 1;
+            }
+            key_group[key] = num_groups++;
+        }
+    }
+    return num_groups;
+}
+
+// Returns true if the CPU core whose ordinal number is cpu_num may wait at
+// the barrier. Only these cores' waiting flags belong to the barrier.
+static inline bool is_member(const barrier_t *barrier, int cpu_num)
+{
+    return barrier->domain < 0 || (int)smp_get_proximity_domain_idx(cpu_num) == barrier->domain;
+}
+
+static void wait_while_blocked(volatile bool *i_am_blocked)
+{
+    if (use_mwait) {
+        // Arm the monitor before checking the flag, so a write that clears
+        // it between the check and the MWAIT still wakes us.
+        while (*i_am_blocked) {
+            __asm__ __volatile__ ("monitor" : : "a" (i_am_blocked), "c" (0), "d" (0));
+            if (*i_am_blocked) {
+                __asm__ __volatile__ ("mwait" : : "a" (0), "c" (0));
+            }
+        }
+    } else {
+        while (*i_am_blocked) {
+            __builtin_ia32_pause();
+        }
+    }
+}
+
+static bool is_aborted(barrier_t *barrier, int flag_num, int my_cpu)
+{
+    // Our waiting flag must be visible before we check, so that either we
+    // see the barrier has been aborted, or barrier_abort() sees our flag.
+    __sync_synchronize();
+    if (barrier->aborted) {
+        local_flag(flag_num, my_cpu)->flag = false;
+        return true;
+    }
+    return false;
+}
+
+static void wake_group_members(int flag_num, int group_num, int my_cpu, bool send_nmi)
+{
+    for (int i = tree_first_member[group_num]; i < tree_first_member[group_num + 1]; i++) {
+        int cpu_num = tree_members[i];
+        if (cpu_num == my_cpu) {
+            continue;
+        }
+        if (send_nmi) {
+            if (local_flag(flag_num, cpu_num)->flag) {
+                local_flag(flag_num, cpu_num)->flag = false;
+                smp_send_nmi(cpu_num);
+            }
+        } else {
+            local_flag(flag_num, cpu_num)->flag = false;
+        }
+    }
+}
+
+static void tree_spin_wait(barrier_t *barrier, int flag_num, int my_cpu)
+{
+    int group_num = tree_group[my_cpu];
+    barrier_group_t *group = &barrier->group[group_num];
+
+    volatile bool *i_am_blocked = &local_flag(flag_num, my_cpu)->flag;
+    *i_am_blocked = true;
+    if (is_aborted(barrier, flag_num, my_cpu)) {
+        return;
+    }
+    if (__sync_sub_and_fetch(&group->count, 1) != 0) {
+        wait_while_blocked(i_am_blocked);
+        return;
+    }
+    // Last one in my group, so represent the group at the root.
+    group->leader = my_cpu;
+    if (__sync_sub_and_fetch(&barrier->count, 1) != 0) {
+        wait_while_blocked(i_am_blocked);
+    } else {
+        // Last one here, so reset the root and wake the other group leaders.
+        barrier->count = barrier->num_groups;
+        __sync_synchronize();
+        for (int i = 0; i < barrier->num_groups; i++) {
+            local_flag(flag_num, barrier->group[i].leader)->flag = false;
+        }
+    }
+    // Reset my group and wake the other members.
+    group->count = group->num_threads;
+    __sync_synchronize();
+    wake_group_members(flag_num, group_num, my_cpu, false);
+}
+
+static void tree_halt_wait(barrier_t *barrier, int flag_num, int my_cpu)
+{
+    int group_num = tree_group[my_cpu];
+    barrier_group_t *group = &barrier->group[group_num];
+
+    local_flag(flag_num, my_cpu)->flag = true;
+    if (is_aborted(barrier, flag_num, my_cpu)) {
+        return;
+    }
+    //
+    // Both levels use the same instruction sequence as the flat barrier, so
+    // the interrupt handler can detect and skip over the halts.
+    //
+    __asm__ goto ("\t"
+        "lock decl %0 \n\t"
+        "je 0f        \n\t"
+        "hlt          \n\t"
+        "jmp %l[end]  \n"
+        "0:           \n"
+        : /* no outputs */
+        : "m" (group->count)
+        : /* no clobbers */
+        : end
+    );
+    // Last one in my group, so represent the group at the root.
+    group->leader = my_cpu;
+    __asm__ goto ("\t"
+        "lock decl %0       \n\t"
+        "je 0f              \n\t"
+        "hlt                \n\t"
+        "jmp %l[wake_group] \n"
+        "0:                 \n"
+        : /* no outputs */
+        : "m" (barrier->count)
+        : /* no clobbers */
+        : wake_group
+    );
+    // Last one here, so reset the root and wake the other group leaders.
+    barrier->count = barrier->num_groups;
+    __sync_synchronize();
+    local_flag(flag_num, my_cpu)->flag = false;
+    for (int i = 0; i < barrier->num_groups; i++) {
+        int cpu_num = barrier->group[i].leader;
+        if (local_flag(flag_num, cpu_num)->flag) {
+            local_flag(flag_num, cpu_num)->flag = false;
+            smp_send_nmi(cpu_num);
+        }
+    }
+wake_group:
+    // Reset my group and wake the other members.
+    group->count = group->num_threads;
+    __sync_synchronize();
+    wake_group_members(flag_num, group_num, my_cpu, true);
+end:
+    return;
+}
+
 //------------------------------------------------------------------------------
 // Public Functions
 //------------------------------------------------------------------------------
 
+void barrier_init_tree(const uint8_t cpu_list[], int num_cpus)
+{
+    tree_num_cpus   = 0;
+    tree_num_groups = 0;
+    if (num_cpus < TREE_MIN_THREADS) {
+        return;
+    }
+
+    // The APIC ID fields for the thread, core, and package numbers are each
+    // aligned to a power of two, so ignoring the low order bits groups the
+    // threads of a core, then the cores of a package, then whole packages.
+    // Use the finest grouping that gives no more than the square root of the
+    // number of threads, which balances the cost of the two levels.
+    static int8_t key_group[1 << APIC_ID_BITS];
+    int shift = 1;
+    int num_groups = 0;
+    while (shift < APIC_ID_BITS) {
+        num_groups = assign_groups(cpu_list, num_cpus, shift, key_group);
+        if (num_groups <= BARRIER_MAX_GROUPS && num_groups * num_groups <= num_cpus) {
+            break;
+        }
+        shift++;
+    }
+    if (num_groups < 2 || num_groups > BARRIER_MAX_GROUPS) {
+        return;
+    }
+
+    int group_size[BARRIER_MAX_GROUPS];
+    for (int g = 0; g < num_groups; g++) {
+        group_size[g] = 0;
+    }
+    for (int cpu_num = 0; cpu_num < MAX_CPUS; cpu_num++) {
+        tree_group[cpu_num] = -1;
+    }
+    for (int i = 0; i < num_cpus; i++) {
+        int g = key_group[smp_get_apic_id(cpu_list[i]) >> shift];
+        tree_group[cpu_list[i]] = g;
+        group_size[g]++;
+    }
+    tree_first_member[0] = 0;
+    for (int g = 0; g < num_groups; g++) {
+        tree_first_member[g + 1] = tree_first_member[g] + group_size[g];
+        group_size[g] = tree_first_member[g];
+    }
+    for (int i = 0; i < num_cpus; i++) {
+        int g = tree_group[cpu_list[i]];
+        tree_members[group_size[g]++] = cpu_list[i];
+    }
+
+    tree_num_cpus   = num_cpus;
+    tree_num_groups = num_groups;
+}
+
+void barrier_enable_mwait(bool enable)
+{
+    use_mwait = enable;
+}
+
 void barrier_init(barrier_t *barrier, int num_threads)
 {
     barrier->flag_num = allocate_local_flag();
     assert(barrier->flag_num >= 0);
+    barrier->domain   = -1;
 
     barrier_reset(barrier, num_threads);
 }
 
+void barrier_init_domains(barrier_t barrier[], int num_domains)
+{
+    int flag_num = allocate_local_flag();
+    assert(flag_num >= 0);
+
+    for (int i = 0; i < num_domains; i++) {
+        barrier[i].flag_num = flag_num;
+        barrier[i].domain   = i;
+        barrier_reset(&barrier[i], 1);
+    }
+}
+
 void barrier_reset(barrier_t *barrier, int num_threads)
 {
     barrier->num_threads = num_threads;
     barrier->count       = num_threads;
+    barrier->num_groups  = 0;
+    barrier->aborted     = false;
+
+    if (num_threads == tree_num_cpus && barrier->domain < 0) {
+        for (int g = 0; g < tree_num_groups; g++) {
+            int group_size = tree_first_member[g + 1] - tree_first_member[g];
+            barrier->group[g].num_threads = group_size;
+            barrier->group[g].count       = group_size;
+            barrier->group[g].leader      = tree_members[tree_first_member[g]];
+        }
+        barrier->count      = tree_num_groups;
+        barrier->num_groups = tree_num_groups;
+    }
+
+    int flag_num = barrier->flag_num;
+    for (int cpu_num = 0; cpu_num < num_available_cpus; cpu_num++) {
+        if (is_member(barrier, cpu_num)) {
+            local_flag(flag_num, cpu_num)->flag = false;
+        }
+    }
+}
 
-    local_flag_t *waiting_flags = local_flags(barrier->flag_num);
+void barrier_abort(barrier_t *barrier, bool wake_halted)
+{
+    if (barrier == NULL) {
+        return;
+    }
+    barrier->aborted = true;
+    __sync_synchronize();
+    int flag_num = barrier->flag_num;
+    int my_cpu = smp_my_cpu_num();
     for (int cpu_num = 0; cpu_num < num_available_cpus; cpu_num++) {
-        waiting_flags[cpu_num].flag = false;
+        if (local_flag(flag_num, cpu_num)->flag && is_member(barrier, cpu_num)) {
+            local_flag(flag_num, cpu_num)->flag = false;
+            if (wake_halted && cpu_num != my_cpu) {
+                smp_send_nmi(cpu_num);
+            }
+        }
     }
 }
 
@@ -39,22 +335,29 @@ void barrier_spin_wait(barrier_t *barrier)
     if (barrier == NULL || barrier->num_threads < 2) {
         return;
     }
-    local_flag_t *waiting_flags = local_flags(barrier->flag_num);
+    int flag_num = barrier->flag_num;
     int my_cpu = smp_my_cpu_num();
-    waiting_flags[my_cpu].flag = true;
+    if (barrier->num_groups > 0) {
+        tree_spin_wait(barrier, flag_num, my_cpu);
+        return;
+    }
+    local_flag(flag_num, my_cpu)->flag = true;
+    if (is_aborted(barrier, flag_num, my_cpu)) {
+        return;
+    }
     if (__sync_sub_and_fetch(&barrier->count, 1) != 0) {
-        volatile bool *i_am_blocked = &waiting_flags[my_cpu].flag;
-        while (*i_am_blocked) {
-            __builtin_ia32_pause();
-        }
+        wait_while_blocked(&local_flag(flag_num, my_cpu)->flag);
         return;
     }
     // Last one here, so reset the barrier and wake the others. No need to
-    // check if a CPU core is actually waiting - just clear all the flags.
+    // check if a CPU core is actually waiting - just clear all the flags
+    // that belong to this barrier.
     barrier->count = barrier->num_threads;
     __sync_synchronize();
     for (int cpu_num = 0; cpu_num < num_available_cpus; cpu_num++) {
-        waiting_flags[cpu_num].flag = false;
+        if (is_member(barrier, cpu_num)) {
+            local_flag(flag_num, cpu_num)->flag = false;
+        }
     }
 }
 
@@ -63,9 +366,16 @@ void barrier_halt_wait(barrier_t *barrier)
     if (barrier == NULL || barrier->num_threads < 2) {
         return;
     }
-    local_flag_t *waiting_flags = local_flags(barrier->flag_num);
+    int flag_num = barrier->flag_num;
     int my_cpu = smp_my_cpu_num();
-    waiting_flags[my_cpu].flag = true;
+    if (barrier->num_groups > 0) {
+        tree_halt_wait(barrier, flag_num, my_cpu);
+        return;
+    }
+    local_flag(flag_num, my_cpu)->flag = true;
+    if (is_aborted(barrier, flag_num, my_cpu)) {
+        return;
+    }
     //
     // There is a small window of opportunity for the wakeup signal to arrive
     // between us decrementing the barrier count and halting. So code the
@@ -92,13 +402,32 @@ void barrier_halt_wait(barrier_t *barrier)
     // Last one here, so reset the barrier and wake the others.
     barrier->count = barrier->num_threads;
     __sync_synchronize();
-    waiting_flags[my_cpu].flag = false;
+    local_flag(flag_num, my_cpu)->flag = false;
+    if (barrier->num_threads == num_available_cpus && barrier->domain < 0) {
+        // Every other CPU core is waiting here, so a single broadcast wakes
+        // them all.
+        for (int cpu_num = 0; cpu_num < num_available_cpus; cpu_num++) {
+            local_flag(flag_num, cpu_num)->flag = false;
+        }
+        smp_send_nmi_all_but_self();
+        return;
+    }
     for (int cpu_num = 0; cpu_num < num_available_cpus; cpu_num++) {
-        if (waiting_flags[cpu_num].flag) {
-            waiting_flags[cpu_num].flag = false;
+        if (local_flag(flag_num, cpu_num)->flag && is_member(barrier, cpu_num)) {
+            local_flag(flag_num, cpu_num)->flag = false;
             smp_send_nmi(cpu_num);
         }
     }
 end:
     return;
 }
+
+bool barrier_is_waiting(int cpu_num)
+{
+    for (int i = 0; i < NUM_LOCAL_FLAGS; i++) {
+        if (local_flag(i, cpu_num)->flag) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -6,14 +6,37 @@
  *
  * Provides a barrier synchronisation primitive.
  *
+ * When a barrier blocks the set of CPU cores registered by barrier_init_tree(),
+ * it is implemented as a two level combining tree. The cores are divided into
+ * groups that follow the package/core/thread topology encoded in their APIC
+ * IDs. Each core only updates the count of its own group, and only the last
+ * core to arrive in each group updates the root count. Likewise each group
+ * leader only wakes the members of its own group. Otherwise a flat barrier
+ * with a single count is used.
+ *
  *//*
  * Copyright (C) 2020-2022 Martin Whitaker.
  */
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "cpulocal.h"
 
 #include "spinlock.h"
 
+#define BARRIER_MAX_GROUPS  16
+
+/**
+ * A barrier group node. Each node occupies its own cache line.
+ */
+typedef struct __attribute__((aligned(64)))
+{
+    int     num_threads;
+    int     count;
+    int     leader;
+} barrier_group_t;
+
 /**
  * A barrier object.
  */
@@ -22,21 +45,58 @@ typedef struct
     int     flag_num;
     int     num_threads;
     int     count;
+    int     num_groups;     // 0 when the barrier is flat
+    int     domain;         // the proximity domain of the threads, or -1 if any
+    bool    aborted;
+    barrier_group_t group[BARRIER_MAX_GROUPS];
 } barrier_t;
 
+/**
+ * Registers the CPU cores that take part in parallel tests, listed by their
+ * ordinal numbers, and divides them into barrier groups. A barrier that is
+ * subsequently reset to block exactly this number of threads uses the
+ * combining tree. Must be called before the barriers are reset.
+ */
+void barrier_init_tree(const uint8_t cpu_list[], int num_cpus);
+
+/**
+ * Selects whether barrier_spin_wait() waits using MONITOR/MWAIT on the
+ * waiting CPU core's own flag instead of a PAUSE loop. The caller must
+ * check the CPU supports MONITOR/MWAIT before enabling it.
+ */
+void barrier_enable_mwait(bool enable);
+
 /**
  * Initialises a new barrier to block the specified number of threads.
  */
 void barrier_init(barrier_t *barrier, int num_threads);
 
+/**
+ * Initialises a set of new barriers, one for each NUMA proximity domain, each
+ * of which only blocks threads running on CPU cores in its own domain. As each
+ * CPU core is in only one domain, the barriers can share a single set of
+ * waiting flags. Each barrier must be reset to block the number of threads in
+ * its domain before it is used.
+ */
+void barrier_init_domains(barrier_t barrier[], int num_domains);
+
 /**
  * Resets an existing barrier to block the specified number of threads.
  */
 void barrier_reset(barrier_t *barrier, int num_threads);
 
+/**
+ * Releases all threads waiting at the barrier, and makes subsequent waits
+ * return immediately until the barrier is reset. Used when some threads may
+ * no longer arrive. If wake_halted is true, sends a wakeup signal to each
+ * waiting thread, so it must only be true if the threads halt when waiting.
+ */
+void barrier_abort(barrier_t *barrier, bool wake_halted);
+
 /**
  * Waits for all threads to arrive at the barrier. A CPU core spins in an
- * idle loop when waiting.
+ * idle loop when waiting, or sleeps in MWAIT until its flag is cleared if
+ * enabled by barrier_enable_mwait(). Either way, no wakeup signal is needed.
  */
 void barrier_spin_wait(barrier_t *barrier);
 
@@ -46,4 +106,10 @@ void barrier_spin_wait(barrier_t *barrier);
  */
 void barrier_halt_wait(barrier_t *barrier);
 
+/**
+ * Returns true if the CPU core whose ordinal number is cpu_num is waiting
+ * at any barrier, i.e. it has not yet been released.
+ */
+bool barrier_is_waiting(int cpu_num);
+
 #endif // BARRIER_H
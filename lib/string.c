@@ -13,10 +13,66 @@
 
 #include "string.h"
 
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#if (ARCH_BITS == 64)
+#define STRING_WORD_SUFFIX  "q"
+#else
+#define STRING_WORD_SUFFIX  "l"
+#endif
+
+#define STRING_WORD_SIZE    sizeof(uintptr_t)
+
 //------------------------------------------------------------------------------
 // Private Functions
 //------------------------------------------------------------------------------
 
+// The string instructions copy and fill a word at a time, or better on CPUs
+// with fast string operations, so we only use byte instructions for the
+// remainder. The interrupt entry code clears the direction flag, so it is
+// safe to set it temporarily for a backwards copy.
+
+static inline void copy_forwards(void *dest, const void *src, size_t n)
+{
+    size_t words = n / STRING_WORD_SIZE;
+    size_t bytes = n % STRING_WORD_SIZE;
+
+    __asm__ __volatile__ ("rep movs" STRING_WORD_SUFFIX
+        : "+D" (dest), "+S" (src), "+c" (words)
+        :
+        : "memory"
+    );
+    __asm__ __volatile__ ("rep movsb"
+        : "+D" (dest), "+S" (src), "+c" (bytes)
+        :
+        : "memory"
+    );
+}
+
+static inline void copy_backwards(void *dest, const void *src, size_t n)
+{
+    size_t words = n / STRING_WORD_SIZE;
+    size_t bytes = n % STRING_WORD_SIZE;
+
+    // Copy the odd bytes at the top first, then the words below them.
+    dest = (uint8_t *)dest + n - 1;
+    src  = (const uint8_t *)src + n - 1;
+    __asm__ __volatile__ ("std; rep movsb; cld"
+        : "+D" (dest), "+S" (src), "+c" (bytes)
+        :
+        : "memory"
+    );
+    dest = (uint8_t *)dest - (STRING_WORD_SIZE - 1);
+    src  = (const uint8_t *)src - (STRING_WORD_SIZE - 1);
+    __asm__ __volatile__ ("std; rep movs" STRING_WORD_SUFFIX "; cld"
+        : "+D" (dest), "+S" (src), "+c" (words)
+        :
+        : "memory"
+    );
+}
+
 void reverse(char s[])
 {
     int i, j;
@@ -34,20 +90,12 @@ void reverse(char s[])
 
 void *memmove(void *dest, const void *src, size_t n)
 {
-    char *d = (char *)dest, *s = (char *)src;
-
     if (n > 0) {
-        if (dest < src) {
-            for (size_t i = 0; i < n; i++) {
-                d[i] = s[i];
-            }
-        }
-        if (dest > src) {
-            size_t i = n;
-            do {
-                i--;
-                d[i] = s[i];
-            } while (i > 0);
+        // A forwards copy is safe unless dest overlaps the end of src.
+        if ((uintptr_t)dest - (uintptr_t)src >= n) {
+            copy_forwards(dest, src, n);
+        } else if (dest != src) {
+            copy_backwards(dest, src, n);
         }
     }
     return dest;
@@ -57,19 +105,28 @@ void *memmove(void *dest, const void *src, size_t n)
 
 void *memcpy (void *dest, const void *src, size_t len)
 {
-    char *d = dest;
-    const char *s = src;
-    while (len--)
-        *d++ = *s++;
+    copy_forwards(dest, src, len);
     return dest;
 }
 
 void *memset (void *dest, int val, size_t len)
 {
-  unsigned char *ptr = dest;
-  while (len-- > 0)
-    *ptr++ = val;
-  return dest;
+    void     *ptr   = dest;
+    size_t    words = len / STRING_WORD_SIZE;
+    size_t    bytes = len % STRING_WORD_SIZE;
+    uintptr_t pattern = (uint8_t)val * (UINTPTR_MAX / 0xff);
+
+    __asm__ __volatile__ ("rep stos" STRING_WORD_SUFFIX
+        : "+D" (ptr), "+c" (words)
+        : "a" (pattern)
+        : "memory"
+    );
+    __asm__ __volatile__ ("rep stosb"
+        : "+D" (ptr), "+c" (bytes)
+        : "a" (pattern)
+        : "memory"
+    );
+    return dest;
 }
 
 #endif
@@ -128,4 +185,17 @@ uint32_t hexstr2int(const char *hexstr) {
         ival = (ival << 4) | (b & 0xF);
     }
     return ival;
-}
\ No newline at end of file
+}
+
+uint32_t decstr2int(const char *decstr) {
+    uint32_t ival = 0;
+    while (*decstr) {
+        uint8_t b = *decstr++;
+
+        if (b >= '0' && b <= '9') b = b - '0';
+        else return 0;
+
+        ival = ival * 10 + b;
+    }
+    return ival;
+}
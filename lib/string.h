@@ -111,4 +111,11 @@ char *itoa(int num, char *str);
 
 uint32_t hexstr2int(const char *hexstr);
 
+/**
+ * Convert a decimal string to the corresponding 32-bit uint value.
+ * returns 0 if a non-decimal char is found (not 0-9).
+ */
+
+uint32_t decstr2int(const char *decstr);
+
 #endif // STRING_H
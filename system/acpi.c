@@ -30,6 +30,8 @@
 
 #define FADTSignature   ('F' | ('A' << 8) | ('C' << 16) | ('P' << 24)) // Fixed ACPI Description Table
 
+#define DSDTSignature   ('D' | ('S' << 8) | ('D' << 16) | ('T' << 24)) // Differentiated System Description Table
+
 #define HPETSignature   ('H' | ('P' << 8) | ('E' << 16) | ('T' << 24)) // High Precision Event Timer
 
 #define EINJSignature   ('E' | ('I' << 8) | ('N' << 16) | ('J' << 24)) // Error Injection Table
@@ -40,6 +42,16 @@
 #define SLITSignature   ('S' | ('L' << 8) | ('I' << 16) | ('T' << 24)) // System Locality Information Table (NUMA)
 #define SRATSignature   ('S' | ('R' << 8) | ('A' << 16) | ('T' << 24)) // System Resource Affinity Table (NUMA)
 
+#define MCFGSignature   ('M' | ('C' << 8) | ('F' << 16) | ('G' << 24)) // PCI Express Memory Mapped Configuration
+
+#define MAX_ACPI_TABLES 64
+
+// AML opcodes
+
+#define AML_NAME_OP     0x08
+#define AML_BYTE_PREFIX 0x0a
+#define AML_PACKAGE_OP  0x12
+
 //------------------------------------------------------------------------------
 // Types
 //------------------------------------------------------------------------------
@@ -64,6 +76,11 @@ typedef struct {
     uint8_t     reserved[3];
 } rsdp_t;
 
+typedef struct {
+    uint32_t    signature;
+    uintptr_t   addr;
+} acpi_table_entry_t;
+
 //------------------------------------------------------------------------------
 // Private Variables
 //------------------------------------------------------------------------------
@@ -71,13 +88,18 @@ typedef struct {
 static const efi_guid_t EFI_ACPI_1_RDSP_GUID = { 0xeb9d2d30, 0x2d88, 0x11d3, {0x9a, 0x16, 0x00, 0x90, 0x27, 0x3f, 0xc1, 0x4d} };
 static const efi_guid_t EFI_ACPI_2_RDSP_GUID = { 0x8868e871, 0xe4f1, 0x11d3, {0xbc, 0x22, 0x00, 0x80, 0xc7, 0x3c, 0x88, 0x81} };
 
+// The tables listed in the RSDT or XSDT, recorded by index_acpi_tables().
+static acpi_table_entry_t table_index[MAX_ACPI_TABLES];
+
+static int num_indexed_tables = 0;
+
 //------------------------------------------------------------------------------
 // Variables
 //------------------------------------------------------------------------------
 
 const char *rsdp_source = "";
 
-acpi_t acpi_config = {0, 0, 0, 0, 0, /*0,*/ 0, 0, 0, false};
+acpi_t acpi_config = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, false, 0, 0, 0, 0, 0, 0, false};
 
 //------------------------------------------------------------------------------
 // Private Functions
@@ -188,12 +210,30 @@ static uintptr_t find_rsdp(void)
     return (uintptr_t)rp;
 }
 
-static uintptr_t find_acpi_table(uint32_t table_signature)
+static void add_table_to_index(uintptr_t addr)
+{
+    uint32_t *ptr = (uint32_t *)map_region(addr, sizeof(uint32_t), true);
+    if (ptr == NULL || num_indexed_tables == MAX_ACPI_TABLES) {
+        return;
+    }
+    uint32_t signature = *ptr;
+    // If a table is listed more than once, the first entry wins.
+    for (int i = 0; i < num_indexed_tables; i++) {
+        if (table_index[i].signature == signature) {
+            return;
+        }
+    }
+    table_index[num_indexed_tables].signature = signature;
+    table_index[num_indexed_tables].addr      = addr;
+    num_indexed_tables++;
+}
+
+static void index_acpi_tables(void)
 {
    rsdp_t *rp = (rsdp_t *)acpi_config.rsdp_addr;
 
     // Found the RSDP, now get either the RSDT or XSDT
-    // and scan it for a pointer to the table we're looking for
+    // and record the address and signature of each table it points to.
     rsdt_header_t *rt;
 
     if (acpi_config.ver_maj < rp->revision) {
@@ -203,58 +243,97 @@ static uintptr_t find_acpi_table(uint32_t table_signature)
     if (rp->revision >= 2) {
         rt = (rsdt_header_t *)map_region(rp->xsdt_addr, sizeof(rsdt_header_t), true);
         if (rt == NULL) {
-            return 0;
+            return;
         }
         // Validate the XSDT.
         if (*(uint32_t *)rt != XSDTSignature) {
-            return 0;
+            return;
         }
         rt = (rsdt_header_t *)map_region(rp->xsdt_addr, rt->length, true);
         if (rt == NULL || acpi_checksum(rt, rt->length) != 0) {
-            return 0;
+            return;
         }
-        // Scan the XSDT for a pointer to the table we're looking for.
         uint64_t *tab_ptr = (uint64_t *)((uint8_t *)rt + sizeof(rsdt_header_t));
         uint64_t *tab_end = (uint64_t *)((uint8_t *)rt + rt->length);
 
         while (tab_ptr < tab_end) {
-            uintptr_t addr = *tab_ptr++;  // read the next table entry
-            uint32_t *ptr = (uint32_t *)map_region(addr, sizeof(uint32_t), true);
-
-            if (ptr && *ptr == table_signature) {
-                return addr;
-            }
+            add_table_to_index(*tab_ptr++);
         }
     } else {
         rt = (rsdt_header_t *)map_region(rp->rsdt_addr, sizeof(rsdt_header_t), true);
         if (rt == NULL) {
-            return 0;
+            return;
         }
         // Validate the RSDT.
         if (*(uint32_t *)rt != RSDTSignature) {
-            return 0;
+            return;
         }
         rt = (rsdt_header_t *)map_region(rp->rsdt_addr, rt->length, true);
         if (rt == NULL || acpi_checksum(rt, rt->length) != 0) {
-            return 0;
+            return;
         }
-        // Scan the RSDT for a pointer to the table we're looking for.
         uint32_t *tab_ptr = (uint32_t *)((uint8_t *)rt + sizeof(rsdt_header_t));
         uint32_t *tab_end = (uint32_t *)((uint8_t *)rt + rt->length);
 
         while (tab_ptr < tab_end) {
-            uintptr_t addr = *tab_ptr++;  // read the next table entry
-            uint32_t *ptr = (uint32_t *)map_region(addr, sizeof(uint32_t), true);
-
-            if (ptr && *ptr == table_signature) {
-                return addr;
-            }
+            add_table_to_index(*tab_ptr++);
         }
     }
+}
 
+static uintptr_t find_acpi_table(uint32_t table_signature)
+{
+    for (int i = 0; i < num_indexed_tables; i++) {
+        if (table_index[i].signature == table_signature) {
+            return table_index[i].addr;
+        }
+    }
     return 0;
 }
 
+// Looks for the \_S5 object in the DSDT, which gives the SLP_TYP values used
+// to enter the soft off state. This is not a full AML parser, but \_S5 is
+// normally defined as a package of constants at the top level, i.e.
+//
+//   NameOp ['\'] "_S5_" PackageOp PkgLength NumElements {BytePrefix} SLP_TYPa {BytePrefix} SLP_TYPb
+//
+// where a value of 0 or 1 may be encoded directly as ZeroOp or OneOp.
+static void parse_dsdt(uintptr_t dsdt_addr)
+{
+    rsdt_header_t *dsdt = (rsdt_header_t *)map_region(dsdt_addr, sizeof(rsdt_header_t), true);
+    if (dsdt == NULL || *(uint32_t *)dsdt != DSDTSignature) {
+        return;
+    }
+    uint32_t length = dsdt->length;
+    const uint8_t *aml = (const uint8_t *)map_region(dsdt_addr, length, true);
+    if (aml == NULL) {
+        return;
+    }
+
+    for (uint32_t i = sizeof(rsdt_header_t) + 2; i + 16 < length; i++) {
+        if (aml[i] != '_' || memcmp(&aml[i], "_S5_", 4) != 0 || aml[i + 4] != AML_PACKAGE_OP) {
+            continue;
+        }
+        if (aml[i - 1] != AML_NAME_OP && (aml[i - 1] != '\\' || aml[i - 2] != AML_NAME_OP)) {
+            continue;
+        }
+        // Skip the PkgLength, whose top two bits give the number of extra
+        // bytes, and NumElements.
+        const uint8_t *ptr = &aml[i + 5];
+        ptr += ((*ptr & 0xc0) >> 6) + 2;
+        if (*ptr == AML_BYTE_PREFIX) {
+            ptr++;
+        }
+        acpi_config.slp_typa = *ptr++;
+        if (*ptr == AML_BYTE_PREFIX) {
+            ptr++;
+        }
+        acpi_config.slp_typb = *ptr;
+        acpi_config.s5_valid = true;
+        return;
+    }
+}
+
 static bool parse_fadt(uintptr_t fadt_addr)
 {
     // FADT is a very big & complex table and we only need a few pieces of data.
@@ -279,6 +358,22 @@ static bool parse_fadt(uintptr_t fadt_addr)
     acpi_config.pm_addr  = *(uint32_t *)(fadt_addr+FADT_PM_TMR_BLK_OFFSET);
     acpi_config.pm_is_io = true;
 
+    // Get the power management control ports, used to power off.
+    acpi_config.smi_cmd     = *(uint32_t *)(fadt_addr+FADT_SMI_CMD_OFFSET);
+    acpi_config.acpi_enable = *(uint8_t  *)(fadt_addr+FADT_ACPI_ENABLE_OFFSET);
+    acpi_config.pm1a_cnt    = *(uint32_t *)(fadt_addr+FADT_PM1A_CNT_BLK_OFFSET);
+    acpi_config.pm1b_cnt    = *(uint32_t *)(fadt_addr+FADT_PM1B_CNT_BLK_OFFSET);
+
+    uintptr_t dsdt_addr = *(uint32_t *)(fadt_addr+FADT_DSDT_OFFSET);
+#if (ARCH_BITS == 64)
+    if (fadt->length >= FADT_X_DSDT_OFFSET + sizeof(uint64_t) && *(uint64_t *)(fadt_addr+FADT_X_DSDT_OFFSET) != 0) {
+        dsdt_addr = *(uint64_t *)(fadt_addr+FADT_X_DSDT_OFFSET);
+    }
+#endif
+    if (dsdt_addr != 0 && acpi_config.pm1a_cnt != 0) {
+        parse_dsdt(dsdt_addr);
+    }
+
 #if (ARCH_BITS == 64)
     acpi_gen_addr_struct *rt;
 
@@ -320,6 +415,9 @@ void acpi_init(void)
         return;
     }
 
+    // Scan the RSDT or XSDT once, and then look up each table we need.
+    index_acpi_tables();
+
     acpi_config.madt_addr = find_acpi_table(MADTSignature);
 
     acpi_config.fadt_addr = find_acpi_table(FADTSignature);
@@ -332,5 +430,7 @@ void acpi_init(void)
 
     acpi_config.srat_addr = find_acpi_table(SRATSignature);
 
-    //acpi_config.slit_addr = find_acpi_table(SLITSignature);
+    acpi_config.slit_addr = find_acpi_table(SLITSignature);
+
+    acpi_config.mcfg_addr = find_acpi_table(MCFGSignature);
 }
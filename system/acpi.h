@@ -14,8 +14,14 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#define FADT_DSDT_OFFSET            40
+#define FADT_SMI_CMD_OFFSET         48
+#define FADT_ACPI_ENABLE_OFFSET     52
+#define FADT_PM1A_CNT_BLK_OFFSET    64
+#define FADT_PM1B_CNT_BLK_OFFSET    68
 #define FADT_PM_TMR_BLK_OFFSET      76
 #define FADT_MINOR_REV_OFFSET       131
+#define FADT_X_DSDT_OFFSET          140
 #define FADT_X_PM_TMR_BLK_OFFSET    208
 
 /**
@@ -28,11 +34,19 @@ typedef struct __attribute__ ((packed)) {
     uintptr_t   fadt_addr;
     uintptr_t   hpet_addr;
     uintptr_t   srat_addr;
-    //uintptr_t   slit_addr;
+    uintptr_t   slit_addr;
+    uintptr_t   mcfg_addr;
     uintptr_t   pm_addr;
     uint8_t     ver_maj;
     uint8_t     ver_min;
     bool        pm_is_io;
+    uint32_t    smi_cmd;        // the SMI command port, 0 if none
+    uint8_t     acpi_enable;    // the value written to smi_cmd to enable ACPI
+    uint16_t    pm1a_cnt;       // the PM1a control port
+    uint16_t    pm1b_cnt;       // the PM1b control port, 0 if none
+    uint16_t    slp_typa;       // the PM1a SLP_TYP value for the S5 (soft off) state
+    uint16_t    slp_typb;       // the PM1b SLP_TYP value for the S5 (soft off) state
+    bool        s5_valid;       // true if the SLP_TYP values were found
 } acpi_t;
 
 /**
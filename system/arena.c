@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "heap.h"
+#include "memsize.h"
+#include "smp.h"
+#include "vmem.h"
+
+#include "config.h"
+
+#include "spinlock.h"
+
+#include "arena.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define CPU_ARENA_ALIGN     64      // keeps each CPU's arena on its own cache lines
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+static bool         cpu_arenas_ready = false;
+
+static arena_t      cpu_arenas[MAX_CPUS];
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static uintptr_t align_up(uintptr_t value, uintptr_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static void set_arena(arena_t *arena, uintptr_t start, size_t size)
+{
+    arena->start = start;
+    arena->end   = start + size;
+    arena->next  = start;
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+bool arena_init(arena_t *arena, heap_type_t heap_id, size_t size)
+{
+    uintptr_t addr = heap_alloc(heap_id, size, PAGE_SIZE);
+    if (addr == 0) {
+        return false;
+    }
+    set_arena(arena, addr, size);
+    return true;
+}
+
+bool arena_init_in_domain(arena_t *arena, uint32_t proximity_domain_idx, size_t size)
+{
+    uint64_t addr = heap_alloc_in_domain(proximity_domain_idx, size, PAGE_SIZE);
+    if (addr != 0) {
+        uintptr_t virt_addr = map_region(addr, size, false);
+        if (virt_addr != 0) {
+            set_arena(arena, virt_addr, size);
+            return true;
+        }
+    }
+    return arena_init(arena, HEAP_TYPE_HM_1, size);
+}
+
+void *arena_alloc(arena_t *arena, size_t size, size_t alignment)
+{
+    uintptr_t addr = align_up(arena->next, alignment);
+    if (addr < arena->next || addr > arena->end || size > arena->end - addr) {
+        return NULL;
+    }
+    arena->next = addr + size;
+    return (void *)addr;
+}
+
+void arena_reset(arena_t *arena)
+{
+    arena->next = arena->start;
+}
+
+bool pool_init(pool_t *pool, arena_t *arena, size_t obj_size, int num_objs)
+{
+    obj_size = align_up(obj_size < sizeof(void *) ? sizeof(void *) : obj_size, sizeof(void *));
+
+    uint8_t *objs = arena_alloc(arena, obj_size * num_objs, sizeof(void *));
+    if (objs == NULL) {
+        return false;
+    }
+    spin_unlock(&pool->lock);
+    pool->free_list = NULL;
+    pool->obj_size  = obj_size;
+    pool->num_free  = 0;
+    for (int i = num_objs - 1; i >= 0; i--) {
+        pool_free(pool, objs + i * obj_size);
+    }
+    return true;
+}
+
+void *pool_alloc(pool_t *pool)
+{
+    spin_lock(&pool->lock);
+    void **obj = pool->free_list;
+    if (obj != NULL) {
+        pool->free_list = *obj;
+        pool->num_free--;
+    }
+    spin_unlock(&pool->lock);
+    return obj;
+}
+
+void pool_free(pool_t *pool, void *obj)
+{
+    if (obj == NULL) {
+        return;
+    }
+    spin_lock(&pool->lock);
+    *(void **)obj = pool->free_list;
+    pool->free_list = obj;
+    pool->num_free++;
+    spin_unlock(&pool->lock);
+}
+
+bool cpu_arenas_init(size_t size_per_cpu)
+{
+    size_per_cpu = align_up(size_per_cpu, CPU_ARENA_ALIGN);
+
+    // Take one block for each proximity domain and share it out between the
+    // CPU cores in that domain.
+    int num_domains = enable_numa ? num_proximity_domains : 1;
+    for (int domain = 0; domain < num_domains; domain++) {
+        int num_cpus = 0;
+        for (int i = 0; i < num_available_cpus; i++) {
+            if (cpu_state[i] != CPU_STATE_DISABLED && (!enable_numa || (int)smp_get_proximity_domain_idx(i) == domain)) {
+                num_cpus++;
+            }
+        }
+        if (num_cpus == 0) {
+            continue;
+        }
+        arena_t block;
+        bool found = enable_numa ? arena_init_in_domain(&block, domain, num_cpus * size_per_cpu)
+                                 : arena_init(&block, HEAP_TYPE_HM_1, num_cpus * size_per_cpu);
+        if (!found) {
+            return false;
+        }
+        for (int i = 0; i < num_available_cpus; i++) {
+            if (cpu_state[i] != CPU_STATE_DISABLED && (!enable_numa || (int)smp_get_proximity_domain_idx(i) == domain)) {
+                set_arena(&cpu_arenas[i], (uintptr_t)arena_alloc(&block, size_per_cpu, CPU_ARENA_ALIGN), size_per_cpu);
+            }
+        }
+    }
+    cpu_arenas_ready = true;
+    return true;
+}
+
+arena_t *cpu_arena(int cpu_num)
+{
+    return cpu_arenas_ready ? &cpu_arenas[cpu_num] : NULL;
+}
@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef ARENA_H
+#define ARENA_H
+/**
+ * \file
+ *
+ * Provides arenas and fixed-size object pools for subsystems that need
+ * memory with a lifetime of their own. Each arena is a contiguous block
+ * taken once from a heap or from a NUMA proximity domain, and is then
+ * carved up without further calls to the heap. Memory used by the arenas
+ * is excluded from the memory tests and is counted by heap_reserved_pages().
+ *
+ * Arenas are not thread safe. Each CPU core has its own arena once
+ * cpu_arenas_init() has been called. Pools are thread safe.
+ *
+ *//*
+ * Copyright (C) 2024 Memtest86+ contributors.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "heap.h"
+
+#include "spinlock.h"
+
+/**
+ * An arena. The addresses are virtual addresses.
+ */
+typedef struct {
+    uintptr_t   start;
+    uintptr_t   end;
+    uintptr_t   next;
+} arena_t;
+
+/**
+ * A pool of fixed-size objects. The free objects are kept in a list that
+ * is threaded through the objects themselves.
+ */
+typedef struct {
+    spinlock_t  lock;
+    void        *free_list;
+    size_t      obj_size;
+    int         num_free;
+} pool_t;
+
+/**
+ * Initialises an arena of at least the given size in the given heap.
+ * Returns false if there is not enough memory.
+ */
+bool arena_init(arena_t *arena, heap_type_t heap_id, size_t size);
+
+/**
+ * Initialises an arena of at least the given size in memory belonging to
+ * the given proximity domain, falling back to the high memory heap if there
+ * is none. Returns false if there is not enough memory.
+ */
+bool arena_init_in_domain(arena_t *arena, uint32_t proximity_domain_idx, size_t size);
+
+/**
+ * Allocates a block of the given size and alignment (which must be a power
+ * of 2) from an arena. Returns NULL if the arena is exhausted.
+ */
+void *arena_alloc(arena_t *arena, size_t size, size_t alignment);
+
+/**
+ * Frees everything allocated from an arena.
+ */
+void arena_reset(arena_t *arena);
+
+/**
+ * Initialises a pool of num_objs objects of the given size, taken from the
+ * given arena. Returns false if the arena is exhausted.
+ */
+bool pool_init(pool_t *pool, arena_t *arena, size_t obj_size, int num_objs);
+
+/**
+ * Takes an object from a pool. Returns NULL if the pool is empty.
+ */
+void *pool_alloc(pool_t *pool);
+
+/**
+ * Returns an object to the pool it was taken from.
+ */
+void pool_free(pool_t *pool, void *obj);
+
+/**
+ * Gives each enabled CPU core an arena of at least the given size, in memory
+ * belonging to the core's proximity domain when NUMA support is enabled.
+ * Must be called after smp_init() and before the APs are started. Returns
+ * false if there is not enough memory.
+ */
+bool cpu_arenas_init(size_t size_per_cpu);
+
+/**
+ * Returns the arena belonging to the given CPU core, or NULL if
+ * cpu_arenas_init() has not been called.
+ */
+arena_t *cpu_arena(int cpu_num);
+
+#endif // ARENA_H
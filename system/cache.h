@@ -10,6 +10,8 @@
  * Copyright (C) 2020-2022 Martin Whitaker.
  */
 
+#include <stdint.h>
+
 /**
  * Disable the CPU caches.
  */
@@ -77,4 +79,42 @@ static inline void cache_flush(void)
     );
 }
 
+/**
+ * Write back and invalidate the cache line containing the specified address
+ * in all CPU caches in the coherence domain. Requires CLFLUSH.
+ */
+static inline void cache_flush_line(const void *addr)
+{
+    __asm__ __volatile__ ("\t"
+        "clflush %0\n"
+        : /* no outputs */
+        : "m" (*(const volatile char *)addr)
+        : "memory"
+    );
+}
+
+/**
+ * Flush the cache lines containing the specified range of addresses from all
+ * CPU caches in the coherence domain. Requires CLFLUSHOPT. The last address
+ * is inclusive. line_size must be a power of 2.
+ */
+static inline void cache_flush_range(const void *first, const void *last, uintptr_t line_size)
+{
+    for (uintptr_t addr = (uintptr_t)first & ~(line_size - 1); addr <= (uintptr_t)last; addr += line_size) {
+        __asm__ __volatile__ ("\t"
+            "clflushopt %0\n"
+            : /* no outputs */
+            : "m" (*(const volatile char *)addr)
+            : "memory"
+        );
+    }
+    // CLFLUSHOPT is only ordered by fencing instructions.
+    __asm__ __volatile__ ("\t"
+        "sfence\n"
+        : /* no outputs */
+        : /* no inputs */
+        : "memory"
+    );
+}
+
 #endif // CACHE_H
@@ -54,7 +54,7 @@ typedef union {
 } cpuid_proc_info_t;
 
 typedef union {
-    uint32_t        raw[3];
+    uint32_t        raw[4];
     struct {
         uint32_t    fpu     : 1;    // EDX feature flags, bit 0 */
         uint32_t    vme     : 1;
@@ -99,10 +99,27 @@ typedef union {
         uint32_t    tm2     : 1;
         uint32_t            : 12;   // ECX feature flags, bit 20
         uint32_t    x2apic  : 1;
-        uint32_t            : 10;   // ECX feature flags, bit 31
-        uint32_t            : 29;   // EDX extended feature flags, bit 0
+        uint32_t            : 1;
+        uint32_t    popcnt  : 1;
+        uint32_t            : 2;
+        uint32_t    xsave   : 1;
+        uint32_t    osxsave : 1;
+        uint32_t    avx     : 1;
+        uint32_t            : 3;    // ECX feature flags, bit 31
+        uint32_t            : 26;   // EDX extended feature flags, bit 0
+        uint32_t    pdpe1gb : 1;
+        uint32_t            : 2;
         uint32_t    lm      : 1;
         uint32_t            : 2;    // EDX extended feature flags, bit 31
+        uint32_t            : 5;    // EBX structured extended feature flags, bit 0
+        uint32_t    avx2    : 1;
+        uint32_t            : 3;
+        uint32_t    erms    : 1;
+        uint32_t            : 6;
+        uint32_t    avx512f : 1;
+        uint32_t            : 6;
+        uint32_t    clflushopt : 1;
+        uint32_t            : 8;    // EBX structured extended feature flags, bit 31
     };
 } cpuid_feature_flags_t;
 
@@ -1041,30 +1041,23 @@ static uint32_t memspeed(uintptr_t src, uint32_t len, int iter)
     return run_time_clk;
 }
 
-static void measure_memory_bandwidth(void)
-{
-    uintptr_t bench_start_adr = 0;
-    size_t mem_test_len;
-
-    if (l3_cache) {
-        mem_test_len = 4*l3_cache*1024;
-    } else if (l2_cache) {
-        mem_test_len = 4*l2_cache*1024;
-    } else {
-        return; // If we're not able to detect L2, don't start benchmark
-    }
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
 
+uintptr_t find_scratch_region(size_t size)
+{
     // Locate enough free space for tests. We require the space to be mapped into
     // our virtual address space, which limits us to the first 2GB.
     for (int i = 0; i < pm_map_size && pm_map[i].start < VM_PINNED_SIZE; i++) {
         uintptr_t try_start = pm_map[i].start << PAGE_SHIFT;
-        uintptr_t try_end   = try_start + mem_test_len * 2;
+        uintptr_t try_end   = try_start + size;
 
         // No start address below BENCH_MIN_START_ADR
         if (try_start < BENCH_MIN_START_ADR) {
-            if ((pm_map[i].end << PAGE_SHIFT) >= (BENCH_MIN_START_ADR + mem_test_len * 2)) {
+            if ((pm_map[i].end << PAGE_SHIFT) >= (BENCH_MIN_START_ADR + size)) {
                 try_start = BENCH_MIN_START_ADR;
-                try_end   = BENCH_MIN_START_ADR + mem_test_len * 2;
+                try_end   = BENCH_MIN_START_ADR + size;
             } else {
                 continue;
             }
@@ -1073,16 +1066,46 @@ static void measure_memory_bandwidth(void)
         // Avoid the memory region where the program is currently located.
         if (try_start < (uintptr_t)_end && try_end > (uintptr_t)_start) {
             try_start = (uintptr_t)_end;
-            try_end   = try_start + mem_test_len * 2;
+            try_end   = try_start + size;
         }
 
         uintptr_t end_limit = (pm_map[i].end < VM_PINNED_SIZE ? pm_map[i].end : VM_PINNED_SIZE) << PAGE_SHIFT;
         if (try_end <= end_limit) {
-            bench_start_adr = try_start;
-            break;
+            return try_start;
         }
     }
+    return 0;
+}
 
+void cpuinfo_init(void)
+{
+    // Get cache sizes for most AMD and Intel CPUs. Exceptions for old
+    // CPUs are handled in determine_cpu_model().
+    determine_cache_size();
+
+    determine_cpu_model();
+}
+
+void membw_init(void)
+{
+    if (quirk.type & QUIRK_TYPE_MEM_SIZE) {
+        quirk.process();
+    }
+}
+
+void measure_memory_bandwidth(void)
+{
+    size_t mem_test_len;
+
+    if (l3_cache) {
+        mem_test_len = 4*l3_cache*1024;
+    } else if (l2_cache) {
+        mem_test_len = 4*l2_cache*1024;
+    } else {
+        return; // If we're not able to detect L2, don't start benchmark
+    }
+
+    uintptr_t bench_start_adr = find_scratch_region(mem_test_len * 2);
     if (bench_start_adr == 0) {
         return;
     }
@@ -1105,27 +1128,3 @@ static void measure_memory_bandwidth(void)
     // Measure RAM BW
     ram_speed = memspeed(bench_start_adr, mem_test_len, 25);
 }
-
-//------------------------------------------------------------------------------
-// Public Functions
-//------------------------------------------------------------------------------
-
-void cpuinfo_init(void)
-{
-    // Get cache sizes for most AMD and Intel CPUs. Exceptions for old
-    // CPUs are handled in determine_cpu_model().
-    determine_cache_size();
-
-    determine_cpu_model();
-}
-
-void membw_init(void)
-{
-    if (quirk.type & QUIRK_TYPE_MEM_SIZE) {
-        quirk.process();
-    }
-
-    if(enable_bench) {
-        measure_memory_bandwidth();
-    }
-}
@@ -12,6 +12,7 @@
  */
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /**
@@ -125,8 +126,24 @@ extern uint32_t clks_per_msec;
 void cpuinfo_init(void);
 
 /**
- * Determines the RAM & caches bandwidth and stores it in the exported variables.
+ * Returns the address of a free region of memory of at least the specified
+ * size that is identity mapped in the virtual address space and is not used
+ * by the program or the heaps, for scratch use by the start-up benchmarks.
+ * Returns 0 if there is no such region.
+ */
+uintptr_t find_scratch_region(size_t size);
+
+/**
+ * Applies any hardware quirks that correct the cache sizes, before the RAM &
+ * caches bandwidth is measured.
  */
 void membw_init(void);
 
+/**
+ * Determines the RAM & caches bandwidth and stores it in the exported variables.
+ * This overwrites a scratch region of free memory, so must only be called when
+ * no test is running.
+ */
+void measure_memory_bandwidth(void);
+
 #endif // CPUINFO_H
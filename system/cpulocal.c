@@ -2,16 +2,41 @@
 // Copyright (C) 2022 Martin Whitaker.
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
-#include "boot.h"
+#include "arena.h"
+#include "smp.h"
+
+#include "config.h"
 
 #include "cpulocal.h"
 
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define LOCAL_FLAGS_SIZE    (NUM_LOCAL_FLAGS * sizeof(local_flag_t))
+
+#if (ARCH_BITS == 64)
+// The 32-bit startup code picks its stack before enabling paging, so can only
+// use a stack in the program image.
+#define LOCAL_STACK_SIZE    AP_STACK_SIZE
+#else
+#define LOCAL_STACK_SIZE    0
+#endif
+
 //------------------------------------------------------------------------------
 // Variables
 //------------------------------------------------------------------------------
 
-int local_bytes_used = 0;
+local_flag_t local_flag_array[NUM_LOCAL_FLAGS][1 + MAX_APS];
+
+local_flag_t *local_flag_block[1 + MAX_APS];
+
+uintptr_t local_stack_top[1 + MAX_APS];
+
+int local_flags_used = 0;
 
 //------------------------------------------------------------------------------
 // Public Functions
@@ -19,8 +44,38 @@ int local_bytes_used = 0;
 
 int allocate_local_flag(void)
 {
-    if (local_bytes_used == LOCALS_SIZE) {
+    if (local_flags_used == NUM_LOCAL_FLAGS) {
         return -1;
     }
-    return local_bytes_used += sizeof(bool);
+    return local_flags_used++;
+}
+
+void cpu_local_init(void)
+{
+    if (!enable_numa || num_proximity_domains < 2) {
+        return;
+    }
+    if (!cpu_arenas_init(LOCAL_FLAGS_SIZE + LOCAL_STACK_SIZE)) {
+        return;
+    }
+    for (int cpu_num = 0; cpu_num < num_available_cpus; cpu_num++) {
+        arena_t *arena = cpu_arena(cpu_num);
+        if (cpu_state[cpu_num] == CPU_STATE_DISABLED || arena == NULL) {
+            continue;
+        }
+        local_flag_t *block = arena_alloc(arena, LOCAL_FLAGS_SIZE, sizeof(local_flag_t));
+        if (block != NULL) {
+            for (int flag_num = 0; flag_num < NUM_LOCAL_FLAGS; flag_num++) {
+                block[flag_num] = local_flag_array[flag_num][cpu_num];
+            }
+            local_flag_block[cpu_num] = block;
+        }
+        // The BSP keeps its (larger) stack in the program image.
+        if (cpu_num > 0 && LOCAL_STACK_SIZE > 0) {
+            uint8_t *stack = arena_alloc(arena, LOCAL_STACK_SIZE, 16);
+            if (stack != NULL) {
+                local_stack_top[cpu_num] = (uintptr_t)stack + LOCAL_STACK_SIZE;
+            }
+        }
+    }
 }
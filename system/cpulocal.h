@@ -4,26 +4,51 @@
 /**
  * \file
  *
- * Provides functions to allocate and access thread-local flags.
+ * Provides functions to allocate and access thread-local flags, and to move
+ * the thread-local storage of each CPU core into its own NUMA node.
  *
  *//*
  * Copyright (C) 2022 Martin Whitaker.
  */
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "boot.h"
 
 /**
- * A single thread-local flag. These are spaced out in memory to ensure each
- * flag occupies a different cache line.
+ * The maximum number of arrays of thread-local flags that can be allocated.
  */
-typedef struct __attribute__((packed)) {
+#define NUM_LOCAL_FLAGS     4
+
+/**
+ * A single thread-local flag. Each flag occupies its own cache line.
+ */
+typedef struct __attribute__((aligned(64))) {
     bool	flag;
-    uint8_t	spacing[AP_STACK_SIZE - sizeof(bool)];
 } local_flag_t;
 
+/**
+ * The default storage for the thread-local flags, indexed by flag number and
+ * CPU core number (the BSP plus each of the APs). This is part of the program
+ * image, so it is copied when the program is relocated.
+ */
+extern local_flag_t local_flag_array[NUM_LOCAL_FLAGS][1 + MAX_APS];
+
+/**
+ * For each CPU core, the block of NUM_LOCAL_FLAGS flags in memory local to
+ * the core that replaces its entries in local_flag_array, or NULL if not
+ * moved. These blocks lie outside the program image, so are not relocated.
+ */
+extern local_flag_t *local_flag_block[1 + MAX_APS];
+
+/**
+ * For each AP, the top of its stack in memory local to the AP, or 0 to use
+ * its stack in the program image. Read by the startup code.
+ */
+extern uintptr_t local_stack_top[1 + MAX_APS];
+
 /**
  * Allocates an array of thread-local flags, one per CPU core, and returns
  * a ID number that identifies the allocated array. Returns -1 if there is
@@ -33,14 +58,24 @@ typedef struct __attribute__((packed)) {
 int allocate_local_flag(void);
 
 /**
- * Returns a pointer to the previously allocated array of thread-local flags
- * identified by flag_num.
+ * Moves the thread-local flags of each CPU core, and on 64-bit builds the
+ * stack of each AP, into memory in the core's own proximity domain, taken
+ * from the per-CPU arenas. Does nothing unless the NUMA code paths are
+ * enabled and there is more than one proximity domain, or if the memory
+ * can't be allocated. Must be called after smp_init() and before the APs
+ * are started.
+ */
+void cpu_local_init(void);
+
+/**
+ * Returns a pointer to the thread-local flag of the CPU core whose ordinal
+ * number is cpu_num in the previously allocated array of flags identified
+ * by flag_num.
  */
-static inline local_flag_t *local_flags(int flag_num)
+static inline local_flag_t *local_flag(int flag_num, int cpu_num)
 {
-    // The number returned by allocate_local_flag is the byte offset of the
-    // flag from the start of the thread-local storage.
-    return (local_flag_t *)(_stacks + BSP_STACK_SIZE - LOCALS_SIZE + flag_num);
+    local_flag_t *block = local_flag_block[cpu_num];
+    return (block != NULL) ? &block[flag_num] : &local_flag_array[flag_num][cpu_num];
 }
 
 #endif // CPULOCAL_H
@@ -0,0 +1,290 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "heap.h"
+#include "memrw.h"
+#include "memsize.h"
+#include "pci.h"
+#include "vmem.h"
+
+#include "string.h"
+#include "unistd.h"
+
+#include "e1000.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+// Register offsets
+
+#define E1000_CTRL              0x0000
+#define E1000_STATUS            0x0008
+#define E1000_IMC               0x00d8
+#define E1000_RCTL              0x0100
+#define E1000_TCTL              0x0400
+#define E1000_TIPG              0x0410
+#define E1000_TDBAL             0x3800
+#define E1000_TDBAH             0x3804
+#define E1000_TDLEN             0x3808
+#define E1000_TDH               0x3810
+#define E1000_TDT               0x3818
+#define E1000_RAL0              0x5400
+#define E1000_RAH0              0x5404
+
+// Device Control register
+
+#define E1000_CTRL_ASDE         0x00000020      // Auto-Speed Detection Enable
+#define E1000_CTRL_SLU          0x00000040      // Set Link Up
+#define E1000_CTRL_RST          0x04000000      // Device Reset
+
+// Device Status register
+
+#define E1000_STATUS_LU         0x00000002      // Link Up
+
+// Transmit Control register
+
+#define E1000_TCTL_EN           0x00000002      // Transmit Enable
+#define E1000_TCTL_PSP          0x00000008      // Pad Short Packets
+#define E1000_TCTL_CT           (0x0f <<  4)    // Collision Threshold
+#define E1000_TCTL_COLD         (0x3f << 12)    // Collision Distance (full duplex)
+
+// Transmit Inter Packet Gap register (copper)
+
+#define E1000_TIPG_DEFAULT      (10 | 8 << 10 | 6 << 20)
+
+// Receive Address High register
+
+#define E1000_RAH_AV            0x80000000      // Address Valid
+
+// Transmit descriptor command and status bits
+
+#define E1000_TXD_CMD_EOP       0x01            // End Of Packet
+#define E1000_TXD_CMD_IFCS      0x02            // Insert FCS
+#define E1000_TXD_CMD_RS        0x08            // Report Status
+#define E1000_TXD_STAT_DD       0x01            // Descriptor Done
+
+// Values specific to this driver.
+
+#define MMIO_SIZE               0x20000         // the register space of all supported devices
+
+#define TX_RING_SIZE            8               // descriptors (multiple of 8 to make the ring length a multiple of 128)
+#define TX_BUFFER_SIZE          1024            // bytes per frame
+
+#define MILLISEC                1000            // in microseconds
+
+//------------------------------------------------------------------------------
+// Types
+//------------------------------------------------------------------------------
+
+// Legacy transmit descriptor, as defined by the controller datasheets.
+
+typedef volatile struct {
+    uint64_t            buffer_addr;
+    uint16_t            length;
+    uint8_t             cso;
+    uint8_t             cmd;
+    uint8_t             status;
+    uint8_t             css;
+    uint16_t            special;
+} tx_desc_t  __attribute__ ((aligned (16)));
+
+typedef struct {
+    tx_desc_t           desc    [TX_RING_SIZE]  __attribute__ ((aligned (128)));
+    uint8_t             buffer  [TX_RING_SIZE][TX_BUFFER_SIZE];
+} workspace_t  __attribute__ ((aligned (128)));
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+// The device IDs of the controllers that have the register layout and legacy
+// transmit descriptors used here.
+static const uint16_t supported_device_id[] = {
+    0x100e,                                     // 82540EM (as emulated by QEMU)
+    0x100f, 0x1010, 0x1026,                     // 82545EM, 82546EB, 82545GM
+    0x1075, 0x1076, 0x107c,                     // 82547GI, 82541GI, 82541PI
+    0x105e, 0x107d, 0x108b, 0x108c,             // 82571EB, 82572EI, 82573V, 82573E
+    0x10d3, 0x10f6,                             // 82574L (as emulated by QEMU), 82574LA
+    0x1502, 0x1503,                             // 82579LM, 82579V
+    0x153a, 0x153b, 0x155a, 0x1559,             // I217-LM, I217-V, I218-LM, I218-V
+    0x156f, 0x1570, 0x15b7, 0x15b8, 0x15bb,     // I219-LM, I219-V, ...
+    0x15bc, 0x15bd, 0x15be, 0x15d7, 0x15d8,
+    0x15e3, 0x15d6
+};
+
+static uintptr_t        regs_base = 0;
+
+static workspace_t      *ws = NULL;
+
+static int              tx_tail = 0;
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static uint32_t read_reg(int reg)
+{
+    return read32((volatile uint32_t *)(regs_base + reg));
+}
+
+static void write_reg(int reg, uint32_t value)
+{
+    write32((volatile uint32_t *)(regs_base + reg), value);
+}
+
+static bool is_supported(uint16_t device_id)
+{
+    for (size_t i = 0; i < sizeof(supported_device_id) / sizeof(supported_device_id[0]); i++) {
+        if (supported_device_id[i] == device_id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns the physical base address of the register space of the first
+// supported controller, or 0 if there is none.
+static uintptr_t find_controller(void)
+{
+    for (int bus = 0; bus < PCI_MAX_BUS; bus++) {
+        for (int dev = 0; dev < PCI_MAX_DEV; dev++) {
+            for (int func = 0; func < PCI_MAX_FUNC; func++) {
+                uint16_t vendor_id = pci_config_read16(bus, dev, func, PCI_VID_REG);
+                uint8_t  hdr_type  = pci_config_read8 (bus, dev, func, 0x0e);
+                if (vendor_id == 0xffff) {
+                    // Break out if no device is present.
+                    if (func == 0) {
+                        break;
+                    }
+                    continue;
+                }
+                uint16_t device_id = pci_config_read16(bus, dev, func, PCI_DID_REG);
+                if (vendor_id == PCI_VID_INTEL && is_supported(device_id)) {
+                    uintptr_t base_addr = pci_config_read32(bus, dev, func, 0x10);
+                    if (base_addr & 0x1) {
+                        continue;  // not in memory space
+                    }
+#if (ARCH_BITS == 64)
+                    if (base_addr & 0x4) {
+                        base_addr += (uintptr_t)pci_config_read32(bus, dev, func, 0x14) << 32;
+                    }
+#endif
+                    // Set the memory space and bus master flags in case the BIOS hasn't.
+                    uint16_t pci_command = pci_config_read16(bus, dev, func, 0x04);
+                    pci_config_write16(bus, dev, func, 0x04, pci_command | 0x0006);
+
+                    return base_addr & ~(uintptr_t)0xf;
+                }
+                // Break out if this is a single function device.
+                if (func == 0 && (hdr_type & 0x80) == 0) {
+                    break;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+bool e1000_init(uint8_t mac[6], int max_link_time)
+{
+    if (ws != NULL) {
+        return false;
+    }
+
+    uintptr_t base_addr = find_controller();
+    if (base_addr == 0) {
+        return false;
+    }
+    regs_base = map_region(base_addr, MMIO_SIZE, false);
+    if (regs_base == 0) {
+        return false;
+    }
+
+    // Reset the controller and mask all its interrupts. The reset reloads the
+    // station address from the EEPROM.
+    write_reg(E1000_IMC, 0xffffffff);
+    write_reg(E1000_CTRL, read_reg(E1000_CTRL) | E1000_CTRL_RST);
+    usleep(10*MILLISEC);
+    int timer = 1000;
+    while (read_reg(E1000_CTRL) & E1000_CTRL_RST) {
+        if (timer == 0) return false;
+        usleep(1*MILLISEC);
+        timer--;
+    }
+    write_reg(E1000_IMC, 0xffffffff);
+
+    uint32_t ral = read_reg(E1000_RAL0);
+    uint32_t rah = read_reg(E1000_RAH0);
+    if (~rah & E1000_RAH_AV) {
+        return false;
+    }
+    for (int i = 0; i < 4; i++) {
+        mac[i] = ral >> (8 * i);
+    }
+    mac[4] = rah >> 0;
+    mac[5] = rah >> 8;
+
+    // Allocate and initialise the transmit ring. This needs to be permanently mapped into virtual memory.
+    uintptr_t workspace_addr = heap_alloc(HEAP_TYPE_LM_1, sizeof(workspace_t), PAGE_SIZE);
+    if (workspace_addr == 0) {
+        return false;
+    }
+    ws = (workspace_t *)workspace_addr;
+
+    memset(ws, 0, sizeof(workspace_t));
+
+    for (int i = 0; i < TX_RING_SIZE; i++) {
+        ws->desc[i].buffer_addr = (uintptr_t)ws->buffer[i];
+        ws->desc[i].status      = E1000_TXD_STAT_DD;
+    }
+    tx_tail = 0;
+
+    write_reg(E1000_RCTL,  0);
+    write_reg(E1000_TDBAL, (uintptr_t)ws->desc);
+    write_reg(E1000_TDBAH, (uint64_t)(uintptr_t)ws->desc >> 32);
+    write_reg(E1000_TDLEN, sizeof(ws->desc));
+    write_reg(E1000_TDH,   0);
+    write_reg(E1000_TDT,   0);
+    write_reg(E1000_TIPG,  E1000_TIPG_DEFAULT);
+    write_reg(E1000_TCTL,  E1000_TCTL_EN | E1000_TCTL_PSP | E1000_TCTL_CT | E1000_TCTL_COLD);
+
+    // Bring the link up and wait for auto-negotiation to complete. Frames sent
+    // while the link is down are held until it comes up.
+    write_reg(E1000_CTRL, read_reg(E1000_CTRL) | E1000_CTRL_ASDE | E1000_CTRL_SLU);
+    for (int i = 0; i < max_link_time; i++) {
+        if (read_reg(E1000_STATUS) & E1000_STATUS_LU) break;
+        usleep(1*MILLISEC);
+    }
+
+    return true;
+}
+
+bool e1000_send(const void *frame, int length)
+{
+    if (ws == NULL || length <= 0 || length > TX_BUFFER_SIZE) {
+        return false;
+    }
+
+    tx_desc_t *desc = &ws->desc[tx_tail];
+    if (~desc->status & E1000_TXD_STAT_DD) {
+        return false;
+    }
+
+    memcpy(ws->buffer[tx_tail], frame, length);
+    desc->length = length;
+    desc->cmd    = E1000_TXD_CMD_EOP | E1000_TXD_CMD_IFCS | E1000_TXD_CMD_RS;
+    desc->status = 0;
+
+    tx_tail = (tx_tail + 1) % TX_RING_SIZE;
+    write_reg(E1000_TDT, tx_tail);
+
+    return true;
+}
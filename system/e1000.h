@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef E1000_H
+#define E1000_H
+/**
+ * \file
+ *
+ * Provides a minimal transmit-only driver for the Intel 8254x, 8257x, and
+ * I21x families of Gigabit Ethernet controllers. Received frames are never
+ * accepted, and interrupts are not used.
+ *
+ *//*
+ * Copyright (C) 2024 Memtest86+ contributors.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Looks for a supported network controller, resets it, and enables its
+ * transmitter. Waits for up to the specified time for the Ethernet link to
+ * come up. Must be called after the PCI access support is initialised.
+ *
+ * \param mac           - set to the station address read by the controller
+ *                        from its EEPROM
+ * \param max_link_time - the maximum time to wait, in milliseconds
+ *
+ * \returns
+ * true if a controller was found and successfully initialised, otherwise
+ * false.
+ */
+bool e1000_init(uint8_t mac[6], int max_link_time);
+
+/**
+ * Queues an Ethernet frame for transmission, without waiting. The frame must
+ * include the Ethernet header, but not the frame check sequence, which is
+ * added by the controller. Frames shorter than the Ethernet minimum are
+ * padded by the controller.
+ *
+ * \returns
+ * true if the frame was queued, or false if it was dropped because it was
+ * too long or all the transmit buffers are in use.
+ */
+bool e1000_send(const void *frame, int length);
+
+#endif // E1000_H
@@ -7,6 +7,7 @@
 
 #include "memsize.h"
 #include "pmem.h"
+#include "smp.h"
 
 #include "heap.h"
 
@@ -29,6 +30,8 @@ static heap_t heaps[HEAP_TYPE_LAST] = {
     { .segment = -1, .start = 0, .end = 0 }
 };
 
+static size_t reserved_pages = 0;
+
 //------------------------------------------------------------------------------
 // Private Functions
 //------------------------------------------------------------------------------
@@ -38,6 +41,16 @@ static size_t num_pages(size_t size)
     return (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
 }
 
+static bool is_heap_segment(int segment)
+{
+    for (int i = 0; i < HEAP_TYPE_LAST; i++) {
+        if (heaps[i].segment == segment) {
+            return true;
+        }
+    }
+    return false;
+}
+
 uintptr_t heap_alloc(heap_type_t heap_id, size_t size, uintptr_t alignment)
 {
     const heap_t * heap = &heaps[heap_id];
@@ -49,6 +62,7 @@ uintptr_t heap_alloc(heap_type_t heap_id, size_t size, uintptr_t alignment)
     if (addr < heap->start) {
         return 0;
     }
+    reserved_pages += pm_map[heap->segment].end - addr;
     pm_map[heap->segment].end = addr;
     return addr << PAGE_SHIFT;
 }
@@ -66,9 +80,58 @@ void heap_rewind(heap_type_t heap_id, uintptr_t mark)
 {
     const heap_t * heap = &heaps[heap_id];
     if (heap->segment >= 0 && mark > pm_map[heap->segment].end && mark <= heap->end) {
+        reserved_pages -= mark - pm_map[heap->segment].end;
         pm_map[heap->segment].end = mark;
     }
 }
+
+uint64_t heap_alloc_in_domain(uint32_t proximity_domain_idx, size_t size, uintptr_t alignment)
+{
+    // Search from the top of memory, to leave the low memory for the heaps.
+    for (int i = pm_map_size - 1; i >= 0; i--) {
+        if (is_heap_segment(i)) {
+            continue;
+        }
+#if (ARCH_BITS == 32)
+        if (pm_map[i].end > PAGE_C(4,GB)) {
+            continue;
+        }
+#endif
+        if (pm_map[i].end - pm_map[i].start < num_pages(size)) {
+            continue;
+        }
+        uintptr_t addr = pm_map[i].end - num_pages(size);
+        addr &= ~((alignment - 1) >> PAGE_SHIFT);
+        if (addr < pm_map[i].start) {
+            continue;
+        }
+        // The whole chunk must lie in the target domain.
+        uint64_t start = (uint64_t)addr << PAGE_SHIFT;
+        uint64_t end   = (uint64_t)pm_map[i].end << PAGE_SHIFT;
+        uint32_t domain_idx = 0;
+        uint64_t new_start, new_end;
+        if (num_proximity_domains > 1) {
+            if (!smp_narrow_to_proximity_domain(start, end, &domain_idx, &new_start, &new_end)) {
+                continue;
+            }
+            if (new_start != start || new_end != end) {
+                continue;
+            }
+        }
+        if (domain_idx != proximity_domain_idx) {
+            continue;
+        }
+        reserved_pages += pm_map[i].end - addr;
+        pm_map[i].end = addr;
+        return start;
+    }
+    return 0;
+}
+
+size_t heap_reserved_pages(void)
+{
+    return reserved_pages;
+}
 //------------------------------------------------------------------------------
 // Public Functions
 //------------------------------------------------------------------------------
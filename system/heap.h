@@ -62,4 +62,26 @@ uintptr_t heap_mark(heap_type_t heap_id);
  */
 void heap_rewind(heap_type_t heap_id, uintptr_t mark);
 
+/**
+ * Allocates a chunk of physical memory from the top of a physical memory
+ * segment in the given NUMA proximity domain, other than the segments used
+ * for the heaps. The allocated region will be at least the requested size
+ * with the requested alignment. Unlike the heaps, this memory may be above
+ * 4GB and is not mapped into virtual memory. It can not be freed.
+ *
+ * \param proximity_domain_idx - the target proximity domain.
+ * \param size                 - the requested size in bytes.
+ * \param alignment            - the requested byte alignment (must be a power of 2).
+ *
+ * \returns
+ * On success, the allocated address in physical memory. On failure, 0.
+ */
+uint64_t heap_alloc_in_domain(uint32_t proximity_domain_idx, size_t size, uintptr_t alignment);
+
+/**
+ * Returns the number of pages currently allocated from all the heaps and by
+ * heap_alloc_in_domain(), and so excluded from the memory tests.
+ */
+size_t heap_reserved_pages(void);
+
 #endif // HEAP_H
@@ -8,24 +8,114 @@
 // Released under version 2 of the Gnu Public License.
 // By Chris Brady
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "stddef.h"
 
 #include "boot.h"
 #include "bootparams.h"
 #include "efi.h"
 
+#include "acpi.h"
+#include "cpuid.h"
 #include "io.h"
+#include "msr.h"
+#include "serial.h"
+#include "smp.h"
 
 #include "unistd.h"
 
 #include "hwctrl.h"
 
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define MAX_VARIABLE_NAME_LEN   32      // including the terminating null
+
+// The PM1 control register bits.
+#define PM1_SCI_EN              (1 << 0)
+#define PM1_SLP_TYP_SHIFT       10
+#define PM1_SLP_TYP_MASK        (7 << PM1_SLP_TYP_SHIFT)
+#define PM1_SLP_EN              (1 << 13)
+
+#define NV_VARIABLE_ATTRIBUTES  (EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS)
+
 //------------------------------------------------------------------------------
 // Private Variables
 //------------------------------------------------------------------------------
 
+// The vendor GUID of the UEFI variables saved by read_nv_variable() and
+// write_nv_variable().
+static efi_guid_t               MEMTEST_VARIABLE_GUID = { 0x5e6f4c3b, 0x2a8d, 0x4e71, {0x9c, 0x05, 0x6a, 0x1f, 0xd3, 0x82, 0x47, 0xb9} };
+
 static efi_runtime_services_t   *efi_rs_table = NULL;
 
+// The settings replaced by set_max_performance() for each CPU core.
+static bool                     perf_saved[MAX_CPUS];
+
+static uint32_t                 saved_perf_req_lo[MAX_CPUS];
+static uint32_t                 saved_perf_req_hi[MAX_CPUS];
+static uint32_t                 saved_energy_bias[MAX_CPUS];
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static bool is_intel(void)
+{
+    return cpuid_info.vendor_id.str[0] == 'G';
+}
+
+static bool is_amd(void)
+{
+    return cpuid_info.vendor_id.str[0] == 'A';
+}
+
+static bool has_hwp(void)
+{
+    return is_intel() && cpuid_info.max_cpuid >= 6 && (cpuid_info.dts_pmp & (1 << 7));
+}
+
+static bool has_energy_bias(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    if (!is_intel() || cpuid_info.max_cpuid < 6) {
+        return false;
+    }
+    cpuid(0x6, 0, &eax, &ebx, &ecx, &edx);
+    return ecx & (1 << 3);
+}
+
+static bool has_cppc(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    if (!is_amd() || cpuid_info.max_xcpuid < 0x80000008) {
+        return false;
+    }
+    cpuid(0x80000008, 0, &eax, &ebx, &ecx, &edx);
+    return ebx & (1 << 27);
+}
+
+static void enter_sleep_state(uint16_t port, uint16_t slp_typ)
+{
+    uint16_t value = inw(port) & ~(PM1_SLP_TYP_MASK | PM1_SLP_EN);
+    outw(value | (slp_typ << PM1_SLP_TYP_SHIFT) | PM1_SLP_EN, port);
+}
+
+static void make_variable_name(efi_char16_t *buffer, const char *name)
+{
+    int i = 0;
+    while (name[i] != '\0' && i < MAX_VARIABLE_NAME_LEN - 1) {
+        buffer[i] = name[i];
+        i++;
+    }
+    buffer[i] = 0;
+}
+
 //------------------------------------------------------------------------------
 // Public Functions
 //------------------------------------------------------------------------------
@@ -52,8 +142,119 @@ void hwctrl_init(void)
 #endif
 }
 
+void set_max_performance(int my_cpu)
+{
+    uint32_t lo, hi;
+
+    if (has_hwp()) {
+        rdmsr(MSR_IA32_PM_ENABLE, lo, hi);
+        if (lo & 1) {
+            rdmsr(MSR_IA32_HWP_REQUEST, saved_perf_req_lo[my_cpu], saved_perf_req_hi[my_cpu]);
+            rdmsr(MSR_IA32_HWP_CAPABILITIES, lo, hi);
+            uint32_t highest = lo & 0xff;
+            // Minimum and maximum performance at the highest level, energy
+            // performance preference 0 (performance), desired performance 0
+            // (autonomous selection within that range).
+            wrmsr(MSR_IA32_HWP_REQUEST, highest | highest << 8, saved_perf_req_hi[my_cpu]);
+            perf_saved[my_cpu] = true;
+        }
+    } else if (has_cppc()) {
+        rdmsr(MSR_AMD_CPPC_ENABLE, lo, hi);
+        if (lo & 1) {
+            rdmsr(MSR_AMD_CPPC_REQ, saved_perf_req_lo[my_cpu], saved_perf_req_hi[my_cpu]);
+            rdmsr(MSR_AMD_CPPC_CAP1, lo, hi);
+            uint32_t highest = lo & 0xff;
+            // Same layout as the Intel HWP request.
+            wrmsr(MSR_AMD_CPPC_REQ, highest | highest << 8, saved_perf_req_hi[my_cpu]);
+            perf_saved[my_cpu] = true;
+        }
+    }
+    if (has_energy_bias()) {
+        rdmsr(MSR_IA32_ENERGY_PERF_BIAS, saved_energy_bias[my_cpu], hi);
+        wrmsr(MSR_IA32_ENERGY_PERF_BIAS, saved_energy_bias[my_cpu] & ~0xf, hi);
+        perf_saved[my_cpu] = true;
+    }
+}
+
+void restore_performance(int my_cpu)
+{
+    uint32_t lo, hi;
+
+    if (!perf_saved[my_cpu]) {
+        return;
+    }
+    if (has_hwp()) {
+        rdmsr(MSR_IA32_PM_ENABLE, lo, hi);
+        if (lo & 1) {
+            wrmsr(MSR_IA32_HWP_REQUEST, saved_perf_req_lo[my_cpu], saved_perf_req_hi[my_cpu]);
+        }
+    } else if (has_cppc()) {
+        rdmsr(MSR_AMD_CPPC_ENABLE, lo, hi);
+        if (lo & 1) {
+            wrmsr(MSR_AMD_CPPC_REQ, saved_perf_req_lo[my_cpu], saved_perf_req_hi[my_cpu]);
+        }
+    }
+    if (has_energy_bias()) {
+        rdmsr(MSR_IA32_ENERGY_PERF_BIAS, lo, hi);
+        wrmsr(MSR_IA32_ENERGY_PERF_BIAS, (lo & ~0xf) | (saved_energy_bias[my_cpu] & 0xf), hi);
+    }
+    perf_saved[my_cpu] = false;
+}
+
+bool read_core_clock_counters(uint64_t *aperf, uint64_t *mperf)
+{
+    uint32_t eax, ebx, ecx, edx;
+    uint32_t lo, hi;
+
+    if (cpuid_info.max_cpuid < 6) {
+        return false;
+    }
+    cpuid(0x6, 0, &eax, &ebx, &ecx, &edx);
+    if (!(ecx & 1)) {
+        return false;
+    }
+    rdmsr(MSR_IA32_MPERF, lo, hi);
+    *mperf = (uint64_t)hi << 32 | lo;
+    rdmsr(MSR_IA32_APERF, lo, hi);
+    *aperf = (uint64_t)hi << 32 | lo;
+    return true;
+}
+
+bool read_nv_variable(const char *name, void *data, uintptr_t size)
+{
+    if (efi_rs_table == NULL) {
+        return false;
+    }
+    efi_char16_t var_name[MAX_VARIABLE_NAME_LEN];
+    make_variable_name(var_name, name);
+
+    uint32_t attributes = 0;
+    uintn_t  data_size  = size;
+    efi_status_t status = efi_rs_table->get_variable(var_name, &MEMTEST_VARIABLE_GUID, &attributes, &data_size, data);
+    return status == EFI_SUCCESS && data_size == size;
+}
+
+bool write_nv_variable(const char *name, const void *data, uintptr_t size)
+{
+    if (efi_rs_table == NULL) {
+        return false;
+    }
+    efi_char16_t var_name[MAX_VARIABLE_NAME_LEN];
+    make_variable_name(var_name, name);
+
+    efi_status_t status = efi_rs_table->set_variable(var_name, &MEMTEST_VARIABLE_GUID, NV_VARIABLE_ATTRIBUTES, size, (void *)data);
+    return status == EFI_SUCCESS;
+}
+
 void reboot(void)
 {
+    // Put back what we changed on this core. A hard reset reinitialises
+    // the other cores' settings.
+    restore_performance(smp_my_cpu_num());
+
+    // Make sure the serial console has received everything we sent.
+    tty_xmit_flush();
+
     // Use cf9 method as first try
     uint8_t cf9 = inb(0xcf9) & ~6;
     outb(cf9|2, 0xcf9); // Request hard reset
@@ -77,6 +278,36 @@ void reboot(void)
     }
 }
 
+void power_off(void)
+{
+    restore_performance(smp_my_cpu_num());
+
+    tty_xmit_flush();
+
+    // If we have UEFI, try EFI reset service
+    if (efi_rs_table != NULL) {
+        efi_rs_table->reset_system(EFI_RESET_SHUTDOWN, 0, 0);
+        usleep(1000000);
+    }
+
+    // Still here? try entering the ACPI S5 state
+    if (acpi_config.s5_valid) {
+        // The sleep state is ignored until the firmware hands control of
+        // the power management hardware over to ACPI.
+        if ((inw(acpi_config.pm1a_cnt) & PM1_SCI_EN) == 0 && acpi_config.smi_cmd != 0 && acpi_config.acpi_enable != 0) {
+            outb(acpi_config.acpi_enable, acpi_config.smi_cmd);
+            for (int i = 0; i < 300 && (inw(acpi_config.pm1a_cnt) & PM1_SCI_EN) == 0; i++) {
+                usleep(10000);
+            }
+        }
+        enter_sleep_state(acpi_config.pm1a_cnt, acpi_config.slp_typa);
+        if (acpi_config.pm1b_cnt != 0) {
+            enter_sleep_state(acpi_config.pm1b_cnt, acpi_config.slp_typb);
+        }
+        usleep(1000000);
+    }
+}
+
 void floppy_off()
 {
     // Stop the floppy motor.
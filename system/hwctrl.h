@@ -10,16 +10,66 @@
  * Copyright (C) 2020-2022 Martin Whitaker.
  */
 
+#include <stdbool.h>
+#include <stdint.h>
+
 /**
  * Initialises the hardware control interface.
  */
 void hwctrl_init(void);
 
 /**
- * Reboots the machine.
+ * Asks the CPU core running this function to run at its highest performance
+ * level, using HWP and the energy/performance bias on Intel CPUs or CPPC on
+ * AMD CPUs, and saves the previous settings. Only changes the settings if
+ * the firmware has already enabled HWP or CPPC.
+ */
+void set_max_performance(int my_cpu);
+
+/**
+ * Restores the settings saved by set_max_performance() for the CPU core
+ * running this function.
+ */
+void restore_performance(int my_cpu);
+
+/**
+ * Reads the APERF and MPERF counters of the CPU core running this function.
+ * Returns false if the CPU doesn't have them. The ratio of the increments
+ * of the two counters gives the average core clock frequency as a multiple
+ * of the rated frequency while the core was not halted.
+ */
+bool read_core_clock_counters(uint64_t *aperf, uint64_t *mperf);
+
+/**
+ * Reads the UEFI variable with the specified name into the data buffer.
+ * Returns false if the machine wasn't booted through UEFI, if the variable
+ * doesn't exist, or if it doesn't hold exactly the specified number of bytes.
+ */
+bool read_nv_variable(const char *name, void *data, uintptr_t size);
+
+/**
+ * Writes the specified data to the non-volatile UEFI variable with the
+ * specified name, creating it if necessary. Returns false if the machine
+ * wasn't booted through UEFI or the firmware failed to write the variable.
+ * Each write may take several milliseconds and wears the firmware's flash
+ * memory, so this should only be used occasionally.
+ */
+bool write_nv_variable(const char *name, const void *data, uintptr_t size);
+
+/**
+ * Reboots the machine. Restores the settings saved by set_max_performance()
+ * for the CPU core running this function first.
  */
 void reboot(void);
 
+/**
+ * Powers off the machine, using the UEFI reset service if the machine was
+ * booted through UEFI, or else by entering the ACPI soft off state. Restores
+ * the settings saved by set_max_performance() for the CPU core running this
+ * function first. Returns if the machine couldn't be powered off.
+ */
+void power_off(void);
+
 /**
  * Turns off the floppy motor.
  */
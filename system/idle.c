@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpuid.h"
+
+#include "idle.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define CPUID_MWAIT_LEAF    0x05
+
+#define MAX_CSTATES         8       // the sub-state counts for C0 to C7 are in EDX
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+static int  mwait_hint = -1;    // not yet known
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+// Returns the MWAIT hint for the deepest sub-state of the deepest C-state
+// listed in the MWAIT leaf, or 0 (C1) if the CPU doesn't list any.
+static uint32_t deepest_mwait_hint(void)
+{
+    if (mwait_hint >= 0) {
+        return mwait_hint;
+    }
+    uint32_t hint = 0;
+    if (cpuid_info.max_cpuid >= CPUID_MWAIT_LEAF) {
+        uint32_t eax, ebx, ecx, edx;
+        cpuid(CPUID_MWAIT_LEAF, 0, &eax, &ebx, &ecx, &edx);
+        for (int cstate = 1; cstate < MAX_CSTATES; cstate++) {
+            int num_substates = (edx >> (4 * cstate)) & 0xf;
+            if (num_substates > 0) {
+                hint = (cstate - 1) << 4 | (num_substates - 1);
+            }
+        }
+    }
+    mwait_hint = hint;
+    return hint;
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+bool idle_wait_sleeps(void)
+{
+    return cpuid_info.flags.mon;
+}
+
+void idle_wait(const volatile uint32_t *addr, uint32_t value)
+{
+    if (cpuid_info.flags.mon) {
+        uint32_t hint = deepest_mwait_hint();
+        // Arm the monitor before checking the word, so a write between the
+        // check and the MWAIT still wakes us.
+        while (*addr == value) {
+            __asm__ __volatile__ ("monitor" : : "a" (addr), "c" (0), "d" (0));
+            if (*addr == value) {
+                __asm__ __volatile__ ("mwait" : : "a" (hint), "c" (0));
+            }
+        }
+    } else {
+        while (*addr == value) {
+            __builtin_ia32_pause();
+        }
+    }
+}
@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef IDLE_H
+#define IDLE_H
+/**
+ * \file
+ *
+ * Provides a way for a CPU core to sleep in a deep C-state until another CPU
+ * core wakes it. The tests run with interrupts disabled, so a core can't use
+ * a timer interrupt to wake itself. Instead one core keeps time and the cores
+ * that are idle sleep in MONITOR/MWAIT until it writes to a shared word.
+ *
+ *//*
+ * Copyright (C) 2024 Memtest86+ contributors.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Returns true if idle_wait() sleeps, or false if it can only spin because
+ * the CPU doesn't support MONITOR/MWAIT.
+ */
+bool idle_wait_sleeps(void);
+
+/**
+ * Waits until the value of the word at addr differs from value. Sleeps in the
+ * deepest C-state the CPU advertises for MWAIT if idle_wait_sleeps() is true,
+ * otherwise spins in a PAUSE loop.
+ */
+void idle_wait(const volatile uint32_t *addr, uint32_t value);
+
+#endif // IDLE_H
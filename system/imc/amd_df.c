@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+//
+// ------------------------
+//
+// DRAM traffic counting for AMD Zen 2 and Zen 3 CPUs, using the Data Fabric
+// performance counters. The fabric counts the 64-byte transfers to and from
+// each DRAM channel, with the reads and writes counted together.
+//
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpuid.h"
+#include "cpuinfo.h"
+#include "memctrl.h"
+#include "msr.h"
+
+#include "imc.h"
+
+#define MSR_DF_PERF_CTL         0xC0010240      // the control for counter n is at 2n, the count at 2n+1
+
+#define DF_NUM_COUNTERS         4
+#define DF_COUNTER_MASK         0xFFFFFFFFFFFF  // 48 bits
+
+#define DF_CTL_ENABLE           (1 << 22)
+
+// The "DRAM channel data" event for channel n. There are two client channels.
+#define DF_EVENT_CHANNEL(n)     (0x07 + 0x40 * (n))
+#define DF_UMASK_CHANNEL        0x38
+
+#define DF_NUM_CHANNELS         2
+
+#define CPUID_PERFCTR_EXT_DF    (1 << 24)       // in the ECX extended feature flags
+
+#define CACHE_LINE_SIZE         64
+
+static uint64_t     last_count[MAX_TRAFFIC_COUNTERS];
+
+static uint64_t read_counter(int n)
+{
+    uint32_t low, high;
+    rdmsr(MSR_DF_PERF_CTL + 2 * n + 1, low, high);
+    return ((uint64_t)high << 32 | low) & DF_COUNTER_MASK;
+}
+
+void init_traffic_amd_df(void)
+{
+    // The event encodings are only known for Zen 2 and Zen 3.
+    if (imc.family == IMC_K17 && cpuid_info.version.extendedModel < 3) return;
+
+    uint32_t reg[4];
+    cpuid(0x80000001, 0, &reg[0], &reg[1], &reg[2], &reg[3]);
+    if (!(reg[2] & CPUID_PERFCTR_EXT_DF)) return;
+
+    for (int n = 0; n < DF_NUM_CHANNELS && n < DF_NUM_COUNTERS; n++) {
+        wrmsr(MSR_DF_PERF_CTL + 2 * n, 0, 0);
+        wrmsr(MSR_DF_PERF_CTL + 2 * n, DF_CTL_ENABLE | DF_UMASK_CHANNEL << 8 | DF_EVENT_CHANNEL(n), 0);
+        last_count[n] = read_counter(n);
+    }
+
+    dram_traffic.num_counters = DF_NUM_CHANNELS;
+    dram_traffic.per_channel  = true;
+    dram_traffic.combined     = true;
+}
+
+void poll_traffic_amd_df(void)
+{
+    for (int n = 0; n < dram_traffic.num_counters; n++) {
+        uint64_t count = read_counter(n);
+        dram_traffic.read_bytes[n] += ((count - last_count[n]) & DF_COUNTER_MASK) * CACHE_LINE_SIZE;
+        last_count[n] = count;
+    }
+}
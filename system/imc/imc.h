@@ -25,6 +25,19 @@ void get_imc_config_intel_icl(void);
 /* Memory configuration Detection for Intel Alder Lake */
 void get_imc_config_intel_adl(void);
 
+/**
+ * Physical address decoding for various IMCs
+ */
+
+/* Reads the MAD registers at mad_base for the Intel IMCs from Ice Lake on */
+void read_mad_intel(uintptr_t mad_base, int mc);
+
+/* Decodes an address using the MAD registers previously read */
+bool decode_addr_intel_mad(uint64_t addr, dram_location_t *loc);
+
+/* Returns the channel interleave granule in bytes from the MAD registers, or 0 if unknown */
+uintptr_t interleave_size_intel_mad(void);
+
 /**
  * ECC Polling Code for various IMCs
  */
@@ -32,4 +45,32 @@ void get_imc_config_intel_adl(void);
 /* ECC Polling Code for AMD Zen CPUs */
 void poll_ecc_amd_zen(bool report);
 
+/* ECC Polling Setup for Intel CPUs, using the machine check banks */
+void init_ecc_intel_mca(void);
+
+/* ECC Polling Code for Intel CPUs, using the machine check banks */
+void poll_ecc_intel_mca(bool report);
+
+/* ECC Interrupt Setup for Intel CPUs, signalling CMCI as NMI */
+void enable_cmci_intel_mca(void);
+
+/* ECC Interrupt Capture for Intel CPUs, called by the NMI handler */
+bool capture_cmci_intel_mca(void);
+
+/**
+ * DRAM Traffic Counting Code for various IMCs
+ */
+
+/* DRAM Traffic Counting Setup for Intel client CPUs, using the MCHBAR counters */
+void init_traffic_intel_uncore(void);
+
+/* DRAM Traffic Counting Update for Intel client CPUs */
+void poll_traffic_intel_uncore(void);
+
+/* DRAM Traffic Counting Setup for AMD Zen 2 & Zen 3 CPUs, using the Data Fabric counters */
+void init_traffic_amd_df(void);
+
+/* DRAM Traffic Counting Update for AMD Zen 2 & Zen 3 CPUs */
+void poll_traffic_amd_df(void);
+
 #endif /* _IMC_H_ */
@@ -18,6 +18,7 @@
 #define ICL_MMR_BASE_REG_HIGH   0x4C
 #define ICL_MMR_TIMINGS         0x4000
 #define ICL_MMR_TIMING_CAS      0x4070
+#define ICL_MMR_MAD_BASE        0x5000
 #define ICL_MMR_MAD_CHAN0       0x500C
 #define ICL_MMR_MAD_CHAN1       0x5010
 #define ICL_MMR_DRAM_CLOCK      0x5E00
@@ -85,6 +86,9 @@ void get_imc_config_intel_icl(void)
     // Define offset (ie: which channel is really used)
     offset = reg0 ? 0x0000 : 0x0400;
 
+    // Save the address map for decoding error addresses
+    read_mad_intel(mchbar_addr + ICL_MMR_MAD_BASE, 0);
+
     // CAS Latency (tCAS)
     ptr = (uintptr_t*)(mchbar_addr + offset + ICL_MMR_TIMING_CAS);
     imc.tCL = (*ptr >> 16) & 0x1F;
@@ -0,0 +1,139 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+//
+// ------------------------
+//
+// Physical address decoding for the Intel client IMCs that use the memory
+// address decoder (MAD) register layout introduced with Ice Lake.
+//
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memctrl.h"
+#include "pci.h"
+
+#include "imc.h"
+
+#define MAD_INTER_CHANNEL       0x00
+#define MAD_DIMM_CH0            0x0C
+#define MAD_DIMM_CH1            0x10
+#define MAD_CHANNEL_HASH        0x24
+
+#define HOST_BRIDGE_TOLUD       0xBC
+
+#define MAD_SIZE_SHIFT          29      // sizes are in units of 512MB
+
+//------------------------------------------------------------------------------
+// Types
+//------------------------------------------------------------------------------
+
+typedef struct {
+    bool        valid;
+    int         mc;
+    int         ch_l_map;           // the channel that holds the larger DIMMs
+    uint64_t    ch_s_size;          // size of the smaller channel
+    uint64_t    dimm_l_size[2];     // size of the larger DIMM in each channel
+    int         dimm_l_map[2];      // the slot that holds the larger DIMM
+    bool        hash_enabled;
+    uint64_t    hash_mask;
+    int         intlv_bit;          // the lowest address bit that selects the channel
+    uint64_t    tolud;
+} mad_decoder_t;
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+static mad_decoder_t decoder = { .valid = false };
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static int parity(uint64_t value)
+{
+    value ^= value >> 32;
+    value ^= value >> 16;
+    value ^= value >> 8;
+    value ^= value >> 4;
+    value ^= value >> 2;
+    value ^= value >> 1;
+    return value & 1;
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+void read_mad_intel(uintptr_t mad_base, int mc)
+{
+    uint32_t inter = *(volatile uint32_t *)(mad_base + MAD_INTER_CHANNEL);
+    uint32_t hash  = *(volatile uint32_t *)(mad_base + MAD_CHANNEL_HASH);
+
+    decoder.mc        = mc;
+    decoder.ch_l_map  = (inter >> 4) & 0x1;
+    decoder.ch_s_size = (uint64_t)((inter >> 12) & 0xFF) << MAD_SIZE_SHIFT;
+
+    for (int ch = 0; ch < 2; ch++) {
+        uint32_t dimm = *(volatile uint32_t *)(mad_base + (ch ? MAD_DIMM_CH1 : MAD_DIMM_CH0));
+        uint32_t intra = *(volatile uint32_t *)(mad_base + 0x04 + 4 * ch);
+        decoder.dimm_l_size[ch] = (uint64_t)(dimm & 0x7F) << MAD_SIZE_SHIFT;
+        decoder.dimm_l_map[ch]  = intra & 0x1;
+    }
+
+    decoder.hash_enabled = (hash >> 28) & 0x1;
+    decoder.hash_mask    = (uint64_t)((hash >> 6) & 0x3FFF) << 6;
+    decoder.intlv_bit    = ((hash >> 24) & 0x7) + 6;
+
+    decoder.tolud = pci_config_read32(0, 0, 0, HOST_BRIDGE_TOLUD) & 0xFFF00000;
+
+    decoder.valid = (decoder.dimm_l_size[0] != 0 || decoder.dimm_l_size[1] != 0);
+}
+
+bool decode_addr_intel_mad(uint64_t addr, dram_location_t *loc)
+{
+    if (!decoder.valid) {
+        return false;
+    }
+
+    // Remove the PCI hole, which the BIOS remaps above 4GB.
+    if (addr >= 0x100000000ULL && decoder.tolud != 0) {
+        addr -= 0x100000000ULL - decoder.tolud;
+    }
+
+    // Below twice the size of the smaller channel, the channels are
+    // interleaved. Above that, everything is in the larger channel.
+    int      channel;
+    uint64_t ch_addr;
+    if (addr < 2 * decoder.ch_s_size) {
+        channel = (addr >> decoder.intlv_bit) & 0x1;
+        if (decoder.hash_enabled) {
+            channel ^= parity(addr & decoder.hash_mask);
+        }
+        uint64_t low_mask = ((uint64_t)1 << decoder.intlv_bit) - 1;
+        ch_addr = ((addr >> 1) & ~low_mask) | (addr & low_mask);
+    } else {
+        channel = decoder.ch_l_map;
+        ch_addr = addr - decoder.ch_s_size;
+    }
+
+    // The larger DIMM occupies the bottom of the channel address space.
+    int dimm = decoder.dimm_l_map[channel];
+    if (ch_addr >= decoder.dimm_l_size[channel]) {
+        dimm ^= 1;
+    }
+
+    loc->mc      = decoder.mc;
+    loc->channel = channel;
+    loc->dimm    = dimm;
+    return true;
+}
+
+uintptr_t interleave_size_intel_mad(void)
+{
+    if (!decoder.valid || decoder.ch_s_size == 0) {
+        return 0;
+    }
+    return (uintptr_t)1 << decoder.intlv_bit;
+}
@@ -0,0 +1,248 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+//
+// ------------------------
+//
+// ECC error reporting for Intel CPUs. The IMCs log corrected and uncorrected
+// DRAM errors in the architectural machine check banks, along with the
+// physical address when it is known. If the CPU supports it, corrected
+// errors are also signalled by a CMCI, which we deliver as an NMI so the
+// error can be captured when it happens rather than at the next poll.
+//
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "error.h"
+
+#include "cpuid.h"
+#include "memctrl.h"
+#include "msr.h"
+#include "smp.h"
+#include "tsc.h"
+
+#include "imc.h"
+
+#define MCA_MAX_BANKS           32
+#define MCA_BANK_STRIDE         4
+
+#define MCG_CAP_CMCI_P          (1 << 10)
+
+// Bits in the high half of IA32_MCi_STATUS.
+#define MCA_STATUS_VAL          (1U << 31)
+#define MCA_STATUS_UC           (1U << 29)
+#define MCA_STATUS_MISCV        (1U << 27)
+#define MCA_STATUS_ADDRV        (1U << 26)
+
+// Bits in IA32_MCi_CTL2.
+#define MCA_CTL2_CMCI_EN        (1U << 30)
+#define MCA_CTL2_THRESHOLD      0x7FFF
+
+// Compound error codes 0000 0000 1MMM CCCC are memory controller errors,
+// where CCCC is the channel number (or 0xF if unknown).
+#define MCA_MC_ERROR_MASK       0xFF80
+#define MCA_MC_ERROR_CODE       0x0080
+
+// Must be a power of 2.
+#define CMCI_RING_SIZE          32
+
+typedef struct {
+    uint32_t    status_l;
+    uint32_t    status_h;
+    uint64_t    addr;
+    uint64_t    tsc;
+} mca_event_t;
+
+static int num_mca_banks = 0;
+
+static bool cmci_enabled = false;
+
+static int cmci_cpu = 0;
+
+static uint32_t cmci_banks = 0;
+
+static volatile bool cmci_missed = false;
+
+// Written by the NMI handler on cmci_cpu, read by whichever CPU polls.
+static mca_event_t cmci_ring[CMCI_RING_SIZE];
+
+static volatile uint32_t cmci_head = 0;
+static volatile uint32_t cmci_tail = 0;
+
+// Reads and clears the error logged in the bank, if it is a memory controller
+// error. Returns false if there is no such error.
+static bool read_bank(int bank, mca_event_t *event)
+{
+    uint32_t status_msr = MSR_IA32_MC0_STATUS + bank * MCA_BANK_STRIDE;
+    uint32_t regl, regh;
+
+    rdmsr(status_msr, regl, regh);
+    if (!(regh & MCA_STATUS_VAL) || (regl & MCA_MC_ERROR_MASK) != MCA_MC_ERROR_CODE) {
+        return false;
+    }
+    event->status_l = regl;
+    event->status_h = regh;
+
+    event->addr = 0;
+    if (regh & MCA_STATUS_ADDRV) {
+        uint32_t addrl, addrh;
+        rdmsr(MSR_IA32_MC0_ADDR + bank * MCA_BANK_STRIDE, addrl, addrh);
+        event->addr = (uint64_t)addrh << 32 | addrl;
+
+        // Clear the address bits below the recoverable address LSB.
+        if (regh & MCA_STATUS_MISCV) {
+            uint32_t miscl, misch;
+            rdmsr(MSR_IA32_MC0_MISC + bank * MCA_BANK_STRIDE, miscl, misch);
+            event->addr &= ~0ULL << (miscl & 0x3F);
+        }
+    }
+
+    // Clear Error
+    wrmsr(status_msr, 0, 0);
+
+    return true;
+}
+
+static void report_event(const mca_event_t *event)
+{
+    ecc_status.type     = (event->status_h & MCA_STATUS_UC) ? ECC_ERR_UNCORRECTED : ECC_ERR_CORRECTED;
+    ecc_status.addr     = event->addr;
+    ecc_status.channel  = event->status_l & 0xF;
+    ecc_status.syndrome = event->status_l >> 16;   // the model-specific error code
+    ecc_status.core     = 0;
+    ecc_status.tsc      = event->tsc;
+
+    // Corrected error count, in bits 52:38.
+    ecc_status.count = (event->status_h >> 6) & 0x7FFF;
+    if (!ecc_status.count) ecc_status.count++;
+
+    ecc_error();
+
+    // Clear Internal ECC Error status
+    ecc_status.type     = ECC_ERR_NONE;
+    ecc_status.addr     = 0;
+    ecc_status.count    = 0;
+    ecc_status.core     = 0;
+    ecc_status.channel  = 0;
+    ecc_status.syndrome = 0;
+    ecc_status.tsc      = 0;
+}
+
+void init_ecc_intel_mca(void)
+{
+#if TESTWORD_WIDTH > 32
+    uint32_t regl, regh;
+
+    if (!cpuid_info.flags.mca) {
+        return;
+    }
+
+    rdmsr(MSR_IA32_MCG_CAP, regl, regh);
+    num_mca_banks = regl & 0xFF;
+    if (num_mca_banks > MCA_MAX_BANKS) {
+        num_mca_banks = MCA_MAX_BANKS;
+    }
+    if (num_mca_banks == 0) {
+        return;
+    }
+
+    ecc_status.ecc_enabled = true;
+
+    poll_ecc_intel_mca(false); // Clear any errors logged before we started
+#endif
+}
+
+void enable_cmci_intel_mca(void)
+{
+    uint32_t regl, regh;
+
+    if (num_mca_banks == 0) {
+        return;
+    }
+    rdmsr(MSR_IA32_MCG_CAP, regl, regh);
+    if (!(regl & MCG_CAP_CMCI_P)) {
+        return;
+    }
+
+    // Signal every corrected error. A bank that does not support CMCI
+    // ignores the enable bit, so read it back to see which banks do.
+    cmci_banks = 0;
+    for (int bank = 0; bank < num_mca_banks; bank++) {
+        uint32_t ctl2_msr = MSR_IA32_MC0_CTL2 + bank;
+
+        rdmsr(ctl2_msr, regl, regh);
+        regl = (regl & ~MCA_CTL2_THRESHOLD) | MCA_CTL2_CMCI_EN | 1;
+        wrmsr(ctl2_msr, regl, regh);
+        rdmsr(ctl2_msr, regl, regh);
+        if (regl & MCA_CTL2_CMCI_EN) {
+            cmci_banks |= 1U << bank;
+        }
+    }
+    if (cmci_banks == 0) {
+        return;
+    }
+
+    cmci_cpu = smp_my_cpu_num();
+    __sync_synchronize();
+    cmci_enabled = smp_enable_cmci_nmi();
+}
+
+bool capture_cmci_intel_mca(void)
+{
+    if (!cmci_enabled || smp_my_cpu_num() != cmci_cpu) {
+        return false;
+    }
+
+    bool captured = false;
+    for (int bank = 0; bank < num_mca_banks; bank++) {
+        if (!(cmci_banks & (1U << bank))) {
+            continue;
+        }
+        // If the ring is full, leave the error latched in the bank, where
+        // any later errors are added to its count, and have it polled.
+        uint32_t head = cmci_head;
+        if (head - cmci_tail >= CMCI_RING_SIZE) {
+            cmci_missed = true;
+            break;
+        }
+        mca_event_t *event = &cmci_ring[head % CMCI_RING_SIZE];
+        if (read_bank(bank, event)) {
+            event->tsc = get_tsc();
+            __sync_synchronize();
+            cmci_head = head + 1;
+            captured = true;
+        }
+    }
+    return captured;
+}
+
+void poll_ecc_intel_mca(bool report)
+{
+    // Report the errors captured by the NMI handler.
+    while (cmci_tail != cmci_head) {
+        __sync_synchronize();
+        mca_event_t event = cmci_ring[cmci_tail % CMCI_RING_SIZE];
+        __sync_synchronize();
+        cmci_tail++;
+        if (report) {
+            report_event(&event);
+        }
+    }
+
+    // Poll the banks that do not signal CMCI, or all the banks if the NMI
+    // handler had to leave an error behind.
+    bool poll_all = cmci_missed;
+    cmci_missed = false;
+    for (int bank = 0; bank < num_mca_banks; bank++) {
+        if (cmci_enabled && !poll_all && (cmci_banks & (1U << bank))) {
+            continue;
+        }
+        mca_event_t event;
+        if (read_bank(bank, &event)) {
+            event.tsc = 0;
+            if (report) {
+                report_event(&event);
+            }
+        }
+    }
+}
@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+//
+// ------------------------
+//
+// DRAM traffic counting for the Intel client IMCs. From Sandy Bridge to Rocket
+// Lake, the IMC has a pair of free-running 32-bit counters in the MCHBAR that
+// count the 64-byte reads and writes of all the channels. From Alder Lake on,
+// each memory controller has its own pair of free-running 64-bit counters.
+//
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpuinfo.h"
+#include "memctrl.h"
+#include "memrw.h"
+#include "pci.h"
+#include "vmem.h"
+
+#include "imc.h"
+
+#define MCHBAR_REG_LOW          0x48
+#define MCHBAR_REG_HIGH         0x4C
+
+#define SNB_MCHBAR_WINDOW       (1UL << 15)
+#define SNB_MCHBAR_MASK         0x7FFFFF8000
+#define SNB_DATA_READS          0x5050
+#define SNB_DATA_WRITES         0x5054
+
+#define ADL_MCHBAR_WINDOW       (1UL << 17)
+#define ADL_MCHBAR_MASK         0x3FFFFFE0000
+#define ADL_MC1_OFFSET          0x10000
+#define ADL_DATA_READS          0xD858
+#define ADL_DATA_WRITES         0xD8A0
+
+#define CACHE_LINE_SIZE         64
+
+static uintptr_t    mchbar_addr = 0;
+
+static bool         wide_counters = false;
+
+static uint64_t     last_reads [MAX_TRAFFIC_COUNTERS];
+static uint64_t     last_writes[MAX_TRAFFIC_COUNTERS];
+
+static uint64_t read_counter(int mc, bool writes)
+{
+    if (wide_counters) {
+        uintptr_t reg = mchbar_addr + mc * ADL_MC1_OFFSET + (writes ? ADL_DATA_WRITES : ADL_DATA_READS);
+        // Retry if the low half wraps between the reads of the high half.
+        uint32_t high, low;
+        do {
+            high = read32((volatile uint32_t *)(reg + 4));
+            low  = read32((volatile uint32_t *)reg);
+        } while (read32((volatile uint32_t *)(reg + 4)) != high);
+        return (uint64_t)high << 32 | low;
+    }
+    return read32((volatile uint32_t *)(mchbar_addr + (writes ? SNB_DATA_WRITES : SNB_DATA_READS)));
+}
+
+void init_traffic_intel_uncore(void)
+{
+    wide_counters = (imc.family == IMC_ADL || imc.family == IMC_RPL);
+
+    // The MCHBAR has already been enabled by the IMC configuration code.
+    uint64_t mmio_reg = pci_config_read32(0, 0, 0, MCHBAR_REG_LOW);
+    if (!(mmio_reg & 0x1)) return;
+
+    mmio_reg |= (uint64_t)pci_config_read32(0, 0, 0, MCHBAR_REG_HIGH) << 32;
+    mmio_reg &= wide_counters ? ADL_MCHBAR_MASK : SNB_MCHBAR_MASK;
+
+#ifndef __x86_64__
+    if (mmio_reg >= (1ULL << 32)) return;    // MMIO is outside reachable range (> 32bit)
+#endif
+
+    mchbar_addr = map_region(mmio_reg, wide_counters ? ADL_MCHBAR_WINDOW : SNB_MCHBAR_WINDOW, false);
+    if (mchbar_addr == 0) return;
+
+    dram_traffic.num_counters = wide_counters ? 2 : 1;
+    dram_traffic.per_channel  = false;
+    dram_traffic.combined     = false;
+    for (int mc = 0; mc < dram_traffic.num_counters; mc++) {
+        last_reads [mc] = read_counter(mc, false);
+        last_writes[mc] = read_counter(mc, true);
+    }
+}
+
+void poll_traffic_intel_uncore(void)
+{
+    uint64_t mask = wide_counters ? UINT64_MAX : UINT32_MAX;
+
+    for (int mc = 0; mc < dram_traffic.num_counters; mc++) {
+        uint64_t reads  = read_counter(mc, false);
+        uint64_t writes = read_counter(mc, true);
+        dram_traffic.read_bytes [mc] += ((reads  - last_reads [mc]) & mask) * CACHE_LINE_SIZE;
+        dram_traffic.write_bytes[mc] += ((writes - last_writes[mc]) & mask) * CACHE_LINE_SIZE;
+        last_reads [mc] = reads;
+        last_writes[mc] = writes;
+    }
+}
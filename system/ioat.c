@@ -0,0 +1,426 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpuinfo.h"
+#include "heap.h"
+#include "memrw.h"
+#include "memsize.h"
+#include "pci.h"
+#include "tsc.h"
+#include "vmem.h"
+
+#include "string.h"
+#include "unistd.h"
+
+#include "ioat.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+// Global register offsets
+
+#define IOAT_CHANCNT            0x00            // 8-bit
+#define IOAT_XFERCAP            0x01            // 8-bit, log2 of the maximum transfer size
+#define IOAT_VER                0x08            // 8-bit
+#define IOAT_DMACAP             0x10            // 32-bit
+
+// Channel register offsets, from the start of the channel register space
+
+#define IOAT_CHAN_SPACE(n)      (0x80 * ((n) + 1))
+
+#define IOAT_CHANCTRL           0x00            // 16-bit
+#define IOAT_CHANCMD            0x04            // 8-bit
+#define IOAT_DMACOUNT           0x06            // 16-bit
+#define IOAT_CHANSTS_LO         0x08
+#define IOAT_CHAINADDR_LO       0x10
+#define IOAT_CHAINADDR_HI       0x14
+#define IOAT_CHANCMP_LO         0x18
+#define IOAT_CHANCMP_HI         0x1c
+#define IOAT_CHANERR            0x28
+
+// Register bits
+
+#define IOAT_VER_3_0            0x30
+
+#define IOAT_CAP_FILL_BLOCK     0x00000040
+
+#define IOAT_CHANCTRL_ANY_ERR_ABORT_EN  0x0008
+#define IOAT_CHANCTRL_ERR_COMPLETION_EN 0x0004
+
+#define IOAT_CHANCMD_RESET      0x20
+
+#define IOAT_CHANSTS_STATUS     0x7
+#define IOAT_CHANSTS_DONE       0x1
+#define IOAT_CHANSTS_HALTED     0x3
+#define IOAT_CHANSTS_ADDR       (~(uint64_t)0x3f)
+
+// Descriptor control bits
+
+#define IOAT_CTL_COMPL_WRITE    (1 << 3)
+#define IOAT_CTL_FENCE          (1 << 4)
+#define IOAT_CTL_NULL           (1 << 5)
+#define IOAT_CTL_OP_COPY        (0x00 << 24)
+#define IOAT_CTL_OP_FILL        (0x01 << 24)
+
+// Values specific to this driver.
+
+#define MMIO_SIZE               0x1000          // covers the registers of up to 31 channels
+
+#define MAX_CHANNELS            8
+
+#define RING_SIZE               256             // descriptors (must divide 65536)
+
+#define MAX_XFER_SHIFT          30
+
+#define MILLISEC                1000            // in microseconds
+
+#define RESET_TIMEOUT           100             // milliseconds
+#define WAIT_TIMEOUT            5000            // milliseconds
+
+//------------------------------------------------------------------------------
+// Types
+//------------------------------------------------------------------------------
+
+// DMA descriptor, as defined by the Intel QuickData specification. For the
+// fill operation, the source address holds the pattern.
+
+typedef volatile struct {
+    uint32_t            size;
+    uint32_t            ctl;
+    uint64_t            src_addr;
+    uint64_t            dst_addr;
+    uint64_t            next;
+    uint64_t            reserved[2];
+    uint64_t            user[2];
+} dma_desc_t  __attribute__ ((aligned (64)));
+
+typedef struct {
+    dma_desc_t          desc[RING_SIZE]         __attribute__ ((aligned (PAGE_SIZE)));
+    volatile uint64_t   completion              __attribute__ ((aligned (64)));
+} workspace_t;
+
+typedef struct {
+    uintptr_t           regs_base;
+    workspace_t         *ws;
+    size_t              max_xfer;
+    bool                can_fill;
+    bool                failed;
+    uint16_t            queued;                 // descriptors queued  (modulo 65536)
+    uint16_t            started;                // descriptors started (modulo 65536)
+    uint16_t            completed;              // descriptors completed (modulo 65536)
+} channel_t;
+
+typedef struct {
+    uint16_t            first;
+    uint16_t            last;
+} id_range_t;
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+// The device IDs of the version 3 engines. Each PCI function provides one or
+// more channels.
+static const id_range_t supported_device_id[] = {
+    { 0x3c20, 0x3c27 }, { 0x3c2e, 0x3c2f },     // Sandy Bridge EP
+    { 0x0e20, 0x0e27 }, { 0x0e2e, 0x0e2f },     // Ivy Bridge EP
+    { 0x2f20, 0x2f27 }, { 0x2f2e, 0x2f2f },     // Haswell EP
+    { 0x6f20, 0x6f27 }, { 0x6f2e, 0x6f2f },     // Broadwell EP
+    { 0x6f50, 0x6f53 },                         // Broadwell DE
+    { 0x0c50, 0x0c53 },                         // Avoton
+    { 0x2021, 0x2021 },                         // Skylake SP and later
+    { 0x0b00, 0x0b00 }                          // Ice Lake SP and later
+};
+
+static channel_t        channel[MAX_CHANNELS];
+
+static int              num_channels = 0;
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static uint8_t read_reg8(uintptr_t base, int reg)
+{
+    return read8((volatile uint8_t *)(base + reg));
+}
+
+static void write_reg8(uintptr_t base, int reg, uint8_t value)
+{
+    write8((volatile uint8_t *)(base + reg), value);
+}
+
+static void write_reg16(uintptr_t base, int reg, uint16_t value)
+{
+    write16((volatile uint16_t *)(base + reg), value);
+}
+
+static uint32_t read_reg32(uintptr_t base, int reg)
+{
+    return read32((volatile uint32_t *)(base + reg));
+}
+
+static void write_reg32(uintptr_t base, int reg, uint32_t value)
+{
+    write32((volatile uint32_t *)(base + reg), value);
+}
+
+static void write_reg64(uintptr_t base, int reg, uint64_t value)
+{
+    write32((volatile uint32_t *)(base + reg + 0), (uint32_t)value);
+    write32((volatile uint32_t *)(base + reg + 4), (uint32_t)(value >> 32));
+}
+
+static bool is_supported(uint16_t device_id)
+{
+    for (size_t i = 0; i < sizeof(supported_device_id) / sizeof(supported_device_id[0]); i++) {
+        if (device_id >= supported_device_id[i].first && device_id <= supported_device_id[i].last) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint64_t phys_addr(const volatile void *addr)
+{
+    return (uint64_t)page_of((void *)addr) << PAGE_SHIFT | ((uintptr_t)addr & (PAGE_SIZE - 1));
+}
+
+static int free_descs(const channel_t *ch)
+{
+    return RING_SIZE - 1 - (uint16_t)(ch->queued - ch->completed);
+}
+
+static bool wait_for_completion(channel_t *ch, int timeout)
+{
+    uint64_t last_addr = phys_addr(&ch->ws->desc[(uint16_t)(ch->started - 1) % RING_SIZE]);
+    uint64_t end_time  = get_tsc() + (uint64_t)timeout * clks_per_msec;
+    while (true) {
+        uint64_t status = ch->ws->completion;
+        if ((status & IOAT_CHANSTS_ADDR) == last_addr && (status & IOAT_CHANSTS_STATUS) == IOAT_CHANSTS_DONE) {
+            ch->completed = ch->started;
+            return true;
+        }
+        if ((status & IOAT_CHANSTS_STATUS) == IOAT_CHANSTS_HALTED || get_tsc() > end_time) {
+            ch->failed = true;
+            return false;
+        }
+        __builtin_ia32_pause();
+    }
+}
+
+static dma_desc_t *next_desc(channel_t *ch)
+{
+    dma_desc_t *desc = &ch->ws->desc[ch->queued % RING_SIZE];
+    ch->queued++;
+    return desc;
+}
+
+static bool queue_op(int chan, void *dst, uint64_t src, size_t size, uint32_t op, bool fence)
+{
+    channel_t *ch = &channel[chan];
+    if (ch->failed || free_descs(ch) < (int)((size + ch->max_xfer - 1) / ch->max_xfer)) {
+        return false;
+    }
+
+    uint64_t dst_addr = phys_addr(dst);
+    while (size > 0) {
+        size_t xfer_size = size < ch->max_xfer ? size : ch->max_xfer;
+        dma_desc_t *desc = next_desc(ch);
+        desc->size     = xfer_size;
+        desc->ctl      = op;
+        desc->src_addr = src;
+        desc->dst_addr = dst_addr;
+        if (op == IOAT_CTL_OP_COPY) {
+            src += xfer_size;
+        }
+        dst_addr += xfer_size;
+        size     -= xfer_size;
+        if (size == 0 && fence) {
+            desc->ctl |= IOAT_CTL_FENCE;
+        }
+    }
+    return true;
+}
+
+static bool init_channel(channel_t *ch, uintptr_t regs_base, size_t max_xfer, bool can_fill)
+{
+    ch->regs_base = regs_base;
+    ch->max_xfer  = max_xfer;
+    ch->can_fill  = can_fill;
+
+    write_reg8(regs_base, IOAT_CHANCMD, IOAT_CHANCMD_RESET);
+    int timer = RESET_TIMEOUT;
+    while (read_reg8(regs_base, IOAT_CHANCMD) & IOAT_CHANCMD_RESET) {
+        if (timer == 0) return false;
+        usleep(1*MILLISEC);
+        timer--;
+    }
+    write_reg32(regs_base, IOAT_CHANERR, read_reg32(regs_base, IOAT_CHANERR));
+
+    // The descriptor ring and completion status need to be permanently mapped into virtual memory.
+    uintptr_t workspace_addr = heap_alloc(HEAP_TYPE_HM_1, sizeof(workspace_t), PAGE_SIZE);
+    if (workspace_addr == 0) {
+        return false;
+    }
+    ch->ws = (workspace_t *)workspace_addr;
+
+    memset(ch->ws, 0, sizeof(workspace_t));
+
+    for (int i = 0; i < RING_SIZE; i++) {
+        ch->ws->desc[i].next = phys_addr(&ch->ws->desc[(i + 1) % RING_SIZE]);
+    }
+
+    write_reg16(regs_base, IOAT_CHANCTRL, IOAT_CHANCTRL_ANY_ERR_ABORT_EN | IOAT_CHANCTRL_ERR_COMPLETION_EN);
+    write_reg64(regs_base, IOAT_CHANCMP_LO, phys_addr(&ch->ws->completion));
+    write_reg64(regs_base, IOAT_CHAINADDR_LO, phys_addr(&ch->ws->desc[0]));
+
+    // Start the channel with a null descriptor, which also checks it works.
+    dma_desc_t *desc = next_desc(ch);
+    desc->size = 1;
+    desc->ctl  = IOAT_CTL_NULL | IOAT_CTL_COMPL_WRITE;
+    ch->started = ch->queued;
+    write_reg16(regs_base, IOAT_DMACOUNT, ch->started);
+
+    return wait_for_completion(ch, RESET_TIMEOUT);
+}
+
+// Initialises the channels of the engine with the given register space,
+// while there are free channel slots.
+static void init_engine(uintptr_t base_addr)
+{
+    uintptr_t regs_base = map_region(base_addr, MMIO_SIZE, false);
+    if (regs_base == 0) {
+        return;
+    }
+    if (read_reg8(regs_base, IOAT_VER) < IOAT_VER_3_0) {
+        return;
+    }
+    int xfer_shift = read_reg8(regs_base, IOAT_XFERCAP) & 0x1f;
+    if (xfer_shift < PAGE_SHIFT) {
+        return;
+    }
+    if (xfer_shift > MAX_XFER_SHIFT) {
+        xfer_shift = MAX_XFER_SHIFT;
+    }
+    bool can_fill = read_reg32(regs_base, IOAT_DMACAP) & IOAT_CAP_FILL_BLOCK;
+
+    int chan_count = read_reg8(regs_base, IOAT_CHANCNT) & 0x1f;
+    for (int i = 0; i < chan_count && IOAT_CHAN_SPACE(i) < MMIO_SIZE && num_channels < MAX_CHANNELS; i++) {
+        channel_t *ch = &channel[num_channels];
+        if (init_channel(ch, regs_base + IOAT_CHAN_SPACE(i), (size_t)1 << xfer_shift, can_fill)) {
+            num_channels++;
+        } else {
+            memset(ch, 0, sizeof(channel_t));
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+int ioat_init(void)
+{
+    if (num_channels > 0) {
+        return num_channels;
+    }
+
+    for (int bus = 0; bus < PCI_MAX_BUS; bus++) {
+        for (int dev = 0; dev < PCI_MAX_DEV; dev++) {
+            for (int func = 0; func < PCI_MAX_FUNC; func++) {
+                uint16_t vendor_id = pci_config_read16(bus, dev, func, PCI_VID_REG);
+                uint8_t  hdr_type  = pci_config_read8 (bus, dev, func, 0x0e);
+                if (vendor_id == 0xffff) {
+                    // Break out if no device is present.
+                    if (func == 0) {
+                        break;
+                    }
+                    continue;
+                }
+                uint16_t device_id = pci_config_read16(bus, dev, func, PCI_DID_REG);
+                if (vendor_id == PCI_VID_INTEL && is_supported(device_id) && num_channels < MAX_CHANNELS) {
+                    uintptr_t base_addr = pci_config_read32(bus, dev, func, 0x10);
+                    if (base_addr & 0x1) {
+                        continue;  // not in memory space
+                    }
+#if (ARCH_BITS == 64)
+                    if (base_addr & 0x4) {
+                        base_addr += (uintptr_t)pci_config_read32(bus, dev, func, 0x14) << 32;
+                    }
+#else
+                    if ((base_addr & 0x4) && pci_config_read32(bus, dev, func, 0x14) != 0) {
+                        continue;  // not addressable
+                    }
+#endif
+                    // Set the memory space and bus master flags in case the BIOS hasn't.
+                    uint16_t pci_command = pci_config_read16(bus, dev, func, 0x04);
+                    pci_config_write16(bus, dev, func, 0x04, pci_command | 0x0006);
+
+                    init_engine(base_addr & ~(uintptr_t)0xf);
+                }
+                // Break out if this is a single function device.
+                if (func == 0 && (hdr_type & 0x80) == 0) {
+                    break;
+                }
+            }
+        }
+    }
+    return num_channels;
+}
+
+int ioat_num_channels(void)
+{
+    return num_channels;
+}
+
+bool ioat_can_fill(int chan)
+{
+    return channel[chan].can_fill && !channel[chan].failed;
+}
+
+bool ioat_queue_copy(int chan, void *dst, const void *src, size_t size, bool fence)
+{
+    return queue_op(chan, dst, phys_addr(src), size, IOAT_CTL_OP_COPY, fence);
+}
+
+bool ioat_queue_fill(int chan, void *dst, uint64_t pattern, size_t size, bool fence)
+{
+    if (!channel[chan].can_fill) {
+        return false;
+    }
+    return queue_op(chan, dst, pattern, size, IOAT_CTL_OP_FILL, fence);
+}
+
+void ioat_cancel(int chan)
+{
+    channel[chan].queued = channel[chan].started;
+}
+
+void ioat_start(int chan)
+{
+    channel_t *ch = &channel[chan];
+    if (ch->queued == ch->started) {
+        return;
+    }
+    ch->ws->desc[(uint16_t)(ch->queued - 1) % RING_SIZE].ctl |= IOAT_CTL_COMPL_WRITE;
+    ch->started = ch->queued;
+    write_reg16(ch->regs_base, IOAT_DMACOUNT, ch->started);
+}
+
+bool ioat_wait(int chan)
+{
+    channel_t *ch = &channel[chan];
+    if (ch->failed) {
+        return false;
+    }
+    if (ch->completed == ch->started) {
+        return true;
+    }
+    return wait_for_completion(ch, WAIT_TIMEOUT);
+}
@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef IOAT_H
+#define IOAT_H
+/**
+ * \file
+ *
+ * Provides a minimal polled driver for the Intel QuickData (I/OAT version 3)
+ * DMA engines found in Xeon server platforms. Each channel can copy or fill
+ * memory without using a CPU core, so the memory tests can use it to move
+ * some of the data while the CPU cores work on other data.
+ *
+ * A channel must only be used by one CPU core at a time. Descriptors are
+ * queued, then started, then waited for. Interrupts are not used.
+ *
+ *//*
+ * Copyright (C) 2024 Memtest86+ contributors.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Looks for the supported DMA engines, and resets and initialises up to a
+ * fixed maximum number of channels. Must be called after the PCI access
+ * support and the heaps are initialised.
+ *
+ * \returns
+ * The number of channels that are ready for use.
+ */
+int ioat_init(void);
+
+/**
+ * Returns the number of channels initialised by ioat_init().
+ */
+int ioat_num_channels(void);
+
+/**
+ * Returns true if the channel supports the fill operation.
+ */
+bool ioat_can_fill(int chan);
+
+/**
+ * Queues a copy of 'size' bytes from 'src' to 'dst', without starting it.
+ * The source and destination must not overlap, and must each lie in memory
+ * that is physically contiguous and currently mapped. If 'fence' is true,
+ * later operations on the channel wait for this one to complete.
+ *
+ * \returns
+ * true if the copy was queued, or false if the channel has failed or there
+ * is not enough free space in its descriptor ring.
+ */
+bool ioat_queue_copy(int chan, void *dst, const void *src, size_t size, bool fence);
+
+/**
+ * Queues a fill of 'size' bytes at 'dst' with the repeated 64-bit 'pattern',
+ * without starting it. The same conditions apply as for ioat_queue_copy().
+ */
+bool ioat_queue_fill(int chan, void *dst, uint64_t pattern, size_t size, bool fence);
+
+/**
+ * Discards the operations queued since the last call to ioat_start().
+ */
+void ioat_cancel(int chan);
+
+/**
+ * Starts the queued operations.
+ */
+void ioat_start(int chan);
+
+/**
+ * Waits for the started operations to complete.
+ *
+ * \returns
+ * true if they all completed successfully, or false if the channel halted
+ * with an error or timed out. In the latter case the channel is disabled,
+ * and the contents of the destination memory are undefined.
+ */
+bool ioat_wait(int chan);
+
+#endif // IOAT_H
@@ -8,6 +8,7 @@
 #include "io.h"
 #include "usbhcd.h"
 
+#include "screen.h"
 #include "serial.h"
 
 #include "keyboard.h"
@@ -239,6 +240,9 @@ void keyboard_init(void)
 
 char get_key(void)
 {
+    // Make sure anything displayed while waiting for a key is visible.
+    update_screen();
+
     if (keyboard_types & KT_USB) {
         uint8_t c = get_usb_keycode();
         if (c > 0 && c < sizeof(usb_hid_keymap)) {
@@ -271,6 +275,7 @@ char get_key(void)
     }
 
     if (enable_tty) {
+        tty_xmit_poll();
         uint8_t c = tty_get_key();
         if (c != 0xFF) {
             if (c == 0x0D) c = '\n'; // Enter
@@ -8,7 +8,10 @@
 
 #include <stdbool.h>
 
+#include "spinlock.h"
+
 #include "config.h"
+#include "cpuid.h"
 #include "cpuinfo.h"
 
 #include "memctrl.h"
@@ -18,7 +21,11 @@
 
 imc_info_t imc = {"UNDEF", 0, 0, 0, 0, 0, 0, 0, 0};
 
-ecc_info_t ecc_status = {false, ECC_ERR_NONE, 0, 0, 0, 0};
+ecc_info_t ecc_status = {false, ECC_ERR_NONE, 0, 0, 0, 0, 0, 0};
+
+dram_traffic_t dram_traffic;
+
+static spinlock_t traffic_lock = false;
 
 // ---------------------
 // -- Public function --
@@ -61,12 +68,110 @@ void memctrl_init(void)
         break;
     }
 
+    // Count the DRAM traffic, where the memory controller's counters are known.
+    dram_traffic.num_counters = 0;
+    switch(imc.family) {
+      case IMC_K17:
+      case IMC_K19_VRM:
+        init_traffic_amd_df();
+        break;
+      case IMC_SNB:
+      case IMC_IVB:
+      case IMC_HSW:
+      case IMC_SKL:
+      case IMC_KBL:
+      case IMC_RKL:
+      case IMC_RPL:
+      case IMC_ADL:
+        init_traffic_intel_uncore();
+        break;
+      default:
+        break;
+    }
+
+    // The Intel IMCs report ECC errors through the machine check banks.
+    if (enable_ecc_polling && cpuid_info.vendor_id.str[0] == 'G') {
+        init_ecc_intel_mca();
+    }
+
     // Consistency check
     if (imc.tCL == 0 || imc.tRCD == 0 || imc.tRP == 0 || imc.tRCD == 0) {
         imc.freq = 0;
     }
 }
 
+void memctrl_enable_ecc_interrupts(void)
+{
+    if (ecc_status.ecc_enabled && cpuid_info.vendor_id.str[0] == 'G') {
+        enable_cmci_intel_mca();
+    }
+}
+
+bool memctrl_capture_ecc_interrupt(void)
+{
+    if (ecc_status.ecc_enabled && cpuid_info.vendor_id.str[0] == 'G') {
+        return capture_cmci_intel_mca();
+    }
+    return false;
+}
+
+void memctrl_poll_traffic(void)
+{
+    if (dram_traffic.num_counters == 0) {
+        return;
+    }
+
+    spin_lock(&traffic_lock);
+    if (cpuid_info.vendor_id.str[0] == 'G') {
+        poll_traffic_intel_uncore();
+    } else {
+        poll_traffic_amd_df();
+    }
+    spin_unlock(&traffic_lock);
+}
+
+bool memctrl_decode_addr(uint64_t addr, dram_location_t *loc)
+{
+    loc->mc      = -1;
+    loc->channel = -1;
+    loc->dimm    = -1;
+
+    if (!enable_mch_read) {
+        return false;
+    }
+
+    switch(imc.family) {
+      case IMC_RKL:
+      case IMC_RPL:
+      case IMC_ADL:
+        return decode_addr_intel_mad(addr, loc);
+      default:
+        return false;
+    }
+}
+
+uintptr_t memctrl_interleave_size(void)
+{
+    if (!enable_mch_read) {
+        return 0;
+    }
+
+    switch(imc.family) {
+      case IMC_RKL:
+      case IMC_RPL:
+      case IMC_ADL:
+        return interleave_size_intel_mad();
+      default:
+        return 0;
+    }
+}
+
+uint32_t memctrl_peak_bandwidth(void)
+{
+    // The data rate is in MT/s and the width in bits.
+    return (uint32_t)imc.freq * (imc.width / 8);
+}
+
 void memctrl_poll_ecc(void)
 {
     if (!ecc_status.ecc_enabled) {
@@ -81,6 +186,9 @@ void memctrl_poll_ecc(void)
         poll_ecc_amd_zen(true);
         break;
       default:
+        if (cpuid_info.vendor_id.str[0] == 'G') {
+            poll_ecc_intel_mca(true);
+        }
         break;
     }
 }
@@ -38,8 +38,37 @@ typedef struct __attribute__((packed)) ecc_status {
     uint32_t            count;
     uint16_t            core;
     uint8_t             channel;
+    uint32_t            syndrome;
+    uint64_t            tsc;        // when captured by an interrupt, 0 if polled
 } ecc_info_t;
 
+/**
+ * The location of a physical address in the DRAM. Each field is -1 if it
+ * could not be decoded.
+ */
+typedef struct {
+    int8_t      mc;
+    int8_t      channel;
+    int8_t      dimm;
+} dram_location_t;
+
+/**
+ * The maximum number of DRAM traffic counters.
+ */
+#define MAX_TRAFFIC_COUNTERS    4
+
+/**
+ * The DRAM traffic counted by the memory controller since memctrl_init()
+ * was called, in bytes.
+ */
+typedef struct {
+    int         num_counters;   // 0 if the traffic can't be counted
+    bool        per_channel;    // each counter covers one channel, otherwise one memory controller
+    bool        combined;       // the reads and writes are counted together, in read_bytes
+    uint64_t    read_bytes [MAX_TRAFFIC_COUNTERS];
+    uint64_t    write_bytes[MAX_TRAFFIC_COUNTERS];
+} dram_traffic_t;
+
 /**
  * Current DRAM configuration of the Integrated Memory Controller
  */
@@ -52,8 +81,60 @@ extern imc_info_t imc;
 
 extern ecc_info_t ecc_status;
 
+/**
+ * DRAM traffic counted by the Integrated Memory Controller
+ */
+
+extern dram_traffic_t dram_traffic;
+
 void memctrl_init(void);
 
 void memctrl_poll_ecc(void);
 
+/**
+ * Enables interrupt-driven capture of corrected ECC errors on the calling
+ * CPU core, if the memory controller and local APIC support it. Must be
+ * called after smp_init(). Errors that are not captured this way are still
+ * found by memctrl_poll_ecc().
+ */
+void memctrl_enable_ecc_interrupts(void);
+
+/**
+ * Called from the NMI handler. Captures any ECC errors signalled by an
+ * interrupt into a buffer that is drained by memctrl_poll_ecc(). Returns
+ * true if any errors were captured, meaning the NMI was (at least in part)
+ * an ECC error interrupt.
+ */
+bool memctrl_capture_ecc_interrupt(void);
+
+/**
+ * Updates dram_traffic from the memory controller's performance counters.
+ * Must be called at least once a second, as some of the counters are only
+ * 32 bits wide. May be called on any CPU core.
+ */
+void memctrl_poll_traffic(void);
+
+/**
+ * Decodes the memory controller, channel and DIMM slot that hold the given
+ * physical address, using the address map registers read by memctrl_init().
+ * Returns false if the address could not be decoded for this memory
+ * controller.
+ */
+bool memctrl_decode_addr(uint64_t addr, dram_location_t *loc);
+
+/**
+ * Returns the size in bytes of the blocks of consecutive physical addresses
+ * that the memory controller maps to the same channel before moving on to
+ * the next, as read by memctrl_init(). Returns 0 if this is not known for
+ * this memory controller or if its channels are not interleaved.
+ */
+uintptr_t memctrl_interleave_size(void);
+
+/**
+ * Returns the theoretical peak DRAM bandwidth in MB/s (10^6 bytes per second),
+ * from the data rate and the total width of the populated channels read by
+ * memctrl_init(). Returns 0 if these are not known.
+ */
+uint32_t memctrl_peak_bandwidth(void);
+
 #endif // MEMCTRL_H
@@ -4,7 +4,7 @@
 /**
  * \file
  *
- * Provides some 32/64-bit memory access functions. These stop the compiler
+ * Provides some 8/16/32/64-bit memory access functions. These stop the compiler
  * optimizing accesses which need to be ordered and atomic. Mostly used
  * for accessing memory-mapped hardware registers.
  *
@@ -15,11 +15,20 @@
 
 #include <stdint.h>
 
+#define __MEMRW_SUFFIX_8BIT  "b"
+#define __MEMRW_SUFFIX_16BIT "w"
 #define __MEMRW_SUFFIX_32BIT "l"
 #define __MEMRW_SUFFIX_64BIT "q"
+// Only some registers can hold a byte in 32-bit mode.
+#define __MEMRW_REG_8BIT  "q"
+#define __MEMRW_REG_16BIT "r"
+#define __MEMRW_REG_32BIT "r"
+#define __MEMRW_REG_64BIT "r"
+
 #define __MEMRW_READ_INSTRUCTIONS(bitwidth) "mov" __MEMRW_SUFFIX_##bitwidth##BIT " %1, %0"
 #define __MEMRW_WRITE_INSTRUCTIONS(bitwidth) "mov" __MEMRW_SUFFIX_##bitwidth##BIT " %1, %0"
 #define __MEMRW_FLUSH_INSTRUCTIONS(bitwidth) "mov" __MEMRW_SUFFIX_##bitwidth##BIT " %1, %0; mov" __MEMRW_SUFFIX_##bitwidth##BIT " %0, %1"
+#define __MEMRW_WRITE_NT_INSTRUCTIONS(bitwidth) "movnti" __MEMRW_SUFFIX_##bitwidth##BIT " %1, %0"
 
 #define __MEMRW_READ_FUNC(bitwidth) \
 static inline uint##bitwidth##_t read##bitwidth(const volatile uint##bitwidth##_t *ptr) \
@@ -27,7 +36,7 @@ static inline uint##bitwidth##_t read##bitwidth(const volatile uint##bitwidth##_
     uint##bitwidth##_t val; \
     __asm__ __volatile__( \
         __MEMRW_READ_INSTRUCTIONS(bitwidth) \
-        : "=r" (val) \
+        : "=" __MEMRW_REG_##bitwidth##BIT (val) \
         : "m" (*ptr) \
         : "memory" \
     ); \
@@ -41,7 +50,7 @@ static inline void write##bitwidth(const volatile uint##bitwidth##_t *ptr, uint#
 	__MEMRW_WRITE_INSTRUCTIONS(bitwidth) \
         : \
         : "m" (*ptr), \
-          "r" (val) \
+          __MEMRW_REG_##bitwidth##BIT (val) \
         : "memory" \
     ); \
 }
@@ -58,6 +67,26 @@ static inline void flush##bitwidth(const volatile uint##bitwidth##_t *ptr, uint#
     ); \
 }
 
+#define __MEMRW_WRITE_NT_FUNC(bitwidth) \
+static inline void write##bitwidth##_nt(const volatile uint##bitwidth##_t *ptr, uint##bitwidth##_t val) \
+{ \
+    __asm__ __volatile__( \
+        __MEMRW_WRITE_NT_INSTRUCTIONS(bitwidth) \
+        : \
+        : "m" (*ptr), \
+          "r" (val) \
+        : "memory" \
+    ); \
+}
+
+/**
+ * Reads and returns the value stored in the 8-bit memory location pointed to by ptr.
+ */
+__MEMRW_READ_FUNC(8)
+/**
+ * Reads and returns the value stored in the 16-bit memory location pointed to by ptr.
+ */
+__MEMRW_READ_FUNC(16)
 /**
  * Reads and returns the value stored in the 32-bit memory location pointed to by ptr.
  */
@@ -67,6 +96,14 @@ __MEMRW_READ_FUNC(32)
  */
 __MEMRW_READ_FUNC(64)
 
+/**
+ * Writes val to the 8-bit memory location pointed to by ptr.
+ */
+__MEMRW_WRITE_FUNC(8)
+/**
+ * Writes val to the 16-bit memory location pointed to by ptr.
+ */
+__MEMRW_WRITE_FUNC(16)
 /**
  * Writes val to the 32-bit memory location pointed to by ptr.
  */
@@ -85,4 +122,26 @@ __MEMRW_FLUSH_FUNC(32)
  */
 __MEMRW_FLUSH_FUNC(64)
 
+/**
+ * Writes val to the 32-bit memory location pointed to by ptr using a
+ * non-temporal (streaming) store. Requires SSE2. Must be followed by a
+ * call to store_fence() before the data is read back by another CPU.
+ */
+__MEMRW_WRITE_NT_FUNC(32)
+/**
+ * Writes val to the 64-bit memory location pointed to by ptr using a
+ * non-temporal (streaming) store. Requires SSE2. Must be followed by a
+ * call to store_fence() before the data is read back by another CPU.
+ */
+__MEMRW_WRITE_NT_FUNC(64)
+
+/**
+ * Waits for all preceding stores, including non-temporal stores, to
+ * become globally visible. Requires SSE.
+ */
+static inline void store_fence(void)
+{
+    __asm__ __volatile__("sfence" : : : "memory");
+}
+
 #endif // MEMRW_H
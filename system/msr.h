@@ -19,10 +19,25 @@
 #define MSR_IA32_APIC_BASE              0x1b
 #define MSR_IA32_EBL_CR_POWERON         0x2a
 #define MSR_IA32_PLATFORM_INFO          0xce
+#define MSR_IA32_MPERF                  0xe7
+#define MSR_IA32_APERF                  0xe8
+#define MSR_IA32_MCG_CAP                0x179
 #define MSR_IA32_MCG_CTL                0x17b
 #define MSR_IA32_PERF_STATUS            0x198
 #define MSR_IA32_THERM_STATUS           0x19c
 #define MSR_IA32_TEMPERATURE_TARGET     0x1a2
+#define MSR_IA32_ENERGY_PERF_BIAS       0x1b0
+#define MSR_IA32_PACKAGE_THERM_STATUS   0x1b1
+#define MSR_IA32_PAT                    0x277
+#define MSR_IA32_MC0_CTL2               0x280
+#define MSR_IA32_MC0_STATUS             0x401
+#define MSR_IA32_MC0_ADDR               0x402
+#define MSR_IA32_MC0_MISC               0x403
+#define MSR_IA32_PM_ENABLE              0x770
+#define MSR_IA32_HWP_CAPABILITIES       0x771
+#define MSR_IA32_HWP_REQUEST            0x774
+#define MSR_IA32_PQR_ASSOC              0xc8f
+#define MSR_IA32_L3_QOS_MASK_0          0xc90
 
 #define MSR_EFER                        0xc0000080
 
@@ -32,6 +47,9 @@
 #define MSR_AMD64_NB_CFG                0xc001001f
 #define MSR_AMD64_COFVID_STATUS         0xc0010071
 #define MSR_AMD64_UMC_MCA_CTRL          0xc00020f0
+#define MSR_AMD_CPPC_CAP1               0xc00102b0
+#define MSR_AMD_CPPC_ENABLE             0xc00102b1
+#define MSR_AMD_CPPC_REQ                0xc00102b3
 #define MSR_AMD64_UMC_MCA_STATUS        0xc00020f1
 #define MSR_AMD64_UMC_MCA_ADDR          0xc00020f2
 #define MSR_AMD64_HW_CONF               0xc0010015
@@ -18,8 +18,11 @@
 #include "boot.h"
 #include "bootparams.h"
 
+#include "acpi.h"
 #include "cpuid.h"
 #include "io.h"
+#include "memrw.h"
+#include "vmem.h"
 
 #include "pci.h"
 #include "unistd.h"
@@ -32,6 +35,8 @@
 
 #define PCI_CLASS_BRIDGE_HOST   0x0600
 
+#define ECAM_MAX_BUSES          64      // limits the device address space we use
+
 //------------------------------------------------------------------------------
 // Types
 //------------------------------------------------------------------------------
@@ -42,12 +47,26 @@ typedef enum {
     PCI_CONFIG_TYPE_2     = 2
 } pci_config_type_t;
 
+typedef struct __attribute__ ((packed)) {
+    uint64_t    base_addr;
+    uint16_t    segment;
+    uint8_t     start_bus;
+    uint8_t     end_bus;
+    uint32_t    reserved;
+} mcfg_entry_t;
+
 //------------------------------------------------------------------------------
 // Private Variables
 //------------------------------------------------------------------------------
 
 static pci_config_type_t pci_config_type = PCI_CONFIG_TYPE_NONE;
 
+// The memory-mapped configuration space of the buses in segment 0 that we
+// mapped, or 0 if we only have the legacy access methods.
+static uintptr_t    ecam_base      = 0;
+static int          ecam_start_bus = 0;
+static int          ecam_end_bus   = -1;
+
 //------------------------------------------------------------------------------
 // Private Functions
 //------------------------------------------------------------------------------
@@ -99,6 +118,76 @@ static void probe_config_type(void)
     pci_config_type = PCI_CONFIG_TYPE_NONE;
 }
 
+static uintptr_t ecam_addr(int bus, int dev, int func, int reg)
+{
+    if (bus < ecam_start_bus || bus > ecam_end_bus) {
+        return 0;
+    }
+    return ecam_base
+         + ((uintptr_t)(bus - ecam_start_bus) << 20
+         | (dev  & 0x1f)  << 15
+         | (func & 0x07)  << 12
+         | (reg  & 0xfff));
+}
+
+static void init_ecam(void)
+{
+    if (acpi_config.mcfg_addr == 0) {
+        return;
+    }
+
+    uint32_t legacy_id = pci_config_read32(0, 0, 0, 0);
+
+    rsdt_header_t *mcfg = (rsdt_header_t *)map_region(acpi_config.mcfg_addr, sizeof(rsdt_header_t), true);
+    if (mcfg == NULL) {
+        return;
+    }
+    uint32_t length = mcfg->length;
+    mcfg = (rsdt_header_t *)map_region(acpi_config.mcfg_addr, length, true);
+    if (mcfg == NULL || acpi_checksum(mcfg, length) != 0) {
+        return;
+    }
+
+    // The allocation entries follow the header and 8 reserved bytes.
+    mcfg_entry_t *entry = (mcfg_entry_t *)((uint8_t *)mcfg + sizeof(rsdt_header_t) + 8);
+    mcfg_entry_t *end   = (mcfg_entry_t *)((uint8_t *)mcfg + length);
+    for (; entry < end; entry++) {
+        if (entry->segment != 0 || entry->end_bus < entry->start_bus) {
+            continue;
+        }
+        uint64_t base_addr = entry->base_addr + ((uint64_t)entry->start_bus << 20);
+#if (ARCH_BITS == 32)
+        if ((base_addr >> 32) != 0) {
+            return;
+        }
+#endif
+        int num_buses = entry->end_bus - entry->start_bus + 1;
+        if (num_buses > ECAM_MAX_BUSES) {
+            num_buses = ECAM_MAX_BUSES;
+        }
+        uintptr_t virt_addr = map_region(base_addr, (size_t)num_buses << 20, false);
+        if (virt_addr == 0) {
+            return;
+        }
+        ecam_base      = virt_addr;
+        ecam_start_bus = entry->start_bus;
+        ecam_end_bus   = entry->start_bus + num_buses - 1;
+        break;
+    }
+    if (ecam_base == 0) {
+        return;
+    }
+
+    // Make sure the ECAM shows us the same host bridge as the legacy access
+    // method does. If it doesn't, fall back to the legacy method.
+    uintptr_t addr = ecam_addr(0, 0, 0, 0);
+    uint32_t ecam_id = (addr != 0) ? read32((uint32_t *)addr) : 0xFFFFFFFF;
+    if (ecam_id == 0xFFFFFFFF || (pci_config_type != PCI_CONFIG_TYPE_NONE && ecam_id != legacy_id)) {
+        ecam_base    = 0;
+        ecam_end_bus = -1;
+    }
+}
+
 static void set_pci_config1_addr(int bus, int dev, int func, int reg)
 {
     uint32_t addr = 0x80000000
@@ -135,12 +224,17 @@ void pci_init(void)
     } else {
         probe_config_type();
     }
+    init_ecam();
 }
 
 uint8_t pci_config_read8(int bus, int dev, int func, int reg)
 {
     uint8_t value;
 
+    uintptr_t addr = ecam_addr(bus, dev, func, reg);
+    if (addr != 0) {
+        return read8((uint8_t *)addr);
+    }
     switch (pci_config_type) {
       case PCI_CONFIG_TYPE_1:
         set_pci_config1_addr(bus, dev, func, reg);
@@ -159,6 +253,10 @@ uint16_t pci_config_read16(int bus, int dev, int func, int reg)
 {
     uint16_t value;
 
+    uintptr_t addr = ecam_addr(bus, dev, func, reg);
+    if (addr != 0) {
+        return read16((uint16_t *)addr);
+    }
     switch (pci_config_type) {
       case PCI_CONFIG_TYPE_1:
         set_pci_config1_addr(bus, dev, func, reg);
@@ -177,6 +275,10 @@ uint32_t pci_config_read32(int bus, int dev, int func, int reg)
 {
     uint32_t value;
 
+    uintptr_t addr = ecam_addr(bus, dev, func, reg);
+    if (addr != 0) {
+        return read32((uint32_t *)addr);
+    }
     switch (pci_config_type) {
       case PCI_CONFIG_TYPE_1:
         set_pci_config1_addr(bus, dev, func, reg);
@@ -193,6 +295,11 @@ uint32_t pci_config_read32(int bus, int dev, int func, int reg)
 
 void pci_config_write8(int bus, int dev, int func, int reg, uint8_t value)
 {
+    uintptr_t addr = ecam_addr(bus, dev, func, reg);
+    if (addr != 0) {
+        write8((uint8_t *)addr, value);
+        return;
+    }
     switch (pci_config_type)
     {
       case PCI_CONFIG_TYPE_1:
@@ -211,6 +318,11 @@ void pci_config_write8(int bus, int dev, int func, int reg, uint8_t value)
 
 void pci_config_write16(int bus, int dev, int func, int reg, uint16_t value)
 {
+    uintptr_t addr = ecam_addr(bus, dev, func, reg);
+    if (addr != 0) {
+        write16((uint16_t *)addr, value);
+        return;
+    }
     switch (pci_config_type)
     {
       case PCI_CONFIG_TYPE_1:
@@ -229,6 +341,11 @@ void pci_config_write16(int bus, int dev, int func, int reg, uint16_t value)
 
 void pci_config_write32(int bus, int dev, int func, int reg, uint32_t value)
 {
+    uintptr_t addr = ecam_addr(bus, dev, func, reg);
+    if (addr != 0) {
+        write32((uint32_t *)addr, value);
+        return;
+    }
     switch (pci_config_type)
     {
       case PCI_CONFIG_TYPE_1:
@@ -36,7 +36,11 @@
 #define PCI_MAX_FUNC    8
 
 /**
- * Initialises the PCI access support.
+ * Initialises the PCI access support. If the ACPI MCFG table describes a
+ * PCI Express enhanced configuration access mechanism (ECAM) for segment 0,
+ * the buses it covers are accessed through that, which also gives access
+ * to the extended configuration registers (0x100 to 0xFFF). Must be called
+ * after acpi_init().
  */
 void pci_init(void);
 
@@ -13,6 +13,7 @@
 
 #include "boot.h"
 #include "bootparams.h"
+#include "efi.h"
 
 #include "memsize.h"
 
@@ -191,32 +192,47 @@ static int sanitize_e820_map(e820_entry_t new_map[], const e820_entry_t orig_map
     return new_map_entries;
 }
 
+// Adds the pages wholly contained in the physical address range [start, end)
+// to the pm_map, excluding the reserved memory between 640KB and 1024KB.
+// Returns false if the pm_map is full.
+static bool add_pm_range(uint64_t start, uint64_t end)
+{
+    // Don't ever use memory between 640KB and 1024KB
+    if (start > RESERVED_MEM_START && start < RESERVED_MEM_END) {
+        if (end < RESERVED_MEM_END) {
+            return true;
+        }
+        start = RESERVED_MEM_END;
+    }
+    if (end > RESERVED_MEM_START && end < RESERVED_MEM_END) {
+        end = RESERVED_MEM_START;
+    }
+
+    uintptr_t start_page = (start + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    uintptr_t end_page   = end >> PAGE_SHIFT;
+    if (end_page <= start_page) {
+        return true;
+    }
+    if ((pm_map_size > 0) && (start_page == pm_map[pm_map_size - 1].end)) {
+        pm_map[pm_map_size - 1].end = end_page;
+        return true;
+    }
+    if (pm_map_size >= MAX_MEM_SEGMENTS) {
+        return false;
+    }
+    pm_map[pm_map_size].start = start_page;
+    pm_map[pm_map_size].end   = end_page;
+    pm_map_size++;
+    return true;
+}
+
 static void init_pm_map(const e820_entry_t e820_map[], int e820_entries)
 {
     pm_map_size = 0;
     for (int i = 0; i < e820_entries; i++) {
         if (e820_map[i].type == E820_RAM || e820_map[i].type == E820_ACPI) {
-            uint64_t start = e820_map[i].addr;
-            uint64_t end   = start + e820_map[i].size;
-
-            // Don't ever use memory between 640KB and 1024KB
-            if (start > RESERVED_MEM_START && start < RESERVED_MEM_END) {
-                if (end < RESERVED_MEM_END) {
-                    continue;
-                }
-                start = RESERVED_MEM_END;
-            }
-            if (end > RESERVED_MEM_START && end < RESERVED_MEM_END) {
-                end = RESERVED_MEM_START;
-            }
-
-            pm_map[pm_map_size].start = (start + PAGE_SIZE - 1) >> PAGE_SHIFT;
-            pm_map[pm_map_size].end   = end >> PAGE_SHIFT;
-            num_pm_pages += pm_map[pm_map_size].end - pm_map[pm_map_size].start;
-            if ((pm_map_size > 0) && (pm_map[pm_map_size].start == pm_map[pm_map_size - 1].end)) {
-                pm_map[pm_map_size - 1].end = pm_map[pm_map_size].end;
-            } else {
-                pm_map_size++;
+            if (!add_pm_range(e820_map[i].addr, e820_map[i].addr + e820_map[i].size)) {
+                break;
             }
         }
     }
@@ -236,6 +252,82 @@ static void sort_pm_map(void)
     }
 }
 
+// Merges the segments of the sorted pm_map that touch or overlap.
+static void merge_pm_map(void)
+{
+    int n = 0;
+    for (int i = 1; i < pm_map_size; i++) {
+        if (pm_map[i].start <= pm_map[n].end) {
+            if (pm_map[i].end > pm_map[n].end) {
+                pm_map[n].end = pm_map[i].end;
+            }
+        } else {
+            pm_map[++n] = pm_map[i];
+        }
+    }
+    if (pm_map_size > 0) {
+        pm_map_size = n + 1;
+    }
+}
+
+// Builds the pm_map directly from the EFI memory map, if we were given one.
+// The EFI map often has more entries than the e820 map can hold, and isn't
+// always in address order, so converting it loses memory. The boot services
+// code and data can be tested once ExitBootServices() has been called, so
+// the usable types are all treated as one, and the ranges are sorted and
+// merged into the fewest segments. Returns false if there is no EFI map.
+static bool init_pm_map_from_efi(const boot_params_t *boot_params)
+{
+    const efi_info_t *efi_info = &boot_params->efi_info;
+
+    if (efi_info->loader_signature != EFI32_LOADER_SIGNATURE
+    &&  efi_info->loader_signature != EFI64_LOADER_SIGNATURE) {
+        return false;
+    }
+    uintptr_t mem_map_addr = efi_info->mem_map;
+#if (ARCH_BITS == 64)
+    mem_map_addr |= (uintptr_t)efi_info->mem_map_hi << 32;
+#endif
+    size_t mem_desc_size = efi_info->mem_desc_size;
+    if (mem_map_addr == 0 || mem_desc_size < sizeof(efi_memory_desc_t)) {
+        return false;
+    }
+    size_t num_descs = efi_info->mem_map_size / mem_desc_size;
+
+    pm_map_size = 0;
+    for (size_t i = 0; i < num_descs; i++) {
+        const efi_memory_desc_t *mem_desc = (const efi_memory_desc_t *)(mem_map_addr + i * mem_desc_size);
+
+        switch (mem_desc->type) {
+          case EFI_LOADER_CODE:
+          case EFI_LOADER_DATA:
+          case EFI_BOOT_SERVICES_CODE:
+          case EFI_BOOT_SERVICES_DATA:
+          case EFI_CONVENTIONAL_MEMORY:
+          case EFI_ACPI_RECLAIM_MEMORY:
+            break;
+          default:
+            continue;
+        }
+        // The firmware may still use boot services memory marked as needed
+        // at runtime.
+        if (mem_desc->attribute & EFI_MEMORY_RUNTIME) {
+            continue;
+        }
+        uint64_t start = mem_desc->phys_addr;
+        uint64_t end   = start + (mem_desc->num_pages << PAGE_SHIFT);
+        if (!add_pm_range(start, end)) {
+            // Make room by merging the ranges found so far.
+            sort_pm_map();
+            merge_pm_map();
+            if (!add_pm_range(start, end)) {
+                break;
+            }
+        }
+    }
+    return pm_map_size > 0;
+}
+
 //------------------------------------------------------------------------------
 // Public Functions
 //------------------------------------------------------------------------------
@@ -248,8 +340,15 @@ void pmem_init(void)
 
     const boot_params_t *boot_params = (boot_params_t *)boot_params_addr;
 
-    int sanitized_entries = sanitize_e820_map(sanitized_map, boot_params->e820_map, boot_params->e820_entries);
+    if (!init_pm_map_from_efi(boot_params)) {
+        int sanitized_entries = sanitize_e820_map(sanitized_map, boot_params->e820_map, boot_params->e820_entries);
 
-    init_pm_map(sanitized_map, sanitized_entries);
+        init_pm_map(sanitized_map, sanitized_entries);
+    }
     sort_pm_map();
+    merge_pm_map();
+
+    for (int i = 0; i < pm_map_size; i++) {
+        num_pm_pages += pm_map[i].end - pm_map[i].start;
+    }
 }
@@ -0,0 +1,247 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpuid.h"
+#include "msr.h"
+#include "smp.h"
+
+#include "pmu.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+// Intel architectural performance monitoring.
+
+#define MSR_IA32_PMC0               0x0c1
+#define MSR_IA32_PERFEVTSEL0        0x186
+#define MSR_IA32_FIXED_CTR0         0x309       // instructions retired
+#define MSR_IA32_FIXED_CTR1         0x30a       // core cycles while not halted
+#define MSR_IA32_FIXED_CTR2         0x30b       // reference (TSC) cycles while not halted
+#define MSR_IA32_FIXED_CTR_CTRL     0x38d
+#define MSR_IA32_PERF_GLOBAL_STATUS 0x38e
+#define MSR_IA32_PERF_GLOBAL_CTRL   0x38f
+#define MSR_IA32_PERF_GLOBAL_OVF_CTRL 0x390
+
+#define FIXED_CTR_CTRL_OS_USR       0x33        // counts at all privilege levels in fixed counters 0 and 1
+#define FIXED_CTR2_CTRL_MASK        0xf00
+#define FIXED_CTR2_CTRL_OS_USR_PMI  0xb00       // counts at all privilege levels in fixed counter 2, and interrupts on overflow
+
+#define GLOBAL_FIXED_CTR2           (1 << 2)    // in the high half of the global registers
+
+#define EVTSEL_USR                  (1 << 16)
+#define EVTSEL_OS                   (1 << 17)
+#define EVTSEL_EN                   (1 << 22)
+#define EVTSEL_CMASK(n)             ((n) << 24)
+
+#define EVENT_LLC_MISSES            0x412e      // LONGEST_LAT_CACHE.MISS (architectural)
+#define EVENT_STALLS_MEM_ANY        0x14a3      // CYCLE_ACTIVITY.STALLS_MEM_ANY (Skylake and later big cores)
+
+#define CPUID_PERFMON_LEAF          0x0a
+#define CPUID_PERFMON_NO_LLC_MISSES (1 << 4)    // in EBX
+
+// AMD legacy core performance counters.
+
+#define MSR_K7_PERFCTL0             0xc0010000
+#define MSR_K7_PERFCTR0             0xc0010004
+
+#define AMD_EVENT_CYCLES            0x76        // cycles while not halted
+#define AMD_EVENT_INSTRUCTIONS      0xc0        // instructions retired
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+static unsigned     counted_events[MAX_CPUS];
+
+static unsigned     common_events = ~0u;
+
+static bool         heartbeat_on[MAX_CPUS];
+
+static uint64_t     heartbeat_reload = 0;       // the counter value that overflows after one period
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static uint64_t read_msr(uint32_t msr)
+{
+    uint32_t low, high;
+    rdmsr(msr, low, high);
+    return (uint64_t)high << 32 | low;
+}
+
+static unsigned start_intel(void)
+{
+    if (cpuid_info.max_cpuid < CPUID_PERFMON_LEAF) {
+        return 0;
+    }
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(CPUID_PERFMON_LEAF, 0, &eax, &ebx, &ecx, &edx);
+
+    int version         = eax & 0xff;
+    int num_gp_counters = (eax >> 8) & 0xff;
+    int num_fixed       = edx & 0x1f;
+
+    // The fixed and global control registers were added in version 2.
+    if (version < 2 || num_fixed < 2) {
+        return 0;
+    }
+    unsigned events = 1 << PMU_CYCLES | 1 << PMU_INSTRUCTIONS;
+
+    // The enable bits for the fixed counters are in the high half.
+    uint32_t global_ctrl_low  = 0;
+    uint32_t global_ctrl_high = 0x3;
+
+    wrmsr(MSR_IA32_PERF_GLOBAL_CTRL, 0, 0);
+
+    wrmsr(MSR_IA32_FIXED_CTR0, 0, 0);
+    wrmsr(MSR_IA32_FIXED_CTR1, 0, 0);
+    wrmsr(MSR_IA32_FIXED_CTR_CTRL, FIXED_CTR_CTRL_OS_USR, 0);
+
+    if (num_gp_counters >= 1 && !(ebx & CPUID_PERFMON_NO_LLC_MISSES)) {
+        wrmsr(MSR_IA32_PERFEVTSEL0, 0, 0);
+        wrmsr(MSR_IA32_PMC0, 0, 0);
+        wrmsr(MSR_IA32_PERFEVTSEL0, EVTSEL_EN | EVTSEL_OS | EVTSEL_USR | EVENT_LLC_MISSES, 0);
+        global_ctrl_low |= 1 << 0;
+        events |= 1 << PMU_LLC_MISSES;
+    }
+    if (num_gp_counters >= 2 && version >= 4 && cpuid_info.version.family == 6
+    &&  get_ap_hybrid_type() != CORE_ECORE) {
+        wrmsr(MSR_IA32_PERFEVTSEL0 + 1, 0, 0);
+        wrmsr(MSR_IA32_PMC0 + 1, 0, 0);
+        wrmsr(MSR_IA32_PERFEVTSEL0 + 1, EVTSEL_EN | EVTSEL_OS | EVTSEL_USR | EVTSEL_CMASK(0x14) | EVENT_STALLS_MEM_ANY, 0);
+        global_ctrl_low |= 1 << 1;
+        events |= 1 << PMU_MEM_STALLS;
+    }
+
+    wrmsr(MSR_IA32_PERF_GLOBAL_CTRL, global_ctrl_low, global_ctrl_high);
+
+    return events;
+}
+
+static unsigned start_amd(void)
+{
+    // All the 64-bit AMD CPUs have these counters and events.
+    if (cpuid_info.version.family != 0xf) {
+        return 0;
+    }
+    wrmsr(MSR_K7_PERFCTL0 + 0, 0, 0);
+    wrmsr(MSR_K7_PERFCTL0 + 1, 0, 0);
+    wrmsr(MSR_K7_PERFCTR0 + 0, 0, 0);
+    wrmsr(MSR_K7_PERFCTR0 + 1, 0, 0);
+    wrmsr(MSR_K7_PERFCTL0 + 0, EVTSEL_EN | EVTSEL_OS | EVTSEL_USR | AMD_EVENT_CYCLES, 0);
+    wrmsr(MSR_K7_PERFCTL0 + 1, EVTSEL_EN | EVTSEL_OS | EVTSEL_USR | AMD_EVENT_INSTRUCTIONS, 0);
+
+    return 1 << PMU_CYCLES | 1 << PMU_INSTRUCTIONS;
+}
+
+static void reload_heartbeat(void)
+{
+    wrmsr(MSR_IA32_FIXED_CTR2, (uint32_t)heartbeat_reload, (uint32_t)(heartbeat_reload >> 32));
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+unsigned pmu_start(int my_cpu)
+{
+    unsigned events = 0;
+    if (cpuid_info.flags.msr) {
+        if (cpuid_info.vendor_id.str[0] == 'G') {
+            events = start_intel();
+        } else if (cpuid_info.vendor_id.str[0] == 'A') {
+            events = start_amd();
+        }
+    }
+    counted_events[my_cpu] = events;
+    __sync_fetch_and_and(&common_events, events);
+    return events;
+}
+
+unsigned pmu_common_events(void)
+{
+    return common_events;
+}
+
+void pmu_read(int my_cpu, uint64_t count[NUM_PMU_EVENTS])
+{
+    unsigned events = counted_events[my_cpu];
+
+    for (int i = 0; i < NUM_PMU_EVENTS; i++) {
+        count[i] = 0;
+    }
+    if (cpuid_info.vendor_id.str[0] == 'G') {
+        if (events & (1 << PMU_CYCLES)) {
+            count[PMU_CYCLES]       = read_msr(MSR_IA32_FIXED_CTR1);
+            count[PMU_INSTRUCTIONS] = read_msr(MSR_IA32_FIXED_CTR0);
+        }
+        if (events & (1 << PMU_LLC_MISSES)) {
+            count[PMU_LLC_MISSES]   = read_msr(MSR_IA32_PMC0);
+        }
+        if (events & (1 << PMU_MEM_STALLS)) {
+            count[PMU_MEM_STALLS]   = read_msr(MSR_IA32_PMC0 + 1);
+        }
+    } else if (events != 0) {
+        count[PMU_CYCLES]       = read_msr(MSR_K7_PERFCTR0 + 0);
+        count[PMU_INSTRUCTIONS] = read_msr(MSR_K7_PERFCTR0 + 1);
+    }
+}
+
+bool pmu_start_heartbeat(int my_cpu, uint64_t period)
+{
+    if (!cpuid_info.flags.msr || cpuid_info.vendor_id.str[0] != 'G' || cpuid_info.max_cpuid < CPUID_PERFMON_LEAF) {
+        return false;
+    }
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(CPUID_PERFMON_LEAF, 0, &eax, &ebx, &ecx, &edx);
+
+    int version     = eax & 0xff;
+    int num_fixed   = edx & 0x1f;
+    int fixed_width = (edx >> 5) & 0xff;
+
+    if (version < 2 || num_fixed < 3 || fixed_width < 32 || fixed_width > 48) {
+        return false;
+    }
+    if (period == 0 || period >= (UINT64_C(1) << (fixed_width - 1))) {
+        return false;
+    }
+    heartbeat_reload = (UINT64_C(1) << fixed_width) - period;
+
+    if (!smp_enable_pmi_nmi()) {
+        return false;
+    }
+
+    // Leave the counters programmed by pmu_start() running.
+    uint32_t low, high;
+    rdmsr(MSR_IA32_FIXED_CTR_CTRL, low, high);
+    low = (low & ~FIXED_CTR2_CTRL_MASK) | FIXED_CTR2_CTRL_OS_USR_PMI;
+    reload_heartbeat();
+    wrmsr(MSR_IA32_PERF_GLOBAL_OVF_CTRL, 0, GLOBAL_FIXED_CTR2);
+    wrmsr(MSR_IA32_FIXED_CTR_CTRL, low, high);
+    rdmsr(MSR_IA32_PERF_GLOBAL_CTRL, low, high);
+    wrmsr(MSR_IA32_PERF_GLOBAL_CTRL, low, high | GLOBAL_FIXED_CTR2);
+
+    heartbeat_on[my_cpu] = true;
+    return true;
+}
+
+bool pmu_heartbeat_expired(int my_cpu)
+{
+    if (!heartbeat_on[my_cpu]) {
+        return false;
+    }
+    uint32_t low, high;
+    rdmsr(MSR_IA32_PERF_GLOBAL_STATUS, low, high);
+    if (!(high & GLOBAL_FIXED_CTR2)) {
+        return false;
+    }
+    reload_heartbeat();
+    wrmsr(MSR_IA32_PERF_GLOBAL_OVF_CTRL, 0, GLOBAL_FIXED_CTR2);
+    smp_enable_pmi_nmi();
+    return true;
+}
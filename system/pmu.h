@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef PMU_H
+#define PMU_H
+/**
+ * \file
+ *
+ * Provides access to the core performance monitoring counters, which count
+ * events in the CPU core that is running the code. This uses the Intel
+ * architectural performance monitoring or the AMD legacy core counters.
+ *
+ *//*
+ * Copyright (C) 2024 Memtest86+ contributors.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The events that may be counted.
+ */
+typedef enum {
+    PMU_CYCLES,             // core clock cycles while not halted
+    PMU_INSTRUCTIONS,       // instructions retired
+    PMU_LLC_MISSES,         // last level cache misses (Intel only)
+    PMU_MEM_STALLS,         // cycles stalled by an outstanding load from the memory subsystem (Intel only)
+    NUM_PMU_EVENTS
+} pmu_event_t;
+
+/**
+ * The number of bits in a counter value that can be relied on. The difference
+ * between two readings must be masked with this, as the counters wrap.
+ */
+#define PMU_COUNTER_MASK    ((UINT64_C(1) << 40) - 1)
+
+/**
+ * Programs and starts the performance counters of the CPU core running this
+ * function to count the events it supports. Returns a bit mask of the events
+ * that are counted, with bit n set for event n, or 0 if the CPU doesn't have
+ * usable counters.
+ */
+unsigned pmu_start(int my_cpu);
+
+/**
+ * Returns a bit mask of the events that are counted by all the CPU cores that
+ * have called pmu_start(). Must only be called after at least one has.
+ */
+unsigned pmu_common_events(void);
+
+/**
+ * Reads the performance counters of the CPU core running this function. The
+ * counts for the events that are not counted are set to 0.
+ */
+void pmu_read(int my_cpu, uint64_t count[NUM_PMU_EVENTS]);
+
+/**
+ * Programs a spare performance counter of the CPU core running this function
+ * to raise a non-maskable interrupt each time the core has run for 'period'
+ * TSC cycles while not halted. This provides a periodic interrupt while the
+ * tests run with maskable interrupts disabled. Must be called after
+ * pmu_start(), if that is used. Returns false if the CPU doesn't have a
+ * suitable counter (only Intel CPUs with architectural performance monitoring
+ * version 2 and three fixed counters do).
+ */
+bool pmu_start_heartbeat(int my_cpu, uint64_t period);
+
+/**
+ * Returns true if the heartbeat counter of the CPU core running this function
+ * has overflowed, and rearms it. Called from the NMI handler to identify the
+ * heartbeat interrupts.
+ */
+bool pmu_heartbeat_expired(int my_cpu);
+
+#endif // PMU_H
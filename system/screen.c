@@ -67,8 +67,29 @@ static uint32_t lfb_pallete[16];
 
 static lfb_rotate_t lfb_rotate = LFB_TOP_UP;
 
+// The font, rotated to suit the screen orientation, so that every glyph can
+// be drawn a row at a time. Each glyph has glyph_rows rows of glyph_cols
+// pixels, with the leftmost pixel of each row in bit 15.
+static uint16_t glyph[FONT_CHARS][FONT_HEIGHT];
+
+static int glyph_rows = FONT_HEIGHT;
+static int glyph_cols = FONT_WIDTH;
+
+// The masks that select the foreground colour for each of the four pixels
+// described by a 4-bit group of a glyph row, leftmost first.
+static uint32_t nibble_mask[16][4];
+
 static uint8_t current_attr = WHITE | BLUE << 4;
 
+static bool defer_update = false;
+
+// The columns [start, end) of each row that have changed since the last call
+// to update_screen(). An end of 0 means the row has not changed.
+static uint8_t dirty_start[SCREEN_HEIGHT];
+static uint8_t dirty_end[SCREEN_HEIGHT];
+
+static int headless_row = -1;
+
 //------------------------------------------------------------------------------
 // Private Functions
 //------------------------------------------------------------------------------
@@ -126,141 +147,186 @@ static void vga_put_char(int row, int col, uint8_t ch, uint8_t attr)
     }
 }
 
-static int lfb_offset(int row, int col, int x, int y, int bpp)
+// Returns the offset of the top left pixel of the glyph for the character cell
+// at the specified screen position from lfb_base, in units of 'bpp' bytes.
+// The rotated glyphs are drawn from the top left of the rotated cell.
+static uintptr_t glyph_offset(int row, int col, int bpp)
 {
     switch (lfb_rotate) {
       case LFB_RHS_UP:
-        return (col * FONT_WIDTH  + x) * lfb_stride + ((SCREEN_HEIGHT - row) * FONT_HEIGHT - y - 1) * bpp;
+        return col * FONT_WIDTH * lfb_stride + (SCREEN_HEIGHT - row - 1) * FONT_HEIGHT * bpp;
       case LFB_LHS_UP:
-        return ((SCREEN_WIDTH - col) * FONT_WIDTH - x - 1) * lfb_stride + (row * FONT_HEIGHT + y) * bpp;
+        return (SCREEN_WIDTH - col - 1) * FONT_WIDTH * lfb_stride + row * FONT_HEIGHT * bpp;
       default:
-        return 0;
+        return row * FONT_HEIGHT * lfb_stride + col * FONT_WIDTH * bpp;
     }
 }
 
-static void lfb8_put_char(int row, int col, uint8_t ch, uint8_t attr)
+static void init_glyphs(void)
 {
-    shadow_buffer[row][col].ch   = ch;
-    shadow_buffer[row][col].attr = attr;
-
-    uint8_t fg_colour = attr % 16;
-    uint8_t bg_colour = attr / 16;
-
-    if (lfb_rotate) {
-        for (int y = 0; y < FONT_HEIGHT; y++) {
-            uint8_t font_row = font_data[ch][y];
-            for (int x = 0; x < FONT_WIDTH; x++) {
-                uint8_t *pixel = (uint8_t *)lfb_base + lfb_offset(row, col, x, y, 1);
-                *pixel = font_row & 0x80 ? fg_colour : bg_colour;
-                font_row <<= 1;
-            }
+    for (int i = 0; i < 16; i++) {
+        for (int j = 0; j < 4; j++) {
+            nibble_mask[i][j] = (i & (8 >> j)) ? UINT32_MAX : 0;
         }
-    } else {
-        uint8_t *pixel_row = (uint8_t *)lfb_base + row * FONT_HEIGHT * lfb_stride + col * FONT_WIDTH;
-        for (int y = 0; y < FONT_HEIGHT; y++) {
-            uint8_t font_row = font_data[ch][y];
-            for (int x = 0; x < FONT_WIDTH; x++) {
-                pixel_row[x] = font_row & 0x80 ? fg_colour : bg_colour;
-                font_row <<= 1;
+    }
+
+    glyph_rows = lfb_rotate ? FONT_WIDTH  : FONT_HEIGHT;
+    glyph_cols = lfb_rotate ? FONT_HEIGHT : FONT_WIDTH;
+    for (int ch = 0; ch < FONT_CHARS; ch++) {
+        for (int r = 0; r < glyph_rows; r++) {
+            uint16_t bits = 0;
+            for (int c = 0; c < glyph_cols; c++) {
+                int x, y;
+                switch (lfb_rotate) {
+                  case LFB_RHS_UP:
+                    x = r;
+                    y = FONT_HEIGHT - 1 - c;
+                    break;
+                  case LFB_LHS_UP:
+                    x = FONT_WIDTH - 1 - r;
+                    y = c;
+                    break;
+                  default:
+                    x = c;
+                    y = r;
+                    break;
+                }
+                if (font_data[ch][y] & (0x80 >> x)) {
+                    bits |= 0x8000 >> c;
+                }
             }
-            pixel_row += lfb_stride;
+            glyph[ch][r] = bits;
         }
-   }
+    }
 }
 
-static void lfb16_put_char(int row, int col, uint8_t ch, uint8_t attr)
+static void lfb8_draw_char(int row, int col, uint8_t ch, uint8_t attr)
 {
-    shadow_buffer[row][col].ch   = ch;
-    shadow_buffer[row][col].attr = attr;
+    uint8_t bg_colour   = attr / 16;
+    uint8_t colour_diff = (attr % 16) ^ bg_colour;
+
+    uint8_t *pixel_row = (uint8_t *)lfb_base + glyph_offset(row, col, 1);
+    for (int y = 0; y < glyph_rows; y++) {
+        uint16_t bits = glyph[ch][y];
+        for (int x = 0; x < glyph_cols; x += 4) {
+            const uint32_t *mask = nibble_mask[bits >> 12];
+            pixel_row[x+0] = bg_colour ^ (mask[0] & colour_diff);
+            pixel_row[x+1] = bg_colour ^ (mask[1] & colour_diff);
+            pixel_row[x+2] = bg_colour ^ (mask[2] & colour_diff);
+            pixel_row[x+3] = bg_colour ^ (mask[3] & colour_diff);
+            bits <<= 4;
+        }
+        pixel_row += lfb_stride;
+    }
+}
 
-    uint16_t fg_colour = lfb_pallete[attr % 16];
-    uint16_t bg_colour = lfb_pallete[attr / 16];
+static void lfb16_draw_char(int row, int col, uint8_t ch, uint8_t attr)
+{
+    uint16_t bg_colour   = lfb_pallete[attr / 16];
+    uint16_t colour_diff = lfb_pallete[attr % 16] ^ bg_colour;
+
+    uint16_t *pixel_row = (uint16_t *)lfb_base + glyph_offset(row, col, 1);
+    for (int y = 0; y < glyph_rows; y++) {
+        uint16_t bits = glyph[ch][y];
+        for (int x = 0; x < glyph_cols; x += 4) {
+            const uint32_t *mask = nibble_mask[bits >> 12];
+            pixel_row[x+0] = bg_colour ^ (mask[0] & colour_diff);
+            pixel_row[x+1] = bg_colour ^ (mask[1] & colour_diff);
+            pixel_row[x+2] = bg_colour ^ (mask[2] & colour_diff);
+            pixel_row[x+3] = bg_colour ^ (mask[3] & colour_diff);
+            bits <<= 4;
+        }
+        pixel_row += lfb_stride;
+    }
+}
 
-    if (lfb_rotate) {
-        for (int y = 0; y < FONT_HEIGHT; y++) {
-            uint8_t font_row = font_data[ch][y];
-            for (int x = 0; x < FONT_WIDTH; x++) {
-                uint16_t *pixel = (uint16_t *)lfb_base + lfb_offset(row, col, x, y, 1);
-                *pixel = font_row & 0x80 ? fg_colour : bg_colour;
-                font_row <<= 1;
+static void lfb24_draw_char(int row, int col, uint8_t ch, uint8_t attr)
+{
+    uint32_t bg_colour   = lfb_pallete[attr / 16];
+    uint32_t colour_diff = lfb_pallete[attr % 16] ^ bg_colour;
+
+    uint8_t *pixel_row = (uint8_t *)lfb_base + glyph_offset(row, col, 3);
+    for (int y = 0; y < glyph_rows; y++) {
+        uint16_t bits = glyph[ch][y];
+        for (int x = 0; x < glyph_cols * 3; x += 12) {
+            const uint32_t *mask = nibble_mask[bits >> 12];
+            for (int i = 0; i < 4; i++) {
+                uint32_t colour = bg_colour ^ (mask[i] & colour_diff);
+                pixel_row[x+3*i+0] = colour & 0xff; colour >>= 8;
+                pixel_row[x+3*i+1] = colour & 0xff; colour >>= 8;
+                pixel_row[x+3*i+2] = colour & 0xff;
             }
+            bits <<= 4;
         }
-    } else {
-        uint16_t *pixel_row = (uint16_t *)lfb_base + row * FONT_HEIGHT * lfb_stride + col * FONT_WIDTH;
-        for (int y = 0; y < FONT_HEIGHT; y++) {
-            uint8_t font_row = font_data[ch][y];
-            for (int x = 0; x < FONT_WIDTH; x++) {
-                pixel_row[x] = font_row & 0x80 ? fg_colour : bg_colour;
-                font_row <<= 1;
-            }
-            pixel_row += lfb_stride;
+        pixel_row += lfb_stride;
+    }
+}
+
+static void lfb32_draw_char(int row, int col, uint8_t ch, uint8_t attr)
+{
+    uint32_t bg_colour   = lfb_pallete[attr / 16];
+    uint32_t colour_diff = lfb_pallete[attr % 16] ^ bg_colour;
+
+    uint32_t *pixel_row = (uint32_t *)lfb_base + glyph_offset(row, col, 1);
+    for (int y = 0; y < glyph_rows; y++) {
+        uint16_t bits = glyph[ch][y];
+        for (int x = 0; x < glyph_cols; x += 4) {
+            const uint32_t *mask = nibble_mask[bits >> 12];
+            pixel_row[x+0] = bg_colour ^ (mask[0] & colour_diff);
+            pixel_row[x+1] = bg_colour ^ (mask[1] & colour_diff);
+            pixel_row[x+2] = bg_colour ^ (mask[2] & colour_diff);
+            pixel_row[x+3] = bg_colour ^ (mask[3] & colour_diff);
+            bits <<= 4;
         }
+        pixel_row += lfb_stride;
     }
 }
 
-static void lfb24_put_char(int row, int col, uint8_t ch, uint8_t attr)
+static void (*lfb_draw_char)(int, int, uint8_t, uint8_t) = NULL;
+
+static void lfb_put_char(int row, int col, uint8_t ch, uint8_t attr)
 {
+    if (shadow_buffer[row][col].ch == ch && shadow_buffer[row][col].attr == attr) {
+        // Nothing has changed, so avoid the slow framebuffer writes.
+        return;
+    }
     shadow_buffer[row][col].ch   = ch;
     shadow_buffer[row][col].attr = attr;
 
-    uint32_t fg_colour = lfb_pallete[attr % 16];
-    uint32_t bg_colour = lfb_pallete[attr / 16];
-
-    if (lfb_rotate) {
-        for (int y = 0; y < FONT_HEIGHT; y++) {
-            uint8_t font_row = font_data[ch][y];
-            for (int x = 0; x < FONT_WIDTH; x++) {
-                uint8_t *pixel = (uint8_t *)lfb_base + lfb_offset(row, col, x, y, 3);
-                uint32_t colour = font_row & 0x80 ? fg_colour : bg_colour;
-                pixel[0] = colour & 0xff; colour >>= 8;
-                pixel[1] = colour & 0xff; colour >>= 8;
-                pixel[2] = colour & 0xff;
-                font_row <<= 1;
-            }
+    if (defer_update) {
+        if (dirty_end[row] == 0) {
+            dirty_start[row] = col;
+            dirty_end[row]   = col + 1;
+        } else {
+            if (col <  dirty_start[row]) dirty_start[row] = col;
+            if (col >= dirty_end[row])   dirty_end[row]   = col + 1;
         }
     } else {
-        uint8_t *pixel_row = (uint8_t *)lfb_base + row * FONT_HEIGHT * lfb_stride + col * FONT_WIDTH * 3;
-        for (int y = 0; y < FONT_HEIGHT; y++) {
-            uint8_t font_row = font_data[ch][y];
-            for (int x = 0; x < FONT_WIDTH * 3; x += 3) {
-                uint32_t colour = font_row & 0x80 ? fg_colour : bg_colour;
-                pixel_row[x+0] = colour & 0xff; colour >>= 8;
-                pixel_row[x+1] = colour & 0xff; colour >>= 8;
-                pixel_row[x+2] = colour & 0xff;
-                font_row <<= 1;
-            }
-            pixel_row += lfb_stride;
-        }
+        lfb_draw_char(row, col, ch, attr);
     }
 }
 
-static void lfb32_put_char(int row, int col, uint8_t ch, uint8_t attr)
+// Draws a character on the physical screen, without changing the shadow buffer.
+static void draw_char(int row, int col, uint8_t ch, uint8_t attr)
 {
+    if (lfb_draw_char != NULL) {
+        lfb_draw_char(row, col, ch, attr);
+    } else if (vga_buffer) {
+        (*vga_buffer)[row][col].ch   = ch;
+        (*vga_buffer)[row][col].attr = attr;
+    }
+}
+
+static void headless_put_char(int row, int col, uint8_t ch, uint8_t attr)
+{
+    if (shadow_buffer[row][col].ch == ch && shadow_buffer[row][col].attr == attr) {
+        return;
+    }
     shadow_buffer[row][col].ch   = ch;
     shadow_buffer[row][col].attr = attr;
 
-    uint32_t fg_colour = lfb_pallete[attr % 16];
-    uint32_t bg_colour = lfb_pallete[attr / 16];
-
-    if (lfb_rotate) {
-        for (int y = 0; y < FONT_HEIGHT; y++) {
-            uint8_t font_row = font_data[ch][y];
-            for (int x = 0; x < FONT_WIDTH; x++) {
-                uint32_t *pixel = (uint32_t *)lfb_base + lfb_offset(row, col, x, y, 1);
-                *pixel = font_row & 0x80 ? fg_colour : bg_colour;
-                font_row <<= 1;
-            }
-        }
-    } else {
-        uint32_t *pixel_row = (uint32_t *)lfb_base + row * FONT_HEIGHT * lfb_stride + col * FONT_WIDTH;
-        for (int y = 0; y < FONT_HEIGHT; y++) {
-            uint8_t font_row = font_data[ch][y];
-            for (int x = 0; x < FONT_WIDTH; x++) {
-                pixel_row[x] = font_row & 0x80 ? fg_colour : bg_colour;
-                font_row <<= 1;
-            }
-            pixel_row += lfb_stride;
-        }
+    if (row == headless_row) {
+        draw_char(row, col, ch, attr);
     }
 }
 
@@ -293,16 +359,16 @@ void screen_init(void)
 
         if (lfb_depth <= 8) {
             lfb_bytes_per_pixel = 1;
-            put_char = lfb8_put_char;
+            lfb_draw_char = lfb8_draw_char;
         } else if (lfb_depth <= 16) {
             lfb_bytes_per_pixel = 2;
-            put_char = lfb16_put_char;
+            lfb_draw_char = lfb16_draw_char;
         } else if (lfb_depth <= 24) {
             lfb_bytes_per_pixel = 3;
-            put_char = lfb24_put_char;
+            lfb_draw_char = lfb24_draw_char;
         } else {
             lfb_bytes_per_pixel = 4;
-            put_char = lfb32_put_char;
+            lfb_draw_char = lfb32_draw_char;
         }
 
         lfb_base = screen_info->lfb_base;
@@ -311,6 +377,10 @@ void screen_init(void)
             lfb_base |= (uintptr_t)screen_info->ext_lfb_base << 32;
         }
 #endif
+        put_char = lfb_put_char;
+
+        init_glyphs();
+
         lfb_stride = screen_info->lfb_linelength;
 
         // Clip the framebuffer size to make sure we can map it into the 0.5GB device region.
@@ -326,6 +396,12 @@ void screen_init(void)
         // The above clipping should guarantee the mapping never fails.
         lfb_base = map_region(lfb_base, lfb_height * lfb_stride, false);
 
+        // Use write-combining for the framebuffer if we can. The other CPUs
+        // program their PAT when they start.
+        if (init_write_combining()) {
+            set_write_combining(lfb_base, lfb_height * lfb_stride);
+        }
+
         // Blank the whole framebuffer.
         int pixels_per_word = sizeof(uint32_t) / lfb_bytes_per_pixel;
         uint32_t *line = (uint32_t *)lfb_base;
@@ -464,6 +540,53 @@ void restore_screen_region(int start_row, int start_col, int end_row, int end_co
     }
 }
 
+void set_screen_update_deferred(bool deferred)
+{
+    defer_update = deferred && (lfb_draw_char != NULL);
+    if (!deferred) {
+        update_screen();
+    }
+}
+
+void set_screen_headless(int status_row)
+{
+    defer_update = false;
+    headless_row = status_row;
+
+    // Blank the physical screen, except for the status row. The shadow
+    // buffer is left intact, so it still holds the full display.
+    for (int row = 0; row < SCREEN_HEIGHT; row++) {
+        dirty_end[row] = 0;
+        for (int col = 0; col < SCREEN_WIDTH; col++) {
+            if (row == status_row) {
+                draw_char(row, col, shadow_buffer[row][col].ch, shadow_buffer[row][col].attr);
+            } else {
+                draw_char(row, col, ' ', BLACK << 4 | WHITE);
+            }
+        }
+    }
+
+    put_char = headless_put_char;
+}
+
+void update_screen(void)
+{
+    if (lfb_draw_char == NULL) {
+        return;
+    }
+    for (int row = 0; row < SCREEN_HEIGHT; row++) {
+        int start_col = dirty_start[row];
+        int end_col   = dirty_end[row];
+        if (end_col == 0) {
+            continue;
+        }
+        dirty_end[row] = 0;
+        for (int col = start_col; col < end_col; col++) {
+            lfb_draw_char(row, col, shadow_buffer[row][col].ch, shadow_buffer[row][col].attr);
+        }
+    }
+}
+
 void print_char(int row, int col, char ch)
 {
     if (row < 0 || row >= SCREEN_HEIGHT) return;
@@ -471,3 +594,14 @@ void print_char(int row, int col, char ch)
 
     put_char(row, col, ch, (current_attr & 0x0f) | (shadow_buffer[row][col].attr & 0xf0));
 }
+
+void draw_char_now(int row, int col, char ch, screen_colour_t fg, screen_colour_t bg)
+{
+    if (row < 0 || row >= SCREEN_HEIGHT) return;
+    if (col < 0 || col >= SCREEN_WIDTH)  return;
+
+    if (put_char == headless_put_char && row != headless_row) {
+        return;
+    }
+    draw_char(row, col, ch, (fg & 0x0f) | ((bg << 4) & 0x70));
+}
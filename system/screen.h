@@ -11,6 +11,7 @@
  * Copyright (C) 2020-2024 Martin Whitaker.
  */
 
+#include <stdbool.h>
 #include <stdint.h>
 
 /**
@@ -109,4 +110,35 @@ void restore_screen_region(int start_row, int start_col, int end_row, int end_co
  */
 void print_char(int row, int col, char ch);
 
+/**
+ * Draws the supplied character at the specified screen location on the
+ * physical screen, in the specified colours. Unlike print_char(), this neither
+ * uses nor changes the current colours, the shadow buffer, or the changes
+ * waiting for update_screen(), so it may be called from an interrupt handler
+ * that has interrupted any of the other screen functions. The character stays
+ * until the location is next changed. Has no effect if the location is outside
+ * the screen or is not being drawn.
+ */
+void draw_char_now(int row, int col, char ch, screen_colour_t fg, screen_colour_t bg);
+
+/**
+ * When using a framebuffer, selects whether changes to the screen are drawn
+ * immediately (the default) or are only recorded until the next call to
+ * update_screen(). Turning deferral off draws any pending changes.
+ */
+void set_screen_update_deferred(bool deferred);
+
+/**
+ * Stops drawing to the physical screen, apart from the specified status row,
+ * and blanks the rest of it. Subsequent changes to the screen are only made
+ * in the shadow buffer, so they are still sent to the serial console.
+ */
+void set_screen_headless(int status_row);
+
+/**
+ * Draws the screen cells that have changed since the last call, if updates
+ * are deferred.
+ */
+void update_screen(void);
+
 #endif // SCREEN_H
@@ -9,12 +9,58 @@
 #include "string.h"
 #include "serial.h"
 #include "unistd.h"
+#include "usbhcd.h"
+#include "xhci.h"
+
+#include "spinlock.h"
 
 #include "config.h"
 #include "display.h"
 
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define XMIT_BUFFER_SIZE    4096    // must be a power of 2
+
+#define UART_FIFO_DEPTH     16      // 16550A
+
+#define TTY_CELL_INVERSE    0x100
+#define TTY_CELL_UNKNOWN    0xffff
+
+// Unchanged cells between two changed ones are resent if that is shorter
+// than the escape sequence needed to move the cursor past them.
+#define TTY_MAX_SPAN_GAP    6
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
 static struct serial_port console_serial;
 
+static int          xmit_fifo_depth = 1;
+
+static char         xmit_buffer[XMIT_BUFFER_SIZE];
+
+static unsigned int xmit_head = 0;  // next byte to be queued
+static unsigned int xmit_tail = 0;  // next byte to be sent
+
+static spinlock_t   xmit_lock = false;
+
+// When using the XHCI Debug Capability, output is discarded while no debug
+// host is attached, and the whole screen is resent when one attaches.
+static bool         dbc_host_attached = false;
+static bool         dbc_resend_screen = false;
+
+// A copy of what we believe the terminal is showing, so that only changed
+// cells are sent. Each cell holds the VT100 character, plus TTY_CELL_INVERSE
+// if it was drawn in inverse video, or TTY_CELL_UNKNOWN if we don't know.
+static uint16_t     tty_screen[SCREEN_HEIGHT][SCREEN_WIDTH];
+
+static int          tty_cursor_row = -1;    // -1 if unknown
+static int          tty_cursor_col = -1;
+static int          tty_cur_inverse = -1;   // -1 if unknown
+
 //------------------------------------------------------------------------------
 // Private Functions
 //------------------------------------------------------------------------------
@@ -51,16 +97,69 @@ static uint8_t serial_read_reg(struct serial_port *port, uint16_t reg)
     }
 }
 
-static void serial_wait_for_xmit(struct serial_port *port)
+// Returns true if a debug host is attached to the XHCI Debug Capability.
+// Must be called with the transmit lock held.
+static bool dbc_check_host(void)
+{
+    bool attached = xhci_dbc_ready();
+    if (attached && !dbc_host_attached) {
+        dbc_resend_screen = true;
+    }
+    dbc_host_attached = attached;
+    return attached;
+}
+
+// Sends queued bytes while the XHCI Debug Capability can accept them. If
+// wait is true, waits until all of them have been sent. Must be called with
+// the transmit lock held.
+static void dbc_send_queued(bool wait)
 {
-    uint8_t lsr;
+    while (xmit_tail != xmit_head) {
+        if (!dbc_check_host()) {
+            // Nobody is listening.
+            xmit_tail = xmit_head;
+            return;
+        }
+        unsigned int index  = xmit_tail % XMIT_BUFFER_SIZE;
+        unsigned int length = xmit_head - xmit_tail;
+        if (length > XMIT_BUFFER_SIZE - index) {
+            length = XMIT_BUFFER_SIZE - index;
+        }
+        int sent = xhci_dbc_write(&xmit_buffer[index], length);
+        if (sent == 0 && !wait) {
+            return;
+        }
+        xmit_tail += sent;
+    }
+}
 
-    do {
-        lsr = serial_read_reg(port, UART_LSR);
-    } while ((lsr & BOTH_EMPTY) != BOTH_EMPTY);
+// Sends queued bytes while the UART can accept them. If wait is true, waits
+// for the UART to be ready for at least one byte. Must be called with the
+// transmit lock held.
+static void send_queued(struct serial_port *port, bool wait)
+{
+    if (port->is_dbc) {
+        dbc_send_queued(wait);
+        return;
+    }
+    while (xmit_tail != xmit_head) {
+        uint8_t lsr = serial_read_reg(port, UART_LSR);
+        if (!(lsr & UART_LSR_THRE)) {
+            if (wait) {
+                continue;
+            }
+            return;
+        }
+        // The transmit holding register or FIFO is empty, so we can write up
+        // to the FIFO depth without checking again.
+        for (int i = 0; i < xmit_fifo_depth && xmit_tail != xmit_head; i++) {
+            serial_write_reg(port, UART_TX, xmit_buffer[xmit_tail++ % XMIT_BUFFER_SIZE]);
+        }
+        wait = false;
+    }
 }
 
-void serial_echo_print(const char *p)
+static void queue_string(const char *p)
 {
     struct serial_port *port = &console_serial;
 
@@ -68,29 +167,146 @@ void serial_echo_print(const char *p)
         return;
     }
 
-    /* Now, do each character */
+    spin_lock(&xmit_lock);
     while (*p) {
-        /* Send the character out. */
-        serial_wait_for_xmit(port);
-        serial_write_reg(port, UART_TX, *p++);
+        if (xmit_head - xmit_tail == XMIT_BUFFER_SIZE) {
+            // The buffer is full, so we have to wait.
+            send_queued(port, true);
+        }
+        xmit_buffer[xmit_head++ % XMIT_BUFFER_SIZE] = *p++;
     }
+    send_queued(port, false);
+    spin_unlock(&xmit_lock);
 }
 
-void tty_goto(int y, int x)
+static void tty_forget_screen(void)
+{
+    for (int row = 0; row < SCREEN_HEIGHT; row++) {
+        for (int col = 0; col < SCREEN_WIDTH; col++) {
+            tty_screen[row][col] = TTY_CELL_UNKNOWN;
+        }
+    }
+    tty_cursor_row  = -1;
+    tty_cur_inverse = -1;
+}
+
+static void tty_move_cursor(int row, int col)
 {
     static char s[3];
 
-    serial_echo_print("\x1b[");
-    serial_echo_print(itoa(y + 1, s));
-    serial_echo_print(";");
-    serial_echo_print(itoa(x + 1, s));
-    serial_echo_print("H");
+    // Always use absolute positioning instead of relying on CR-LF to avoid issues
+    // when a CR-LF is lost (especially with Industrial RS232/Ethernet converters).
+    queue_string("\x1b[");
+    queue_string(itoa(row + 1, s));
+    queue_string(";");
+    queue_string(itoa(col + 1, s));
+    queue_string("H");
+
+    tty_cursor_row = row;
+    tty_cursor_col = col;
+}
+
+// Returns the terminal cell for a shadow buffer cell.
+static uint16_t tty_cell(int row, int col)
+{
+    uint16_t cell = shadow_buffer[row][col].ch;
+
+    /* Make sure only VT100 characters are sent. */
+    switch (cell) {
+      case 32 ... 127:
+        break;
+
+      case 0xB3:
+        cell = '|';
+        break;
+
+      case 0xC1:
+      case 0xC2:
+      case 0xC4:
+        cell = '-';
+        break;
+
+      case 0xF8:
+        cell = '*';
+        break;
+
+      default:
+        cell = '?';
+    }
+
+    if ((shadow_buffer[row][col].attr & 0x70) >> 4 != BLUE) {
+        cell |= TTY_CELL_INVERSE;
+    }
+    return cell;
+}
+
+static void tty_send_span(int row, int start_col, int end_col)
+{
+    char p[SCREEN_WIDTH+1];
+    int pos = 0;
+
+    if (tty_cursor_row != row || tty_cursor_col != start_col) {
+        tty_move_cursor(row, start_col);
+    }
+
+    for (int col = start_col; col <= end_col; col++) {
+        uint16_t cell = tty_cell(row, col);
+        int inverse = (cell & TTY_CELL_INVERSE) ? 1 : 0;
+
+        if (tty_cur_inverse != inverse) {
+            if (pos) {
+                p[pos] = '\0';
+                queue_string(p);
+                pos = 0;
+            }
+            queue_string(inverse ? TTY_INVERSE : TTY_NORMAL);
+            tty_cur_inverse = inverse;
+        }
+
+        p[pos++] = cell & 0xff;
+        tty_screen[row][col] = cell;
+    }
+
+    if (pos) {
+        p[pos] = '\0';
+        queue_string(p);
+    }
+
+    // Terminals differ in where they leave the cursor after writing to the
+    // last column. Don't rely on it.
+    if (end_col < (SCREEN_WIDTH - 1)) {
+        tty_cursor_col = end_col + 1;
+    } else {
+        tty_cursor_row = -1;
+    }
 }
 
 //------------------------------------------------------------------------------
 // Public Functions
 //------------------------------------------------------------------------------
 
+void serial_echo_print(const char *p)
+{
+    if (!console_serial.enable) {
+        return;
+    }
+
+    queue_string(p);
+
+    // The text may have moved the cursor or scrolled the terminal, so we no
+    // longer know what it is showing.
+    tty_forget_screen();
+}
+
+void tty_goto(int y, int x)
+{
+    if (!console_serial.enable) {
+        return;
+    }
+
+    tty_move_cursor(y, x);
+}
+
 void tty_init(void)
 {
     if (!enable_tty) {
@@ -101,6 +317,14 @@ void tty_init(void)
     unsigned char lcr;
 
     console_serial.enable       = true;
+
+    // The XHCI Debug Capability is set up later, by tty_dbc_init().
+    if (tty_dbc) {
+        console_serial.is_dbc   = true;
+        tty_forget_screen();
+        return;
+    }
+
     console_serial.base_addr    = tty_address;
     console_serial.baudrate     = tty_baud_rate;
     console_serial.parity       = SERIAL_DEFAULT_PARITY;
@@ -142,18 +366,39 @@ void tty_init(void)
     if (console_serial.is_mmio) {
         serial_write_reg(&console_serial, UART_FCR, 0x00);
         serial_write_reg(&console_serial, UART_FCR, (0xFF) & (UART_FCR_ENA | UART_FCR_THR));
+    } else {
+        serial_write_reg(&console_serial, UART_FCR, UART_FCR_ENA | UART_FCR_CLEAR_RCVR | UART_FCR_CLEAR_XMIT);
     }
 
-    tty_clear_screen();
-    tty_disable_cursor();
+    /* Only use the FIFO if the UART reports it is enabled */
+    if ((serial_read_reg(&console_serial, UART_IIR) & UART_IIR_FIFO) == UART_IIR_FIFO) {
+        xmit_fifo_depth = UART_FIFO_DEPTH;
+    } else {
+        xmit_fifo_depth = 1;
+    }
+
+    if (enable_telemetry) {
+        return;
+    }
+
+    queue_string(TTY_CLEAR_SCREEN);
+    queue_string(TTY_DISABLE_CURSOR);
+
+    for (int row = 0; row < SCREEN_HEIGHT; row++) {
+        for (int col = 0; col < SCREEN_WIDTH; col++) {
+            tty_screen[row][col] = ' ';
+        }
+    }
+    tty_cursor_row  = -1;
+    tty_cur_inverse = -1;
 }
 
 void tty_send_region(int start_row, int start_col, int end_row, int end_col)
 {
-    char p[SCREEN_WIDTH+1];
-    uint8_t ch;
-    int pos = 0;
-    int cur_inverse = -1, inverse = false;
+    // The event stream replaces the copy of the screen.
+    if (!console_serial.enable || enable_telemetry) {
+        return;
+    }
 
     if (start_col > (SCREEN_WIDTH - 1) || end_col > (SCREEN_WIDTH - 1)) {
         return;
@@ -164,71 +409,86 @@ void tty_send_region(int start_row, int start_col, int end_row, int end_col)
     }
 
     for (int row = start_row; row <= end_row; row++) {
-
-        // Always use absolute positioning instead of relying on CR-LF to avoid issues
-        // when a CR-LF is lost (especially with Industrial RS232/Ethernet converters).
-        tty_goto(row, start_col);
-
-        // Copy Shadow buffer to TTY buffer
-        pos = 0;
-        for (int col = start_col; col <= end_col; col++) {
-
-            inverse = ((shadow_buffer[row][col].attr & 0x70) >> 4 != BLUE);
-
-            if (cur_inverse != inverse) {
-
-                if (pos) {
-                  p[pos] = '\0';
-                  serial_echo_print(p);
-                  pos = 0;
-                }
-
-                if (inverse) {
-                    tty_inverse();
-                } else {
-                    tty_normal();
-                }
-
-                cur_inverse = inverse;
+        int col = start_col;
+        while (col <= end_col) {
+            if (tty_cell(row, col) == tty_screen[row][col]) {
+                col++;
+                continue;
             }
-
-            /* Make sure only VT100 characters are sent. */
-            ch = shadow_buffer[row][col].ch;
-
-            switch (ch) {
-                case 32 ... 127:
-                    break;
-
-                case 0xB3:
-                    ch = '|';
-                    break;
-
-                case 0xC1:
-                case 0xC2:
-                case 0xC4:
-                    ch = '-';
-                    break;
-
-                case 0xF8:
-                    ch = '*';
+            // Extend the span over any short runs of unchanged cells.
+            int span_end = col;
+            int gap = 0;
+            for (int next_col = col + 1; next_col <= end_col; next_col++) {
+                if (tty_cell(row, next_col) != tty_screen[row][next_col]) {
+                    span_end = next_col;
+                    gap = 0;
+                } else if (++gap > TTY_MAX_SPAN_GAP) {
                     break;
-
-                default:
-                    ch = '?';
+                }
             }
-
-            p[pos++] = ch;
+            tty_send_span(row, col, span_end);
+            col = span_end + 1;
         }
+    }
+}
 
-        if (pos) {
-            p[pos] = '\0';
-            serial_echo_print(p);
+void tty_dbc_init(void)
+{
+    if (!console_serial.enable || !console_serial.is_dbc) {
+        return;
+    }
+    if (!find_usb_debug_port()) {
+        console_serial.enable = false;
+    }
+}
+
+void tty_xmit_poll(void)
+{
+    if (!console_serial.enable) {
+        return;
+    }
+    // A debug host may attach at any time, so always check.
+    if (xmit_tail == xmit_head && !console_serial.is_dbc) {
+        return;
+    }
+    // Don't wait if another CPU is already sending.
+    if (__sync_bool_compare_and_swap(&xmit_lock, false, true)) {
+        if (console_serial.is_dbc) {
+            dbc_check_host();
+        }
+        send_queued(&console_serial, false);
+        spin_unlock(&xmit_lock);
+    }
+    if (dbc_resend_screen) {
+        dbc_resend_screen = false;
+        if (!enable_telemetry) {
+            queue_string(TTY_CLEAR_SCREEN);
+            queue_string(TTY_DISABLE_CURSOR);
+            tty_forget_screen();
+            tty_full_redraw();
         }
     }
 }
 
+void tty_xmit_flush(void)
+{
+    if (!console_serial.enable) {
+        return;
+    }
+    spin_lock(&xmit_lock);
+    while (xmit_tail != xmit_head) {
+        send_queued(&console_serial, true);
+    }
+    spin_unlock(&xmit_lock);
+}
+
 char tty_get_key(void)
 {
+    // The XHCI Debug Capability is only used for output.
+    if (console_serial.is_dbc) {
+        return 0xFF;
+    }
+
     int uart_status = serial_read_reg(&console_serial, UART_LSR);
 
     if (uart_status & UART_LSR_DR) {
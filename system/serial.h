@@ -23,6 +23,7 @@ static const uint16_t serial_io_ports[] = { 0x3f8, 0x2f8, 0x3e8, 0x2e8 };
 struct serial_port {
     bool enable;
     bool is_mmio;
+    bool is_dbc;
     int parity;
     int bits;
     int baudrate;
@@ -95,6 +96,7 @@ struct serial_port {
 /*
  * Definitions for the Interrupt Identification Register
  */
+#define UART_IIR_FIFO   0xc0    /* FIFOs enabled (16550A and later) */
 #define UART_IIR_NO_INT 0x01    /* No interrupts pending */
 #define UART_IIR_ID     0x06    /* Mask for the interrupt ID */
 
@@ -107,6 +109,8 @@ struct serial_port {
  * Definitions for the FIFO Control Register
  */
 #define UART_FCR_ENA   0x01     /* FIFO Enable */
+#define UART_FCR_CLEAR_RCVR 0x02 /* Clear the RCVR FIFO */
+#define UART_FCR_CLEAR_XMIT 0x04 /* Clear the XMIT FIFO */
 #define UART_FCR_THR   0x20     /* FIFO Threshold */
 
 /*
@@ -173,10 +177,42 @@ struct serial_port {
 #define tty_clear_screen() \
     serial_echo_print(TTY_CLEAR_SCREEN);
 
+/**
+ * Queues a string for transmission on the serial console. The string is
+ * copied into a transmit buffer, and as much of it as the UART FIFO can hold
+ * is sent without waiting. Only waits if the transmit buffer is full. As
+ * the string may move the cursor or scroll the terminal, the next redraw of
+ * any region resends all of it.
+ */
+void serial_echo_print(const char *p);
+
+/**
+ * Moves as much queued output as the UART FIFO can hold into the FIFO,
+ * without waiting. Must be called regularly while output is queued.
+ */
+void tty_xmit_poll(void);
+
+/**
+ * Waits until all queued output has been sent.
+ */
+void tty_xmit_flush(void);
+
 void tty_init(void);
 
+/**
+ * Enables the XHCI Debug Capability when it has been selected as the
+ * console. This must be called after the USB controllers have been reset.
+ * If no debug capability is found, the console is disabled.
+ */
+void tty_dbc_init(void);
+
 void tty_print(int y, int x, const char *p);
 
+/**
+ * Brings the specified region of the terminal up to date with the shadow
+ * buffer. Only the cells that differ from what was last sent are sent, so
+ * redrawing an unchanged region costs nothing.
+ */
 void tty_send_region(int start_row, int start_col, int end_row, int end_col);
 
 char tty_get_key(void);
@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpuid.h"
+
+#include "simd.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define CR0_MP          0x00000002
+#define CR0_EM          0x00000004
+#define CR0_TS          0x00000008
+
+#define CR4_OSFXSR      0x00000200
+#define CR4_OSXMMEXCPT  0x00000400
+#define CR4_OSXSAVE     0x00040000
+
+#define XCR0_X87        0x00000001
+#define XCR0_SSE        0x00000002
+#define XCR0_AVX        0x00000004
+#define XCR0_AVX512     0x000000e0  // opmask, ZMM_Hi256, Hi16_ZMM
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+static uint32_t xcr0 = 0;
+
+//------------------------------------------------------------------------------
+// Public Variables
+//------------------------------------------------------------------------------
+
+simd_level_t simd_level = SIMD_NONE;
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static inline uintptr_t read_cr0(void)
+{
+    uintptr_t cr0;
+    __asm__ __volatile__ ("mov %%cr0, %0" : "=r" (cr0));
+    return cr0;
+}
+
+static inline void write_cr0(uintptr_t cr0)
+{
+    __asm__ __volatile__ ("mov %0, %%cr0" : : "r" (cr0) : "memory");
+}
+
+static inline uintptr_t read_cr4(void)
+{
+    uintptr_t cr4;
+    __asm__ __volatile__ ("mov %%cr4, %0" : "=r" (cr4));
+    return cr4;
+}
+
+static inline void write_cr4(uintptr_t cr4)
+{
+    __asm__ __volatile__ ("mov %0, %%cr4" : : "r" (cr4) : "memory");
+}
+
+static inline void write_xcr0(uint32_t value)
+{
+    __asm__ __volatile__ ("xsetbv" : : "a" (value), "d" (0), "c" (0) : "memory");
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+void simd_init(void)
+{
+    simd_level = SIMD_NONE;
+    xcr0 = 0;
+
+    if (!cpuid_info.flags.fxsr || !cpuid_info.flags.sse2) {
+        return;
+    }
+    simd_level = SIMD_SSE2;
+
+    if (cpuid_info.flags.xsave && cpuid_info.max_cpuid >= 0xd) {
+        uint32_t xcr0_supported, reg[3];
+
+        cpuid(0xd, 0, &xcr0_supported, &reg[0], &reg[1], &reg[2]);
+
+        uint32_t avx_state = XCR0_X87 | XCR0_SSE | XCR0_AVX;
+        if (cpuid_info.flags.avx && cpuid_info.flags.avx2 && (xcr0_supported & avx_state) == avx_state) {
+            simd_level = SIMD_AVX2;
+            xcr0 = avx_state;
+
+            uint32_t avx512_state = avx_state | XCR0_AVX512;
+            if (cpuid_info.flags.avx512f && (xcr0_supported & avx512_state) == avx512_state) {
+                simd_level = SIMD_AVX512;
+                xcr0 = avx512_state;
+            }
+        }
+    }
+
+    simd_enable();
+}
+
+void simd_enable(void)
+{
+    if (simd_level == SIMD_NONE) {
+        return;
+    }
+
+    write_cr0((read_cr0() & ~(uintptr_t)(CR0_EM | CR0_TS)) | CR0_MP);
+
+    uintptr_t cr4 = read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (xcr0 != 0) {
+        cr4 |= CR4_OSXSAVE;
+    }
+    write_cr4(cr4);
+
+    if (xcr0 != 0) {
+        write_xcr0(xcr0);
+    }
+}
@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef SIMD_H
+#define SIMD_H
+/**
+ * \file
+ *
+ * Provides functions to detect and enable the SIMD extensions (SSE2, AVX2,
+ * and AVX-512) used by the optimised memory test kernels.
+ *
+ * The rest of the program is compiled without any SIMD instructions, so the
+ * processor state saved by the interrupt handlers does not include the SIMD
+ * registers. Only the separately compiled test kernels may use them.
+ *
+ *//*
+ * Copyright (C) 2024 Memtest86+ contributors.
+ */
+
+typedef enum {
+    SIMD_NONE,
+    SIMD_SSE2,
+    SIMD_AVX2,
+    SIMD_AVX512
+} simd_level_t;
+
+/**
+ * The highest SIMD level supported by both the CPU and this program.
+ */
+extern simd_level_t simd_level;
+
+/**
+ * Determines the highest SIMD level supported by the CPU and enables it
+ * on the boot CPU. Must be called after cpuid_init().
+ */
+void simd_init(void);
+
+/**
+ * Enables the SIMD level chosen by simd_init() on the current CPU. Must be
+ * called by each AP before it executes any test.
+ */
+void simd_enable(void);
+
+#endif // SIMD_H
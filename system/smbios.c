@@ -14,6 +14,19 @@
 
 #define LINE_DMI 23
 
+#define MAX_DIMMS           32
+#define MAX_DIMM_RANGES     64
+
+#define EXT_ADDR_USED       0xFFFFFFFF
+
+// A range of physical addresses mapped to one memory device, or to several
+// (dimm = -1) if the mapped address structures overlap.
+typedef struct {
+    uint64_t    start;
+    uint64_t    end;                // the last byte in the range
+    int         dimm;
+} dimm_range_t;
+
 static const uint8_t *table_start = NULL;
 static uint32_t table_length = 0; // 16-bit in SMBIOS v2, 32-bit in SMBIOS v3.
 
@@ -26,6 +39,17 @@ struct system_info *dmi_system_info;
 struct baseboard_info *dmi_baseboard_info;
 struct mem_dev *dmi_memory_device;
 
+static struct mem_dev *dimm_dev[MAX_DIMMS];
+static const char   *dimm_name[MAX_DIMMS];
+static int          num_dimms = 0;
+
+static const struct mem_dev_mapped_addr *mapped_addr[MAX_DIMM_RANGES];
+static int          num_mapped_addrs = 0;
+
+// Sorted and disjoint.
+static dimm_range_t dimm_range[MAX_DIMM_RANGES];
+static int          num_dimm_ranges = 0;
+
 static char *get_tstruct_string(struct tstruct_header *header, uint16_t maxlen, int n)
 {
     if (n < 1)
@@ -150,6 +174,15 @@ static int parse_dmi(uint16_t numstructs)
             if (dmi_memory_device->type <= 2) {
                 dmi_memory_device = (struct mem_dev *) dmi;
             }
+            if (num_dimms < MAX_DIMMS) {
+                dimm_dev[num_dimms++] = (struct mem_dev *) dmi;
+            }
+        }
+        // Type 20 - Memory Device Mapped Address
+        else if (header->type == 20 && header->length > offsetof(struct mem_dev_mapped_addr, interleaved_data_depth)) {
+            if (num_mapped_addrs < MAX_DIMM_RANGES) {
+                mapped_addr[num_mapped_addrs++] = (const struct mem_dev_mapped_addr *) dmi;
+            }
         }
 
         dmi += header->length;
@@ -175,6 +208,73 @@ static int parse_dmi(uint16_t numstructs)
     return 0;
 }
 
+// Builds the sorted index of the address ranges mapped to each memory device.
+// The type 19 (memory array mapped address) structures are not needed, as
+// they don't identify the devices.
+static void build_dimm_index(void)
+{
+    for (int i = 0; i < num_dimms; i++) {
+        uint16_t struct_length = table_length - ((uint8_t *)dimm_dev[i] - table_start);
+        dimm_name[i] = get_tstruct_string(&dimm_dev[i]->header, struct_length, dimm_dev[i]->dev_locator);
+    }
+
+    num_dimm_ranges = 0;
+    for (int i = 0; i < num_mapped_addrs; i++) {
+        const struct mem_dev_mapped_addr *map = mapped_addr[i];
+
+        int dimm = -1;
+        for (int j = 0; j < num_dimms; j++) {
+            if (dimm_dev[j]->header.handle == map->mem_dev_handle) {
+                dimm = j;
+                break;
+            }
+        }
+        if (dimm < 0 || dimm_name[dimm] == NULL) {
+            continue;
+        }
+
+        uint64_t start, end;
+        if (map->start_addr == EXT_ADDR_USED) {
+            if (map->header.length < sizeof(struct mem_dev_mapped_addr)) {
+                continue;
+            }
+            start = map->ext_start_addr;
+            end   = map->ext_end_addr;
+        } else {
+            start = (uint64_t)map->start_addr << 10;
+            end   = ((uint64_t)map->end_addr << 10) | 0x3ff;
+        }
+        if (end <= start) {
+            continue;
+        }
+
+        // Insertion sort by start address, as there are only a few ranges.
+        int k = num_dimm_ranges++;
+        while (k > 0 && dimm_range[k - 1].start > start) {
+            dimm_range[k] = dimm_range[k - 1];
+            k--;
+        }
+        dimm_range[k].start = start;
+        dimm_range[k].end   = end;
+        dimm_range[k].dimm  = dimm;
+    }
+
+    // With interleaving, several devices map the same range, so the device
+    // that holds an address can't be told. Merge the overlapping ranges.
+    int n = 0;
+    for (int i = 0; i < num_dimm_ranges; i++) {
+        if (n > 0 && dimm_range[i].start <= dimm_range[n - 1].end) {
+            if (dimm_range[i].end > dimm_range[n - 1].end) {
+                dimm_range[n - 1].end = dimm_range[i].end;
+            }
+            dimm_range[n - 1].dimm = -1;
+        } else {
+            dimm_range[n++] = dimm_range[i];
+        }
+    }
+    num_dimm_ranges = n;
+}
+
 int smbios_init(void)
 {
     uintptr_t smb_adr;
@@ -211,7 +311,11 @@ int smbios_init(void)
     table_start = (const uint8_t *)(uintptr_t)eps->tableaddress;
     table_length = (uint32_t)eps->tablelength;
 
-    return parse_dmi(eps->numstructs);
+    int result = parse_dmi(eps->numstructs);
+    if (result == 0) {
+        build_dimm_index();
+    }
+    return result;
 }
 
 void print_smbios_startup_info(void)
@@ -250,3 +354,26 @@ void print_smbios_startup_info(void)
         }
     }
 }
+
+int smbios_find_dimm(uint64_t addr)
+{
+    int lo = 0;
+    int hi = num_dimm_ranges;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (dimm_range[mid].end < addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < num_dimm_ranges && dimm_range[lo].start <= addr) {
+        return dimm_range[lo].dimm;
+    }
+    return -1;
+}
+
+const char *smbios_dimm_name(int dimm)
+{
+    return (dimm >= 0 && dimm < num_dimms) ? dimm_name[dimm] : NULL;
+}
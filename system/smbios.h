@@ -9,6 +9,8 @@
  * Copyright (C) 2004-2022 Samuel Demeulemeester.
  */
 
+#include <stdint.h>
+
 #define DMI_SDR         0x0F
 #define DMI_RDRAM       0x11
 #define DMI_DDR         0x12
@@ -122,6 +124,19 @@ struct mem_dev {
     uint32_t extended_conf_speed;*/
 } __attribute__((packed));
 
+struct mem_dev_mapped_addr {
+    struct tstruct_header header;
+    uint32_t start_addr;            // in kB, 0xFFFFFFFF if the extended address is used
+    uint32_t end_addr;              // in kB, the last kB in the range
+    uint16_t mem_dev_handle;
+    uint16_t array_mapped_addr_handle;
+    uint8_t  partition_row_position;
+    uint8_t  interleave_position;
+    uint8_t  interleaved_data_depth; // Last field defined by SMBIOS 2.3.
+    uint64_t ext_start_addr;        // in bytes (SMBIOS 2.7)
+    uint64_t ext_end_addr;          // in bytes, the last byte in the range
+} __attribute__((packed));
+
 /**
  * Memory device Structure (used for SPD decoding)
  */
@@ -140,4 +155,21 @@ int smbios_init(void);
 
 void print_smbios_startup_info(void);
 
+/**
+ * Returns the index of the memory device (DIMM) that holds the specified
+ * physical address, as given by the SMBIOS memory device mapped address
+ * structures, or -1 if the firmware doesn't provide them or the address is
+ * interleaved across several devices. This is a binary search.
+ */
+
+int smbios_find_dimm(uint64_t addr);
+
+/**
+ * Returns the device locator (slot name) of the memory device with the
+ * specified index, as returned by smbios_find_dimm(), or NULL if the index
+ * is -1.
+ */
+
+const char *smbios_dimm_name(int dimm);
+
 #endif // SMBIOS_H
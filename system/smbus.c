@@ -19,9 +19,12 @@
 
 #define LINE_SPD        13
 #define MAX_SPD_SLOT    8
+#define SPD_CACHE_SIZE  1024    // the largest SPD (DDR5)
 
 ram_info ram = { 0, 0, 0, 0, 0, 0, "N/A"};
 
+uint32_t spd_population = 0;
+
 int smbdev, smbfun;
 unsigned short smbusbase = 0;
 uint32_t smbus_id = 0;
@@ -30,6 +33,11 @@ static uint16_t extra_initial_sleep_for_smb_transaction = 0;
 static int8_t spd_page = -1;
 static int8_t last_adr = -1;
 
+// The SPD contents are read two bytes at a time and cached, so each word is
+// only fetched over the SMBus once, however many times the parsers read it.
+static uint8_t  spd_cache[MAX_SPD_SLOT][SPD_CACHE_SIZE];
+static uint32_t spd_cached[MAX_SPD_SLOT][SPD_CACHE_SIZE / 2 / 32];
+
 // Functions Prototypes
 static void read_sku(char *sku, uint8_t slot_idx, uint16_t offset, uint8_t max_len);
 
@@ -46,6 +54,7 @@ static bool setup_smb_controller(void);
 static bool find_smb_controller(uint16_t vid, uint16_t did);
 
 static uint8_t get_spd(uint8_t slot_idx, uint16_t spd_adr);
+static void read_spd_word(uint8_t slot_idx, uint16_t spd_adr, uint8_t *data);
 
 static bool nv_mcp_get_smb(void);
 static bool amd_sb_get_smb(void);
@@ -54,7 +63,8 @@ static bool piix4_get_smb(uint8_t address);
 static bool ich5_get_smb(void);
 static bool ali_get_smb(uint8_t address);
 static uint8_t ich5_process(void);
-static uint8_t ich5_read_spd_byte(uint8_t adr, uint16_t cmd);
+static uint8_t ich5_select_spd_page(uint8_t smbus_adr, uint16_t spd_adr);
+static void ich5_read_spd_word(uint8_t adr, uint16_t cmd, uint8_t *data);
 static uint8_t nf_read_spd_byte(uint8_t smbus_adr, uint8_t spd_adr);
 static uint8_t ali_m1563_read_spd_byte(uint8_t smbus_adr, uint8_t spd_adr);
 static uint8_t ali_m1543_read_spd_byte(uint8_t smbus_adr, uint8_t spd_adr);
@@ -70,6 +80,7 @@ void print_smbus_startup_info(void)
 
     spd_info curspd;
     ram.freq = 0;
+    spd_population = 0;
     curspd.isValid = false;
 
     if (quirk.type & QUIRK_TYPE_SMBUS) {
@@ -116,6 +127,10 @@ void print_smbus_startup_info(void)
             }
 
             if (curspd.isValid) {
+                spd_population = (spd_population << 5 | spd_population >> 27)
+                               ^ (curspd.slot_num << 24 | curspd.jedec_code)
+                               ^ curspd.module_size * 31 ^ curspd.freq;
+
                 if (spd_line_idx == 0) {
                     prints(LINE_SPD-2, 0, "Memory SPD Information");
                     prints(LINE_SPD-1, 0, "----------------------");
@@ -1486,17 +1501,41 @@ static bool ali_get_smb(uint8_t address)
 // ------------------
 
 static uint8_t get_spd(uint8_t slot_idx, uint16_t spd_adr)
+{
+    if (slot_idx >= MAX_SPD_SLOT || spd_adr >= SPD_CACHE_SIZE) {
+        return 0xFF;
+    }
+
+    uint16_t word = spd_adr / 2;
+    uint32_t mask = 1U << (word % 32);
+
+    if (!(spd_cached[slot_idx][word / 32] & mask)) {
+        read_spd_word(slot_idx, word * 2, &spd_cache[slot_idx][word * 2]);
+        spd_cached[slot_idx][word / 32] |= mask;
+    }
+
+    return spd_cache[slot_idx][spd_adr];
+}
+
+static void read_spd_word(uint8_t slot_idx, uint16_t spd_adr, uint8_t *data)
 {
     switch ((smbus_id >> 16) & 0xFFFF) {
       case PCI_VID_ALI:
-        if ((smbus_id & 0xFFFF) == 0x7101)
-            return ali_m1543_read_spd_byte(slot_idx, (uint8_t)spd_adr);
-        else
-            return ali_m1563_read_spd_byte(slot_idx, (uint8_t)spd_adr);
+        if ((smbus_id & 0xFFFF) == 0x7101) {
+            data[0] = ali_m1543_read_spd_byte(slot_idx, (uint8_t)spd_adr);
+            data[1] = ali_m1543_read_spd_byte(slot_idx, (uint8_t)spd_adr + 1);
+        } else {
+            data[0] = ali_m1563_read_spd_byte(slot_idx, (uint8_t)spd_adr);
+            data[1] = ali_m1563_read_spd_byte(slot_idx, (uint8_t)spd_adr + 1);
+        }
+        break;
       case PCI_VID_NVIDIA:
-        return nf_read_spd_byte(slot_idx, (uint8_t)spd_adr);
+        data[0] = nf_read_spd_byte(slot_idx, (uint8_t)spd_adr);
+        data[1] = nf_read_spd_byte(slot_idx, (uint8_t)spd_adr + 1);
+        break;
       default:
-        return ich5_read_spd_byte(slot_idx, spd_adr);
+        ich5_read_spd_word(slot_idx, spd_adr, data);
+        break;
     }
 }
 
@@ -1508,10 +1547,10 @@ static uint8_t get_spd(uint8_t slot_idx, uint16_t spd_adr)
 /                /!\  Your RAM modules will not work anymore  /!\
 / *************************************************************************************/
 
-static uint8_t ich5_read_spd_byte(uint8_t smbus_adr, uint16_t spd_adr)
+// Selects the SPD page holding spd_adr, if needed, and returns the offset to
+// use within that page.
+static uint8_t ich5_select_spd_page(uint8_t smbus_adr, uint16_t spd_adr)
 {
-    smbus_adr += 0x50;
-
     if (dmi_memory_device->type == DMI_DDR4) {
         // Switch page if needed (DDR4)
         if (spd_adr > 0xFF && spd_page != 1) {
@@ -1552,14 +1591,28 @@ static uint8_t ich5_read_spd_byte(uint8_t smbus_adr, uint16_t spd_adr)
           spd_adr |= 0x80;
     }
 
+    return spd_adr;
+}
+
+// Reads two consecutive bytes with a single Read Word transaction. The SPD
+// EEPROM (or DDR5 SPD hub) simply returns the next byte for the second one,
+// as in a sequential read, so spd_adr must be even to stay in one page.
+static void ich5_read_spd_word(uint8_t smbus_adr, uint16_t spd_adr, uint8_t *data)
+{
+    smbus_adr += 0x50;
+
+    uint8_t cmd = ich5_select_spd_page(smbus_adr, spd_adr);
+
     __outb((smbus_adr << 1) | I2C_READ, SMBHSTADD);
-    __outb(spd_adr, SMBHSTCMD);
-    __outb(SMBHSTCNT_BYTE_DATA, SMBHSTCNT);
+    __outb(cmd, SMBHSTCMD);
+    __outb(SMBHSTCNT_WORD_DATA, SMBHSTCNT);
 
     if (ich5_process() == 0) {
-        return __inb(SMBHSTDAT0);
+        data[0] = __inb(SMBHSTDAT0);
+        data[1] = __inb(SMBHSTDAT1);
     } else {
-        return 0xFF;
+        data[0] = 0xFF;
+        data[1] = 0xFF;
     }
 }
 
@@ -1585,12 +1638,14 @@ static uint8_t ich5_process(void)
         usleep(extra_initial_sleep_for_smb_transaction);
     }
 
+    // Poll often, as a transaction only takes a few hundred microseconds at
+    // 100kHz, but keep the same overall timeout of 50ms.
     do {
-        usleep(500);
+        usleep(50);
         status = __inb(SMBHSTSTS);
-    } while ((status & 0x01) && (timeout++ < 100));
+    } while ((status & 0x01) && (timeout++ < 1000));
 
-    if (timeout >= 100) {
+    if (timeout >= 1000) {
         return 2;
     }
 
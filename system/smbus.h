@@ -150,6 +150,12 @@ typedef struct ram_infos {
 
 extern ram_info ram;
 
+/**
+ * A hash of the slot number, manufacturer, size and speed of each memory
+ * module found by print_smbus_startup_info(), or 0 if no module was found.
+ */
+extern uint32_t spd_population;
+
 /**
  * Print SMBUS Info
  */
@@ -47,6 +47,12 @@
 #define APIC_REG_ESR                0x28
 #define APIC_REG_ICRLO              0x30
 #define APIC_REG_ICRHI              0x31
+#define APIC_REG_LVT_CMCI           0x2f
+#define APIC_REG_LVT_PERF           0x34
+
+// APIC LVT mask bit
+
+#define APIC_LVT_MASKED             (1 << 16)
 
 // APIC trigger types
 
@@ -67,6 +73,10 @@
 
 #define	APIC_ICR_BUSY               (1 << 12)
 
+// APIC ICR destination shorthands
+
+#define APIC_DEST_ALL_BUT_SELF      (3 << 18)
+
 // IA32_APIC_BASE MSR bits
 
 #define IA32_APIC_ENABLED           (1 << 11)
@@ -94,6 +104,7 @@
 
 #define MADT_PROCESSOR                 0
 #define MADT_LAPIC_ADDR                5
+#define MADT_X2APIC                    9
 
 // MADT processor flag values
 
@@ -111,6 +122,15 @@
 #define SRAT_MAF_ENABLED               1
 #define SRAT_PXAAF_ENABLED             1
 
+// The maximum number of SRAT memory affinity ranges
+
+#define MAX_MEMORY_AFFINITY_RANGES     256
+
+// In x2APIC mode, the APIC registers are accessed as MSRs starting at this
+// address, at the same register index as in xAPIC mode.
+
+#define X2APIC_MSR_BASE                0x800
+
 // Private memory heap used for AP trampoline and synchronisation objects
 
 #define HEAP_BASE_ADDR              (smp_heap_page << PAGE_SHIFT)
@@ -223,6 +243,15 @@ typedef struct {
     uint64_t    lapic_addr;
 } madt_lapic_addr_entry_t;
 
+typedef struct {
+    uint8_t     type;
+    uint8_t     length;
+    uint16_t    reserved;
+    uint32_t    apic_id;
+    uint32_t    flags;
+    uint32_t    acpi_id;
+} madt_x2apic_entry_t;
+
 
 typedef struct {
     rsdt_header_t h;
@@ -280,17 +309,23 @@ typedef struct __attribute__((packed)) {
 
 static apic_register_t   *apic = NULL;
 
+static bool              x2apic_mode = false;
+
 static uint8_t           apic_id_to_cpu_num[MAX_APIC_IDS];
 
-static uint8_t           apic_id_to_proximity_domain_idx[MAX_APIC_IDS];
+static uint32_t          cpu_num_to_apic_id[MAX_CPUS];
+
+static bool              bsp_apic_id_unusable = false;
 
-static uint8_t           cpu_num_to_apic_id[MAX_CPUS];
+static uint8_t           cpu_num_to_proximity_domain_idx[MAX_CPUS];
 
-static memory_affinity_t memory_affinity_ranges[MAX_APIC_IDS];
+static memory_affinity_t memory_affinity_ranges[MAX_MEMORY_AFFINITY_RANGES];
 
 static uint32_t          proximity_domains[MAX_PROXIMITY_DOMAINS];
 
 static uint8_t           cpus_in_proximity_domain[MAX_PROXIMITY_DOMAINS];
+
+static uint8_t           proximity_distance[MAX_DISTANCE_DOMAINS][MAX_DISTANCE_DOMAINS];
 uint8_t                  used_cpus_in_proximity_domain[MAX_PROXIMITY_DOMAINS];
 
 static uintptr_t         smp_heap_page = 0;
@@ -305,25 +340,78 @@ int num_available_cpus = 1;  // There is always at least one CPU, the BSP
 int num_memory_affinity_ranges = 0;
 int num_proximity_domains = 0;
 
+bool nmi_shared = false;
+
 //------------------------------------------------------------------------------
 // Private Functions
 //------------------------------------------------------------------------------
 
 static int my_apic_id(void)
 {
+    if (x2apic_mode) {
+        uint32_t msrl, msrh;
+        // This is the first SMP function an AP calls, so make sure its APIC
+        // is in the same mode as the BSP's before using any other registers.
+        rdmsr(MSR_IA32_APIC_BASE, msrl, msrh);
+        if (!(msrl & IA32_APIC_EXTENDED)) {
+            wrmsr(MSR_IA32_APIC_BASE, msrl | IA32_APIC_EXTENDED, msrh);
+        }
+        rdmsr(X2APIC_MSR_BASE + APIC_REG_ID, msrl, msrh);
+        return msrl;
+    }
     return read32(&apic[APIC_REG_ID][0]) >> 24;
 }
 
 static void apic_write(int reg, uint32_t val)
 {
+    if (x2apic_mode) {
+        wrmsr(X2APIC_MSR_BASE + reg, val, 0);
+        return;
+    }
     write32(&apic[reg][0], val);
 }
 
 static uint32_t apic_read(int reg)
 {
+    if (x2apic_mode) {
+        uint32_t msrl, msrh;
+        rdmsr(X2APIC_MSR_BASE + reg, msrl, msrh);
+        return msrl;
+    }
     return read32(&apic[reg][0]);
 }
 
+// Adds a CPU found in the ACPI or MP tables to the list of available CPUs.
+// The first CPU found is the BSP. found_cpus counts all the CPUs found. If
+// the BSP's APIC ID is too large to map to a CPU number, no more CPUs are
+// added, and smp_init() falls back to using the BSP alone.
+
+static void add_cpu(uint32_t apic_id, int *found_cpus)
+{
+    if (bsp_apic_id_unusable) {
+        return;
+    }
+    if (apic_id >= MAX_APIC_IDS) {
+        if (*found_cpus == 0) {
+            bsp_apic_id_unusable = true;
+        }
+        return;
+    }
+    for (int i = 0; i < *found_cpus && i < num_available_cpus; i++) {
+        if (cpu_num_to_apic_id[i] == apic_id) {
+            return;
+        }
+    }
+    if (num_available_cpus < MAX_CPUS) {
+        cpu_num_to_apic_id[*found_cpus] = apic_id;
+        // The first CPU is the BSP, don't increment.
+        if (*found_cpus > 0) {
+            num_available_cpus++;
+        }
+    }
+    (*found_cpus)++;
+}
+
 static floating_pointer_struct_t *scan_for_floating_ptr_struct(uintptr_t addr, int length)
 {
     uint32_t *ptr = (uint32_t *)addr;
@@ -476,14 +564,17 @@ static bool find_cpus_in_madt(void)
             }
             madt_processor_entry_t *entry = (madt_processor_entry_t *)tab_entry_ptr;
             if (entry->flags & (MADT_PF_ENABLED|MADT_PF_ONLINE_CAPABLE)) {
-                if (num_available_cpus < MAX_CPUS) {
-                    cpu_num_to_apic_id[found_cpus] = entry->apic_id;
-                    // The first CPU is the BSP, don't increment.
-                    if (found_cpus > 0) {
-                        num_available_cpus++;
-                    }
-                }
-                found_cpus++;
+                add_cpu(entry->apic_id, &found_cpus);
+            }
+        }
+        else if (entry_header->type == MADT_X2APIC) {
+            if (entry_header->length != sizeof(madt_x2apic_entry_t)) {
+                return false;
+            }
+            madt_x2apic_entry_t *entry = (madt_x2apic_entry_t *)tab_entry_ptr;
+            // We can only send IPIs to IDs above 254 in x2APIC mode.
+            if ((entry->flags & (MADT_PF_ENABLED|MADT_PF_ONLINE_CAPABLE)) && (x2apic_mode || entry->apic_id < 0xff)) {
+                add_cpu(entry->apic_id, &found_cpus);
             }
         }
         else if (entry_header->type == MADT_LAPIC_ADDR) {
@@ -623,18 +714,16 @@ find_proximity_domain:
                 // Do we know about that APIC ID ?
                 int found2 = -1;
                 for (int i = 0; i < num_available_cpus; i++) {
-                    if ((uint32_t)cpu_num_to_apic_id[i] == apic_id) {
+                    if (cpu_num_to_apic_id[i] == apic_id) {
                         found2 = i;
                         break;
                     }
                 }
 
-                if (found2 == -1) {
-                    // We've found an affinity entry whose APIC ID we don't know about.
-                    return false;
+                // Ignore the entries for CPUs we aren't using.
+                if (found2 != -1) {
+                    cpu_num_to_proximity_domain_idx[found2] = (uint32_t)found1;
                 }
-
-                apic_id_to_proximity_domain_idx[apic_id] = (uint32_t)found1;
             }
         }
         else if (entry_header->type == SRAT_PROCESSOR_X2APIC_AFFINITY) {
@@ -653,16 +742,22 @@ find_proximity_domain:
     return true;
 }
 
-#if 0
 static bool parse_slit(uintptr_t slit_addr)
 {
     // SLIT is a simple table.
+    if (slit_addr == 0) {
+        return false;
+    }
 
     // SLIT Header is identical to RSDP Header
-    rsdt_header_t *slit = (rsdt_header_t *)slit_addr;
+    rsdt_header_t *slit = (rsdt_header_t *)map_region(slit_addr, sizeof(rsdt_header_t), true);
+    if (slit == NULL) return false;
+
+    slit = (rsdt_header_t *)map_region(slit_addr, slit->length, true);
+    if (slit == NULL) return false;
 
     // Validate SLIT
-    if (slit == NULL || acpi_checksum(slit, slit->length) != 0) {
+    if (acpi_checksum(slit, slit->length) != 0) {
         return false;
     }
     // A SLIT shall always contain at least one byte beyond the header and the number of localities.
@@ -671,19 +766,34 @@ static bool parse_slit(uintptr_t slit_addr)
     }
     // 8 bytes for the number of localities, followed by (number of localities) ^ 2 bytes.
     uint64_t localities = *(uint64_t *)((uint8_t *)slit + sizeof(*slit));
-    if (localities > MAX_APIC_IDS) {
+    if (localities > MAX_PROXIMITY_DOMAINS) {
         return false;
     }
     if (slit->length != sizeof(*slit) + sizeof(uint64_t) + (localities * localities)) {
         return false;
     }
 
+    // The localities are the proximity domains, so translate them to our indices.
+    const uint8_t *distance = (uint8_t *)slit + sizeof(*slit) + sizeof(uint64_t);
+    for (int i = 0; i < num_proximity_domains && i < MAX_DISTANCE_DOMAINS; i++) {
+        for (int j = 0; j < num_proximity_domains && j < MAX_DISTANCE_DOMAINS; j++) {
+            if (proximity_domains[i] < localities && proximity_domains[j] < localities) {
+                proximity_distance[i][j] = distance[proximity_domains[i] * localities + proximity_domains[j]];
+            }
+        }
+    }
+
     return true;
 }
-#endif
 
 static inline void send_ipi(int apic_id, int trigger, int level, int mode, uint8_t vector)
 {
+    if (x2apic_mode) {
+        // The ICR is a single 64-bit register, with the full destination ID
+        // in the upper half.
+        wrmsr(X2APIC_MSR_BASE + APIC_REG_ICRLO, trigger << 15 | level << 14 | mode << 8 | vector, apic_id);
+        return;
+    }
     apic_write(APIC_REG_ICRHI, apic_id << 24);
 
     apic_write(APIC_REG_ICRLO, trigger << 15 | level << 14 | mode << 8 | vector);
@@ -716,6 +826,23 @@ static uint32_t read_apic_esr(bool is_p5)
     return apic_read(APIC_REG_ESR);
 }
 
+static bool apic_is_p5(void)
+{
+    uint32_t apic_ver = apic_read(APIC_REG_VER);
+    uint32_t max_lvt = (apic_ver >> 16) & 0x7f;
+    return (max_lvt == 3);
+}
+
+static bool need_long_ipi_delays(void)
+{
+    if ((cpuid_info.vendor_id.str[0] == 'G' && cpuid_info.version.family == 6)      // Intel P6 or later
+    ||  (cpuid_info.vendor_id.str[0] == 'A' && cpuid_info.version.family >= 15)) {  // AMD Hammer or later
+        return false;
+    }
+    return true;
+}
+
+#if SEQUENTIAL_AP_START
 static bool start_cpu(int cpu_num)
 {
     // This is based on the method used in Linux 5.14.
@@ -723,15 +850,9 @@ static bool start_cpu(int cpu_num)
 
     int apic_id = cpu_num_to_apic_id[cpu_num];
 
-    uint32_t apic_ver = apic_read(APIC_REG_VER);
-    uint32_t max_lvt = (apic_ver >> 16) & 0x7f;
-    bool is_p5 = (max_lvt == 3);
+    bool is_p5 = apic_is_p5();
 
-    bool use_long_delays = true;
-    if ((cpuid_info.vendor_id.str[0] == 'G' && cpuid_info.version.family == 6)      // Intel P6 or later
-    ||  (cpuid_info.vendor_id.str[0] == 'A' && cpuid_info.version.family >= 15)) {  // AMD Hammer or later
-        use_long_delays = false;
-    }
+    bool use_long_delays = need_long_ipi_delays();
 
     // Clear APIC errors.
     (void)read_apic_esr(is_p5);
@@ -769,6 +890,77 @@ static bool start_cpu(int cpu_num)
 
     return true;
 }
+#else
+static int first_enabled_ap(const cpu_state_t cpu_state[MAX_CPUS])
+{
+    for (int cpu_num = 1; cpu_num < num_available_cpus; cpu_num++) {
+        if (cpu_state[cpu_num] == CPU_STATE_ENABLED) {
+            return cpu_num;
+        }
+    }
+    return 0;
+}
+
+// Sends each step of the INIT/STARTUP sequence to all the enabled APs before
+// moving on to the next step, so the delays between steps are only incurred
+// once, however many APs there are. The IPIs are still addressed to each AP,
+// so the disabled APs are left alone. Returns 0 on success, or the number of
+// the AP whose IPI could not be sent, or of the first enabled AP if the local
+// APIC reported an error.
+static int start_cpus(const cpu_state_t cpu_state[MAX_CPUS])
+{
+    // This follows the same steps as the sequential start (based on Linux 5.14).
+
+    bool is_p5 = apic_is_p5();
+
+    bool use_long_delays = need_long_ipi_delays();
+
+    // Clear APIC errors.
+    (void)read_apic_esr(is_p5);
+
+    // Pulse the INIT IPI.
+    for (int cpu_num = 1; cpu_num < num_available_cpus; cpu_num++) {
+        if (cpu_state[cpu_num] != CPU_STATE_ENABLED) continue;
+        if (!send_ipi_and_wait(cpu_num_to_apic_id[cpu_num], APIC_TRIGGER_LEVEL, 1, APIC_DELMODE_INIT, 0, 0)) {
+            return cpu_num;
+        }
+    }
+    if (use_long_delays) {
+        usleep(10*1000);  // 10ms
+    }
+    for (int cpu_num = 1; cpu_num < num_available_cpus; cpu_num++) {
+        if (cpu_state[cpu_num] != CPU_STATE_ENABLED) continue;
+        if (!send_ipi_and_wait(cpu_num_to_apic_id[cpu_num], APIC_TRIGGER_LEVEL, 0, APIC_DELMODE_INIT, 0, 0)) {
+            return cpu_num;
+        }
+    }
+
+    // Send two STARTUP_IPIs.
+    for (int num_sipi = 0; num_sipi < 2; num_sipi++) {
+        // Clear APIC errors.
+        (void)read_apic_esr(is_p5);
+
+        // Send the STARTUP IPI.
+        for (int cpu_num = 1; cpu_num < num_available_cpus; cpu_num++) {
+            if (cpu_state[cpu_num] != CPU_STATE_ENABLED) continue;
+            if (!send_ipi_and_wait(cpu_num_to_apic_id[cpu_num], 0, 0, APIC_DELMODE_STARTUP, AP_TRAMPOLINE_PAGE, 0)) {
+                return cpu_num;
+            }
+        }
+
+        // Give the other CPUs some time to accept the IPI.
+        usleep(use_long_delays ? 500 : 20);
+
+        // Check the IPIs were accepted.
+        uint32_t status = read_apic_esr(is_p5) & 0xef;
+        if (status != 0) {
+            return first_enabled_ap(cpu_state);
+        }
+    }
+
+    return 0;
+}
+#endif
 
 //------------------------------------------------------------------------------
 // Public Functions
@@ -779,8 +971,8 @@ void smp_init(bool smp_enable)
     for (int i = 0; i < (int)(ARRAY_SIZE(apic_id_to_cpu_num)); i++) {
         apic_id_to_cpu_num[i] = 0;
     }
-    for (int i = 0; i < (int)(ARRAY_SIZE(apic_id_to_proximity_domain_idx)); i++) {
-        apic_id_to_proximity_domain_idx[i] = 0;
+    for (int i = 0; i < (int)(ARRAY_SIZE(cpu_num_to_proximity_domain_idx)); i++) {
+        cpu_num_to_proximity_domain_idx[i] = 0;
     }
 
     for (int i = 0; i < (int)(ARRAY_SIZE(cpu_num_to_apic_id)); i++) {
@@ -804,13 +996,16 @@ void smp_init(bool smp_enable)
     num_available_cpus = 1;
     num_memory_affinity_ranges = 0;
     num_proximity_domains = 0;
+    bsp_apic_id_unusable = false;
 
+    x2apic_mode = false;
     if (cpuid_info.flags.x2apic) {
         uint32_t msrl, msrh;
         rdmsr(MSR_IA32_APIC_BASE, msrl, msrh);
         if ((msrl & IA32_APIC_ENABLED) && (msrl & IA32_APIC_EXTENDED)) {
-            // We don't currently support x2APIC mode.
-            smp_enable = false;
+            // The firmware has enabled x2APIC mode, which it must do if any
+            // APIC IDs are above 254, so keep using it.
+            x2apic_mode = true;
         }
     }
 
@@ -823,19 +1018,23 @@ void smp_init(bool smp_enable)
     if (smp_enable) {
         (void)(find_cpus_in_madt() || find_cpus_in_floating_mp_struct());
     }
+    if (bsp_apic_id_unusable) {
+        num_available_cpus = 1;
+        cpu_num_to_apic_id[0] = 0;
+    }
 
     for (int i = 0; i < num_available_cpus; i++) {
         apic_id_to_cpu_num[cpu_num_to_apic_id[i]] = i;
     }
 
     if (smp_enable) {
-        if (!find_numa_nodes_in_srat()) {
-            // Do nothing.
+        if (find_numa_nodes_in_srat()) {
+            (void)parse_slit(acpi_config.slit_addr);
         }
     }
 
     for (int i = 0; i < num_available_cpus; i++) {
-        uint32_t proximity_domain_idx = apic_id_to_proximity_domain_idx[i];
+        uint32_t proximity_domain_idx = cpu_num_to_proximity_domain_idx[i];
         cpus_in_proximity_domain[proximity_domain_idx]++;
     }
 
@@ -857,13 +1056,13 @@ int smp_start(cpu_state_t cpu_state[MAX_CPUS])
 
     cpu_state[0] = CPU_STATE_RUNNING;  // we don't support disabling the boot CPU
 
+#if SEQUENTIAL_AP_START
     for (cpu_num = 1; cpu_num < num_available_cpus; cpu_num++) {
         if (cpu_state[cpu_num] == CPU_STATE_ENABLED) {
             if (!start_cpu(cpu_num)) {
                 return cpu_num;
             }
         }
-#if SEQUENTIAL_AP_START
         int timeout = 10*1000*10;
         while (timeout > 0) {
             if (cpu_state[cpu_num] == CPU_STATE_RUNNING) break;
@@ -873,12 +1072,15 @@ int smp_start(cpu_state_t cpu_state[MAX_CPUS])
         if (cpu_state[cpu_num] != CPU_STATE_RUNNING) {
             return cpu_num;
         }
-#endif
     }
 
-#if SEQUENTIAL_AP_START
     return 0;
 #else
+    int failed = start_cpus(cpu_state);
+    if (failed) {
+        return failed;
+    }
+
     int timeout = 10*1000*10;
     while (timeout > 0) {
         for (cpu_num = 1; cpu_num < num_available_cpus; cpu_num++) {
@@ -902,14 +1104,74 @@ void smp_send_nmi(int cpu_num)
     send_ipi(cpu_num_to_apic_id[cpu_num], 0, 0, APIC_DELMODE_NMI, 0);
 }
 
+void smp_send_nmi_all_but_self(void)
+{
+    while (apic_read(APIC_REG_ICRLO) & APIC_ICR_BUSY) {
+        __builtin_ia32_pause();
+    }
+    if (x2apic_mode) {
+        wrmsr(X2APIC_MSR_BASE + APIC_REG_ICRLO, APIC_DEST_ALL_BUT_SELF | APIC_DELMODE_NMI << 8, 0);
+        return;
+    }
+    apic_write(APIC_REG_ICRLO, APIC_DEST_ALL_BUT_SELF | APIC_DELMODE_NMI << 8);
+}
+
+bool smp_enable_cmci_nmi(void)
+{
+    if (!x2apic_mode && apic == NULL) {
+        return false;
+    }
+    // The CMCI LVT entry is only present if there are at least 7 entries.
+    uint32_t max_lvt = (apic_read(APIC_REG_VER) >> 16) & 0x7f;
+    if (max_lvt < 6) {
+        return false;
+    }
+    apic_write(APIC_REG_LVT_CMCI, APIC_DELMODE_NMI << 8);
+    if (apic_read(APIC_REG_LVT_CMCI) & APIC_LVT_MASKED) {
+        return false;
+    }
+    nmi_shared = true;
+    return true;
+}
+
+bool smp_enable_pmi_nmi(void)
+{
+    if (!x2apic_mode && apic == NULL) {
+        return false;
+    }
+    apic_write(APIC_REG_LVT_PERF, APIC_DELMODE_NMI << 8);
+    if (apic_read(APIC_REG_LVT_PERF) & APIC_LVT_MASKED) {
+        return false;
+    }
+    nmi_shared = true;
+    return true;
+}
+
 int smp_my_cpu_num(void)
 {
-    return num_available_cpus > 1 ? apic_id_to_cpu_num[my_apic_id()] : 0;
+    if (num_available_cpus <= 1) {
+        return 0;
+    }
+    uint32_t apic_id = my_apic_id();
+    return apic_id < MAX_APIC_IDS ? apic_id_to_cpu_num[apic_id] : 0;
+}
+
+int smp_get_apic_id(int cpu_num)
+{
+    return cpu_num_to_apic_id[cpu_num];
 }
 
 uint32_t smp_get_proximity_domain_idx(int cpu_num)
 {
-    return num_available_cpus > 1 ? apic_id_to_proximity_domain_idx[cpu_num_to_apic_id[cpu_num]] : 0;
+    return num_available_cpus > 1 ? cpu_num_to_proximity_domain_idx[cpu_num] : 0;
+}
+
+int smp_get_proximity_distance(uint32_t from_domain_idx, uint32_t to_domain_idx)
+{
+    if (from_domain_idx >= MAX_DISTANCE_DOMAINS || to_domain_idx >= MAX_DISTANCE_DOMAINS) {
+        return 0;
+    }
+    return proximity_distance[from_domain_idx][to_domain_idx];
 }
 
 int smp_narrow_to_proximity_domain(uint64_t start, uint64_t end, uint32_t * proximity_domain_idx, uint64_t * new_start, uint64_t * new_end)
@@ -975,6 +1237,7 @@ void get_memory_affinity_entry(int idx, uint32_t * proximity_domain_idx, uint64_
 
 barrier_t *smp_alloc_barrier(int num_threads)
 {
+    alloc_addr = (alloc_addr + __alignof__(barrier_t) - 1) & ~(uintptr_t)(__alignof__(barrier_t) - 1);
     barrier_t *barrier = (barrier_t *)(alloc_addr);
     alloc_addr += sizeof(barrier_t);
     barrier_init(barrier, num_threads);
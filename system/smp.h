@@ -24,14 +24,21 @@
 #define MAX_CPUS       (1 + MAX_APS)
 
 /**
- * The maximum number of APIC IDs.
+ * The maximum number of APIC IDs. CPU cores with higher (x2APIC) IDs are not
+ * used.
  */
-#define MAX_APIC_IDS                256
+#define MAX_APIC_IDS                4096
 
 /**
  * The maximum number of NUMA proximity domains.
  */
-#define MAX_PROXIMITY_DOMAINS       MAX_APIC_IDS
+#define MAX_PROXIMITY_DOMAINS       256
+
+/**
+ * The maximum number of NUMA proximity domains for which the distances
+ * between domains are recorded.
+ */
+#define MAX_DISTANCE_DOMAINS        16
 
 /**
  * The current state of a CPU core.
@@ -48,12 +55,26 @@ typedef enum  __attribute__ ((packed)) {
  */
 extern int num_available_cpus;
 
+/**
+ * True once a CPU core has been set up to receive corrected machine check or
+ * performance counter interrupts as NMIs. Until then, an NMI that interrupts
+ * a HLT instruction can only be a barrier wakeup signal, so the 64-bit NMI
+ * entry code returns straight away without calling the interrupt handler.
+ */
+extern bool nmi_shared;
+
 /**
  * The number of distinct memory proximity domains. Initially this is 1, but
  * may increase after calling smp_init().
  */
 extern int num_proximity_domains;
 
+/**
+ * The number of memory affinity ranges found in the ACPI SRAT. Initially this
+ * is 0, but may increase after calling smp_init().
+ */
+extern int num_memory_affinity_ranges;
+
 /**
  * Initialises the SMP state and detects the number of available CPU cores.
  */
@@ -71,11 +92,37 @@ int smp_start(cpu_state_t cpu_state[MAX_CPUS]);
  */
 void smp_send_nmi(int cpu_num);
 
+/**
+ * Sends a non-maskable interrupt to all CPU cores except the calling one,
+ * using a single broadcast IPI.
+ */
+void smp_send_nmi_all_but_self(void);
+
+/**
+ * Programs the local APIC of the calling CPU core to deliver corrected
+ * machine check interrupts (CMCI) to it as non-maskable interrupts. Returns
+ * false if the local APIC is not available or does not support CMCI.
+ */
+bool smp_enable_cmci_nmi(void);
+
+/**
+ * Programs the local APIC of the calling CPU core to deliver performance
+ * counter overflow interrupts (PMI) to it as non-maskable interrupts. As the
+ * local APIC masks the entry when it delivers a PMI, this must be called
+ * again after each one. Returns false if the local APIC is not available.
+ */
+bool smp_enable_pmi_nmi(void);
+
 /**
  * Returns the ordinal number of the calling CPU core.
  */
 int smp_my_cpu_num(void);
 
+/**
+ * Returns the local APIC ID of the CPU core whose ordinal number is cpu_num.
+ */
+int smp_get_apic_id(int cpu_num);
+
 /**
  * Return the index of the proximity domain corresponding to the current CPU number.
  * 1 in NUMA-unaware mode, >= 1 otherwise.
@@ -94,6 +141,13 @@ static inline uint8_t smp_alloc_cpu_in_proximity_domain(uint32_t proximity_domai
     return chunk_index;
 }
 
+/**
+ * Returns the relative distance between the proximity domains with the given
+ * indices, as reported by the ACPI SLIT, where 10 is the distance within a
+ * domain. Returns 0 if the distance is not known.
+ */
+int smp_get_proximity_distance(uint32_t from_domain_idx, uint32_t to_domain_idx);
+
 /**
  * Computes the first span, limited to a single proximity domain, of the given memory range.
  */
@@ -2,6 +2,7 @@
 // Copyright (C) 2020-2022 Martin Whitaker.
 // Copyright (C) 2004-2023 Sam Demeulemeester.
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "config.h"
@@ -11,6 +12,7 @@
 #include "memctrl.h"
 #include "msr.h"
 #include "pci.h"
+#include "smp.h"
 
 #include "temperature.h"
 
@@ -20,6 +22,15 @@
 
 float cpu_temp_offset = 0;
 
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+// The last sample taken on each CPU core. A temperature of 0 means no sample.
+static int  core_temp[MAX_CPUS];
+
+static bool core_throttled[MAX_CPUS];
+
 //------------------------------------------------------------------------------
 // Public Functions
 //------------------------------------------------------------------------------
@@ -139,3 +150,67 @@ int get_cpu_temperature(void)
 
     return 0;
 }
+
+void sample_cpu_thermal_status(int my_cpu)
+{
+    uint32_t regl, regh;
+
+    if (!enable_temperature || my_cpu < 0 || TjMax == 0) {
+        return;
+    }
+
+    // Only Intel CPUs provide a per-core sensor that each core can read
+    // without disturbing the others.
+    rdmsr(MSR_IA32_THERM_STATUS, regl, regh);
+    if (!(regl & (1u << 31))) {   // reading not valid
+        return;
+    }
+    int temp = TjMax - ((regl >> 16) & 0x7F);
+    bool throttled = (regl & 0x5) != 0;   // thermal status or PROCHOT/FORCEPR active
+
+    if (cpuid_info.dts_pmp & (1 << 6)) {
+        rdmsr(MSR_IA32_PACKAGE_THERM_STATUS, regl, regh);
+        int package_temp = TjMax - ((regl >> 16) & 0x7F);
+        if (package_temp > temp) {
+            temp = package_temp;
+        }
+        throttled |= (regl & 0x5) != 0;
+    }
+
+    core_temp[my_cpu]      = (temp > 0) ? temp : 1;
+    core_throttled[my_cpu] = throttled;
+}
+
+bool cpu_is_throttled(int cpu)
+{
+    return core_throttled[cpu];
+}
+
+bool get_thermal_summary(int *hottest, int *average, int *num_throttled)
+{
+    int max_temp  = 0;
+    int sum_temp  = 0;
+    int num_temps = 0;
+    int throttled = 0;
+
+    for (int i = 0; i < num_available_cpus; i++) {
+        if (core_temp[i] == 0) {
+            continue;
+        }
+        if (max_temp < core_temp[i]) {
+            max_temp = core_temp[i];
+        }
+        sum_temp += core_temp[i];
+        num_temps++;
+        if (core_throttled[i]) {
+            throttled++;
+        }
+    }
+    if (num_temps == 0) {
+        return false;
+    }
+    *hottest       = max_temp;
+    *average       = sum_temp / num_temps;
+    *num_throttled = throttled;
+    return true;
+}
@@ -4,13 +4,16 @@
 /**
  * \file
  *
- * Provides a function to read the CPU core temperature.
+ * Provides functions to read the CPU core temperature, and to sample and
+ * summarise the temperature and throttle status of each CPU core.
  *
  *//*
  * Copyright (C) 2020-2022 Martin Whitaker.
  * Copyright (C) 2003-2023 Sam Demeulemeester.
  */
 
+#include <stdbool.h>
+
 #define AMD_TEMP_REG_K8     0xE4
 #define AMD_TEMP_REG_K10    0xA4
 
@@ -34,4 +37,24 @@ void temperature_init(void);
  */
 int get_cpu_temperature(void);
 
+/**
+ * Records the current temperature and throttle status of the CPU core
+ * running this function. The package status is folded in for the core's
+ * own package. Does nothing if per-core readings are not available.
+ */
+void sample_cpu_thermal_status(int my_cpu);
+
+/**
+ * Returns true if the last sample taken on the specified CPU core showed
+ * that it or its package was being thermally throttled.
+ */
+bool cpu_is_throttled(int cpu);
+
+/**
+ * Summarises the last samples taken by sample_cpu_thermal_status().
+ * Returns false if no samples have been taken, in which case the outputs
+ * are not changed.
+ */
+bool get_thermal_summary(int *hottest, int *average, int *num_throttled);
+
 #endif // TEMPERATURE_H
@@ -10,7 +10,9 @@
 #include "cpuid.h"
 #include "cpuinfo.h"
 #include "io.h"
+#include "memrw.h"
 #include "tsc.h"
+#include "vmem.h"
 
 //------------------------------------------------------------------------------
 // Constants
@@ -19,10 +21,130 @@
 #define PIT_TICKS_50mS      59659       // PIT clock is 1.193182MHz
 #define APIC_TICKS_50mS     178977      // APIC clock is 3.579545MHz
 
+#define HPET_CALIBRATE_MS   10
+
+// HPET ACPI table offsets
+#define HPET_ADDR_SPACE_OFFSET  40
+#define HPET_ADDR_OFFSET        44
+
+// HPET register offsets
+#define HPET_GCAP_ID_REG        0x000
+#define HPET_GEN_CONF_REG       0x010
+#define HPET_MAIN_CNT_REG       0x0F0
+
+#define HPET_ENABLE_CNF         0x1
+
+#define HPET_MAX_PERIOD         100000000   // 100ns in fs, as specified by the standard
+
 //------------------------------------------------------------------------------
 // Private Functions
 //------------------------------------------------------------------------------
 
+static bool tsc_freq_from_cpuid(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    if (cpuid_info.vendor_id.str[0] != 'G' || cpuid_info.max_cpuid < 0x15) {
+        return false;
+    }
+
+    // Leaf 0x15 gives the TSC/crystal clock ratio and, on most parts, the
+    // crystal clock frequency.
+    cpuid(0x15, 0, &eax, &ebx, &ecx, &edx);
+    if (eax == 0 || ebx == 0) {
+        return false;
+    }
+    if (ecx != 0) {
+        uint64_t khz = (uint64_t)(ecx / 1000) * ebx;
+        if ((khz >> 32) != 0) {
+            return false;
+        }
+        clks_per_msec = (uint32_t)khz / eax;
+        return clks_per_msec != 0;
+    }
+
+    // Otherwise the TSC runs at the processor base frequency, which leaf
+    // 0x16 reports in MHz.
+    if (cpuid_info.max_cpuid < 0x16) {
+        return false;
+    }
+    cpuid(0x16, 0, &eax, &ebx, &ecx, &edx);
+    eax &= 0xffff;
+    if (eax == 0) {
+        return false;
+    }
+    clks_per_msec = eax * 1000;
+    return true;
+}
+
+static bool calibrate_tsc_with_hpet(void)
+{
+    if (acpi_config.hpet_addr == 0) {
+        return false;
+    }
+
+    uint8_t *table = (uint8_t *)map_region(acpi_config.hpet_addr, HPET_ADDR_OFFSET + sizeof(uint64_t), true);
+    if (table == NULL || table[HPET_ADDR_SPACE_OFFSET] != 0) {
+        return false;
+    }
+    uint64_t base_addr = *(uint64_t *)(table + HPET_ADDR_OFFSET);
+#if (ARCH_BITS == 32)
+    if ((base_addr >> 32) != 0) {
+        return false;
+    }
+#endif
+    uint8_t *regs = (uint8_t *)map_region(base_addr, HPET_MAIN_CNT_REG + sizeof(uint64_t), true);
+    if (regs == NULL) {
+        return false;
+    }
+
+    // The upper half of the capabilities register holds the counter period in femtoseconds.
+    uint32_t period = read32((uint32_t *)(regs + HPET_GCAP_ID_REG + 4));
+    if (period == 0 || period > HPET_MAX_PERIOD) {
+        return false;
+    }
+    uint32_t ticks_per_ms = 1000000000 / (period / 1000);
+    uint32_t target_ticks = HPET_CALIBRATE_MS * ticks_per_ms;
+
+    uint32_t conf = read32((uint32_t *)(regs + HPET_GEN_CONF_REG));
+    if (!(conf & HPET_ENABLE_CNF)) {
+        write32((uint32_t *)(regs + HPET_GEN_CONF_REG), conf | HPET_ENABLE_CNF);
+    }
+
+    // Only use the lower half of the counter, as it may only be 32 bits wide.
+    volatile uint32_t *counter = (uint32_t *)(regs + HPET_MAIN_CNT_REG);
+
+    uint32_t start_count = read32(counter);
+    uint32_t start_time, end_time;
+    rdtscl(start_time);
+
+    bool running = false;
+    uint32_t elapsed;
+    int loops = 0;
+    do {
+        elapsed = read32(counter) - start_count;
+        if (elapsed != 0) {
+            running = true;
+        }
+        loops++;
+    } while (elapsed < target_ticks && (running || loops < 10000));
+
+    rdtscl(end_time);
+
+    if (!(conf & HPET_ENABLE_CNF)) {
+        write32((uint32_t *)(regs + HPET_GEN_CONF_REG), conf);
+    }
+
+    uint32_t run_time = end_time - start_time;
+
+    // Make sure we have a credible result
+    if (!running || run_time < (HPET_CALIBRATE_MS * 1000)) {
+        return false;
+    }
+    clks_per_msec = run_time / HPET_CALIBRATE_MS;
+    return true;
+}
+
 static void correct_tsc(void)
 {
     uint32_t start_time, end_time, run_time, counter;
@@ -32,6 +154,15 @@ static void correct_tsc(void)
         return;
     }
 
+    // Prefer the frequency the CPU reports, then a short HPET measurement,
+    // and only then the slower legacy timers.
+    if (tsc_freq_from_cpuid()) {
+        return;
+    }
+    if (calibrate_tsc_with_hpet()) {
+        return;
+    }
+
     // If available, use APIC Timer to find TSC correction factor
     if (acpi_config.pm_is_io && acpi_config.pm_addr != 0) {
         rdtscl(start_time);
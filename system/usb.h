@@ -62,6 +62,7 @@
 
 #define USB_DESC_DEVICE         1
 #define USB_DESC_CONFIGURATION  2
+#define USB_DESC_STRING         3
 #define USB_DESC_INTERFACE      4
 #define USB_DESC_ENDPOINT       5
 
@@ -5,6 +5,7 @@
 #include "memrw.h"
 #include "pci.h"
 #include "screen.h"
+#include "tsc.h"
 #include "usb.h"
 #include "vmem.h"
 
@@ -13,6 +14,7 @@
 #include "uhci.h"
 #include "xhci.h"
 
+#include "cpuinfo.h"
 #include "print.h"
 #include "unistd.h"
 
@@ -30,6 +32,10 @@
 
 #define MILLISEC                1000    // in microseconds
 
+#define MAX_ATTACH_TIME         100     // USB maximum device attach time in milliseconds
+
+#define XHCI_MIN_MMIO_SIZE      0x10000 // the smallest register space an XHCI controller may have
+
 //------------------------------------------------------------------------------
 // Types
 //------------------------------------------------------------------------------
@@ -84,6 +90,8 @@ static usb_hcd_t hcd_list[MAX_HCD] = {
 
 static int num_hcd = 0;
 
+static uint64_t controllers_reset_time = 0;
+
 static int print_row = 0;
 static int print_col = 0;
 
@@ -542,6 +550,18 @@ static void probe_usb_controller(hci_type_t controller_type, uintptr_t pm_base_a
 // Shared Functions (used by all drivers)
 //------------------------------------------------------------------------------
 
+void usb_wait_for_attach(void)
+{
+    if (clks_per_msec == 0) {
+        usleep(MAX_ATTACH_TIME*MILLISEC);
+        return;
+    }
+    uint64_t attach_deadline = controllers_reset_time + (uint64_t)MAX_ATTACH_TIME * clks_per_msec;
+    while (get_tsc() < attach_deadline) {
+        usleep(1*MILLISEC);
+    }
+}
+
 uint32_t usb_route(const usb_hub_t *hub, int port_num)
 {
     if (hub->level == 0) {
@@ -840,6 +860,7 @@ void find_usb_keyboards(bool pause_if_none)
     for (int i = 0; i < num_hci; i++) {
         reset_usb_controller(&hci_list[i]);
     }
+    controllers_reset_time = get_tsc();
 
     num_hcd = 0;
 
@@ -874,6 +895,43 @@ void find_usb_keyboards(bool pause_if_none)
     }
 }
 
+bool find_usb_debug_port(void)
+{
+    hci_info_t hci_list[MAX_HCI];
+
+    int num_hci = find_usb_controllers(hci_list);
+
+    for (int i = 0; i < num_hci; i++) {
+        if (hci_list[i].type != XHCI) continue;
+
+        int bus  = hci_list[i].bus;
+        int dev  = hci_list[i].dev;
+        int func = hci_list[i].func;
+
+        uintptr_t base_addr = pci_config_read32(bus, dev, func, 0x10);
+        if (base_addr & 0x1) continue;  // not in memory space
+#if (ARCH_BITS == 64)
+        if (base_addr & 0x4) {
+            base_addr += (uintptr_t)pci_config_read32(bus, dev, func, 0x14) << 32;
+        }
+#endif
+        base_addr &= ~(uintptr_t)0xf;
+
+        // Set the memory space and bus master flags in case the BIOS hasn't.
+        uint16_t pci_command = pci_config_read16(bus, dev, func, 0x04);
+        pci_config_write16(bus, dev, func, 0x04, pci_command | 0x0006);
+
+        // The debug capability registers lie within the minimum register space.
+        uintptr_t vm_base_addr = map_region(base_addr, XHCI_MIN_MMIO_SIZE, false);
+        if (vm_base_addr == 0) continue;
+
+        if (xhci_dbc_init(vm_base_addr)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 uint8_t get_usb_keycode(void)
 {
     for (int i = 0; i < num_hcd; i++) {
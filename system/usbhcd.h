@@ -211,6 +211,16 @@ static inline bool valid_usb_config_descriptor(const uint8_t *buffer)
     return desc->length == sizeof(usb_config_desc_t) && desc->type == USB_DESC_CONFIGURATION;
 }
 
+/**
+ * Waits until the USB maximum device attach time has passed since all the
+ * host controllers were reset. Only used when the root hub ports stay
+ * powered through the reset, so any devices have been attaching since then,
+ * and the controllers probed after the first normally do not wait at all.
+ *
+ * Used internally by the various HCI drivers.
+ */
+void usb_wait_for_attach(void);
+
 /**
  * Returns the USB route to the device attached to the hub port specified by
  * hub and port_num. The top 8 bits of the returned value contain the root
@@ -308,6 +318,19 @@ bool process_usb_keyboard_report(const usb_hcd_t *hcd, const hid_kbd_rpt_t *repo
  */
 void find_usb_keyboards(bool pause_if_none);
 
+/**
+ * Looks for an XHCI controller with a Debug Capability and enables the
+ * first one it finds, so that the controller presents a USB debug device
+ * to a debug host. Must be called after find_usb_keyboards, as that resets
+ * the controllers.
+ *
+ * Used internally by serial.c.
+ *
+ * \returns
+ * true if a Debug Capability was enabled, otherwise false.
+ */
+bool find_usb_debug_port(void);
+
 /**
  * Polls the keyboards discovered by find_usb_keyboards. Consumes and returns
  * the HID key code for the first key press it detects. Returns zero if no key
@@ -16,6 +16,8 @@
 #include "boot.h"
 
 #include "cpuid.h"
+#include "heap.h"
+#include "msr.h"
 
 #include "vmem.h"
 
@@ -37,14 +39,88 @@
 #define VM_REGION_END       (VM_REGION_START + MAX_REGION_PAGES * VM_PAGE_SIZE - 1)
 #define VM_SPACE_END        0xffffffff
 
+// In long mode, map_all_memory() maps the whole of physical memory starting
+// at the second PML4 entry, so each PML4 entry covers 512GB of it. The first
+// PML4 entry is used for the original 4GB virtual address space.
+
+#define MAX_DIRECT_PDPTS    255
+
+// In long mode, map_windows() maps each window slot into its own entry in the
+// PDPT, starting at the fifth entry (the first four are used as above).
+
+#define VM_SLOT_START       SIZE_C(4,GB)
+#define FIRST_SLOT_PDPT     4
+
+// In long mode, if the CPU supports 1GB pages, map_window() maps the window
+// with a single entry in the third entry of the PDPT, instead of rewriting
+// pd2, and only invalidates the TLB entry for that page.
+
+#define WINDOW_PDPT         2
+
+// We reprogram PAT entry 4 (selected by setting just the PAT bit in a page
+// table entry) to select the WC memory type. No page uses that entry before.
+
+#define PAT_WC_ENTRY        4
+#define PAT_TYPE_WC         0x01
+#define PDE_PAT             0x1000  // the PAT bit in a 2MB page entry
+#define PTE_PAT             0x80    // the PAT bit in a 4KB page entry
+#define PDE_PS              0x80    // set if a page directory entry maps a 2MB page
+
+// Device regions no larger than this are mapped with 4KB pages, taken from a
+// small number of page tables that each occupy one VM page of the region
+// space, so a small BAR doesn't use up a whole VM page. The page tables are
+// allocated from the pinned heap, so are only available once it has been
+// initialised.
+
+#define MAX_SMALL_REGION_SIZE   SIZE_C(1,MB)
+#define NUM_SMALL_TABLES        4
+#define SMALL_PAGES_PER_TABLE   512
+
+// The mapped device regions are recorded in a table sorted by physical
+// address, so map_region() can find an existing mapping by binary search.
+
+#define MAX_REGIONS         64
+
+//------------------------------------------------------------------------------
+// Types
+//------------------------------------------------------------------------------
+
+typedef struct {
+    uintptr_t       phys_first;     // the first byte mapped
+    uintptr_t       phys_last;      // the last byte mapped
+    uintptr_t       virt_first;     // the virtual address of phys_first
+} region_t;
+
 //------------------------------------------------------------------------------
 // Private Variables
 //------------------------------------------------------------------------------
 
 static unsigned int device_pages_used = 0;
 
+static region_t     region[MAX_REGIONS];
+
+static int          num_regions = 0;
+
+static uint64_t     *small_table = NULL;            // the current small table
+
+static int          num_small_tables = 0;
+
+static unsigned int small_table_vm_page = 0;        // the VM page mapped by the current small table
+
+static unsigned int small_pages_used = SMALL_PAGES_PER_TABLE;  // in the current small table
+
 static uintptr_t    mapped_window = 2;
 
+static bool         direct_mapped = false;
+
+static uint64_t     *slot_pd = NULL;
+
+static int          num_slots_available = 0;
+
+static int          num_slots_mapped = 0;
+
+static uintptr_t    slot_window[MAX_WINDOW_SLOTS];
+
 //------------------------------------------------------------------------------
 // Private Functions
 //------------------------------------------------------------------------------
@@ -70,6 +146,105 @@ static void load_pdbr()
     );
 }
 
+static inline void invalidate_page(uintptr_t addr)
+{
+    __asm__ __volatile__ ("invlpg (%0)" : : "r" (addr) : "memory");
+}
+
+// Returns the index of the mapped region with the highest start address that
+// is not above addr, or -1 if there is none.
+static int find_region(uintptr_t addr)
+{
+    int lo = 0;
+    int hi = num_regions;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (region[mid].phys_first <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo - 1;
+}
+
+// Records a new mapping, keeping the table sorted. If the table is full, the
+// mapping is still usable, but won't be found again.
+static void add_region(uintptr_t phys_first, uintptr_t phys_last, uintptr_t virt_first)
+{
+    if (num_regions == MAX_REGIONS) {
+        return;
+    }
+    int i = num_regions++;
+    while (i > 0 && region[i-1].phys_first > phys_first) {
+        region[i] = region[i-1];
+        i--;
+    }
+    region[i].phys_first = phys_first;
+    region[i].phys_last  = phys_last;
+    region[i].virt_first = virt_first;
+}
+
+// Maps the pages containing [base_addr, last_addr] with 4KB pages. Returns
+// the virtual address of the first page, or 0 if there is no room.
+static uintptr_t map_small_pages(uintptr_t base_addr, uintptr_t last_addr)
+{
+    uintptr_t first_phys_page = base_addr >> PAGE_SHIFT;
+    uintptr_t last_phys_page  = last_addr >> PAGE_SHIFT;
+    uintptr_t num_pages       = last_phys_page - first_phys_page + 1;
+
+    if (small_pages_used + num_pages > SMALL_PAGES_PER_TABLE) {
+        if (num_small_tables == NUM_SMALL_TABLES || device_pages_used == MAX_REGION_PAGES) {
+            return 0;
+        }
+        uintptr_t table_addr = heap_alloc(HEAP_TYPE_HM_1, PAGE_SIZE, PAGE_SIZE);
+        if (table_addr == 0) {
+            return 0;
+        }
+        small_table = (uint64_t *)table_addr;
+        for (int i = 0; i < SMALL_PAGES_PER_TABLE; i++) {
+            small_table[i] = 0;
+        }
+        num_small_tables++;
+        small_table_vm_page = device_pages_used++;
+        pd3[small_table_vm_page] = table_addr + 0x3;
+        small_pages_used = 0;
+    }
+    uint64_t *pt = small_table;
+    uintptr_t virt_first = VM_REGION_START + small_table_vm_page * VM_PAGE_SIZE + small_pages_used * PAGE_SIZE;
+    for (uintptr_t page = first_phys_page; page <= last_phys_page; page++) {
+        pt[small_pages_used++] = ((uint64_t)page << PAGE_SHIFT) + 0x3;
+    }
+    return virt_first;
+}
+
+// Maps the pages containing [base_addr, last_addr] with VM pages. Returns
+// the virtual address of the first page, or 0 if there is no room.
+static uintptr_t map_large_pages(uintptr_t base_addr, uintptr_t last_addr)
+{
+    uintptr_t first_phys_page = base_addr >> VM_PAGE_SHIFT;
+    uintptr_t last_phys_page  = last_addr >> VM_PAGE_SHIFT;
+    uintptr_t num_pages       = last_phys_page - first_phys_page + 1;
+
+    if (num_pages > MAX_REGION_PAGES - device_pages_used) {
+        return 0;
+    }
+    uintptr_t virt_first = VM_REGION_START + device_pages_used * VM_PAGE_SIZE;
+    for (uintptr_t page = first_phys_page; page <= last_phys_page; page++) {
+        pd3[device_pages_used++] = (page << VM_PAGE_SHIFT) + 0x83;
+    }
+    return virt_first;
+}
+
+static bool use_1gb_window(void)
+{
+#if (ARCH_BITS == 64)
+    return cpuid_info.flags.lm && cpuid_info.flags.pdpe1gb;
+#else
+    return false;
+#endif
+}
+
 //------------------------------------------------------------------------------
 // Public Functions
 //------------------------------------------------------------------------------
@@ -83,35 +258,200 @@ uintptr_t map_region(uintptr_t base_addr, size_t size, bool only_for_startup)
         return base_addr;
     }
     // Check if the requested region is already mapped.
-    uintptr_t first_virt_page = 0;
-    uintptr_t first_phys_page = base_addr >> VM_PAGE_SHIFT;
-    uintptr_t last_phys_page  = last_addr >> VM_PAGE_SHIFT;
-    uintptr_t curr_virt_page  = first_virt_page;
-    uintptr_t curr_phys_page  = first_phys_page;
-    while (curr_virt_page < device_pages_used && curr_phys_page <= last_phys_page) {
-        uintptr_t mapped_phys_page = pd3[curr_virt_page++] >> VM_PAGE_SHIFT;
-        if (mapped_phys_page == curr_phys_page) {
-            curr_phys_page++;
-        } else {
-            first_virt_page = curr_virt_page;
-            curr_phys_page = first_phys_page;
-        }
+    int i = find_region(base_addr);
+    if (i >= 0 && region[i].phys_last >= last_addr) {
+        return region[i].virt_first + (base_addr - region[i].phys_first);
     }
-    // If not, map it. Note that this will extend a partial match at the end of the current map.
-    while (curr_phys_page <= last_phys_page) {
-        if (device_pages_used == MAX_REGION_PAGES) return 0;
-        pd3[device_pages_used++] = (curr_phys_page++ << VM_PAGE_SHIFT) + 0x83;
+    // If not, map it, using 4KB pages if it is small enough and there is room.
+    uintptr_t phys_first = 0;
+    uintptr_t virt_first = 0;
+    if (size <= MAX_SMALL_REGION_SIZE) {
+        phys_first = base_addr & ~(uintptr_t)(PAGE_SIZE - 1);
+        virt_first = map_small_pages(base_addr, last_addr);
+    }
+    if (virt_first == 0) {
+        phys_first = base_addr & ~(uintptr_t)(VM_PAGE_SIZE - 1);
+        virt_first = map_large_pages(base_addr, last_addr);
+        if (virt_first == 0) {
+            return 0;
+        }
+        add_region(phys_first, last_addr | (VM_PAGE_SIZE - 1), virt_first);
+    } else {
+        add_region(phys_first, last_addr | (PAGE_SIZE - 1), virt_first);
     }
     // Reload the PDBR to flush any remnants of the old mapping.
     load_pdbr();
     // Return the mapped address.
-    return VM_REGION_START + first_virt_page * VM_PAGE_SIZE + base_addr % VM_PAGE_SIZE;
+    return virt_first + (base_addr - phys_first);
+}
+
+bool init_write_combining(void)
+{
+    if (cpuid_info.flags.pat == 0) {
+        return false;
+    }
+    uint32_t pat_lo, pat_hi;
+    rdmsr(MSR_IA32_PAT, pat_lo, pat_hi);
+    pat_hi = (pat_hi & ~(0xffU << (8 * (PAT_WC_ENTRY - 4)))) | (PAT_TYPE_WC << (8 * (PAT_WC_ENTRY - 4)));
+    wrmsr(MSR_IA32_PAT, pat_lo, pat_hi);
+    return true;
+}
+
+void set_write_combining(uintptr_t addr, size_t size)
+{
+    // We can only change the pages in the fourth GB, which is mapped by pd3
+    // and never remapped.
+    if (addr < VM_REGION_START || addr > VM_SPACE_END || size > VM_SPACE_END - addr) {
+        return;
+    }
+    // Only change the pages that lie wholly within the region, as the others
+    // may be shared with other device regions. A VM page may be mapped by one
+    // of the small page tables, in which case its 4KB pages are changed.
+    uintptr_t first_page = (addr - VM_REGION_START + PAGE_SIZE - 1) / PAGE_SIZE;
+    uintptr_t end_page   = (addr - VM_REGION_START + size) / PAGE_SIZE;
+    uintptr_t page = first_page;
+    while (page < end_page && page / SMALL_PAGES_PER_TABLE < 512) {
+        uintptr_t i = page / SMALL_PAGES_PER_TABLE;
+        if (pd3[i] & PDE_PS) {
+            if (page % SMALL_PAGES_PER_TABLE == 0 && end_page - page >= SMALL_PAGES_PER_TABLE) {
+                pd3[i] |= PDE_PAT;
+            }
+            page = (i + 1) * SMALL_PAGES_PER_TABLE;
+        } else {
+            uint64_t *pt = (uint64_t *)(uintptr_t)(pd3[i] & ~(uint64_t)(PAGE_SIZE - 1));
+            if (pd3[i] & 0x1) {
+                pt[page % SMALL_PAGES_PER_TABLE] |= PTE_PAT;
+            }
+            page++;
+        }
+    }
+    // Reload the PDBR to flush any remnants of the old mapping.
+    load_pdbr();
+}
+
+bool map_all_memory(uintptr_t end_page)
+{
+#if (ARCH_BITS == 64)
+    if (cpuid_info.flags.lm == 0) {
+        return false;
+    }
+    if (direct_mapped) {
+        return true;
+    }
+    uintptr_t num_gb   = (end_page + PAGE_C(1,GB) - 1) >> (30 - PAGE_SHIFT);
+    uintptr_t num_pdpt = (num_gb + 511) / 512;
+    if (num_pdpt == 0 || num_pdpt > MAX_DIRECT_PDPTS) {
+        return false;
+    }
+    // Use 1GB pages if the CPU supports them. Otherwise we need a page
+    // directory of 2MB pages for each GB.
+    bool   use_1gb_pages = cpuid_info.flags.pdpe1gb;
+    size_t table_pages   = num_pdpt + (use_1gb_pages ? 0 : num_gb);
+
+    // The tables are allocated from the pinned heap, which is identity mapped.
+    uintptr_t table_addr = heap_alloc(HEAP_TYPE_HM_1, table_pages * PAGE_SIZE, PAGE_SIZE);
+    if (table_addr == 0) {
+        return false;
+    }
+    uint64_t *pdpt = (uint64_t *)table_addr;
+    uint64_t *pd   = pdpt + num_pdpt * 512;
+    for (uintptr_t gb = 0; gb < num_pdpt * 512; gb++) {
+        if (gb >= num_gb) {
+            pdpt[gb] = 0;
+        } else if (use_1gb_pages) {
+            pdpt[gb] = ((uint64_t)gb << 30) + 0x83;
+        } else {
+            for (uintptr_t i = 0; i < 512; i++) {
+                pd[i] = ((uint64_t)gb << 30) + (i << VM_PAGE_SHIFT) + 0x83;
+            }
+            pdpt[gb] = (uintptr_t)pd + 0x3;
+            pd += 512;
+        }
+    }
+    for (uintptr_t i = 0; i < num_pdpt; i++) {
+        pml4[1 + i] = (uintptr_t)(pdpt + i * 512) + 0x3;
+    }
+    load_pdbr();
+
+    direct_mapped = true;
+    return true;
+#else
+    (void)end_page;
+    return false;
+#endif
+}
+
+bool init_window_slots(int num_slots)
+{
+#if (ARCH_BITS == 64)
+    if (cpuid_info.flags.lm == 0 || num_slots < 1 || num_slots > MAX_WINDOW_SLOTS) {
+        return false;
+    }
+    if (num_slots_available >= num_slots) {
+        return true;
+    }
+    // We need a page directory for each slot, unless the CPU supports 1GB pages.
+    if (!cpuid_info.flags.pdpe1gb) {
+        slot_pd = (uint64_t *)heap_alloc(HEAP_TYPE_HM_1, num_slots * PAGE_SIZE, PAGE_SIZE);
+        if (slot_pd == NULL) {
+            return false;
+        }
+    }
+    num_slots_available = num_slots;
+    return true;
+#else
+    (void)num_slots;
+    return false;
+#endif
+}
+
+bool map_windows(const uintptr_t start_page[], int num_windows)
+{
+    if (direct_mapped) {
+        // All of physical memory is already mapped.
+        return true;
+    }
+    if (num_windows > num_slots_available) {
+        return false;
+    }
+    for (int slot = 0; slot < num_windows; slot++) {
+        uintptr_t window = start_page[slot] >> (30 - PAGE_SHIFT);
+        slot_window[slot] = window;
+        if (start_page[slot] == NO_WINDOW || window < 2) {
+            // Either unused or less than 2 GB, so no mapping is required.
+            continue;
+        }
+        if (slot_pd == NULL) {
+            pdp[FIRST_SLOT_PDPT + slot] = ((uint64_t)window << 30) + 0x83;
+            invalidate_page(VM_SLOT_START + ((uintptr_t)slot << 30));
+        } else {
+            uint64_t *pd = slot_pd + slot * 512;
+            for (uintptr_t i = 0; i < 512; i++) {
+                pd[i] = ((uint64_t)window << 30) + (i << VM_PAGE_SHIFT) + 0x83;
+            }
+            pdp[FIRST_SLOT_PDPT + slot] = (uintptr_t)pd + 0x3;
+        }
+    }
+    // With 1GB pages, each slot's TLB entry has been invalidated above.
+    // Otherwise, reload the PDBR to flush any remnants of the old mapping.
+    if (slot_pd != NULL) {
+        load_pdbr();
+    }
+
+    num_slots_mapped = num_windows;
+    return true;
 }
 
 bool map_window(uintptr_t start_page)
 {
     uintptr_t window = start_page >> (30 - PAGE_SHIFT);
 
+    num_slots_mapped = 0;
+
+    if (direct_mapped) {
+        // All of physical memory is already mapped.
+        return true;
+    }
     if (window < 2) {
         // Less than 2 GB so no mapping is required.
         return true;
@@ -129,6 +469,14 @@ bool map_window(uintptr_t start_page)
          // for PAE and no long mode (ie. 32 bit CPU).
         return false;
     }
+    if (use_1gb_window()) {
+        // Only this CPU's TLB entry for the window needs to be invalidated.
+        // This also discards any cached entries for the old pd2 mapping.
+        pdp[WINDOW_PDPT] = ((uint64_t)window << 30) + 0x83;
+        invalidate_page(VM_WINDOW_START);
+        mapped_window = window;
+        return true;
+    }
     // Compute the page table entries.
     for (uintptr_t i = 0; i < 512; i++) {
         pd2[i] = ((uint64_t)window << 30) + (i << VM_PAGE_SHIFT) + 0x83;
@@ -140,9 +488,58 @@ bool map_window(uintptr_t start_page)
     return true;
 }
 
+bool map_window_uncached(uintptr_t start_page)
+{
+    uintptr_t window = start_page >> (30 - PAGE_SHIFT);
+
+    if (cpuid_info.flags.pae == 0) {
+        // No PAE, so paging is not enabled.
+        return false;
+    }
+    if (cpuid_info.flags.lm == 0 && (start_page >= PAGE_C(64,GB))) {
+        return false;
+    }
+    // Compute the page table entries, setting PCD and PWT to select the UC
+    // memory type whatever the PAT and MTRR settings.
+    for (uintptr_t i = 0; i < 512; i++) {
+        pd2[i] = ((uint64_t)window << 30) + (i << VM_PAGE_SHIFT) + 0x9b;
+    }
+    if (use_1gb_window()) {
+        // Undo any 1GB page mapping made by map_window().
+        pdp[WINDOW_PDPT] = (uintptr_t)pd2 + 0x3;
+    }
+    // Reload the PDBR to flush any remnants of the old mapping.
+    load_pdbr();
+
+    num_slots_mapped = 0;
+    mapped_window = window;
+    return true;
+}
+
+void *uncached_alias(const void *addr)
+{
+    uintptr_t page = page_of((void *)addr);
+    uintptr_t alias = PAGE_C(2,GB) + page % PAGE_C(1,GB);
+    return (void *)((alias << PAGE_SHIFT) + (uintptr_t)addr % PAGE_SIZE);
+}
+
 void *first_word_mapping(uintptr_t page)
 {
     void *result;
+#if (ARCH_BITS == 64)
+    if (direct_mapped) {
+        return (void *)(VM_DIRECT_MAP_START + (page << PAGE_SHIFT));
+    }
+    if (page >= PAGE_C(2,GB)) {
+        // Use a window slot if one contains this page.
+        uintptr_t window = page >> (30 - PAGE_SHIFT);
+        for (int slot = 0; slot < num_slots_mapped; slot++) {
+            if (slot_window[slot] == window) {
+                return (void *)(VM_SLOT_START + ((uintptr_t)slot << 30) + ((page % PAGE_C(1,GB)) << PAGE_SHIFT));
+            }
+        }
+    }
+#endif
     if (page < PAGE_C(2,GB)) {
         // If the address is less than 2GB, it is directly mapped.
         result = (void *)(page << PAGE_SHIFT);
@@ -161,6 +558,16 @@ void *last_word_mapping(uintptr_t page, size_t word_size)
 
 uintptr_t page_of(void *addr)
 {
+#if (ARCH_BITS == 64)
+    if ((uintptr_t)addr >= VM_DIRECT_MAP_START) {
+        return ((uintptr_t)addr - VM_DIRECT_MAP_START) >> PAGE_SHIFT;
+    }
+    if ((uintptr_t)addr >= VM_SLOT_START) {
+        uintptr_t offset = (uintptr_t)addr - VM_SLOT_START;
+        uintptr_t slot   = offset >> 30;
+        return (slot_window[slot] << (30 - PAGE_SHIFT)) + ((offset % SIZE_C(1,GB)) >> PAGE_SHIFT);
+    }
+#endif
     uintptr_t page = (uintptr_t)addr >> PAGE_SHIFT;
     if (page >= PAGE_C(2,GB)) {
         page = page % PAGE_C(1,GB);
@@ -12,6 +12,15 @@
  * leave the lower 2GB permanently mapped, and use the upper 2GB for mapping
  * the remaining physical memory as required.
  *
+ * In the 64-bit build, map_all_memory() may instead be used to map the whole
+ * of physical memory above the first 4GB of virtual address space, starting
+ * at \ref VM_DIRECT_MAP_START. After that, all physical memory is accessed
+ * through that mapping and map_window() no longer needs to do anything.
+ *
+ * Also in the 64-bit build, map_windows() may be used to map several windows
+ * at once, each in its own slot above the first 4GB of virtual address space.
+ * This allows each NUMA proximity domain to test its own memory concurrently.
+ *
  *//*
  * Copyright (C) 2020-2022 Martin Whitaker.
  */
@@ -34,6 +43,22 @@
  */
 #define VM_WINDOW_SIZE  PAGE_C(1,GB)
 
+/**
+ * The maximum number of windows that can be mapped by map_windows().
+ */
+#define MAX_WINDOW_SLOTS    16
+
+/**
+ * The value used in the start_page list passed to map_windows() to indicate
+ * that a slot is unused.
+ */
+#define NO_WINDOW           UINTPTR_MAX
+
+/**
+ * The virtual byte address at which map_all_memory() maps physical address 0.
+ */
+#define VM_DIRECT_MAP_START SIZE_C(512,GB)
+
 /**
  * Maps a physical memory region into the upper 2GB of virtual memory. The
  * virtual address will have the same alignment within a page as the physical
@@ -50,11 +75,80 @@
  */
 uintptr_t map_region(uintptr_t base_addr, size_t size, bool only_for_startup);
 
+/**
+ * Programs the page attribute table of the calling CPU core so that regions
+ * passed to set_write_combining() use the WC memory type. Must be called by
+ * each CPU core before it accesses such a region.
+ *
+ * \returns
+ * True if the CPU supports the PAT, otherwise false.
+ */
+bool init_write_combining(void);
+
+/**
+ * Changes a region mapped by map_region() to use the WC memory type. Only the
+ * pages that are wholly within the region are changed, and only if the region
+ * was mapped into the upper 1GB of the 4GB virtual address space.
+ *
+ * \param addr              - the virtual byte address returned by map_region().
+ * \param size              - the region size in bytes.
+ */
+void set_write_combining(uintptr_t addr, size_t size);
+
+/**
+ * Maps all physical memory up to the specified page into virtual memory at
+ * \ref VM_DIRECT_MAP_START, using 1GB pages if the CPU supports them, and
+ * 2MB pages otherwise. The page tables are allocated from the pinned heap.
+ * Only supported in the 64-bit build. Subsequent calls to first_word_mapping()
+ * will return addresses in this mapping for all physical memory pages.
+ *
+ * \param end_page          - the physical page number of the end of memory.
+ *
+ * \returns
+ * On success, true. On failure, false.
+ */
+bool map_all_memory(uintptr_t end_page);
+
+/**
+ * Reserves the page tables needed to map the specified number of window slots
+ * by calls to map_windows(). The page tables are allocated from the pinned
+ * heap. Only supported in the 64-bit build.
+ *
+ * \param num_slots         - the number of slots (at most \ref MAX_WINDOW_SLOTS).
+ *
+ * \returns
+ * On success, true. On failure, false.
+ */
+bool init_window_slots(int num_slots);
+
+/**
+ * Maps a list of \ref VM_WINDOW_SIZE regions of physical memory into virtual
+ * memory, each into its own slot. The physical memory regions must be aligned
+ * on a \ref VM_WINDOW_SIZE boundary. Regions below \ref VM_PINNED_SIZE need no
+ * mapping, and are accessed through the permanent mapping. The regions remain
+ * mapped until the next call to map_windows() or map_window(). Does nothing if
+ * map_all_memory() has succeeded.
+ *
+ * \param start_page        - the physical page numbers of the regions, or
+ *                            \ref NO_WINDOW for unused slots.
+ * \param num_windows       - the number of entries in start_page (must not be
+ *                            more than reserved by init_window_slots()).
+ *
+ * \returns
+ * On success, true. On failure, false.
+ */
+bool map_windows(const uintptr_t start_page[], int num_windows);
+
 /**
  * Maps a \ref VM_WINDOW_SIZE region of physical memory into the upper 2GB of
  * virtual memory. The physical memory region must be aligned on a \ref
  * VM_WINDOW_SIZE boundary. The virtual address will be similarly aligned.
- * The region will remain mapped until the next call to map_window().
+ * The region will remain mapped until the next call to map_window(). Does
+ * nothing if map_all_memory() has succeeded. In long mode, if the CPU
+ * supports 1GB pages, the region is mapped by a single 1GB page, and only
+ * its TLB entry is invalidated on the calling CPU, so the translations for
+ * the program and the permanently mapped regions stay cached. Each CPU
+ * that accesses the region must call this.
  *
  * \param start_page        - the physical page number of the region.
  *
@@ -63,10 +157,39 @@ uintptr_t map_region(uintptr_t base_addr, size_t size, bool only_for_startup);
  */
 bool map_window(uintptr_t start_page);
 
+/**
+ * Maps the \ref VM_WINDOW_SIZE region of physical memory that contains the
+ * specified page into the upper 2GB of virtual memory with caching disabled.
+ * Unlike map_window(), this also maps regions below \ref VM_PINNED_SIZE, so
+ * they can be accessed uncached without disabling the caches for the code and
+ * data that share the permanent mapping. The region will remain mapped until
+ * the next call to map_window(). Only supported when paging is enabled (i.e.
+ * when the CPU supports PAE).
+ *
+ * \param start_page        - a physical page number in the region.
+ *
+ * \returns
+ * On success, true. On failure, false.
+ */
+bool map_window_uncached(uintptr_t start_page);
+
+/**
+ * Returns the address at which the physical memory currently mapped at the
+ * specified virtual address is mapped by map_window_uncached(). The physical
+ * memory must be in the region mapped by the last call to that function.
+ *
+ * \param addr              - the virtual memory address.
+ *
+ * \returns
+ * The corresponding address in the uncached mapping.
+ */
+void *uncached_alias(const void *addr);
+
 /**
  * Returns a virtual memory pointer to the first word of the specified physical
  * memory page. Physical memory pages above \ref VM_PINNED_SIZE must have been
- * mapped by a call to map_window() prior to calling this function.
+ * mapped by a call to map_window() or map_windows() prior to calling this
+ * function.
  *
  * \param page              - the physical page number.
  *
@@ -78,7 +201,8 @@ void *first_word_mapping(uintptr_t page);
 /**
  * Returns a virtual memory pointer to the last word of the specified physical
  * memory page. Physical memory pages above \ref VM_PINNED_SIZE must have been
- * mapped by a call to map_window() prior to calling this function.
+ * mapped by a call to map_window() or map_windows() prior to calling this
+ * function.
  *
  * \param page              - the physical page number.
  * \param word_size         - the size of a word in bytes.
@@ -91,7 +215,8 @@ void *last_word_mapping(uintptr_t page, size_t word_size);
 /**
  * Returns the page number of the physical memory page containing the specified
  * virtual memory address. The specified address must either be permanently
- * mapped or mapped by a call to map_window() prior to calling this function.
+ * mapped or mapped by a call to map_window() or map_windows() prior to calling
+ * this function.
  *
  * \param addr              - the virtual memory address.
  *
@@ -37,6 +37,11 @@
 
 #define XHCI_EXT_CAP_LEGACY_SUPPORT     1
 #define XHCI_EXT_CAP_SUPPORTED_PROTOCOL 2
+#define XHCI_EXT_CAP_DEBUG              10
+
+// Capability Parameters 1 register
+
+#define XHCI_HCC_PPC                    0x00000008      // Port Power Control
 
 // USB Command register
 
@@ -51,6 +56,12 @@
 #define XHCI_USBSTS_HSE                 0x00000004      // Host System Error
 #define XHCI_USBSTS_CNR                 0x00000800      // Controller Not Ready
 
+// Debug Capability Control register
+
+#define XHCI_DBC_CTRL_DCR               0x00000001      // DbC Run
+#define XHCI_DBC_CTRL_LSE               0x00000002      // Link Status Event Enable
+#define XHCI_DBC_CTRL_DCE               0x80000000      // Debug Capability Enable
+
 // Port Status and Control register
 
 #define XHCI_PORT_SC_CCS                0x00000001      // Current Connect Status
@@ -141,6 +152,20 @@
 
 #define EP_TR_SIZE                      8       // TRBs    (multiple of 4 to maintain 64 byte alignment)
 
+#define DBC_ER_SIZE                     16      // TRBs    (multiple of 4 to maintain 64 byte alignment)
+#define DBC_TR_SIZE                     8       // TRBs    (multiple of 4 to maintain 64 byte alignment)
+
+#define DBC_STRING_SIZE                 64      // bytes per string descriptor
+#define DBC_BUFFER_SIZE                 2048    // bytes per OUT transfer
+
+// The debug device uses the same identity as the Linux early console, so a
+// Linux host binds its usb_debug driver and presents the device as a serial
+// port.
+#define DBC_VENDOR_ID                   0x1d6b
+#define DBC_PRODUCT_ID                  0x0011
+#define DBC_DEVICE_REV                  0x0010
+#define DBC_PROTOCOL                    1
+
 #define MILLISEC                        1000    // in microseconds
 
 #define DEVICE_WS_SIZE                  (XHCI_MAX_OP_CONTEXT_SIZE + 2 * sizeof(ep_tr_t))
@@ -202,6 +227,22 @@ typedef volatile struct {
 
 typedef volatile uint32_t xhci_db_reg_t;
 
+typedef volatile struct {
+    uint32_t            id;
+    uint32_t            doorbell;
+    uint32_t            erst_size;
+    uint32_t            reserved1;
+    uint64_t            erst_addr;
+    uint64_t            erdp;
+    uint32_t            control;
+    uint32_t            status;
+    uint32_t            port_sc;
+    uint32_t            reserved2;
+    uint64_t            context_ptr;
+    uint32_t            dev_info1;
+    uint32_t            dev_info2;
+} xhci_dbc_regs_t;
+
 // Extended capability structures defined by the XHCI specification.
 
 typedef struct {
@@ -291,6 +332,29 @@ typedef volatile struct {
     uint32_t            reserved2;
 } xhci_erst_entry_t  __attribute__ ((aligned (16)));
 
+// The debug capability context uses 64 byte contexts, whatever the size of
+// the host controller contexts.
+
+typedef struct {
+    uint64_t            string0_addr;
+    uint64_t            manufacturer_addr;
+    uint64_t            product_addr;
+    uint64_t            serial_addr;
+    uint8_t             string0_length;
+    uint8_t             manufacturer_length;
+    uint8_t             product_length;
+    uint8_t             serial_length;
+    uint32_t            reserved[7];
+} xhci_dbc_info_context_t  __attribute__ ((aligned (64)));
+
+typedef struct {
+    xhci_dbc_info_context_t info;
+    xhci_ep_context_t   out_ep;
+    uint32_t            reserved1[8];
+    xhci_ep_context_t   in_ep;
+    uint32_t            reserved2[8];
+} xhci_dbc_context_t  __attribute__ ((aligned (64)));
+
 // Data structures specific to this driver.
 
 typedef volatile struct {
@@ -344,6 +408,38 @@ typedef struct {
     uint8_t             kbd_ep_id   [MAX_KEYBOARDS];
 } workspace_t  __attribute__ ((aligned (64)));
 
+// The debug capability workspace fits in a single page, so the transfer
+// buffer never crosses a 64KB boundary.
+
+typedef struct {
+    // System memory data structures used by the debug capability.
+    xhci_erst_entry_t   erst    [WS_ERST_SIZE]  __attribute__ ((aligned (64)));   // event ring segment table
+    xhci_trb_t          er      [DBC_ER_SIZE]   __attribute__ ((aligned (64)));   // event ring
+    xhci_trb_t          out_tr  [DBC_TR_SIZE]   __attribute__ ((aligned (64)));   // OUT transfer ring
+    xhci_trb_t          in_tr   [DBC_TR_SIZE]   __attribute__ ((aligned (64)));   // IN transfer ring (unused)
+    xhci_dbc_context_t  context;
+    uint8_t             string  [4][DBC_STRING_SIZE];
+
+    // OUT data transfer buffer.
+    uint8_t             out_buffer[DBC_BUFFER_SIZE]  __attribute__ ((aligned (64)));
+
+    // Pointer to the debug capability registers.
+    xhci_dbc_regs_t     *regs;
+
+    // TRB ring state (cycle and index).
+    uint32_t            er_dequeue_state;
+    uint32_t            out_enqueue_state;
+
+    // True while an OUT transfer is in progress.
+    bool                out_busy;
+} dbc_workspace_t  __attribute__ ((aligned (64)));
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+static dbc_workspace_t  *dbc_ws = NULL;
+
 //------------------------------------------------------------------------------
 // Private Functions
 //------------------------------------------------------------------------------
@@ -459,6 +555,28 @@ static bool reset_xhci_port(xhci_op_regs_t *op_regs, int port_idx)
     return wait_until_set(&op_regs->port_regs[port_idx].sc, XHCI_PORT_SC_PRC, 1000*MILLISEC);
 }
 
+static void start_xhci_port_reset(xhci_op_regs_t *op_regs, int port_idx)
+{
+    write32(&op_regs->port_regs[port_idx].sc, XHCI_PORT_SC_PP | XHCI_PORT_SC_PR | XHCI_PORT_SC_PRC);
+}
+
+static void wait_for_xhci_port_resets(xhci_op_regs_t *op_regs, const bool port_resetting[], int num_ports)
+{
+    int timer = (1000*MILLISEC) >> 3;
+    while (timer > 0) {
+        bool all_done = true;
+        for (int port_idx = 0; port_idx < num_ports; port_idx++) {
+            if (port_resetting[port_idx] && (~read32(&op_regs->port_regs[port_idx].sc) & XHCI_PORT_SC_PRC)) {
+                all_done = false;
+                break;
+            }
+        }
+        if (all_done) return;
+        usleep(8);
+        timer--;
+    }
+}
+
 static void disable_xhci_port(xhci_op_regs_t *op_regs, int port_idx)
 {
     write32(&op_regs->port_regs[port_idx].sc, XHCI_PORT_SC_PP | XHCI_PORT_SC_PED);
@@ -597,6 +715,65 @@ static void issue_normal_trb(ep_tr_t *ep_tr, const void *buffer, uint32_t dir, s
     ep_tr->enqueue_state = enqueue_trb(ep_tr->tr, EP_TR_SIZE, ep_tr->enqueue_state, control, params1, params2);
 }
 
+// Builds a string descriptor for an ASCII string and returns its length.
+static uint8_t make_string_descriptor(uint8_t *desc, const char *str)
+{
+    int length = 2;
+    while (*str && length <= (DBC_STRING_SIZE - 2)) {
+        desc[length++] = *str++;
+        desc[length++] = 0;
+    }
+    desc[0] = length;
+    desc[1] = USB_DESC_STRING;
+    return length;
+}
+
+static void init_dbc_ep_context(xhci_ep_context_t *ep_context, int ep_type, int max_burst, xhci_trb_t *tr)
+{
+    ep_context->params2             = ep_type << 3;
+    ep_context->max_burst_size      = max_burst;
+    ep_context->max_packet_size     = 1024;
+    ep_context->tr_dequeue_ptr      = (uintptr_t)tr | 0x1;  // cycle = 1
+    ep_context->average_trb_length  = DBC_BUFFER_SIZE;
+}
+
+// Consumes any events posted by the debug capability, and returns true if
+// the debug capability is running, i.e. has been configured by a debug host.
+static bool poll_dbc(dbc_workspace_t *ws)
+{
+    while (true) {
+        uint32_t cycle = ws->er_dequeue_state / DBC_ER_SIZE;
+        uint32_t index = ws->er_dequeue_state % DBC_ER_SIZE;
+
+        uint32_t control = read32(&ws->er[index].control);
+        if ((control & 0x1) != cycle) break;
+
+        switch (control & XHCI_TRB_TYPE) {
+          case XHCI_TRB_TRANSFER_EVENT:
+            // We only send on the OUT endpoint, and only have one transfer
+            // in progress. If it failed, the data is lost.
+            ws->out_busy = false;
+            break;
+          default:
+            // Writing back the port status clears the change flags.
+            write32(&ws->regs->port_sc, read32(&ws->regs->port_sc));
+            break;
+        }
+
+        write64_(&ws->regs->erdp, (uintptr_t)(&ws->er[index]));
+
+        if (index == (DBC_ER_SIZE - 1)) {
+            cycle ^= 1;
+            index = 0;
+        } else {
+            index++;
+        }
+        ws->er_dequeue_state = cycle * DBC_ER_SIZE + index;
+    }
+
+    return read32(&ws->regs->control) & XHCI_DBC_CTRL_DCR;
+}
+
 //------------------------------------------------------------------------------
 // Driver Methods
 //------------------------------------------------------------------------------
@@ -1126,7 +1303,38 @@ bool xhci_probe(uintptr_t base_addr, usb_hcd_t *hcd)
     root_hub.ep0            = NULL;
     root_hub.num_ports      = cap_regs->hcs_params1 & 0xff;
 
-    usleep(100*MILLISEC);  // USB maximum device attach time.
+    // If the ports don't have power switches, they stayed powered when the
+    // controller was reset, so the waits for each controller can overlap.
+    if (cap_regs->hcc_params1 & XHCI_HCC_PPC) {
+        usleep(100*MILLISEC);  // USB maximum device attach time.
+    } else {
+        usb_wait_for_attach();
+    }
+
+    // Reset all the connected ports at once and wait for them together. Each
+    // root hub port is a separate link, and the controller addresses devices
+    // by slot rather than by the default address, so unlike the ports on an
+    // external hub they don't need to be reset one at a time.
+    bool port_resetting[XHCI_MAX_PORTS];
+    int num_resetting = 0;
+    for (int port_idx = 0; port_idx < root_hub.num_ports; port_idx++) {
+        port_resetting[port_idx] = false;
+
+        // We only expect to find keyboards on USB2 ports.
+        if (~port_type[port_idx] & PORT_TYPE_USB2) continue;
+
+        // Check if anything is connected to this port.
+        if (~read32(&op_regs->port_regs[port_idx].sc) & XHCI_PORT_SC_CCS) continue;
+
+        start_xhci_port_reset(op_regs, port_idx);
+        port_resetting[port_idx] = true;
+        num_resetting++;
+    }
+    if (num_resetting > 0) {
+        wait_for_xhci_port_resets(op_regs, port_resetting, root_hub.num_ports);
+
+        usleep(10*MILLISEC);  // USB reset recovery time
+    }
 
     // Scan the ports, looking for hubs and keyboards.
     usb_ep_t keyboards[MAX_KEYBOARDS];
@@ -1136,20 +1344,12 @@ bool xhci_probe(uintptr_t base_addr, usb_hcd_t *hcd)
         // If we've filled the keyboard info table, abort now.
         if (num_keyboards >= MAX_KEYBOARDS) break;
 
-        // We only expect to find keyboards on USB2 ports.
-        if (~port_type[port_idx] & PORT_TYPE_USB2) continue;
+        if (!port_resetting[port_idx]) continue;
 
         uint32_t port_status = read32(&op_regs->port_regs[port_idx].sc);
 
-        // Check if anything is connected to this port.
-        if (~port_status & XHCI_PORT_SC_CCS) continue;
-
-        // Reset the port.
-        if (!reset_xhci_port(op_regs, port_idx)) continue;
-
-        usleep(10*MILLISEC);  // USB reset recovery time
-
-        port_status = read32(&op_regs->port_regs[port_idx].sc);
+        // Check the port reset completed.
+        if (~port_status & XHCI_PORT_SC_PRC) continue;
 
         // Check the port is active.
         if (~port_status & XHCI_PORT_SC_CCS) continue;
@@ -1201,3 +1401,136 @@ no_keyboards_found:
     heap_rewind(HEAP_TYPE_HM_1, initial_hm_heap_mark);
     return false;
 }
+
+bool xhci_dbc_init(uintptr_t base_addr)
+{
+    if (dbc_ws != NULL) {
+        return false;
+    }
+
+    xhci_cap_regs_t *cap_regs = (xhci_cap_regs_t *)base_addr;
+
+#ifdef QEMU_WORKAROUND
+    xhci_cap_regs_t cap_regs_copy;
+    memcpy32(&cap_regs_copy, cap_regs, sizeof(cap_regs_copy));
+    cap_regs = &cap_regs_copy;
+#endif
+
+    // Walk the extra capabilities list, looking for the debug capability.
+    xhci_dbc_regs_t *regs = NULL;
+    uintptr_t ext_cap_base = base_addr;
+    uintptr_t ext_cap_offs = cap_regs->hcc_params1 >> 16;
+    while (ext_cap_offs != 0) {
+        ext_cap_base += ext_cap_offs * sizeof(uint32_t);
+        xhci_ext_cap_t *ext_cap = (xhci_ext_cap_t *)ext_cap_base;
+
+#ifdef QEMU_WORKAROUND
+        xhci_ext_cap_t ext_cap_copy;
+        memcpy32(&ext_cap_copy, ext_cap, sizeof(ext_cap_copy));
+        ext_cap = &ext_cap_copy;
+#endif
+        if (ext_cap->id == XHCI_EXT_CAP_DEBUG) {
+            regs = (xhci_dbc_regs_t *)ext_cap_base;
+            break;
+        }
+        ext_cap_offs = ext_cap->next_offset;
+    }
+    if (regs == NULL) {
+        return false;
+    }
+
+    // Make sure the debug capability is disabled before we set it up.
+    write32(&regs->control, 0);
+    if (!wait_until_clr(&regs->control, XHCI_DBC_CTRL_DCE, 1000*MILLISEC)) {
+        return false;
+    }
+
+    // Allocate and initialise the workspace. This needs to be permanently mapped into virtual memory.
+    uintptr_t initial_lm_heap_mark = heap_mark(HEAP_TYPE_LM_1);
+    uintptr_t workspace_addr = heap_alloc(HEAP_TYPE_LM_1, sizeof(dbc_workspace_t), PAGE_SIZE);
+    if (workspace_addr == 0) {
+        return false;
+    }
+    dbc_workspace_t *ws = (dbc_workspace_t *)workspace_addr;
+
+    memset(ws, 0, sizeof(dbc_workspace_t));
+
+    ws->regs = regs;
+
+    ws->er_dequeue_state  = DBC_ER_SIZE;  // cycle = 1, index = 0
+    ws->out_enqueue_state = DBC_TR_SIZE;  // cycle = 1, index = 0
+
+    // String descriptor 0 holds the supported language IDs (US English).
+    xhci_dbc_info_context_t *info = &ws->context.info;
+    ws->string[0][0] = 4;
+    ws->string[0][1] = USB_DESC_STRING;
+    ws->string[0][2] = 0x09;
+    ws->string[0][3] = 0x04;
+    info->string0_addr          = (uintptr_t)ws->string[0];
+    info->string0_length        = 4;
+    info->manufacturer_addr     = (uintptr_t)ws->string[1];
+    info->manufacturer_length   = make_string_descriptor(ws->string[1], "Memtest86+");
+    info->product_addr          = (uintptr_t)ws->string[2];
+    info->product_length        = make_string_descriptor(ws->string[2], "Memtest86+ Console");
+    info->serial_addr           = (uintptr_t)ws->string[3];
+    info->serial_length         = make_string_descriptor(ws->string[3], "0");
+
+    int max_burst = (read32(&regs->control) >> 16) & 0xff;
+    init_dbc_ep_context(&ws->context.out_ep, XHCI_EP_BULK_OUT, max_burst, ws->out_tr);
+    init_dbc_ep_context(&ws->context.in_ep,  XHCI_EP_BULK_IN,  max_burst, ws->in_tr);
+
+    // Initialise the ERST. We only use the first segment.
+    ws->erst[0].segment_addr = (uintptr_t)(&ws->er);
+    ws->erst[0].segment_size = DBC_ER_SIZE;
+
+    write32(&regs->erst_size, 1);
+    write64_(&regs->erst_addr,   (uintptr_t)(&ws->erst));
+    write64_(&regs->erdp,        (uintptr_t)(&ws->er));
+    write64_(&regs->context_ptr, (uintptr_t)(&ws->context));
+    write32(&regs->dev_info1, DBC_VENDOR_ID << 16 | DBC_PROTOCOL);
+    write32(&regs->dev_info2, DBC_DEVICE_REV << 16 | DBC_PRODUCT_ID);
+
+    // Enable the debug capability. It runs once a debug host has attached to
+    // the debug port and configured the debug device.
+    write32(&regs->control, XHCI_DBC_CTRL_DCE | XHCI_DBC_CTRL_LSE);
+    if (!wait_until_set(&regs->control, XHCI_DBC_CTRL_DCE, 1000*MILLISEC)) {
+        write32(&regs->control, 0);
+        heap_rewind(HEAP_TYPE_LM_1, initial_lm_heap_mark);
+        return false;
+    }
+
+    dbc_ws = ws;
+
+    return true;
+}
+
+bool xhci_dbc_ready(void)
+{
+    if (dbc_ws == NULL) {
+        return false;
+    }
+    return poll_dbc(dbc_ws);
+}
+
+int xhci_dbc_write(const void *data, int length)
+{
+    dbc_workspace_t *ws = dbc_ws;
+
+    if (ws == NULL || length <= 0 || !poll_dbc(ws) || ws->out_busy) {
+        return 0;
+    }
+    if (length > DBC_BUFFER_SIZE) {
+        length = DBC_BUFFER_SIZE;
+    }
+    memcpy(ws->out_buffer, data, length);
+
+    uint32_t control = XHCI_TRB_NORMAL | XHCI_TRB_IOC;
+    ws->out_enqueue_state = enqueue_trb(ws->out_tr, DBC_TR_SIZE, ws->out_enqueue_state,
+                                        control, (uintptr_t)ws->out_buffer, length);
+    ws->out_busy = true;
+
+    // Doorbell target 0 selects the OUT endpoint.
+    write32(&ws->regs->doorbell, 0);
+
+    return length;
+}
@@ -4,7 +4,8 @@
 /**
  * \file
  *
- * Provides support for USB keyboards connected via an XHCI controller.
+ * Provides support for USB keyboards connected via an XHCI controller, and
+ * for an output channel using the XHCI Debug Capability.
  *
  *//*
  * Copyright (C) 2021-2022 Martin Whitaker.
@@ -43,4 +44,34 @@ bool xhci_reset(uintptr_t base_addr);
  */
 bool xhci_probe(uintptr_t base_addr, usb_hcd_t *hcd);
 
+/**
+ * Sets up the Debug Capability of the XHCI device at the specified base
+ * address, if it has one, so that the device presents a USB debug device
+ * on its debug port. This must be done after the device has been reset,
+ * as a reset disables the Debug Capability. Only one Debug Capability is
+ * used.
+ *
+ * \param base_addr - the base address of the device in virtual memory
+ *
+ * \returns
+ * true if the Debug Capability was successfully enabled, otherwise false.
+ */
+bool xhci_dbc_init(uintptr_t base_addr);
+
+/**
+ * Returns true if a debug host has attached to the debug device and
+ * configured it, so data can be sent.
+ */
+bool xhci_dbc_ready(void);
+
+/**
+ * Starts sending up to length bytes of data to the debug host, without
+ * waiting. Only one transfer is in progress at any time.
+ *
+ * \returns
+ * the number of bytes that will be sent, or 0 if the previous transfer
+ * has not completed or no debug host is attached.
+ */
+int xhci_dbc_write(const void *data, int length);
+
 #endif // XHCI_H
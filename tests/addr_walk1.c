@@ -12,8 +12,11 @@
 // Released under version 2 of the Gnu Public License.
 // By Chris Brady
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#include "vmem.h"
+
 #include "display.h"
 #include "error.h"
 #include "test.h"
@@ -25,12 +28,12 @@
 // Public Functions
 //------------------------------------------------------------------------------
 
-int test_addr_walk1(int my_cpu)
+int test_addr_walk1(int my_cpu, bool uncached)
 {
     int ticks = 0;
 
     // There isn't a meaningful address for this test.
-    test_addr[my_cpu] = 0;
+    cpu_context[my_cpu].test_addr = 0;
 
     testword_t invert = 0;
     for (int i = 0; i < 2; i++) {
@@ -45,6 +48,11 @@ int test_addr_walk1(int my_cpu)
         for (int j = 0; j < vm_map_size; j++) {
             uintptr_t pb = (uintptr_t)vm_map[j].start;
             uintptr_t pe = (uintptr_t)vm_map[j].end;
+            if (uncached) {
+                // The alias has the same alignment within the window.
+                pb = (uintptr_t)uncached_alias(vm_map[j].start);
+                pe = (uintptr_t)uncached_alias(vm_map[j].end);
+            }
 
             // Walking one on our first address.
             uintptr_t mask1 = sizeof(testword_t);
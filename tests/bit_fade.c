@@ -15,20 +15,81 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "cpuinfo.h"
+#include "idle.h"
+#include "tsc.h"
 #include "unistd.h"
 
+#include "config.h"
 #include "display.h"
 #include "error.h"
 #include "test.h"
 
 #include "test_funcs.h"
 #include "test_helper.h"
+#include "test_kernels.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define EXERCISE_CHUNK_SIZE (1 << 20)   // in testwords, between checks of the fade time
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+// While the memory fades, the first CPU core to start the delay keeps time and
+// counts the seconds in fade_clock. The others sleep until it changes. The
+// delay ends when fade_clock reaches fade_end.
+
+static volatile uint32_t fade_clock = 0;
+static volatile uint32_t fade_end   = 0;
 
 //------------------------------------------------------------------------------
 // Private Functions
 //------------------------------------------------------------------------------
 
-static int pattern_fill(int my_cpu, testword_t pattern)
+// Limits the range [*start, *end] to the lower (half 0) or upper (half 1) half
+// of the specified segment. A negative half selects the whole segment. Returns
+// false if nothing is left of the range.
+
+static bool clip_to_half(int segment, int half, testword_t **start, testword_t **end)
+{
+    if (half < 0) {
+        return true;
+    }
+    testword_t *mid = vm_map[segment].start + (vm_map[segment].end - vm_map[segment].start) / 2;
+    if (half == 0) {
+        if (*start > mid) {
+            return false;
+        }
+        if (*end > mid) {
+            *end = mid;
+        }
+    } else {
+        if (*end <= mid) {
+            return false;
+        }
+        if (*start <= mid) {
+            *start = mid + 1;
+        }
+    }
+    return true;
+}
+
+// Returns the half of each segment to be faded with the specified pattern, or
+// -1 if the whole segment is to be faded.
+
+static int faded_half(bool ones)
+{
+    if (!enable_fade_overlap) {
+        return -1;
+    }
+    return (pass_num + ones) & 1;
+}
+
+static int pattern_fill(int my_cpu, testword_t pattern, int half)
 {
     int ticks = 0;
 
@@ -40,29 +101,23 @@ static int pattern_fill(int my_cpu, testword_t pattern)
         testword_t *start = vm_map[i].start;
         testword_t *end   = vm_map[i].end;
 
-        testword_t *p  = start;
-        testword_t *pe = start;
-
-        bool at_end = false;
-        do {
-            // take care to avoid pointer overflow
-            if ((end - pe) >= SPIN_SIZE) {
-                pe += SPIN_SIZE - 1;
-            } else {
-                at_end = true;
-                pe = end;
-            }
+        testword_t *p  = NULL;
+        testword_t *pe = NULL;
+        while (next_block(start, end, spin_size, false, &p, &pe)) {
             ticks++;
             if (my_cpu < 0) {
                 continue;
             }
-            test_addr[my_cpu] = (uintptr_t)p;
-            do {
-                write_word(p, pattern);
-            } while (p++ < pe); // test before increment in case pointer overflows
+            cpu_context[my_cpu].test_addr = (uintptr_t)p;
+            testword_t *fill_start = p;
+            testword_t *fill_end   = pe;
+            if (clip_to_half(i, half, &fill_start, &fill_end)) {
+                fill_words(fill_start, fill_end, pattern);
+            }
+            count_test_data(my_cpu, (uintptr_t)pe - cpu_context[my_cpu].test_addr + sizeof(testword_t));
             do_tick(my_cpu);
             BAILOUT;
-        } while (!at_end && ++pe); // advance pe to next start point
+        }
     }
 
     flush_caches(my_cpu);
@@ -70,7 +125,7 @@ static int pattern_fill(int my_cpu, testword_t pattern)
     return ticks;
 }
 
-static int pattern_check(int my_cpu, testword_t pattern)
+static int pattern_check(int my_cpu, testword_t pattern, int half)
 {
     int ticks = 0;
 
@@ -78,32 +133,56 @@ static int pattern_check(int my_cpu, testword_t pattern)
         testword_t *start = vm_map[i].start;
         testword_t *end   = vm_map[i].end;
 
-        testword_t *p  = start;
-        testword_t *pe = start;
-
-        bool at_end = false;
-        do {
-            // take care to avoid pointer overflow
-            if ((end - pe) >= SPIN_SIZE) {
-                pe += SPIN_SIZE - 1;
-            } else {
-                at_end = true;
-                pe = end;
-            }
+        testword_t *p  = NULL;
+        testword_t *pe = NULL;
+        while (next_block(start, end, spin_size, false, &p, &pe)) {
             ticks++;
             if (my_cpu < 0) {
                 continue;
             }
-            test_addr[my_cpu] = (uintptr_t)p;
-            do {
-                testword_t actual = read_word(p);
-                if (unlikely(actual != pattern)) {
-                    data_error(p, pattern, actual, true);
-                }
-            } while (p++ < pe); // test before increment in case pointer overflows
+            cpu_context[my_cpu].test_addr = (uintptr_t)p;
+            testword_t *check_start = p;
+            testword_t *check_end   = pe;
+            if (clip_to_half(i, half, &check_start, &check_end)) {
+                test_kernel->pattern_check(check_start, check_end, pattern);
+            }
+            count_test_data(my_cpu, (uintptr_t)pe - cpu_context[my_cpu].test_addr + sizeof(testword_t));
             do_tick(my_cpu);
             BAILOUT;
-        } while (!at_end && ++pe); // advance pe to next start point
+        }
+    }
+
+    return ticks;
+}
+
+// Sleeps for a second, in steps of a tick period, so the display and the
+// keyboard stay responsive. Returns early if the test is being abandoned.
+
+static void fade_second(int my_cpu)
+{
+    for (int step = 0; step < 1000 / TICK_PERIOD && !bail; step++) {
+        usleep(TICK_PERIOD * 1000);
+        poll_housekeeping(my_cpu);
+    }
+}
+
+// Performs a tick each time the fade timekeeper counts a second, sleeping in
+// between, until the delay ends. Returns the number of ticks performed.
+
+static int fade_sleep(int my_cpu)
+{
+    int ticks = 0;
+
+    uint32_t seen = fade_clock;
+    while ((int32_t)(fade_end - seen) > 0) {
+        idle_wait(&fade_clock, seen);
+        uint32_t now = fade_clock;
+        while (seen != now) {
+            seen++;
+            ticks++;
+            do_tick(my_cpu);
+        }
+        BAILOUT;
     }
 
     return ticks;
@@ -116,13 +195,33 @@ static int fade_delay(int my_cpu, int sleep_secs)
     if (my_cpu == master_cpu) {
         display_test_stage_description("fade over %i seconds", sleep_secs);
     }
+    if (my_cpu >= 0 && power_save != POWER_SAVE_OFF && idle_wait_sleeps()) {
+        uint32_t end = fade_end;
+        uint32_t now = fade_clock;
+        if ((int32_t)(end - now) > 0 || !__sync_bool_compare_and_swap(&fade_end, end, now + sleep_secs)) {
+            // Another core is keeping time.
+            return fade_sleep(my_cpu);
+        }
+        while (ticks < sleep_secs) {
+            fade_second(my_cpu);
+            ticks++;
+            do_tick(my_cpu);
+            if (bail) {
+                // End the delay for the sleeping cores too.
+                fade_end = fade_clock + 1;
+            }
+            __sync_fetch_and_add(&fade_clock, 1);
+            BAILOUT;
+        }
+        return ticks;
+    }
     while (sleep_secs > 0) {
         sleep_secs--;
         ticks++;
         if (my_cpu < 0) {
             continue;
         }
-        sleep(1);
+        fade_second(my_cpu);
         do_tick(my_cpu);
         BAILOUT;
     }
@@ -130,6 +229,100 @@ static int fade_delay(int my_cpu, int sleep_secs)
     return ticks;
 }
 
+// Runs one moving inversions sweep over the specified half of each segment,
+// checking for 'expect' and writing 'replace', in chunks. After each chunk,
+// performs a tick for each second that has passed since 'start_time', up to
+// 'sleep_secs'. Returns the number of ticks performed.
+
+static int exercise_sweep(int my_cpu, int half, bool top_down, testword_t expect, testword_t replace,
+                          uint64_t start_time, int sleep_secs, int ticks)
+{
+    for (int n = 0; n < vm_map_size; n++) {
+        int i = top_down ? vm_map_size - 1 - n : n;
+        testword_t *start = vm_map[i].start;
+        testword_t *end   = vm_map[i].end;
+        if (!clip_to_half(i, half, &start, &end)) {
+            continue;
+        }
+        testword_t *chunk_start = NULL;
+        testword_t *chunk_end   = NULL;
+        while (next_block(start, end, EXERCISE_CHUNK_SIZE, top_down, &chunk_start, &chunk_end)) {
+            if (top_down) {
+                cpu_context[my_cpu].test_addr = (uintptr_t)chunk_end;
+                test_kernel->check_write_down(chunk_start, chunk_end, expect, replace);
+            } else {
+                cpu_context[my_cpu].test_addr = (uintptr_t)chunk_start;
+                test_kernel->check_write_up(chunk_start, chunk_end, expect, replace);
+            }
+            count_test_data(my_cpu, (uintptr_t)chunk_end - (uintptr_t)chunk_start + sizeof(testword_t));
+            poll_housekeeping(my_cpu);
+            BAILOUT;
+            uint64_t elapsed_secs = (get_tsc() - start_time) / (clks_per_msec * 1000);
+            while (ticks < sleep_secs && ticks < (int)elapsed_secs) {
+                ticks++;
+                do_tick(my_cpu);
+                BAILOUT;
+            }
+        }
+    }
+    return ticks;
+}
+
+// Waits for the fade period, while running moving inversions with patterns of
+// all zeros and all ones over the half of each segment that isn't fading.
+
+static int fade_exercise(int my_cpu, int fading_half, int sleep_secs)
+{
+    int ticks = 0;
+
+    int half = 1 - fading_half;
+
+    bool have_memory = false;
+    for (int i = 0; i < vm_map_size; i++) {
+        testword_t *start = vm_map[i].start;
+        testword_t *end   = vm_map[i].end;
+        have_memory |= clip_to_half(i, half, &start, &end);
+    }
+    if (!have_memory) {
+        return fade_delay(my_cpu, sleep_secs);
+    }
+
+    if (my_cpu == master_cpu) {
+        display_test_stage_description("fade over %i seconds, testing other half", sleep_secs);
+    }
+    if (my_cpu < 0) {
+        return sleep_secs;
+    }
+
+    uint64_t start_time = get_tsc();
+
+    testword_t pattern = 0;
+    for (int i = 0; i < vm_map_size; i++) {
+        testword_t *start = vm_map[i].start;
+        testword_t *end   = vm_map[i].end;
+        if (clip_to_half(i, half, &start, &end)) {
+            fill_words(start, end, pattern);
+        }
+    }
+    while (ticks < sleep_secs) {
+        ticks = exercise_sweep(my_cpu, half, false, pattern, ~pattern, start_time, sleep_secs, ticks);
+        BAILOUT;
+        ticks = exercise_sweep(my_cpu, half, true, ~pattern, pattern, start_time, sleep_secs, ticks);
+        BAILOUT;
+        pattern = ~pattern;
+    }
+
+    return ticks;
+}
+
+static int fade_wait(int my_cpu, int fading_half, int sleep_secs)
+{
+    if (fading_half >= 0 && clks_per_msec > 0) {
+        return fade_exercise(my_cpu, fading_half, sleep_secs);
+    }
+    return fade_delay(my_cpu, sleep_secs);
+}
+
 //------------------------------------------------------------------------------
 // Public Functions
 //------------------------------------------------------------------------------
@@ -145,28 +338,28 @@ int test_bit_fade(int my_cpu, int stage, int sleep_secs)
 
     switch (stage) {
       case 0:
-        ticks = pattern_fill(my_cpu, all_zero);
+        ticks = pattern_fill(my_cpu, all_zero, faded_half(false));
         break;
       case 1:
         // Only sleep once.
         if (stage != last_stage) {
-            ticks = fade_delay(my_cpu, sleep_secs);
+            ticks = fade_wait(my_cpu, faded_half(false), sleep_secs);
         }
         break;
       case 2:
-        ticks = pattern_check(my_cpu, all_zero);
+        ticks = pattern_check(my_cpu, all_zero, faded_half(false));
         break;
       case 3:
-        ticks = pattern_fill(my_cpu, all_ones);
+        ticks = pattern_fill(my_cpu, all_ones, faded_half(true));
         break;
       case 4:
         // Only sleep once.
         if (stage != last_stage) {
-            ticks = fade_delay(my_cpu, sleep_secs);
+            ticks = fade_wait(my_cpu, faded_half(true), sleep_secs);
         }
         break;
       case 5:
-        ticks = pattern_check(my_cpu, all_ones);
+        ticks = pattern_check(my_cpu, all_ones, faded_half(true));
         break;
       default:
         break;
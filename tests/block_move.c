@@ -16,12 +16,74 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "ioat.h"
+
+#include "config.h"
 #include "display.h"
 #include "error.h"
 #include "test.h"
 
 #include "test_funcs.h"
 #include "test_helper.h"
+#include "test_kernels.h"
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+// Performs one iteration of the moves on the block from p to pe (inclusive).
+// At the end of all this
+// - the second half equals the initial value of the first half
+// - the first half is rotated up by 8 words (with wrapping)
+static void move_block(testword_t *p, testword_t *pe)
+{
+    size_t half_length = (pe - p + 1) / 2;
+    testword_t *pm = p + half_length;
+
+    // Move first half to second half.
+    move_words(pm, p, half_length);
+
+    // Move the second half, less the last 8 words, to the first half, offset plus 8 words.
+    move_words(p + 8, pm, half_length - 8);
+
+    // Move the last 8 words of the second half to the start of the first half.
+    move_words(p, pm + half_length - 8, 8);
+}
+
+// Queues and starts the same moves as move_block() on the DMA channel. Each
+// move reads what the previous one wrote, so each is fenced. Returns false,
+// with nothing queued, if the channel can't take them.
+static bool start_dma_block(int chan, testword_t *p, testword_t *pe)
+{
+    size_t half_length = (pe - p + 1) / 2;
+    testword_t *pm = p + half_length;
+
+    size_t half_bytes = half_length * sizeof(testword_t);
+    if (ioat_queue_copy(chan, pm, p, half_bytes, true)
+    &&  ioat_queue_copy(chan, p + 8, pm, half_bytes - 8 * sizeof(testword_t), true)
+    &&  ioat_queue_copy(chan, p, pm + half_length - 8, 8 * sizeof(testword_t), true)) {
+        ioat_start(chan);
+        return true;
+    }
+    ioat_cancel(chan);
+    return false;
+}
+
+// Waits for the DMA channel to finish the last iteration of the moves on the
+// block from p to pe. If the channel failed, the block contents are undefined,
+// so the block is reinitialised and the first 'iterations' iterations are
+// redone by the CPU.
+static void finish_dma_block(int my_cpu, int chan, testword_t *p, testword_t *pe, int iterations)
+{
+    if (ioat_wait(chan)) {
+        return;
+    }
+    trace(my_cpu, "DMA channel %i failed at %x", chan, (uintptr_t)p);
+    test_kernel->block_fill(p, pe);
+    for (int j = 0; j < iterations; j++) {
+        move_block(p, pe);
+    }
+}
 
 //------------------------------------------------------------------------------
 // Public Functions
@@ -35,53 +97,27 @@ int test_block_move(int my_cpu, int iterations)
         display_test_pattern_name("block move");
     }
 
+    int chan = dma_channel(my_cpu);
+
     // Initialize memory with the initial pattern.
     for (int i = 0; i < vm_map_size; i++) {
         testword_t *start, *end;
         calculate_chunk(&start, &end, my_cpu, i, 16 * sizeof(testword_t));
         if ((end - start) < 15) SKIP_RANGE(1)  // we need at least 16 words for this test
 
-        testword_t *p  = start;
-        testword_t *pe = start;
-
-        bool at_end = false;
-        do {
-            // take care to avoid pointer overflow
-            if ((end - pe) >= SPIN_SIZE) {
-                pe += SPIN_SIZE - 1;
-            } else {
-                at_end = true;
-                pe = end;
-            }
+        testword_t *p  = NULL;
+        testword_t *pe = NULL;
+        while (next_block(start, end, spin_size, false, &p, &pe)) {
             ticks++;
             if (my_cpu < 0) {
                 continue;
             }
-            test_addr[my_cpu] = (uintptr_t)p;
-            testword_t pattern1 = 1;
-            do {
-                testword_t pattern2 = ~pattern1;
-                write_word(p + 0,  pattern1);
-                write_word(p + 1,  pattern1);
-                write_word(p + 2,  pattern1);
-                write_word(p + 3,  pattern1);
-                write_word(p + 4,  pattern2);
-                write_word(p + 5,  pattern2);
-                write_word(p + 6,  pattern1);
-                write_word(p + 7,  pattern1);
-                write_word(p + 8,  pattern1);
-                write_word(p + 9,  pattern1);
-                write_word(p + 10, pattern2);
-                write_word(p + 11, pattern2);
-                write_word(p + 12, pattern1);
-                write_word(p + 13, pattern1);
-                write_word(p + 14, pattern2);
-                write_word(p + 15, pattern2);
-                pattern1 = pattern1 << 1 | pattern1 >> (TESTWORD_WIDTH - 1);  // rotate left
-            } while (p <= (pe - 16) && (p += 16)); // test before increment in case pointer overflows
+            cpu_context[my_cpu].test_addr = (uintptr_t)p;
+            test_kernel->block_fill(p, pe);
+            count_test_data(my_cpu, (uintptr_t)pe - cpu_context[my_cpu].test_addr + sizeof(testword_t));
             do_tick(my_cpu);
             BAILOUT;
-        } while (!at_end && ++pe); // advance pe to next start point
+        }
     }
     flush_caches(my_cpu);
 
@@ -92,108 +128,51 @@ int test_block_move(int my_cpu, int iterations)
         calculate_chunk(&start, &end, my_cpu, i, 16 * sizeof(testword_t));
         if ((end - start) < 15) SKIP_RANGE(iterations)  // we need at least 16 words for this test
 
-        testword_t *p  = start;
-        testword_t *pe = start;
-        bool at_end = false;
-        do {
-            // take care to avoid pointer overflow
-            if ((end - pe) >= SPIN_SIZE) {
-                pe += SPIN_SIZE - 1;
-            } else {
-                at_end = true;
-                pe = end;
+        // The chunk is a multiple of 16 words, and so is spin_size, so each
+        // block is at least 16 words. With a DMA channel, the channel moves
+        // one block while the CPU moves the next one, if there is one.
+        testword_t *p  = NULL;
+        testword_t *pe = NULL;
+        bool have_block = next_block(start, end, spin_size, false, &p, &pe);
+        while (have_block) {
+            testword_t *dp  = NULL;
+            testword_t *dpe = NULL;
+            if (chan >= 0) {
+                dp  = p;
+                dpe = pe;
+                have_block = next_block(start, end, spin_size, false, &p, &pe);
             }
-
-            size_t half_length = (pe - p + 1) / 2;
-            testword_t *pm = p + half_length;
+            bool cpu_block = have_block;
 
             for (int j = 0; j < iterations; j++) {
-                ticks++;
+                ticks += (dp != NULL) + cpu_block;
                 if (my_cpu < 0) {
                     continue;
                 }
-                test_addr[my_cpu] = (uintptr_t)p;
-#ifdef __x86_64__
-                __asm__ __volatile__ (
-                    "cld\n"
-                    "jmp L110\n\t"
-
-                    ".p2align 4,,7\n\t"
-                    "L110:\n\t"
-
-                    // At the end of all this
-                    // - the second half equals the initial value of the first half
-                    // - the first half is right shifted 64-bytes (with wrapping)
-
-                    // Move first half to second half
-                    "movq %1,%%rdi\n\t"     // Destination, pm (mid point)
-                    "movq %0,%%rsi\n\t"     // Source, p (start point)
-                    "movq %2,%%rcx\n\t"     // Length, half_length (size of a half in DWORDS)
-                    "rep\n\t"
-                    "movsq\n\t"
-
-                    // Move the second half, less the last 64 bytes, to the first half, offset plus 64 bytes
-                    "movq %0,%%rdi\n\t"
-                    "addq $64,%%rdi\n\t"    // Destination, p (start-point) plus 32 bytes
-                    "movq %1,%%rsi\n\t"     // Source, pm (mid-point)
-                    "movq %2,%%rcx\n\t"
-                    "subq $8,%%rcx\n\t"     // Length, half_length (size of a half in QWORDS) minus 8 QWORDS (64 bytes)
-                    "rep\n\t"
-                    "movsq\n\t"
-
-                    // Move last 8 QWORDS (64 bytes) of the second half to the start of the first half
-                    "movq %0,%%rdi\n\t"     // Destination, p(start-point)
-                                            // Source, 8 QWORDS from the end of the second half, left over by the last rep/movsl
-                    "movq $8,%%rcx\n\t"     // Length, 8 QWORDS (64 bytes)
-                    "rep\n\t"
-                    "movsq\n\t"
-
-                    :: "g" (p), "g" (pm), "g" (half_length)
-                    : "rdi", "rsi", "rcx"
-                );
-#else
-                __asm__ __volatile__ (
-                    "cld\n"
-                    "jmp L110\n\t"
-
-                    ".p2align 4,,7\n\t"
-                    "L110:\n\t"
-
-                    // At the end of all this
-                    // - the second half equals the initial value of the first half
-                    // - the first half is right shifted 32 bytes (with wrapping)
-
-                    // Move first half to second half
-                    "movl %1,%%edi\n\t"     // Destination, pm (mid point)
-                    "movl %0,%%esi\n\t"     // Source, p (start point)
-                    "movl %2,%%ecx\n\t"     // Length, half_length (size of a half in DWORDS)
-                    "rep\n\t"
-                    "movsl\n\t"
-
-                    // Move the second half, less the last 32 bytes, to the first half, offset plus 32 bytes
-                    "movl %0,%%edi\n\t"
-                    "addl $32,%%edi\n\t"    // Destination, p (start-point) plus 32 bytes
-                    "movl %1,%%esi\n\t"     // Source, pm (mid-point)
-                    "movl %2,%%ecx\n\t"
-                    "subl $8,%%ecx\n\t"     // Length, half_length (size of a half in DWORDS) minus 8 DWORDS (32 bytes)
-                    "rep\n\t"
-                    "movsl\n\t"
-
-                    // Move last 8 DWORDS (32 bytes) of the second half to the start of the first half
-                    "movl %0,%%edi\n\t"     // Destination, p(start-point)
-                                            // Source, 8 DWORDS from the end of the second half, left over by the last rep/movsl
-                    "movl $8,%%ecx\n\t"     // Length, 8 DWORDS (32 bytes)
-                    "rep\n\t"
-                    "movsl\n\t"
-
-                    :: "g" (p), "g" (pm), "g" (half_length)
-                    : "edi", "esi", "ecx"
-                );
-#endif
-                do_tick(my_cpu);
+                bool use_dma = dp != NULL && start_dma_block(chan, dp, dpe);
+                if (dp != NULL && !use_dma) {
+                    cpu_context[my_cpu].test_addr = (uintptr_t)dp;
+                    move_block(dp, dpe);
+                }
+                if (cpu_block) {
+                    cpu_context[my_cpu].test_addr = (uintptr_t)p;
+                    move_block(p, pe);
+                    count_test_data(my_cpu, (uintptr_t)pe - (uintptr_t)p + sizeof(testword_t));
+                    do_tick(my_cpu);
+                }
+                if (dp != NULL) {
+                    if (use_dma) {
+                        finish_dma_block(my_cpu, chan, dp, dpe, j + 1);
+                    }
+                    count_test_data(my_cpu, (uintptr_t)dpe - (uintptr_t)dp + sizeof(testword_t));
+                    do_tick(my_cpu);
+                }
                 BAILOUT;
             }
-        } while (!at_end && ++pe); // advance pe to next start point
+            if (cpu_block) {
+                have_block = next_block(start, end, spin_size, false, &p, &pe);
+            }
+        }
     }
 
     flush_caches(my_cpu);
@@ -205,33 +184,19 @@ int test_block_move(int my_cpu, int iterations)
         calculate_chunk(&start, &end, my_cpu, i, 16 * sizeof(testword_t));
         if ((end - start) < 15) SKIP_RANGE(1)  // we need at least 16 words for this test
 
-        testword_t *p  = start;
-        testword_t *pe = start;
-
-        bool at_end = false;
-        do {
-            // take care to avoid pointer overflow
-            if ((end - pe) >= SPIN_SIZE) {
-                pe += SPIN_SIZE - 1;
-            } else {
-                at_end = true;
-                pe = end;
-            }
+        testword_t *p  = NULL;
+        testword_t *pe = NULL;
+        while (next_block(start, end, spin_size, false, &p, &pe)) {
             ticks++;
             if (my_cpu < 0) {
                 continue;
             }
-            test_addr[my_cpu] = (uintptr_t)p;
-            do {
-                testword_t p0 = read_word(p + 0);
-                testword_t p1 = read_word(p + 1);
-                if (unlikely(p0 != p1)) {
-                    data_error(p, p0, p1, false);
-                }
-            } while (p <= (pe - 2) && (p += 2)); // test before increment in case pointer overflows
+            cpu_context[my_cpu].test_addr = (uintptr_t)p;
+            test_kernel->pair_check(p, pe);
+            count_test_data(my_cpu, (uintptr_t)pe - cpu_context[my_cpu].test_addr + sizeof(testword_t));
             do_tick(my_cpu);
             BAILOUT;
-        } while (!at_end && ++pe); // advance pe to next start point
+        }
     }
 
     return ticks;
@@ -0,0 +1,384 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+//
+// Implements the coherence test. In the other tests, each CPU core works on
+// its own part of memory, so the cache coherence links between the packages
+// only carry the occasional line. In this test, all the active CPU cores pass
+// the ownership of a small set of cache lines from one to another, many times
+// over, so that each line keeps moving between caches.
+//
+// Each shared line holds a counter, a sequence number, and data words derived
+// from the sequence number. The CPU cores take turns to own each line, in an
+// order that alternates between the proximity domains (the packages, when the
+// ACPI SRAT is available). When it is a core's turn, it checks the data words
+// hold the values written by the previous owner, increments the counter with a
+// locked read-modify-write, writes the data words for the next sequence number
+// with plain stores, and finally stores the next sequence number, which hands
+// the line on. While waiting for their turns, the cores also increment the
+// counters with locked read-modify-writes. Each core checks that the sequence
+// numbers it sees never go backwards and that no counter falls behind its
+// sequence number, and at the end the master checks the final contents of
+// each line.
+//
+// The AP stacks are small, so the state each CPU keeps for the shared lines
+// is held in static arrays.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpuinfo.h"
+#include "smp.h"
+#include "tsc.h"
+
+#include "display.h"
+#include "error.h"
+#include "test.h"
+
+#include "test_funcs.h"
+#include "test_helper.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define LINE_SIZE           64
+#define LINE_WORDS          (LINE_SIZE / sizeof(testword_t))
+
+#define NUM_SHARED_LINES    16
+
+#define TURNS_PER_LINE      4096    // per iteration, approximately
+
+#define STALL_TIMEOUT       1000    // milliseconds
+
+//------------------------------------------------------------------------------
+// Types
+//------------------------------------------------------------------------------
+
+typedef struct {
+    testword_t      counter;
+    testword_t      seq;
+    testword_t      data[LINE_WORDS - 2];
+} shared_line_t;
+
+typedef struct {
+    testword_t      next_seq[NUM_SHARED_LINES];     // the sequence number of our next turn on each line
+    testword_t      last_seq[NUM_SHARED_LINES];     // the last sequence number seen on each line
+    uintptr_t       num_scans;
+} __attribute__((aligned(64))) cpu_lines_t;
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+// These are written by the master before the other CPUs read them.
+
+static shared_line_t    *shared = NULL;
+
+static volatile bool    joined[MAX_CPUS];
+
+static uint8_t          cpu_domain[MAX_CPUS];
+static uint8_t          cpu_index[MAX_CPUS];       // within its domain
+
+static uint64_t         start_time = 0;
+
+// These are updated by all the CPUs.
+
+static volatile bool    abandoned = false;
+
+static uintptr_t        num_transfers = 0;
+
+static cpu_lines_t      cpu_lines[MAX_CPUS];
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static testword_t line_word(testword_t seed, testword_t seq, int word)
+{
+#if (ARCH_BITS == 64)
+    return (seed + seq) * UINT64_C(0x9e3779b97f4a7c15) ^ word;
+#else
+    return (seed + seq) * UINT32_C(0x9e3779b9) ^ word;
+#endif
+}
+
+// Records the proximity domain of my_cpu and its index among the CPUs taking
+// part that are in the same domain. Must be called after all the CPUs taking
+// part have joined.
+static void record_domain(int my_cpu)
+{
+    uint8_t domain = smp_get_proximity_domain_idx(my_cpu);
+    uint8_t index  = 0;
+    for (int i = 0; i < my_cpu; i++) {
+        if (joined[i] && smp_get_proximity_domain_idx(i) == domain) {
+            index++;
+        }
+    }
+    cpu_domain[my_cpu] = domain;
+    cpu_index[my_cpu]  = index;
+}
+
+// Returns the position of my_cpu in the order in which the CPUs take their
+// turns. The CPUs are ordered by their index within their proximity domain
+// and then by domain, so consecutive turns are taken in different domains
+// wherever possible. Also returns the number of CPUs taking part. Must be
+// called after all the CPUs have called record_domain().
+static int turn_order(int my_cpu, int *num_cpus)
+{
+    int count = 0;
+    int rank  = 0;
+    for (int i = 0; i < MAX_CPUS; i++) {
+        if (!joined[i]) {
+            continue;
+        }
+        count++;
+        if (cpu_index[i] < cpu_index[my_cpu]
+        || (cpu_index[i] == cpu_index[my_cpu] && cpu_domain[i] < cpu_domain[my_cpu])) {
+            rank++;
+        }
+    }
+    *num_cpus = count;
+    return rank;
+}
+
+// Sets up the shared lines at the start of the first segment in the current
+// window that is large enough to hold them.
+static void init_shared_lines(testword_t seed)
+{
+    shared = NULL;
+    for (int i = 0; i < vm_map_size; i++) {
+        uintptr_t size = (uintptr_t)vm_map[i].end - (uintptr_t)vm_map[i].start + sizeof(testword_t);
+        if (size >= NUM_SHARED_LINES * sizeof(shared_line_t)) {
+            shared = (shared_line_t *)vm_map[i].start;
+            break;
+        }
+    }
+    if (shared == NULL) {
+        return;
+    }
+    for (int l = 0; l < NUM_SHARED_LINES; l++) {
+        write_word(&shared[l].counter, 0);
+        write_word(&shared[l].seq, 0);
+        for (int j = 0; j < (int)(LINE_WORDS - 2); j++) {
+            write_word(&shared[l].data[j], line_word(seed, 0, j));
+        }
+    }
+    num_transfers = 0;
+    abandoned     = false;
+}
+
+// Takes the turns of my_cpu on each shared line until every line has reached
+// the target sequence number. Returns the number of transfers made.
+static uintptr_t take_turns(int my_cpu, testword_t seed, testword_t first_seq, testword_t target_seq,
+                            int rank, int num_cpus)
+{
+    testword_t *next_seq = cpu_lines[my_cpu].next_seq;
+    testword_t *last_seq = cpu_lines[my_cpu].last_seq;
+
+    int pending = 0;
+    for (int l = 0; l < NUM_SHARED_LINES; l++) {
+        next_seq[l] = first_seq + (rank - l % num_cpus + num_cpus) % num_cpus;
+        if (next_seq[l] < target_seq) {
+            pending++;
+        }
+    }
+
+    uint64_t  stall_clks    = (uint64_t)STALL_TIMEOUT * clks_per_msec;
+    uint64_t  progress_time = get_tsc();
+    uintptr_t transfers     = 0;
+
+    while (pending > 0 && !abandoned && !bail) {
+        bool progress = false;
+        for (int l = 0; l < NUM_SHARED_LINES; l++) {
+            shared_line_t *line = &shared[l];
+
+            testword_t seq = read_word(&line->seq);
+            if (seq != last_seq[l]) {
+                if (unlikely(seq < last_seq[l])) {
+                    data_error(&line->seq, last_seq[l], seq, false);
+                    abandoned = true;
+                    return transfers;
+                }
+                progress = true;
+                last_seq[l] = seq;
+            }
+            if (next_seq[l] >= target_seq || seq < next_seq[l]) {
+                continue;
+            }
+            if (unlikely(seq > next_seq[l])) {
+                // Another CPU has taken our turn.
+                data_error(&line->seq, next_seq[l], seq, false);
+                abandoned = true;
+                return transfers;
+            }
+
+            for (int j = 0; j < (int)(LINE_WORDS - 2); j++) {
+                testword_t good = line_word(seed, seq, j);
+                testword_t bad  = read_word(&line->data[j]);
+                if (unlikely(bad != good)) {
+                    data_error(&line->data[j], good, bad, false);
+                }
+            }
+            // Every earlier turn incremented the counter before handing the
+            // line on.
+            testword_t count = __sync_fetch_and_add(&line->counter, 1);
+            if (unlikely(count < seq)) {
+                data_error(&line->counter, seq, count, false);
+            }
+
+            for (int j = 0; j < (int)(LINE_WORDS - 2); j++) {
+                write_word(&line->data[j], line_word(seed, seq + 1, j));
+            }
+            // Stores are not reordered with other stores, so the new data is
+            // visible to the next owner before the new sequence number is.
+            __asm__ __volatile__ ("" ::: "memory");
+            write_word(&line->seq, seq + 1);
+            last_seq[l] = seq + 1;
+
+            next_seq[l] += num_cpus;
+            if (next_seq[l] >= target_seq) {
+                pending--;
+            }
+            transfers++;
+            progress = true;
+        }
+
+        // Contend for one line while waiting for the others.
+        int l = cpu_lines[my_cpu].num_scans++ % NUM_SHARED_LINES;
+        __sync_fetch_and_add(&shared[l].counter, 1);
+        transfers++;
+
+        if (progress) {
+            progress_time = get_tsc();
+        } else if (stall_clks > 0 && get_tsc() - progress_time > stall_clks) {
+            // The line we are waiting for has not moved on. Report the first
+            // line that is stuck where the next owner should have written it.
+            for (l = 0; l < NUM_SHARED_LINES; l++) {
+                if (next_seq[l] < target_seq) {
+                    data_error(&shared[l].seq, next_seq[l], last_seq[l], false);
+                    break;
+                }
+            }
+            abandoned = true;
+        }
+    }
+    return transfers;
+}
+
+// Checks the final contents of the shared lines. Must only be called by the
+// master after all the CPUs have finished.
+static void check_shared_lines(testword_t seed, testword_t final_seq)
+{
+    for (int l = 0; l < NUM_SHARED_LINES; l++) {
+        shared_line_t *line = &shared[l];
+
+        testword_t seq = read_word(&line->seq);
+        if (seq != final_seq) {
+            data_error(&line->seq, final_seq, seq, false);
+            continue;
+        }
+        for (int j = 0; j < (int)(LINE_WORDS - 2); j++) {
+            testword_t good = line_word(seed, final_seq, j);
+            testword_t bad  = read_word(&line->data[j]);
+            if (bad != good) {
+                data_error(&line->data[j], good, bad, false);
+            }
+        }
+        // Each turn increments the counter once, as does each CPU once in
+        // every NUM_SHARED_LINES scans.
+        testword_t good = final_seq;
+        for (int i = 0; i < MAX_CPUS; i++) {
+            if (joined[i]) {
+                good += (cpu_lines[i].num_scans + NUM_SHARED_LINES - 1 - l) / NUM_SHARED_LINES;
+            }
+        }
+        testword_t bad  = read_word(&line->counter);
+        if (bad != good) {
+            data_error(&line->counter, good, bad, false);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+int test_coherence(int my_cpu, int iterations, testword_t seed)
+{
+    int ticks = 0;
+
+    if (my_cpu < 0) {
+        return iterations;
+    }
+
+    if (my_cpu == master_cpu) {
+        display_test_pattern_name("shared lines");
+        init_shared_lines(seed);
+        for (int i = 0; i < MAX_CPUS; i++) {
+            joined[i] = false;
+        }
+    }
+    sync_cpus(my_cpu);
+    BAILOUT;
+
+    joined[my_cpu] = true;
+    cpu_lines[my_cpu].num_scans = 0;
+    sync_cpus(my_cpu);
+    BAILOUT;
+
+    record_domain(my_cpu);
+    sync_cpus(my_cpu);
+    BAILOUT;
+
+    int num_cpus;
+    int rank = turn_order(my_cpu, &num_cpus);
+
+    // Make the number of turns on each line a multiple of the number of CPUs,
+    // so every CPU takes the same number.
+    int rounds = TURNS_PER_LINE / num_cpus;
+    if (rounds < 1) {
+        rounds = 1;
+    }
+    testword_t turns_per_iteration = (testword_t)rounds * num_cpus;
+
+    for (int l = 0; l < NUM_SHARED_LINES; l++) {
+        cpu_lines[my_cpu].last_seq[l] = 0;
+    }
+
+    if (my_cpu == master_cpu) {
+        start_time = get_tsc();
+    }
+
+    uintptr_t transfers = 0;
+    for (int i = 0; i < iterations; i++) {
+        if (shared != NULL && !abandoned) {
+            cpu_context[my_cpu].test_addr = (uintptr_t)shared;
+            transfers += take_turns(my_cpu, seed, i * turns_per_iteration, (i + 1) * turns_per_iteration,
+                                    rank, num_cpus);
+        }
+        ticks++;
+        do_tick(my_cpu);
+        BAILOUT;
+        sync_cpus(my_cpu);
+        BAILOUT;
+    }
+    if (shared == NULL) {
+        return ticks;
+    }
+
+    __sync_fetch_and_add(&num_transfers, transfers);
+    sync_cpus(my_cpu);
+    BAILOUT;
+
+    if (my_cpu == master_cpu) {
+        uint64_t elapsed_ms = (clks_per_msec > 0) ? (get_tsc() - start_time) / clks_per_msec : 0;
+        if (!abandoned) {
+            check_shared_lines(seed, iterations * turns_per_iteration);
+        }
+        if (elapsed_ms > 0) {
+            display_test_transfer_rate(num_transfers / elapsed_ms);
+        }
+    }
+
+    return ticks;
+}
@@ -0,0 +1,216 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+//
+// Implements the last level cache test. The other tests sweep through far more
+// memory than the caches hold, so the cache SRAM only holds each line briefly
+// and a faulty cell is only found if it happens to corrupt a line before it is
+// written back. In this test, a buffer that fits in the L3 cache is filled and
+// then checked by the moving inversions and random pattern kernels many times
+// over, so the data stays in the cache and is checked at cache bandwidth.
+//
+// Where the CPU supports L3 Cache Allocation Technology (Intel RDT or AMD
+// PQoS), the buffer is pinned to a small group of the cache ways: the CPU
+// running the test is given a class of service that may only allocate lines
+// in those ways, and the default class used by the other CPUs is kept out of
+// them. The group is moved through all the ways on each iteration, so every
+// way is tested in turn. Without CAT, the buffer fills half the cache, and the
+// hardware chooses the ways.
+//
+// The way masks are shared by all the CPUs in an L3 domain, so the test is run
+// by each CPU in turn, and the masks found at the start are restored after
+// each group.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cache.h"
+#include "cpuid.h"
+#include "cpuinfo.h"
+#include "msr.h"
+
+#include "display.h"
+#include "test.h"
+
+#include "test_funcs.h"
+#include "test_helper.h"
+#include "test_kernels.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define TEST_COS            1       // the class of service used by the CPU under test
+
+#define WAYS_PER_GROUP      2       // some CPUs require at least two bits in a mask
+
+#define FILL_PERCENT        75      // of the capacity of the selected ways
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+static bool         cat_checked  = false;
+static int          cbm_length   = 0;   // the number of ways that may be allocated, or 0 if CAT isn't available
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+// Finds the length of the L3 capacity bit mask, if the CPU supports L3 CAT
+// with at least two classes of service.
+static void check_cat(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    cat_checked = true;
+    cbm_length  = 0;
+
+    if (cpuid_info.vendor_id.str[0] == 'G' && cpuid_info.max_cpuid >= 0x10) {
+        cpuid(0x7, 0, &eax, &ebx, &ecx, &edx);
+        if (!(ebx & (1 << 15))) {
+            return;
+        }
+        cpuid(0x10, 0, &eax, &ebx, &ecx, &edx);
+    } else if (cpuid_info.vendor_id.str[0] == 'A' && cpuid_info.max_xcpuid >= 0x80000020) {
+        cpuid(0x80000020, 0, &eax, &ebx, &ecx, &edx);
+    } else {
+        return;
+    }
+    if (!(ebx & (1 << 1))) {
+        return;
+    }
+    cpuid(cpuid_info.vendor_id.str[0] == 'G' ? 0x10 : 0x80000020, 1, &eax, &ebx, &ecx, &edx);
+    if ((edx & 0xffff) < TEST_COS) {
+        return;
+    }
+    cbm_length = (eax & 0x1f) + 1;
+    if (cbm_length < WAYS_PER_GROUP) {
+        cbm_length = 0;
+    }
+}
+
+// Restricts the current CPU to the ways in the specified group, and the other
+// CPUs in its L3 domain to the remaining ways. Saves the previous masks.
+static void select_ways(int group, uint32_t saved_mask[2])
+{
+    uint32_t all_ways = (cbm_length < 32) ? (1u << cbm_length) - 1 : 0xffffffff;
+    uint32_t selected = ((1u << WAYS_PER_GROUP) - 1) << (group * WAYS_PER_GROUP);
+
+    uint32_t hi;
+    rdmsr(MSR_IA32_L3_QOS_MASK_0, saved_mask[0], hi);
+    rdmsr(MSR_IA32_L3_QOS_MASK_0 + TEST_COS, saved_mask[1], hi);
+
+    wrmsr(MSR_IA32_L3_QOS_MASK_0 + TEST_COS, selected, 0);
+    wrmsr(MSR_IA32_L3_QOS_MASK_0, all_ways & ~selected, 0);
+
+    uint32_t lo;
+    rdmsr(MSR_IA32_PQR_ASSOC, lo, hi);
+    wrmsr(MSR_IA32_PQR_ASSOC, lo, TEST_COS);
+
+    // Lines already in the cache stay where they are, so start empty.
+    cache_flush();
+}
+
+static void restore_ways(const uint32_t saved_mask[2])
+{
+    uint32_t lo, hi;
+    rdmsr(MSR_IA32_PQR_ASSOC, lo, hi);
+    wrmsr(MSR_IA32_PQR_ASSOC, lo, 0);
+
+    wrmsr(MSR_IA32_L3_QOS_MASK_0, saved_mask[0], 0);
+    wrmsr(MSR_IA32_L3_QOS_MASK_0 + TEST_COS, saved_mask[1], 0);
+}
+
+// Returns the first block of buffer_size bytes in the current window, or NULL
+// if no segment is large enough.
+static testword_t *find_buffer(uintptr_t buffer_size)
+{
+    for (int i = 0; i < vm_map_size; i++) {
+        uintptr_t size = (uintptr_t)vm_map[i].end - (uintptr_t)vm_map[i].start + sizeof(testword_t);
+        if (size >= buffer_size) {
+            return vm_map[i].start;
+        }
+    }
+    return NULL;
+}
+
+// Runs the moving inversions and random pattern kernels over the buffer, which
+// must already be held in the cache ways under test.
+static void test_buffer(int my_cpu, testword_t *start, testword_t *end, testword_t seed)
+{
+    testword_t pattern = ~seed;
+
+    cpu_context[my_cpu].test_addr = (uintptr_t)start;
+
+    // Use cached stores, so the fill allocates the lines.
+    for (testword_t *p = start; p <= end; p++) {
+        write_word(p, pattern);
+    }
+    test_kernel->check_write_up(start, end, pattern, ~pattern);
+    test_kernel->check_write_down(start, end, ~pattern, pattern);
+    test_kernel->check_write_up(start, end, pattern, ~pattern);
+    test_kernel->pattern_check(start, end, ~pattern);
+
+    test_kernel->random_fill(start, end, seed, false);
+    test_kernel->random_check_write(start, end, seed, 0);
+    test_kernel->random_check_write(start, end, seed, ~(testword_t)0);
+
+    count_test_data(my_cpu, 8 * ((uintptr_t)end - (uintptr_t)start + sizeof(testword_t)));
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+int test_llc(int my_cpu, int iterations, testword_t seed)
+{
+    int ticks = 0;
+
+    if (my_cpu < 0) {
+        return iterations;
+    }
+
+    if (!cat_checked) {
+        check_cat();
+    }
+
+    int       num_groups  = 1;
+    uintptr_t buffer_size = (uintptr_t)l3_cache * 1024 / 2;
+    if (cbm_length > 0) {
+        num_groups  = cbm_length / WAYS_PER_GROUP;
+        buffer_size = (uintptr_t)l3_cache * 1024 / cbm_length * WAYS_PER_GROUP / 100 * FILL_PERCENT;
+    }
+    buffer_size = round_down(buffer_size, PAGE_SIZE);
+
+    testword_t *start = (buffer_size > 0) ? find_buffer(buffer_size) : NULL;
+    testword_t *end   = NULL;
+    if (start != NULL) {
+        end = start + buffer_size / sizeof(testword_t) - 1;
+    }
+
+    testword_t state = seed;
+    for (int i = 0; i < iterations; i++) {
+        for (int group = 0; group < num_groups && start != NULL; group++) {
+            if (cbm_length > 0) {
+                display_test_stage_description("L3 ways %i-%i of %i, %kB", group * WAYS_PER_GROUP,
+                                               (group + 1) * WAYS_PER_GROUP - 1, cbm_length, buffer_size >> 10);
+                uint32_t saved_mask[2];
+                select_ways(group, saved_mask);
+                state = prsg(state);
+                test_buffer(my_cpu, start, end, state);
+                restore_ways(saved_mask);
+            } else {
+                display_test_stage_description("L3 without CAT, %kB", buffer_size >> 10);
+                state = prsg(state);
+                cache_flush();
+                test_buffer(my_cpu, start, end, state);
+            }
+            BAILOUT;
+        }
+        ticks++;
+        do_tick(my_cpu);
+        BAILOUT;
+    }
+
+    return ticks;
+}
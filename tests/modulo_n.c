@@ -22,6 +22,46 @@
 
 #include "test_funcs.h"
 #include "test_helper.h"
+#include "test_kernels.h"
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+// Returns the first word in the range starting at 'start' whose offset from the
+// start of the segment is congruent to 'offset' modulo n. The selected words
+// only depend on position, so are the same whichever CPU tests each unit.
+
+static testword_t *first_nth_word(testword_t *start, int segment, int n, int offset)
+{
+    int k = (uintptr_t)(start - vm_map[segment].start) % n;
+    return start + ((offset - k + n) % n);
+}
+
+// For the fused test, finds the position of the word at 'start' relative to
+// the target words. Sets 'j' to the index of the last target word at or before
+// it, and returns its distance from that word.
+
+static int fused_position(testword_t *start, int segment, int n, int offset, int cell, int *j)
+{
+    int k = (uintptr_t)(start - vm_map[segment].start) % n;
+    int rel = (k - offset + n) % n;
+    *j = rel / cell;
+    return rel % cell;
+}
+
+// For the fused test, returns the first target word in the range starting at
+// 'start', and sets 'j' to its index.
+
+static testword_t *first_target_word(testword_t *start, int segment, int n, int offset, int cell, int num_offsets, int *j)
+{
+    int r = fused_position(start, segment, n, offset, cell, j);
+    if (r == 0) {
+        return start;
+    }
+    *j = (*j + 1) % num_offsets;
+    return start + (cell - r);
+}
 
 //------------------------------------------------------------------------------
 // Public Functions
@@ -37,61 +77,36 @@ int test_modulo_n(int my_cpu, int iterations, testword_t pattern1, testword_t pa
 
     // Write every nth location with pattern1.
     for (int i = 0; i < vm_map_size; i++) {
+        int segment_ticks = setup_work_units(my_cpu, i);
+        ticks += segment_ticks;
+        if (my_cpu < 0) {
+            continue;
+        }
         testword_t *start, *end;
-        calculate_chunk(&start, &end, my_cpu, i, sizeof(testword_t));
-        if ((end - start) < (n - 1)) SKIP_RANGE(1)  // we need at least n words for this test
-        end -= n;  // avoids pointer overflow when incrementing p
-
-        testword_t *p  = start + offset;  // we assume each chunk has at least 'n' words, so this won't overflow
-        testword_t *pe = start;
-
-        bool at_end = false;
-        do {
-            // take care to avoid pointer overflow
-            if ((end - pe) >= SPIN_SIZE) {
-                pe += SPIN_SIZE - 1;
-            } else {
-                at_end = true;
-                pe = end;
-            }
-            ticks++;
-            if (my_cpu < 0) {
+        while (get_work_unit(my_cpu, i, false, &start, &end)) {
+            testword_t *p = first_nth_word(start, i, n, offset);
+            if (p > end) {
                 continue;
             }
-            test_addr[my_cpu] = (uintptr_t)p;
-            do {
-                write_word(p, pattern1);
-            } while (p <= (pe - n) && (p += n)); // test before increment in case pointer overflows
-            do_tick(my_cpu);
-            BAILOUT;
-        } while (!at_end && ++pe); // advance pe to next start point
+            cpu_context[my_cpu].test_addr = (uintptr_t)p;
+            test_kernel->strided_fill(p, end, n, pattern1);
+        }
+        DO_TICKS(segment_ticks);
     }
 
     // Write the rest of memory "iteration" times with pattern2.
     for (int i = 0; i < iterations; i++) {
         for (int j = 0; j < vm_map_size; j++) {
+            int segment_ticks = setup_work_units(my_cpu, j);
+            ticks += segment_ticks;
+            if (my_cpu < 0) {
+                continue;
+            }
             testword_t *start, *end;
-            calculate_chunk(&start, &end, my_cpu, j, sizeof(testword_t));
-            if ((end - start) < (n - 1)) SKIP_RANGE(1)  // we need at least n words for this test
-
-            int k = 0;
-            testword_t *p  = start;
-            testword_t *pe = start;
-
-            bool at_end = false;
-            do {
-                // take care to avoid pointer overflow
-                if ((end - pe) >= SPIN_SIZE) {
-                    pe += SPIN_SIZE - 1;
-                } else {
-                    at_end = true;
-                    pe = end;
-                }
-                ticks++;
-                if (my_cpu < 0) {
-                    continue;
-                }
-                test_addr[my_cpu] = (uintptr_t)p;
+            while (get_work_unit(my_cpu, j, false, &start, &end)) {
+                cpu_context[my_cpu].test_addr = (uintptr_t)start;
+                testword_t *p = start;
+                int k = (uintptr_t)(start - vm_map[j].start) % n;
                 do {
                     if (k != offset) {
                         write_word(p, pattern2);
@@ -100,10 +115,9 @@ int test_modulo_n(int my_cpu, int iterations, testword_t pattern1, testword_t pa
                     if (k == n) {
                         k = 0;
                     }
-                } while (p++ < pe); // test before increment in case pointer overflows
-                do_tick(my_cpu);
-                BAILOUT;
-            } while (!at_end && ++pe); // advance pe to next start point
+                } while (p++ < end); // test before increment in case pointer overflows
+            }
+            DO_TICKS(segment_ticks);
         }
     }
 
@@ -111,37 +125,134 @@ int test_modulo_n(int my_cpu, int iterations, testword_t pattern1, testword_t pa
 
     // Now check every nth location.
     for (int i = 0; i < vm_map_size; i++) {
+        int segment_ticks = setup_work_units(my_cpu, i);
+        ticks += segment_ticks;
+        if (my_cpu < 0) {
+            continue;
+        }
+        testword_t *start, *end;
+        while (get_work_unit(my_cpu, i, false, &start, &end)) {
+            testword_t *p = first_nth_word(start, i, n, offset);
+            if (p > end) {
+                continue;
+            }
+            cpu_context[my_cpu].test_addr = (uintptr_t)p;
+            test_kernel->strided_check(p, end, n, pattern1);
+        }
+        DO_TICKS(segment_ticks);
+    }
+
+    return ticks;
+}
+
+// Tests 'num_offsets' offsets modulo n in one set of sweeps. The target words
+// are the words at offset + j * n / num_offsets, each written with pattern[j],
+// and the words after each target word are written with the complement of its
+// pattern. n must be a multiple of num_offsets, and offset must be less than
+// n / num_offsets.
+
+int test_modulo_n_fused(int my_cpu, int iterations, const testword_t pattern[], int n, int offset, int num_offsets)
+{
+    int ticks = 0;
+
+    if (my_cpu == master_cpu) {
+        display_test_pattern_values(pattern[0], offset);
+    }
+
+    // Keep the patterns in locals, so they can be held in registers.
+    testword_t p1[MAX_FUSED_OFFSETS];
+    testword_t p2[MAX_FUSED_OFFSETS];
+    for (int j = 0; j < num_offsets; j++) {
+        p1[j] =  pattern[j];
+        p2[j] = ~pattern[j];
+    }
+    int cell = n / num_offsets;
+
+    // Write every target word with its own pattern.
+    for (int i = 0; i < vm_map_size; i++) {
+        int segment_ticks = setup_work_units(my_cpu, i);
+        ticks += segment_ticks;
+        if (my_cpu < 0) {
+            continue;
+        }
         testword_t *start, *end;
-        calculate_chunk(&start, &end, my_cpu, i, sizeof(testword_t));
-        if ((end - start) < (n - 1)) SKIP_RANGE(1)  // we need at least n words for this test
-        end -= n;  // avoids pointer overflow when incrementing p
-
-        testword_t *p  = start + offset;  // we assume each chunk has at least 'offset' words, so this won't overflow
-        testword_t *pe = start;
-
-        bool at_end = false;
-        do {
-            // take care to avoid pointer overflow
-            if ((end - pe) >= SPIN_SIZE) {
-                pe += SPIN_SIZE - 1;
-            } else {
-                at_end = true;
-                pe = end;
+        while (get_work_unit(my_cpu, i, false, &start, &end)) {
+            int j;
+            testword_t *p = first_target_word(start, i, n, offset, cell, num_offsets, &j);
+            if (p > end) {
+                continue;
             }
-            ticks++;
+            cpu_context[my_cpu].test_addr = (uintptr_t)p;
+            do {
+                write_word(p, p1[j]);
+                if (++j == num_offsets) {
+                    j = 0;
+                }
+            } while ((uintptr_t)(end - p) >= (uintptr_t)cell && (p += cell)); // test before increment in case pointer overflows
+        }
+        DO_TICKS(segment_ticks);
+    }
+
+    // Write the rest of memory "iteration" times with the complement of the
+    // pattern of the target word before it.
+    for (int i = 0; i < iterations; i++) {
+        for (int j = 0; j < vm_map_size; j++) {
+            int segment_ticks = setup_work_units(my_cpu, j);
+            ticks += segment_ticks;
             if (my_cpu < 0) {
                 continue;
             }
-            test_addr[my_cpu] = (uintptr_t)p;
+            testword_t *start, *end;
+            while (get_work_unit(my_cpu, j, false, &start, &end)) {
+                cpu_context[my_cpu].test_addr = (uintptr_t)start;
+                testword_t *p = start;
+                int t;
+                int r = fused_position(start, j, n, offset, cell, &t);
+                do {
+                    if (r != 0) {
+                        write_word(p, p2[t]);
+                    }
+                    r++;
+                    if (r == cell) {
+                        r = 0;
+                        if (++t == num_offsets) {
+                            t = 0;
+                        }
+                    }
+                } while (p++ < end); // test before increment in case pointer overflows
+            }
+            DO_TICKS(segment_ticks);
+        }
+    }
+
+    flush_caches(my_cpu);
+
+    // Now check every target word. The expected value identifies its offset.
+    for (int i = 0; i < vm_map_size; i++) {
+        int segment_ticks = setup_work_units(my_cpu, i);
+        ticks += segment_ticks;
+        if (my_cpu < 0) {
+            continue;
+        }
+        testword_t *start, *end;
+        while (get_work_unit(my_cpu, i, false, &start, &end)) {
+            int j;
+            testword_t *p = first_target_word(start, i, n, offset, cell, num_offsets, &j);
+            if (p > end) {
+                continue;
+            }
+            cpu_context[my_cpu].test_addr = (uintptr_t)p;
             do {
                 testword_t actual = read_word(p);
-                if (unlikely(actual != pattern1)) {
-                    data_error(p, pattern1, actual, true);
+                if (unlikely(actual != p1[j])) {
+                    data_error(p, p1[j], actual, true);
                 }
-            } while (p <= (pe - n) && (p += n)); // test before increment in case pointer overflows
-            do_tick(my_cpu);
-            BAILOUT;
-        } while (!at_end && ++pe); // advance pe to next start point
+                if (++j == num_offsets) {
+                    j = 0;
+                }
+            } while ((uintptr_t)(end - p) >= (uintptr_t)cell && (p += cell)); // test before increment in case pointer overflows
+        }
+        DO_TICKS(segment_ticks);
     }
 
     return ticks;
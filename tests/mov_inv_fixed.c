@@ -16,20 +16,77 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "ioat.h"
+
 #include "display.h"
 #include "error.h"
+#include "profile.h"
 #include "test.h"
 
 #include "test_funcs.h"
 #include "test_helper.h"
+#include "test_kernels.h"
 
-#define HAND_OPTIMISED  1   // Use hand-optimised assembler code for performance.
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+// Starts a DMA fill of the range from start to end (inclusive). The channel
+// fills with a 64-bit pattern, so the range must be a whole number of 64-bit
+// words. Returns false if the fill wasn't started.
+static bool start_dma_fill(int chan, testword_t *start, testword_t *end, testword_t pattern)
+{
+    size_t size = (uintptr_t)end - (uintptr_t)start + sizeof(testword_t);
+    if (chan < 0 || size % sizeof(uint64_t) != 0) {
+        return false;
+    }
+    uint64_t dma_pattern = pattern;
+#if TESTWORD_WIDTH < 64
+    dma_pattern |= dma_pattern << 32;
+#endif
+    if (!ioat_queue_fill(chan, start, dma_pattern, size, false)) {
+        return false;
+    }
+    ioat_start(chan);
+    return true;
+}
+
+// Fills the work units of the segment with the pattern. With a DMA channel
+// that can fill, the channel fills one unit while the CPU fills the next. If
+// the channel fails, the CPU fills its unit again.
+static void fill_work_units(int my_cpu, int segment, int chan, testword_t pattern)
+{
+    testword_t *start, *end;
+    bool more = get_work_unit(my_cpu, segment, false, &start, &end);
+    while (more) {
+        cpu_context[my_cpu].test_addr = (uintptr_t)start;
+        uint64_t start_time = profile_start();
+        if (start_dma_fill(chan, start, end, pattern)) {
+            testword_t *dma_start = start;
+            testword_t *dma_end   = end;
+            more = get_work_unit(my_cpu, segment, false, &start, &end);
+            if (more) {
+                fill_words(start, end, pattern);
+            }
+            if (!ioat_wait(chan)) {
+                fill_words(dma_start, dma_end, pattern);
+            }
+        } else {
+            fill_words(start, end, pattern);
+        }
+        profile_record(my_cpu, PHASE_FILL, start_time);
+        if (more) {
+            more = get_work_unit(my_cpu, segment, false, &start, &end);
+        }
+    }
+}
 
 //------------------------------------------------------------------------------
 // Public Functions
 //------------------------------------------------------------------------------
 
-int test_mov_inv_fixed(int my_cpu, int iterations, testword_t pattern1, testword_t pattern2)
+int test_mov_inv_fixed(int my_cpu, int iterations, testword_t pattern1, testword_t pattern2,
+                       bool chained, testword_t next_pattern)
 {
     int ticks = 0;
 
@@ -37,134 +94,63 @@ int test_mov_inv_fixed(int my_cpu, int iterations, testword_t pattern1, testword
         display_test_pattern_value(pattern1);
     }
 
-    // Initialize memory with the initial pattern.
-    for (int i = 0; i < vm_map_size; i++) {
-        testword_t *start, *end;
-        calculate_chunk(&start, &end, my_cpu, i, sizeof(testword_t));
-        if (end < start) SKIP_RANGE(1) // we need at least one word for this test
-
-        testword_t *p  = start;
-        testword_t *pe = start;
-
-        bool at_end = false;
-        do {
-            // take care to avoid pointer overflow
-            if ((end - pe) >= SPIN_SIZE) {
-                pe += SPIN_SIZE - 1;
-            } else {
-                at_end = true;
-                pe = end;
-            }
-            ticks++;
-            if (my_cpu < 0) {
-                continue;
-            }
-            test_addr[my_cpu] = (uintptr_t)p;
-#if HAND_OPTIMISED
-#ifdef __x86_64__
-            uint64_t length = pe - p + 1;
-            __asm__  __volatile__ ("\t"
-                "rep    \n\t"
-                "stosq  \n\t"
-                :
-                : "c" (length), "D" (p), "a" (pattern1)
-                :
-            );
-            p = pe;
-#else
-            uint32_t length = pe - p + 1;
-            __asm__  __volatile__ ("\t"
-                "rep    \n\t"
-                "stosl  \n\t"
-                :
-                : "c" (length), "D" (p), "a" (pattern1)
-                :
-            );
-            p = pe;
-#endif
-#else
-            do {
-                write_word(p, pattern1);
-            } while (p++ < pe); // test before increment in case pointer overflows
-#endif
-            do_tick(my_cpu);
-            BAILOUT;
-        } while (!at_end && ++pe); // advance pe to next start point
+    // Initialize memory with the initial pattern, unless the previous call
+    // left it there. If there are no sweeps, go straight to the next pattern.
+    testword_t fill_pattern = iterations > 0 ? pattern1 : next_pattern;
+    int chan = dma_channel(my_cpu);
+    if (chan >= 0 && !ioat_can_fill(chan)) {
+        chan = -1;
+    }
+    for (int i = 0; i < vm_map_size && !chained; i++) {
+        int segment_ticks = setup_work_units(my_cpu, i);
+        ticks += segment_ticks;
+        if (my_cpu < 0) {
+            continue;
+        }
+        fill_work_units(my_cpu, i, chan, fill_pattern);
+        DO_TICKS(segment_ticks);
     }
 
     // Check for the current pattern and then write the alternate pattern for
     // each memory location. Test from the bottom up and then from the top down.
+    // The last sweep writes the pattern the next call starts with.
     for (int i = 0; i < iterations; i++) {
+        testword_t down_pattern = (i == iterations - 1) ? next_pattern : pattern1;
+
         flush_caches(my_cpu);
 
         for (int j = 0; j < vm_map_size; j++) {
+            int segment_ticks = setup_work_units(my_cpu, j);
+            ticks += segment_ticks;
+            if (my_cpu < 0) {
+                continue;
+            }
             testword_t *start, *end;
-            calculate_chunk(&start, &end, my_cpu, j, sizeof(testword_t));
-            if (end < start) SKIP_RANGE(1) // we need at least one word for this test
-
-            testword_t *p  = start;
-            testword_t *pe = start;
-
-            bool at_end = false;
-            do {
-                // take care to avoid pointer overflow
-                if ((end - pe) >= SPIN_SIZE) {
-                    pe += SPIN_SIZE - 1;
-                } else {
-                    at_end = true;
-                    pe = end;
-                }
-                ticks++;
-                if (my_cpu < 0) {
-                    continue;
-                }
-                test_addr[my_cpu] = (uintptr_t)p;
-                do {
-                    testword_t actual = read_word(p);
-                    if (unlikely(actual != pattern1)) {
-                        data_error(p, pattern1, actual, true);
-                    }
-                    write_word(p, pattern2);
-                } while (p++ < pe); // test before increment in case pointer overflows
-                do_tick(my_cpu);
-                BAILOUT;
-            } while (!at_end && ++pe); // advance pe to next start point
+            while (get_work_unit(my_cpu, j, false, &start, &end)) {
+                cpu_context[my_cpu].test_addr = (uintptr_t)start;
+                uint64_t start_time = profile_start();
+                test_kernel->check_write_up(start, end, pattern1, pattern2);
+                profile_record(my_cpu, PHASE_VERIFY, start_time);
+            }
+            DO_TICKS(segment_ticks);
         }
 
         flush_caches(my_cpu);
 
         for (int j = vm_map_size - 1; j >= 0; j--) {
+            int segment_ticks = setup_work_units(my_cpu, j);
+            ticks += segment_ticks;
+            if (my_cpu < 0) {
+                continue;
+            }
             testword_t *start, *end;
-            calculate_chunk(&start, &end, my_cpu, j, sizeof(testword_t));
-            if (end < start) SKIP_RANGE(1) // we need at least one word for this test
-
-            testword_t *p  = end;
-            testword_t *ps = end;
-
-            bool at_start = false;
-            do {
-                // take care to avoid pointer underflow
-                if ((ps - start) >= SPIN_SIZE) {
-                    ps -= SPIN_SIZE - 1;
-                } else {
-                    at_start = true;
-                    ps = start;
-                }
-                ticks++;
-                if (my_cpu < 0) {
-                    continue;
-                }
-                test_addr[my_cpu] = (uintptr_t)p;
-                do {
-                    testword_t actual = read_word(p);
-                    if (unlikely(actual != pattern2)) {
-                        data_error(p, pattern2, actual, true);
-                    }
-                    write_word(p, pattern1);
-                } while (p-- > ps); // test before decrement in case pointer overflows
-                do_tick(my_cpu);
-                BAILOUT;
-            } while (!at_start && --ps); // advance ps to next start point
+            while (get_work_unit(my_cpu, j, true, &start, &end)) {
+                cpu_context[my_cpu].test_addr = (uintptr_t)end;
+                uint64_t start_time = profile_start();
+                test_kernel->check_write_down(start, end, pattern2, down_pattern);
+                profile_record(my_cpu, PHASE_VERIFY, start_time);
+            }
+            DO_TICKS(segment_ticks);
         }
     }
 
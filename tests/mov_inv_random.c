@@ -16,67 +16,72 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-#include "cpuid.h"
-#include "tsc.h"
-
+#include "config.h"
 #include "display.h"
 #include "error.h"
+#include "profile.h"
 #include "test.h"
 
 #include "test_funcs.h"
 #include "test_helper.h"
+#include "test_kernels.h"
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+static testword_t test_seed = 0;
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+// Returns the initial state of the pseudo-random sequence for the work unit
+// starting at address p. This only depends on the seed and the address, so the
+// sequence is the same whichever CPU tests the unit.
+
+static testword_t unit_seed(testword_t seed, const testword_t *p)
+{
+#if (ARCH_BITS == 64)
+    testword_t state = seed ^ ((uintptr_t)p * UINT64_C(0x9e3779b97f4a7c15));
+#else
+    testword_t state = seed ^ ((uintptr_t)p * UINT32_C(0x9e3779b9));
+#endif
+    return (state != 0) ? state : seed;
+}
 
 //------------------------------------------------------------------------------
 // Public Functions
 //------------------------------------------------------------------------------
 
-int test_mov_inv_random(int my_cpu)
+int test_mov_inv_random(int my_cpu, testword_t seed)
 {
     int ticks = 0;
 
-    testword_t seed;
-    if (cpuid_info.flags.rdtsc) {
-        seed = get_tsc();
-    } else {
-        seed = 1 + pass_num;
-    }
-    seed *= 0x87654321;
-
+    // Any CPU may test any work unit, so they must all use the same seed.
     if (my_cpu == master_cpu) {
-        display_test_pattern_value(seed);
+        test_seed = seed;
+
+        display_test_pattern_value(test_seed);
     }
+    sync_cpus(my_cpu);
+    BAILOUT;
 
     // Initialize memory with the initial pattern.
-    testword_t prsg_state = seed;
     for (int i = 0; i < vm_map_size; i++) {
+        int segment_ticks = setup_work_units(my_cpu, i);
+        ticks += segment_ticks;
+        if (my_cpu < 0) {
+            continue;
+        }
         testword_t *start, *end;
-        calculate_chunk(&start, &end, my_cpu, i, sizeof(testword_t));
-        if (end < start) SKIP_RANGE(1)  // we need at least one word for this test
-
-        testword_t *p  = start;
-        testword_t *pe = start;
-
-        bool at_end = false;
-        do {
-            // take care to avoid pointer overflow
-            if ((end - pe) >= SPIN_SIZE) {
-                pe += SPIN_SIZE - 1;
-            } else {
-                at_end = true;
-                pe = end;
-            }
-            ticks++;
-            if (my_cpu < 0) {
-                continue;
-            }
-            test_addr[my_cpu] = (uintptr_t)p;
-            do {
-                prsg_state = prsg(prsg_state);
-                write_word(p, prsg_state);
-            } while (p++ < pe); // test before increment in case pointer overflows
-            do_tick(my_cpu);
-            BAILOUT;
-        } while (!at_end && ++pe); // advance pe to next start point
+        while (get_work_unit(my_cpu, i, false, &start, &end)) {
+            cpu_context[my_cpu].test_addr = (uintptr_t)start;
+            uint64_t start_time = profile_start();
+            test_kernel->random_fill(start, end, unit_seed(test_seed, start), enable_nt_fill);
+            profile_record(my_cpu, PHASE_FILL, start_time);
+        }
+        DO_TICKS(segment_ticks);
     }
 
     // Check for initial pattern and then write the inverse pattern for each
@@ -85,41 +90,20 @@ int test_mov_inv_random(int my_cpu)
     for (int i = 0; i < 2; i++) {
         flush_caches(my_cpu);
 
-        prsg_state = seed;
         for (int j = 0; j < vm_map_size; j++) {
+            int segment_ticks = setup_work_units(my_cpu, j);
+            ticks += segment_ticks;
+            if (my_cpu < 0) {
+                continue;
+            }
             testword_t *start, *end;
-            calculate_chunk(&start, &end, my_cpu, j, sizeof(testword_t));
-            if (end < start) SKIP_RANGE(1)  // we need at least one word for this test
-
-            testword_t *p  = start;
-            testword_t *pe = start;
-
-            bool at_end = false;
-            do {
-                // take care to avoid pointer overflow
-                if ((end - pe) >= SPIN_SIZE) {
-                    pe += SPIN_SIZE - 1;
-                } else {
-                    at_end = true;
-                    pe = end;
-                }
-                ticks++;
-                if (my_cpu < 0) {
-                    continue;
-                }
-                test_addr[my_cpu] = (uintptr_t)p;
-                do {
-                    prsg_state = prsg(prsg_state);
-                    testword_t expect = prsg_state ^ invert;
-                    testword_t actual = read_word(p);
-                    if (unlikely(actual != expect)) {
-                        data_error(p, expect, actual, true);
-                    }
-                    write_word(p, ~expect);
-                } while (p++ < pe); // test before increment in case pointer overflows
-                do_tick(my_cpu);
-                BAILOUT;
-            } while (!at_end && ++pe); // advance pe to next start point
+            while (get_work_unit(my_cpu, j, false, &start, &end)) {
+                cpu_context[my_cpu].test_addr = (uintptr_t)start;
+                uint64_t start_time = profile_start();
+                test_kernel->random_check_write(start, end, unit_seed(test_seed, start), invert);
+                profile_record(my_cpu, PHASE_VERIFY, start_time);
+            }
+            DO_TICKS(segment_ticks);
         }
         invert = ~invert;
     }
@@ -16,12 +16,107 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "config.h"
 #include "display.h"
 #include "error.h"
+#include "profile.h"
 #include "test.h"
 
 #include "test_funcs.h"
 #include "test_helper.h"
+#include "test_kernels.h"
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+// Returns the pattern expected at address p. The pattern is rotated left one
+// bit for each successive word in the segment, so it only depends on position.
+
+static testword_t pattern_at(const testword_t *p, int segment, testword_t pattern)
+{
+    int count = (uintptr_t)(p - vm_map[segment].start) % TESTWORD_WIDTH;
+    if (count == 0) {
+        return pattern;
+    }
+    return pattern << count | pattern >> (TESTWORD_WIDTH - count);
+}
+
+// The wide version of the test. Each block of wide_word_bits bits (up to a
+// whole 64-byte DRAM burst) has a single bit that differs from the others, so
+// the bit lines either side of it are driven the opposite way. The SIMD
+// kernels write and check a whole vector of the pattern at a time.
+static int test_wide_walk(int my_cpu, int iterations, int offset, bool inverse)
+{
+    int ticks = 0;
+
+    unsigned   width  = wide_word_bits;
+    testword_t invert = inverse ? ~(testword_t)0 : 0;
+
+    if (my_cpu == master_cpu) {
+        display_test_wide_pattern(width, offset, inverse);
+    }
+
+    // Initialize memory with the initial pattern.
+    for (int i = 0; i < vm_map_size; i++) {
+        int segment_ticks = setup_work_units(my_cpu, i);
+        ticks += segment_ticks;
+        if (my_cpu < 0) {
+            continue;
+        }
+        testword_t *start, *end;
+        while (get_work_unit(my_cpu, i, false, &start, &end)) {
+            cpu_context[my_cpu].test_addr = (uintptr_t)start;
+            uint64_t start_time = profile_start();
+            test_kernel->wide_walk_fill(start, end, width, offset, invert);
+            profile_record(my_cpu, PHASE_FILL, start_time);
+        }
+        DO_TICKS(segment_ticks);
+    }
+
+    // Check for initial pattern and then write the complement for each memory location.
+    // Test from bottom up and then from the top down.
+    for (int i = 0; i < iterations; i++) {
+        flush_caches(my_cpu);
+
+        for (int j = 0; j < vm_map_size; j++) {
+            int segment_ticks = setup_work_units(my_cpu, j);
+            ticks += segment_ticks;
+            if (my_cpu < 0) {
+                continue;
+            }
+            testword_t *start, *end;
+            while (get_work_unit(my_cpu, j, false, &start, &end)) {
+                cpu_context[my_cpu].test_addr = (uintptr_t)start;
+                uint64_t start_time = profile_start();
+                test_kernel->wide_walk_check_up(start, end, width, offset, invert);
+                profile_record(my_cpu, PHASE_VERIFY, start_time);
+            }
+            DO_TICKS(segment_ticks);
+        }
+
+        flush_caches(my_cpu);
+
+        for (int j = vm_map_size - 1; j >= 0; j--) {
+            int segment_ticks = setup_work_units(my_cpu, j);
+            ticks += segment_ticks;
+            if (my_cpu < 0) {
+                continue;
+            }
+            testword_t *start, *end;
+            while (get_work_unit(my_cpu, j, true, &start, &end)) {
+                cpu_context[my_cpu].test_addr = (uintptr_t)end;
+                uint64_t start_time = profile_start();
+                // The memory now holds the complement of the pattern.
+                test_kernel->wide_walk_check_down(start, end, width, offset, ~invert);
+                profile_record(my_cpu, PHASE_VERIFY, start_time);
+            }
+            DO_TICKS(segment_ticks);
+        }
+    }
+
+    return ticks;
+}
 
 //------------------------------------------------------------------------------
 // Public Functions
@@ -29,6 +124,10 @@
 
 int test_mov_inv_walk1(int my_cpu, int iterations, int offset, bool inverse)
 {
+    if (wide_word_bits > 0) {
+        return test_wide_walk(my_cpu, iterations, offset, inverse);
+    }
+
     int ticks = 0;
 
     testword_t pattern = (testword_t)1 << offset;
@@ -40,118 +139,64 @@ int test_mov_inv_walk1(int my_cpu, int iterations, int offset, bool inverse)
 
     // Initialize memory with the initial pattern.
     for (int i = 0; i < vm_map_size; i++) {
+        int segment_ticks = setup_work_units(my_cpu, i);
+        ticks += segment_ticks;
+        if (my_cpu < 0) {
+            continue;
+        }
         testword_t *start, *end;
-        calculate_chunk(&start, &end, my_cpu, i, sizeof(testword_t));
-        if (end < start) SKIP_RANGE(1)  // we need at least one word for this test
-
-        testword_t *p  = start;
-        testword_t *pe = start;
-
-        bool at_end = false;
-        do {
-            // take care to avoid pointer overflow
-            if ((end - pe) >= SPIN_SIZE) {
-                pe += SPIN_SIZE - 1;
-            } else {
-                at_end = true;
-                pe = end;
-            }
-            ticks++;
-            if (my_cpu < 0) {
-                continue;
-            }
-            test_addr[my_cpu] = (uintptr_t)p;
+        while (get_work_unit(my_cpu, i, false, &start, &end)) {
+            cpu_context[my_cpu].test_addr = (uintptr_t)start;
+            uint64_t start_time = profile_start();
+            testword_t *p = start;
+            testword_t pat = pattern_at(p, i, pattern);
             do {
-                write_word(p, pattern);
-                pattern = pattern << 1 | pattern >> (TESTWORD_WIDTH - 1);  // rotate left
-            } while (p++ < pe); // test before increment in case pointer overflows
-            do_tick(my_cpu);
-            BAILOUT;
-        } while (!at_end && ++pe); // advance pe to next start point
+                write_word(p, pat);
+                pat = pat << 1 | pat >> (TESTWORD_WIDTH - 1);  // rotate left
+            } while (p++ < end); // test before increment in case pointer overflows
+            profile_record(my_cpu, PHASE_FILL, start_time);
+        }
+        DO_TICKS(segment_ticks);
     }
 
     // Check for initial pattern and then write the complement for each memory location.
     // Test from bottom up and then from the top down.
     for (int i = 0; i < iterations; i++) {
-        pattern = (testword_t)1 << offset;
-        pattern = inverse ? ~pattern : pattern;
-
         flush_caches(my_cpu);
 
         for (int j = 0; j < vm_map_size; j++) {
+            int segment_ticks = setup_work_units(my_cpu, j);
+            ticks += segment_ticks;
+            if (my_cpu < 0) {
+                continue;
+            }
             testword_t *start, *end;
-            calculate_chunk(&start, &end, my_cpu, j, sizeof(testword_t));
-            if (end < start) SKIP_RANGE(1)  // we need at least one word for this test
-
-            testword_t *p  = start;
-            testword_t *pe = start;
-
-            bool at_end = false;
-            do {
-                // take care to avoid pointer overflow
-                if ((end - pe) >= SPIN_SIZE) {
-                    pe += SPIN_SIZE - 1;
-                } else {
-                    at_end = true;
-                    pe = end;
-                }
-                ticks++;
-                if (my_cpu < 0) {
-                    continue;
-                }
-                test_addr[my_cpu] = (uintptr_t)p;
-                do {
-                    testword_t expect = pattern;
-                    testword_t actual = read_word(p);
-                    if (unlikely(actual != expect)) {
-                        data_error(p, expect, actual, true);
-                    }
-                    write_word(p, ~expect);
-                    pattern = pattern << 1 | pattern >> (TESTWORD_WIDTH - 1);  // rotate left
-                } while (p++ < pe); // test before increment in case pointer overflows
-                do_tick(my_cpu);
-                BAILOUT;
-            } while (!at_end && ++pe); // advance pe to next start point
+            while (get_work_unit(my_cpu, j, false, &start, &end)) {
+                cpu_context[my_cpu].test_addr = (uintptr_t)start;
+                uint64_t start_time = profile_start();
+                test_kernel->walk_check_up(start, end, pattern_at(start, j, pattern));
+                profile_record(my_cpu, PHASE_VERIFY, start_time);
+            }
+            DO_TICKS(segment_ticks);
         }
 
-        pattern = ~pattern;
-
         flush_caches(my_cpu);
 
         for (int j = vm_map_size - 1; j >= 0; j--) {
+            int segment_ticks = setup_work_units(my_cpu, j);
+            ticks += segment_ticks;
+            if (my_cpu < 0) {
+                continue;
+            }
             testword_t *start, *end;
-            calculate_chunk(&start, &end, my_cpu, j, sizeof(testword_t));
-            if (end < start) SKIP_RANGE(1)  // we need at least one word for this test
-
-            testword_t *p  = end;
-            testword_t *ps = end;
-
-            bool at_start = false;
-            do {
-                // take care to avoid pointer underflow
-                if ((ps - start) >= SPIN_SIZE) {
-                    ps -= SPIN_SIZE - 1;
-                } else {
-                    at_start = true;
-                    ps = start;
-                }
-                ticks++;
-                if (my_cpu < 0) {
-                    continue;
-                }
-                test_addr[my_cpu] = (uintptr_t)ps;
-                do {
-                    pattern = pattern >> 1 | pattern << (TESTWORD_WIDTH - 1);  // rotate right
-                    testword_t expect = pattern;
-                    testword_t actual = read_word(p);
-                    if (unlikely(actual != expect)) {
-                        data_error(p, expect, actual, true);
-                    }
-                    write_word(p, ~expect);
-                } while (p-- > ps); // test before decrement in case pointer overflows
-                do_tick(my_cpu);
-                BAILOUT;
-            } while (!at_start && --ps); // advance ps to next start point
+            while (get_work_unit(my_cpu, j, true, &start, &end)) {
+                cpu_context[my_cpu].test_addr = (uintptr_t)end;
+                uint64_t start_time = profile_start();
+                // The kernel is passed the complement of the pattern for the word after the unit.
+                test_kernel->walk_check_down(start, end, ~pattern_at(end + 1, j, pattern));
+                profile_record(my_cpu, PHASE_VERIFY, start_time);
+            }
+            DO_TICKS(segment_ticks);
         }
     }
 
@@ -19,16 +19,38 @@
 
 #include "display.h"
 #include "error.h"
+#include "profile.h"
 #include "test.h"
 
 #include "test_funcs.h"
 #include "test_helper.h"
+#include "test_kernels.h"
 
 //------------------------------------------------------------------------------
 // Private Functions
 //------------------------------------------------------------------------------
 
-static int pattern_fill(int my_cpu, testword_t offset)
+static testword_t physical_offset(const vm_map_t *segment)
+{
+    testword_t offset;
+
+#if (ARCH_BITS == 64)
+    // Calculate the byte address offset that will translate the virtual address into a physical address.
+    offset = (segment->pm_base_addr << PAGE_SHIFT) - (uintptr_t)segment->start;
+#else
+    // Calculate the offset (in pages) between the virtual address and the physical address.
+    offset = (segment->pm_base_addr / VM_WINDOW_SIZE) * VM_WINDOW_SIZE;
+    offset = (offset >= VM_PINNED_SIZE) ? offset - VM_PINNED_SIZE : 0;
+    // Convert to a VM window offset. This will get added into the LSBs of the virtual address.
+    offset /= VM_WINDOW_SIZE;
+#endif
+    return offset;
+}
+
+// The pattern only depends on the address, so the segments are shared between
+// the active CPUs as work units, and they can all run these tests together.
+
+static int pattern_fill(int my_cpu, bool physical)
 {
     int ticks = 0;
 
@@ -38,32 +60,21 @@ static int pattern_fill(int my_cpu, testword_t offset)
 
     // Write each address with it's own address.
     for (int i = 0; i < vm_map_size; i++) {
-        testword_t *start = vm_map[i].start;
-        testword_t *end   = vm_map[i].end;
-
-        testword_t *p  = start;
-        testword_t *pe = start;
-
-        bool at_end = false;
-        do {
-            // take care to avoid pointer overflow
-            if ((end - pe) >= SPIN_SIZE) {
-                pe += SPIN_SIZE - 1;
-            } else {
-                at_end = true;
-                pe = end;
-            }
-            ticks++;
-            if (my_cpu < 0) {
-                continue;
-            }
-            test_addr[my_cpu] = (uintptr_t)p;
-            do {
-                write_word(p, (testword_t)p + offset);
-            } while (p++ < pe); // test before increment in case pointer overflows
-            do_tick(my_cpu);
-            BAILOUT;
-        } while (!at_end && ++pe); // advance pe to next start point
+        int segment_ticks = setup_work_units(my_cpu, i);
+        ticks += segment_ticks;
+        if (my_cpu < 0) {
+            continue;
+        }
+        testword_t offset = physical ? physical_offset(&vm_map[i]) : 0;
+
+        testword_t *start, *end;
+        while (get_work_unit(my_cpu, i, false, &start, &end)) {
+            cpu_context[my_cpu].test_addr = (uintptr_t)start;
+            uint64_t start_time = profile_start();
+            test_kernel->addr_fill(start, end, offset);
+            profile_record(my_cpu, PHASE_FILL, start_time);
+        }
+        DO_TICKS(segment_ticks);
     }
 
     flush_caches(my_cpu);
@@ -71,42 +82,27 @@ static int pattern_fill(int my_cpu, testword_t offset)
     return ticks;
 }
 
-static int pattern_check(int my_cpu, testword_t offset)
+static int pattern_check(int my_cpu, bool physical)
 {
     int ticks = 0;
 
     // Check each address has its own address.
     for (int i = 0; i < vm_map_size; i++) {
-        testword_t *start = vm_map[i].start;
-        testword_t *end   = vm_map[i].end;
-
-        testword_t *p  = start;
-        testword_t *pe = start;
-
-        bool at_end = false;
-        do {
-            // take care to avoid pointer overflow
-            if ((end - pe) >= SPIN_SIZE) {
-                pe += SPIN_SIZE - 1;
-            } else {
-                at_end = true;
-                pe = end;
-            }
-            ticks++;
-            if (my_cpu < 0) {
-                continue;
-            }
-            test_addr[my_cpu] = (uintptr_t)p;
-            do {
-                testword_t expect = (testword_t)p + offset;
-                testword_t actual = read_word(p);
-                if (unlikely(actual != expect)) {
-                    data_error(p, expect, actual, true);
-                }
-            } while (p++ < pe); // test before increment in case pointer overflows
-            do_tick(my_cpu);
-            BAILOUT;
-        } while (!at_end && ++pe); // advance pe to next start point
+        int segment_ticks = setup_work_units(my_cpu, i);
+        ticks += segment_ticks;
+        if (my_cpu < 0) {
+            continue;
+        }
+        testword_t offset = physical ? physical_offset(&vm_map[i]) : 0;
+
+        testword_t *start, *end;
+        while (get_work_unit(my_cpu, i, false, &start, &end)) {
+            cpu_context[my_cpu].test_addr = (uintptr_t)start;
+            uint64_t start_time = profile_start();
+            test_kernel->addr_check(start, end, offset);
+            profile_record(my_cpu, PHASE_VERIFY, start_time);
+        }
+        DO_TICKS(segment_ticks);
     }
 
     return ticks;
@@ -120,8 +116,8 @@ int test_own_addr1(int my_cpu)
 {
     int ticks = 0;
 
-    ticks += pattern_fill(my_cpu, 0);
-    ticks += pattern_check(my_cpu, 0);
+    ticks += pattern_fill(my_cpu, false);
+    ticks += pattern_check(my_cpu, false);
 
     return ticks;
 }
@@ -130,25 +126,12 @@ int test_own_addr2(int my_cpu, int stage)
 {
     int ticks = 0;
 
-    testword_t offset;
-
-    // Calculate the offset (in pages) between the virtual address and the physical address.
-    offset = (vm_map[0].pm_base_addr / VM_WINDOW_SIZE) * VM_WINDOW_SIZE;
-    offset = (offset >= VM_PINNED_SIZE) ? offset - VM_PINNED_SIZE : 0;
-#if (ARCH_BITS == 64)
-    // Convert to a byte address offset. This will translate the virtual address into a physical address.
-    offset *= PAGE_SIZE;
-#else
-    // Convert to a VM window offset. This will get added into the LSBs of the virtual address.
-    offset /= VM_WINDOW_SIZE;
-#endif
-
     switch (stage) {
       case 0:
-        ticks = pattern_fill(my_cpu, offset);
+        ticks = pattern_fill(my_cpu, true);
         break;
       case 1:
-        ticks = pattern_check(my_cpu, offset);
+        ticks = pattern_check(my_cpu, true);
         break;
       default:
         break;
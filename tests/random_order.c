@@ -0,0 +1,199 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+//
+// Implements the random order test. Every other test sweeps through memory in
+// address order (or with a fixed stride), so most accesses hit an open DRAM
+// row. This test visits the cache lines of each work unit in a pseudo-random
+// order, so that almost every access opens a new row, usually in a different
+// bank from the last one. The order is given by a Feistel permutation of the
+// line index, which doesn't depend on the data read, so each CPU core can keep
+// many independent accesses in flight and the throughput is limited by the
+// DRAM row cycle and activate timings rather than by the bus.
+//
+// Each word holds its own address XORed with the test pattern. Memory is first
+// filled in one random order, then on each iteration it is checked and its
+// complement written in another random order, and finally it is checked.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "display.h"
+#include "error.h"
+#include "test.h"
+
+#include "test_funcs.h"
+#include "test_helper.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define LINE_SIZE       64
+#define LINE_WORDS      (LINE_SIZE / sizeof(testword_t))
+
+#define NUM_ROUNDS      4
+
+//------------------------------------------------------------------------------
+// Types
+//------------------------------------------------------------------------------
+
+// A permutation of the indices 0 to num_lines-1. The Feistel network permutes
+// a power of 4 indices, and indices that fall outside the range are permuted
+// again until they fall inside it ("cycle walking"). The power of 4 is less
+// than 4 times num_lines, so this takes few steps.
+
+typedef struct {
+    uintptr_t   num_lines;
+    int         half_bits;
+    uintptr_t   half_mask;
+    uint32_t    key[NUM_ROUNDS];
+} permutation_t;
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static uint32_t hash32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+// Sets up the permutation for the lines of the range starting at 'start'. The
+// key is taken from the range address as well as the seed, so that each work
+// unit is visited in a different order.
+static void init_permutation(permutation_t *perm, const testword_t *start, uintptr_t num_lines, uint32_t seed)
+{
+    int bits = 1;
+    while (bits < ARCH_BITS - 1 && (num_lines - 1) >> bits) {
+        bits++;
+    }
+    perm->num_lines = num_lines;
+    perm->half_bits = (bits + 1) / 2;
+    perm->half_mask = ((uintptr_t)1 << perm->half_bits) - 1;
+
+    uint32_t key = seed ^ hash32((uintptr_t)start / LINE_SIZE);
+    for (int i = 0; i < NUM_ROUNDS; i++) {
+        key = hash32(key + i);
+        perm->key[i] = key;
+    }
+}
+
+static inline uintptr_t permute(const permutation_t *perm, uintptr_t index)
+{
+    do {
+        uintptr_t left  = index >> perm->half_bits;
+        uintptr_t right = index &  perm->half_mask;
+        for (int i = 0; i < NUM_ROUNDS; i++) {
+            uintptr_t next = left ^ (hash32(right ^ perm->key[i]) & perm->half_mask);
+            left  = right;
+            right = next;
+        }
+        index = left << perm->half_bits | right;
+    } while (index >= perm->num_lines);
+
+    return index;
+}
+
+static inline testword_t expected_word(const testword_t *p, testword_t pattern)
+{
+    return (testword_t)(uintptr_t)p ^ pattern;
+}
+
+// Visits the lines of the range from start to end (inclusive) in a random
+// order. If 'check' is true, checks each word holds its address XORed with
+// 'pattern1' before writing its address XORed with 'pattern2'. Otherwise just
+// writes the words. If 'write' is false, just checks the words. The range is
+// covered in whole lines from 'start'; the last line may be partial.
+static void visit_range(testword_t *start, testword_t *end, uint32_t seed, bool check, bool write,
+                        testword_t pattern1, testword_t pattern2)
+{
+    uintptr_t num_words = end - start + 1;
+    uintptr_t num_lines = (num_words + LINE_WORDS - 1) / LINE_WORDS;
+
+    permutation_t perm;
+    init_permutation(&perm, start, num_lines, seed);
+
+    for (uintptr_t i = 0; i < num_lines; i++) {
+        uintptr_t first = permute(&perm, i) * LINE_WORDS;
+        uintptr_t count = (num_words - first < LINE_WORDS) ? num_words - first : LINE_WORDS;
+        testword_t *line = start + first;
+
+        // The line address is known before anything in it is read, so the
+        // loads for successive lines are independent and overlap.
+        if (check) {
+            testword_t diff = 0;
+            for (uintptr_t j = 0; j < count; j++) {
+                diff |= read_word(line + j) ^ expected_word(line + j, pattern1);
+            }
+            if (unlikely(diff != 0)) {
+                for (uintptr_t j = 0; j < count; j++) {
+                    testword_t good = expected_word(line + j, pattern1);
+                    testword_t bad  = read_word(line + j);
+                    if (unlikely(bad != good)) {
+                        data_error(line + j, good, bad, true);
+                    }
+                }
+            }
+        }
+        if (write) {
+            for (uintptr_t j = 0; j < count; j++) {
+                write_word(line + j, expected_word(line + j, pattern2));
+            }
+        }
+    }
+}
+
+static int visit_all(int my_cpu, uint32_t seed, bool check, bool write, testword_t pattern1, testword_t pattern2)
+{
+    int ticks = 0;
+
+    for (int i = 0; i < vm_map_size; i++) {
+        int segment_ticks = setup_work_units(my_cpu, i);
+        ticks += segment_ticks;
+        if (my_cpu < 0) {
+            continue;
+        }
+        testword_t *start, *end;
+        while (get_work_unit(my_cpu, i, false, &start, &end)) {
+            cpu_context[my_cpu].test_addr = (uintptr_t)start;
+            visit_range(start, end, seed, check, write, pattern1, pattern2);
+        }
+        DO_TICKS(segment_ticks);
+    }
+
+    return ticks;
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+int test_random_order(int my_cpu, int iterations, testword_t pattern)
+{
+    int ticks = 0;
+
+    if (my_cpu == master_cpu) {
+        display_test_pattern_value(pattern);
+    }
+
+    uint32_t seed = (uint32_t)pattern;
+
+    ticks += visit_all(my_cpu, hash32(seed), false, true, 0, pattern);
+    BAILOUT;
+
+    testword_t invert = 0;
+    for (int i = 0; i < iterations; i++) {
+        ticks += visit_all(my_cpu, hash32(seed + 1 + i), true, true, pattern ^ invert, pattern ^ ~invert);
+        BAILOUT;
+        invert = ~invert;
+    }
+
+    ticks += visit_all(my_cpu, hash32(seed - 1), true, false, pattern ^ invert, 0);
+
+    return ticks;
+}
@@ -0,0 +1,264 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+//
+// Implements the retention scrub. The bit fade test reads memory back once,
+// after a fixed delay. This test fills all memory once with pseudo-random
+// data, then repeatedly verifies it with read-only sweeps at a low, fixed
+// bandwidth, for a configured time or number of sweeps. A weak cell that
+// loses its charge between refreshes shows up in the first sweep after it
+// fails, and is reported with the time since the fill.
+//
+// The data in each page is a PRSG sequence seeded from the physical page
+// number, so it can be regenerated for the check and never needs to be
+// stored.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpuinfo.h"
+#include "memsize.h"
+#include "tsc.h"
+#include "vmem.h"
+
+#include "config.h"
+#include "display.h"
+#include "error.h"
+#include "test.h"
+
+#include "test_funcs.h"
+#include "test_helper.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define PAGE_WORDS      (PAGE_SIZE / sizeof(testword_t))
+
+#define PACE_WORDS      (1 << 17)   // in testwords, between checks of the sweep rate
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+static uint64_t     fill_time       = 0;   // TSC at the start of the fill
+static int          sweep_num       = 0;
+
+static uint32_t     first_error_age = 0;   // seconds from the fill to the first error, or 0
+static uint64_t     last_errors     = 0;   // the error count at the start of the sweep
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static uint32_t secs_since(uint64_t start_time)
+{
+    if (clks_per_msec == 0) {
+        return 0;
+    }
+    return (get_tsc() - start_time) / ((uint64_t)clks_per_msec * 1000);
+}
+
+// Returns the first value of the sequence for the page containing p.
+static testword_t page_seed(testword_t seed, testword_t *p)
+{
+    testword_t page = page_of(p);
+#if (ARCH_BITS == 64)
+    testword_t state = seed ^ (page + 1) * UINT64_C(0x9e3779b97f4a7c15);
+#else
+    testword_t state = seed ^ (page + 1) * UINT32_C(0x9e3779b9);
+#endif
+    if (state == 0) {
+        state = seed;
+    }
+    return prsg(prsg(prsg(state)));
+}
+
+// Returns the first word of the page containing p.
+static testword_t *page_start(testword_t *p)
+{
+    return (testword_t *)((uintptr_t)p & ~(uintptr_t)(PAGE_SIZE - 1));
+}
+
+static void fill_range(testword_t *start, testword_t *end, testword_t seed)
+{
+    testword_t *page = page_start(start);
+    while (true) {
+        testword_t state = page_seed(seed, page);
+        for (uintptr_t i = 0; i < PAGE_WORDS; i++) {
+            if (page + i >= start) {
+                write_word(page + i, state);
+            }
+            state = prsg(state);
+            if (page + i == end) {
+                return;
+            }
+        }
+        page += PAGE_WORDS;
+    }
+}
+
+static void check_range(testword_t *start, testword_t *end, testword_t seed)
+{
+    testword_t *page = page_start(start);
+    while (true) {
+        testword_t state = page_seed(seed, page);
+        for (uintptr_t i = 0; i < PAGE_WORDS; i++) {
+            if (page + i >= start) {
+                testword_t actual = read_word(page + i);
+                if (unlikely(actual != state)) {
+                    data_error(page + i, state, actual, true);
+                }
+            }
+            state = prsg(state);
+            if (page + i == end) {
+                return;
+            }
+        }
+        page += PAGE_WORDS;
+    }
+}
+
+// Waits until the sweep has taken as long as 'bytes' take at soak_rate MB/s.
+static void pace_sweep(uint64_t sweep_start, uint64_t bytes)
+{
+    if (soak_rate <= 0 || clks_per_msec == 0) {
+        return;
+    }
+    uint64_t msecs  = bytes * 1000 / ((uint64_t)soak_rate << 20);
+    uint64_t target = sweep_start + msecs * clks_per_msec;
+    while (get_tsc() < target && !bail) {
+        __builtin_ia32_pause();
+    }
+}
+
+static void display_sweep(void)
+{
+    uint32_t age = secs_since(fill_time) / 60;
+    if (first_error_age > 0) {
+        display_test_stage_description("sweep %i, %i min since fill, first error at %i min",
+                                       sweep_num + 1, age, first_error_age / 60);
+    } else {
+        display_test_stage_description("sweep %i, %i min since fill", sweep_num + 1, age);
+    }
+}
+
+static int fill_all(int my_cpu, testword_t seed)
+{
+    int ticks = 0;
+
+    if (my_cpu == master_cpu) {
+        display_test_stage_description("fill");
+    }
+
+    for (int i = 0; i < vm_map_size; i++) {
+        testword_t *p  = NULL;
+        testword_t *pe = NULL;
+        while (next_block(vm_map[i].start, vm_map[i].end, spin_size, false, &p, &pe)) {
+            ticks++;
+            if (my_cpu < 0) {
+                continue;
+            }
+            cpu_context[my_cpu].test_addr = (uintptr_t)p;
+            fill_range(p, pe, seed);
+            count_test_data(my_cpu, (uintptr_t)pe - (uintptr_t)p + sizeof(testword_t));
+            do_tick(my_cpu);
+            BAILOUT;
+        }
+    }
+
+    return ticks;
+}
+
+static int sweep(int my_cpu, testword_t seed)
+{
+    int ticks = 0;
+
+    if (my_cpu == master_cpu) {
+        display_sweep();
+    }
+
+    // The window is swept at the configured rate, measured from the start of
+    // the sweep through the window.
+    uint64_t start_time = get_tsc();
+    uint64_t bytes = 0;
+
+    for (int i = 0; i < vm_map_size; i++) {
+        testword_t *p  = NULL;
+        testword_t *pe = NULL;
+        while (next_block(vm_map[i].start, vm_map[i].end, spin_size, false, &p, &pe)) {
+            ticks++;
+            if (my_cpu < 0) {
+                continue;
+            }
+            testword_t *cp  = NULL;
+            testword_t *cpe = NULL;
+            while (next_block(p, pe, PACE_WORDS, false, &cp, &cpe)) {
+                cpu_context[my_cpu].test_addr = (uintptr_t)cp;
+                check_range(cp, cpe, seed);
+                uintptr_t num_bytes = (uintptr_t)cpe - (uintptr_t)cp + sizeof(testword_t);
+                count_test_data(my_cpu, num_bytes);
+                bytes += num_bytes;
+                pace_sweep(start_time, bytes);
+                BAILOUT;
+            }
+            do_tick(my_cpu);
+            BAILOUT;
+        }
+    }
+
+    // Report the age of the errors found in this window. The cells last read
+    // correctly in the previous sweep.
+    if (error_count > last_errors) {
+        uint32_t age = secs_since(fill_time);
+        if (first_error_age == 0) {
+            first_error_age = age > 0 ? age : 1;
+        }
+        trace(my_cpu, "%i retention errors in sweep %i, %i s after the fill",
+              (int)(error_count - last_errors), sweep_num + 1, age);
+        last_errors = error_count;
+    }
+
+    return ticks;
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+int test_retention(int my_cpu, int stage, testword_t seed)
+{
+    static int last_stage = -1;
+
+    int ticks = 0;
+
+    switch (stage) {
+      case 0:
+        if (stage != last_stage && my_cpu >= 0) {
+            fill_time       = get_tsc();
+            sweep_num       = 0;
+            first_error_age = 0;
+            last_errors     = error_count;
+        }
+        ticks = fill_all(my_cpu, seed);
+        break;
+      case 1:
+        ticks = sweep(my_cpu, seed);
+        break;
+      default:
+        break;
+    }
+    if (my_cpu >= 0) {
+        last_stage = stage;
+    }
+
+    return ticks;
+}
+
+bool retention_next_sweep(int iterations)
+{
+    sweep_num++;
+    if (soak_hours > 0) {
+        return secs_since(fill_time) < (uint32_t)soak_hours * 3600;
+    }
+    return sweep_num < iterations;
+}
@@ -0,0 +1,270 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+//
+// Implements a double-sided row hammer test. For each victim location, the
+// test looks for a pair of aggressor locations on either side of it that lie
+// in the same DRAM bank as the victim but in different rows, then reads the
+// aggressors alternately, flushing them from the cache after each read, so
+// that each read opens its row. Repeatedly opening the rows either side of a
+// victim row can disturb the charge in the victim row's cells.
+//
+// The memory controller's mapping from physical addresses to banks and rows
+// is not known, so the aggressors are found by timing. Two locations in the
+// same bank but in different rows can't be read in parallel, as each read
+// has to close the other's row, so reading them alternately takes longer
+// than reading two locations in different banks. The nearest such locations
+// at a power of 2 distance either side of the victim are normally in the
+// neighbouring rows.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpuid.h"
+#include "tsc.h"
+
+#include "display.h"
+#include "test.h"
+
+#include "test_funcs.h"
+#include "test_helper.h"
+#include "test_kernels.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define LINE_SIZE           64          // in bytes
+
+// The range of distances from a victim to its aggressors that are tried, in
+// bytes. The lower limit is above the column bits of any DRAM device, and the
+// upper limit is above the lowest row bit of any likely memory configuration.
+#define MIN_ROW_DISTANCE    (1 << 13)
+#define MAX_ROW_DISTANCE    (1 << 23)
+
+// The number of times each aggressor is read. Each read opens a row, so this
+// is well above the number of activations needed to disturb a weak row within
+// one refresh period.
+#define HAMMER_READS        (1 << 19)
+
+// The number of times each aggressor is read when timing a pair of locations,
+// and the number of pairs timed to find the time for a pair in different banks.
+#define TIMING_READS        64
+#define TIMING_SAMPLES      16
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static void hammer(const testword_t *p1, const testword_t *p2, uint32_t num_reads, bool use_clflushopt)
+{
+    // The fence makes sure the flushes have completed before the next reads.
+    if (use_clflushopt) {
+        for (uint32_t i = 0; i < num_reads; i++) {
+            __asm__ __volatile__ ("\t"
+                "movl       %0, %%eax   \n\t"
+                "movl       %1, %%eax   \n\t"
+                "clflushopt %0          \n\t"
+                "clflushopt %1          \n\t"
+                "mfence                 \n"
+                : /* no outputs */
+                : "m" (*p1), "m" (*p2)
+                : "eax", "memory"
+            );
+        }
+    } else {
+        for (uint32_t i = 0; i < num_reads; i++) {
+            __asm__ __volatile__ ("\t"
+                "movl       %0, %%eax   \n\t"
+                "movl       %1, %%eax   \n\t"
+                "clflush    %0          \n\t"
+                "clflush    %1          \n\t"
+                "mfence                 \n"
+                : /* no outputs */
+                : "m" (*p1), "m" (*p2)
+                : "eax", "memory"
+            );
+        }
+    }
+}
+
+static uint32_t pair_time(const testword_t *p1, const testword_t *p2, bool use_clflushopt)
+{
+    uint32_t start_time, end_time;
+
+    // Take the best of two runs, so an interruption by SMM doesn't count.
+    uint32_t best_time = UINT32_MAX;
+    for (int run = 0; run < 2; run++) {
+        rdtscl(start_time);
+        hammer(p1, p2, TIMING_READS, use_clflushopt);
+        rdtscl(end_time);
+        if (best_time > end_time - start_time) {
+            best_time = end_time - start_time;
+        }
+    }
+    return best_time;
+}
+
+// Returns the time above which a pair of locations is taken to be in the
+// same bank but in different rows, by timing pairs of locations scattered
+// across the specified range. Most of these will be in different banks.
+static uint32_t conflict_threshold(testword_t *start, testword_t *end, bool use_clflushopt)
+{
+    uint32_t sample[TIMING_SAMPLES];
+
+    uintptr_t  num_lines  = ((uintptr_t)end - (uintptr_t)start) / LINE_SIZE + 1;
+    testword_t prsg_state = 0x12345678;
+    for (int i = 0; i < TIMING_SAMPLES; i++) {
+        prsg_state = prsg(prsg_state);
+        const testword_t *p1 = (testword_t *)((uintptr_t)start + (prsg_state % num_lines) * LINE_SIZE);
+        prsg_state = prsg(prsg_state);
+        const testword_t *p2 = (testword_t *)((uintptr_t)start + (prsg_state % num_lines) * LINE_SIZE);
+
+        // Insertion sort.
+        uint32_t time = pair_time(p1, p2, use_clflushopt);
+        int j = i;
+        while (j > 0 && sample[j - 1] > time) {
+            sample[j] = sample[j - 1];
+            j--;
+        }
+        sample[j] = time;
+    }
+
+    // Closing and opening a row adds more than a quarter to the access time.
+    uint32_t base_time = sample[TIMING_SAMPLES / 4];
+    return base_time + base_time / 4;
+}
+
+// Looks for a pair of aggressor locations either side of the victim that are
+// in the same bank as the victim but in different rows. The rows either side
+// of the aggressors are also disturbed, so they must lie in the same segment.
+// If the CPU has no TSC, the pairs can't be timed, so takes the nearest pair.
+static bool find_aggressors(int segment, const testword_t *victim, uint32_t threshold, bool use_clflushopt,
+                            const testword_t **p1, const testword_t **p2)
+{
+    uintptr_t seg_start = (uintptr_t)vm_map[segment].start;
+    uintptr_t seg_end   = (uintptr_t)vm_map[segment].end;
+
+    for (uintptr_t distance = MIN_ROW_DISTANCE; distance <= MAX_ROW_DISTANCE; distance *= 2) {
+        if ((uintptr_t)victim - seg_start < 2 * distance || seg_end - (uintptr_t)victim < 2 * distance) {
+            break;
+        }
+        *p1 = (const testword_t *)((uintptr_t)victim - distance);
+        *p2 = (const testword_t *)((uintptr_t)victim + distance);
+        if (threshold == 0) {
+            return true;
+        }
+        if (pair_time(*p1, *p2, use_clflushopt) > threshold && pair_time(*p1, victim, use_clflushopt) > threshold) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+int test_row_hammer(int my_cpu, int iterations, testword_t pattern)
+{
+    int ticks = 0;
+
+    if (my_cpu == master_cpu) {
+        display_test_pattern_value(pattern);
+    }
+
+    // Initialize memory with the pattern.
+    for (int i = 0; i < vm_map_size; i++) {
+        testword_t *start, *end;
+        calculate_chunk(&start, &end, my_cpu, i, LINE_SIZE);
+        if (end < start) SKIP_RANGE(1)
+
+        testword_t *p  = NULL;
+        testword_t *pe = NULL;
+        while (next_block(start, end, spin_size, false, &p, &pe)) {
+            ticks++;
+            if (my_cpu < 0) {
+                continue;
+            }
+            cpu_context[my_cpu].test_addr = (uintptr_t)p;
+            fill_words(p, pe, pattern);
+            count_test_data(my_cpu, (uintptr_t)pe - cpu_context[my_cpu].test_addr + sizeof(testword_t));
+            do_tick(my_cpu);
+            BAILOUT;
+        }
+    }
+    flush_caches(my_cpu);
+
+    // Hammer the rows around 'iterations' victims, evenly spaced across the
+    // memory in the current window. Each CPU takes the victims in its own
+    // chunks, so all the CPUs hammer different banks at the same time.
+    uintptr_t total_size = 0;
+    for (int i = 0; i < vm_map_size; i++) {
+        total_size += (uintptr_t)vm_map[i].end - (uintptr_t)vm_map[i].start + sizeof(testword_t);
+    }
+    uintptr_t spacing = round_down(total_size / (iterations > 0 ? iterations : 1), LINE_SIZE);
+    if (spacing < LINE_SIZE) {
+        spacing = LINE_SIZE;
+    }
+    bool use_clflushopt = cpuid_info.flags.clflushopt;
+    bool can_hammer     = cpuid_info.flags.cflush;
+
+    uint32_t threshold = UINT32_MAX;
+    for (int i = 0; i < vm_map_size && iterations > 0; i++) {
+        testword_t *start, *end;
+        calculate_chunk(&start, &end, my_cpu, i, LINE_SIZE);
+        if (end < start) {
+            continue;
+        }
+        uintptr_t seg_start = (uintptr_t)vm_map[i].start;
+        uintptr_t offset    = round_down(spacing / 2, LINE_SIZE);
+        if ((uintptr_t)start - seg_start > offset) {
+            // Move on to the first victim in this CPU's chunk.
+            offset += (((uintptr_t)start - seg_start - offset + spacing - 1) / spacing) * spacing;
+        }
+        for (; offset <= (uintptr_t)end - seg_start; offset += spacing) {
+            ticks++;
+            if (my_cpu < 0) {
+                continue;
+            }
+            const testword_t *victim = (const testword_t *)(seg_start + offset);
+            cpu_context[my_cpu].test_addr = (uintptr_t)victim;
+            if (can_hammer && threshold == UINT32_MAX) {
+                threshold = cpuid_info.flags.rdtsc ? conflict_threshold(start, end, use_clflushopt) : 0;
+            }
+            const testword_t *p1, *p2;
+            if (can_hammer && find_aggressors(i, victim, threshold, use_clflushopt, &p1, &p2)) {
+                hammer(p1, p2, HAMMER_READS, use_clflushopt);
+            }
+            do_tick(my_cpu);
+            BAILOUT;
+        }
+    }
+
+    // Wait for all the CPUs to finish hammering, as they may disturb rows
+    // in each others' chunks.
+    sync_cpus(my_cpu);
+    BAILOUT;
+
+    // Check for the pattern.
+    for (int i = 0; i < vm_map_size; i++) {
+        testword_t *start, *end;
+        calculate_chunk(&start, &end, my_cpu, i, LINE_SIZE);
+        if (end < start) SKIP_RANGE(1)
+
+        testword_t *p  = NULL;
+        testword_t *pe = NULL;
+        while (next_block(start, end, spin_size, false, &p, &pe)) {
+            ticks++;
+            if (my_cpu < 0) {
+                continue;
+            }
+            cpu_context[my_cpu].test_addr = (uintptr_t)p;
+            test_kernel->pattern_check(p, pe, pattern);
+            count_test_data(my_cpu, (uintptr_t)pe - cpu_context[my_cpu].test_addr + sizeof(testword_t));
+            do_tick(my_cpu);
+            BAILOUT;
+        }
+    }
+
+    return ticks;
+}
@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+//
+// Implements the stress test, which keeps the memory controllers as busy as
+// possible rather than targeting particular faults. Each CPU splits its chunk
+// of each segment into two halves, fills the lower half with a pseudo-random
+// sequence, and then repeatedly copies the lower half to the upper half and
+// checks and inverts the lower half. The CPUs never wait for each other while
+// doing this, and the caches are never flushed. Finally, the upper half is
+// checked for the copy of the sequence it should hold.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "display.h"
+#include "test.h"
+
+#include "test_funcs.h"
+#include "test_helper.h"
+#include "test_kernels.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define CHUNK_ALIGN     (PRSG_LANES * sizeof(testword_t))
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+// Returns the seed for the block of memory at the specified offset from the
+// start of a half. Both halves use the same seeds, so the upper half can be
+// checked against the sequence copied from the lower half.
+static testword_t block_seed(testword_t seed, uintptr_t offset)
+{
+#if (ARCH_BITS == 64)
+    return seed ^ (offset * UINT64_C(0x9e3779b97f4a7c15));
+#else
+    return seed ^ (offset * UINT32_C(0x9e3779b9));
+#endif
+}
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+int test_stress(int my_cpu, int iterations)
+{
+    int ticks = 0;
+
+    if (my_cpu == master_cpu) {
+        display_test_pattern_name("mixed streams");
+    }
+
+    testword_t seed = pass_prsg_seed(cpu_context[my_cpu].running_test, 0);
+
+    for (int i = 0; i < vm_map_size; i++) {
+        testword_t *start, *end;
+        calculate_chunk(&start, &end, my_cpu, i, CHUNK_ALIGN);
+
+        // Both halves must start on a lane boundary, so they use the same
+        // lane of the random sequence for each word.
+        uintptr_t half_size = (end >= start) ? round_down((end - start + 1) / 2, PRSG_LANES) : 0;
+        if (half_size == 0) SKIP_RANGE(2 + iterations)
+
+        testword_t *lower = start;
+        testword_t *upper = start + half_size;
+
+        // Each half is handled in blocks of spin_size words, each with its
+        // own seed.
+        ticks++;
+        if (my_cpu >= 0) {
+            for (uintptr_t offset = 0; offset < half_size; offset += spin_size) {
+                uintptr_t length = (half_size - offset < spin_size) ? half_size - offset : spin_size;
+                cpu_context[my_cpu].test_addr = (uintptr_t)(lower + offset);
+                test_kernel->random_fill(lower + offset, lower + offset + length - 1,
+                                         block_seed(seed, offset), enable_nt_fill);
+                count_test_data(my_cpu, length * sizeof(testword_t));
+            }
+            do_tick(my_cpu);
+            BAILOUT;
+        }
+
+        testword_t invert = 0;
+        for (int j = 0; j < iterations; j++) {
+            ticks++;
+            if (my_cpu < 0) {
+                continue;
+            }
+            for (uintptr_t offset = 0; offset < half_size; offset += spin_size) {
+                uintptr_t length = (half_size - offset < spin_size) ? half_size - offset : spin_size;
+                cpu_context[my_cpu].test_addr = (uintptr_t)(lower + offset);
+
+                // The ERMS copy reaches the peak bandwidth with the least
+                // work for the CPU core. The vector copy adds thermal load.
+                if (enable_stress_avx) {
+                    test_kernel->copy_words(upper + offset, lower + offset, length);
+                } else {
+                    move_words(upper + offset, lower + offset, length);
+                }
+                test_kernel->random_check_write(lower + offset, lower + offset + length - 1,
+                                                block_seed(seed, offset), invert);
+                count_test_data(my_cpu, 4 * length * sizeof(testword_t));
+            }
+            invert = ~invert;
+            do_tick(my_cpu);
+            BAILOUT;
+        }
+
+        // The upper half holds the lower half as it was before the last
+        // check, i.e. the sequence XORed with the previous inversion.
+        ticks++;
+        if (my_cpu >= 0) {
+            for (uintptr_t offset = 0; offset < half_size && iterations > 0; offset += spin_size) {
+                uintptr_t length = (half_size - offset < spin_size) ? half_size - offset : spin_size;
+                cpu_context[my_cpu].test_addr = (uintptr_t)(upper + offset);
+                test_kernel->random_check_write(upper + offset, upper + offset + length - 1,
+                                                block_seed(seed, offset), ~invert);
+                count_test_data(my_cpu, length * sizeof(testword_t));
+            }
+            do_tick(my_cpu);
+            BAILOUT;
+        }
+    }
+
+    return ticks;
+}
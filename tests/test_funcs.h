@@ -15,22 +15,42 @@
 
 #include "test.h"
 
-int test_addr_walk1(int my_cpu);
+// The maximum number of offsets test_modulo_n_fused() tests at once.
+#define MAX_FUSED_OFFSETS   8
+
+int test_addr_walk1(int my_cpu, bool uncached);
 
 int test_own_addr1(int my_cpu);
 
 int test_own_addr2(int my_cpu, int stage);
 
-int test_mov_inv_fixed(int my_cpu, int iterations, testword_t pattern1, testword_t pattern2);
+int test_mov_inv_fixed(int my_cpu, int iterations, testword_t pattern1, testword_t pattern2,
+                       bool chained, testword_t next_pattern);
 
 int test_mov_inv_walk1(int my_cpu, int iterations, int offset, bool inverse);
 
-int test_mov_inv_random(int my_cpu);
+int test_mov_inv_random(int my_cpu, testword_t seed);
 
 int test_modulo_n(int my_cpu, int iterations, testword_t pattern1, testword_t pattern2, int n, int offset);
 
+int test_modulo_n_fused(int my_cpu, int iterations, const testword_t pattern[], int n, int offset, int num_offsets);
+
 int test_block_move(int my_cpu, int iterations);
 
 int test_bit_fade(int my_cpu, int stage, int sleep_secs);
 
+int test_row_hammer(int my_cpu, int iterations, testword_t pattern);
+
+int test_stress(int my_cpu, int iterations);
+
+int test_random_order(int my_cpu, int iterations, testword_t pattern);
+
+int test_coherence(int my_cpu, int iterations, testword_t seed);
+
+int test_retention(int my_cpu, int stage, testword_t seed);
+
+bool retention_next_sweep(int iterations);
+
+int test_llc(int my_cpu, int iterations, testword_t seed);
+
 #endif // TEST_FUNCS_H
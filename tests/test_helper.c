@@ -16,21 +16,332 @@
 #include <stdint.h>
 
 #include "cache.h"
+#include "cpuid.h"
+#include "cpuinfo.h"
+#include "ioat.h"
 #include "smp.h"
+#include "temperature.h"
+#include "tsc.h"
 
 #include "barrier.h"
 
 #include "config.h"
 #include "display.h"
+#include "error.h"
+#include "profile.h"
 
 #include "test_helper.h"
 
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define WORK_UNIT_SIZE  (1 << 18)   // in testwords, must be a multiple of the page size
+
+#define WORK_UNIT_BYTES (WORK_UNIT_SIZE * sizeof(testword_t))
+
+// Flushing a range takes time in proportion to the size of the range, whereas
+// WBINVD takes time in proportion to the size of the caches. So we only flush
+// by range when each CPU's share of the mapped memory is no more than this
+// multiple of the last level cache size.
+#define RANGE_FLUSH_LIMIT   4
+
+// The weight given to the initial work share of the fastest type of CPU
+// core, and the fixed point scale used for the share boundaries. A core's
+// weight is scaled by its measured speed and halved while it is throttled.
+#define WEIGHT_SCALE        16
+#define MIN_WEIGHT          2
+#define SHARE_SCALE         (1 << 16)
+
+// The size of the buffer and the number of passes over it used to measure
+// the speed of each type of CPU core. The buffer is only read, so that the
+// cores measuring at the same time don't disturb each other.
+#define SPEED_TEST_WORDS    4096
+#define SPEED_TEST_PASSES   16
+
+//------------------------------------------------------------------------------
+// Types
+//------------------------------------------------------------------------------
+
+// A work queue holds the range [front, back) of unit numbers within a segment,
+// tagged with the segment number. All fields are packed into a single word so
+// the owner and the thieves can update it atomically.
+
+typedef struct __attribute__((aligned(64))) {
+    volatile uint64_t   state;
+} work_queue_t;
+
+// The part of a rotated work unit that has still to be handed out to its CPU.
+
+typedef struct __attribute__((aligned(64))) {
+    bool                pending;
+    testword_t          *start;
+    testword_t          *end;
+} unit_rest_t;
+
+//------------------------------------------------------------------------------
+// Public Variables
+//------------------------------------------------------------------------------
+
+uintptr_t           spin_size = MAX_SPIN_SIZE;
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+static work_queue_t work_queue[MAX_CPUS];
+
+// The boundaries of each CPU's share of the work units in a segment, as a
+// fraction of SHARE_SCALE. Only used when use_weighted_shares is true.
+static bool         use_weighted_shares = false;
+
+static uint32_t     share_first[MAX_CPUS];
+static uint32_t     share_last[MAX_CPUS];
+
+// The CPUs that were given a chunk_index, recorded by init_work_shares().
+static uint8_t      share_cpus[MAX_CPUS];
+
+static int          num_share_cpus = 0;
+
+// The other hardware thread in each CPU's core, or -1 if none, recorded by
+// init_work_pairs(). When pairing, the two threads of a core share the work
+// of one core, and the lower numbered thread holds it.
+static int          sibling[MAX_CPUS];
+
+static bool         pairing = false;
+
+// The time each CPU took to run the speed test, or 0 if not measured.
+static uint32_t     speed_test_clks[MAX_CPUS];
+
+static testword_t   speed_test_buffer[SPEED_TEST_WORDS];
+
+// Scratch space for update_work_shares(), kept off the (small) AP stacks.
+static int          cpu_at_index[MAX_CPUS];
+
+static int          cpu_weight[MAX_CPUS];
+
+// The sampling set by set_work_sampling().
+static uintptr_t    sample_stride = 1;
+static uintptr_t    sample_offset = 0;
+
+// The stripe size set by set_work_striping(), or 0 if the work units are
+// handed out unrotated.
+static uintptr_t    stripe_size = 0;
+
+static unit_rest_t  unit_rest[MAX_CPUS];
+
+// When the master CPU is next due to do the housekeeping between ticks.
+static uint64_t     next_poll_time = 0;
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static inline uint64_t queue_state(uint32_t front, uint32_t back, uint32_t tag)
+{
+    return (uint64_t)front | (uint64_t)back << 24 | (uint64_t)tag << 48;
+}
+
+static bool take_work_unit(work_queue_t *queue, uint32_t tag, bool from_back, uint32_t *unit)
+{
+    uint64_t state = __atomic_load_n(&queue->state, __ATOMIC_ACQUIRE);
+    while (1) {
+        uint32_t front = (state >>  0) & 0xffffff;
+        uint32_t back  = (state >> 24) & 0xffffff;
+        if ((state >> 48) != tag || front >= back) {
+            return false;
+        }
+        uint64_t new_state;
+        if (from_back) {
+            *unit = back - 1;
+            new_state = queue_state(front, back - 1, tag);
+        } else {
+            *unit = front;
+            new_state = queue_state(front + 1, back, tag);
+        }
+        if (__atomic_compare_exchange_n(&queue->state, &state, new_state, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return true;
+        }
+    }
+}
+
+// Returns the offset within the slice of the specified work unit at which
+// the CPU that takes it starts work, as a multiple of the stripe size. The
+// offset is fixed for each unit, and is spread across the slice by Fibonacci
+// hashing so that the units being tested at the same time, which are mostly
+// a whole share apart, start in unrelated channels and banks.
+static uintptr_t unit_phase(uint32_t unit, uintptr_t slice_size)
+{
+    if (stripe_size == 0 || stripe_size >= slice_size) {
+        return 0;
+    }
+    int phase_bits = 0;
+    while ((stripe_size << phase_bits) < slice_size) {
+        phase_bits++;
+    }
+    uint32_t index = (unit * UINT32_C(0x9e3779b9)) >> (32 - phase_bits);
+    return index * stripe_size;
+}
+
+// Clips the range [first, last] to the specified segment. Returns false if
+// none of the range lies in the segment.
+static bool clip_to_segment(int segment, uintptr_t first, uintptr_t last, testword_t **start, testword_t **end)
+{
+    if (last < (uintptr_t)vm_map[segment].start || first > (uintptr_t)vm_map[segment].end) {
+        return false;
+    }
+    *start = (first > (uintptr_t)vm_map[segment].start) ? (testword_t *)first : vm_map[segment].start;
+    *end   = (last  < (uintptr_t)vm_map[segment].end)   ? (testword_t *)last  : vm_map[segment].end;
+    return true;
+}
+
+// Returns the barrier that synchronises my_cpu with the other CPUs working
+// on the same memory. When the NUMA code paths are enabled, the CPUs in each
+// proximity domain only test the segments in that domain, so they only need
+// to wait for each other until the end of the test.
+static barrier_t *sweep_barrier(int my_cpu)
+{
+    if (enable_numa && domain_barrier != NULL && num_active_cpus > 1) {
+        return &domain_barrier[smp_get_proximity_domain_idx(my_cpu)];
+    }
+    return run_barrier;
+}
+
+static bool use_range_flush(void)
+{
+    if (!cpuid_info.flags.clflushopt || cpuid_info.proc_info.cflushLineSize == 0) {
+        return false;
+    }
+    uintptr_t cache_kb = (l3_cache > 0) ? l3_cache : l2_cache;
+    if (cache_kb == 0) {
+        return false;
+    }
+    uintptr_t mapped_kb = 0;
+    for (int i = 0; i < vm_map_size; i++) {
+        mapped_kb += ((uintptr_t)vm_map[i].end - (uintptr_t)vm_map[i].start) / 1024 + 1;
+    }
+    return mapped_kb / num_active_cpus <= RANGE_FLUSH_LIMIT * cache_kb;
+}
+
+// Returns the average speed test time of the CPU cores of the specified type,
+// or 0 if none of them were measured.
+static uint32_t average_speed_test_clks(core_type_t core_type)
+{
+    uint32_t total_clks = 0;
+    int      num_clks   = 0;
+    for (int n = 0; n < num_share_cpus; n++) {
+        int cpu = share_cpus[n];
+        if (hybrid_core_type[cpu] == core_type && speed_test_clks[cpu] != 0) {
+            total_clks += speed_test_clks[cpu];
+            num_clks++;
+        }
+    }
+    return (num_clks > 0) ? total_clks / num_clks : 0;
+}
+
+// Sets the weight of each CPU's work share, and returns true if they differ.
+// Returns true if the CPU shares the work of its core with its sibling.
+static bool is_paired(int cpu)
+{
+    return pairing && sibling[cpu] >= 0;
+}
+
+static bool calculate_cpu_weights(void)
+{
+    uint32_t pcore_clks = 0;
+    uint32_t ecore_clks = 0;
+    if (cpuid_info.topology.is_hybrid) {
+        pcore_clks = average_speed_test_clks(CORE_PCORE);
+        ecore_clks = average_speed_test_clks(CORE_ECORE);
+    }
+
+    bool weights_differ = false;
+    for (int n = 0; n < num_share_cpus; n++) {
+        int cpu = share_cpus[n];
+        int weight = WEIGHT_SCALE;
+        if (hybrid_core_type[cpu] == CORE_ECORE && pcore_clks != 0 && ecore_clks > pcore_clks) {
+            weight = (WEIGHT_SCALE * pcore_clks + ecore_clks / 2) / ecore_clks;
+        }
+        if (cpu_is_throttled(cpu)) {
+            weight /= 2;
+        }
+        if (weight < MIN_WEIGHT) {
+            weight = MIN_WEIGHT;
+        }
+        cpu_weight[cpu] = weight;
+        if (weight != cpu_weight[share_cpus[0]]) {
+            weights_differ = true;
+        }
+    }
+    if (pairing) {
+        for (int n = 0; n < num_share_cpus; n++) {
+            int cpu = share_cpus[n];
+            if (is_paired(cpu) && sibling[cpu] < cpu) {
+                cpu_weight[sibling[cpu]] += cpu_weight[cpu];
+                cpu_weight[cpu] = 0;
+                weights_differ = true;
+            }
+        }
+    }
+    return weights_differ;
+}
+
+// Flushes this CPU's share of each segment. The shares cover the whole of
+// each segment, unlike the chunks used by the tests, which may leave a tail.
+static void flush_cpu_share(int my_cpu)
+{
+    uintptr_t line_size = cpuid_info.proc_info.cflushLineSize * 8;
+
+    for (int i = 0; i < vm_map_size; i++) {
+        int num_cpus = num_active_cpus;
+        if (num_cpus > 1 && enable_numa) {
+            // Only the CPUs in the segment's proximity domain will have tested it.
+            if (smp_get_proximity_domain_idx(my_cpu) != vm_map[i].proximity_domain_idx) {
+                continue;
+            }
+            num_cpus = used_cpus_in_proximity_domain[vm_map[i].proximity_domain_idx];
+        }
+        uintptr_t first = (uintptr_t)vm_map[i].start;
+        uintptr_t last  = (uintptr_t)vm_map[i].end + sizeof(testword_t) - 1;
+        if (num_cpus > 1) {
+            uintptr_t share = round_up((last - first) / num_cpus + 1, line_size);
+            uintptr_t offset = share * cpu_context[my_cpu].chunk_index;
+            if (offset > last - first) {
+                continue;
+            }
+            first += offset;
+            if (last - first >= share) {
+                last = first + share - 1;
+            }
+        }
+        cache_flush_range((void *)first, (void *)last, line_size);
+    }
+}
+
 //------------------------------------------------------------------------------
 // Public Functions
 //------------------------------------------------------------------------------
 
+void report_pattern_errors(testword_t *start, uintptr_t count, testword_t pattern, testword_t diff)
+{
+    bool found = false;
+    for (uintptr_t i = 0; i < count; i++) {
+        testword_t actual = read_word(&start[i]);
+        if (actual != pattern) {
+            data_error(&start[i], pattern, actual, true);
+            found = true;
+        }
+    }
+    if (!found) {
+        data_error(start, pattern, pattern ^ diff, false);
+    }
+}
+
 void calculate_chunk(testword_t **start, testword_t **end, int my_cpu, int segment, size_t chunk_align)
 {
+    // When only counting ticks (my_cpu < 0), use the equal split, which gives
+    // the average number of ticks per CPU.
+    bool weighted = use_weighted_shares && my_cpu >= 0;
     if (my_cpu < 0) {
         my_cpu = 0;
     }
@@ -39,6 +350,31 @@ void calculate_chunk(testword_t **start, testword_t **end, int my_cpu, int segme
     if (num_active_cpus == 1) {
         *start = vm_map[segment].start;
         *end   = vm_map[segment].end;
+    } else if (weighted) {
+        if (!enable_numa || smp_get_proximity_domain_idx(my_cpu) == vm_map[segment].proximity_domain_idx) {
+            // A chunk is contiguous, so paired threads split their core's
+            // share in two.
+            int share_cpu = (is_paired(my_cpu) && sibling[my_cpu] < my_cpu) ? sibling[my_cpu] : my_cpu;
+
+            uintptr_t segment_size = (vm_map[segment].end - vm_map[segment].start + 1) * sizeof(testword_t);
+            uintptr_t chunk_first  = round_down(((uint64_t)segment_size * share_first[share_cpu]) / SHARE_SCALE, chunk_align);
+            uintptr_t chunk_last   = round_down(((uint64_t)segment_size * share_last[share_cpu])  / SHARE_SCALE, chunk_align);
+            if (is_paired(my_cpu)) {
+                uintptr_t chunk_mid = chunk_first + round_down((chunk_last - chunk_first) / 2, chunk_align);
+                if (share_cpu == my_cpu) {
+                    chunk_last  = chunk_mid;
+                } else {
+                    chunk_first = chunk_mid;
+                }
+            }
+
+            // Calculate chunk boundaries.
+            *start = (testword_t *)((uintptr_t)vm_map[segment].start + chunk_first);
+            *end   = (testword_t *)((uintptr_t)vm_map[segment].start + chunk_last) - 1;
+        } else {
+            *start = (testword_t *)1;
+            *end = (testword_t *)0;
+        }
     } else {
         if (enable_numa) {
             uint32_t proximity_domain_idx = smp_get_proximity_domain_idx(my_cpu);
@@ -49,7 +385,7 @@ void calculate_chunk(testword_t **start, testword_t **end, int my_cpu, int segme
                 uintptr_t chunk_size   = round_down(segment_size / used_cpus_in_proximity_domain[proximity_domain_idx], chunk_align);
 
                 // Calculate chunk boundaries.
-                *start = (testword_t *)((uintptr_t)vm_map[segment].start + chunk_size * chunk_index[my_cpu]);
+                *start = (testword_t *)((uintptr_t)vm_map[segment].start + chunk_size * cpu_context[my_cpu].chunk_index);
                 *end   = (testword_t *)((uintptr_t)(*start) + chunk_size) - 1;
 
                 if (*end > vm_map[segment].end) {
@@ -65,7 +401,7 @@ void calculate_chunk(testword_t **start, testword_t **end, int my_cpu, int segme
             uintptr_t chunk_size   = round_down(segment_size / num_active_cpus, chunk_align);
 
             // Calculate chunk boundaries.
-            *start = (testword_t *)((uintptr_t)vm_map[segment].start + chunk_size * chunk_index[my_cpu]);
+            *start = (testword_t *)((uintptr_t)vm_map[segment].start + chunk_size * cpu_context[my_cpu].chunk_index);
             *end   = (testword_t *)((uintptr_t)(*start) + chunk_size) - 1;
 
             if (*end > vm_map[segment].end) {
@@ -73,24 +409,345 @@ void calculate_chunk(testword_t **start, testword_t **end, int my_cpu, int segme
             }
         }
     }
+
+    if (sample_stride > 1 && *start <= *end) {
+        uintptr_t slice_size = round_down(((uintptr_t)*end - (uintptr_t)*start + sizeof(testword_t)) / sample_stride, chunk_align);
+        if (slice_size == 0) {
+            *start = (testword_t *)1;
+            *end = (testword_t *)0;
+            return;
+        }
+        *start = (testword_t *)((uintptr_t)(*start) + slice_size * sample_offset);
+        *end   = (testword_t *)((uintptr_t)(*start) + slice_size) - 1;
+    }
+}
+
+void set_work_sampling(int stride, int offset)
+{
+    if (stride < 1) {
+        stride = 1;
+    }
+    if (stride > MAX_SAMPLE_STRIDE) {
+        stride = MAX_SAMPLE_STRIDE;
+    }
+    sample_stride = stride;
+    sample_offset = (uintptr_t)offset % stride;
+}
+
+void set_work_striping(uintptr_t size)
+{
+    stripe_size = 0;
+    if (size >= MIN_STRIPE_SIZE) {
+        stripe_size = MIN_STRIPE_SIZE;
+        while (stripe_size <= size / 2) {
+            stripe_size *= 2;
+        }
+    }
+}
+
+int calibrate_spin_size(uint64_t clks_per_tick)
+{
+    uint64_t target_clks = (uint64_t)TICK_PERIOD * clks_per_msec;
+    if (clks_per_tick == 0 || target_clks == 0) {
+        return 0;
+    }
+    int shift = 0;
+    while (clks_per_tick > 2 * target_clks && spin_size > MIN_SPIN_SIZE) {
+        spin_size /= 2;
+        clks_per_tick /= 2;
+        shift--;
+    }
+    while (clks_per_tick < target_clks / 2 && spin_size < MAX_SPIN_SIZE) {
+        spin_size *= 2;
+        clks_per_tick *= 2;
+        shift++;
+    }
+    return shift;
+}
+
+void init_work_shares(const uint8_t test_cpus[], int num_cpus)
+{
+    for (int n = 0; n < num_cpus; n++) {
+        share_cpus[n] = test_cpus[n];
+    }
+    num_share_cpus = num_cpus;
+}
+
+void init_work_pairs(const int cpu_sibling[])
+{
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        sibling[cpu] = -1;
+    }
+    for (int n = 0; n < num_share_cpus; n++) {
+        int cpu   = share_cpus[n];
+        int other = cpu_sibling[cpu];
+        for (int m = 0; other >= 0 && m < num_share_cpus; m++) {
+            if (share_cpus[m] == other) {
+                sibling[cpu] = other;
+            }
+        }
+    }
+}
+
+void set_work_pairing(bool enabled)
+{
+    pairing = enabled;
+}
+
+void measure_cpu_speed(int my_cpu)
+{
+    if (!cpuid_info.flags.rdtsc) {
+        return;
+    }
+    // Take the best of a few runs, so that an interrupted run doesn't count.
+    uint32_t best_clks = UINT32_MAX;
+    for (int run = 0; run < 3; run++) {
+        uint32_t start_time, end_time;
+        rdtscl(start_time);
+        for (int pass = 0; pass < SPEED_TEST_PASSES; pass++) {
+            for (int i = 0; i < SPEED_TEST_WORDS; i++) {
+                (void)read_word(&speed_test_buffer[i]);
+            }
+        }
+        rdtscl(end_time);
+        if (best_clks > end_time - start_time) {
+            best_clks = end_time - start_time;
+        }
+    }
+    speed_test_clks[my_cpu] = best_clks;
+}
+
+void update_work_shares(void)
+{
+    use_weighted_shares = false;
+    if (num_active_cpus == 1 || num_share_cpus == 0) {
+        return;
+    }
+    if (!calculate_cpu_weights()) {
+        return;
+    }
+
+    // The CPUs sharing a segment are numbered by chunk_index, either across
+    // all the test CPUs or within each proximity domain.
+    int num_groups = enable_numa ? num_proximity_domains : 1;
+    for (int group = 0; group < num_groups; group++) {
+        int num_cpus = 0;
+        for (int n = 0; n < num_share_cpus; n++) {
+            int cpu = share_cpus[n];
+            if (!enable_numa || (int)smp_get_proximity_domain_idx(cpu) == group) {
+                cpu_at_index[cpu_context[cpu].chunk_index] = cpu;
+                num_cpus++;
+            }
+        }
+        uint32_t total_weight = 0;
+        for (int n = 0; n < num_cpus; n++) {
+            total_weight += cpu_weight[cpu_at_index[n]];
+        }
+        uint32_t weight = 0;
+        for (int n = 0; n < num_cpus; n++) {
+            int cpu = cpu_at_index[n];
+            share_first[cpu] = weight * SHARE_SCALE / total_weight;
+            weight += cpu_weight[cpu];
+            share_last[cpu]  = weight * SHARE_SCALE / total_weight;
+        }
+    }
+    use_weighted_shares = true;
+}
+
+int setup_work_units(int my_cpu, int segment)
+{
+    uintptr_t segment_size = vm_map[segment].end - vm_map[segment].start + 1;
+
+    // Every active CPU must perform the same number of ticks.
+    int ticks = (segment_size / sample_stride / num_active_cpus + spin_size - 1) / spin_size;
+    if (ticks < 1) {
+        ticks = 1;
+    }
+    if (my_cpu < 0) {
+        return ticks;
+    }
+    unit_rest[my_cpu].pending = false;
+
+    uintptr_t base = round_down((uintptr_t)vm_map[segment].start, WORK_UNIT_BYTES);
+    uint32_t num_units = ((uintptr_t)vm_map[segment].end - base) / WORK_UNIT_BYTES + 1;
+
+    uint32_t first = 0;
+    uint32_t last  = 0;
+    if (num_active_cpus == 1) {
+        last = num_units;
+    } else if (use_weighted_shares) {
+        if (!enable_numa || smp_get_proximity_domain_idx(my_cpu) == vm_map[segment].proximity_domain_idx) {
+            first = ((uint64_t)num_units * share_first[my_cpu]) / SHARE_SCALE;
+            last  = ((uint64_t)num_units * share_last[my_cpu])  / SHARE_SCALE;
+        }
+    } else if (enable_numa) {
+        uint32_t proximity_domain_idx = smp_get_proximity_domain_idx(my_cpu);
+
+        // Only CPUs in the same proximity domain as the segment get a share.
+        if (proximity_domain_idx == vm_map[segment].proximity_domain_idx) {
+            uint32_t num_cpus = used_cpus_in_proximity_domain[proximity_domain_idx];
+            first = (uintptr_t)num_units * (cpu_context[my_cpu].chunk_index + 0) / num_cpus;
+            last  = (uintptr_t)num_units * (cpu_context[my_cpu].chunk_index + 1) / num_cpus;
+        }
+    } else {
+        first = (uintptr_t)num_units * (cpu_context[my_cpu].chunk_index + 0) / num_active_cpus;
+        last  = (uintptr_t)num_units * (cpu_context[my_cpu].chunk_index + 1) / num_active_cpus;
+    }
+
+    __atomic_store_n(&work_queue[my_cpu].state, queue_state(first, last, segment + 1), __ATOMIC_RELEASE);
+
+    return ticks;
+}
+
+void poll_housekeeping(int my_cpu)
+{
+    if (my_cpu != master_cpu || ui_cpu >= 0 || clks_per_msec == 0) {
+        return;
+    }
+    uint64_t current_time = get_tsc();
+    if (current_time < next_poll_time) {
+        return;
+    }
+    next_poll_time = current_time + TICK_PERIOD * clks_per_msec;
+    do_housekeeping();
+}
+
+bool get_work_unit(int my_cpu, int segment, bool top_down, testword_t **start, testword_t **end)
+{
+    uint32_t tag = segment + 1;
+
+    poll_housekeeping(my_cpu);
+    if (bail) {
+        return false;
+    }
+
+    if (unit_rest[my_cpu].pending) {
+        unit_rest[my_cpu].pending = false;
+        *start = unit_rest[my_cpu].start;
+        *end   = unit_rest[my_cpu].end;
+        count_test_data(my_cpu, (uintptr_t)*end - (uintptr_t)*start + sizeof(testword_t));
+        return true;
+    }
+
+    // When sampling, only one slice of each unit is tested. The first and
+    // last units of a segment may not contain any of their slice, in which
+    // case we move on to the next unit.
+    uintptr_t slice_size = WORK_UNIT_BYTES / sample_stride;
+
+    uint32_t  unit;
+    uintptr_t unit_start, unit_end;
+    do {
+        // The owner takes units from one end of its queue and thieves take them from the other.
+        // Paired threads both take units from the owner's end of their core's queue, so they
+        // work through it in step, in alternate units.
+        bool found = take_work_unit(&work_queue[my_cpu], tag, top_down, &unit);
+        if (!found && is_paired(my_cpu)) {
+            found = take_work_unit(&work_queue[sibling[my_cpu]], tag, top_down, &unit);
+        }
+        if (!found && num_active_cpus > 1) {
+            bool may_steal = true;
+            if (enable_numa) {
+                may_steal = (smp_get_proximity_domain_idx(my_cpu) == vm_map[segment].proximity_domain_idx);
+            }
+            for (int i = 1; may_steal && !found && i < num_available_cpus; i++) {
+                int victim = (my_cpu + i) % num_available_cpus;
+                found = take_work_unit(&work_queue[victim], tag, !top_down, &unit);
+            }
+        }
+        if (!found) {
+            return false;
+        }
+
+        unit_start = round_down((uintptr_t)vm_map[segment].start, WORK_UNIT_BYTES) + unit * WORK_UNIT_BYTES
+                   + sample_offset * slice_size;
+        unit_end   = unit_start + slice_size - sizeof(testword_t);
+    } while (unit_end < (uintptr_t)vm_map[segment].start || unit_start > (uintptr_t)vm_map[segment].end);
+
+    // When striping, the unit is handed out in two parts, so that the CPU
+    // works through it from its phase round to its phase again, in the
+    // direction given by top_down.
+    uintptr_t phase = unit_phase(unit, slice_size);
+    if (phase != 0) {
+        uintptr_t split = unit_start + phase;
+        unit_rest_t *rest = &unit_rest[my_cpu];
+        if (top_down) {
+            rest->pending = clip_to_segment(segment, split, unit_end, &rest->start, &rest->end);
+            unit_end = split - sizeof(testword_t);
+        } else {
+            rest->pending = clip_to_segment(segment, unit_start, split - sizeof(testword_t), &rest->start, &rest->end);
+            unit_start = split;
+        }
+        if (!clip_to_segment(segment, unit_start, unit_end, start, end)) {
+            // All of this unit that lies in the segment is in the other part.
+            rest->pending = false;
+            *start = rest->start;
+            *end   = rest->end;
+        }
+    } else {
+        clip_to_segment(segment, unit_start, unit_end, start, end);
+    }
+
+    count_test_data(my_cpu, (uintptr_t)*end - (uintptr_t)*start + sizeof(testword_t));
+
+    return true;
+}
+
+void sync_cpus(int my_cpu)
+{
+    if (my_cpu >= 0) {
+        barrier_t *barrier = sweep_barrier(my_cpu);
+        uint64_t start_time = profile_start();
+        if (power_save < POWER_SAVE_HIGH) {
+            barrier_spin_wait(barrier);
+        } else {
+            barrier_halt_wait(barrier);
+        }
+        profile_record(my_cpu, PHASE_BARRIER_WAIT, start_time);
+        if (my_cpu == master_cpu && ui_cpu < 0) {
+            error_update();
+        }
+    }
 }
 
 void flush_caches(int my_cpu)
 {
     if (my_cpu >= 0) {
+        barrier_t *barrier = sweep_barrier(my_cpu);
         bool use_spin_wait = (power_save < POWER_SAVE_HIGH);
+        uint64_t start_time = profile_start();
         if (use_spin_wait) {
-            barrier_spin_wait(run_barrier);
+            barrier_spin_wait(barrier);
         } else {
-            barrier_halt_wait(run_barrier);
+            barrier_halt_wait(barrier);
         }
-        if (my_cpu == master_cpu) {
+        profile_record(my_cpu, PHASE_BARRIER_WAIT, start_time);
+        if (use_range_flush()) {
+            // Avoid the global serialising WBINVD by having each CPU flush its
+            // own share of the mapped memory in parallel.
+            start_time = profile_start();
+            flush_cpu_share(my_cpu);
+            profile_record(my_cpu, PHASE_CACHE_FLUSH, start_time);
+        } else if (barrier == run_barrier ? my_cpu == master_cpu : cpu_context[my_cpu].chunk_index == 0) {
+            // With a barrier per proximity domain, the first CPU in each
+            // domain flushes the caches for its own domain.
+            start_time = profile_start();
             cache_flush();
+            profile_record(my_cpu, PHASE_CACHE_FLUSH, start_time);
         }
+        start_time = profile_start();
         if (use_spin_wait) {
-            barrier_spin_wait(run_barrier);
+            barrier_spin_wait(barrier);
         } else {
-            barrier_halt_wait(run_barrier);
+            barrier_halt_wait(barrier);
         }
+        profile_record(my_cpu, PHASE_BARRIER_WAIT, start_time);
+    }
+}
+
+int dma_channel(int my_cpu)
+{
+    if (!enable_dma || my_cpu < 0 || my_cpu >= ioat_num_channels()) {
+        return -1;
     }
+    return my_cpu;
 }
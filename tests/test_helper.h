@@ -11,9 +11,12 @@
  * Copyright (C) 2020-2022 Martin Whitaker.
  */
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+#include "memsize.h"
+
 #include "test.h"
 
 /**
@@ -21,11 +24,13 @@
  */
 #include "memrw.h"
 #if (ARCH_BITS == 64)
-#define read_word   read64
-#define write_word  write64
+#define read_word       read64
+#define write_word      write64
+#define write_word_nt   write64_nt
 #else
-#define read_word   read32
-#define write_word  write32
+#define read_word       read32
+#define write_word      write32
+#define write_word_nt   write32_nt
 #endif
 
 /**
@@ -33,12 +38,24 @@
  */
 #define unlikely(x) __builtin_expect(!!(x), 0)
 
+/**
+ * The limits of the block size processed between each update of the progress
+ * bars and spinners, in testwords. The block size must be a power of 2.
+ */
+#define MIN_SPIN_SIZE   (1 << 18)
+#define MAX_SPIN_SIZE   (1 << 27)
+
+/**
+ * The target time taken to process a block of spin_size words, in ms.
+ */
+#define TICK_PERIOD     50
+
 /**
  * The block size processed between each update of the progress bars and
- * spinners. This also affects how quickly the program will respond to the
- * keyboard.
+ * spinners, in testwords. Each CPU performs one tick per block, so this
+ * determines the number of ticks in each test. Set by calibrate_spin_size().
  */
-#define SPIN_SIZE (1 << 27)  // in testwords
+extern uintptr_t spin_size;
 
 /**
  * A macro to perform test bailout when requested.
@@ -46,10 +63,16 @@
 #define BAILOUT if (bail) return ticks
 
 /**
- * A macro to skip the current range without disturbing waits on barriers and creating a deadlock.
+ * A macro to skip the current range while keeping the progress display in step with the other CPUs.
  */
 #define SKIP_RANGE(num_ticks) { if (my_cpu >= 0) { for (int iter = 0; iter < num_ticks; iter++) { do_tick(my_cpu); BAILOUT; } } continue; }
 
+/**
+ * A macro to perform the ticks for a segment once all its work units have been processed, and then to
+ * wait for the other CPUs to finish the segment.
+ */
+#define DO_TICKS(num_ticks) { for (int iter = 0; iter < num_ticks; iter++) { do_tick(my_cpu); BAILOUT; } sync_cpus(my_cpu); BAILOUT; }
+
 /**
  * Returns value rounded down to the nearest multiple of align_size.
  */
@@ -66,6 +89,41 @@ static inline uintptr_t round_up(uintptr_t value, size_t align_size)
     return (value + (align_size - 1)) & ~(align_size - 1);
 }
 
+/**
+ * Steps through the range [start, end] in blocks of at most block_size words,
+ * from the lowest address to the highest address, or from the highest to the
+ * lowest if top_down is true. Before the first call, *pb and *pe must both be
+ * NULL. Each call sets *pb and *pe to the first and last word of the next
+ * block and returns true, or returns false if there are no more blocks. The
+ * block limits are calculated so that the pointers never overflow.
+ *
+ * This is always inlined, so the direction is fixed at compile time.
+ */
+static inline __attribute__((always_inline)) bool next_block(testword_t *start, testword_t *end, uintptr_t block_size,
+                                                             bool top_down, testword_t **pb, testword_t **pe)
+{
+    if (top_down) {
+        if (*pe == NULL) {
+            *pe = end;
+        } else if (*pb == start) {
+            return false;
+        } else {
+            *pe = *pb - 1;
+        }
+        *pb = ((uintptr_t)(*pe - start) >= block_size) ? *pe - (block_size - 1) : start;
+    } else {
+        if (*pb == NULL) {
+            *pb = start;
+        } else if (*pe == end) {
+            return false;
+        } else {
+            *pb = *pe + 1;
+        }
+        *pe = ((uintptr_t)(end - *pb) >= block_size) ? *pb + (block_size - 1) : end;
+    }
+    return true;
+}
+
 /**
  * Returns the next word in a pseudo-random sequence where state was the
  * previous word in that sequence.
@@ -85,6 +143,89 @@ static inline testword_t prsg(testword_t state)
     return state;
 }
 
+/**
+ * Returns the initial PRSG state for the random patterns used by iteration
+ * i of the specified test in the current pass. This only depends on the pass
+ * seed and the arguments, so a run with the same seed repeats the patterns,
+ * even when only some of the tests or windows are run.
+ */
+static inline testword_t pass_prsg_seed(int test, int i)
+{
+#if (ARCH_BITS == 64)
+    testword_t state = pass_seed ^ ((testword_t)(test << 16 | i) + 1) * UINT64_C(0x9e3779b97f4a7c15);
+#else
+    testword_t state = pass_seed ^ ((testword_t)(test << 16 | i) + 1) * UINT32_C(0x9e3779b9);
+#endif
+    if (state == 0) {
+        state = 1;
+    }
+    return prsg(prsg(state));
+}
+
+/**
+ * The number of independent pseudo-random sequences interleaved by the
+ * multi-lane generator. The sequence used for each word is selected by its
+ * address, so each aligned block of PRSG_LANES words takes one value from
+ * every sequence, and the sequences can be advanced in parallel.
+ */
+#define PRSG_LANES  16
+
+/**
+ * Returns the lane of the multi-lane generator used for the word at p.
+ */
+static inline unsigned prsg_lane(const testword_t *p)
+{
+    return ((uintptr_t)p / sizeof(testword_t)) % PRSG_LANES;
+}
+
+/**
+ * Returns the initial state of the specified lane of the multi-lane generator
+ * for the specified seed. The lanes start far enough apart in the sequence
+ * that neighbouring words are not correlated.
+ */
+static inline testword_t prsg_lane_seed(testword_t seed, unsigned lane)
+{
+#if (ARCH_BITS == 64)
+    testword_t state = seed ^ ((lane + 1) * UINT64_C(0x9e3779b97f4a7c15));
+#else
+    testword_t state = seed ^ ((lane + 1) * UINT32_C(0x9e3779b9));
+#endif
+    if (state == 0) {
+        state = seed;
+    }
+    return prsg(prsg(prsg(state)));
+}
+
+/**
+ * Returns the value of the word at p in the wide walking ones pattern that is
+ * 'width' bits wide, where width is a power of 2 greater than TESTWORD_WIDTH.
+ * Each aligned block of width / 8 bytes has a single bit set, and the bit
+ * moves on by one for each successive block, starting from bit 'offset' in
+ * the block at address 0.
+ */
+static inline testword_t wide_walk_word(const testword_t *p, unsigned width, unsigned offset)
+{
+    uintptr_t word  = (uintptr_t)p / sizeof(testword_t);
+    uintptr_t words = width / TESTWORD_WIDTH;
+    unsigned  bit   = (offset + word / words) % width;
+    return (word % words == bit / TESTWORD_WIDTH) ? (testword_t)1 << (bit % TESTWORD_WIDTH) : 0;
+}
+
+/**
+ * The size of the blocks reduced by the pattern_check kernels before testing
+ * the result, in words.
+ */
+#define CHECK_BLOCK_WORDS   (PAGE_SIZE / sizeof(testword_t))
+
+/**
+ * Rescans the 'count' words starting at 'start', which a pattern check found
+ * did not all contain 'pattern', and reports each word that differs. 'diff' is
+ * the OR of the differences seen by the check. If the rescan finds no error,
+ * the error was transient, and is reported at 'start' with the bits set in
+ * 'diff' inverted.
+ */
+void report_pattern_errors(testword_t *start, uintptr_t count, testword_t pattern, testword_t diff);
+
 /**
  * Calculates the start and end word address for the chunk of segment that is
  * to be tested by my_cpu. The chunk start will be aligned to a multiple of
@@ -92,10 +233,142 @@ static inline testword_t prsg(testword_t state)
  */
 void calculate_chunk(testword_t **start, testword_t **end, int my_cpu, int segment, size_t chunk_align);
 
+/**
+ * The largest sampling stride supported by set_work_sampling().
+ */
+#define MAX_SAMPLE_STRIDE   256
+
+/**
+ * Restricts the work units and chunks handed out to the tests to one slice in
+ * every stride, starting with the slice at the specified offset. The slices
+ * are spread evenly across each work unit (or each chunk), so a sampled test
+ * still touches every part of the physical map. A stride of 1 tests all the
+ * memory. stride must be a power of 2 no larger than MAX_SAMPLE_STRIDE. Must
+ * only be called by the master CPU while the other CPUs are waiting at a
+ * barrier.
+ */
+void set_work_sampling(int stride, int offset);
+
+/**
+ * The smallest stripe size supported by set_work_striping(), in bytes.
+ */
+#define MIN_STRIPE_SIZE     64
+
+/**
+ * Rotates each work unit handed out by get_work_unit() so that testing starts
+ * at an offset within the unit that is a multiple of the specified size. The
+ * offset differs from unit to unit, so the CPUs testing different units at the
+ * same time spread their accesses across the memory channels and banks rather
+ * than moving through them in step. size should be the channel interleave
+ * granule, and is rounded down to a power of 2. A size less than
+ * MIN_STRIPE_SIZE hands out the units unrotated. Must only be called while no
+ * test is running.
+ */
+void set_work_striping(uintptr_t size);
+
+/**
+ * Adjusts spin_size by a power of 2, within its limits, so that a tick that
+ * took clks_per_tick TSC cycles with the current block size takes as close
+ * as possible to TICK_PERIOD. Returns the power of 2 by which the time per
+ * tick is expected to scale (negative if the block size was reduced). Does
+ * nothing if clks_per_tick is 0. The tick counts of all the tests must be
+ * recalculated after changing the block size.
+ */
+int calibrate_spin_size(uint64_t clks_per_tick);
+
+/**
+ * Distributes the specified segment between the active CPUs as a set of
+ * aligned work units, and loads the work units assigned to my_cpu into its
+ * work queue. Returns the number of ticks that every active CPU must perform
+ * once it has finished working on the segment. When my_cpu is negative, only
+ * calculates the number of ticks.
+ *
+ * Each CPU must call this before calling get_work_unit() for a segment, and
+ * must synchronise with the other CPUs (by calling sync_cpus()) before moving
+ * on to the next segment.
+ */
+int setup_work_units(int my_cpu, int segment);
+
+/**
+ * Records the CPUs that take part in the tests, in the order of their
+ * chunk_index. Must be called before update_work_shares().
+ */
+void init_work_shares(const uint8_t test_cpus[], int num_cpus);
+
+/**
+ * Records the other hardware thread in the same core as each CPU, or -1 if
+ * there is none. Threads that aren't both test CPUs are not paired. Must be
+ * called after init_work_shares().
+ */
+void init_work_pairs(const int cpu_sibling[]);
+
+/**
+ * Enables or disables pairing. When enabled, the two hardware threads of each
+ * core share the core's work: they take alternate work units from a single
+ * share, and split a single chunk in two. When disabled, each thread has its
+ * own share, as in a core without SMT. Must only be called by the master CPU
+ * while the other CPUs are waiting at a barrier, and followed by a call to
+ * update_work_shares().
+ */
+void set_work_pairing(bool enabled);
+
+/**
+ * Measures how fast the CPU core running this function is, using a short
+ * read loop. On a hybrid CPU, each core should call this once at startup.
+ */
+void measure_cpu_speed(int my_cpu);
+
+/**
+ * Recalculates the work shares used by setup_work_units() and
+ * calculate_chunk(). Each CPU's share is weighted by the measured speed of
+ * its core type and is halved while the latest thermal sample shows it is
+ * throttled, so that slower CPUs start with a smaller share and the others
+ * steal less of their work. Must only be called by the master CPU while the
+ * other CPUs are waiting at a barrier.
+ */
+void update_work_shares(void);
+
+/**
+ * Does the housekeeping on the master CPU if a tick period has passed since
+ * it was last done here. The tests that use work units only tick at the end
+ * of each segment, and the bit fade test only ticks once a second, so this
+ * keeps the display and the keyboard responsive, and lets a key press that
+ * abandons the test take effect within a tick period. Does nothing on the
+ * other CPUs, or if there is a dedicated UI core.
+ */
+void poll_housekeeping(int my_cpu);
+
+/**
+ * Takes the next work unit from the work queue of my_cpu, or if that is
+ * empty, steals one from another CPU working on the same segment. Takes the
+ * units in order of increasing address, or of decreasing address if top_down
+ * is true. Returns false when there is no more work for this segment.
+ *
+ * The work units cover fixed address ranges, so a test that derives its data
+ * pattern from the address or from the offset within the segment produces the
+ * same result whichever CPU tests each unit. When striping, each unit is
+ * handed out as two consecutive ranges, which are also fixed.
+ */
+bool get_work_unit(int my_cpu, int segment, bool top_down, testword_t **start, testword_t **end);
+
+/**
+ * Waits for all the active CPUs to reach the end of the current test phase.
+ * The progress ticks do not synchronise the CPUs, so tests must call this
+ * wherever a CPU might next access memory written by another CPU. Returns
+ * early if the test is being abandoned.
+ */
+void sync_cpus(int my_cpu);
+
 /**
  * Flushes the CPU caches. If SMP is enabled, synchronises the threads before
  * and after issuing the cache flush instruction.
  */
 void flush_caches(int my_cpu);
 
+/**
+ * Returns the DMA channel that my_cpu may use to offload part of its work,
+ * or -1 if it has none. When the dma option is given, CPU n drives channel n.
+ */
+int dma_channel(int my_cpu);
+
 #endif // TEST_HELPER_H
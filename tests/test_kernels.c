@@ -0,0 +1,391 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpuid.h"
+#include "simd.h"
+
+#include "config.h"
+#include "display.h"
+#include "error.h"
+#include "test.h"
+
+#include "test_helper.h"
+#include "test_kernels.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define HAND_OPTIMISED  1   // Use hand-optimised assembler code for performance.
+
+#define ERMS_MIN_BYTES  2048    // below this, the start-up cost of "rep movsb" dominates
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static void scalar_fill(testword_t *start, testword_t *end, testword_t pattern)
+{
+#if HAND_OPTIMISED
+#ifdef __x86_64__
+    uint64_t length = end - start + 1;
+    __asm__  __volatile__ ("\t"
+        "rep    \n\t"
+        "stosq  \n\t"
+        :
+        : "c" (length), "D" (start), "a" (pattern)
+        : "memory"
+    );
+#else
+    uint32_t length = end - start + 1;
+    __asm__  __volatile__ ("\t"
+        "rep    \n\t"
+        "stosl  \n\t"
+        :
+        : "c" (length), "D" (start), "a" (pattern)
+        : "memory"
+    );
+#endif
+#else
+    testword_t *p = start;
+    do {
+        write_word(p, pattern);
+    } while (p++ < end); // test before increment in case pointer overflows
+#endif
+}
+
+// The scalar moving inversions kernels are generated from these for each
+// direction. They are always inlined, so the direction is fixed at compile
+// time and the inner loops contain no direction tests.
+
+static inline __attribute__((always_inline)) void check_write(testword_t *start, testword_t *end,
+                                                              testword_t expect, testword_t replace, bool top_down)
+{
+    testword_t *p = top_down ? end : start;
+    do {
+        testword_t actual = read_word(p);
+        if (unlikely(actual != expect)) {
+            data_error(p, expect, actual, true);
+        }
+        write_word(p, replace);
+    } while (top_down ? p-- > start : p++ < end); // test before stepping in case pointer overflows
+}
+
+static inline __attribute__((always_inline)) testword_t walk_check(testword_t *start, testword_t *end,
+                                                                   testword_t pattern, bool top_down)
+{
+    testword_t *p = top_down ? end : start;
+    do {
+        if (top_down) {
+            pattern = pattern >> 1 | pattern << (TESTWORD_WIDTH - 1);  // rotate right
+        }
+        testword_t expect = pattern;
+        testword_t actual = read_word(p);
+        if (unlikely(actual != expect)) {
+            data_error(p, expect, actual, true);
+        }
+        write_word(p, ~expect);
+        if (!top_down) {
+            pattern = pattern << 1 | pattern >> (TESTWORD_WIDTH - 1);  // rotate left
+        }
+    } while (top_down ? p-- > start : p++ < end); // test before stepping in case pointer overflows
+    return pattern;
+}
+
+static inline __attribute__((always_inline)) void wide_walk_check(testword_t *start, testword_t *end, unsigned width,
+                                                                  unsigned offset, testword_t invert, bool top_down)
+{
+    testword_t *p = top_down ? end : start;
+    do {
+        testword_t expect = wide_walk_word(p, width, offset) ^ invert;
+        testword_t actual = read_word(p);
+        if (unlikely(actual != expect)) {
+            data_error(p, expect, actual, true);
+        }
+        write_word(p, ~expect);
+    } while (top_down ? p-- > start : p++ < end); // test before stepping in case pointer overflows
+}
+
+static void scalar_check_write_up(testword_t *start, testword_t *end, testword_t expect, testword_t replace)
+{
+    check_write(start, end, expect, replace, false);
+}
+
+static void scalar_check_write_down(testword_t *start, testword_t *end, testword_t expect, testword_t replace)
+{
+    check_write(start, end, expect, replace, true);
+}
+
+static testword_t scalar_walk_check_up(testword_t *start, testword_t *end, testword_t pattern)
+{
+    return walk_check(start, end, pattern, false);
+}
+
+static testword_t scalar_walk_check_down(testword_t *start, testword_t *end, testword_t pattern)
+{
+    return walk_check(start, end, pattern, true);
+}
+
+static void scalar_wide_walk_fill(testword_t *start, testword_t *end, unsigned width, unsigned offset, testword_t invert)
+{
+    testword_t *p = start;
+    do {
+        write_word(p, wide_walk_word(p, width, offset) ^ invert);
+    } while (p++ < end); // test before increment in case pointer overflows
+}
+
+static void scalar_wide_walk_check_up(testword_t *start, testword_t *end, unsigned width, unsigned offset, testword_t invert)
+{
+    wide_walk_check(start, end, width, offset, invert, false);
+}
+
+static void scalar_wide_walk_check_down(testword_t *start, testword_t *end, unsigned width, unsigned offset, testword_t invert)
+{
+    wide_walk_check(start, end, width, offset, invert, true);
+}
+
+static void scalar_random_fill(testword_t *start, testword_t *end, testword_t seed, bool nt)
+{
+    (void)nt;   // streaming stores need SSE2
+
+    testword_t state[PRSG_LANES];
+    for (unsigned lane = 0; lane < PRSG_LANES; lane++) {
+        state[lane] = prsg_lane_seed(seed, lane);
+    }
+    testword_t *p = start;
+    do {
+        unsigned lane = prsg_lane(p);
+        state[lane] = prsg(state[lane]);
+        write_word(p, state[lane]);
+    } while (p++ < end); // test before increment in case pointer overflows
+}
+
+static void scalar_random_check_write(testword_t *start, testword_t *end, testword_t seed, testword_t invert)
+{
+    testword_t state[PRSG_LANES];
+    for (unsigned lane = 0; lane < PRSG_LANES; lane++) {
+        state[lane] = prsg_lane_seed(seed, lane);
+    }
+    testword_t *p = start;
+    do {
+        unsigned lane = prsg_lane(p);
+        state[lane] = prsg(state[lane]);
+        testword_t expect = state[lane] ^ invert;
+        testword_t actual = read_word(p);
+        if (unlikely(actual != expect)) {
+            data_error(p, expect, actual, true);
+        }
+        write_word(p, ~expect);
+    } while (p++ < end); // test before increment in case pointer overflows
+}
+
+static void scalar_block_fill(testword_t *start, testword_t *end)
+{
+    uintptr_t n = end - start + 1;
+    uintptr_t i = 0;
+
+    testword_t pattern1 = 1;
+    while (n - i >= BLOCK_WORDS) {
+        testword_t *p = &start[i];
+        testword_t pattern2 = ~pattern1;
+        write_word(p + 0,  pattern1);
+        write_word(p + 1,  pattern1);
+        write_word(p + 2,  pattern1);
+        write_word(p + 3,  pattern1);
+        write_word(p + 4,  pattern2);
+        write_word(p + 5,  pattern2);
+        write_word(p + 6,  pattern1);
+        write_word(p + 7,  pattern1);
+        write_word(p + 8,  pattern1);
+        write_word(p + 9,  pattern1);
+        write_word(p + 10, pattern2);
+        write_word(p + 11, pattern2);
+        write_word(p + 12, pattern1);
+        write_word(p + 13, pattern1);
+        write_word(p + 14, pattern2);
+        write_word(p + 15, pattern2);
+        pattern1 = pattern1 << 1 | pattern1 >> (TESTWORD_WIDTH - 1);  // rotate left
+        i += BLOCK_WORDS;
+    }
+    for (unsigned j = 0; i < n; i++, j++) {
+        write_word(&start[i], (BLOCK_INVERTED_WORDS >> j) & 1 ? ~pattern1 : pattern1);
+    }
+}
+
+static void scalar_copy_words(testword_t *dst, const testword_t *src, uintptr_t count)
+{
+#ifdef __x86_64__
+    __asm__ __volatile__ (
+        "cld\n\t"
+        "rep\n\t"
+        "movsq\n\t"
+        : "+D" (dst), "+S" (src), "+c" (count)
+        :
+        : "memory"
+    );
+#else
+    __asm__ __volatile__ (
+        "cld\n\t"
+        "rep\n\t"
+        "movsl\n\t"
+        : "+D" (dst), "+S" (src), "+c" (count)
+        :
+        : "memory"
+    );
+#endif
+}
+
+static void scalar_pair_check(testword_t *start, testword_t *end)
+{
+    uintptr_t n = end - start + 1;
+
+    for (uintptr_t i = 0; n - i >= 2; i += 2) {
+        testword_t p0 = read_word(&start[i + 0]);
+        testword_t p1 = read_word(&start[i + 1]);
+        if (unlikely(p0 != p1)) {
+            data_error(&start[i], p0, p1, false);
+        }
+    }
+}
+
+static void scalar_strided_fill(testword_t *start, testword_t *end, uintptr_t stride, testword_t pattern)
+{
+    testword_t *p = start;
+    do {
+        write_word(p, pattern);
+    } while ((uintptr_t)(end - p) >= stride && (p += stride)); // test before increment in case pointer overflows
+}
+
+static void scalar_strided_check(testword_t *start, testword_t *end, uintptr_t stride, testword_t pattern)
+{
+    testword_t *p = start;
+    do {
+        testword_t actual = read_word(p);
+        if (unlikely(actual != pattern)) {
+            data_error(p, pattern, actual, true);
+        }
+    } while ((uintptr_t)(end - p) >= stride && (p += stride)); // test before increment in case pointer overflows
+}
+
+static void scalar_pattern_check(testword_t *start, testword_t *end, testword_t pattern)
+{
+    uintptr_t n = end - start + 1;
+    uintptr_t i = 0;
+
+    while (i < n) {
+        uintptr_t count = (n - i < CHECK_BLOCK_WORDS) ? n - i : CHECK_BLOCK_WORDS;
+        testword_t diff = 0;
+        for (uintptr_t j = 0; j < count; j++) {
+            diff |= read_word(&start[i + j]) ^ pattern;
+        }
+        if (unlikely(diff != 0)) {
+            report_pattern_errors(&start[i], count, pattern, diff);
+        }
+        i += count;
+    }
+}
+
+static void scalar_addr_fill(testword_t *start, testword_t *end, testword_t offset)
+{
+    testword_t *p = start;
+    do {
+        write_word(p, (testword_t)p + offset);
+    } while (p++ < end); // test before increment in case pointer overflows
+}
+
+static void scalar_addr_check(testword_t *start, testword_t *end, testword_t offset)
+{
+    testword_t *p = start;
+    do {
+        testword_t expect = (testword_t)p + offset;
+        testword_t actual = read_word(p);
+        if (unlikely(actual != expect)) {
+            data_error(p, expect, actual, true);
+        }
+    } while (p++ < end); // test before increment in case pointer overflows
+}
+
+//------------------------------------------------------------------------------
+// Public Variables
+//------------------------------------------------------------------------------
+
+const test_kernel_t scalar_kernel = {
+    .name               = "scalar",
+    .check_write_up     = scalar_check_write_up,
+    .check_write_down   = scalar_check_write_down,
+    .walk_check_up      = scalar_walk_check_up,
+    .walk_check_down    = scalar_walk_check_down,
+    .wide_walk_fill     = scalar_wide_walk_fill,
+    .wide_walk_check_up = scalar_wide_walk_check_up,
+    .wide_walk_check_down = scalar_wide_walk_check_down,
+    .fill_nt            = scalar_fill,  // streaming stores need SSE2
+    .random_fill        = scalar_random_fill,
+    .random_check_write = scalar_random_check_write,
+    .block_fill         = scalar_block_fill,
+    .copy_words         = scalar_copy_words,
+    .pair_check         = scalar_pair_check,
+    .strided_fill       = scalar_strided_fill,
+    .strided_check      = scalar_strided_check,
+    .pattern_check      = scalar_pattern_check,
+    .addr_fill          = scalar_addr_fill,
+    .addr_check         = scalar_addr_check
+};
+
+const test_kernel_t *test_kernel = &scalar_kernel;
+
+//------------------------------------------------------------------------------
+// Public Functions
+//------------------------------------------------------------------------------
+
+void test_kernels_init(void)
+{
+    simd_level_t level = simd_level;
+    if (forced_kernel >= 0 && forced_kernel < (int)level) {
+        level = (simd_level_t)forced_kernel;
+    }
+    switch (level) {
+      case SIMD_AVX512:
+        test_kernel = &avx512_kernel;
+        break;
+      case SIMD_AVX2:
+        test_kernel = &avx2_kernel;
+        break;
+      case SIMD_SSE2:
+        test_kernel = &sse2_kernel;
+        break;
+      default:
+        test_kernel = &scalar_kernel;
+        enable_nt_fill = false;
+        break;
+    }
+    trace(0, "using %s test kernels%s", test_kernel->name, enable_nt_fill ? " with streaming fill" : "");
+}
+
+void fill_words(testword_t *start, testword_t *end, testword_t pattern)
+{
+    if (enable_nt_fill) {
+        test_kernel->fill_nt(start, end, pattern);
+    } else {
+        scalar_fill(start, end, pattern);
+    }
+}
+
+void move_words(testword_t *dst, const testword_t *src, uintptr_t count)
+{
+    uintptr_t num_bytes = count * sizeof(testword_t);
+    if (cpuid_info.flags.erms && num_bytes >= ERMS_MIN_BYTES) {
+        __asm__ __volatile__ (
+            "cld\n\t"
+            "rep\n\t"
+            "movsb\n\t"
+            : "+D" (dst), "+S" (src), "+c" (num_bytes)
+            :
+            : "memory"
+        );
+    } else {
+        test_kernel->copy_words(dst, src, count);
+    }
+}
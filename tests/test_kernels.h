@@ -0,0 +1,199 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef TEST_KERNELS_H
+#define TEST_KERNELS_H
+/**
+ * \file
+ *
+ * Provides the inner loops of the moving inversions tests. A scalar version
+ * is always available. Versions that use the SSE2, AVX2, or AVX-512 vector
+ * instructions are compiled separately and are selected at run time when
+ * the CPU supports them.
+ *
+ * All kernels operate on the inclusive address range [start, end], so the
+ * callers can pass the same block limits they use when avoiding pointer
+ * overflow.
+ *
+ *//*
+ * Copyright (C) 2024 Memtest86+ contributors.
+ */
+
+#include <stdbool.h>
+
+#include "test.h"
+
+/**
+ * The size of the blocks written by block_fill, in words.
+ */
+#define BLOCK_WORDS             16
+
+/**
+ * The words of each block that block_fill writes with the complement of the
+ * block pattern, as a bit mask.
+ */
+#define BLOCK_INVERTED_WORDS    0xcc30
+
+/**
+ * A test kernel method table.
+ */
+typedef struct {
+    const char  *name;
+
+    /**
+     * Checks that each word in the range contains 'expect' and then writes
+     * 'replace' to it, from the lowest address to the highest address.
+     */
+    void        (*check_write_up)   (testword_t *start, testword_t *end, testword_t expect, testword_t replace);
+
+    /**
+     * As check_write_up, but from the highest address to the lowest address.
+     */
+    void        (*check_write_down) (testword_t *start, testword_t *end, testword_t expect, testword_t replace);
+
+    /**
+     * Checks that each word in the range contains 'pattern', rotated left one
+     * bit for each successive word, and then writes its complement to it, from
+     * the lowest address to the highest address. Returns the pattern expected
+     * for the word following the range.
+     */
+    testword_t  (*walk_check_up)    (testword_t *start, testword_t *end, testword_t pattern);
+
+    /**
+     * Checks that each word in the range contains 'pattern' rotated right one
+     * bit for each successive word, starting with the highest address, and
+     * then writes its complement to it. 'pattern' is the value expected for the
+     * word following the range. Returns the value expected at 'start'.
+     */
+    testword_t  (*walk_check_down)  (testword_t *start, testword_t *end, testword_t pattern);
+
+    /**
+     * Writes each word in the range with its value in the wide walking ones
+     * pattern given by wide_walk_word() for 'width' and 'offset', XORed with
+     * 'invert'.
+     */
+    void        (*wide_walk_fill)   (testword_t *start, testword_t *end, unsigned width, unsigned offset, testword_t invert);
+
+    /**
+     * Checks that each word in the range contains the value written by
+     * wide_walk_fill for the same arguments, and then writes its complement
+     * to it, from the lowest address to the highest address.
+     */
+    void        (*wide_walk_check_up)   (testword_t *start, testword_t *end, unsigned width, unsigned offset, testword_t invert);
+
+    /**
+     * As wide_walk_check_up, but from the highest address to the lowest
+     * address.
+     */
+    void        (*wide_walk_check_down) (testword_t *start, testword_t *end, unsigned width, unsigned offset, testword_t invert);
+
+    /**
+     * Writes 'pattern' to each word in the range using non-temporal stores,
+     * bypassing the caches, followed by a store fence.
+     */
+    void        (*fill_nt)          (testword_t *start, testword_t *end, testword_t pattern);
+
+    /**
+     * Writes the multi-lane pseudo-random sequence for 'seed' to each word in
+     * the range, from the lowest address to the highest address. Each lane
+     * starts from prsg_lane_seed(seed, lane) and is advanced by prsg() for
+     * each word it supplies. If 'nt' is true, may use non-temporal stores
+     * followed by a store fence.
+     */
+    void        (*random_fill)      (testword_t *start, testword_t *end, testword_t seed, bool nt);
+
+    /**
+     * Checks that each word in the range contains the value written by
+     * random_fill for 'seed' XORed with 'invert', and then writes its
+     * complement to it, from the lowest address to the highest address.
+     */
+    void        (*random_check_write) (testword_t *start, testword_t *end, testword_t seed, testword_t invert);
+
+    /**
+     * Fills the range with successive blocks of BLOCK_WORDS words. Each word
+     * of a block contains the block pattern, or its complement if selected by
+     * BLOCK_INVERTED_WORDS. The first block pattern is 1, and the pattern is
+     * rotated left one bit for each successive block.
+     */
+    void        (*block_fill)       (testword_t *start, testword_t *end);
+
+    /**
+     * Copies 'count' words from 'src' to 'dst'. The source and destination
+     * must not overlap.
+     */
+    void        (*copy_words)       (testword_t *dst, const testword_t *src, uintptr_t count);
+
+    /**
+     * Checks that the two words of each aligned pair in the range are equal.
+     * Any odd word at the end of the range is not checked.
+     */
+    void        (*pair_check)       (testword_t *start, testword_t *end);
+
+    /**
+     * Writes 'pattern' to the word at 'start' and to every 'stride'th word
+     * after it, up to and including 'end'. The SIMD kernels prefetch the
+     * words a page ahead, so the sweep isn't limited by memory latency.
+     */
+    void        (*strided_fill)     (testword_t *start, testword_t *end, uintptr_t stride, testword_t pattern);
+
+    /**
+     * Checks that the word at 'start' and every 'stride'th word after it, up
+     * to and including 'end', contain 'pattern'.
+     */
+    void        (*strided_check)    (testword_t *start, testword_t *end, uintptr_t stride, testword_t pattern);
+
+    /**
+     * Checks that each word in the range contains 'pattern'. The differences
+     * are ORed together over blocks of up to CHECK_BLOCK_WORDS words, and only
+     * a block with a non-zero result is rescanned by report_pattern_errors().
+     */
+    void        (*pattern_check)    (testword_t *start, testword_t *end, testword_t pattern);
+
+    /**
+     * Writes each word in the range with its own virtual address plus
+     * 'offset'.
+     */
+    void        (*addr_fill)        (testword_t *start, testword_t *end, testword_t offset);
+
+    /**
+     * Checks that each word in the range contains its own virtual address plus
+     * 'offset'.
+     */
+    void        (*addr_check)       (testword_t *start, testword_t *end, testword_t offset);
+} test_kernel_t;
+
+/**
+ * The test kernels selected by test_kernels_init().
+ */
+extern const test_kernel_t *test_kernel;
+
+/**
+ * The available test kernels. The SIMD kernels must only be used when the
+ * corresponding level has been enabled by simd_init().
+ */
+extern const test_kernel_t scalar_kernel;
+extern const test_kernel_t sse2_kernel;
+extern const test_kernel_t avx2_kernel;
+extern const test_kernel_t avx512_kernel;
+
+/**
+ * Selects the fastest test kernels supported by the CPU, or the ones given by
+ * the kernel boot option if the CPU supports them. Must be called after
+ * simd_init() and config_init().
+ */
+void test_kernels_init(void);
+
+/**
+ * Writes 'pattern' to each word in the range [start, end]. Uses non-temporal
+ * stores if enabled by the "ntfill" boot option, otherwise uses normal cached
+ * stores.
+ */
+void fill_words(testword_t *start, testword_t *end, testword_t pattern);
+
+/**
+ * Copies 'count' words from 'src' to 'dst'. The source and destination must
+ * not overlap. Uses the ERMS "rep movsb" instruction if the CPU supports it
+ * and the copy is large enough to benefit, otherwise uses the selected test
+ * kernel.
+ */
+void move_words(testword_t *dst, const testword_t *src, uintptr_t count);
+
+#endif // TEST_KERNELS_H
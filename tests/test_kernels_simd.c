@@ -0,0 +1,919 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Memtest86+ contributors.
+//
+// This file is compiled once for each supported SIMD level, with the compiler
+// flags that enable the corresponding instruction set extensions. The build
+// defines SIMD_NAME (the prefix of the exported kernel table) and SIMD_BYTES
+// (the vector register width in bytes).
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "error.h"
+#include "test.h"
+
+#include "test_helper.h"
+#include "test_kernels.h"
+
+#if !defined(SIMD_NAME) || !defined(SIMD_BYTES)
+#error "SIMD_NAME and SIMD_BYTES must be defined when compiling this file"
+#endif
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+#define LANES       (SIMD_BYTES / sizeof(testword_t))
+
+#define UNROLL      4       // the number of vectors processed in each step
+
+#define STEP        (UNROLL * LANES)
+
+#define ALIGN_MASK  (SIMD_BYTES - 1)
+
+#define PRSG_VECTORS    (PRSG_LANES / LANES)    // the vectors in each block of random words
+
+#define BLOCK_VECTORS   (BLOCK_WORDS / LANES)   // the vectors in each block move fill block
+
+#define PREFETCH_WORDS  (4096 / sizeof(testword_t)) // how far ahead the strided and descending kernels prefetch
+
+#define LINE_WORDS      (64 / sizeof(testword_t))   // the words in each cache line
+
+#define CHECK_STREAMS   4       // the blocks read in parallel by pattern_check
+
+#define WORD_SHIFT  ((TESTWORD_WIDTH == 64) ? 6 : 5)    // log2(TESTWORD_WIDTH)
+
+#if SIMD_BYTES == 16
+#define NT_STORE    "movntdq"
+#else
+#define NT_STORE    "vmovntdq"
+#endif
+
+#define CONCAT_(a, b)   a ## b
+#define CONCAT(a, b)    CONCAT_(a, b)
+#define STRING_(a)      #a
+#define STRING(a)       STRING_(a)
+
+//------------------------------------------------------------------------------
+// Types
+//------------------------------------------------------------------------------
+
+typedef testword_t vword_t __attribute__((vector_size(SIMD_BYTES), may_alias));
+
+typedef testword_t vword_u_t __attribute__((vector_size(SIMD_BYTES), aligned(sizeof(testword_t)), may_alias));
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static inline testword_t rotl(testword_t value, unsigned count)
+{
+    count %= TESTWORD_WIDTH;
+    return count ? value << count | value >> (TESTWORD_WIDTH - count) : value;
+}
+
+static inline testword_t rotr(testword_t value, unsigned count)
+{
+    count %= TESTWORD_WIDTH;
+    return count ? value >> count | value << (TESTWORD_WIDTH - count) : value;
+}
+
+static inline vword_t vrotl(vword_t value, unsigned count)
+{
+    count %= TESTWORD_WIDTH;
+    if (count == 0) {
+        return value;
+    }
+    return value << count | value >> (TESTWORD_WIDTH - count);
+}
+
+static inline vword_t vrotr(vword_t value, unsigned count)
+{
+    count %= TESTWORD_WIDTH;
+    if (count == 0) {
+        return value;
+    }
+    return value >> count | value << (TESTWORD_WIDTH - count);
+}
+
+static inline vword_t vbroadcast(testword_t value)
+{
+    vword_t zero = { 0 };
+    return zero + value;
+}
+
+static inline testword_t vfold(vword_t value)
+{
+    testword_t result = 0;
+    for (unsigned k = 0; k < LANES; k++) {
+        result |= value[k];
+    }
+    return result;
+}
+
+static inline bool vnonzero(vword_t value)
+{
+    return vfold(value) != 0;
+}
+
+static inline vword_t vread(const testword_t *p)
+{
+    return *(const volatile vword_t *)p;
+}
+
+static inline vword_t vread_unaligned(const testword_t *p)
+{
+    return *(const volatile vword_u_t *)p;
+}
+
+static inline void vwrite(testword_t *p, vword_t value)
+{
+    *(volatile vword_t *)p = value;
+}
+
+static inline void vwrite_nt(testword_t *p, vword_t value)
+{
+    __asm__ __volatile__ (NT_STORE " %1, %0" : "=m" (*(vword_t *)p) : "x" (value) : "memory");
+}
+
+// Advances all the lanes of a pseudo-random sequence, as prsg() does for one.
+static inline vword_t vprsg(vword_t state)
+{
+#if (ARCH_BITS == 64)
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+#else
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+#endif
+    return state;
+}
+
+// Returns the wide walking ones pattern for the vector at p, as wide_walk_word()
+// does for one word.
+static inline vword_t vwide_walk(const testword_t *p, unsigned width, unsigned offset)
+{
+    vword_t word = vbroadcast((uintptr_t)p / sizeof(testword_t));
+    for (unsigned k = 0; k < LANES; k++) {
+        word[k] += k;
+    }
+    unsigned words_shift = __builtin_ctz(width) - WORD_SHIFT;
+    vword_t bit = (vbroadcast(offset) + (word >> words_shift)) & vbroadcast(width - 1);
+    vword_t hit = (vword_t)((word & vbroadcast((1u << words_shift) - 1)) == (bit >> WORD_SHIFT));
+    return hit & (vbroadcast(1) << (bit & vbroadcast(TESTWORD_WIDTH - 1)));
+}
+
+static inline void check_word(testword_t *p, testword_t expect, testword_t replace)
+{
+    testword_t actual = read_word(p);
+    if (unlikely(actual != expect)) {
+        data_error(p, expect, actual, true);
+    }
+    write_word(p, replace);
+}
+
+// The hardware prefetchers follow descending streams less well than
+// ascending ones, so the descending kernels prefetch each step a page below
+// the one they are on. The order in which the words are checked and written
+// is unchanged.
+static inline void prefetch_below(testword_t *start, uintptr_t i)
+{
+    if (i >= PREFETCH_WORDS) {
+        for (unsigned j = 0; j < STEP; j += LINE_WORDS) {
+            __builtin_prefetch(&start[i - PREFETCH_WORDS + j], 1, 3);
+        }
+    }
+}
+
+static void __attribute__((noinline)) report_errors(testword_t *p, const vword_t actual[], const vword_t expect[],
+                                                    unsigned num_vectors)
+{
+    for (unsigned q = 0; q < num_vectors; q++) {
+        for (unsigned k = 0; k < LANES; k++) {
+            if (actual[q][k] != expect[q][k]) {
+                data_error(p + q * LANES + k, expect[q][k], actual[q][k], true);
+            }
+        }
+    }
+}
+
+static void check_write_up(testword_t *start, testword_t *end, testword_t expect, testword_t replace)
+{
+    uintptr_t n = end - start + 1;
+    uintptr_t i = 0;
+
+    while (i < n && ((uintptr_t)&start[i] & ALIGN_MASK)) {
+        check_word(&start[i], expect, replace);
+        i++;
+    }
+
+    vword_t vexpect[UNROLL], vreplace = vbroadcast(replace);
+    for (unsigned q = 0; q < UNROLL; q++) {
+        vexpect[q] = vbroadcast(expect);
+    }
+    while (n - i >= STEP) {
+        testword_t *p = &start[i];
+        vword_t actual[UNROLL], diff = { 0 };
+        for (unsigned q = 0; q < UNROLL; q++) {
+            actual[q] = vread(p + q * LANES);
+            vwrite(p + q * LANES, vreplace);
+            diff |= actual[q] ^ vexpect[q];
+        }
+        if (unlikely(vnonzero(diff))) {
+            report_errors(p, actual, vexpect, UNROLL);
+        }
+        i += STEP;
+    }
+
+    while (i < n) {
+        check_word(&start[i], expect, replace);
+        i++;
+    }
+}
+
+static void check_write_down(testword_t *start, testword_t *end, testword_t expect, testword_t replace)
+{
+    uintptr_t i = end - start + 1;
+
+    while (i > 0 && ((uintptr_t)&start[i] & ALIGN_MASK)) {
+        i--;
+        check_word(&start[i], expect, replace);
+    }
+
+    vword_t vexpect[UNROLL], vreplace = vbroadcast(replace);
+    for (unsigned q = 0; q < UNROLL; q++) {
+        vexpect[q] = vbroadcast(expect);
+    }
+    while (i >= STEP) {
+        i -= STEP;
+        prefetch_below(start, i);
+        testword_t *p = &start[i];
+        vword_t actual[UNROLL], diff = { 0 };
+        for (int q = UNROLL - 1; q >= 0; q--) {
+            actual[q] = vread(p + q * LANES);
+            vwrite(p + q * LANES, vreplace);
+            diff |= actual[q] ^ vexpect[q];
+        }
+        if (unlikely(vnonzero(diff))) {
+            report_errors(p, actual, vexpect, UNROLL);
+        }
+    }
+
+    while (i > 0) {
+        i--;
+        check_word(&start[i], expect, replace);
+    }
+}
+
+static testword_t walk_check_up(testword_t *start, testword_t *end, testword_t pattern)
+{
+    uintptr_t n = end - start + 1;
+    uintptr_t i = 0;
+
+    while (i < n && ((uintptr_t)&start[i] & ALIGN_MASK)) {
+        check_word(&start[i], pattern, ~pattern);
+        pattern = rotl(pattern, 1);
+        i++;
+    }
+
+    if (n - i >= STEP) {
+        // Lane k of vector q expects the pattern rotated left by q * LANES + k.
+        vword_t vexpect[UNROLL];
+        for (unsigned k = 0; k < LANES; k++) {
+            vexpect[0][k] = rotl(pattern, k);
+        }
+        for (unsigned q = 1; q < UNROLL; q++) {
+            vexpect[q] = vrotl(vexpect[0], q * LANES);
+        }
+        do {
+            testword_t *p = &start[i];
+            vword_t actual[UNROLL], diff = { 0 };
+            for (unsigned q = 0; q < UNROLL; q++) {
+                actual[q] = vread(p + q * LANES);
+                vwrite(p + q * LANES, ~vexpect[q]);
+                diff |= actual[q] ^ vexpect[q];
+            }
+            if (unlikely(vnonzero(diff))) {
+                report_errors(p, actual, vexpect, UNROLL);
+            }
+            for (unsigned q = 0; q < UNROLL; q++) {
+                vexpect[q] = vrotl(vexpect[q], STEP);
+            }
+            i += STEP;
+        } while (n - i >= STEP);
+        pattern = vexpect[0][0];
+    }
+
+    while (i < n) {
+        check_word(&start[i], pattern, ~pattern);
+        pattern = rotl(pattern, 1);
+        i++;
+    }
+
+    return pattern;
+}
+
+static testword_t walk_check_down(testword_t *start, testword_t *end, testword_t pattern)
+{
+    uintptr_t i = end - start + 1;
+
+    while (i > 0 && ((uintptr_t)&start[i] & ALIGN_MASK)) {
+        i--;
+        pattern = rotr(pattern, 1);
+        check_word(&start[i], pattern, ~pattern);
+    }
+
+    if (i >= STEP) {
+        // Lane k of vector q expects the pattern rotated right by (UNROLL - q) * LANES - k.
+        vword_t vexpect[UNROLL];
+        for (unsigned k = 0; k < LANES; k++) {
+            vexpect[UNROLL - 1][k] = rotr(pattern, LANES - k);
+        }
+        for (unsigned q = 0; q < UNROLL - 1; q++) {
+            vexpect[q] = vrotr(vexpect[UNROLL - 1], (UNROLL - 1 - q) * LANES);
+        }
+        do {
+            i -= STEP;
+            prefetch_below(start, i);
+            testword_t *p = &start[i];
+            vword_t actual[UNROLL], diff = { 0 };
+            for (int q = UNROLL - 1; q >= 0; q--) {
+                actual[q] = vread(p + q * LANES);
+                vwrite(p + q * LANES, ~vexpect[q]);
+                diff |= actual[q] ^ vexpect[q];
+            }
+            if (unlikely(vnonzero(diff))) {
+                report_errors(p, actual, vexpect, UNROLL);
+            }
+            for (unsigned q = 0; q < UNROLL; q++) {
+                vexpect[q] = vrotr(vexpect[q], STEP);
+            }
+        } while (i >= STEP);
+        pattern = vrotl(vexpect[0], STEP)[0];
+    }
+
+    while (i > 0) {
+        i--;
+        pattern = rotr(pattern, 1);
+        check_word(&start[i], pattern, ~pattern);
+    }
+
+    return pattern;
+}
+
+static void wide_walk_fill(testword_t *start, testword_t *end, unsigned width, unsigned offset, testword_t invert)
+{
+    uintptr_t n = end - start + 1;
+    uintptr_t i = 0;
+
+    while (i < n && ((uintptr_t)&start[i] & ALIGN_MASK)) {
+        write_word(&start[i], wide_walk_word(&start[i], width, offset) ^ invert);
+        i++;
+    }
+
+    vword_t vinvert = vbroadcast(invert);
+    while (n - i >= LANES) {
+        vwrite(&start[i], vwide_walk(&start[i], width, offset) ^ vinvert);
+        i += LANES;
+    }
+
+    while (i < n) {
+        write_word(&start[i], wide_walk_word(&start[i], width, offset) ^ invert);
+        i++;
+    }
+}
+
+static void wide_walk_check_up(testword_t *start, testword_t *end, unsigned width, unsigned offset, testword_t invert)
+{
+    uintptr_t n = end - start + 1;
+    uintptr_t i = 0;
+
+    while (i < n && ((uintptr_t)&start[i] & ALIGN_MASK)) {
+        testword_t expect = wide_walk_word(&start[i], width, offset) ^ invert;
+        check_word(&start[i], expect, ~expect);
+        i++;
+    }
+
+    vword_t vinvert = vbroadcast(invert);
+    while (n - i >= STEP) {
+        testword_t *p = &start[i];
+        vword_t actual[UNROLL], vexpect[UNROLL], diff = { 0 };
+        for (unsigned q = 0; q < UNROLL; q++) {
+            vexpect[q] = vwide_walk(p + q * LANES, width, offset) ^ vinvert;
+            actual[q]  = vread(p + q * LANES);
+            vwrite(p + q * LANES, ~vexpect[q]);
+            diff |= actual[q] ^ vexpect[q];
+        }
+        if (unlikely(vnonzero(diff))) {
+            report_errors(p, actual, vexpect, UNROLL);
+        }
+        i += STEP;
+    }
+
+    while (i < n) {
+        testword_t expect = wide_walk_word(&start[i], width, offset) ^ invert;
+        check_word(&start[i], expect, ~expect);
+        i++;
+    }
+}
+
+static void wide_walk_check_down(testword_t *start, testword_t *end, unsigned width, unsigned offset, testword_t invert)
+{
+    uintptr_t i = end - start + 1;
+
+    while (i > 0 && ((uintptr_t)&start[i] & ALIGN_MASK)) {
+        i--;
+        testword_t expect = wide_walk_word(&start[i], width, offset) ^ invert;
+        check_word(&start[i], expect, ~expect);
+    }
+
+    vword_t vinvert = vbroadcast(invert);
+    while (i >= STEP) {
+        i -= STEP;
+        prefetch_below(start, i);
+        testword_t *p = &start[i];
+        vword_t actual[UNROLL], vexpect[UNROLL], diff = { 0 };
+        for (int q = UNROLL - 1; q >= 0; q--) {
+            vexpect[q] = vwide_walk(p + q * LANES, width, offset) ^ vinvert;
+            actual[q]  = vread(p + q * LANES);
+            vwrite(p + q * LANES, ~vexpect[q]);
+            diff |= actual[q] ^ vexpect[q];
+        }
+        if (unlikely(vnonzero(diff))) {
+            report_errors(p, actual, vexpect, UNROLL);
+        }
+    }
+
+    while (i > 0) {
+        i--;
+        testword_t expect = wide_walk_word(&start[i], width, offset) ^ invert;
+        check_word(&start[i], expect, ~expect);
+    }
+}
+
+static void fill_nt(testword_t *start, testword_t *end, testword_t pattern)
+{
+    uintptr_t n = end - start + 1;
+    uintptr_t i = 0;
+
+    while (i < n && ((uintptr_t)&start[i] & ALIGN_MASK)) {
+        write_word_nt(&start[i], pattern);
+        i++;
+    }
+
+    vword_t vpattern = vbroadcast(pattern);
+    while (n - i >= STEP) {
+        testword_t *p = &start[i];
+        for (unsigned q = 0; q < UNROLL; q++) {
+            vwrite_nt(p + q * LANES, vpattern);
+        }
+        i += STEP;
+    }
+
+    while (i < n) {
+        write_word_nt(&start[i], pattern);
+        i++;
+    }
+
+    store_fence();
+}
+
+static void random_fill(testword_t *start, testword_t *end, testword_t seed, bool nt)
+{
+    testword_t state[PRSG_LANES];
+    for (unsigned lane = 0; lane < PRSG_LANES; lane++) {
+        state[lane] = prsg_lane_seed(seed, lane);
+    }
+
+    uintptr_t n = end - start + 1;
+    uintptr_t i = 0;
+
+    // Words are handled one at a time until the start of a block of lanes,
+    // which is always aligned to the vector size.
+    while (i < n && prsg_lane(&start[i]) != 0) {
+        unsigned lane = prsg_lane(&start[i]);
+        state[lane] = prsg(state[lane]);
+        if (nt) {
+            write_word_nt(&start[i], state[lane]);
+        } else {
+            write_word(&start[i], state[lane]);
+        }
+        i++;
+    }
+
+    if (n - i >= PRSG_LANES) {
+        vword_t vstate[PRSG_VECTORS];
+        for (unsigned q = 0; q < PRSG_VECTORS; q++) {
+            for (unsigned k = 0; k < LANES; k++) {
+                vstate[q][k] = state[q * LANES + k];
+            }
+        }
+        do {
+            testword_t *p = &start[i];
+            for (unsigned q = 0; q < PRSG_VECTORS; q++) {
+                vstate[q] = vprsg(vstate[q]);
+                if (nt) {
+                    vwrite_nt(p + q * LANES, vstate[q]);
+                } else {
+                    vwrite(p + q * LANES, vstate[q]);
+                }
+            }
+            i += PRSG_LANES;
+        } while (n - i >= PRSG_LANES);
+        for (unsigned q = 0; q < PRSG_VECTORS; q++) {
+            for (unsigned k = 0; k < LANES; k++) {
+                state[q * LANES + k] = vstate[q][k];
+            }
+        }
+    }
+
+    while (i < n) {
+        unsigned lane = prsg_lane(&start[i]);
+        state[lane] = prsg(state[lane]);
+        if (nt) {
+            write_word_nt(&start[i], state[lane]);
+        } else {
+            write_word(&start[i], state[lane]);
+        }
+        i++;
+    }
+
+    if (nt) {
+        store_fence();
+    }
+}
+
+static void random_check_write(testword_t *start, testword_t *end, testword_t seed, testword_t invert)
+{
+    testword_t state[PRSG_LANES];
+    for (unsigned lane = 0; lane < PRSG_LANES; lane++) {
+        state[lane] = prsg_lane_seed(seed, lane);
+    }
+
+    uintptr_t n = end - start + 1;
+    uintptr_t i = 0;
+
+    while (i < n && prsg_lane(&start[i]) != 0) {
+        unsigned lane = prsg_lane(&start[i]);
+        state[lane] = prsg(state[lane]);
+        check_word(&start[i], state[lane] ^ invert, ~(state[lane] ^ invert));
+        i++;
+    }
+
+    if (n - i >= PRSG_LANES) {
+        vword_t vstate[PRSG_VECTORS], vinvert = vbroadcast(invert);
+        for (unsigned q = 0; q < PRSG_VECTORS; q++) {
+            for (unsigned k = 0; k < LANES; k++) {
+                vstate[q][k] = state[q * LANES + k];
+            }
+        }
+        do {
+            testword_t *p = &start[i];
+            vword_t actual[PRSG_VECTORS], expect[PRSG_VECTORS], diff = { 0 };
+            for (unsigned q = 0; q < PRSG_VECTORS; q++) {
+                vstate[q] = vprsg(vstate[q]);
+                expect[q] = vstate[q] ^ vinvert;
+                actual[q] = vread(p + q * LANES);
+                vwrite(p + q * LANES, ~expect[q]);
+                diff |= actual[q] ^ expect[q];
+            }
+            if (unlikely(vnonzero(diff))) {
+                report_errors(p, actual, expect, PRSG_VECTORS);
+            }
+            i += PRSG_LANES;
+        } while (n - i >= PRSG_LANES);
+        for (unsigned q = 0; q < PRSG_VECTORS; q++) {
+            for (unsigned k = 0; k < LANES; k++) {
+                state[q * LANES + k] = vstate[q][k];
+            }
+        }
+    }
+
+    while (i < n) {
+        unsigned lane = prsg_lane(&start[i]);
+        state[lane] = prsg(state[lane]);
+        check_word(&start[i], state[lane] ^ invert, ~(state[lane] ^ invert));
+        i++;
+    }
+}
+
+static void block_fill(testword_t *start, testword_t *end)
+{
+    uintptr_t n = end - start + 1;
+    uintptr_t i = 0;
+
+    testword_t pattern = 1;
+    if (((uintptr_t)start & ALIGN_MASK) == 0) {
+        vword_t vinvert[BLOCK_VECTORS];
+        for (unsigned q = 0; q < BLOCK_VECTORS; q++) {
+            for (unsigned k = 0; k < LANES; k++) {
+                vinvert[q][k] = (BLOCK_INVERTED_WORDS >> (q * LANES + k)) & 1 ? ~(testword_t)0 : 0;
+            }
+        }
+        while (n - i >= BLOCK_WORDS) {
+            testword_t *p = &start[i];
+            vword_t vpattern = vbroadcast(pattern);
+            for (unsigned q = 0; q < BLOCK_VECTORS; q++) {
+                vwrite(p + q * LANES, vpattern ^ vinvert[q]);
+            }
+            pattern = rotl(pattern, 1);
+            i += BLOCK_WORDS;
+        }
+    }
+
+    for (unsigned j = i % BLOCK_WORDS; i < n; i++) {
+        write_word(&start[i], (BLOCK_INVERTED_WORDS >> j) & 1 ? ~pattern : pattern);
+        if (++j == BLOCK_WORDS) {
+            pattern = rotl(pattern, 1);
+            j = 0;
+        }
+    }
+}
+
+static void copy_words(testword_t *dst, const testword_t *src, uintptr_t count)
+{
+    uintptr_t i = 0;
+
+    while (i < count && ((uintptr_t)&dst[i] & ALIGN_MASK)) {
+        write_word(&dst[i], read_word((testword_t *)&src[i]));
+        i++;
+    }
+
+    while (count - i >= STEP) {
+        vword_t value[UNROLL];
+        for (unsigned q = 0; q < UNROLL; q++) {
+            value[q] = vread_unaligned(&src[i + q * LANES]);
+        }
+        for (unsigned q = 0; q < UNROLL; q++) {
+            vwrite(&dst[i + q * LANES], value[q]);
+        }
+        i += STEP;
+    }
+
+    while (i < count) {
+        write_word(&dst[i], read_word((testword_t *)&src[i]));
+        i++;
+    }
+}
+
+static inline void check_pair(testword_t *p)
+{
+    testword_t p0 = read_word(p + 0);
+    testword_t p1 = read_word(p + 1);
+    if (unlikely(p0 != p1)) {
+        data_error(p, p0, p1, false);
+    }
+}
+
+static void pair_check(testword_t *start, testword_t *end)
+{
+    uintptr_t n = (end - start + 1) & ~(uintptr_t)1;
+    uintptr_t i = 0;
+
+    while (i < n && ((uintptr_t)&start[i] & ALIGN_MASK)) {
+        check_pair(&start[i]);
+        i += 2;
+    }
+
+    // Each even lane is compared with the following word, which is loaded
+    // by an unaligned read one word further on. The odd lanes are ignored.
+    // The last unaligned read needs the word after each step to be in range.
+    vword_t veven;
+    for (unsigned k = 0; k < LANES; k++) {
+        veven[k] = (k & 1) ? 0 : ~(testword_t)0;
+    }
+    while (n - i > STEP) {
+        testword_t *p = &start[i];
+        vword_t diff = { 0 };
+        for (unsigned q = 0; q < UNROLL; q++) {
+            diff |= (vread(p + q * LANES) ^ vread_unaligned(p + q * LANES + 1)) & veven;
+        }
+        if (unlikely(vnonzero(diff))) {
+            for (unsigned j = 0; j < STEP; j += 2) {
+                check_pair(p + j);
+            }
+        }
+        i += STEP;
+    }
+
+    while (i < n) {
+        check_pair(&start[i]);
+        i += 2;
+    }
+}
+
+// The strided kernels touch one word in every few cache lines, which the
+// hardware prefetchers don't follow well, so they prefetch the word a page
+// ahead of each word they access. The AVX-512 kernels are built with PREFETCHW
+// enabled, so use it for the writes. The others use a normal prefetch.
+
+static void strided_fill(testword_t *start, testword_t *end, uintptr_t stride, testword_t pattern)
+{
+    uintptr_t count = (end - start) / stride + 1;
+    uintptr_t ahead = PREFETCH_WORDS / stride + 1;
+
+    for (uintptr_t i = 0; i < count; i++) {
+        if (i + ahead < count) {
+            __builtin_prefetch(start + (i + ahead) * stride, 1, 3);
+        }
+        write_word(start + i * stride, pattern);
+    }
+}
+
+static void strided_check(testword_t *start, testword_t *end, uintptr_t stride, testword_t pattern)
+{
+    uintptr_t count = (end - start) / stride + 1;
+    uintptr_t ahead = PREFETCH_WORDS / stride + 1;
+
+    for (uintptr_t i = 0; i < count; i++) {
+        if (i + ahead < count) {
+            __builtin_prefetch(start + (i + ahead) * stride, 0, 3);
+        }
+        testword_t *p = start + i * stride;
+        testword_t actual = read_word(p);
+        if (unlikely(actual != pattern)) {
+            data_error(p, pattern, actual, true);
+        }
+    }
+}
+
+static inline void check_pattern_word(testword_t *p, testword_t pattern)
+{
+    testword_t actual = read_word(p);
+    if (unlikely(actual != pattern)) {
+        data_error(p, pattern, actual, true);
+    }
+}
+
+static void pattern_check(testword_t *start, testword_t *end, testword_t pattern)
+{
+    uintptr_t n = end - start + 1;
+    uintptr_t i = 0;
+
+    while (i < n && ((uintptr_t)&start[i] & ALIGN_MASK)) {
+        check_pattern_word(&start[i], pattern);
+        i++;
+    }
+
+    vword_t vpattern = vbroadcast(pattern);
+
+    // A single stream of reads doesn't keep enough cache misses outstanding
+    // to saturate the memory controller on a large core, so read a group of
+    // consecutive blocks in parallel, each with its own accumulator.
+    while (n - i >= CHECK_STREAMS * CHECK_BLOCK_WORDS) {
+        testword_t *p = &start[i];
+        vword_t diff[CHECK_STREAMS] = { { 0 } };
+        for (uintptr_t j = 0; j < CHECK_BLOCK_WORDS; j += LANES) {
+            for (unsigned b = 0; b < CHECK_STREAMS; b++) {
+                diff[b] |= vread(p + b * CHECK_BLOCK_WORDS + j) ^ vpattern;
+            }
+        }
+        for (unsigned b = 0; b < CHECK_STREAMS; b++) {
+            if (unlikely(vnonzero(diff[b]))) {
+                report_pattern_errors(p + b * CHECK_BLOCK_WORDS, CHECK_BLOCK_WORDS, pattern, vfold(diff[b]));
+            }
+        }
+        i += CHECK_STREAMS * CHECK_BLOCK_WORDS;
+    }
+
+    // Keep one accumulator per unrolled vector, so the reads of a block are
+    // not serialised by a single dependency chain.
+    while (n - i >= STEP) {
+        uintptr_t count = (n - i < CHECK_BLOCK_WORDS) ? (n - i) & ~(uintptr_t)(STEP - 1) : CHECK_BLOCK_WORDS;
+        testword_t *p = &start[i];
+        vword_t diff[UNROLL] = { { 0 } };
+        for (uintptr_t j = 0; j < count; j += STEP) {
+            for (unsigned q = 0; q < UNROLL; q++) {
+                diff[q] |= vread(p + j + q * LANES) ^ vpattern;
+            }
+        }
+        for (unsigned q = 1; q < UNROLL; q++) {
+            diff[0] |= diff[q];
+        }
+        if (unlikely(vnonzero(diff[0]))) {
+            report_pattern_errors(p, count, pattern, vfold(diff[0]));
+        }
+        i += count;
+    }
+
+    while (i < n) {
+        check_pattern_word(&start[i], pattern);
+        i++;
+    }
+}
+
+// Lane k of vector q holds the address of word q * LANES + k of the step
+// starting at 'p', plus 'offset'. The addresses advance by a constant from
+// each step to the next.
+static inline void init_addr_vectors(vword_t vaddr[UNROLL], const testword_t *p, testword_t offset)
+{
+    for (unsigned q = 0; q < UNROLL; q++) {
+        for (unsigned k = 0; k < LANES; k++) {
+            vaddr[q][k] = (testword_t)(p + q * LANES + k) + offset;
+        }
+    }
+}
+
+static void addr_fill(testword_t *start, testword_t *end, testword_t offset)
+{
+    uintptr_t n = end - start + 1;
+    uintptr_t i = 0;
+
+    while (i < n && ((uintptr_t)&start[i] & ALIGN_MASK)) {
+        write_word(&start[i], (testword_t)&start[i] + offset);
+        i++;
+    }
+
+    if (n - i >= STEP) {
+        vword_t vaddr[UNROLL];
+        init_addr_vectors(vaddr, &start[i], offset);
+        vword_t vstep = vbroadcast(STEP * sizeof(testword_t));
+        do {
+            testword_t *p = &start[i];
+            for (unsigned q = 0; q < UNROLL; q++) {
+                vwrite(p + q * LANES, vaddr[q]);
+                vaddr[q] += vstep;
+            }
+            i += STEP;
+        } while (n - i >= STEP);
+    }
+
+    while (i < n) {
+        write_word(&start[i], (testword_t)&start[i] + offset);
+        i++;
+    }
+}
+
+static inline void check_addr_word(testword_t *p, testword_t offset)
+{
+    testword_t expect = (testword_t)p + offset;
+    testword_t actual = read_word(p);
+    if (unlikely(actual != expect)) {
+        data_error(p, expect, actual, true);
+    }
+}
+
+static void addr_check(testword_t *start, testword_t *end, testword_t offset)
+{
+    uintptr_t n = end - start + 1;
+    uintptr_t i = 0;
+
+    while (i < n && ((uintptr_t)&start[i] & ALIGN_MASK)) {
+        check_addr_word(&start[i], offset);
+        i++;
+    }
+
+    if (n - i >= STEP) {
+        vword_t vexpect[UNROLL];
+        init_addr_vectors(vexpect, &start[i], offset);
+        vword_t vstep = vbroadcast(STEP * sizeof(testword_t));
+        do {
+            testword_t *p = &start[i];
+            vword_t actual[UNROLL], diff = { 0 };
+            for (unsigned q = 0; q < UNROLL; q++) {
+                actual[q] = vread(p + q * LANES);
+                diff |= actual[q] ^ vexpect[q];
+            }
+            if (unlikely(vnonzero(diff))) {
+                report_errors(p, actual, vexpect, UNROLL);
+            }
+            for (unsigned q = 0; q < UNROLL; q++) {
+                vexpect[q] += vstep;
+            }
+            i += STEP;
+        } while (n - i >= STEP);
+    }
+
+    while (i < n) {
+        check_addr_word(&start[i], offset);
+        i++;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Public Variables
+//------------------------------------------------------------------------------
+
+const test_kernel_t CONCAT(SIMD_NAME, _kernel) = {
+    .name               = STRING(SIMD_NAME),
+    .check_write_up     = check_write_up,
+    .check_write_down   = check_write_down,
+    .walk_check_up      = walk_check_up,
+    .walk_check_down    = walk_check_down,
+    .wide_walk_fill     = wide_walk_fill,
+    .wide_walk_check_up = wide_walk_check_up,
+    .wide_walk_check_down = wide_walk_check_down,
+    .fill_nt            = fill_nt,
+    .random_fill        = random_fill,
+    .random_check_write = random_check_write,
+    .block_fill         = block_fill,
+    .copy_words         = copy_words,
+    .pair_check         = pair_check,
+    .strided_fill       = strided_fill,
+    .strided_check      = strided_check,
+    .pattern_check      = pattern_check,
+    .addr_fill          = addr_fill,
+    .addr_check         = addr_check
+};
@@ -18,9 +18,7 @@
 #include "boot.h"
 
 #include "cache.h"
-#include "cpuid.h"
 #include "memsize.h"
-#include "tsc.h"
 #include "vmem.h"
 
 #include "barrier.h"
@@ -43,6 +41,7 @@
 #endif
 
 #define MODULO_N            20
+#define MODULO_FUSED        4           // offsets per sweep (MODULO_N / MODULO_FUSED is odd, so the targets move through each cache line)
 
 //------------------------------------------------------------------------------
 // Public Variables
@@ -51,8 +50,8 @@
 test_pattern_t test_list[NUM_TEST_PATTERNS] = {
     // ena,  cpu, stgs, itrs, errs, description
     { true,  SEQ,    1,    6,    0, "[Address test, walking ones, no cache] "},
-    {false,  SEQ,    1,    6,    0, "[Address test, own address in window]  "},
-    { true,  SEQ,    2,    6,    0, "[Address test, own address + window]   "},
+    {false,  PAR,    1,    6,    0, "[Address test, own address in window]  "},
+    { true,  PAR,    2,    6,    0, "[Address test, own address + window]   "},
     { true,  PAR,    1,    6,    0, "[Moving inversions, 1s & 0s]           "},
     { true,  PAR,    1,    3,    0, "[Moving inversions, 8 bit pattern]     "},
     { true,  PAR,    1,   30,    0, "[Moving inversions, random pattern]    "},
@@ -65,24 +64,148 @@ test_pattern_t test_list[NUM_TEST_PATTERNS] = {
     { true,  PAR,    1,   48,    0, "[Random number sequence]               "},
     { true,  PAR,    1,    6,    0, "[Modulo 20, random pattern]            "},
     { true,  ONE,    6,  240,    0, "[Bit fade test, 2 patterns]            "},
+    { true,  PAR,    1,   48,    0, "[Row hammer, double-sided]             "},
+    {false,  PAR,    1,   60,    0, "[Stress, mixed streams]                "},
+    { true,  PAR,    1,    2,    0, "[Random order, own address]            "},
+    { true,  PAR,    1,   16,    0, "[Cache coherence, shared lines]        "},
+    {false,  ONE,    2,    3,    0, "[Retention scrub, random pattern]      "},
+    {false,  SEQ,    1,    4,    0, "[L3 cache, moving inversions by way]   "},
+};
+
+// The relative number of faults each test finds, for a given amount of
+// memory. These are rough weights, used to decide which tests to drop first
+// when the time for a pass is limited.
+const int test_yield[NUM_TEST_PATTERNS] = {
+    3,  // address test, walking ones
+    2,  // address test, own address in window
+    4,  // address test, own address + window
+    6,  // moving inversions, 1s & 0s
+    6,  // moving inversions, 8 bit pattern
+    8,  // moving inversions, random pattern
+    5,  // moving inversions, 32/64 bit pattern
+    7,  // block move
+    8,  // random number sequence
+    5,  // modulo 20, random pattern
+    4,  // bit fade
+    6,  // row hammer
+    1,  // stress
+    5,  // random order
+    2,  // cache coherence
+    3,  // retention scrub
+    2   // L3 cache
 };
 
 int ticks_per_pass[NUM_PASS_TYPES];
 int ticks_per_test[NUM_PASS_TYPES][NUM_TEST_PATTERNS];
+int delay_ticks_per_test[NUM_PASS_TYPES][NUM_TEST_PATTERNS];
+
+//------------------------------------------------------------------------------
+// Private Variables
+//------------------------------------------------------------------------------
+
+// Tests 3 to 5 all start by filling memory with a known pattern. When one of
+// these tests is followed by another, the last sweep of the first writes the
+// pattern the second starts with, so the second needn't fill memory itself.
+
+static int          prepared_test   = -1;   // the test memory was left ready for
+static bool         chained_in      = false;
+
+static int          chain_out_test  = -1;
+static testword_t   chain_out_pattern = 0;
+
+// The random patterns must be the same on all CPUs, as any CPU may test any
+// part of memory.
+static testword_t   test_prsg_start = 0;
+static testword_t   next_prsg_start = 0;
+
+//------------------------------------------------------------------------------
+// Private Functions
+//------------------------------------------------------------------------------
+
+static bool is_chainable(int test)
+{
+    return test >= 3 && test <= 5;
+}
+
+static testword_t random_start_state(int test)
+{
+    return pass_prsg_seed(test, 0);
+}
+
+static testword_t initial_pattern(int test)
+{
+    switch (test) {
+      case 3:
+        return 0;
+      case 4:
+#if TESTWORD_WIDTH > 32
+        return UINT64_C(0x8080808080808080);
+#else
+        return 0x80808080;
+#endif
+      default:
+        return next_prsg_start;
+    }
+}
+
+// Returns the pattern the last sweep of the current test should leave in
+// memory, given the pattern it would otherwise write.
+static testword_t exit_pattern(testword_t pattern)
+{
+    return chain_out_test >= 0 ? chain_out_pattern : pattern;
+}
+
+// Performs the ticks for the initial fill that was skipped because the
+// previous test left memory ready, so the progress display stays in step
+// with the estimated test duration.
+static int skip_fill(int my_cpu)
+{
+    int ticks = 0;
+
+    for (int i = 0; i < vm_map_size; i++) {
+        int segment_ticks = setup_work_units(-1, i);
+        ticks += segment_ticks;
+        if (my_cpu < 0) {
+            continue;
+        }
+        for (int iter = 0; iter < segment_ticks; iter++) {
+            do_tick(my_cpu);
+            BAILOUT;
+        }
+    }
+    return ticks;
+}
+
+// The uncached mapping can only be used if all the memory in the current
+// window lies within a single VM_WINDOW_SIZE region of physical memory.
+static bool use_uncached_window(int my_cpu)
+{
+    if (my_cpu < 0 || vm_map_size == 0) {
+        return false;
+    }
+    uintptr_t window = page_of(vm_map[0].start) / VM_WINDOW_SIZE;
+    if (page_of(vm_map[vm_map_size - 1].end) / VM_WINDOW_SIZE != window) {
+        return false;
+    }
+    return map_window_uncached(page_of(vm_map[0].start));
+}
 
 //------------------------------------------------------------------------------
 // Public Functions
 //------------------------------------------------------------------------------
 
+// When the proximity domains are running different tests, the phases of each
+// test only need to be synchronised within each domain.
 #define BARRIER \
     if (my_cpu >= 0) { \
+        barrier_t *phase_barrier = mixed_tests ? &domain_barrier[smp_get_proximity_domain_idx(my_cpu)] : run_barrier; \
         if (TRACE_BARRIERS) { \
             trace(my_cpu, "Run barrier wait begin at %s line %i", __FILE__, __LINE__); \
         } \
         if (power_save < POWER_SAVE_HIGH) { \
-            barrier_spin_wait(run_barrier); \
+            barrier_spin_wait(phase_barrier); \
         } else { \
-            barrier_halt_wait(run_barrier); \
+            barrier_halt_wait(phase_barrier); \
         } \
         if (TRACE_BARRIERS) { \
             trace(my_cpu, "Run barrier wait end at %s line %i", __FILE__, __LINE__); \
@@ -116,9 +239,17 @@ int run_test(int my_cpu, int test, int stage, int iterations)
     switch (test) {
         // Address test, walking ones.
       case 0:
-        if (my_cpu >= 0) cache_off();
-        ticks += test_addr_walk1(my_cpu);
-        if (my_cpu >= 0) cache_on();
+        if (use_uncached_window(my_cpu)) {
+            // Only the memory under test is uncached, so we just need to make
+            // sure none of it remains in the caches.
+            cache_flush();
+            ticks += test_addr_walk1(my_cpu, true);
+            map_window(vm_map[0].pm_base_addr);
+        } else {
+            if (my_cpu >= 0) cache_off();
+            ticks += test_addr_walk1(my_cpu, false);
+            if (my_cpu >= 0) cache_on();
+        }
         BAILOUT;
         break;
 
@@ -135,58 +266,70 @@ int run_test(int my_cpu, int test, int stage, int iterations)
         break;
 
         // Moving inversions, all ones and zeros.
+        //
+        // In this and the following two tests, the last sweep of each call
+        // writes the pattern checked by the next call, so memory is only
+        // initialised once.
       case 3: {
         testword_t pattern1 = 0;
         testword_t pattern2 = ~pattern1;
 
+        if (chained_in) {
+            ticks += skip_fill(my_cpu);
+            BAILOUT;
+        }
+
         BARRIER;
-        ticks += test_mov_inv_fixed(my_cpu, iterations, pattern1, pattern2);
+        ticks += test_mov_inv_fixed(my_cpu, iterations, pattern1, pattern2, chained_in, pattern2);
         BAILOUT;
 
         BARRIER;
-        ticks += test_mov_inv_fixed(my_cpu, iterations, pattern2, pattern1);
+        ticks += test_mov_inv_fixed(my_cpu, iterations, pattern2, pattern1, true, exit_pattern(pattern1));
         BAILOUT;
       } break;
 
         // Moving inversions, 8 bit walking ones and zeros.
       case 4: {
-#if TESTWORD_WIDTH > 32
-            testword_t pattern1 = UINT64_C(0x8080808080808080);
-#else
-            testword_t pattern1 = 0x80808080;
-#endif
+        testword_t pattern1 = initial_pattern(4);
+
+        if (chained_in) {
+            ticks += skip_fill(my_cpu);
+            BAILOUT;
+        }
         for (int i = 0; i < 8; i++) {
             testword_t pattern2 = ~pattern1;
+            testword_t next_pattern1 = pattern1 >> 1;
 
             BARRIER;
-            ticks += test_mov_inv_fixed(my_cpu, iterations, pattern1, pattern2);
+            ticks += test_mov_inv_fixed(my_cpu, iterations, pattern1, pattern2, i > 0 || chained_in, pattern2);
             BAILOUT;
 
             BARRIER;
-            ticks += test_mov_inv_fixed(my_cpu, iterations, pattern2, pattern1);
+            ticks += test_mov_inv_fixed(my_cpu, iterations, pattern2, pattern1, true,
+                                        i == 7 ? exit_pattern(next_pattern1) : next_pattern1);
             BAILOUT;
 
-            pattern1 >>= 1;
+            pattern1 = next_pattern1;
         }
       } break;
 
         // Moving inversions, fixed random pattern.
       case 5:
-        if (cpuid_info.flags.rdtsc) {
-            prsg_state = get_tsc();
-        } else {
-            prsg_state = 1 + pass_num;
-        }
-        prsg_state *= 0x12345678;
+        prsg_state = test_prsg_start;
 
+        if (chained_in) {
+            ticks += skip_fill(my_cpu);
+            BAILOUT;
+        }
         for (int i = 0; i < iterations; i++) {
-            prsg_state = prsg(prsg_state);
-
             testword_t pattern1 = prsg_state;
             testword_t pattern2 = ~pattern1;
 
+            prsg_state = prsg(prsg_state);
+
             BARRIER;
-            ticks += test_mov_inv_fixed(my_cpu, 2, pattern1, pattern2);
+            ticks += test_mov_inv_fixed(my_cpu, 2, pattern1, pattern2, i > 0 || chained_in,
+                                        i == iterations - 1 ? exit_pattern(prsg_state) : prsg_state);
             BAILOUT;
         }
         break;
@@ -214,33 +357,32 @@ int run_test(int my_cpu, int test, int stage, int iterations)
       case 8:
         for (int i = 0; i < iterations; i++) {
             BARRIER;
-            ticks += test_mov_inv_random(my_cpu);
+            ticks += test_mov_inv_random(my_cpu, pass_prsg_seed(test, i));
             BAILOUT;
         }
         break;
 
         // Modulo 20 check, fixed random pattern.
       case 9:
-        if (cpuid_info.flags.rdtsc) {
-            prsg_state = get_tsc();
-        } else {
-            prsg_state = 1 + pass_num;
-        }
-        prsg_state *= 0x87654321;
+        prsg_state = test_prsg_start;
 
+        // Each call tests MODULO_FUSED offsets, each with its own pattern.
         for (int i = 0; i < iterations; i++) {
-            for (int offset = 0; offset < MODULO_N; offset++) {
-                prsg_state = prsg(prsg_state);
-
-                testword_t pattern1 = prsg_state;
-                testword_t pattern2 = ~pattern1;
+            for (int offset = 0; offset < MODULO_N / MODULO_FUSED; offset++) {
+                testword_t pattern1[MODULO_FUSED];
+                testword_t pattern2[MODULO_FUSED];
+                for (int j = 0; j < MODULO_FUSED; j++) {
+                    prsg_state = prsg(prsg_state);
+                    pattern1[j] = prsg_state;
+                    pattern2[j] = ~pattern1[j];
+                }
 
                 BARRIER;
-                ticks += test_modulo_n(my_cpu, 2, pattern1, pattern2, MODULO_N, offset);
+                ticks += test_modulo_n_fused(my_cpu, 2, pattern1, MODULO_N, offset, MODULO_FUSED);
                 BAILOUT;
 
                 BARRIER;
-                ticks += test_modulo_n(my_cpu, 2, pattern2, pattern1, MODULO_N, offset);
+                ticks += test_modulo_n_fused(my_cpu, 2, pattern2, MODULO_N, offset, MODULO_FUSED);
                 BAILOUT;
             }
         }
@@ -251,6 +393,139 @@ int run_test(int my_cpu, int test, int stage, int iterations)
         ticks += test_bit_fade(my_cpu, stage, iterations);
         BAILOUT;
         break;
+
+        // Row hammer, all zeros and all ones.
+      case 11:
+        BARRIER;
+        ticks += test_row_hammer(my_cpu, iterations, 0);
+        BAILOUT;
+
+        BARRIER;
+        ticks += test_row_hammer(my_cpu, iterations, ~(testword_t)0);
+        BAILOUT;
+        break;
+
+        // Stress, mixed read, write, and copy streams.
+      case 12:
+        ticks += test_stress(my_cpu, iterations);
+        BAILOUT;
+        break;
+
+        // Own address, cache lines visited in random order.
+      case 13:
+        BARRIER;
+        ticks += test_random_order(my_cpu, iterations, pass_prsg_seed(test, 0));
+        BAILOUT;
+        break;
+
+        // Cache coherence, lines shared by all the CPUs.
+      case 14:
+        BARRIER;
+        ticks += test_coherence(my_cpu, iterations, pass_prsg_seed(test, 0));
+        BAILOUT;
+        break;
+
+        // Retention scrub, slow read-only sweeps of a single fill.
+      case 15:
+        ticks += test_retention(my_cpu, stage, pass_prsg_seed(test, 0));
+        BAILOUT;
+        break;
+
+        // L3 cache, moving inversions in each group of cache ways.
+      case 16:
+        ticks += test_llc(my_cpu, iterations, pass_prsg_seed(test, 0));
+        BAILOUT;
+        break;
     }
     return ticks;
 }
+
+void chain_test_start(int test, int next_test)
+{
+    chained_in = (test == prepared_test);
+    prepared_test = -1;
+
+    // When the tests are mixed, tests 5 and 9 may be run at the same time as
+    // another test, so always choose a start state.
+    test_prsg_start = (chained_in && test == 5) ? next_prsg_start : random_start_state(test);
+
+    chain_out_test = -1;
+    if (is_chainable(test) && is_chainable(next_test)) {
+        if (next_test == 5) {
+            next_prsg_start = random_start_state(next_test);
+        }
+        chain_out_test    = next_test;
+        chain_out_pattern = initial_pattern(next_test);
+    }
+}
+
+void chain_test_end(bool completed)
+{
+    prepared_test = completed ? chain_out_test : -1;
+    chain_out_test = -1;
+}
+
+int estimate_test_ticks(int test, int stage, int iterations, int sweep_ticks, int num_windows)
+{
+    // Each test function performs one tick for each spin_size block (or part
+    // block) of each segment it sweeps through, so the totals follow from the
+    // number of sweeps each test makes.
+    int mov_inv_ticks = sweep_ticks * (1 + 2 * iterations);
+
+    switch (test) {
+      case 0:
+        return 2 * num_windows;
+      case 1:
+        return 2 * sweep_ticks;
+      case 2:
+        return sweep_ticks;
+      case 3:
+        // Memory is only initialised by the first call in tests 3 to 5.
+        return sweep_ticks * (1 + 2 * 2 * iterations);
+      case 4:
+        return sweep_ticks * (1 + 16 * 2 * iterations);
+      case 5:
+        return iterations > 0 ? sweep_ticks * (1 + iterations * 4) : 0;
+      case 6:
+        return 2 * TESTWORD_WIDTH * mov_inv_ticks;
+      case 7:
+        return (2 + iterations) * sweep_ticks;
+      case 8:
+        return iterations * 3 * sweep_ticks;
+      case 9:
+        return iterations * (MODULO_N / MODULO_FUSED) * 2 * 4 * sweep_ticks;
+      case 10:
+        // The fade delay is only performed once, not once per window.
+        return (stage == 1 || stage == 4) ? iterations : sweep_ticks;
+      case 11:
+        // Each iteration hammers the rows around one victim in each window.
+        return 2 * (2 * sweep_ticks + iterations * num_windows);
+      case 12:
+      case 13:
+        return (2 + iterations) * sweep_ticks;
+      case 14:
+        // Only a few cache lines in each window are used.
+        return iterations * num_windows;
+      case 15:
+        // One fill, or one sweep. The number of sweeps isn't known in advance.
+        return sweep_ticks;
+      case 16:
+        // Only a cache-sized buffer in each window is used.
+        return iterations * num_windows;
+      default:
+        return 0;
+    }
+}
+
+int estimate_delay_ticks(int test, int stage, int iterations)
+{
+    if (test == 10 && (stage == 1 || stage == 4)) {
+        return iterations;
+    }
+    return 0;
+}
+
+bool repeat_test_stage(int test, int stage, int iterations)
+{
+    return test == 15 && stage == 1 && retention_next_sweep(iterations);
+}
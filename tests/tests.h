@@ -14,7 +14,7 @@
 
 #include "config.h"
 
-#define NUM_TEST_PATTERNS   11
+#define NUM_TEST_PATTERNS   17
 
 typedef struct {
     bool            enabled;
@@ -27,11 +27,57 @@ typedef struct {
 
 extern test_pattern_t test_list[NUM_TEST_PATTERNS];
 
+/**
+ * The relative fault-detection yield of each test.
+ */
+extern const int test_yield[NUM_TEST_PATTERNS];
+
 typedef enum { FAST_PASS, FULL_PASS, NUM_PASS_TYPES } pass_type_t;
 
 extern int ticks_per_pass[NUM_PASS_TYPES];
 extern int ticks_per_test[NUM_PASS_TYPES][NUM_TEST_PATTERNS];
 
+/**
+ * The number of the ticks in each test that are one second delays rather
+ * than memory accesses.
+ */
+extern int delay_ticks_per_test[NUM_PASS_TYPES][NUM_TEST_PATTERNS];
+
 int run_test(int my_cpu, int test, int stage, int iterations);
 
+/**
+ * Tells the tests which test is about to be run and which test will be run
+ * straight after it over the same memory (or -1 if that isn't known). Where
+ * possible, the last sweep of the test then leaves memory filled with the
+ * pattern the next test starts with, and the next test skips its initial
+ * fill. Must be called before each test is run over the first window.
+ */
+void chain_test_start(int test, int next_test);
+
+/**
+ * Tells the tests the current test has finished. If it was not completed,
+ * the next test initialises memory itself.
+ */
+void chain_test_end(bool completed);
+
+/**
+ * Returns the number of ticks run_test() will perform for the specified test
+ * stage when run by a single CPU, given the number of ticks taken by one
+ * sweep through the memory under test and the number of windows containing
+ * memory under test.
+ */
+int estimate_test_ticks(int test, int stage, int iterations, int sweep_ticks, int num_windows);
+
+/**
+ * Returns how many of the ticks estimated for the specified test stage are
+ * one second delays.
+ */
+int estimate_delay_ticks(int test, int stage, int iterations);
+
+/**
+ * Returns true if the specified test stage, which has just been run over all
+ * the windows, should be run again.
+ */
+bool repeat_test_stage(int test, int stage, int iterations);
+
 #endif // TESTS_H